@@ -0,0 +1,214 @@
+#include "AllocationTracer.h"
+#include <cstdlib>
+#include <new>
+
+// Constant initialised, so allocations made by other globals' constructors before main are safe to count.
+static AllocationCounter totals;
+static thread_local AllocationCounter* current = nullptr;
+
+static void countAllocation(size_t size)
+{
+	totals.allocations.fetch_add(1, std::memory_order_relaxed);
+	totals.bytes.fetch_add(size, std::memory_order_relaxed);
+	if (current) {
+		current->allocations.fetch_add(1, std::memory_order_relaxed);
+		current->bytes.fetch_add(size, std::memory_order_relaxed);
+	}
+}
+
+static void countFree()
+{
+	totals.frees.fetch_add(1, std::memory_order_relaxed);
+	if (current) {
+		current->frees.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+AllocationCounts getAllocationCounts()
+{
+	return totals.get();
+}
+
+AllocationScope::AllocationScope(AllocationCounter* counter) : previous(current)
+{
+	current = counter;
+}
+
+AllocationScope::~AllocationScope()
+{
+	current = previous;
+}
+
+AllocationCounter* AllocationScope::getCurrent()
+{
+	return current;
+}
+
+void* tracedMalloc(size_t size, void*)
+{
+	countAllocation(size);
+	return std::malloc(size);
+}
+
+void tracedFree(void* pointer, void*)
+{
+	if (pointer) {
+		countFree();
+		std::free(pointer);
+	}
+}
+
+static void* allocate(size_t size)
+{
+	void* pointer = std::malloc(size ? size : 1);
+	if (pointer)
+		countAllocation(size);
+	return pointer;
+}
+
+static void* allocateAligned(size_t size, std::align_val_t alignment)
+{
+	size_t align = static_cast<size_t>(alignment);
+#ifdef _MSC_VER
+	void* pointer = _aligned_malloc(size ? size : 1, align);
+#else
+	void* pointer = std::aligned_alloc(align, (size + align - 1) / align * align + (size ? 0 : align));
+#endif
+	if (pointer)
+		countAllocation(size);
+	return pointer;
+}
+
+static void release(void* pointer)
+{
+	if (pointer) {
+		countFree();
+		std::free(pointer);
+	}
+}
+
+static void releaseAligned(void* pointer)
+{
+	if (pointer) {
+		countFree();
+#ifdef _MSC_VER
+		_aligned_free(pointer);
+#else
+		std::free(pointer);
+#endif
+	}
+}
+
+// Every replaceable form, plain, array, aligned, nothrow and sized. The standard has the rest default to the plain
+// ones, but a library is free to route them elsewhere and the compiler emits the sized deletes directly.
+void* operator new(size_t size)
+{
+	void* pointer = allocate(size);
+	if (!pointer)
+		throw std::bad_alloc();
+	return pointer;
+}
+
+void* operator new[](size_t size)
+{
+	void* pointer = allocate(size);
+	if (!pointer)
+		throw std::bad_alloc();
+	return pointer;
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+	void* pointer = allocateAligned(size, alignment);
+	if (!pointer)
+		throw std::bad_alloc();
+	return pointer;
+}
+
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+	void* pointer = allocateAligned(size, alignment);
+	if (!pointer)
+		throw std::bad_alloc();
+	return pointer;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	return allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+	return allocate(size);
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return allocateAligned(size, alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return allocateAligned(size, alignment);
+}
+
+void operator delete(void* pointer) noexcept
+{
+	release(pointer);
+}
+
+void operator delete[](void* pointer) noexcept
+{
+	release(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept
+{
+	release(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept
+{
+	release(pointer);
+}
+
+void operator delete(void* pointer, const std::nothrow_t&) noexcept
+{
+	release(pointer);
+}
+
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept
+{
+	release(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t) noexcept
+{
+	releaseAligned(pointer);
+}
+
+void operator delete[](void* pointer, std::align_val_t) noexcept
+{
+	releaseAligned(pointer);
+}
+
+void operator delete(void* pointer, size_t, std::align_val_t) noexcept
+{
+	releaseAligned(pointer);
+}
+
+void operator delete[](void* pointer, size_t, std::align_val_t) noexcept
+{
+	releaseAligned(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t, const std::nothrow_t&) noexcept
+{
+	releaseAligned(pointer);
+}
+
+void operator delete[](void* pointer, std::align_val_t, const std::nothrow_t&) noexcept
+{
+	releaseAligned(pointer);
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+struct AllocationCounts {
+	uint64_t allocations = 0;
+	uint64_t frees = 0;
+	uint64_t bytes = 0;
+
+	AllocationCounts operator-(const AllocationCounts& other) const {
+		return { allocations - other.allocations, frees - other.frees, bytes - other.bytes };
+	}
+};
+
+// Counts towards whatever the threads it's scoped on allocate. Bytes are what was asked for, frees don't know theirs.
+struct AllocationCounter {
+	std::atomic<uint64_t> allocations{ 0 };
+	std::atomic<uint64_t> frees{ 0 };
+	std::atomic<uint64_t> bytes{ 0 };
+
+	AllocationCounts get() const { return { allocations.load(), frees.load(), bytes.load() }; }
+};
+
+// Global operator new and delete are replaced in AllocationTracer.cpp, so every heap allocation made through them by
+// any thread since startup is counted here. malloc from C code isn't, unless it goes through tracedMalloc.
+AllocationCounts getAllocationCounts();
+
+// Also charges the calling thread's allocations to counter until it goes out of scope, nested scopes put the outer
+// one back. JobSystem::parallelFor carries the caller's counter over to the workers for the length of the call.
+class AllocationScope
+{
+public:
+	explicit AllocationScope(AllocationCounter* counter);
+	~AllocationScope();
+
+	AllocationScope(const AllocationScope&) = delete;
+	AllocationScope& operator=(const AllocationScope&) = delete;
+
+	// The calling thread's, null outside any scope.
+	static AllocationCounter* getCurrent();
+
+private:
+	AllocationCounter* previous;
+};
+
+// Counted malloc and free for libraries that take allocator hooks, ImGui's SetAllocatorFunctions among them.
+void* tracedMalloc(size_t size, void* user = nullptr);
+void tracedFree(void* pointer, void* user = nullptr);
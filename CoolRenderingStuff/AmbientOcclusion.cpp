@@ -0,0 +1,882 @@
+#include "AmbientOcclusion.h"
+#include "JobSystem.h"
+#include <xmmintrin.h>
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+using namespace DirectX;
+
+static const uint32_t OCCLUSION_FILE_MAGIC = 0x314f4141; // "AAO1"
+static const uint32_t OCCLUSION_FILE_VERSION = 1;
+
+struct OcclusionFileHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t raysPerVertex;
+	float maxDistance;
+	float bias;
+	uint32_t meshCount;
+	// Of every mesh's positions, normals and indices and every instance's mesh and world matrix.
+	uint64_t hash;
+};
+
+// Vertices traced per job.
+static const uint32_t OCCLUSION_BATCH = 64;
+// Deeper than any tree the SAH build makes out of a real scene, the build throws rather than go past it.
+static const uint32_t MAX_BVH_DEPTH = 64;
+// Triangles bigger than the scene's longest side over this are split into pieces before the build.
+static const float REFERENCE_CELLS = 16.0f;
+// Halvings per triangle at most, so a triangle makes at most 2^MAX_REFERENCE_SPLITS references.
+static const uint32_t MAX_REFERENCE_SPLITS = 8;
+
+// Directions this close to parallel to an axis are nudged off it, so a slab test never multiplies 0 by infinity.
+static float safeInverse(float d)
+{
+	return 1.0f / (std::fabs(d) > 1e-20f ? d : (d < 0.0f ? -1e-20f : 1e-20f));
+}
+
+struct BuildBounds {
+	XMFLOAT3 min = { FLT_MAX, FLT_MAX, FLT_MAX };
+	XMFLOAT3 max = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+	void grow(const XMFLOAT3& p) {
+		min = { std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z) };
+		max = { std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z) };
+	}
+
+	void grow(const BuildBounds& b) {
+		// An empty bin's inverted bounds would otherwise stretch these to infinity.
+		if (b.max.x < b.min.x)
+			return;
+		grow(b.min);
+		grow(b.max);
+	}
+
+	float area() const {
+		float x = max.x - min.x, y = max.y - min.y, z = max.z - min.z;
+		return (x < 0.0f) ? 0.0f : 2.0f * (x * y + y * z + z * x);
+	}
+};
+
+static float getAxis(const XMFLOAT3& v, uint32_t axis)
+{
+	return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+static void setAxis(XMFLOAT3& v, uint32_t axis, float value)
+{
+	(axis == 0 ? v.x : (axis == 1 ? v.y : v.z)) = value;
+}
+
+// A piece of a triangle the tree is built over. Most triangles are one reference, a big one is several with the bounds
+// of the part of it in each, so a floor doesn't drag a box the size of the room all the way down to the leaves.
+struct BuildReference {
+	BuildBounds bounds;
+	XMFLOAT3 centroid;
+	uint32_t triangle;
+};
+
+// Each clip adds a point at most, so a triangle never gets past this many.
+struct ClipPolygon {
+	XMFLOAT3 points[3 + MAX_REFERENCE_SPLITS];
+	uint32_t count;
+};
+
+static void clipPolygon(const ClipPolygon& polygon, uint32_t axis, float plane, ClipPolygon& below, ClipPolygon& above)
+{
+	below.count = 0;
+	above.count = 0;
+
+	for (uint32_t i = 0; i < polygon.count; i++) {
+		const XMFLOAT3& a = polygon.points[i];
+		const XMFLOAT3& b = polygon.points[(i + 1) % polygon.count];
+		float da = getAxis(a, axis) - plane;
+		float db = getAxis(b, axis) - plane;
+
+		if (da <= 0.0f)
+			below.points[below.count++] = a;
+		if (da >= 0.0f)
+			above.points[above.count++] = a;
+
+		if ((da < 0.0f && db > 0.0f) || (da > 0.0f && db < 0.0f)) {
+			float t = da / (da - db);
+			XMFLOAT3 crossing = { a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t };
+			setAxis(crossing, axis, plane);
+			below.points[below.count++] = crossing;
+			above.points[above.count++] = crossing;
+		}
+	}
+}
+
+// Halves the piece across its longest side until it's no bigger than maxExtent. Bounds are padded a little so rounding
+// in the clip can't open a gap between two pieces.
+static void splitReference(const ClipPolygon& polygon, uint32_t triangle, float maxExtent, float padding, uint32_t splits, std::vector<BuildReference>& out)
+{
+	BuildReference reference;
+	reference.triangle = triangle;
+	for (uint32_t i = 0; i < polygon.count; i++) {
+		reference.bounds.grow(polygon.points[i]);
+	}
+
+	XMFLOAT3 extent = {
+		reference.bounds.max.x - reference.bounds.min.x,
+		reference.bounds.max.y - reference.bounds.min.y,
+		reference.bounds.max.z - reference.bounds.min.z,
+	};
+	uint32_t axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+
+	if (splits == MAX_REFERENCE_SPLITS || getAxis(extent, axis) <= maxExtent) {
+		reference.bounds.min = { reference.bounds.min.x - padding, reference.bounds.min.y - padding, reference.bounds.min.z - padding };
+		reference.bounds.max = { reference.bounds.max.x + padding, reference.bounds.max.y + padding, reference.bounds.max.z + padding };
+		reference.centroid = {
+			(reference.bounds.min.x + reference.bounds.max.x) * 0.5f,
+			(reference.bounds.min.y + reference.bounds.max.y) * 0.5f,
+			(reference.bounds.min.z + reference.bounds.max.z) * 0.5f,
+		};
+		out.push_back(reference);
+		return;
+	}
+
+	ClipPolygon below, above;
+	clipPolygon(polygon, axis, getAxis(reference.bounds.min, axis) + getAxis(extent, axis) * 0.5f, below, above);
+
+	// A side that only touches the plane has nothing the other side doesn't.
+	if (below.count >= 3)
+		splitReference(below, triangle, maxExtent, padding, splits + 1, out);
+	if (above.count >= 3)
+		splitReference(above, triangle, maxExtent, padding, splits + 1, out);
+}
+
+struct BVHBuilder {
+	const std::vector<BuildReference>& input;
+	std::vector<uint32_t>& order;
+	std::vector<TriangleBVH::Node>& nodes;
+	uint32_t depth = 0;
+
+	// Splits [begin, end) of order at the cheapest of SAH_BINS planes on each axis, or makes it a leaf when no split
+	// beats intersecting every triangle. Falls back to a median split when a leaf would be too big.
+	void build(uint32_t begin, uint32_t end, uint32_t level) {
+		if (level >= MAX_BVH_DEPTH) {
+			throw std::runtime_error("BVH too deep");
+		}
+		depth = std::max(depth, level + 1);
+
+		uint32_t nodeIndex = static_cast<uint32_t>(nodes.size());
+		nodes.emplace_back();
+
+		BuildBounds bounds, centroidBounds;
+		for (uint32_t i = begin; i < end; i++) {
+			bounds.grow(input[order[i]].bounds);
+			centroidBounds.grow(input[order[i]].centroid);
+		}
+
+		nodes[nodeIndex].min = bounds.min;
+		nodes[nodeIndex].max = bounds.max;
+
+		uint32_t count = end - begin;
+		auto makeLeaf = [&]() {
+			nodes[nodeIndex].offset = begin;
+			nodes[nodeIndex].count = static_cast<uint16_t>(count);
+			nodes[nodeIndex].axis = 0;
+		};
+
+		if (count <= 1) {
+			makeLeaf();
+			return;
+		}
+
+		float bestCost = FLT_MAX;
+		uint32_t bestAxis = 0;
+		uint32_t bestSplit = 0;
+
+		for (uint32_t axis = 0; axis < 3; axis++) {
+			float lo = getAxis(centroidBounds.min, axis);
+			float extent = getAxis(centroidBounds.max, axis) - lo;
+			if (!(extent > 0.0f))
+				continue;
+
+			BuildBounds binBounds[TriangleBVH::SAH_BINS];
+			uint32_t binCounts[TriangleBVH::SAH_BINS] = {};
+			float scale = TriangleBVH::SAH_BINS / extent;
+
+			for (uint32_t i = begin; i < end; i++) {
+				auto& reference = input[order[i]];
+				uint32_t bin = std::min(TriangleBVH::SAH_BINS - 1, static_cast<uint32_t>((getAxis(reference.centroid, axis) - lo) * scale));
+				binBounds[bin].grow(reference.bounds);
+				binCounts[bin]++;
+			}
+
+			// Right to left sweep first, then the left side is grown bin by bin against it.
+			float rightAreas[TriangleBVH::SAH_BINS];
+			uint32_t rightCounts[TriangleBVH::SAH_BINS];
+			BuildBounds right;
+			uint32_t rightCount = 0;
+			for (uint32_t bin = TriangleBVH::SAH_BINS - 1; bin > 0; bin--) {
+				right.grow(binBounds[bin]);
+				rightCount += binCounts[bin];
+				rightAreas[bin] = right.area();
+				rightCounts[bin] = rightCount;
+			}
+
+			BuildBounds left;
+			uint32_t leftCount = 0;
+			for (uint32_t split = 1; split < TriangleBVH::SAH_BINS; split++) {
+				left.grow(binBounds[split - 1]);
+				leftCount += binCounts[split - 1];
+				if (leftCount == 0 || rightCounts[split] == 0)
+					continue;
+
+				float cost = left.area() * leftCount + rightAreas[split] * rightCounts[split];
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = split;
+				}
+			}
+		}
+
+		// Relative to the node's area, a traversal step costs about as much as a triangle.
+		bool worthSplitting = bestCost < FLT_MAX && 1.0f + bestCost / std::max(bounds.area(), FLT_MIN) < static_cast<float>(count);
+		if (!worthSplitting && count <= TriangleBVH::MAX_LEAF_TRIANGLES) {
+			makeLeaf();
+			return;
+		}
+
+		uint32_t middle;
+		if (bestCost < FLT_MAX) {
+			float lo = getAxis(centroidBounds.min, bestAxis);
+			float scale = TriangleBVH::SAH_BINS / (getAxis(centroidBounds.max, bestAxis) - lo);
+			middle = static_cast<uint32_t>(std::partition(order.begin() + begin, order.begin() + end, [&](uint32_t index) {
+				return std::min(TriangleBVH::SAH_BINS - 1, static_cast<uint32_t>((getAxis(input[index].centroid, bestAxis) - lo) * scale)) < bestSplit;
+			}) - order.begin());
+		}
+		else {
+			// Every centroid in the same place, any split is as good as any other.
+			middle = begin + count / 2;
+		}
+
+		nodes[nodeIndex].count = 0;
+		nodes[nodeIndex].axis = static_cast<uint16_t>(bestAxis);
+
+		build(begin, middle, level + 1);
+		nodes[nodeIndex].offset = static_cast<uint32_t>(nodes.size());
+		build(middle, end, level + 1);
+	}
+};
+
+void TriangleBVH::build(const SceneData& scene)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	nodes.clear();
+	triangles.clear();
+
+	std::vector<Triangle> unordered;
+	std::vector<BuildBounds> triangleBounds;
+	BuildBounds sceneBounds;
+
+	for (auto& instance : scene.instances) {
+		auto& mesh = scene.meshes[instance.mesh];
+		auto world = getInstanceWorld(scene.graph, instance);
+
+		std::vector<XMFLOAT3> positions(mesh.vertices.size());
+		for (size_t i = 0; i < mesh.vertices.size(); i++) {
+			XMStoreFloat3(&positions[i], XMVector3TransformCoord(XMLoadFloat3(&mesh.vertices[i].position), world));
+		}
+
+		for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+			auto& p0 = positions[mesh.indices[i + 0]];
+			auto& p1 = positions[mesh.indices[i + 1]];
+			auto& p2 = positions[mesh.indices[i + 2]];
+
+			Triangle triangle;
+			triangle.v0 = p0;
+			triangle.edge1 = { p1.x - p0.x, p1.y - p0.y, p1.z - p0.z };
+			triangle.edge2 = { p2.x - p0.x, p2.y - p0.y, p2.z - p0.z };
+			unordered.push_back(triangle);
+
+			BuildBounds bounds;
+			bounds.grow(p0);
+			bounds.grow(p1);
+			bounds.grow(p2);
+			triangleBounds.push_back(bounds);
+			sceneBounds.grow(bounds);
+		}
+	}
+
+	float sceneExtent = std::max({ sceneBounds.max.x - sceneBounds.min.x, sceneBounds.max.y - sceneBounds.min.y, sceneBounds.max.z - sceneBounds.min.z, 0.0f });
+	float maxExtent = sceneExtent / REFERENCE_CELLS;
+
+	triangleCount = static_cast<uint32_t>(unordered.size());
+
+	std::vector<BuildReference> input;
+	input.reserve(unordered.size());
+	for (uint32_t i = 0; i < unordered.size(); i++) {
+		auto& triangle = unordered[i];
+		auto& bounds = triangleBounds[i];
+
+		ClipPolygon polygon;
+		polygon.count = 3;
+		polygon.points[0] = triangle.v0;
+		polygon.points[1] = { triangle.v0.x + triangle.edge1.x, triangle.v0.y + triangle.edge1.y, triangle.v0.z + triangle.edge1.z };
+		polygon.points[2] = { triangle.v0.x + triangle.edge2.x, triangle.v0.y + triangle.edge2.y, triangle.v0.z + triangle.edge2.z };
+
+		float padding = 1e-6f * std::max({ std::fabs(bounds.min.x), std::fabs(bounds.min.y), std::fabs(bounds.min.z),
+			std::fabs(bounds.max.x), std::fabs(bounds.max.y), std::fabs(bounds.max.z), 1.0f });
+		splitReference(polygon, i, maxExtent, padding, 0, input);
+	}
+
+	std::vector<uint32_t> order(input.size());
+	for (uint32_t i = 0; i < order.size(); i++) {
+		order[i] = i;
+	}
+
+	depth = 0;
+	if (!input.empty()) {
+		nodes.reserve(input.size() * 2);
+
+		BVHBuilder builder{ input, order, nodes };
+		builder.build(0, static_cast<uint32_t>(input.size()), 0);
+		depth = builder.depth;
+	}
+
+	// Leaves point into the triangles in the order the build left them, a split triangle copied into each of its leaves.
+	triangles.resize(order.size());
+	for (size_t i = 0; i < order.size(); i++) {
+		triangles[i] = unordered[input[order[i]].triangle];
+	}
+
+	buildMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+// Moller-Trumbore against four rays, two sided. The scalar version below has to stay the same maths op for op.
+static inline __m128 intersectTriangle4(const TriangleBVH::Triangle& triangle, __m128 ox, __m128 oy, __m128 oz, __m128 dx, __m128 dy, __m128 dz, __m128 maxT)
+{
+	__m128 e1x = _mm_set1_ps(triangle.edge1.x), e1y = _mm_set1_ps(triangle.edge1.y), e1z = _mm_set1_ps(triangle.edge1.z);
+	__m128 e2x = _mm_set1_ps(triangle.edge2.x), e2y = _mm_set1_ps(triangle.edge2.y), e2z = _mm_set1_ps(triangle.edge2.z);
+
+	// p = d x e2
+	__m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+	__m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+	__m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+	__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+	__m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+	__m128 sx = _mm_sub_ps(ox, _mm_set1_ps(triangle.v0.x));
+	__m128 sy = _mm_sub_ps(oy, _mm_set1_ps(triangle.v0.y));
+	__m128 sz = _mm_sub_ps(oz, _mm_set1_ps(triangle.v0.z));
+	__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), invDet);
+
+	// q = s x e1
+	__m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+	__m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+	__m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+	__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+	__m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+	__m128 zero = _mm_setzero_ps();
+	__m128 absDet = _mm_andnot_ps(_mm_set1_ps(-0.0f), det);
+	__m128 hit = _mm_cmpgt_ps(absDet, _mm_set1_ps(1e-12f));
+	hit = _mm_and_ps(hit, _mm_cmpge_ps(u, zero));
+	hit = _mm_and_ps(hit, _mm_cmpge_ps(v, zero));
+	hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+	hit = _mm_and_ps(hit, _mm_cmpgt_ps(t, zero));
+	hit = _mm_and_ps(hit, _mm_cmplt_ps(t, maxT));
+	return hit;
+}
+
+static inline bool intersectTriangle(const TriangleBVH::Triangle& triangle, const XMFLOAT3& o, const XMFLOAT3& d, float maxT)
+{
+	auto& e1 = triangle.edge1;
+	auto& e2 = triangle.edge2;
+
+	float px = d.y * e2.z - d.z * e2.y;
+	float py = d.z * e2.x - d.x * e2.z;
+	float pz = d.x * e2.y - d.y * e2.x;
+	float det = e1.x * px + e1.y * py + e1.z * pz;
+	float invDet = 1.0f / det;
+
+	float sx = o.x - triangle.v0.x;
+	float sy = o.y - triangle.v0.y;
+	float sz = o.z - triangle.v0.z;
+	float u = (sx * px + sy * py + sz * pz) * invDet;
+
+	float qx = sy * e1.z - sz * e1.y;
+	float qy = sz * e1.x - sx * e1.z;
+	float qz = sx * e1.y - sy * e1.x;
+	float v = (d.x * qx + d.y * qy + d.z * qz) * invDet;
+	float t = (e2.x * qx + e2.y * qy + e2.z * qz) * invDet;
+
+	return std::fabs(det) > 1e-12f && u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t > 0.0f && t < maxT;
+}
+
+uint32_t TriangleBVH::occluded(const RayPacket& packet) const
+{
+	uint32_t active = packet.activeMask & 0xf;
+	if (nodes.empty() || !active)
+		return 0;
+
+	__m128 ox = _mm_loadu_ps(packet.originX);
+	__m128 oy = _mm_loadu_ps(packet.originY);
+	__m128 oz = _mm_loadu_ps(packet.originZ);
+	__m128 dx = _mm_loadu_ps(packet.directionX);
+	__m128 dy = _mm_loadu_ps(packet.directionY);
+	__m128 dz = _mm_loadu_ps(packet.directionZ);
+	__m128 maxT = _mm_loadu_ps(packet.maxDistance);
+
+	__m128 invDx = _mm_setr_ps(safeInverse(packet.directionX[0]), safeInverse(packet.directionX[1]), safeInverse(packet.directionX[2]), safeInverse(packet.directionX[3]));
+	__m128 invDy = _mm_setr_ps(safeInverse(packet.directionY[0]), safeInverse(packet.directionY[1]), safeInverse(packet.directionY[2]), safeInverse(packet.directionY[3]));
+	__m128 invDz = _mm_setr_ps(safeInverse(packet.directionZ[0]), safeInverse(packet.directionZ[1]), safeInverse(packet.directionZ[2]), safeInverse(packet.directionZ[3]));
+	const float* directions[3] = { packet.directionX, packet.directionY, packet.directionZ };
+
+	uint32_t hit = 0;
+	uint32_t stack[MAX_BVH_DEPTH];
+	uint32_t stackSize = 0;
+	uint32_t nodeIndex = 0;
+
+	while (true) {
+		const Node& node = nodes[nodeIndex];
+
+		__m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.min.x), ox), invDx);
+		__m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.max.x), ox), invDx);
+		__m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.min.y), oy), invDy);
+		__m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.max.y), oy), invDy);
+		__m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.min.z), oz), invDz);
+		__m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.max.z), oz), invDz);
+
+		__m128 tNear = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)), _mm_max_ps(_mm_min_ps(t0z, t1z), _mm_setzero_ps()));
+		__m128 tFar = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)), _mm_min_ps(_mm_max_ps(t0z, t1z), maxT));
+
+		// Lanes still looking that are inside this node's box.
+		uint32_t inside = static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(tNear, tFar))) & active & ~hit;
+
+		if (inside) {
+			if (node.count) {
+				for (uint32_t i = 0; i < node.count; i++) {
+					__m128 triangleHit = intersectTriangle4(triangles[node.offset + i], ox, oy, oz, dx, dy, dz, maxT);
+					hit |= static_cast<uint32_t>(_mm_movemask_ps(triangleHit)) & inside;
+				}
+
+				if (hit == active)
+					return hit;
+			}
+			else {
+				// Near child first for the first lane still in here, any hit ends a lane so there's no sorting by distance.
+				uint32_t lane = 0;
+				while (!(inside & (1u << lane)))
+					lane++;
+
+				uint32_t nearChild = nodeIndex + 1;
+				uint32_t farChild = node.offset;
+				if (directions[node.axis][lane] < 0.0f)
+					std::swap(nearChild, farChild);
+
+				stack[stackSize++] = farChild;
+				nodeIndex = nearChild;
+				continue;
+			}
+		}
+
+		if (stackSize == 0)
+			break;
+		nodeIndex = stack[--stackSize];
+	}
+
+	return hit;
+}
+
+bool TriangleBVH::occluded(XMFLOAT3 origin, XMFLOAT3 direction, float maxDistance) const
+{
+	if (nodes.empty())
+		return false;
+
+	XMFLOAT3 invDirection = { safeInverse(direction.x), safeInverse(direction.y), safeInverse(direction.z) };
+	float directions[3] = { direction.x, direction.y, direction.z };
+
+	uint32_t stack[MAX_BVH_DEPTH];
+	uint32_t stackSize = 0;
+	uint32_t nodeIndex = 0;
+
+	while (true) {
+		const Node& node = nodes[nodeIndex];
+
+		float t0x = (node.min.x - origin.x) * invDirection.x, t1x = (node.max.x - origin.x) * invDirection.x;
+		float t0y = (node.min.y - origin.y) * invDirection.y, t1y = (node.max.y - origin.y) * invDirection.y;
+		float t0z = (node.min.z - origin.z) * invDirection.z, t1z = (node.max.z - origin.z) * invDirection.z;
+
+		float tNear = std::max(std::max(std::min(t0x, t1x), std::min(t0y, t1y)), std::max(std::min(t0z, t1z), 0.0f));
+		float tFar = std::min(std::min(std::max(t0x, t1x), std::max(t0y, t1y)), std::min(std::max(t0z, t1z), maxDistance));
+
+		if (tNear <= tFar) {
+			if (node.count) {
+				for (uint32_t i = 0; i < node.count; i++) {
+					if (intersectTriangle(triangles[node.offset + i], origin, direction, maxDistance))
+						return true;
+				}
+			}
+			else {
+				uint32_t nearChild = nodeIndex + 1;
+				uint32_t farChild = node.offset;
+				if (directions[node.axis] < 0.0f)
+					std::swap(nearChild, farChild);
+
+				stack[stackSize++] = farChild;
+				nodeIndex = nearChild;
+				continue;
+			}
+		}
+
+		if (stackSize == 0)
+			return false;
+		nodeIndex = stack[--stackSize];
+	}
+}
+
+bool TriangleBVH::occludedBruteForce(XMFLOAT3 origin, XMFLOAT3 direction, float maxDistance) const
+{
+	for (auto& triangle : triangles) {
+		if (intersectTriangle(triangle, origin, direction, maxDistance))
+			return true;
+	}
+	return false;
+}
+
+static float radicalInverse(uint32_t bits)
+{
+	bits = (bits << 16u) | (bits >> 16u);
+	bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+	bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+	bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+	bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+	return static_cast<float>(bits) * 2.3283064365386963e-10f;
+}
+
+// Integer hash to [0, 1), so every vertex gets the Hammersley set turned by a different amount.
+static float hashToUnit(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return static_cast<float>(x >> 8) * (1.0f / 16777216.0f);
+}
+
+// Any two unit vectors perpendicular to n and each other, without a branch on which axis n is closest to.
+static void getOrthonormalBasis(const XMFLOAT3& n, XMFLOAT3& tangent, XMFLOAT3& bitangent)
+{
+	float sign = n.z >= 0.0f ? 1.0f : -1.0f;
+	float a = -1.0f / (sign + n.z);
+	float b = n.x * n.y * a;
+	tangent = { 1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x };
+	bitangent = { b, sign + n.y * n.y * a, -n.y };
+}
+
+static uint64_t hashBytes(uint64_t hash, const void* data, size_t size)
+{
+	auto bytes = static_cast<const unsigned char*>(data);
+
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		memcpy(&word, bytes + i, 8);
+		hash = (hash ^ word) * 0x100000001b3ull;
+		hash ^= hash >> 29;
+	}
+	for (; i < size; i++) {
+		hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+	}
+	return hash;
+}
+
+static uint64_t hashSceneGeometry(const SceneData& scene)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (auto& mesh : scene.meshes) {
+		for (auto& vertex : mesh.vertices) {
+			hash = hashBytes(hash, &vertex.position, sizeof(vertex.position));
+			hash = hashBytes(hash, &vertex.normal, sizeof(vertex.normal));
+		}
+		hash = hashBytes(hash, mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t));
+	}
+	for (auto& instance : scene.instances) {
+		XMFLOAT4X4 world;
+		XMStoreFloat4x4(&world, getInstanceWorld(scene.graph, instance));
+		hash = hashBytes(hash, &instance.mesh, sizeof(instance.mesh));
+		hash = hashBytes(hash, &world, sizeof(world));
+	}
+	return hash;
+}
+
+static bool readOcclusionFile(const std::string& path, const OcclusionFileHeader& header, SceneData& scene)
+{
+	std::ifstream file(path, std::ios::binary);
+	OcclusionFileHeader existing{};
+	if (!file.read(reinterpret_cast<char*>(&existing), sizeof(existing)) || memcmp(&existing, &header, sizeof(header)) != 0)
+		return false;
+
+	std::vector<float> occlusion;
+	for (auto& mesh : scene.meshes) {
+		occlusion.resize(mesh.vertices.size());
+		mesh.bentNormals.resize(mesh.vertices.size());
+		file.read(reinterpret_cast<char*>(occlusion.data()), occlusion.size() * sizeof(float));
+		file.read(reinterpret_cast<char*>(mesh.bentNormals.data()), mesh.bentNormals.size() * sizeof(XMFLOAT3));
+
+		for (size_t i = 0; i < mesh.vertices.size(); i++) {
+			mesh.vertices[i].occlusion = occlusion[i];
+		}
+	}
+	return static_cast<bool>(file);
+}
+
+static void writeOcclusionFile(const std::string& path, const OcclusionFileHeader& header, const SceneData& scene)
+{
+	auto directory = std::filesystem::path(path).parent_path();
+	if (!directory.empty())
+		std::filesystem::create_directories(directory);
+
+	// Written under another name and moved over the old file at the end, a bake that dies part way never looks up to date.
+	std::string tempPath = path + ".tmp";
+	std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+	if (!file) {
+		throw std::runtime_error("Failed to open " + tempPath + " for writing");
+	}
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	std::vector<float> occlusion;
+	for (auto& mesh : scene.meshes) {
+		occlusion.resize(mesh.vertices.size());
+		for (size_t i = 0; i < mesh.vertices.size(); i++) {
+			occlusion[i] = mesh.vertices[i].occlusion;
+		}
+		file.write(reinterpret_cast<const char*>(occlusion.data()), occlusion.size() * sizeof(float));
+		file.write(reinterpret_cast<const char*>(mesh.bentNormals.data()), mesh.bentNormals.size() * sizeof(XMFLOAT3));
+	}
+
+	file.close();
+	if (!file) {
+		throw std::runtime_error("Failed to write " + tempPath);
+	}
+
+	std::filesystem::rename(tempPath, path);
+}
+
+AmbientOcclusionStats bakeAmbientOcclusion(SceneData& scene, const std::string& cachePath, const AmbientOcclusionSettings& settings, JobSystem& jobs)
+{
+	if (settings.raysPerVertex == 0 || !(settings.maxDistance > 0.0f) || settings.bias < 0.0f) {
+		throw std::runtime_error("Ambient occlusion settings out of range");
+	}
+
+	auto start = std::chrono::high_resolution_clock::now();
+	auto elapsedMs = [](std::chrono::high_resolution_clock::time_point since) {
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - since).count();
+	};
+
+	uint32_t raysPerVertex = (settings.raysPerVertex + 3) & ~3u;
+
+	OcclusionFileHeader header{};
+	header.magic = OCCLUSION_FILE_MAGIC;
+	header.version = OCCLUSION_FILE_VERSION;
+	header.raysPerVertex = raysPerVertex;
+	header.maxDistance = settings.maxDistance;
+	header.bias = settings.bias;
+	header.meshCount = static_cast<uint32_t>(scene.meshes.size());
+
+	AmbientOcclusionStats stats{};
+	if (!cachePath.empty()) {
+		header.hash = hashSceneGeometry(scene);
+		if (readOcclusionFile(cachePath, header, scene)) {
+			stats.upToDate = true;
+			stats.totalMs = elapsedMs(start);
+			return stats;
+		}
+	}
+
+	TriangleBVH bvh;
+	bvh.build(scene);
+	stats.triangles = bvh.getTriangleCount();
+	stats.references = bvh.getReferenceCount();
+	stats.nodes = bvh.getNodeCount();
+	stats.depth = bvh.getDepth();
+	stats.buildMs = bvh.getBuildMs();
+
+	// Every instance's vertices one after another, each one's occlusion in w and its open direction in world space.
+	std::vector<uint64_t> instanceStarts(scene.instances.size() + 1, 0);
+	for (size_t i = 0; i < scene.instances.size(); i++) {
+		instanceStarts[i + 1] = instanceStarts[i] + scene.meshes[scene.instances[i].mesh].vertices.size();
+	}
+	stats.vertices = instanceStarts.back();
+	stats.rays = stats.vertices * raysPerVertex;
+
+	std::vector<XMFLOAT4> results(stats.vertices);
+
+	// The same cosine weighted Hammersley set for every vertex, rotated about the normal and jittered per vertex below.
+	std::vector<XMFLOAT2> samples(raysPerVertex);
+	for (uint32_t i = 0; i < raysPerVertex; i++) {
+		samples[i] = { (i + 0.5f) / raysPerVertex, radicalInverse(i) };
+	}
+
+	struct Batch {
+		uint32_t instance;
+		uint32_t first;
+		uint32_t count;
+	};
+
+	std::vector<Batch> batches;
+	for (uint32_t i = 0; i < scene.instances.size(); i++) {
+		uint32_t vertexCount = static_cast<uint32_t>(scene.meshes[scene.instances[i].mesh].vertices.size());
+		for (uint32_t first = 0; first < vertexCount; first += OCCLUSION_BATCH) {
+			batches.push_back({ i, first, std::min(OCCLUSION_BATCH, vertexCount - first) });
+		}
+	}
+
+	auto traceStart = std::chrono::high_resolution_clock::now();
+
+	jobs.parallelFor(static_cast<uint32_t>(batches.size()), [&](uint32_t index, uint32_t) {
+		auto& batch = batches[index];
+		auto& instance = scene.instances[batch.instance];
+		auto& mesh = scene.meshes[instance.mesh];
+		auto world = getInstanceWorld(scene.graph, instance);
+
+		std::vector<XMFLOAT3> directions(raysPerVertex);
+
+		for (uint32_t v = batch.first; v < batch.first + batch.count; v++) {
+			uint64_t resultIndex = instanceStarts[batch.instance] + v;
+			auto& vertex = mesh.vertices[v];
+
+			XMFLOAT3 normal;
+			XMStoreFloat3(&normal, XMVector3Normalize(XMVector3TransformNormal(XMLoadFloat3(&vertex.normal), world)));
+			if (!std::isfinite(normal.x + normal.y + normal.z)) {
+				results[resultIndex] = { 0.0f, 0.0f, 0.0f, 1.0f };
+				continue;
+			}
+
+			XMFLOAT3 origin;
+			XMStoreFloat3(&origin, XMVectorAdd(XMVector3TransformCoord(XMLoadFloat3(&vertex.position), world), XMVectorScale(XMLoadFloat3(&normal), settings.bias)));
+
+			XMFLOAT3 tangent, bitangent;
+			getOrthonormalBasis(normal, tangent, bitangent);
+
+			float jitterU = hashToUnit(static_cast<uint32_t>(resultIndex) * 2 + 0);
+			float jitterV = hashToUnit(static_cast<uint32_t>(resultIndex) * 2 + 1);
+			for (uint32_t i = 0; i < raysPerVertex; i++) {
+				float u = samples[i].x + jitterU;
+				float w = samples[i].y + jitterV;
+				u -= std::floor(u);
+				w -= std::floor(w);
+
+				float radius = std::sqrt(u);
+				float phi = 2.0f * XM_PI * w;
+				float x = radius * std::cos(phi), y = radius * std::sin(phi), z = std::sqrt(std::max(0.0f, 1.0f - u));
+
+				directions[i] = {
+					tangent.x * x + bitangent.x * y + normal.x * z,
+					tangent.y * x + bitangent.y * y + normal.y * z,
+					tangent.z * x + bitangent.z * y + normal.z * z,
+				};
+			}
+
+			uint32_t open = 0;
+			XMFLOAT3 openSum = { 0.0f, 0.0f, 0.0f };
+			auto addOpen = [&](const XMFLOAT3& d) {
+				open++;
+				openSum.x += d.x;
+				openSum.y += d.y;
+				openSum.z += d.z;
+			};
+
+			if (settings.packets) {
+				RayPacket packet;
+				for (uint32_t lane = 0; lane < 4; lane++) {
+					packet.originX[lane] = origin.x;
+					packet.originY[lane] = origin.y;
+					packet.originZ[lane] = origin.z;
+					packet.maxDistance[lane] = settings.maxDistance;
+				}
+
+				for (uint32_t i = 0; i < raysPerVertex; i += 4) {
+					for (uint32_t lane = 0; lane < 4; lane++) {
+						packet.directionX[lane] = directions[i + lane].x;
+						packet.directionY[lane] = directions[i + lane].y;
+						packet.directionZ[lane] = directions[i + lane].z;
+					}
+
+					uint32_t hit = bvh.occluded(packet);
+					for (uint32_t lane = 0; lane < 4; lane++) {
+						if (!(hit & (1u << lane)))
+							addOpen(directions[i + lane]);
+					}
+				}
+			}
+			else {
+				for (uint32_t i = 0; i < raysPerVertex; i++) {
+					if (!bvh.occluded(origin, directions[i], settings.maxDistance))
+						addOpen(directions[i]);
+				}
+			}
+
+			// Cosine weighted rays, so the open fraction is already the cosine weighted visibility.
+			float occlusion = static_cast<float>(open) / raysPerVertex;
+			XMFLOAT3 bent = open ? openSum : normal;
+			results[resultIndex] = { bent.x, bent.y, bent.z, occlusion };
+		}
+	});
+
+	stats.traceMs = elapsedMs(traceStart);
+
+	// Back into each mesh's space and averaged over its instances.
+	std::vector<uint32_t> instanceCounts(scene.meshes.size(), 0);
+	for (auto& mesh : scene.meshes) {
+		mesh.bentNormals.assign(mesh.vertices.size(), { 0.0f, 0.0f, 0.0f });
+		for (auto& vertex : mesh.vertices) {
+			vertex.occlusion = 0.0f;
+		}
+	}
+
+	for (size_t i = 0; i < scene.instances.size(); i++) {
+		auto& instance = scene.instances[i];
+		auto& mesh = scene.meshes[instance.mesh];
+		auto toMesh = XMMatrixInverse(nullptr, getInstanceWorld(scene.graph, instance));
+		instanceCounts[instance.mesh]++;
+
+		for (size_t v = 0; v < mesh.vertices.size(); v++) {
+			auto& result = results[instanceStarts[i] + v];
+			auto bent = XMVector3Normalize(XMVector3TransformNormal(XMVectorSet(result.x, result.y, result.z, 0.0f), toMesh));
+			XMStoreFloat3(&mesh.bentNormals[v], XMVectorAdd(XMLoadFloat3(&mesh.bentNormals[v]), bent));
+			mesh.vertices[v].occlusion += result.w;
+		}
+	}
+
+	for (size_t m = 0; m < scene.meshes.size(); m++) {
+		auto& mesh = scene.meshes[m];
+		if (instanceCounts[m] == 0) {
+			// Never placed, so never traced.
+			for (size_t v = 0; v < mesh.vertices.size(); v++) {
+				mesh.vertices[v].occlusion = 1.0f;
+				mesh.bentNormals[v] = mesh.vertices[v].normal;
+			}
+			continue;
+		}
+
+		for (size_t v = 0; v < mesh.vertices.size(); v++) {
+			mesh.vertices[v].occlusion /= instanceCounts[m];
+
+			auto bent = XMLoadFloat3(&mesh.bentNormals[v]);
+			bent = XMVectorGetX(XMVector3LengthSq(bent)) > 1e-12f ? XMVector3Normalize(bent) : XMLoadFloat3(&mesh.vertices[v].normal);
+			XMStoreFloat3(&mesh.bentNormals[v], bent);
+		}
+	}
+
+	if (!cachePath.empty())
+		writeOcclusionFile(cachePath, header, scene);
+
+	stats.totalMs = elapsedMs(start);
+	return stats;
+}
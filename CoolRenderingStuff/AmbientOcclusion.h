@@ -0,0 +1,106 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <DirectXMath.h>
+#include "Scene.h"
+
+class JobSystem;
+
+// Four rays traced together, a lane each. Lanes outside activeMask are left alone.
+struct RayPacket {
+	float originX[4];
+	float originY[4];
+	float originZ[4];
+	float directionX[4];
+	float directionY[4];
+	float directionZ[4];
+	float maxDistance[4];
+	uint32_t activeMask = 0xf;
+};
+
+// Binary BVH over every instance's triangles in world space, built with a binned SAH after big triangles are clipped
+// into smaller pieces. Nodes are depth first, an interior node's left child right after it. Only answers whether
+// anything is hit, which is all occlusion needs. Cutout materials count as solid.
+class TriangleBVH
+{
+public:
+	static const uint32_t MAX_LEAF_TRIANGLES = 4;
+	static const uint32_t SAH_BINS = 12;
+
+	struct Node {
+		DirectX::XMFLOAT3 min;
+		// Interior: the right child. Leaf: the first triangle.
+		uint32_t offset;
+		DirectX::XMFLOAT3 max;
+		// 0 for an interior node.
+		uint16_t count;
+		// The axis an interior node was split on.
+		uint16_t axis;
+	};
+
+	// Ready for Moller-Trumbore, a vertex and the two edges from it.
+	struct Triangle {
+		DirectX::XMFLOAT3 v0;
+		DirectX::XMFLOAT3 edge1;
+		DirectX::XMFLOAT3 edge2;
+	};
+
+	void build(const SceneData& scene);
+
+	// Bitmask of the active lanes that hit a triangle closer than their maxDistance. SSE, a node's box and a leaf's
+	// triangles are tested against all four rays at once and the packet goes down a node while any lane is still in it.
+	uint32_t occluded(const RayPacket& packet) const;
+	// A ray at a time through the same tree with the same maths, to check the packets against and measure what they buy.
+	bool occluded(DirectX::XMFLOAT3 origin, DirectX::XMFLOAT3 direction, float maxDistance) const;
+	// Every triangle with no tree at all, for checking the tree.
+	bool occludedBruteForce(DirectX::XMFLOAT3 origin, DirectX::XMFLOAT3 direction, float maxDistance) const;
+
+	uint32_t getTriangleCount() const { return triangleCount; }
+	// Triangles in the leaves, more than getTriangleCount since big triangles are split into pieces for the build.
+	uint32_t getReferenceCount() const { return static_cast<uint32_t>(triangles.size()); }
+	uint32_t getNodeCount() const { return static_cast<uint32_t>(nodes.size()); }
+	uint32_t getDepth() const { return depth; }
+	double getBuildMs() const { return buildMs; }
+
+private:
+	std::vector<Node> nodes;
+	std::vector<Triangle> triangles;
+	uint32_t triangleCount = 0;
+	uint32_t depth = 0;
+	double buildMs = 0.0;
+};
+
+struct AmbientOcclusionSettings {
+	// Cosine weighted over the hemisphere, rounded up to a whole number of packets.
+	uint32_t raysPerVertex = 64;
+	// Metres. Anything further away doesn't occlude, so open rooms don't go black.
+	float maxDistance = 1.0f;
+	// Metres along the normal the rays start from, so they don't hit the triangles around their own vertex.
+	float bias = 0.002f;
+	// Single rays when false, same directions and same answer.
+	bool packets = true;
+};
+
+struct AmbientOcclusionStats {
+	// True when the cache already held a bake of this geometry with these settings and nothing was traced.
+	bool upToDate;
+	uint32_t triangles;
+	uint32_t references;
+	uint32_t nodes;
+	uint32_t depth;
+	// Every instance's vertices, a vertex shared by several instances is traced from each of them.
+	uint64_t vertices;
+	uint64_t rays;
+	double buildMs;
+	double traceMs;
+	double totalMs;
+
+	double raysPerSecond() const { return traceMs > 0.0 ? rays / (traceMs / 1000.0) : 0.0; }
+};
+
+// Traces every instance's vertices against the whole scene and writes the result into the meshes: each vertex's
+// occlusion, 1 for fully open, and the mesh's bentNormals, the average open direction in mesh space. Instances share
+// their mesh's vertices so a mesh gets the average of its instances. With a cachePath the bake is read back from there
+// when the geometry and settings haven't changed and written there otherwise.
+AmbientOcclusionStats bakeAmbientOcclusion(SceneData& scene, const std::string& cachePath, const AmbientOcclusionSettings& settings, JobSystem& jobs);
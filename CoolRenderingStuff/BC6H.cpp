@@ -0,0 +1,253 @@
+#include "BC6H.h"
+#include <DirectXPackedVector.h>
+
+using namespace DirectX;
+
+namespace {
+	// Endpoint components, endpoint * 3 + channel. w and x are the first subset's ends, y and z the second's.
+	enum Field : uint8_t {
+		RW, GW, BW,
+		RX, GX, BX,
+		RY, GY, BY,
+		RZ, GZ, BZ,
+	};
+
+	// A run of bits of one field in the order they're stored, first to last inclusive. Runs high to low where the
+	// format stores the top bits reversed.
+	struct BitRun {
+		uint8_t field;
+		uint8_t first;
+		uint8_t last;
+	};
+
+	struct Mode {
+		uint8_t value;
+		uint8_t regions;
+		bool transformed;
+		uint8_t endpointBits;
+		uint8_t deltaBits[3];
+		BitRun runs[32];
+	};
+
+	// Every valid mode, the bit layouts from the BC6H spec. Anything not here is reserved.
+	const Mode modes[] = {
+		{ 0x00, 2, true, 10, { 5, 5, 5 }, {
+			{ GY, 4, 4 }, { BY, 4, 4 }, { BZ, 4, 4 }, { RW, 0, 9 }, { GW, 0, 9 }, { BW, 0, 9 }, { RX, 0, 4 }, { GZ, 4, 4 },
+			{ GY, 0, 3 }, { GX, 0, 4 }, { BZ, 0, 0 }, { GZ, 0, 3 }, { BX, 0, 4 }, { BZ, 1, 1 }, { BY, 0, 3 }, { RY, 0, 4 },
+			{ BZ, 2, 2 }, { RZ, 0, 4 }, { BZ, 3, 3 } } },
+		{ 0x01, 2, true, 7, { 6, 6, 6 }, {
+			{ GY, 5, 5 }, { GZ, 4, 5 }, { RW, 0, 6 }, { BZ, 0, 1 }, { BY, 4, 4 }, { GW, 0, 6 }, { BY, 5, 5 }, { BZ, 2, 2 },
+			{ GY, 4, 4 }, { BW, 0, 6 }, { BZ, 3, 3 }, { BZ, 5, 4 }, { RX, 0, 5 }, { GY, 0, 3 }, { GX, 0, 5 }, { GZ, 0, 3 },
+			{ BX, 0, 5 }, { BY, 0, 3 }, { RY, 0, 5 }, { RZ, 0, 5 } } },
+		{ 0x02, 2, true, 11, { 5, 4, 4 }, {
+			{ RW, 0, 9 }, { GW, 0, 9 }, { BW, 0, 9 }, { RX, 0, 4 }, { RW, 10, 10 }, { GY, 0, 3 }, { GX, 0, 3 }, { GW, 10, 10 },
+			{ BZ, 0, 0 }, { GZ, 0, 3 }, { BX, 0, 3 }, { BW, 10, 10 }, { BZ, 1, 1 }, { BY, 0, 3 }, { RY, 0, 4 }, { BZ, 2, 2 },
+			{ RZ, 0, 4 }, { BZ, 3, 3 } } },
+		{ 0x06, 2, true, 11, { 4, 5, 4 }, {
+			{ RW, 0, 9 }, { GW, 0, 9 }, { BW, 0, 9 }, { RX, 0, 3 }, { RW, 10, 10 }, { GZ, 4, 4 }, { GY, 0, 3 }, { GX, 0, 4 },
+			{ GW, 10, 10 }, { GZ, 0, 3 }, { BX, 0, 3 }, { BW, 10, 10 }, { BZ, 1, 1 }, { BY, 0, 3 }, { RY, 0, 3 }, { BZ, 0, 0 },
+			{ BZ, 2, 2 }, { RZ, 0, 3 }, { GY, 4, 4 }, { BZ, 3, 3 } } },
+		{ 0x0a, 2, true, 11, { 4, 4, 5 }, {
+			{ RW, 0, 9 }, { GW, 0, 9 }, { BW, 0, 9 }, { RX, 0, 3 }, { RW, 10, 10 }, { BY, 4, 4 }, { GY, 0, 3 }, { GX, 0, 3 },
+			{ GW, 10, 10 }, { BZ, 0, 0 }, { GZ, 0, 3 }, { BX, 0, 4 }, { BW, 10, 10 }, { BY, 0, 3 }, { RY, 0, 3 }, { BZ, 1, 2 },
+			{ RZ, 0, 3 }, { BZ, 4, 4 }, { BZ, 3, 3 } } },
+		{ 0x0e, 2, true, 9, { 5, 5, 5 }, {
+			{ RW, 0, 8 }, { BY, 4, 4 }, { GW, 0, 8 }, { GY, 4, 4 }, { BW, 0, 8 }, { BZ, 4, 4 }, { RX, 0, 4 }, { GZ, 4, 4 },
+			{ GY, 0, 3 }, { GX, 0, 4 }, { BZ, 0, 0 }, { GZ, 0, 3 }, { BX, 0, 4 }, { BZ, 1, 1 }, { BY, 0, 3 }, { RY, 0, 4 },
+			{ BZ, 2, 2 }, { RZ, 0, 4 }, { BZ, 3, 3 } } },
+		{ 0x12, 2, true, 8, { 6, 5, 5 }, {
+			{ RW, 0, 7 }, { GZ, 4, 4 }, { BY, 4, 4 }, { GW, 0, 7 }, { BZ, 2, 2 }, { GY, 4, 4 }, { BW, 0, 7 }, { BZ, 3, 4 },
+			{ RX, 0, 5 }, { GY, 0, 3 }, { GX, 0, 4 }, { BZ, 0, 0 }, { GZ, 0, 3 }, { BX, 0, 4 }, { BZ, 1, 1 }, { BY, 0, 3 },
+			{ RY, 0, 5 }, { RZ, 0, 5 } } },
+		{ 0x16, 2, true, 8, { 5, 6, 5 }, {
+			{ RW, 0, 7 }, { BZ, 0, 0 }, { BY, 4, 4 }, { GW, 0, 7 }, { GY, 5, 4 }, { BW, 0, 7 }, { GZ, 5, 5 }, { BZ, 4, 4 },
+			{ RX, 0, 4 }, { GZ, 4, 4 }, { GY, 0, 3 }, { GX, 0, 5 }, { GZ, 0, 3 }, { BX, 0, 4 }, { BZ, 1, 1 }, { BY, 0, 3 },
+			{ RY, 0, 4 }, { BZ, 2, 2 }, { RZ, 0, 4 }, { BZ, 3, 3 } } },
+		{ 0x1a, 2, true, 8, { 5, 5, 6 }, {
+			{ RW, 0, 7 }, { BZ, 1, 1 }, { BY, 4, 4 }, { GW, 0, 7 }, { BY, 5, 5 }, { GY, 4, 4 }, { BW, 0, 7 }, { BZ, 5, 4 },
+			{ RX, 0, 4 }, { GZ, 4, 4 }, { GY, 0, 3 }, { GX, 0, 4 }, { BZ, 0, 0 }, { GZ, 0, 3 }, { BX, 0, 5 }, { BY, 0, 3 },
+			{ RY, 0, 4 }, { BZ, 2, 2 }, { RZ, 0, 4 }, { BZ, 3, 3 } } },
+		{ 0x1e, 2, false, 6, { 6, 6, 6 }, {
+			{ RW, 0, 5 }, { GZ, 4, 4 }, { BZ, 0, 1 }, { BY, 4, 4 }, { GW, 0, 5 }, { GY, 5, 5 }, { BY, 5, 5 }, { BZ, 2, 2 },
+			{ GY, 4, 4 }, { BW, 0, 5 }, { GZ, 5, 5 }, { BZ, 3, 3 }, { BZ, 5, 4 }, { RX, 0, 5 }, { GY, 0, 3 }, { GX, 0, 5 },
+			{ GZ, 0, 3 }, { BX, 0, 5 }, { BY, 0, 3 }, { RY, 0, 5 }, { RZ, 0, 5 } } },
+		{ 0x03, 1, false, 10, { 10, 10, 10 }, {
+			{ RW, 0, 9 }, { GW, 0, 9 }, { BW, 0, 9 }, { RX, 0, 9 }, { GX, 0, 9 }, { BX, 0, 9 } } },
+		{ 0x07, 1, true, 11, { 9, 9, 9 }, {
+			{ RW, 0, 9 }, { GW, 0, 9 }, { BW, 0, 9 }, { RX, 0, 8 }, { RW, 10, 10 }, { GX, 0, 8 }, { GW, 10, 10 }, { BX, 0, 8 },
+			{ BW, 10, 10 } } },
+		{ 0x0b, 1, true, 12, { 8, 8, 8 }, {
+			{ RW, 0, 9 }, { GW, 0, 9 }, { BW, 0, 9 }, { RX, 0, 7 }, { RW, 11, 10 }, { GX, 0, 7 }, { GW, 11, 10 }, { BX, 0, 7 },
+			{ BW, 11, 10 } } },
+		{ 0x0f, 1, true, 16, { 4, 4, 4 }, {
+			{ RW, 0, 9 }, { GW, 0, 9 }, { BW, 0, 9 }, { RX, 0, 3 }, { RW, 15, 10 }, { GX, 0, 3 }, { GW, 15, 10 }, { BX, 0, 3 },
+			{ BW, 15, 10 } } },
+	};
+
+	// The first 32 two subset partitions shared with BC7, bit i set when texel i is in the second subset.
+	const uint16_t partitions[32] = {
+		0xcccc, 0x8888, 0xeeee, 0xecc8, 0xc880, 0xfeec, 0xfec8, 0xec80,
+		0xc800, 0xffec, 0xfe80, 0xe800, 0xffe8, 0xff00, 0xfff0, 0xf000,
+		0xf710, 0x008e, 0x7100, 0x08ce, 0x008c, 0x7310, 0x3100, 0x8cce,
+		0x088c, 0x3110, 0x6666, 0x366c, 0x17e8, 0x0ff0, 0x718e, 0x399c,
+	};
+
+	// The texel of the second subset whose index drops its top bit.
+	const uint8_t secondAnchors[32] = {
+		15, 15, 15, 15, 15, 15, 15, 15,
+		15, 15, 15, 15, 15, 15, 15, 15,
+		15, 2, 8, 2, 2, 8, 8, 15,
+		2, 8, 2, 2, 8, 8, 2, 2,
+	};
+
+	const int weights3[8] = { 0, 9, 18, 27, 37, 46, 55, 64 };
+	const int weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	struct BitReader {
+		const uint8_t* data;
+		uint32_t position = 0;
+
+		uint32_t read(uint32_t count)
+		{
+			uint32_t value = 0;
+			for (uint32_t i = 0; i < count; i++, position++) {
+				value |= ((data[position >> 3] >> (position & 7)) & 1u) << i;
+			}
+			return value;
+		}
+	};
+
+	int signExtend(int value, int bits)
+	{
+		int shift = 32 - bits;
+		return static_cast<int>(static_cast<uint32_t>(value) << shift) >> shift;
+	}
+
+	int unquantize(int component, int bits, bool isSigned)
+	{
+		if (!isSigned) {
+			if (bits >= 15 || component == 0)
+				return component;
+			if (component == (1 << bits) - 1)
+				return 0xffff;
+			return ((component << 16) + 0x8000) >> bits;
+		}
+
+		if (bits >= 16)
+			return component;
+
+		bool negative = component < 0;
+		int magnitude = negative ? -component : component;
+		int result;
+		if (magnitude == 0)
+			result = 0;
+		else if (magnitude >= (1 << (bits - 1)) - 1)
+			result = 0x7fff;
+		else
+			result = ((magnitude << 15) + 0x4000) >> (bits - 1);
+		return negative ? -result : result;
+	}
+
+	// Scales an interpolated value back down to the half float it stands for.
+	float finishUnquantize(int value, bool isSigned)
+	{
+		if (!isSigned) {
+			return PackedVector::XMConvertHalfToFloat(static_cast<PackedVector::HALF>((value * 31) >> 6));
+		}
+
+		uint16_t bits = value < 0
+			? static_cast<uint16_t>(0x8000 | ((-value * 31) >> 5))
+			: static_cast<uint16_t>((value * 31) >> 5);
+		return PackedVector::XMConvertHalfToFloat(bits);
+	}
+}
+
+void decodeBC6HBlock(const uint8_t* block, bool isSigned, XMFLOAT4 out[16])
+{
+	BitReader reader{ block };
+
+	uint32_t modeValue = reader.read(2);
+	if (modeValue > 1) {
+		modeValue |= reader.read(3) << 2;
+	}
+
+	const Mode* mode = nullptr;
+	for (auto& candidate : modes) {
+		if (candidate.value == modeValue) {
+			mode = &candidate;
+			break;
+		}
+	}
+
+	if (!mode) {
+		for (int i = 0; i < 16; i++) {
+			out[i] = XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f);
+		}
+		return;
+	}
+
+	int endpoints[12] = {};
+	for (auto& run : mode->runs) {
+		// The unused tail of runs is zeroed, and no real run is a single bit of RW.
+		if (run.field == RW && run.first == 0 && run.last == 0)
+			break;
+
+		int step = run.last >= run.first ? 1 : -1;
+		for (int bit = run.first; ; bit += step) {
+			endpoints[run.field] |= static_cast<int>(reader.read(1)) << bit;
+			if (bit == run.last)
+				break;
+		}
+	}
+
+	uint32_t partition = mode->regions == 2 ? reader.read(5) : 0;
+	int endpointCount = mode->regions * 2;
+	int bits = mode->endpointBits;
+
+	for (int channel = 0; channel < 3; channel++) {
+		int& base = endpoints[channel];
+		if (isSigned) {
+			base = signExtend(base, bits);
+		}
+
+		for (int e = 1; e < endpointCount; e++) {
+			int& value = endpoints[e * 3 + channel];
+			if (mode->transformed) {
+				value = signExtend(value, mode->deltaBits[channel]);
+				value = (base + value) & ((1 << bits) - 1);
+				if (isSigned) {
+					value = signExtend(value, bits);
+				}
+			}
+			else if (isSigned) {
+				value = signExtend(value, bits);
+			}
+		}
+	}
+
+	for (int i = 0; i < endpointCount * 3; i++) {
+		endpoints[i] = unquantize(endpoints[i], bits, isSigned);
+	}
+
+	// Each texel's index, anchors one bit short as their top bit is always 0.
+	for (int i = 0; i < 16; i++) {
+		int subset = mode->regions == 2 ? (partitions[partition] >> i) & 1 : 0;
+		int weight;
+		if (mode->regions == 2) {
+			bool anchor = i == 0 || i == secondAnchors[partition];
+			weight = weights3[reader.read(anchor ? 2 : 3)];
+		}
+		else {
+			weight = weights4[reader.read(i == 0 ? 3 : 4)];
+		}
+
+		const int* first = &endpoints[subset * 6];
+		const int* second = &endpoints[subset * 6 + 3];
+		float rgb[3];
+		for (int channel = 0; channel < 3; channel++) {
+			int value = (first[channel] * (64 - weight) + second[channel] * weight + 32) >> 6;
+			rgb[channel] = finishUnquantize(value, isSigned);
+		}
+		out[i] = XMFLOAT4(rgb[0], rgb[1], rgb[2], 1.0f);
+	}
+}
@@ -0,0 +1,7 @@
+#pragma once
+#include <cstdint>
+#include <DirectXMath.h>
+
+// Decodes one 16 byte BC6H block to 4x4 linear RGB texels, row by row, alpha 1. isSigned picks SF16 over UF16.
+// Reserved modes decode to black like the hardware.
+void decodeBC6HBlock(const uint8_t* block, bool isSigned, DirectX::XMFLOAT4 out[16]);
@@ -0,0 +1,41 @@
+#include "ConstantAllocator.h"
+#include <stdexcept>
+
+LinearConstantAllocator::LinearConstantAllocator(uint32_t capacity) : capacity(capacity - capacity % ALIGNMENT)
+{
+	if (this->capacity == 0) {
+		throw std::runtime_error("Constant allocator needs at least one aligned block!");
+	}
+}
+
+void LinearConstantAllocator::beginFrame()
+{
+	discardPending = true;
+	frameStats = {};
+}
+
+ConstantAllocation LinearConstantAllocator::allocate(uint32_t size)
+{
+	uint32_t alignedSize = alignSize(size == 0 ? 1 : size);
+	if (alignedSize > capacity) {
+		throw std::runtime_error("Constant allocation is bigger than the whole buffer!");
+	}
+
+	ConstantAllocation allocation{};
+	allocation.size = alignedSize;
+
+	if (discardPending || capacity - head < alignedSize) {
+		head = 0;
+		allocation.discard = true;
+		discardPending = false;
+		frameStats.discards++;
+	}
+
+	allocation.offset = head;
+	head += alignedSize;
+
+	frameStats.allocations++;
+	frameStats.bytesAllocated += alignedSize;
+
+	return allocation;
+}
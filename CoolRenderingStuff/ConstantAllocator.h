@@ -0,0 +1,52 @@
+#pragma once
+#include <cstdint>
+
+struct ConstantAllocation {
+	// Bytes from the start of the buffer, always a multiple of ALIGNMENT.
+	uint32_t offset;
+	// Aligned size, what the binding has to cover.
+	uint32_t size;
+	// The buffer has to be mapped with DISCARD for this one, everything after it can use NO_OVERWRITE.
+	bool discard;
+};
+
+struct ConstantAllocatorStats {
+	uint64_t allocations;
+	uint64_t bytesAllocated;
+	uint64_t discards;
+};
+
+// Linear allocator over one big dynamic constant buffer, kept free of D3D so the offset math can be checked on its own.
+// The first allocation of every frame discards, which renames the buffer once instead of once per draw.
+// Running out of space mid frame discards again and starts over at 0, earlier bindings keep the old copy.
+class LinearConstantAllocator
+{
+public:
+	// Offsets handed to *SetConstantBuffers1 are in 16 byte constants and have to be multiples of 16 of them.
+	static const uint32_t ALIGNMENT = 256;
+	static const uint32_t CONSTANT_SIZE = 16;
+
+	explicit LinearConstantAllocator(uint32_t capacity);
+
+	void beginFrame();
+
+	// Throws if a single allocation is bigger than the whole buffer.
+	ConstantAllocation allocate(uint32_t size);
+
+	uint32_t getCapacity() const { return capacity; }
+	uint32_t getHead() const { return head; }
+
+	// Reset by beginFrame.
+	const ConstantAllocatorStats& getFrameStats() const { return frameStats; }
+
+	static uint32_t alignSize(uint32_t size) { return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1); }
+
+	static uint32_t toConstants(uint32_t bytes) { return bytes / CONSTANT_SIZE; }
+
+private:
+	uint32_t capacity;
+	uint32_t head = 0;
+	bool discardPending = true;
+
+	ConstantAllocatorStats frameStats{};
+};
@@ -0,0 +1,190 @@
+#include "ConstantBufferRing.h"
+#include <cstring>
+#include <stdexcept>
+
+ConstantBufferRing::ConstantBufferRing(ID3D11Device* device, ID3D11DeviceContext* context, uint32_t capacity, uint32_t fallbackSize) :
+	context(context),
+	allocator(capacity),
+	fallbackSize(LinearConstantAllocator::alignSize(fallbackSize))
+{
+	D3D11_FEATURE_DATA_D3D11_OPTIONS options{};
+	if (SUCCEEDED(device->CheckFeatureSupport(D3D11_FEATURE_D3D11_OPTIONS, &options, sizeof(options)))
+		&& options.ConstantBufferOffsetting && options.MapNoOverwriteOnDynamicConstantBuffer) {
+		if (FAILED(context->QueryInterface(IID_PPV_ARGS(&context1)))) {
+			context1 = nullptr;
+		}
+	}
+
+	D3D11_BUFFER_DESC desc{};
+	desc.ByteWidth = supportsOffsets() ? allocator.getCapacity() : this->fallbackSize;
+	desc.Usage = D3D11_USAGE_DYNAMIC;
+	desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	desc.MiscFlags = 0;
+	desc.StructureByteStride = 0;
+
+	if (FAILED(device->CreateBuffer(&desc, nullptr, &buffer))) {
+		throw std::runtime_error("Failed to create constant buffer ring!");
+	}
+}
+
+ConstantBufferRing::~ConstantBufferRing()
+{
+	buffer->Release();
+
+	if (context1)
+		context1->Release();
+}
+
+void ConstantBufferRing::beginFrame()
+{
+	allocator.beginFrame();
+	fallbackStats = {};
+}
+
+ConstantBinding ConstantBufferRing::upload(const void* data, uint32_t size)
+{
+	D3D11_MAPPED_SUBRESOURCE mapped{};
+
+	if (!supportsOffsets()) {
+		if (size > fallbackSize) {
+			throw std::runtime_error("Constant upload is bigger than the fallback buffer!");
+		}
+
+		if (FAILED(context->Map(buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped))) {
+			throw std::runtime_error("Failed to map constant buffer!");
+		}
+		memcpy(mapped.pData, data, size);
+		context->Unmap(buffer, 0);
+
+		uint32_t alignedSize = LinearConstantAllocator::alignSize(size);
+		fallbackStats.allocations++;
+		fallbackStats.bytesAllocated += alignedSize;
+		fallbackStats.discards++;
+
+		return { buffer, 0, LinearConstantAllocator::toConstants(alignedSize) };
+	}
+
+	auto allocation = allocator.allocate(size);
+
+	if (FAILED(context->Map(buffer, 0, allocation.discard ? D3D11_MAP_WRITE_DISCARD : D3D11_MAP_WRITE_NO_OVERWRITE, 0, &mapped))) {
+		throw std::runtime_error("Failed to map constant buffer ring!");
+	}
+	memcpy(static_cast<uint8_t*>(mapped.pData) + allocation.offset, data, size);
+	context->Unmap(buffer, 0);
+
+	return { buffer, LinearConstantAllocator::toConstants(allocation.offset), LinearConstantAllocator::toConstants(allocation.size) };
+}
+
+// Some runtimes filter out a *SetConstantBuffers1 call that binds the buffer already in the slot and never look at the
+// offsets, so the shader would go on reading the old range. Binding null in between makes it a real change.
+void ConstantBufferRing::bindWithOffset(uint32_t stage, uint32_t slot, const ConstantBinding& binding)
+{
+	auto& last = bound[stage][slot];
+	bool offsetOnly = last.buffer == binding.buffer && (last.firstConstant != binding.firstConstant || last.numConstants != binding.numConstants);
+
+	if (offsetOnly) {
+		ID3D11Buffer* none = nullptr;
+		if (stage == 0)
+			context1->VSSetConstantBuffers1(slot, 1, &none, nullptr, nullptr);
+		else
+			context1->PSSetConstantBuffers1(slot, 1, &none, nullptr, nullptr);
+	}
+
+	if (stage == 0)
+		context1->VSSetConstantBuffers1(slot, 1, &binding.buffer, &binding.firstConstant, &binding.numConstants);
+	else
+		context1->PSSetConstantBuffers1(slot, 1, &binding.buffer, &binding.firstConstant, &binding.numConstants);
+
+	last = { binding.buffer, binding.firstConstant, binding.numConstants };
+}
+
+void ConstantBufferRing::bind(uint32_t stages, uint32_t slot, const ConstantBinding& binding)
+{
+	if (slot >= D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT) {
+		throw std::runtime_error("Constant buffer slot out of range!");
+	}
+
+	if (context1) {
+		if (stages & CONSTANT_STAGE_VERTEX)
+			bindWithOffset(0, slot, binding);
+		if (stages & CONSTANT_STAGE_PIXEL)
+			bindWithOffset(1, slot, binding);
+		return;
+	}
+
+	if (stages & CONSTANT_STAGE_VERTEX)
+		context->VSSetConstantBuffers(slot, 1, &binding.buffer);
+	if (stages & CONSTANT_STAGE_PIXEL)
+		context->PSSetConstantBuffers(slot, 1, &binding.buffer);
+}
+
+ImmutableConstantArray::ImmutableConstantArray(ID3D11Device* device, const void* data, uint32_t count, uint32_t stride, bool packed) :
+	count(count),
+	alignedStride(LinearConstantAllocator::alignSize(stride)),
+	packed(packed)
+{
+	if (count == 0)
+		return;
+
+	auto bytes = static_cast<const uint8_t*>(data);
+
+	D3D11_BUFFER_DESC desc{};
+	desc.Usage = D3D11_USAGE_IMMUTABLE;
+	desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	desc.CPUAccessFlags = 0;
+	desc.MiscFlags = 0;
+	desc.StructureByteStride = 0;
+
+	if (packed) {
+		std::vector<uint8_t> staging(static_cast<size_t>(count) * alignedStride);
+		for (uint32_t i = 0; i < count; i++) {
+			memcpy(staging.data() + static_cast<size_t>(i) * alignedStride, bytes + static_cast<size_t>(i) * stride, stride);
+		}
+
+		desc.ByteWidth = static_cast<uint32_t>(staging.size());
+
+		D3D11_SUBRESOURCE_DATA initialData{};
+		initialData.pSysMem = staging.data();
+
+		buffers.resize(1);
+		if (FAILED(device->CreateBuffer(&desc, &initialData, &buffers[0]))) {
+			throw std::runtime_error("Failed to create immutable constant buffer!");
+		}
+		return;
+	}
+
+	// Constant buffers have to be a multiple of 16 bytes, the tail is left zeroed.
+	std::vector<uint8_t> staging(alignedStride);
+
+	desc.ByteWidth = alignedStride;
+	buffers.resize(count);
+	for (uint32_t i = 0; i < count; i++) {
+		memcpy(staging.data(), bytes + static_cast<size_t>(i) * stride, stride);
+
+		D3D11_SUBRESOURCE_DATA initialData{};
+		initialData.pSysMem = staging.data();
+
+		if (FAILED(device->CreateBuffer(&desc, &initialData, &buffers[i]))) {
+			throw std::runtime_error("Failed to create immutable constant buffer!");
+		}
+	}
+}
+
+ImmutableConstantArray::~ImmutableConstantArray()
+{
+	for (auto buffer : buffers) {
+		if (buffer)
+			buffer->Release();
+	}
+}
+
+ConstantBinding ImmutableConstantArray::get(uint32_t index) const
+{
+	uint32_t numConstants = LinearConstantAllocator::toConstants(alignedStride);
+
+	if (packed)
+		return { buffers[0], index * numConstants, numConstants };
+
+	return { buffers[index], 0, numConstants };
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include <d3d11_1.h>
+#include <cstdint>
+#include <vector>
+#include "ConstantAllocator.h"
+
+// Enough to bind any constant data, whether it came from the ring or a buffer of its own.
+struct ConstantBinding {
+	ID3D11Buffer* buffer;
+	uint32_t firstConstant;
+	uint32_t numConstants;
+};
+
+enum ConstantStage {
+	CONSTANT_STAGE_VERTEX = 1 << 0,
+	CONSTANT_STAGE_PIXEL = 1 << 1,
+};
+
+// Per frame constant data suballocated from one dynamic buffer with WRITE_NO_OVERWRITE and bound by offset.
+// Devices without constant buffer offsetting get the old behaviour, a small buffer mapped with DISCARD per upload.
+class ConstantBufferRing
+{
+public:
+	ConstantBufferRing(ID3D11Device* device, ID3D11DeviceContext* context, uint32_t capacity = 1 << 20, uint32_t fallbackSize = 4096);
+	~ConstantBufferRing();
+
+	bool supportsOffsets() const { return context1 != nullptr; }
+
+	void beginFrame();
+
+	// Without offset support the binding only lasts until the next upload, so bind it before uploading anything else.
+	ConstantBinding upload(const void* data, uint32_t size);
+
+	template <typename T>
+	ConstantBinding upload(const T& data) { return upload(&data, sizeof(T)); }
+
+	// stages is a mask of ConstantStage.
+	void bind(uint32_t stages, uint32_t slot, const ConstantBinding& binding);
+
+	const ConstantAllocatorStats& getFrameStats() const { return supportsOffsets() ? allocator.getFrameStats() : fallbackStats; }
+	uint32_t getCapacity() const { return supportsOffsets() ? allocator.getCapacity() : fallbackSize; }
+
+private:
+	// What a slot was last given through bind, with offsets.
+	struct SlotBinding {
+		ID3D11Buffer* buffer;
+		uint32_t firstConstant;
+		uint32_t numConstants;
+	};
+
+	void bindWithOffset(uint32_t stage, uint32_t slot, const ConstantBinding& binding);
+
+	ID3D11DeviceContext* context;
+	// Only set when the device can bind at an offset and map dynamic constant buffers with NO_OVERWRITE.
+	ID3D11DeviceContext1* context1 = nullptr;
+
+	ID3D11Buffer* buffer = nullptr;
+	LinearConstantAllocator allocator;
+
+	uint32_t fallbackSize;
+	ConstantAllocatorStats fallbackStats{};
+
+	// Indexed by CONSTANT_STAGE_VERTEX and CONSTANT_STAGE_PIXEL's bit. Only these slots are ever bound at an offset.
+	SlotBinding bound[2][D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT] = {};
+};
+
+// Constants uploaded once at load and never touched again, like the material settings.
+// Packed into one immutable buffer at 256 byte strides when offsets are supported, one buffer per element otherwise.
+class ImmutableConstantArray
+{
+public:
+	ImmutableConstantArray(ID3D11Device* device, const void* data, uint32_t count, uint32_t stride, bool packed);
+	~ImmutableConstantArray();
+
+	ImmutableConstantArray(const ImmutableConstantArray&) = delete;
+	ImmutableConstantArray& operator=(const ImmutableConstantArray&) = delete;
+
+	ConstantBinding get(uint32_t index) const;
+	uint32_t size() const { return count; }
+
+private:
+	std::vector<ID3D11Buffer*> buffers;
+	uint32_t count;
+	uint32_t alignedStride;
+	bool packed;
+};
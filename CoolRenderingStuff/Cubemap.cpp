@@ -0,0 +1,316 @@
+#include "Cubemap.h"
+#include "BC6H.h"
+#include <DirectXPackedVector.h>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+using namespace DirectX;
+
+static const uint32_t DDS_MAGIC = 0x20534444; // "DDS "
+static const uint32_t DDS_FOURCC = 0x4;
+static const uint32_t DDS_CUBEMAP_ALL_FACES = 0xfe00;
+static const uint32_t DDS_RESOURCE_MISC_TEXTURECUBE = 0x4;
+static const uint32_t DDS_FOURCC_DX10 = 0x30315844; // "DX10"
+// D3DFORMAT values legacy headers put in the FourCC.
+static const uint32_t DDS_FOURCC_RGBA16F = 113;
+static const uint32_t DDS_FOURCC_RGBA32F = 116;
+
+static const uint32_t DXGI_FORMAT_R32G32B32A32_FLOAT_VALUE = 2;
+static const uint32_t DXGI_FORMAT_R16G16B16A16_FLOAT_VALUE = 10;
+static const uint32_t DXGI_FORMAT_BC6H_UF16_VALUE = 95;
+static const uint32_t DXGI_FORMAT_BC6H_SF16_VALUE = 96;
+
+struct DDSPixelFormat {
+	uint32_t size;
+	uint32_t flags;
+	uint32_t fourCC;
+	uint32_t rgbBitCount;
+	uint32_t masks[4];
+};
+
+struct DDSHeader {
+	uint32_t size;
+	uint32_t flags;
+	uint32_t height;
+	uint32_t width;
+	uint32_t pitchOrLinearSize;
+	uint32_t depth;
+	uint32_t mipMapCount;
+	uint32_t reserved1[11];
+	DDSPixelFormat pixelFormat;
+	uint32_t caps;
+	uint32_t caps2;
+	uint32_t caps3;
+	uint32_t caps4;
+	uint32_t reserved2;
+};
+
+struct DDSHeaderDX10 {
+	uint32_t dxgiFormat;
+	uint32_t resourceDimension;
+	uint32_t miscFlag;
+	uint32_t arraySize;
+	uint32_t miscFlags2;
+};
+
+void Cubemap::allocate(uint32_t size, uint32_t levelCount)
+{
+	this->size = size;
+	this->levelCount = levelCount;
+	texels.assign(getLevelOffset(levelCount), XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f));
+}
+
+size_t Cubemap::getLevelOffset(uint32_t level) const
+{
+	size_t offset = 0;
+	for (uint32_t i = 0; i < level; i++) {
+		size_t levelSize = getLevelSize(i);
+		offset += levelSize * levelSize * CUBE_FACE_COUNT;
+	}
+	return offset;
+}
+
+XMFLOAT4* Cubemap::getFace(uint32_t level, uint32_t face)
+{
+	size_t levelSize = getLevelSize(level);
+	return texels.data() + getLevelOffset(level) + levelSize * levelSize * face;
+}
+
+const XMFLOAT4* Cubemap::getFace(uint32_t level, uint32_t face) const
+{
+	size_t levelSize = getLevelSize(level);
+	return texels.data() + getLevelOffset(level) + levelSize * levelSize * face;
+}
+
+void Cubemap::generateMips()
+{
+	for (uint32_t level = 1; level < levelCount; level++) {
+		uint32_t parentSize = getLevelSize(level - 1);
+		uint32_t levelSize = getLevelSize(level);
+
+		for (uint32_t face = 0; face < CUBE_FACE_COUNT; face++) {
+			const XMFLOAT4* parent = getFace(level - 1, face);
+			XMFLOAT4* out = getFace(level, face);
+
+			for (uint32_t y = 0; y < levelSize; y++) {
+				for (uint32_t x = 0; x < levelSize; x++) {
+					uint32_t x0 = std::min(x * 2, parentSize - 1), x1 = std::min(x * 2 + 1, parentSize - 1);
+					uint32_t y0 = std::min(y * 2, parentSize - 1), y1 = std::min(y * 2 + 1, parentSize - 1);
+
+					XMVECTOR sum = XMLoadFloat4(&parent[y0 * parentSize + x0]);
+					sum = XMVectorAdd(sum, XMLoadFloat4(&parent[y0 * parentSize + x1]));
+					sum = XMVectorAdd(sum, XMLoadFloat4(&parent[y1 * parentSize + x0]));
+					sum = XMVectorAdd(sum, XMLoadFloat4(&parent[y1 * parentSize + x1]));
+					XMStoreFloat4(&out[y * levelSize + x], XMVectorScale(sum, 0.25f));
+				}
+			}
+		}
+	}
+}
+
+static XMVECTOR sampleLevel(const Cubemap& cube, uint32_t level, uint32_t face, float u, float v)
+{
+	uint32_t levelSize = cube.getLevelSize(level);
+	const XMFLOAT4* texels = cube.getFace(level, face);
+
+	float x = u * levelSize - 0.5f;
+	float y = v * levelSize - 0.5f;
+	float fx = std::floor(x), fy = std::floor(y);
+	float tx = x - fx, ty = y - fy;
+
+	int maxTexel = static_cast<int>(levelSize) - 1;
+	int x0 = std::clamp(static_cast<int>(fx), 0, maxTexel), x1 = std::clamp(static_cast<int>(fx) + 1, 0, maxTexel);
+	int y0 = std::clamp(static_cast<int>(fy), 0, maxTexel), y1 = std::clamp(static_cast<int>(fy) + 1, 0, maxTexel);
+
+	XMVECTOR top = XMVectorLerp(XMLoadFloat4(&texels[y0 * levelSize + x0]), XMLoadFloat4(&texels[y0 * levelSize + x1]), tx);
+	XMVECTOR bottom = XMVectorLerp(XMLoadFloat4(&texels[y1 * levelSize + x0]), XMLoadFloat4(&texels[y1 * levelSize + x1]), tx);
+	return XMVectorLerp(top, bottom, ty);
+}
+
+XMVECTOR Cubemap::sample(FXMVECTOR direction, float level) const
+{
+	XMFLOAT3 d;
+	XMStoreFloat3(&d, direction);
+
+	float ax = std::fabs(d.x), ay = std::fabs(d.y), az = std::fabs(d.z);
+	uint32_t face;
+	float s, t, major;
+	if (ax >= ay && ax >= az) {
+		face = d.x >= 0.0f ? 0 : 1;
+		s = d.x >= 0.0f ? -d.z : d.z;
+		t = -d.y;
+		major = ax;
+	}
+	else if (ay >= az) {
+		face = d.y >= 0.0f ? 2 : 3;
+		s = d.x;
+		t = d.y >= 0.0f ? d.z : -d.z;
+		major = ay;
+	}
+	else {
+		face = d.z >= 0.0f ? 4 : 5;
+		s = d.z >= 0.0f ? d.x : -d.x;
+		t = -d.y;
+		major = az;
+	}
+
+	float u = (s / major + 1.0f) * 0.5f;
+	float v = (t / major + 1.0f) * 0.5f;
+
+	level = std::clamp(level, 0.0f, static_cast<float>(levelCount - 1));
+	uint32_t lower = static_cast<uint32_t>(level);
+	uint32_t upper = std::min(lower + 1, levelCount - 1);
+
+	XMVECTOR colour = sampleLevel(*this, lower, face, u, v);
+	if (upper != lower) {
+		colour = XMVectorLerp(colour, sampleLevel(*this, upper, face, u, v), level - lower);
+	}
+	return colour;
+}
+
+XMFLOAT3 getCubeDirection(uint32_t face, float s, float t)
+{
+	switch (face) {
+	case 0: return XMFLOAT3(1.0f, -t, -s);
+	case 1: return XMFLOAT3(-1.0f, -t, s);
+	case 2: return XMFLOAT3(s, 1.0f, t);
+	case 3: return XMFLOAT3(s, -1.0f, -t);
+	case 4: return XMFLOAT3(s, -t, 1.0f);
+	default: return XMFLOAT3(-s, -t, -1.0f);
+	}
+}
+
+// Solid angle of the face between its centre and (x, y), which differences into any rectangle's.
+static float getCubeAreaElement(float x, float y)
+{
+	return std::atan2(x * y, std::sqrt(x * x + y * y + 1.0f));
+}
+
+float getCubeTexelSolidAngle(uint32_t x, uint32_t y, uint32_t size)
+{
+	float texel = 2.0f / size;
+	float x0 = x * texel - 1.0f, x1 = x0 + texel;
+	float y0 = y * texel - 1.0f, y1 = y0 + texel;
+	return getCubeAreaElement(x0, y0) - getCubeAreaElement(x0, y1) - getCubeAreaElement(x1, y0) + getCubeAreaElement(x1, y1);
+}
+
+static size_t getLevelBytes(uint32_t format, uint32_t width, uint32_t height)
+{
+	switch (format) {
+	case DXGI_FORMAT_BC6H_UF16_VALUE:
+	case DXGI_FORMAT_BC6H_SF16_VALUE:
+		return static_cast<size_t>(std::max(1u, (width + 3) / 4)) * std::max(1u, (height + 3) / 4) * 16;
+	case DXGI_FORMAT_R16G16B16A16_FLOAT_VALUE:
+		return static_cast<size_t>(width) * height * 8;
+	default:
+		return static_cast<size_t>(width) * height * 16;
+	}
+}
+
+Cubemap loadCubemapDDS(const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		throw std::runtime_error("Failed to open " + path);
+	}
+	std::vector<unsigned char> bytes{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+
+	uint32_t magic = 0;
+	DDSHeader header{};
+	if (bytes.size() < sizeof(magic) + sizeof(header)) {
+		throw std::runtime_error("Not a DDS file: " + path);
+	}
+	memcpy(&magic, bytes.data(), sizeof(magic));
+	memcpy(&header, bytes.data() + sizeof(magic), sizeof(header));
+	if (magic != DDS_MAGIC || header.size != sizeof(DDSHeader)) {
+		throw std::runtime_error("Not a DDS file: " + path);
+	}
+
+	size_t offset = sizeof(magic) + sizeof(header);
+	bool isCube = (header.caps2 & DDS_CUBEMAP_ALL_FACES) == DDS_CUBEMAP_ALL_FACES;
+	uint32_t format = 0;
+
+	if ((header.pixelFormat.flags & DDS_FOURCC) && header.pixelFormat.fourCC == DDS_FOURCC_DX10) {
+		DDSHeaderDX10 dx10{};
+		if (bytes.size() < offset + sizeof(dx10)) {
+			throw std::runtime_error("Truncated DDS file: " + path);
+		}
+		memcpy(&dx10, bytes.data() + offset, sizeof(dx10));
+		offset += sizeof(dx10);
+
+		format = dx10.dxgiFormat;
+		isCube = isCube || (dx10.miscFlag & DDS_RESOURCE_MISC_TEXTURECUBE);
+	}
+	else if (header.pixelFormat.flags & DDS_FOURCC) {
+		if (header.pixelFormat.fourCC == DDS_FOURCC_RGBA16F)
+			format = DXGI_FORMAT_R16G16B16A16_FLOAT_VALUE;
+		else if (header.pixelFormat.fourCC == DDS_FOURCC_RGBA32F)
+			format = DXGI_FORMAT_R32G32B32A32_FLOAT_VALUE;
+	}
+
+	if (format != DXGI_FORMAT_BC6H_UF16_VALUE && format != DXGI_FORMAT_BC6H_SF16_VALUE &&
+		format != DXGI_FORMAT_R16G16B16A16_FLOAT_VALUE && format != DXGI_FORMAT_R32G32B32A32_FLOAT_VALUE) {
+		throw std::runtime_error("Unsupported DDS format in " + path + ", only BC6H, RGBA16F and RGBA32F cubes load");
+	}
+	if (!isCube || header.width != header.height || header.width == 0) {
+		throw std::runtime_error("Not a square DDS cubemap: " + path);
+	}
+
+	uint32_t size = header.width;
+	uint32_t storedLevels = std::max(1u, header.mipMapCount);
+
+	// Faces are stored one after another, each with its whole chain.
+	size_t faceBytes = 0;
+	for (uint32_t level = 0; level < storedLevels; level++) {
+		uint32_t levelSize = std::max(1u, size >> level);
+		faceBytes += getLevelBytes(format, levelSize, levelSize);
+	}
+	if (bytes.size() < offset + faceBytes * CUBE_FACE_COUNT) {
+		throw std::runtime_error("Truncated DDS file: " + path);
+	}
+
+	uint32_t levelCount = 1;
+	while ((size >> levelCount) > 0) {
+		levelCount++;
+	}
+
+	Cubemap cube;
+	cube.allocate(size, levelCount);
+
+	for (uint32_t face = 0; face < CUBE_FACE_COUNT; face++) {
+		const unsigned char* data = bytes.data() + offset + faceBytes * face;
+		XMFLOAT4* out = cube.getFace(0, face);
+
+		if (format == DXGI_FORMAT_BC6H_UF16_VALUE || format == DXGI_FORMAT_BC6H_SF16_VALUE) {
+			uint32_t blocks = std::max(1u, (size + 3) / 4);
+			XMFLOAT4 decoded[16];
+			for (uint32_t by = 0; by < blocks; by++) {
+				for (uint32_t bx = 0; bx < blocks; bx++) {
+					decodeBC6HBlock(data + (static_cast<size_t>(by) * blocks + bx) * 16, format == DXGI_FORMAT_BC6H_SF16_VALUE, decoded);
+					for (uint32_t i = 0; i < 16; i++) {
+						uint32_t x = bx * 4 + i % 4, y = by * 4 + i / 4;
+						if (x < size && y < size)
+							out[y * size + x] = decoded[i];
+					}
+				}
+			}
+		}
+		else if (format == DXGI_FORMAT_R16G16B16A16_FLOAT_VALUE) {
+			for (size_t i = 0; i < static_cast<size_t>(size) * size; i++) {
+				PackedVector::HALF half[4];
+				memcpy(half, data + i * 8, 8);
+				out[i] = XMFLOAT4(PackedVector::XMConvertHalfToFloat(half[0]), PackedVector::XMConvertHalfToFloat(half[1]),
+					PackedVector::XMConvertHalfToFloat(half[2]), PackedVector::XMConvertHalfToFloat(half[3]));
+			}
+		}
+		else {
+			memcpy(out, data, static_cast<size_t>(size) * size * sizeof(XMFLOAT4));
+		}
+	}
+
+	cube.generateMips();
+	return cube;
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <DirectXMath.h>
+
+static const uint32_t CUBE_FACE_COUNT = 6;
+
+// Linear float RGBA cube on the CPU. Each level is its six faces in D3D order (+X, -X, +Y, -Y, +Z, -Z), each face
+// size x size texels a row at a time from the top, so a level uploads as one subresource per face.
+struct Cubemap {
+	uint32_t size = 0;
+	uint32_t levelCount = 0;
+	std::vector<DirectX::XMFLOAT4> texels;
+
+	void allocate(uint32_t size, uint32_t levelCount);
+
+	uint32_t getLevelSize(uint32_t level) const { return std::max(1u, size >> level); }
+	size_t getLevelOffset(uint32_t level) const;
+	DirectX::XMFLOAT4* getFace(uint32_t level, uint32_t face);
+	const DirectX::XMFLOAT4* getFace(uint32_t level, uint32_t face) const;
+
+	// Box filters every level below the top from the one above it.
+	void generateMips();
+
+	// Bilinear within a face and linear between levels, clamped at face edges. direction needn't be normalised.
+	DirectX::XMVECTOR sample(DirectX::FXMVECTOR direction, float level) const;
+};
+
+// The direction through (s, t) on a face, both in [-1, 1] with t going down the face, the way D3D maps them. Not normalised.
+DirectX::XMFLOAT3 getCubeDirection(uint32_t face, float s, float t);
+
+// Exact solid angle of texel (x, y), the same on every face.
+float getCubeTexelSolidAngle(uint32_t x, uint32_t y, uint32_t size);
+
+// The top level of a DDS cube in BC6H, RGBA16F or RGBA32F with the rest of the chain rebuilt from it. Throws for any
+// other format and for anything that isn't a square cube.
+Cubemap loadCubemapDDS(const std::string& path);
@@ -0,0 +1,147 @@
+#include "DrawOrder.h"
+#include <algorithm>
+
+using namespace DirectX;
+
+const char* getDepthPrepassModeName(DepthPrepassMode mode)
+{
+	switch (mode) {
+	case DepthPrepassMode::Off: return "Off";
+	case DepthPrepassMode::FrontToBack: return "Front to back";
+	case DepthPrepassMode::Prepass: return "Depth prepass";
+	}
+	return "Unknown";
+}
+
+void buildDrawOrder(DepthPrepassMode mode, const std::vector<MeshBounds>& bounds, const std::vector<uint8_t>& alphaTested, const std::vector<uint8_t>* visibility, XMFLOAT3 eye, DrawOrder& out, LinearArena* scratch)
+{
+	out.instances.clear();
+	out.opaqueCount = 0;
+
+	if (mode == DepthPrepassMode::Off) {
+		for (uint32_t i = 0; i < bounds.size(); i++) {
+			if (!visibility || (*visibility)[i])
+				out.instances.push_back(i);
+		}
+		out.opaqueCount = out.instances.size();
+		return;
+	}
+
+	// Distance to the nearest point on the box, so big instances the camera stands in (the floor) go first.
+	// Reserved for everything so an arena doesn't hold every size they grew through.
+	ArenaVector<std::pair<float, uint32_t>> opaque(scratch);
+	ArenaVector<std::pair<float, uint32_t>> cutout(scratch);
+	opaque.reserve(bounds.size());
+	cutout.reserve(bounds.size());
+
+	auto eyePos = XMLoadFloat3(&eye);
+	for (uint32_t i = 0; i < bounds.size(); i++) {
+		if (visibility && !(*visibility)[i])
+			continue;
+
+		auto closest = XMVectorMin(XMVectorMax(eyePos, XMLoadFloat3(&bounds[i].min)), XMLoadFloat3(&bounds[i].max));
+		float distSq = XMVectorGetX(XMVector3LengthSq(XMVectorSubtract(closest, eyePos)));
+
+		if (alphaTested[i])
+			cutout.push_back({ distSq, i });
+		else
+			opaque.push_back({ distSq, i });
+	}
+
+	std::sort(opaque.begin(), opaque.end());
+	std::sort(cutout.begin(), cutout.end());
+
+	for (auto& entry : opaque) {
+		out.instances.push_back(entry.second);
+	}
+	out.opaqueCount = out.instances.size();
+
+	for (auto& entry : cutout) {
+		out.instances.push_back(entry.second);
+	}
+}
+
+static const uint32_t NO_BATCH = ~0u;
+
+// instances[0, opaqueCount) are opaque, like DrawOrder.
+static void buildBatches(const uint32_t* instances, size_t count, size_t opaqueCount, const std::vector<uint32_t>& instanceMeshes, bool instancing, LinearArena* scratch, DrawBatches& out)
+{
+	out.batches.clear();
+	out.instances.resize(count);
+	out.opaqueCount = 0;
+
+	uint32_t meshCount = 0;
+	for (size_t i = 0; i < count; i++) {
+		meshCount = std::max(meshCount, instanceMeshes[instances[i]] + 1);
+	}
+
+	// Each mesh's batch in the bucket being built, by mesh id. Only the meshes a bucket used are put back after it.
+	ArenaVector<uint32_t> entryBatch(count, 0, scratch);
+	ArenaVector<uint32_t> meshBatch(meshCount, NO_BATCH, scratch);
+
+	auto addBucket = [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			uint32_t mesh = instanceMeshes[instances[i]];
+			if (!instancing || meshBatch[mesh] == NO_BATCH) {
+				meshBatch[mesh] = static_cast<uint32_t>(out.batches.size());
+				out.batches.push_back({ mesh, 0, 0 });
+			}
+			entryBatch[i] = meshBatch[mesh];
+			out.batches[meshBatch[mesh]].count++;
+		}
+
+		for (size_t i = begin; i < end; i++) {
+			meshBatch[instanceMeshes[instances[i]]] = NO_BATCH;
+		}
+	};
+
+	addBucket(0, opaqueCount);
+	out.opaqueCount = out.batches.size();
+	addBucket(opaqueCount, count);
+
+	uint32_t first = 0;
+	for (auto& batch : out.batches) {
+		batch.first = first;
+		first += batch.count;
+		batch.count = 0;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		auto& batch = out.batches[entryBatch[i]];
+		out.instances[batch.first + batch.count++] = instances[i];
+	}
+}
+
+void buildDrawBatches(const DrawOrder& order, const std::vector<uint32_t>& instanceMeshes, bool instancing, DrawBatches& out, LinearArena* scratch)
+{
+	buildBatches(order.instances.data(), order.instances.size(), order.opaqueCount, instanceMeshes, instancing, scratch, out);
+}
+
+void buildViewDrawBatches(const DrawOrder& shared, const std::vector<uint32_t>& viewMasks, uint32_t view, const std::vector<uint32_t>& instanceMeshes, bool instancing, DrawBatches& out, LinearArena* scratch)
+{
+	ArenaVector<uint32_t> instances(scratch);
+	instances.reserve(shared.instances.size());
+	size_t opaqueCount = 0;
+
+	uint32_t bit = 1u << view;
+	for (size_t i = 0; i < shared.instances.size(); i++) {
+		uint32_t instance = shared.instances[i];
+		if (!(viewMasks[instance] & bit))
+			continue;
+
+		instances.push_back(instance);
+		if (i < shared.opaqueCount)
+			opaqueCount++;
+	}
+
+	buildBatches(instances.data(), instances.size(), opaqueCount, instanceMeshes, instancing, scratch, out);
+}
+
+void growDrawBatches(std::vector<DrawBatches>& batches, size_t count, size_t instanceCount)
+{
+	for (size_t i = batches.size(); i < count; i++) {
+		batches.emplace_back();
+		batches.back().batches.reserve(instanceCount);
+		batches.back().instances.reserve(instanceCount);
+	}
+}
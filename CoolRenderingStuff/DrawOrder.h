@@ -0,0 +1,55 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <DirectXMath.h>
+#include "Scene.h"
+#include "LinearArena.h"
+
+enum class DepthPrepassMode {
+	// Submission order with a LESS depth test, every overdrawn pixel pays for all the G-buffer writes.
+	Off,
+	// Opaque instances nearest first, then the alpha tested bucket. Still a single LESS pass.
+	FrontToBack,
+	// Depth only pass in the same order, then the G-buffer pass with an EQUAL test so each pixel is shaded once.
+	Prepass,
+};
+
+const char* getDepthPrepassModeName(DepthPrepassMode mode);
+
+struct DrawOrder {
+	// Instance indices in draw order.
+	std::vector<uint32_t> instances;
+	// instances[0, opaqueCount) are opaque, the rest use alpha cutout. Everything counts as opaque with the prepass off.
+	size_t opaqueCount;
+};
+
+// alphaTested has one entry per instance. visibility can be null, otherwise instances with a 0 entry are left out.
+// The builders' temporaries come out of scratch when there is one, the heap otherwise.
+void buildDrawOrder(DepthPrepassMode mode, const std::vector<MeshBounds>& bounds, const std::vector<uint8_t>& alphaTested, const std::vector<uint8_t>* visibility, DirectX::XMFLOAT3 eye, DrawOrder& out, LinearArena* scratch = nullptr);
+
+// One DrawIndexedInstanced, count instances of mesh whose ids are instances[first, first + count).
+struct DrawBatch {
+	uint32_t mesh;
+	uint32_t first;
+	uint32_t count;
+};
+
+struct DrawBatches {
+	std::vector<DrawBatch> batches;
+	std::vector<uint32_t> instances;
+	// batches[0, opaqueCount) are opaque, like DrawOrder.
+	size_t opaqueCount;
+};
+
+// Groups each bucket of the order by mesh, a batch going where its mesh's first instance was, so the order only
+// loosens where instances of the same mesh are spread out. With instancing off every instance is a batch of its own.
+void buildDrawBatches(const DrawOrder& order, const std::vector<uint32_t>& instanceMeshes, bool instancing, DrawBatches& out, LinearArena* scratch = nullptr);
+
+// One view's batches out of an order built once for every view, visibility being any view's bit in viewMasks. Only the
+// instances with the view's bit are kept, in the shared order, so views that share an eye (probe faces, split screen
+// looking around one camera) draw in the same order as building each on its own would give, for a filter per view.
+void buildViewDrawBatches(const DrawOrder& shared, const std::vector<uint32_t>& viewMasks, uint32_t view, const std::vector<uint32_t>& instanceMeshes, bool instancing, DrawBatches& out, LinearArena* scratch = nullptr);
+
+// Grows batches to at least count, never shrinking, with room in each new one for every instance. For batches reused by
+// whatever lands in the slot that frame, like shadow faces, which would otherwise grow again whenever a bigger one did.
+void growDrawBatches(std::vector<DrawBatches>& batches, size_t count, size_t instanceCount);
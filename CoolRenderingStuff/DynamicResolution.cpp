@@ -0,0 +1,103 @@
+#include "DynamicResolution.h"
+#include <algorithm>
+#include <cmath>
+
+static int32_t scaleEdge(int32_t edge, float scale)
+{
+	return static_cast<int32_t>(std::floor(edge * scale + 0.5f));
+}
+
+ResolutionRect scaleResolutionRect(const ResolutionRect& rect, float scale)
+{
+	ResolutionRect scaled = { scaleEdge(rect.left, scale), scaleEdge(rect.top, scale), scaleEdge(rect.right, scale), scaleEdge(rect.bottom, scale) };
+
+	if (rect.right > rect.left && scaled.right <= scaled.left)
+		scaled.right = scaled.left + 1;
+	if (rect.bottom > rect.top && scaled.bottom <= scaled.top)
+		scaled.bottom = scaled.top + 1;
+
+	return scaled;
+}
+
+ResolutionFrame getResolutionFrame(uint32_t outputWidth, uint32_t outputHeight, uint32_t targetWidth, uint32_t targetHeight, float scale)
+{
+	ResolutionRect window = scaleResolutionRect({ 0, 0, static_cast<int32_t>(outputWidth), static_cast<int32_t>(outputHeight) }, scale);
+
+	ResolutionFrame frame;
+	frame.width = std::min(static_cast<uint32_t>(window.width()), targetWidth);
+	frame.height = std::min(static_cast<uint32_t>(window.height()), targetHeight);
+
+	frame.uvPerPixel[0] = static_cast<float>(frame.width) / (static_cast<float>(outputWidth) * targetWidth);
+	frame.uvPerPixel[1] = static_cast<float>(frame.height) / (static_cast<float>(outputHeight) * targetHeight);
+	frame.uvMax[0] = (frame.width - 0.5f) / targetWidth;
+	frame.uvMax[1] = (frame.height - 0.5f) / targetHeight;
+	return frame;
+}
+
+DynamicResolutionController::DynamicResolutionController(const DynamicResolutionSettings& settings)
+{
+	setSettings(settings);
+}
+
+void DynamicResolutionController::reset()
+{
+	logArea = 0.0f;
+	scale = 1.0f;
+	lastError = 0.0f;
+	previousError = 0.0f;
+}
+
+void DynamicResolutionController::setSettings(const DynamicResolutionSettings& newSettings)
+{
+	settings = newSettings;
+	settings.minScale = std::clamp(settings.minScale, settings.scaleStep, 1.0f);
+
+	float minLogArea = 2.0f * std::log2(settings.minScale);
+	logArea = std::clamp(logArea, minLogArea, 0.0f);
+	scale = std::clamp(scale, getLowestScale(), 1.0f);
+}
+
+float DynamicResolutionController::quantize(float value) const
+{
+	return std::round(value / settings.scaleStep) * settings.scaleStep;
+}
+
+// The first step at or above minScale.
+float DynamicResolutionController::getLowestScale() const
+{
+	return std::min(std::ceil(settings.minScale / settings.scaleStep) * settings.scaleStep, 1.0f);
+}
+
+float DynamicResolutionController::update(float frameMs)
+{
+	stats.frames++;
+	stats.lastFrameMs = frameMs;
+	if (frameMs > settings.targetMs)
+		stats.framesOverBudget++;
+
+	// A frame that took no time says nothing about the load.
+	float error = std::log2(settings.targetMs / std::max(frameMs, 0.01f));
+	float deadband = std::log2(1.0f + settings.tolerance);
+	error = error > 0.0f ? std::max(error - deadband, 0.0f) : std::min(error + deadband, 0.0f);
+
+	float delta = settings.proportional * (error - lastError)
+		+ settings.integral * error
+		+ settings.derivative * (error - 2.0f * lastError + previousError);
+	previousError = lastError;
+	lastError = error;
+
+	float minLogArea = 2.0f * std::log2(settings.minScale);
+	logArea = std::clamp(logArea + delta, minLogArea, 0.0f);
+
+	// Only a step once it's most of the way to the next, the ends of the range are always reachable.
+	float wanted = std::exp2(logArea * 0.5f);
+	float stepped = std::clamp(quantize(wanted), getLowestScale(), 1.0f);
+	bool atEnd = (wanted >= 1.0f || wanted <= settings.minScale) && stepped != scale;
+	if (atEnd || std::abs(wanted - scale) > settings.scaleStep * 0.75f) {
+		if (stepped != scale)
+			stats.scaleChanges++;
+		scale = stepped;
+	}
+
+	return scale;
+}
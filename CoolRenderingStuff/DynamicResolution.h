@@ -0,0 +1,95 @@
+#pragma once
+#include <cstdint>
+
+struct DynamicResolutionSettings {
+	// GPU time per frame the controller aims for, under a 60 Hz vsync with some room to spare.
+	float targetMs = 14.0f;
+	// Fraction of the window along each axis. The targets are window sized, so it never goes above 1.
+	float minScale = 0.5f;
+	// Gains on log2(targetMs / measured), driving log2 of the pixel count. The GPU's time goes roughly with pixels, so the
+	// same gains close the same fraction of the gap whatever the load.
+	float proportional = 0.1f;
+	float integral = 0.25f;
+	float derivative = 0.0f;
+	// Frames within this fraction of the target count as on it, so the controller settles on a step rather than hunting
+	// between the two either side of the budget.
+	float tolerance = 0.05f;
+	// The scale moves in steps of this, and only once the controller is most of a step past the current one, so noise
+	// on the timer doesn't change the size every frame.
+	float scaleStep = 1.0f / 64.0f;
+};
+
+// A rectangle of pixels, right and bottom exclusive.
+struct ResolutionRect {
+	int32_t left;
+	int32_t top;
+	int32_t right;
+	int32_t bottom;
+
+	int32_t width() const { return right - left; }
+	int32_t height() const { return bottom - top; }
+};
+
+// Every edge lands on the nearest pixel of the scaled target, so views that shared an edge still do and the scaled
+// views cover exactly the scaled window. A rect that isn't empty keeps at least a pixel each way.
+ResolutionRect scaleResolutionRect(const ResolutionRect& rect, float scale);
+
+// The part of the targets a frame renders to, and where the upscale reads it from.
+struct ResolutionFrame {
+	uint32_t width;
+	uint32_t height;
+	// Target uv per output pixel, the upscale's uv is the pixel centre times this.
+	float uvPerPixel[2];
+	// Half a texel in from the far edges of what was rendered, so the filter never reads past them.
+	float uvMax[2];
+};
+
+ResolutionFrame getResolutionFrame(uint32_t outputWidth, uint32_t outputHeight, uint32_t targetWidth, uint32_t targetHeight, float scale);
+
+// Constants for upscalePixel.hlsl, register b1.
+struct UpscaleConstants {
+	float uvPerPixel[2];
+	float uvMax[2];
+};
+
+struct DynamicResolutionStats {
+	uint32_t frames = 0;
+	uint32_t framesOverBudget = 0;
+	uint32_t scaleChanges = 0;
+	float lastFrameMs = 0.0f;
+};
+
+// Picks the resolution scale for the next frame from how long the GPU took over the last ones. A PID controller in
+// velocity form, so pinned at either end of the range it has no integral to wind up and responds as soon as the load
+// moves. Nothing here reads a clock, feed it the same times and it picks the same scales.
+class DynamicResolutionController
+{
+public:
+	DynamicResolutionController(const DynamicResolutionSettings& settings = {});
+
+	// One measured frame, however old. Returns the scale to render at from now on.
+	float update(float frameMs);
+	// Back to full resolution with no history.
+	void reset();
+
+	float getScale() const { return scale; }
+	const DynamicResolutionStats& getStats() const { return stats; }
+
+	const DynamicResolutionSettings& getSettings() const { return settings; }
+	// Keeps the history, the scale is only clamped into the new range.
+	void setSettings(const DynamicResolutionSettings& settings);
+
+private:
+	float quantize(float value) const;
+	float getLowestScale() const;
+
+	DynamicResolutionSettings settings;
+	DynamicResolutionStats stats;
+
+	// log2 of the pixel count as a fraction of the window's, the controller's output before it's stepped.
+	float logArea = 0.0f;
+	float scale = 1.0f;
+	// The last two errors, for the velocity form's proportional and derivative terms.
+	float lastError = 0.0f;
+	float previousError = 0.0f;
+};
@@ -0,0 +1,436 @@
+#include "EnvironmentLighting.h"
+#include "JobSystem.h"
+#include <xmmintrin.h>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <vector>
+
+using namespace DirectX;
+
+static const uint32_t ENVIRONMENT_FILE_MAGIC = 0x31564e45; // "ENV1"
+static const uint32_t ENVIRONMENT_FILE_VERSION = 1;
+
+struct EnvironmentFileHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t specularSize;
+	uint32_t specularLevels;
+	uint32_t sampleCount;
+	uint32_t sourceBytes;
+	// Of every byte of the source file.
+	uint64_t hash;
+};
+
+// Y_lm = SH_BASIS[i] * term i of the polynomial in IrradianceSH.
+static const float SH_BASIS[9] = {
+	0.282095f,
+	0.488603f, 0.488603f, 0.488603f,
+	1.092548f, 1.092548f, 0.315392f, 1.092548f, 0.546274f,
+};
+
+// The cosine lobe's band l factor over PI: 1, 2/3 and 1/4.
+static const float SH_COSINE_BANDS[9] = {
+	1.0f,
+	2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f,
+	0.25f, 0.25f, 0.25f, 0.25f, 0.25f,
+};
+
+static void getSHTerms(float x, float y, float z, float terms[9])
+{
+	terms[0] = 1.0f;
+	terms[1] = y;
+	terms[2] = z;
+	terms[3] = x;
+	terms[4] = x * y;
+	terms[5] = y * z;
+	terms[6] = 3.0f * z * z - 1.0f;
+	terms[7] = x * z;
+	terms[8] = x * x - y * y;
+}
+
+// Radiance times each term summed over the sphere is Y_lm's projection over SH_BASIS, so the projection's scaled by the
+// basis again to get to Y_lm's coefficient and once more to evaluate it.
+static IrradianceSH finishIrradianceSH(const double sums[9][3])
+{
+	IrradianceSH sh{};
+	for (int i = 0; i < 9; i++) {
+		double scale = static_cast<double>(SH_COSINE_BANDS[i]) * SH_BASIS[i] * SH_BASIS[i];
+		sh.coefficients[i] = XMFLOAT4(static_cast<float>(sums[i][0] * scale), static_cast<float>(sums[i][1] * scale), static_cast<float>(sums[i][2] * scale), 0.0f);
+	}
+	return sh;
+}
+
+IrradianceSH getConstantIrradianceSH(const XMFLOAT4& ambient)
+{
+	IrradianceSH sh{};
+	sh.coefficients[0] = XMFLOAT4(ambient.x, ambient.y, ambient.z, 0.0f);
+	return sh;
+}
+
+XMVECTOR evaluateIrradianceSH(const IrradianceSH& sh, FXMVECTOR normal)
+{
+	XMFLOAT3 n;
+	XMStoreFloat3(&n, normal);
+
+	float terms[9];
+	getSHTerms(n.x, n.y, n.z, terms);
+
+	XMVECTOR result = XMVectorZero();
+	for (int i = 0; i < 9; i++) {
+		result = XMVectorMultiplyAdd(XMLoadFloat4(&sh.coefficients[i]), XMVectorReplicate(terms[i]), result);
+	}
+	return XMVectorMax(result, XMVectorZero());
+}
+
+static std::vector<float> getSolidAngles(uint32_t size)
+{
+	std::vector<float> solidAngles(static_cast<size_t>(size) * size);
+	for (uint32_t y = 0; y < size; y++) {
+		for (uint32_t x = 0; x < size; x++) {
+			solidAngles[y * size + x] = getCubeTexelSolidAngle(x, y, size);
+		}
+	}
+	return solidAngles;
+}
+
+IrradianceSH projectIrradianceSH(const Cubemap& source, JobSystem& jobs)
+{
+	uint32_t size = source.size;
+	std::vector<float> solidAngles = getSolidAngles(size);
+
+	// Per row sums, added up in row order at the end.
+	uint32_t rowCount = size * CUBE_FACE_COUNT;
+	std::vector<double> rowSums(static_cast<size_t>(rowCount) * 27);
+
+	float step = 2.0f / size;
+	std::vector<float> faceS(size);
+	for (uint32_t x = 0; x < size; x++) {
+		faceS[x] = (x + 0.5f) * step - 1.0f;
+	}
+
+	jobs.parallelFor(rowCount, [&](uint32_t row, uint32_t) {
+		uint32_t face = row / size, y = row % size;
+		const XMFLOAT4* texels = source.getFace(0, face) + static_cast<size_t>(y) * size;
+		const float* weights = solidAngles.data() + static_cast<size_t>(y) * size;
+		float t = (y + 0.5f) * step - 1.0f;
+
+		// Where s, t and the constant 1 land in the face's direction, see getCubeDirection.
+		XMFLOAT3 fromS = getCubeDirection(face, 1.0f, 0.0f), fromT = getCubeDirection(face, 0.0f, 1.0f), major = getCubeDirection(face, 0.0f, 0.0f);
+		fromS = XMFLOAT3(fromS.x - major.x, fromS.y - major.y, fromS.z - major.z);
+		fromT = XMFLOAT3(fromT.x - major.x, fromT.y - major.y, fromT.z - major.z);
+
+		const __m128 one = _mm_set1_ps(1.0f), three = _mm_set1_ps(3.0f);
+		const __m128 tt = _mm_set1_ps(t);
+		const __m128 tSquaredPlusOne = _mm_set1_ps(t * t + 1.0f);
+
+		__m128 sums[9][3];
+		for (auto& term : sums) {
+			term[0] = term[1] = term[2] = _mm_setzero_ps();
+		}
+
+		uint32_t x = 0;
+		for (; x + 4 <= size; x += 4) {
+			__m128 s = _mm_loadu_ps(&faceS[x]);
+			__m128 invLength = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(s, s), tSquaredPlusOne)));
+
+			__m128 dx = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(s, _mm_set1_ps(fromS.x)), _mm_mul_ps(tt, _mm_set1_ps(fromT.x))), _mm_set1_ps(major.x)), invLength);
+			__m128 dy = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(s, _mm_set1_ps(fromS.y)), _mm_mul_ps(tt, _mm_set1_ps(fromT.y))), _mm_set1_ps(major.y)), invLength);
+			__m128 dz = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(s, _mm_set1_ps(fromS.z)), _mm_mul_ps(tt, _mm_set1_ps(fromT.z))), _mm_set1_ps(major.z)), invLength);
+
+			__m128 weight = _mm_loadu_ps(&weights[x]);
+			__m128 terms[9] = {
+				weight,
+				_mm_mul_ps(dy, weight),
+				_mm_mul_ps(dz, weight),
+				_mm_mul_ps(dx, weight),
+				_mm_mul_ps(_mm_mul_ps(dx, dy), weight),
+				_mm_mul_ps(_mm_mul_ps(dy, dz), weight),
+				_mm_mul_ps(_mm_sub_ps(_mm_mul_ps(three, _mm_mul_ps(dz, dz)), one), weight),
+				_mm_mul_ps(_mm_mul_ps(dx, dz), weight),
+				_mm_mul_ps(_mm_sub_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), weight),
+			};
+
+			// Four RGBA texels turned into a register per channel.
+			__m128 r = _mm_loadu_ps(&texels[x].x);
+			__m128 g = _mm_loadu_ps(&texels[x + 1].x);
+			__m128 b = _mm_loadu_ps(&texels[x + 2].x);
+			__m128 a = _mm_loadu_ps(&texels[x + 3].x);
+			_MM_TRANSPOSE4_PS(r, g, b, a);
+
+			for (int i = 0; i < 9; i++) {
+				sums[i][0] = _mm_add_ps(sums[i][0], _mm_mul_ps(terms[i], r));
+				sums[i][1] = _mm_add_ps(sums[i][1], _mm_mul_ps(terms[i], g));
+				sums[i][2] = _mm_add_ps(sums[i][2], _mm_mul_ps(terms[i], b));
+			}
+		}
+
+		double* out = rowSums.data() + static_cast<size_t>(row) * 27;
+		for (int i = 0; i < 9; i++) {
+			for (int c = 0; c < 3; c++) {
+				float lanes[4];
+				_mm_storeu_ps(lanes, sums[i][c]);
+				out[i * 3 + c] = static_cast<double>(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+			}
+		}
+
+		// Faces too small for a whole group of four.
+		for (; x < size; x++) {
+			XMFLOAT3 d = getCubeDirection(face, faceS[x], t);
+			float invLength = 1.0f / std::sqrt(d.x * d.x + d.y * d.y + d.z * d.z);
+			float terms[9];
+			getSHTerms(d.x * invLength, d.y * invLength, d.z * invLength, terms);
+
+			for (int i = 0; i < 9; i++) {
+				float weighted = terms[i] * weights[x];
+				out[i * 3 + 0] += weighted * texels[x].x;
+				out[i * 3 + 1] += weighted * texels[x].y;
+				out[i * 3 + 2] += weighted * texels[x].z;
+			}
+		}
+	});
+
+	double sums[9][3] = {};
+	for (uint32_t row = 0; row < rowCount; row++) {
+		const double* rowSum = rowSums.data() + static_cast<size_t>(row) * 27;
+		for (int i = 0; i < 27; i++) {
+			sums[i / 3][i % 3] += rowSum[i];
+		}
+	}
+
+	return finishIrradianceSH(sums);
+}
+
+IrradianceSH projectIrradianceSHReference(const Cubemap& source)
+{
+	uint32_t size = source.size;
+	double sums[9][3] = {};
+
+	for (uint32_t face = 0; face < CUBE_FACE_COUNT; face++) {
+		const XMFLOAT4* texels = source.getFace(0, face);
+		for (uint32_t y = 0; y < size; y++) {
+			for (uint32_t x = 0; x < size; x++) {
+				XMFLOAT3 d = getCubeDirection(face, (x + 0.5f) * 2.0f / size - 1.0f, (y + 0.5f) * 2.0f / size - 1.0f);
+				double length = std::sqrt(static_cast<double>(d.x) * d.x + static_cast<double>(d.y) * d.y + static_cast<double>(d.z) * d.z);
+				double dx = d.x / length, dy = d.y / length, dz = d.z / length;
+				double terms[9] = { 1.0, dy, dz, dx, dx * dy, dy * dz, 3.0 * dz * dz - 1.0, dx * dz, dx * dx - dy * dy };
+
+				double weight = getCubeTexelSolidAngle(x, y, size);
+				auto& texel = texels[y * size + x];
+				for (int i = 0; i < 9; i++) {
+					sums[i][0] += terms[i] * weight * texel.x;
+					sums[i][1] += terms[i] * weight * texel.y;
+					sums[i][2] += terms[i] * weight * texel.z;
+				}
+			}
+		}
+	}
+
+	return finishIrradianceSH(sums);
+}
+
+// The i'th of count points of the Hammersley set, a bit reversed index for the second coordinate.
+static XMFLOAT2 getHammersley(uint32_t i, uint32_t count)
+{
+	uint32_t bits = i;
+	bits = (bits << 16) | (bits >> 16);
+	bits = ((bits & 0x55555555u) << 1) | ((bits & 0xaaaaaaaau) >> 1);
+	bits = ((bits & 0x33333333u) << 2) | ((bits & 0xccccccccu) >> 2);
+	bits = ((bits & 0x0f0f0f0fu) << 4) | ((bits & 0xf0f0f0f0u) >> 4);
+	bits = ((bits & 0x00ff00ffu) << 8) | ((bits & 0xff00ff00u) >> 8);
+	return XMFLOAT2(static_cast<float>(i) / count, bits * 2.3283064365386963e-10f);
+}
+
+// A sample in the space where the normal is +z, with the source level it reads and how much it counts.
+struct PrefilterSample {
+	XMFLOAT3 direction;
+	float level;
+	float weight;
+};
+
+static std::vector<PrefilterSample> getPrefilterSamples(float roughness, uint32_t sampleCount, uint32_t sourceSize, uint32_t sourceLevels)
+{
+	float alpha = roughness * roughness;
+	float alphaSquared = alpha * alpha;
+	float texelSolidAngle = 4.0f * XM_PI / (CUBE_FACE_COUNT * static_cast<float>(sourceSize) * sourceSize);
+
+	std::vector<PrefilterSample> samples;
+	for (uint32_t i = 0; i < sampleCount; i++) {
+		XMFLOAT2 xi = getHammersley(i, sampleCount);
+
+		float phi = 2.0f * XM_PI * xi.x;
+		float cosTheta = std::sqrt((1.0f - xi.y) / (1.0f + (alphaSquared - 1.0f) * xi.y));
+		float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+		XMFLOAT3 halfway(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+
+		// The normal reflected about the halfway vector, view being the normal.
+		XMFLOAT3 direction(2.0f * cosTheta * halfway.x, 2.0f * cosTheta * halfway.y, 2.0f * cosTheta * cosTheta - 1.0f);
+		if (direction.z <= 0.0f)
+			continue;
+
+		// With view = normal the pdf of the reflected direction is D / 4.
+		float denominator = cosTheta * cosTheta * (alphaSquared - 1.0f) + 1.0f;
+		float distribution = alphaSquared / (XM_PI * denominator * denominator);
+		float sampleSolidAngle = 1.0f / (sampleCount * distribution * 0.25f);
+
+		float level = roughness == 0.0f ? 0.0f : 0.5f * std::log2(sampleSolidAngle / texelSolidAngle) + 1.0f;
+		level = std::clamp(level, 0.0f, static_cast<float>(sourceLevels - 1));
+
+		samples.push_back({ direction, level, direction.z });
+	}
+	return samples;
+}
+
+Cubemap prefilterSpecular(const Cubemap& source, const SpecularPrefilterSettings& settings, JobSystem& jobs)
+{
+	Cubemap out;
+	out.allocate(settings.size, settings.levels);
+
+	for (uint32_t level = 0; level < settings.levels; level++) {
+		float roughness = settings.levels > 1 ? static_cast<float>(level) / (settings.levels - 1) : 0.0f;
+		uint32_t levelSize = out.getLevelSize(level);
+
+		// A mirror only needs the one sample, from the source level nearest this one's size.
+		std::vector<PrefilterSample> samples;
+		if (roughness == 0.0f) {
+			float sourceLevel = std::max(0.0f, std::log2(static_cast<float>(source.size) / levelSize));
+			samples.push_back({ XMFLOAT3(0.0f, 0.0f, 1.0f), sourceLevel, 1.0f });
+		}
+		else {
+			samples = getPrefilterSamples(roughness, settings.sampleCount, source.size, source.levelCount);
+		}
+
+		float totalWeight = 0.0f;
+		for (auto& sample : samples) {
+			totalWeight += sample.weight;
+		}
+
+		jobs.parallelFor(levelSize * CUBE_FACE_COUNT, [&](uint32_t row, uint32_t) {
+			uint32_t face = row / levelSize, y = row % levelSize;
+			XMFLOAT4* texels = out.getFace(level, face) + static_cast<size_t>(y) * levelSize;
+			float t = (y + 0.5f) * 2.0f / levelSize - 1.0f;
+
+			for (uint32_t x = 0; x < levelSize; x++) {
+				XMFLOAT3 d = getCubeDirection(face, (x + 0.5f) * 2.0f / levelSize - 1.0f, t);
+				XMVECTOR normal = XMVector3Normalize(XMLoadFloat3(&d));
+
+				XMVECTOR up = std::fabs(d.y) < 0.999f * std::sqrt(d.x * d.x + d.y * d.y + d.z * d.z) ? XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f) : XMVectorSet(1.0f, 0.0f, 0.0f, 0.0f);
+				XMVECTOR tangent = XMVector3Normalize(XMVector3Cross(up, normal));
+				XMVECTOR bitangent = XMVector3Cross(normal, tangent);
+
+				XMVECTOR colour = XMVectorZero();
+				for (auto& sample : samples) {
+					XMVECTOR direction = XMVectorMultiplyAdd(tangent, XMVectorReplicate(sample.direction.x),
+						XMVectorMultiplyAdd(bitangent, XMVectorReplicate(sample.direction.y), XMVectorScale(normal, sample.direction.z)));
+					colour = XMVectorMultiplyAdd(source.sample(direction, sample.level), XMVectorReplicate(sample.weight), colour);
+				}
+
+				XMStoreFloat4(&texels[x], XMVectorSetW(XMVectorScale(colour, 1.0f / totalWeight), 1.0f));
+			}
+		});
+	}
+
+	return out;
+}
+
+static uint64_t hashBytes(uint64_t hash, const void* data, size_t size)
+{
+	auto bytes = static_cast<const unsigned char*>(data);
+
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		memcpy(&word, bytes + i, 8);
+		hash = (hash ^ word) * 0x100000001b3ull;
+		hash ^= hash >> 29;
+	}
+	for (; i < size; i++) {
+		hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+	}
+	return hash;
+}
+
+static bool readEnvironmentFile(const std::string& path, const EnvironmentFileHeader& header, EnvironmentLighting& out)
+{
+	std::ifstream file(path, std::ios::binary);
+	EnvironmentFileHeader existing{};
+	if (!file.read(reinterpret_cast<char*>(&existing), sizeof(existing)) || memcmp(&existing, &header, sizeof(header)) != 0)
+		return false;
+
+	out.specular.allocate(header.specularSize, header.specularLevels);
+	file.read(reinterpret_cast<char*>(&out.irradiance), sizeof(out.irradiance));
+	file.read(reinterpret_cast<char*>(out.specular.texels.data()), out.specular.texels.size() * sizeof(XMFLOAT4));
+	return static_cast<bool>(file);
+}
+
+EnvironmentBakeStats bakeEnvironmentLighting(const std::string& sourcePath, const std::string& cachePath, const SpecularPrefilterSettings& settings, JobSystem& jobs, EnvironmentLighting& out)
+{
+	if (settings.levels == 0 || settings.levels > 1 + std::log2(static_cast<float>(settings.size)) || settings.sampleCount == 0) {
+		throw std::runtime_error("Specular prefilter settings out of range");
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	auto elapsedMs = [](std::chrono::steady_clock::time_point since) {
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+	};
+
+	std::ifstream sourceFile(sourcePath, std::ios::binary);
+	if (!sourceFile) {
+		throw std::runtime_error("Failed to open " + sourcePath);
+	}
+	std::vector<unsigned char> sourceBytes{ std::istreambuf_iterator<char>(sourceFile), std::istreambuf_iterator<char>() };
+
+	EnvironmentFileHeader header{};
+	header.magic = ENVIRONMENT_FILE_MAGIC;
+	header.version = ENVIRONMENT_FILE_VERSION;
+	header.specularSize = settings.size;
+	header.specularLevels = settings.levels;
+	header.sampleCount = settings.sampleCount;
+	header.sourceBytes = static_cast<uint32_t>(sourceBytes.size());
+	header.hash = hashBytes(0xcbf29ce484222325ull, sourceBytes.data(), sourceBytes.size());
+
+	EnvironmentBakeStats stats{};
+	if (readEnvironmentFile(cachePath, header, out)) {
+		stats.upToDate = true;
+		stats.loadMs = elapsedMs(start);
+		return stats;
+	}
+
+	Cubemap source = loadCubemapDDS(sourcePath);
+	stats.loadMs = elapsedMs(start);
+
+	auto projectStart = std::chrono::steady_clock::now();
+	out.irradiance = projectIrradianceSH(source, jobs);
+	stats.projectMs = elapsedMs(projectStart);
+
+	auto prefilterStart = std::chrono::steady_clock::now();
+	out.specular = prefilterSpecular(source, settings, jobs);
+	stats.prefilterMs = elapsedMs(prefilterStart);
+
+	auto directory = std::filesystem::path(cachePath).parent_path();
+	if (!directory.empty())
+		std::filesystem::create_directories(directory);
+
+	// Written under another name and moved over the old file at the end, a bake that dies part way never looks up to date.
+	std::string tempPath = cachePath + ".tmp";
+	std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+	if (!file) {
+		throw std::runtime_error("Failed to open " + tempPath + " for writing");
+	}
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(&out.irradiance), sizeof(out.irradiance));
+	file.write(reinterpret_cast<const char*>(out.specular.texels.data()), out.specular.texels.size() * sizeof(XMFLOAT4));
+
+	file.close();
+	if (!file) {
+		throw std::runtime_error("Failed to write " + tempPath);
+	}
+
+	std::filesystem::rename(tempPath, cachePath);
+	return stats;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <DirectXMath.h>
+#include "Cubemap.h"
+
+class JobSystem;
+
+// L2 spherical harmonics of the irradiance, convolved with the cosine lobe and divided by PI up front. Evaluated at a
+// normal it's what albedo multiplies, so the shader's ambient is one polynomial per pixel. Coefficients are in the order
+// of the terms 1, y, z, x, xy, yz, 3z^2 - 1, xz, x^2 - y^2, w unused.
+struct IrradianceSH {
+	DirectX::XMFLOAT4 coefficients[9];
+};
+
+// The same ambient from every direction, what a light's ambient term used to add.
+IrradianceSH getConstantIrradianceSH(const DirectX::XMFLOAT4& ambient);
+DirectX::XMVECTOR evaluateIrradianceSH(const IrradianceSH& sh, DirectX::FXMVECTOR normal);
+
+// Four texels at a time with SSE, every texel weighted by its solid angle. Rows are spread over the jobs and their sums
+// added in order, so the result is the same whatever the thread count.
+IrradianceSH projectIrradianceSH(const Cubemap& source, JobSystem& jobs);
+// A texel at a time in double on the calling thread, to check the above against.
+IrradianceSH projectIrradianceSHReference(const Cubemap& source);
+
+struct SpecularPrefilterSettings {
+	// Top level of the prefiltered cube along a side, power of two.
+	uint32_t size = 128;
+	// Level i is filtered for roughness i / (levels - 1), so the last is fully rough.
+	uint32_t levels = 6;
+	// GGX samples per texel.
+	uint32_t sampleCount = 128;
+};
+
+// Importance samples a GGX lobe around each texel's direction, taking view = normal. Each sample reads the source at the
+// level whose texels cover about the solid angle the sample stands for, so few samples still give a smooth result.
+Cubemap prefilterSpecular(const Cubemap& source, const SpecularPrefilterSettings& settings, JobSystem& jobs);
+
+struct EnvironmentLighting {
+	IrradianceSH irradiance;
+	Cubemap specular;
+};
+
+struct EnvironmentBakeStats {
+	// True when the cache already held a bake of this source with these settings and nothing was baked.
+	bool upToDate;
+	double loadMs;
+	double projectMs;
+	double prefilterMs;
+};
+
+// Reads the bake from cachePath when it was made from exactly this source file with these settings, otherwise loads the
+// DDS cube at sourcePath, bakes it and writes the cache. Throws when the source can't be loaded.
+EnvironmentBakeStats bakeEnvironmentLighting(const std::string& sourcePath, const std::string& cachePath, const SpecularPrefilterSettings& settings, JobSystem& jobs, EnvironmentLighting& out);
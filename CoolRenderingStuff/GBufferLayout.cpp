@@ -0,0 +1,201 @@
+#include "GBufferLayout.h"
+#include <cmath>
+#include <algorithm>
+
+using namespace DirectX;
+
+static const GBufferLayoutDesc layoutDescs[] = {
+	{
+		"Standard",
+		{
+			{ "Position", DXGI_FORMAT_R16G16B16A16_FLOAT, 8 },
+			{ "Normals", DXGI_FORMAT_R16G16B16A16_SNORM, 8 },
+			{ "Albedo", DXGI_FORMAT_R8G8B8A8_UNORM_SRGB, 4 },
+			{ "Specular", DXGI_FORMAT_R16G16B16A16_FLOAT, 8 },
+		},
+		4,
+		false,
+		"shaders/deferredPixel",
+		"shaders/lightAccPixel",
+		"shaders/ambientPixel",
+	},
+	{
+		"Compact",
+		{
+			{ "Depth", DXGI_FORMAT_UNKNOWN, 0 },
+			{ "Normals", DXGI_FORMAT_R16G16_SNORM, 4 },
+			{ "Albedo", DXGI_FORMAT_R8G8B8A8_UNORM_SRGB, 4 },
+			{ "Specular", DXGI_FORMAT_R8G8B8A8_UNORM, 4 },
+		},
+		4,
+		true,
+		"shaders/deferredPixelCompact",
+		"shaders/lightAccPixelCompact",
+		"shaders/ambientPixelCompact",
+	},
+};
+
+const GBufferLayoutDesc& getGBufferLayoutDesc(GBufferLayout layout)
+{
+	return layoutDescs[static_cast<size_t>(layout)];
+}
+
+uint32_t getGBufferBytesPerPixel(GBufferLayout layout)
+{
+	auto& desc = getGBufferLayoutDesc(layout);
+
+	uint32_t total = 0;
+	for (size_t i = 0; i < GBUFFER_TARGET_COUNT; i++) {
+		total += desc.targets[i].bytesPerPixel;
+	}
+
+	return total;
+}
+
+GBufferBandwidth calculateGBufferBandwidth(GBufferLayout layout, uint32_t width, uint32_t height, uint32_t numLights)
+{
+	auto& desc = getGBufferLayoutDesc(layout);
+
+	uint64_t pixels = static_cast<uint64_t>(width) * height;
+	uint64_t colorBytes = getGBufferBytesPerPixel(layout);
+	uint64_t lightReadBytes = colorBytes + (desc.positionFromDepth ? desc.depthBytesPerPixel : 0);
+
+	GBufferBandwidth bandwidth{};
+	bandwidth.bytesPerPixel = colorBytes;
+	bandwidth.targetMemory = pixels * colorBytes;
+	bandwidth.geometryPassWrite = pixels * (colorBytes + desc.depthBytesPerPixel);
+	bandwidth.lightPassRead = pixels * lightReadBytes * numLights;
+	bandwidth.totalPerFrame = bandwidth.geometryPassWrite + bandwidth.lightPassRead;
+
+	return bandwidth;
+}
+
+namespace GBufferEncoding {
+	static float signNotZero(float v) {
+		return v >= 0.0f ? 1.0f : -1.0f;
+	}
+
+	static int16_t toSnorm16(float v) {
+		v = std::max(-1.0f, std::min(1.0f, v));
+		return static_cast<int16_t>(std::round(v * 32767.0f));
+	}
+
+	static float fromSnorm16(int16_t v) {
+		// -32768 and -32767 both map to -1.0 as per the D3D conversion rules.
+		return std::max(-1.0f, static_cast<float>(v) / 32767.0f);
+	}
+
+	static uint8_t toUnorm8(float v) {
+		v = std::max(0.0f, std::min(1.0f, v));
+		return static_cast<uint8_t>(std::round(v * 255.0f));
+	}
+
+	XMFLOAT2 encodeOctahedral(XMFLOAT3 n)
+	{
+		float invL1 = 1.0f / (std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z));
+		float x = n.x * invL1;
+		float y = n.y * invL1;
+
+		if (n.z < 0.0f) {
+			float wrappedX = (1.0f - std::fabs(y)) * signNotZero(x);
+			float wrappedY = (1.0f - std::fabs(x)) * signNotZero(y);
+			x = wrappedX;
+			y = wrappedY;
+		}
+
+		return { x, y };
+	}
+
+	XMFLOAT3 decodeOctahedral(XMFLOAT2 e)
+	{
+		XMFLOAT3 n = { e.x, e.y, 1.0f - std::fabs(e.x) - std::fabs(e.y) };
+
+		float t = std::max(-n.z, 0.0f);
+		n.x += n.x >= 0.0f ? -t : t;
+		n.y += n.y >= 0.0f ? -t : t;
+
+		XMFLOAT3 result;
+		XMStoreFloat3(&result, XMVector3Normalize(XMLoadFloat3(&n)));
+		return result;
+	}
+
+	uint32_t packOctahedralSnorm16(XMFLOAT2 encoded)
+	{
+		uint16_t x = static_cast<uint16_t>(toSnorm16(encoded.x));
+		uint16_t y = static_cast<uint16_t>(toSnorm16(encoded.y));
+		return static_cast<uint32_t>(x) | (static_cast<uint32_t>(y) << 16);
+	}
+
+	XMFLOAT2 unpackOctahedralSnorm16(uint32_t packed)
+	{
+		int16_t x = static_cast<int16_t>(packed & 0xffff);
+		int16_t y = static_cast<int16_t>(packed >> 16);
+		return { fromSnorm16(x), fromSnorm16(y) };
+	}
+
+	uint32_t packSpecularGloss(XMFLOAT3 specular, float gloss)
+	{
+		return static_cast<uint32_t>(toUnorm8(specular.x))
+			| (static_cast<uint32_t>(toUnorm8(specular.y)) << 8)
+			| (static_cast<uint32_t>(toUnorm8(specular.z)) << 16)
+			| (static_cast<uint32_t>(toUnorm8(gloss)) << 24);
+	}
+
+	void unpackSpecularGloss(uint32_t packed, XMFLOAT3& outSpecular, float& outGloss)
+	{
+		outSpecular.x = static_cast<float>(packed & 0xff) / 255.0f;
+		outSpecular.y = static_cast<float>((packed >> 8) & 0xff) / 255.0f;
+		outSpecular.z = static_cast<float>((packed >> 16) & 0xff) / 255.0f;
+		outGloss = static_cast<float>((packed >> 24) & 0xff) / 255.0f;
+	}
+
+	float specularPowerFromGloss(float gloss)
+	{
+		return gloss * 100.0f;
+	}
+
+	XMFLOAT3 reconstructPosition(XMFLOAT2 uv, float depth, FXMMATRIX invViewProj)
+	{
+		auto ndc = XMVectorSet(uv.x * 2.0f - 1.0f, 1.0f - uv.y * 2.0f, depth, 1.0f);
+		auto world = XMVector4Transform(ndc, invViewProj);
+		world = XMVectorScale(world, 1.0f / XMVectorGetW(world));
+
+		XMFLOAT3 result;
+		XMStoreFloat3(&result, world);
+		return result;
+	}
+
+	// From the sine and cosine both, acos alone can't resolve angles much under a hundredth of a degree in floats.
+	float angleBetweenDegrees(FXMVECTOR a, FXMVECTOR b)
+	{
+		float sine = XMVectorGetX(XMVector3Length(XMVector3Cross(a, b)));
+		float cosine = XMVectorGetX(XMVector3Dot(a, b));
+		return std::atan2(sine, cosine) * 180.0f / XM_PI;
+	}
+
+	float normalRoundTripErrorDegrees(XMFLOAT3 normal)
+	{
+		auto n = XMVector3Normalize(XMLoadFloat3(&normal));
+		XMStoreFloat3(&normal, n);
+
+		auto decoded = decodeOctahedral(unpackOctahedralSnorm16(packOctahedralSnorm16(encodeOctahedral(normal))));
+
+		return angleBetweenDegrees(n, XMLoadFloat3(&decoded));
+	}
+
+	float maxNormalRoundTripErrorDegrees(uint32_t sampleCount)
+	{
+		const float goldenAngle = XM_PI * (3.0f - std::sqrt(5.0f));
+
+		float maxError = 0.0f;
+		for (uint32_t i = 0; i < sampleCount; i++) {
+			float z = 1.0f - 2.0f * (static_cast<float>(i) + 0.5f) / sampleCount;
+			float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+			float phi = goldenAngle * i;
+
+			maxError = std::max(maxError, normalRoundTripErrorDegrees({ r * std::cos(phi), r * std::sin(phi), z }));
+		}
+
+		return maxError;
+	}
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include <cstdint>
+#include <dxgiformat.h>
+#include <DirectXMath.h>
+
+// Slots are shared between layouts so shaders and the visualizer can keep addressing targets by name.
+enum GBufferTarget {
+	GBUFFER_POSITION,
+	GBUFFER_NORMAL,
+	GBUFFER_ALBEDO,
+	GBUFFER_SPECULAR,
+	GBUFFER_TARGET_COUNT,
+};
+
+enum class GBufferLayout {
+	// RGBA16F world position, RGBA16 SNORM normal, RGBA8 albedo, RGBA16F specular. 28 bytes per pixel.
+	Standard,
+	// Position rebuilt from depth, RG16 SNORM octahedral normal, RGBA8 albedo, RGBA8 specular + gloss. 12 bytes per pixel.
+	Compact,
+};
+
+struct GBufferTargetDesc {
+	const char* name;
+	// DXGI_FORMAT_UNKNOWN means the target isn't stored and has to be reconstructed.
+	DXGI_FORMAT format;
+	uint32_t bytesPerPixel;
+};
+
+struct GBufferLayoutDesc {
+	const char* name;
+	GBufferTargetDesc targets[GBUFFER_TARGET_COUNT];
+
+	// The depth buffer is always there (R24G8), the compact layout just starts reading it.
+	uint32_t depthBytesPerPixel;
+	bool positionFromDepth;
+
+	const char* deferredPixelShader;
+	const char* lightAccPixelShader;
+	const char* ambientPixelShader;
+};
+
+const GBufferLayoutDesc& getGBufferLayoutDesc(GBufferLayout layout);
+
+// Bytes written per pixel into the colour targets, not counting depth.
+uint32_t getGBufferBytesPerPixel(GBufferLayout layout);
+
+struct GBufferBandwidth {
+	uint64_t bytesPerPixel;
+	uint64_t targetMemory;
+	// Every covered pixel writes all targets once (no overdraw accounted for).
+	uint64_t geometryPassWrite;
+	// Every light is a full screen quad, so each one re-reads the whole G-buffer.
+	uint64_t lightPassRead;
+	uint64_t totalPerFrame;
+};
+
+GBufferBandwidth calculateGBufferBandwidth(GBufferLayout layout, uint32_t width, uint32_t height, uint32_t numLights);
+
+// CPU reference versions of what the shaders do, so precision can be checked away from the GPU.
+namespace GBufferEncoding {
+	// Unit vector to the [-1, 1] octahedron square.
+	DirectX::XMFLOAT2 encodeOctahedral(DirectX::XMFLOAT3 normal);
+	DirectX::XMFLOAT3 decodeOctahedral(DirectX::XMFLOAT2 encoded);
+
+	// Round trip through the R16G16_SNORM storage used by the compact normal target.
+	uint32_t packOctahedralSnorm16(DirectX::XMFLOAT2 encoded);
+	DirectX::XMFLOAT2 unpackOctahedralSnorm16(uint32_t packed);
+
+	// Specular rgb and gloss into one RGBA8 UNORM texel.
+	uint32_t packSpecularGloss(DirectX::XMFLOAT3 specular, float gloss);
+	void unpackSpecularGloss(uint32_t packed, DirectX::XMFLOAT3& outSpecular, float& outGloss);
+	// Blinn-Phong power the light passes use, SpecularPower in common.hlsli.
+	float specularPowerFromGloss(float gloss);
+
+	// Matches the compact lightAccPixel path. uv is [0, 1] with y down, depth is the raw [0, 1] depth buffer value.
+	DirectX::XMFLOAT3 reconstructPosition(DirectX::XMFLOAT2 uv, float depth, DirectX::FXMMATRIX invViewProj);
+
+	// Angle in degrees between two unit vectors, accurate down to float rounding.
+	float angleBetweenDegrees(DirectX::FXMVECTOR a, DirectX::FXMVECTOR b);
+
+	// Angle in degrees between a normal and its encoded/quantized/decoded self.
+	float normalRoundTripErrorDegrees(DirectX::XMFLOAT3 normal);
+
+	// Worst round trip error over a fibonacci sphere of sampleCount normals.
+	float maxNormalRoundTripErrorDegrees(uint32_t sampleCount);
+}
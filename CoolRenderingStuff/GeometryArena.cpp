@@ -0,0 +1,182 @@
+#include "GeometryArena.h"
+#include <algorithm>
+#include <stdexcept>
+
+void GeometryArena::FreeList::reset(uint32_t used)
+{
+	byOffset.clear();
+	bySize.clear();
+	freeCount = 0;
+	if (used < capacity)
+		insert(used, capacity - used);
+}
+
+void GeometryArena::FreeList::insert(uint32_t offset, uint32_t count)
+{
+	byOffset[offset] = count;
+	bySize.insert({ count, offset });
+	freeCount += count;
+}
+
+void GeometryArena::FreeList::erase(std::map<uint32_t, uint32_t>::iterator block)
+{
+	bySize.erase({ block->second, block->first });
+	freeCount -= block->second;
+	byOffset.erase(block);
+}
+
+uint32_t GeometryArena::FreeList::allocate(uint32_t count)
+{
+	// Nothing to place, any offset will do.
+	if (count == 0)
+		return 0;
+
+	// The smallest block it fits, lowest offset first between equals.
+	auto fit = bySize.lower_bound({ count, 0 });
+	if (fit == bySize.end())
+		return NO_ALLOCATION;
+
+	uint32_t offset = fit->second;
+	uint32_t size = fit->first;
+	erase(byOffset.find(offset));
+
+	if (size > count)
+		insert(offset + count, size - count);
+
+	return offset;
+}
+
+void GeometryArena::FreeList::free(uint32_t offset, uint32_t count)
+{
+	if (count == 0)
+		return;
+
+	auto next = byOffset.lower_bound(offset);
+	if (next != byOffset.end() && next->first == offset + count) {
+		count += next->second;
+		erase(next);
+	}
+
+	auto previous = byOffset.lower_bound(offset);
+	if (previous != byOffset.begin()) {
+		--previous;
+		if (previous->first + previous->second == offset) {
+			offset = previous->first;
+			count += previous->second;
+			erase(previous);
+		}
+	}
+
+	insert(offset, count);
+}
+
+GeometryArena::GeometryArena(uint32_t vertexCapacity, uint32_t indexCapacity)
+{
+	if (vertexCapacity == 0 || indexCapacity == 0) {
+		throw std::runtime_error("Geometry arena needs room for at least one vertex and index!");
+	}
+
+	vertices.capacity = vertexCapacity;
+	indices.capacity = indexCapacity;
+	vertices.reset(0);
+	indices.reset(0);
+}
+
+uint32_t GeometryArena::allocate(uint32_t vertexCount, uint32_t indexCount)
+{
+	uint32_t baseVertex = vertices.allocate(vertexCount);
+	if (baseVertex == NO_ALLOCATION)
+		return NO_ALLOCATION;
+
+	uint32_t startIndex = indices.allocate(indexCount);
+	if (startIndex == NO_ALLOCATION) {
+		vertices.free(baseVertex, vertexCount);
+		return NO_ALLOCATION;
+	}
+
+	uint32_t handle;
+	if (!freeHandles.empty()) {
+		handle = freeHandles.back();
+		freeHandles.pop_back();
+	}
+	else {
+		handle = static_cast<uint32_t>(ranges.size());
+		ranges.push_back({});
+		live.push_back(0);
+	}
+
+	ranges[handle] = { baseVertex, vertexCount, startIndex, indexCount };
+	live[handle] = 1;
+	allocationCount++;
+
+	return handle;
+}
+
+void GeometryArena::free(uint32_t handle)
+{
+	if (handle >= live.size() || !live[handle]) {
+		throw std::runtime_error("Freed a geometry allocation that isn't live!");
+	}
+
+	auto& range = ranges[handle];
+	vertices.free(range.baseVertex, range.vertexCount);
+	indices.free(range.startIndex, range.indexCount);
+
+	live[handle] = 0;
+	freeHandles.push_back(handle);
+	allocationCount--;
+}
+
+bool GeometryArena::couldFit(uint32_t vertexCount, uint32_t indexCount) const
+{
+	return vertexCount <= vertices.freeCount && indexCount <= indices.freeCount;
+}
+
+std::vector<GeometryMove> GeometryArena::compact()
+{
+	std::vector<uint32_t> handles;
+	for (uint32_t i = 0; i < live.size(); i++) {
+		if (live[i])
+			handles.push_back(i);
+	}
+
+	std::vector<GeometryRange> packed(ranges);
+
+	std::sort(handles.begin(), handles.end(), [&](uint32_t a, uint32_t b) { return ranges[a].baseVertex < ranges[b].baseVertex; });
+	uint32_t vertexHead = 0;
+	for (uint32_t handle : handles) {
+		packed[handle].baseVertex = vertexHead;
+		vertexHead += ranges[handle].vertexCount;
+	}
+
+	std::sort(handles.begin(), handles.end(), [&](uint32_t a, uint32_t b) { return ranges[a].startIndex < ranges[b].startIndex; });
+	uint32_t indexHead = 0;
+	for (uint32_t handle : handles) {
+		packed[handle].startIndex = indexHead;
+		indexHead += ranges[handle].indexCount;
+	}
+
+	std::vector<GeometryMove> moves;
+	for (uint32_t handle : handles) {
+		moves.push_back({ handle, ranges[handle], packed[handle] });
+	}
+
+	ranges = std::move(packed);
+	vertices.reset(vertexHead);
+	indices.reset(indexHead);
+
+	return moves;
+}
+
+GeometryArenaStats GeometryArena::getStats() const
+{
+	GeometryArenaStats stats{};
+	stats.allocations = allocationCount;
+	stats.freeVertices = vertices.freeCount;
+	stats.freeIndices = indices.freeCount;
+	stats.usedVertices = vertices.capacity - vertices.freeCount;
+	stats.usedIndices = indices.capacity - indices.freeCount;
+	stats.largestFreeVertices = vertices.largest();
+	stats.largestFreeIndices = indices.largest();
+	return stats;
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <set>
+#include <vector>
+
+// Where a mesh lives in its arena's vertex and index buffers. Indices stay relative to the mesh, draws add baseVertex.
+struct GeometryRange {
+	uint32_t baseVertex;
+	uint32_t vertexCount;
+	uint32_t startIndex;
+	uint32_t indexCount;
+};
+
+// Where compact found an allocation and where it put it, the same when it didn't have to move.
+struct GeometryMove {
+	uint32_t handle;
+	GeometryRange from;
+	GeometryRange to;
+};
+
+struct GeometryArenaStats {
+	uint32_t allocations;
+	uint32_t usedVertices;
+	uint32_t usedIndices;
+	uint32_t freeVertices;
+	uint32_t freeIndices;
+	uint32_t largestFreeVertices;
+	uint32_t largestFreeIndices;
+
+	// How much of the free space is out of reach of the biggest allocation that could fit, 0 when it's all one block.
+	float vertexFragmentation() const { return freeVertices ? 1.0f - static_cast<float>(largestFreeVertices) / freeVertices : 0.0f; }
+	float indexFragmentation() const { return freeIndices ? 1.0f - static_cast<float>(largestFreeIndices) / freeIndices : 0.0f; }
+};
+
+// Suballocates meshes out of one fixed size vertex buffer and one index buffer, counted in vertices and indices.
+// Kept free of D3D like LinearConstantAllocator, GeometryPool owns the buffers. Each side is a best fit free list whose
+// neighbouring blocks merge back together on free, compact slides everything down when churn has split the free space up.
+class GeometryArena
+{
+public:
+	static const uint32_t NO_ALLOCATION = ~0u;
+
+	GeometryArena(uint32_t vertexCapacity, uint32_t indexCapacity);
+
+	// A handle for getRange and free, NO_ALLOCATION when either side has no free block big enough.
+	uint32_t allocate(uint32_t vertexCount, uint32_t indexCount);
+	void free(uint32_t handle);
+
+	const GeometryRange& getRange(uint32_t handle) const { return ranges[handle]; }
+
+	// True when there's enough free space in total, even if allocate would fail until compact has run.
+	bool couldFit(uint32_t vertexCount, uint32_t indexCount) const;
+
+	// Moves every allocation towards the start in offset order so each side's free space ends up in one block at the end.
+	// Handles stay the same. Every live allocation comes back so the caller can copy its data, a move can overlap its own
+	// source so the copies need to go to fresh buffers or run in order.
+	std::vector<GeometryMove> compact();
+
+	uint32_t getVertexCapacity() const { return vertices.capacity; }
+	uint32_t getIndexCapacity() const { return indices.capacity; }
+
+	GeometryArenaStats getStats() const;
+
+private:
+	// Free blocks of one buffer, by offset to merge neighbours and by size for best fit.
+	struct FreeList {
+		uint32_t capacity;
+		uint32_t freeCount;
+		std::map<uint32_t, uint32_t> byOffset;
+		std::set<std::pair<uint32_t, uint32_t>> bySize;
+
+		void reset(uint32_t used);
+		uint32_t allocate(uint32_t count);
+		void free(uint32_t offset, uint32_t count);
+		void insert(uint32_t offset, uint32_t count);
+		void erase(std::map<uint32_t, uint32_t>::iterator block);
+		uint32_t largest() const { return bySize.empty() ? 0 : bySize.rbegin()->first; }
+	};
+
+	FreeList vertices;
+	FreeList indices;
+
+	std::vector<GeometryRange> ranges;
+	std::vector<uint8_t> live;
+	std::vector<uint32_t> freeHandles;
+	uint32_t allocationCount = 0;
+};
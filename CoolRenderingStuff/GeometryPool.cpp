@@ -0,0 +1,179 @@
+#include "GeometryPool.h"
+#include <algorithm>
+#include <stdexcept>
+
+GeometryPool::GeometryPool(ID3D11Device* device, ID3D11DeviceContext* context, uint32_t pageVertices, uint32_t pageIndices) :
+	device(device),
+	context(context),
+	pageVertices(pageVertices),
+	pageIndices(pageIndices)
+{
+}
+
+GeometryPool::~GeometryPool()
+{
+	for (auto& page : pages) {
+		page.vertices->Release();
+		page.indices->Release();
+		delete page.arena;
+	}
+}
+
+void GeometryPool::createBuffers(uint32_t vertexCount, uint32_t indexCount, ID3D11Buffer** vertices, ID3D11Buffer** indices)
+{
+	D3D11_BUFFER_DESC vDesc{};
+	vDesc.Usage = D3D11_USAGE_DEFAULT;
+	vDesc.ByteWidth = static_cast<UINT>(sizeof(Vertex) * vertexCount);
+	vDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+
+	if (FAILED(device->CreateBuffer(&vDesc, nullptr, vertices))) {
+		throw std::runtime_error("Failed to create a geometry page vertex buffer!");
+	}
+
+	D3D11_BUFFER_DESC iDesc{};
+	iDesc.Usage = D3D11_USAGE_DEFAULT;
+	iDesc.ByteWidth = static_cast<UINT>(sizeof(uint32_t) * indexCount);
+	iDesc.BindFlags = D3D11_BIND_INDEX_BUFFER;
+
+	if (FAILED(device->CreateBuffer(&iDesc, nullptr, indices))) {
+		(*vertices)->Release();
+		throw std::runtime_error("Failed to create a geometry page index buffer!");
+	}
+}
+
+uint32_t GeometryPool::addPage(uint32_t vertexCount, uint32_t indexCount)
+{
+	Page page;
+	page.arena = new GeometryArena(std::max(vertexCount, 1u), std::max(indexCount, 1u));
+	createBuffers(page.arena->getVertexCapacity(), page.arena->getIndexCapacity(), &page.vertices, &page.indices);
+
+	pages.push_back(page);
+	return static_cast<uint32_t>(pages.size() - 1);
+}
+
+void GeometryPool::compactPage(uint32_t pageIndex)
+{
+	auto& page = pages[pageIndex];
+
+	ID3D11Buffer* vertices;
+	ID3D11Buffer* indices;
+	createBuffers(page.arena->getVertexCapacity(), page.arena->getIndexCapacity(), &vertices, &indices);
+
+	for (auto& move : page.arena->compact()) {
+		if (move.from.vertexCount) {
+			D3D11_BOX box{ static_cast<UINT>(sizeof(Vertex) * move.from.baseVertex), 0, 0, static_cast<UINT>(sizeof(Vertex) * (move.from.baseVertex + move.from.vertexCount)), 1, 1 };
+			context->CopySubresourceRegion(vertices, 0, static_cast<UINT>(sizeof(Vertex) * move.to.baseVertex), 0, 0, page.vertices, 0, &box);
+		}
+
+		if (move.from.indexCount) {
+			D3D11_BOX box{ static_cast<UINT>(sizeof(uint32_t) * move.from.startIndex), 0, 0, static_cast<UINT>(sizeof(uint32_t) * (move.from.startIndex + move.from.indexCount)), 1, 1 };
+			context->CopySubresourceRegion(indices, 0, static_cast<UINT>(sizeof(uint32_t) * move.to.startIndex), 0, 0, page.indices, 0, &box);
+		}
+
+		if (move.from.baseVertex != move.to.baseVertex)
+			movedBytes += sizeof(Vertex) * move.from.vertexCount;
+		if (move.from.startIndex != move.to.startIndex)
+			movedBytes += sizeof(uint32_t) * move.from.indexCount;
+	}
+
+	page.vertices->Release();
+	page.indices->Release();
+	page.vertices = vertices;
+	page.indices = indices;
+
+	if (boundPage == pageIndex)
+		boundPage = NO_PAGE;
+	compactions++;
+}
+
+GeometryAllocation GeometryPool::upload(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices)
+{
+	uint32_t vertexCount = static_cast<uint32_t>(vertices.size());
+	uint32_t indexCount = static_cast<uint32_t>(indices.size());
+
+	GeometryAllocation allocation{ NO_PAGE, GeometryArena::NO_ALLOCATION };
+	for (uint32_t i = 0; i < pages.size() && allocation.page == NO_PAGE; i++) {
+		uint32_t handle = pages[i].arena->allocate(vertexCount, indexCount);
+		if (handle == GeometryArena::NO_ALLOCATION && pages[i].arena->couldFit(vertexCount, indexCount)) {
+			compactPage(i);
+			handle = pages[i].arena->allocate(vertexCount, indexCount);
+		}
+
+		if (handle != GeometryArena::NO_ALLOCATION)
+			allocation = { i, handle };
+	}
+
+	if (allocation.page == NO_PAGE) {
+		uint32_t page = addPage(std::max(vertexCount, pageVertices), std::max(indexCount, pageIndices));
+		allocation = { page, pages[page].arena->allocate(vertexCount, indexCount) };
+	}
+
+	auto& page = pages[allocation.page];
+	auto& range = page.arena->getRange(allocation.handle);
+
+	if (vertexCount) {
+		D3D11_BOX box{ static_cast<UINT>(sizeof(Vertex) * range.baseVertex), 0, 0, static_cast<UINT>(sizeof(Vertex) * (range.baseVertex + vertexCount)), 1, 1 };
+		context->UpdateSubresource(page.vertices, 0, &box, vertices.data(), 0, 0);
+	}
+
+	if (indexCount) {
+		D3D11_BOX box{ static_cast<UINT>(sizeof(uint32_t) * range.startIndex), 0, 0, static_cast<UINT>(sizeof(uint32_t) * (range.startIndex + indexCount)), 1, 1 };
+		context->UpdateSubresource(page.indices, 0, &box, indices.data(), 0, 0);
+	}
+
+	return allocation;
+}
+
+void GeometryPool::updateVertices(const GeometryAllocation& allocation, const std::vector<Vertex>& vertices)
+{
+	auto& page = pages[allocation.page];
+	auto& range = page.arena->getRange(allocation.handle);
+	if (vertices.size() != range.vertexCount)
+		throw std::runtime_error("Vertex count doesn't match the allocation");
+
+	if (vertices.empty())
+		return;
+
+	D3D11_BOX box{ static_cast<UINT>(sizeof(Vertex) * range.baseVertex), 0, 0, static_cast<UINT>(sizeof(Vertex) * (range.baseVertex + range.vertexCount)), 1, 1 };
+	context->UpdateSubresource(page.vertices, 0, &box, vertices.data(), 0, 0);
+}
+
+void GeometryPool::free(const GeometryAllocation& allocation)
+{
+	pages[allocation.page].arena->free(allocation.handle);
+}
+
+bool GeometryPool::bind(uint32_t page)
+{
+	if (boundPage == page)
+		return false;
+
+	uint32_t stride = sizeof(Vertex);
+	uint32_t offset = 0;
+	context->IASetVertexBuffers(0, 1, &pages[page].vertices, &stride, &offset);
+	context->IASetIndexBuffer(pages[page].indices, DXGI_FORMAT_R32_UINT, 0);
+
+	boundPage = page;
+	return true;
+}
+
+GeometryPoolStats GeometryPool::getStats() const
+{
+	GeometryPoolStats stats{};
+	stats.pages = static_cast<uint32_t>(pages.size());
+	stats.compactions = compactions;
+	stats.movedBytes = movedBytes;
+
+	for (auto& page : pages) {
+		auto arena = page.arena->getStats();
+		stats.arenas.allocations += arena.allocations;
+		stats.arenas.usedVertices += arena.usedVertices;
+		stats.arenas.usedIndices += arena.usedIndices;
+		stats.arenas.freeVertices += arena.freeVertices;
+		stats.arenas.freeIndices += arena.freeIndices;
+		stats.arenas.largestFreeVertices = std::max(stats.arenas.largestFreeVertices, arena.largestFreeVertices);
+		stats.arenas.largestFreeIndices = std::max(stats.arenas.largestFreeIndices, arena.largestFreeIndices);
+	}
+
+	return stats;
+}
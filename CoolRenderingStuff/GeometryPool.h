@@ -0,0 +1,72 @@
+#pragma once
+#include <d3d11.h>
+#include <cstdint>
+#include <vector>
+#include "GeometryArena.h"
+#include "Scene.h"
+
+// A mesh's page and its handle in that page's arena.
+struct GeometryAllocation {
+	uint32_t page;
+	uint32_t handle;
+};
+
+struct GeometryPoolStats {
+	uint32_t pages;
+	uint32_t compactions;
+	uint64_t movedBytes;
+	GeometryArenaStats arenas;
+};
+
+// Every mesh's vertices and indices in a few big buffer pairs, one GeometryArena per pair, so draws of meshes in the same
+// page share their bindings and only pick their range through the draw's base vertex and start index.
+// A mesh bigger than a page gets a page of its own sized to fit.
+class GeometryPool
+{
+public:
+	GeometryPool(ID3D11Device* device, ID3D11DeviceContext* context, uint32_t pageVertices = 1 << 20, uint32_t pageIndices = 1 << 22);
+	~GeometryPool();
+
+	GeometryPool(const GeometryPool&) = delete;
+	GeometryPool& operator=(const GeometryPool&) = delete;
+
+	// Into the first page with room. A page that only has the room spread out is compacted first, a new page is the last resort.
+	GeometryAllocation upload(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices);
+	void free(const GeometryAllocation& allocation);
+	// Writes over an allocation's vertices where they are, there have to be as many as it was uploaded with.
+	void updateVertices(const GeometryAllocation& allocation, const std::vector<Vertex>& vertices);
+
+	const GeometryRange& getRange(const GeometryAllocation& allocation) const { return pages[allocation.page].arena->getRange(allocation.handle); }
+
+	// Slot 0 and the index buffer, skipped when the page is already bound. Returns whether it had to bind.
+	bool bind(uint32_t page);
+	// For when something else has bound buffers behind the pool's back.
+	void resetBinding() { boundPage = NO_PAGE; }
+
+	GeometryPoolStats getStats() const;
+
+private:
+	static const uint32_t NO_PAGE = ~0u;
+
+	struct Page {
+		GeometryArena* arena;
+		ID3D11Buffer* vertices;
+		ID3D11Buffer* indices;
+	};
+
+	void createBuffers(uint32_t vertexCount, uint32_t indexCount, ID3D11Buffer** vertices, ID3D11Buffer** indices);
+	uint32_t addPage(uint32_t vertexCount, uint32_t indexCount);
+	// Copies everything over to new buffers in its packed place, the old buffers may be bound so they're only released.
+	void compactPage(uint32_t page);
+
+	ID3D11Device* device;
+	ID3D11DeviceContext* context;
+	uint32_t pageVertices;
+	uint32_t pageIndices;
+
+	std::vector<Page> pages;
+	uint32_t boundPage = NO_PAGE;
+
+	uint32_t compactions = 0;
+	uint64_t movedBytes = 0;
+};
@@ -1,64 +1,126 @@
 #include "GraphicsPipeline.h"
 
-GraphicsPipeline::GraphicsPipeline(
-	ID3D11Device* device, 
-	std::vector<char> vertexShaderCode, 
-	std::vector<char> pixelShaderCode,
-	std::optional<std::vector<D3D11_INPUT_ELEMENT_DESC>> inputElementDescs,
-	D3D11_RASTERIZER_DESC rasterizer,
-	D3D11_DEPTH_STENCIL_DESC depthStencil,
-	D3D11_BLEND_DESC blend,
-	D3D11_PRIMITIVE_TOPOLOGY primitiveTopology, 
-	D3D11_VIEWPORT viewport, 
-	D3D11_RECT scissor)
+static bool viewportEqual(const D3D11_VIEWPORT& a, const D3D11_VIEWPORT& b)
 {
-	device->CreateVertexShader(vertexShaderCode.data(), vertexShaderCode.size(), nullptr, &vertexShader);
-	device->CreatePixelShader(pixelShaderCode.data(), pixelShaderCode.size(), nullptr, &pixelShader);
+	return a.TopLeftX == b.TopLeftX && a.TopLeftY == b.TopLeftY && a.Width == b.Width && a.Height == b.Height && a.MinDepth == b.MinDepth && a.MaxDepth == b.MaxDepth;
+}
+
+static bool scissorEqual(const D3D11_RECT& a, const D3D11_RECT& b)
+{
+	return a.left == b.left && a.top == b.top && a.right == b.right && a.bottom == b.bottom;
+}
+
+void PipelineBindState::setPixelShader(ID3D11DeviceContext* context, ID3D11PixelShader* shader)
+{
+	if (valid && pixelShader == shader) {
+		skipped++;
+		return;
+	}
+
+	context->PSSetShader(shader, nullptr, 0);
+	pixelShader = shader;
+	changes++;
+}
+
+void PipelineBindState::setDepthStencilState(ID3D11DeviceContext* context, ID3D11DepthStencilState* state)
+{
+	if (valid && depthStencilState == state) {
+		skipped++;
+		return;
+	}
+
+	context->OMSetDepthStencilState(state, 0);
+	depthStencilState = state;
+	changes++;
+}
 
-	if (inputElementDescs.has_value())
-		device->CreateInputLayout(inputElementDescs.value().data(), inputElementDescs.value().size(), vertexShaderCode.data(), vertexShaderCode.size(), &inputLayout);
+GraphicsPipeline::GraphicsPipeline(StateCache& states, const GraphicsPipelineDesc& desc)
+{
+	// Before the shaders, a layout that doesn't match the vertex shader throws without leaving a reference behind.
+	if (desc.inputElementDescs.has_value())
+		inputLayout = states.getInputLayout(desc.inputElementDescs.value(), desc.vertexShaderCode);
 	else inputLayout = nullptr;
 
-	device->CreateRasterizerState(&rasterizer, &rasterizerState);
+	vertexShader = states.getVertexShader(desc.vertexShaderCode);
+	// No pixel shader code means a depth only pipeline.
+	if (!desc.pixelShaderCode.empty())
+		pixelShader = states.getPixelShader(desc.pixelShaderCode);
+	else pixelShader = nullptr;
 
-	this->primitiveTopology = primitiveTopology;
+	rasterizerState = states.getRasterizerState(desc.rasterizer);
 
-	this->viewport = viewport;
-	this->scissor = scissor;
+	this->primitiveTopology = desc.primitiveTopology;
 
-	device->CreateDepthStencilState(&depthStencil, &depthStencilState);
+	depthStencilState = states.getDepthStencilState(desc.depthStencil);
 
-	device->CreateBlendState(&blend, &blendState);
+	blendState = states.getBlendState(desc.blend);
 }
 
 GraphicsPipeline::~GraphicsPipeline()
 {
-	if (inputLayout)
-		inputLayout->Release();
 	vertexShader->Release();
-	rasterizerState->Release();
-	pixelShader->Release();
-	depthStencilState->Release();
-	blendState->Release();
+	if (pixelShader)
+		pixelShader->Release();
 }
 
-void GraphicsPipeline::bind(ID3D11DeviceContext* context)
+void GraphicsPipeline::bind(ID3D11DeviceContext* context, const D3D11_VIEWPORT& viewport, const D3D11_RECT& scissor, PipelineBindState* bound)
 {
-	context->IASetPrimitiveTopology(primitiveTopology);
+	// Without a bind state everything is set, same as before.
+	bool all = !bound || !bound->valid;
+	uint32_t changes = 0;
+	uint32_t total = 0;
+
+	auto differs = [&](bool different) {
+		total++;
+		if (different) {
+			changes++;
+			return true;
+		}
+		return false;
+	};
 
-	context->VSSetShader(vertexShader, nullptr, 0);
+	if (differs(all || bound->primitiveTopology != primitiveTopology))
+		context->IASetPrimitiveTopology(primitiveTopology);
+
+	if (differs(all || bound->vertexShader != vertexShader))
+		context->VSSetShader(vertexShader, nullptr, 0);
 
 	// No need to check cos nullptr is valid here.
-	context->IASetInputLayout(inputLayout);
+	if (differs(all || bound->inputLayout != inputLayout))
+		context->IASetInputLayout(inputLayout);
+
+	if (differs(all || bound->rasterizerState != rasterizerState))
+		context->RSSetState(rasterizerState);
+	if (differs(all || !viewportEqual(bound->viewport, viewport)))
+		context->RSSetViewports(1, &viewport);
+	if (differs(all || !scissorEqual(bound->scissor, scissor)))
+		context->RSSetScissorRects(1, &scissor);
+
+	if (differs(all || bound->pixelShader != pixelShader))
+		context->PSSetShader(pixelShader, nullptr, 0);
+
+	if (differs(all || bound->blendState != blendState)) {
+		float blendFactor[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+		UINT sampleMask = 0xffffffff;
+		context->OMSetBlendState(blendState, blendFactor, sampleMask);
+	}
+	if (differs(all || bound->depthStencilState != depthStencilState))
+		context->OMSetDepthStencilState(depthStencilState, 0);
 
-	context->RSSetState(rasterizerState);
-	context->RSSetViewports(1, &viewport);
-	context->RSSetScissorRects(1, &scissor);
+	if (!bound)
+		return;
 
-	context->PSSetShader(pixelShader, nullptr, 0);
+	bound->primitiveTopology = primitiveTopology;
+	bound->inputLayout = inputLayout;
+	bound->vertexShader = vertexShader;
+	bound->rasterizerState = rasterizerState;
+	bound->pixelShader = pixelShader;
+	bound->depthStencilState = depthStencilState;
+	bound->blendState = blendState;
+	bound->viewport = viewport;
+	bound->scissor = scissor;
+	bound->valid = true;
 
-	float blendFactor[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
-	UINT sampleMask = 0xffffffff;
-	context->OMSetBlendState(blendState, blendFactor, sampleMask);
-	context->OMSetDepthStencilState(depthStencilState, 0);
+	bound->changes += changes;
+	bound->skipped += total - changes;
 }
@@ -2,37 +2,54 @@
 #include <d3d11.h>
 #include <vector>
 #include <optional>
+#include <cstdint>
+#include "StateCache.h"
 
-struct GraphicsPipeline
+// What the context currently has bound, so pipelines sharing cached states only set what actually differs.
+// Anything bound behind its back (ImGui, the lighting draws) has to be followed by a reset.
+struct PipelineBindState
 {
 	D3D_PRIMITIVE_TOPOLOGY primitiveTopology;
-
 	ID3D11InputLayout* inputLayout;
-
 	ID3D11VertexShader* vertexShader;
 	ID3D11RasterizerState* rasterizerState;
 	ID3D11PixelShader* pixelShader;
 	ID3D11DepthStencilState* depthStencilState;
 	ID3D11BlendState* blendState;
-
 	D3D11_VIEWPORT viewport;
 	D3D11_RECT scissor;
+	bool valid = false;
 
-	GraphicsPipeline(
-		ID3D11Device* device,
-		std::vector<char> vertexShaderCode,
-		std::vector<char> pixelShaderCode,
-		std::optional<std::vector<D3D11_INPUT_ELEMENT_DESC>> inputElementDescs,
-		D3D11_RASTERIZER_DESC rasterizer,
-		D3D11_DEPTH_STENCIL_DESC depthStencil,
-		D3D11_BLEND_DESC blend,
-		D3D11_PRIMITIVE_TOPOLOGY primitiveTopology,
-		D3D11_VIEWPORT viewport,
-		D3D11_RECT scissor = { 0 }
-	);
+	uint64_t changes = 0;
+	uint64_t skipped = 0;
 
-	~GraphicsPipeline();
+	// Once a frame, the counters are per frame too.
+	void reset() { valid = false; changes = 0; skipped = 0; }
 
-	void bind(ID3D11DeviceContext* context);
+	void setPixelShader(ID3D11DeviceContext* context, ID3D11PixelShader* shader);
+	void setDepthStencilState(ID3D11DeviceContext* context, ID3D11DepthStencilState* state);
 };
 
+struct GraphicsPipeline
+{
+	D3D_PRIMITIVE_TOPOLOGY primitiveTopology;
+
+	// Owned by the StateCache.
+	ID3D11InputLayout* inputLayout;
+
+	// Referenced by the pipeline. Hot reload asks the cache for a new pipeline rather than swapping these.
+	ID3D11VertexShader* vertexShader;
+	ID3D11PixelShader* pixelShader;
+
+	// Owned by the StateCache.
+	ID3D11RasterizerState* rasterizerState;
+	ID3D11DepthStencilState* depthStencilState;
+	ID3D11BlendState* blendState;
+
+	GraphicsPipeline(StateCache& states, const GraphicsPipelineDesc& desc);
+
+	~GraphicsPipeline();
+
+	// Shared by everything that asked the cache for the same desc, so where it draws comes from the caller every bind.
+	void bind(ID3D11DeviceContext* context, const D3D11_VIEWPORT& viewport, const D3D11_RECT& scissor, PipelineBindState* bound = nullptr);
+};
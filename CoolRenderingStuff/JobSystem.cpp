@@ -0,0 +1,98 @@
+#include "JobSystem.h"
+#include <algorithm>
+
+JobSystem::JobSystem(uint32_t numThreads)
+{
+	if (numThreads == 0) {
+		numThreads = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	for (uint32_t i = 1; i < numThreads; i++) {
+		workers.emplace_back(&JobSystem::workerMain, this, i);
+	}
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	wake.notify_all();
+
+	for (auto& worker : workers) {
+		worker.join();
+	}
+}
+
+void JobSystem::run(uint32_t count, const JobRef& job)
+{
+	if (count == 0)
+		return;
+
+	if (workers.empty() || count == 1) {
+		for (uint32_t i = 0; i < count; i++) {
+			job.call(job.job, i, 0);
+		}
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		currentJob = &job;
+		currentCount = count;
+		currentCounter = AllocationScope::getCurrent();
+		nextIndex = 0;
+		completed = 0;
+		batchId++;
+	}
+	wake.notify_all();
+
+	runIndices(0);
+
+	// Workers may still be inside the batch even once every index has been handed out.
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [&] { return completed == currentCount && activeWorkers == 0; });
+	currentJob = nullptr;
+}
+
+void JobSystem::workerMain(uint32_t threadIndex)
+{
+	uint64_t lastBatch = 0;
+
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [&] { return quit || (currentJob && batchId != lastBatch); });
+
+			if (quit)
+				return;
+
+			lastBatch = batchId;
+			activeWorkers++;
+		}
+
+		{
+			AllocationScope scope(currentCounter);
+			runIndices(threadIndex);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			activeWorkers--;
+		}
+		done.notify_one();
+	}
+}
+
+void JobSystem::runIndices(uint32_t threadIndex)
+{
+	while (true) {
+		uint32_t index = nextIndex.fetch_add(1);
+		if (index >= currentCount)
+			return;
+
+		currentJob->call(currentJob->job, index, threadIndex);
+		completed.fetch_add(1);
+	}
+}
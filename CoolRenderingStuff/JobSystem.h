@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "AllocationTracer.h"
+
+// Fixed pool of worker threads. parallelFor blocks until every index has run, the calling thread helps out.
+class JobSystem
+{
+public:
+	// 0 threads means one per hardware thread, including the caller.
+	JobSystem(uint32_t numThreads = 0);
+	~JobSystem();
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	// Runs job(index, threadIndex) for index in [0, count). threadIndex is in [0, getNumThreads()), 0 being the caller.
+	// job is only referenced, not copied into a std::function, so a lambda with a lot of captures doesn't allocate.
+	template<typename Job>
+	void parallelFor(uint32_t count, const Job& job) {
+		run(count, { &job, [](const void* job, uint32_t index, uint32_t threadIndex) { (*static_cast<const Job*>(job))(index, threadIndex); } });
+	}
+
+	uint32_t getNumThreads() const { return static_cast<uint32_t>(workers.size()) + 1; }
+
+private:
+	struct JobRef {
+		const void* job;
+		void (*call)(const void* job, uint32_t index, uint32_t threadIndex);
+	};
+
+	void run(uint32_t count, const JobRef& job);
+	void workerMain(uint32_t threadIndex);
+	void runIndices(uint32_t threadIndex);
+
+	std::vector<std::thread> workers;
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+
+	// Current batch, only touched under the mutex apart from the counters.
+	const JobRef* currentJob = nullptr;
+	// The caller's AllocationScope counter, the workers count towards it too.
+	AllocationCounter* currentCounter = nullptr;
+	uint32_t currentCount = 0;
+	uint64_t batchId = 0;
+	std::atomic<uint32_t> nextIndex{ 0 };
+	std::atomic<uint32_t> completed{ 0 };
+	uint32_t activeWorkers = 0;
+
+	bool quit = false;
+};
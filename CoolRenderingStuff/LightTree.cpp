@@ -0,0 +1,322 @@
+#include "LightTree.h"
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+#include <stdexcept>
+
+using namespace DirectX;
+
+// Lights behind the surface still reach it through the specular term, so no node's weight goes all the way to zero.
+static const float MIN_COSINE = 0.05f;
+// A centimetre, so a point right on a light doesn't make its weight infinite.
+static const float MIN_DISTANCE_SQ = 1e-4f;
+// Largest float below 1, u is kept under it as it's rescaled down the tree.
+static const float ONE_MINUS_EPSILON = 0x1.fffffep-1f;
+
+float getLightPower(const Light& light)
+{
+	return light.intensity * (light.color.x + light.color.y + light.color.z) / 3.0f;
+}
+
+namespace {
+
+struct LightBounds {
+	XMFLOAT3 min = { FLT_MAX, FLT_MAX, FLT_MAX };
+	XMFLOAT3 max = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	float power = 0.0f;
+
+	void grow(const XMFLOAT3& p) {
+		min = { std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z) };
+		max = { std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z) };
+	}
+
+	void grow(const LightBounds& b) {
+		power += b.power;
+		// An empty bin's inverted bounds would otherwise stretch these to infinity.
+		if (b.max.x < b.min.x)
+			return;
+		grow(b.min);
+		grow(b.max);
+	}
+
+	float area() const {
+		float x = max.x - min.x, y = max.y - min.y, z = max.z - min.z;
+		return (x < 0.0f) ? 0.0f : 2.0f * (x * y + y * z + z * x);
+	}
+};
+
+float getAxis(const XMFLOAT3& v, uint32_t axis)
+{
+	return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+// What the build needs of a light, packed so the partitions move these rather than indices into the lights.
+struct BuildLight {
+	XMFLOAT3 position;
+	float power;
+	uint32_t light;
+};
+
+struct LightTreeBuilder {
+	std::vector<BuildLight>& input;
+	std::vector<LightTree::Node>& nodes;
+	std::vector<uint32_t>& leaves;
+	uint32_t depth = 0;
+
+	// Splits [begin, end) of input at the cheapest of SAH_BINS planes on each axis, where a side costs its power times
+	// its area. Both sides are weighed by power when sampling so a bright light in a big box is what hurts most.
+	void build(uint32_t begin, uint32_t end, uint32_t level) {
+		depth = std::max(depth, level + 1);
+
+		uint32_t nodeIndex = static_cast<uint32_t>(nodes.size());
+		nodes.emplace_back();
+
+		LightBounds bounds;
+		for (uint32_t i = begin; i < end; i++) {
+			bounds.grow(input[i].position);
+			bounds.power += input[i].power;
+		}
+
+		nodes[nodeIndex].min = bounds.min;
+		nodes[nodeIndex].max = bounds.max;
+		nodes[nodeIndex].power = bounds.power;
+
+		uint32_t count = end - begin;
+		if (count == 1) {
+			nodes[nodeIndex].offset = input[begin].light | LightTree::LEAF_BIT;
+			leaves[input[begin].light] = nodeIndex;
+			return;
+		}
+
+		float bestCost = FLT_MAX;
+		uint32_t bestAxis = 0;
+		uint32_t bestSplit = 0;
+
+		for (uint32_t axis = 0; axis < 3 && level < LightTree::MEDIAN_SPLIT_DEPTH; axis++) {
+			float lo = getAxis(bounds.min, axis);
+			float extent = getAxis(bounds.max, axis) - lo;
+			if (!(extent > 0.0f))
+				continue;
+
+			LightBounds binBounds[LightTree::SAH_BINS];
+			float scale = LightTree::SAH_BINS / extent;
+
+			for (uint32_t i = begin; i < end; i++) {
+				auto& light = input[i];
+				uint32_t bin = std::min(LightTree::SAH_BINS - 1, static_cast<uint32_t>((getAxis(light.position, axis) - lo) * scale));
+				binBounds[bin].grow(light.position);
+				binBounds[bin].power += light.power;
+			}
+
+			// Right to left sweep first, then the left side is grown bin by bin against it.
+			float rightCosts[LightTree::SAH_BINS];
+			bool rightEmpty[LightTree::SAH_BINS];
+			LightBounds right;
+			for (uint32_t bin = LightTree::SAH_BINS - 1; bin > 0; bin--) {
+				right.grow(binBounds[bin]);
+				rightCosts[bin] = right.power * right.area();
+				rightEmpty[bin] = right.max.x < right.min.x;
+			}
+
+			LightBounds left;
+			for (uint32_t split = 1; split < LightTree::SAH_BINS; split++) {
+				left.grow(binBounds[split - 1]);
+				if (left.max.x < left.min.x || rightEmpty[split])
+					continue;
+
+				float cost = left.power * left.area() + rightCosts[split];
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = split;
+				}
+			}
+		}
+
+		uint32_t middle;
+		if (bestCost < FLT_MAX) {
+			float lo = getAxis(bounds.min, bestAxis);
+			float scale = LightTree::SAH_BINS / (getAxis(bounds.max, bestAxis) - lo);
+			middle = static_cast<uint32_t>(std::partition(input.begin() + begin, input.begin() + end, [&](const BuildLight& light) {
+				return std::min(LightTree::SAH_BINS - 1, static_cast<uint32_t>((getAxis(light.position, bestAxis) - lo) * scale)) < bestSplit;
+			}) - input.begin());
+		}
+		else {
+			// Too deep or every light in the same place, half on either side of the longest axis' median.
+			XMFLOAT3 extent = { bounds.max.x - bounds.min.x, bounds.max.y - bounds.min.y, bounds.max.z - bounds.min.z };
+			uint32_t axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+			middle = begin + count / 2;
+			std::nth_element(input.begin() + begin, input.begin() + middle, input.begin() + end, [&](const BuildLight& a, const BuildLight& b) {
+				return getAxis(a.position, axis) < getAxis(b.position, axis);
+			});
+		}
+
+		build(begin, middle, level + 1);
+		nodes[nodeIndex].offset = static_cast<uint32_t>(nodes.size());
+		build(middle, end, level + 1);
+	}
+};
+
+}
+
+void LightTree::build(const std::vector<Light>& lights)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	nodes.clear();
+	leaves.assign(lights.size(), 0);
+	depth = 0;
+
+	if (lights.size() >= LEAF_BIT)
+		throw std::runtime_error("Too many lights for the light tree");
+
+	if (!lights.empty()) {
+		std::vector<BuildLight> input(lights.size());
+		for (uint32_t i = 0; i < lights.size(); i++) {
+			input[i] = { lights[i].position, getLightPower(lights[i]), i };
+		}
+
+		nodes.reserve(lights.size() * 2 - 1);
+
+		LightTreeBuilder builder{ input, nodes, leaves };
+		builder.build(0, static_cast<uint32_t>(lights.size()), 0);
+		depth = builder.depth;
+	}
+
+	buildMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void LightTree::refit(const std::vector<Light>& lights)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	if (lights.size() != leaves.size())
+		throw std::runtime_error("Light count changed since the light tree was built");
+
+	// Children always come after their parent, so back to front sees them first.
+	for (size_t i = nodes.size(); i-- > 0;) {
+		auto& node = nodes[i];
+		if (node.offset & LEAF_BIT) {
+			auto& light = lights[node.offset & ~LEAF_BIT];
+			node.min = light.position;
+			node.max = light.position;
+			node.power = getLightPower(light);
+		}
+		else {
+			auto& left = nodes[i + 1];
+			auto& right = nodes[node.offset];
+			node.min = { std::min(left.min.x, right.min.x), std::min(left.min.y, right.min.y), std::min(left.min.z, right.min.z) };
+			node.max = { std::max(left.max.x, right.max.x), std::max(left.max.y, right.max.y), std::max(left.max.z, right.max.z) };
+			node.power = left.power + right.power;
+		}
+	}
+
+	refitMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+float LightTree::getImportance(const Node& node, FXMVECTOR position, FXMVECTOR normal) const
+{
+	if (!(node.power > 0.0f))
+		return 0.0f;
+
+	// Called twice per level of every sample, so it stays in plain floats.
+	XMFLOAT3 p, n;
+	XMStoreFloat3(&p, position);
+	XMStoreFloat3(&n, normal);
+
+	float halfX = (node.max.x - node.min.x) * 0.5f, halfY = (node.max.y - node.min.y) * 0.5f, halfZ = (node.max.z - node.min.z) * 0.5f;
+	float toX = node.min.x + halfX - p.x, toY = node.min.y + halfY - p.y, toZ = node.min.z + halfZ - p.z;
+	float radiusSq = halfX * halfX + halfY * halfY + halfZ * halfZ;
+	float distSq = toX * toX + toY * toY + toZ * toZ;
+
+	// The largest cosine to anywhere in the node's bounding sphere. From inside it any direction could be a light's.
+	float cosine = 1.0f;
+	if (distSq > radiusSq) {
+		float dist = std::sqrt(distSq);
+		float cosCenter = (n.x * toX + n.y * toY + n.z * toZ) / dist;
+		float sinHalf = std::sqrt(radiusSq) / dist;
+		float cosHalf = std::sqrt(1.0f - sinHalf * sinHalf);
+		if (cosCenter < cosHalf) {
+			float sinCenter = std::sqrt(std::max(1.0f - cosCenter * cosCenter, 0.0f));
+			cosine = cosCenter * cosHalf + sinCenter * sinHalf;
+		}
+	}
+
+	return node.power * std::max(cosine, MIN_COSINE) / std::max(std::max(distSq, radiusSq), MIN_DISTANCE_SQ);
+}
+
+bool LightTree::sample(FXMVECTOR position, FXMVECTOR normal, float u, uint32_t& light, float& probability) const
+{
+	if (nodes.empty())
+		return false;
+
+	probability = 1.0f;
+	uint32_t index = 0;
+	while (!(nodes[index].offset & LEAF_BIT)) {
+		uint32_t left = index + 1;
+		uint32_t right = nodes[index].offset;
+		float leftImportance = getImportance(nodes[left], position, normal);
+		float rightImportance = getImportance(nodes[right], position, normal);
+		float total = leftImportance + rightImportance;
+		float pLeft = total > 0.0f ? leftImportance / total : 0.5f;
+
+		// u is reused for the next choice by stretching whichever side it fell in back over [0, 1).
+		if (u < pLeft) {
+			u = std::min(u / pLeft, ONE_MINUS_EPSILON);
+			probability *= pLeft;
+			index = left;
+		}
+		else {
+			u = std::min((u - pLeft) / (1.0f - pLeft), ONE_MINUS_EPSILON);
+			probability *= 1.0f - pLeft;
+			index = right;
+		}
+	}
+
+	light = nodes[index].offset & ~LEAF_BIT;
+	return true;
+}
+
+float LightTree::getProbability(FXMVECTOR position, FXMVECTOR normal, uint32_t light) const
+{
+	if (light >= leaves.size())
+		return 0.0f;
+
+	uint32_t leaf = leaves[light];
+	float probability = 1.0f;
+	uint32_t index = 0;
+	while (index != leaf) {
+		uint32_t left = index + 1;
+		uint32_t right = nodes[index].offset;
+		float leftImportance = getImportance(nodes[left], position, normal);
+		float rightImportance = getImportance(nodes[right], position, normal);
+		float total = leftImportance + rightImportance;
+		float pLeft = total > 0.0f ? leftImportance / total : 0.5f;
+
+		// The left subtree is every node before the right child.
+		if (leaf < right) {
+			probability *= pLeft;
+			index = left;
+		}
+		else {
+			probability *= 1.0f - pLeft;
+			index = right;
+		}
+	}
+
+	return probability;
+}
+
+double LightTree::getCost() const
+{
+	double cost = 0.0;
+	for (auto& node : nodes) {
+		if (node.offset & LEAF_BIT)
+			continue;
+
+		double x = node.max.x - node.min.x, y = node.max.y - node.min.y, z = node.max.z - node.min.z;
+		cost += node.power * 2.0 * (x * y + y * z + z * x);
+	}
+	return cost;
+}
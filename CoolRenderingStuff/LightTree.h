@@ -0,0 +1,63 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <DirectXMath.h>
+#include "Scene.h"
+
+// A light's brightness as one number, its intensity times the average of its colour.
+float getLightPower(const Light& light);
+
+// Binary tree over the lights, a light per leaf, built with a binned SAH weighted by power. Each node bounds its lights'
+// positions and sums their power, so a shading point can pick a light by walking down and choosing a child in
+// proportion to how much it could add there. The choices multiply into the light's probability, which the caller
+// divides by for an unbiased estimate of every light's sum from a few. Nodes are depth first with an interior node's
+// left child right after it, so a subtree is a contiguous range.
+class LightTree
+{
+public:
+	static const uint32_t SAH_BINS = 12;
+	// Below this a lopsided power distribution could keep peeling single lights off, so splits go to the median.
+	static const uint32_t MEDIAN_SPLIT_DEPTH = 32;
+	static const uint32_t LEAF_BIT = 0x80000000;
+
+	struct Node {
+		DirectX::XMFLOAT3 min;
+		// Interior: the right child. Leaf: the light's index with LEAF_BIT set.
+		uint32_t offset;
+		DirectX::XMFLOAT3 max;
+		float power;
+	};
+
+	// Also where to start when the lights are added or removed, refit only handles them moving or changing.
+	void build(const std::vector<Light>& lights);
+	// Same tree, bounds and power redone bottom up for lights that moved or changed intensity since the build. Quality
+	// drops as lights wander from where they were built, rebuild when they've moved far.
+	void refit(const std::vector<Light>& lights);
+
+	// Picks a light for a point and its normal from u in [0, 1), with the probability it was picked at. The light must
+	// be evaluated and divided by probability. Returns false when there are no lights.
+	bool sample(DirectX::FXMVECTOR position, DirectX::FXMVECTOR normal, float u, uint32_t& light, float& probability) const;
+	// The probability sample would pick light at this point, the same walk down to its leaf.
+	float getProbability(DirectX::FXMVECTOR position, DirectX::FXMVECTOR normal, uint32_t light) const;
+
+	// How much the node's lights could add at the point. Only zero when they have no power, the specular term isn't
+	// held back by the normal so lights behind the surface keep a little weight.
+	float getImportance(const Node& node, DirectX::FXMVECTOR position, DirectX::FXMVECTOR normal) const;
+
+	// Power weighted surface area summed over the interior nodes, lower is better. For comparing a refit against a build.
+	double getCost() const;
+
+	const std::vector<Node>& getNodes() const { return nodes; }
+	uint32_t getLightCount() const { return static_cast<uint32_t>(leaves.size()); }
+	uint32_t getDepth() const { return depth; }
+	double getBuildMs() const { return buildMs; }
+	double getRefitMs() const { return refitMs; }
+
+private:
+	std::vector<Node> nodes;
+	// Each light's leaf.
+	std::vector<uint32_t> leaves;
+	uint32_t depth = 0;
+	double buildMs = 0.0;
+	double refitMs = 0.0;
+};
@@ -57,28 +57,13 @@ Lighting::Lighting(ID3D11Device* device)
 
 		device->CreateBuffer(&iDesc, &iData, &sphereMesh.iBuffer);
 	}
-
-	D3D11_BUFFER_DESC cbDesc{};
-	cbDesc.Usage = D3D11_USAGE_DYNAMIC;
-	cbDesc.ByteWidth = sizeof(Light);
-	cbDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
-	cbDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
-	cbDesc.MiscFlags = 0;
-	cbDesc.StructureByteStride = 0;
-
-	device->CreateBuffer(&cbDesc, nullptr, &lightConstantBuffer);
 }
 
 // TODO WT: Take in all lights and draw instanced.
-void Lighting::DrawPointLight(ID3D11DeviceContext* context, Light& light)
+void Lighting::DrawPointLight(ID3D11DeviceContext* context, ConstantBufferRing& constants, Light& light, const ShadowConstants& shadow)
 {
-	D3D11_MAPPED_SUBRESOURCE mappedCbuffer{};
-	context->Map(lightConstantBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedCbuffer);
-	memcpy(mappedCbuffer.pData, &light, sizeof(Light));
-	context->Unmap(lightConstantBuffer, 0);
-
-	context->VSSetConstantBuffers(1, 1, &lightConstantBuffer);
-	context->PSSetConstantBuffers(1, 1, &lightConstantBuffer);
+	constants.bind(CONSTANT_STAGE_VERTEX | CONSTANT_STAGE_PIXEL, 1, constants.upload(light));
+	constants.bind(CONSTANT_STAGE_PIXEL, 2, constants.upload(shadow));
 
 	//uint32_t stride = sizeof(XMFLOAT3);
 	//uint32_t offset = 0;
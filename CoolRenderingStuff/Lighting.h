@@ -3,19 +3,9 @@
 #include <cstdint>
 #include <DirectXMath.h>
 #include <dxgi.h>
-
-struct Light {
-	DirectX::XMFLOAT3 position;
-	float radius;
-
-	DirectX::XMFLOAT3 color;
-	float intensity;
-
-	DirectX::XMFLOAT4 ambient;
-
-	Light() {}
-	Light(DirectX::XMFLOAT3 pos, float rad, DirectX::XMFLOAT3 col, float inten, DirectX::XMFLOAT4 ambi) : position(pos), radius(rad), color(col), intensity(inten), ambient(ambi) {}
-};
+#include "Scene.h"
+#include "ConstantBufferRing.h"
+#include "ShadowCache.h"
 
 class Lighting
 {
@@ -32,11 +22,10 @@ class Lighting
 
 	Mesh sphereMesh;
 
-	ID3D11Buffer* lightConstantBuffer;
-
 public:
 	Lighting(ID3D11Device* device);
 
-	void DrawPointLight(ID3D11DeviceContext* context, Light& light);
+	// shadow goes to b2, its enabled left at 0 draws the light unshadowed.
+	void DrawPointLight(ID3D11DeviceContext* context, ConstantBufferRing& constants, Light& light, const ShadowConstants& shadow);
 };
 
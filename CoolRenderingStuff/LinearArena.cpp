@@ -0,0 +1,64 @@
+#include "LinearArena.h"
+#include <algorithm>
+#include <stdexcept>
+
+LinearArena::LinearArena(size_t capacity) : block(new uint8_t[capacity]), capacity(capacity)
+{
+}
+
+LinearArena::~LinearArena()
+{
+	reset();
+	delete[] block;
+}
+
+void* LinearArena::allocate(size_t size, size_t alignment)
+{
+	if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+		throw std::runtime_error("Arena alignment must be a power of two");
+
+	// Aligned against the block's address, so the block itself doesn't need to be.
+	uintptr_t base = reinterpret_cast<uintptr_t>(block);
+	size_t offset = head.load(std::memory_order_relaxed);
+	while (true) {
+		size_t start = ((base + offset + alignment - 1) & ~(uintptr_t(alignment) - 1)) - base;
+		if (start + size > capacity)
+			break;
+
+		if (head.compare_exchange_weak(offset, start + size, std::memory_order_relaxed))
+			return block + start;
+	}
+
+	// Over-allocated so it can be aligned, the raw pointer is what goes back to the heap.
+	uint8_t* overflow = new uint8_t[size + alignment];
+
+	std::lock_guard<std::mutex> lock(overflowMutex);
+	overflowBlocks.push_back(overflow);
+	overflowBytes += size;
+	overflows++;
+
+	uintptr_t address = reinterpret_cast<uintptr_t>(overflow);
+	return overflow + (((address + alignment - 1) & ~(uintptr_t(alignment) - 1)) - address);
+}
+
+void LinearArena::reset()
+{
+	highWater = std::max(highWater, getUsed());
+
+	if (!overflowBlocks.empty()) {
+		for (void* overflow : overflowBlocks) {
+			delete[] static_cast<uint8_t*>(overflow);
+		}
+		overflowBlocks.clear();
+		overflowBytes = 0;
+
+		// Room for alignment padding on top of what was asked for.
+		if (highWater > capacity) {
+			delete[] block;
+			capacity = std::max(capacity * 2, highWater + highWater / 4);
+			block = new uint8_t[capacity];
+		}
+	}
+
+	head = 0;
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+// Bump allocator over one block for temporaries that all die together, like a frame's. Allocations are handed out with
+// a compare exchange so jobs can share one, nothing is freed on its own and reset drops the lot. What doesn't fit goes
+// to the heap, and the next reset grows the block to the most that was ever asked of it, so a steady workload stops
+// touching the heap after its first reset.
+class LinearArena
+{
+public:
+	explicit LinearArena(size_t capacity);
+	~LinearArena();
+
+	LinearArena(const LinearArena&) = delete;
+	LinearArena& operator=(const LinearArena&) = delete;
+
+	// alignment is a power of two. Never null, the heap takes over when the block is full.
+	void* allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+	// Uninitialised, and never destroyed, so only for types that don't need to be.
+	template<typename T>
+	T* allocateArray(size_t count) {
+		static_assert(std::is_trivially_destructible<T>::value, "Arena memory is dropped without running destructors");
+		return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+	}
+
+	// Everything allocated since the last reset is gone. Not safe against allocations still in flight on other threads.
+	void reset();
+
+	size_t getCapacity() const { return capacity; }
+	// Since the last reset, overflow included.
+	size_t getUsed() const { return head + overflowBytes; }
+	size_t getHighWater() const { return highWater; }
+	// Allocations that didn't fit and went to the heap since the arena was made.
+	uint64_t getOverflows() const { return overflows; }
+
+private:
+	uint8_t* block;
+	size_t capacity;
+	std::atomic<size_t> head{ 0 };
+	size_t highWater = 0;
+
+	std::mutex overflowMutex;
+	std::vector<void*> overflowBlocks;
+	size_t overflowBytes = 0;
+	uint64_t overflows = 0;
+};
+
+// Lets standard containers take their storage from an arena, deallocate does nothing since reset frees it all at once.
+// A null arena falls back to the heap, for callers that have no arena to give.
+template<typename T>
+struct ArenaAllocator {
+	using value_type = T;
+
+	LinearArena* arena;
+
+	ArenaAllocator(LinearArena* arena = nullptr) noexcept : arena(arena) {}
+	template<typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other) noexcept : arena(other.arena) {}
+
+	T* allocate(size_t count) {
+		return arena ? static_cast<T*>(arena->allocate(sizeof(T) * count, alignof(T))) : std::allocator<T>().allocate(count);
+	}
+
+	void deallocate(T* pointer, size_t count) noexcept {
+		if (!arena)
+			std::allocator<T>().deallocate(pointer, count);
+	}
+
+	template<typename U>
+	bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+	template<typename U>
+	bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+};
+
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
@@ -0,0 +1,259 @@
+#include "MeshInstancing.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+using namespace DirectX;
+
+// Positions are compared within this fraction of the mesh's radius, normals and tangents within this much per component.
+static const float POSITION_TOLERANCE = 1e-3f;
+static const float DIRECTION_TOLERANCE = 1e-3f;
+static const float TEXCOORD_STEPS = 4096.0f;
+
+namespace {
+	struct MeshFrame {
+		// Rows are the axes, then the centroid.
+		XMFLOAT4X4 toMesh;
+		float radius;
+	};
+}
+
+static MeshFrame calculateMeshFrame(const std::vector<Vertex>& vertices)
+{
+	MeshFrame frame;
+	XMStoreFloat4x4(&frame.toMesh, XMMatrixIdentity());
+	frame.radius = 0.0f;
+
+	if (vertices.empty())
+		return frame;
+
+	double sum[3] = {};
+	for (auto& vertex : vertices) {
+		sum[0] += vertex.position.x;
+		sum[1] += vertex.position.y;
+		sum[2] += vertex.position.z;
+	}
+	auto centroid = XMVectorSet(static_cast<float>(sum[0] / vertices.size()), static_cast<float>(sum[1] / vertices.size()), static_cast<float>(sum[2] / vertices.size()), 1.0f);
+
+	for (auto& vertex : vertices) {
+		frame.radius = std::max(frame.radius, XMVectorGetX(XMVector3Length(XMVectorSubtract(XMLoadFloat3(&vertex.position), centroid))));
+	}
+
+	frame.toMesh.m[3][0] = XMVectorGetX(centroid);
+	frame.toMesh.m[3][1] = XMVectorGetY(centroid);
+	frame.toMesh.m[3][2] = XMVectorGetZ(centroid);
+
+	// Half way out is far from any vertex a copy could disagree on by float error alone.
+	XMVECTOR axisX = XMVectorZero();
+	for (auto& vertex : vertices) {
+		auto offset = XMVectorSubtract(XMLoadFloat3(&vertex.position), centroid);
+		if (XMVectorGetX(XMVector3Length(offset)) >= frame.radius * 0.5f) {
+			axisX = XMVector3Normalize(offset);
+			break;
+		}
+	}
+
+	auto perpendicular = [&](const Vertex& vertex) {
+		auto offset = XMVectorSubtract(XMLoadFloat3(&vertex.position), centroid);
+		return XMVectorSubtract(offset, XMVectorMultiply(XMVector3Dot(offset, axisX), axisX));
+	};
+
+	float maxPerpendicular = 0.0f;
+	for (auto& vertex : vertices) {
+		maxPerpendicular = std::max(maxPerpendicular, XMVectorGetX(XMVector3Length(perpendicular(vertex))));
+	}
+
+	// A point or a line, only moved copies can be found.
+	if (frame.radius <= 0.0f || maxPerpendicular <= frame.radius * 1e-3f)
+		return frame;
+
+	XMVECTOR axisY = XMVectorZero();
+	for (auto& vertex : vertices) {
+		auto offset = perpendicular(vertex);
+		if (XMVectorGetX(XMVector3Length(offset)) >= maxPerpendicular * 0.5f) {
+			axisY = XMVector3Normalize(offset);
+			break;
+		}
+	}
+	auto axisZ = XMVector3Cross(axisX, axisY);
+
+	XMFLOAT3 axes[3];
+	XMStoreFloat3(&axes[0], axisX);
+	XMStoreFloat3(&axes[1], axisY);
+	XMStoreFloat3(&axes[2], axisZ);
+	for (int row = 0; row < 3; row++) {
+		frame.toMesh.m[row][0] = axes[row].x;
+		frame.toMesh.m[row][1] = axes[row].y;
+		frame.toMesh.m[row][2] = axes[row].z;
+	}
+
+	return frame;
+}
+
+static void toMeshFrame(const std::vector<Vertex>& vertices, const MeshFrame& frame, ArenaVector<Vertex>& out)
+{
+	auto toMesh = XMLoadFloat4x4(&frame.toMesh);
+	auto det = XMMatrixDeterminant(toMesh);
+	auto toFrame = XMMatrixInverse(&det, toMesh);
+
+	out.assign(vertices.begin(), vertices.end());
+	for (auto& vertex : out) {
+		XMStoreFloat3(&vertex.position, XMVector3TransformCoord(XMLoadFloat3(&vertex.position), toFrame));
+		XMStoreFloat3(&vertex.normal, XMVector3TransformNormal(XMLoadFloat3(&vertex.normal), toFrame));
+		XMStoreFloat3(&vertex.tangent, XMVector3TransformNormal(XMLoadFloat3(&vertex.tangent), toFrame));
+		XMStoreFloat3(&vertex.bitangent, XMVector3TransformNormal(XMLoadFloat3(&vertex.bitangent), toFrame));
+	}
+}
+
+static int32_t quantiseTexcoord(float value)
+{
+	return static_cast<int32_t>(std::lround(value * TEXCOORD_STEPS));
+}
+
+// FNV-1a over everything that doesn't depend on where the mesh is.
+static uint64_t hashMesh(const MeshData& mesh)
+{
+	uint64_t hash = 14695981039346656037ull;
+	auto add = [&](uint32_t value) {
+		for (int i = 0; i < 4; i++) {
+			hash ^= (value >> (i * 8)) & 0xff;
+			hash *= 1099511628211ull;
+		}
+	};
+
+	add(mesh.materialId);
+	add(static_cast<uint32_t>(mesh.vertices.size()));
+	for (uint32_t index : mesh.indices) {
+		add(index);
+	}
+	for (auto& vertex : mesh.vertices) {
+		add(static_cast<uint32_t>(quantiseTexcoord(vertex.texcoord.x)));
+		add(static_cast<uint32_t>(quantiseTexcoord(vertex.texcoord.y)));
+	}
+	return hash;
+}
+
+static bool nearEqual(const XMFLOAT3& a, const XMFLOAT3& b, float tolerance)
+{
+	return std::fabs(a.x - b.x) <= tolerance && std::fabs(a.y - b.y) <= tolerance && std::fabs(a.z - b.z) <= tolerance;
+}
+
+// a and b are in their frames.
+static bool isSameMesh(const MeshData& meshA, const ArenaVector<Vertex>& a, const MeshFrame& frameA, const MeshData& meshB, const ArenaVector<Vertex>& b)
+{
+	if (meshA.materialId != meshB.materialId || a.size() != b.size() || meshA.indices != meshB.indices)
+		return false;
+
+	float positionTolerance = frameA.radius * POSITION_TOLERANCE;
+	for (size_t i = 0; i < a.size(); i++) {
+		if (quantiseTexcoord(a[i].texcoord.x) != quantiseTexcoord(b[i].texcoord.x) || quantiseTexcoord(a[i].texcoord.y) != quantiseTexcoord(b[i].texcoord.y))
+			return false;
+
+		if (!nearEqual(a[i].position, b[i].position, positionTolerance) ||
+			!nearEqual(a[i].normal, b[i].normal, DIRECTION_TOLERANCE) ||
+			!nearEqual(a[i].tangent, b[i].tangent, DIRECTION_TOLERANCE) ||
+			!nearEqual(a[i].bitangent, b[i].bitangent, DIRECTION_TOLERANCE))
+			return false;
+	}
+
+	return true;
+}
+
+static uint64_t getMeshBytes(const MeshData& mesh)
+{
+	return sizeof(Vertex) * mesh.vertices.size() + sizeof(uint32_t) * mesh.indices.size();
+}
+
+MeshInstancingStats instanceDuplicateMeshes(SceneData& scene, LinearArena* scratch)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	MeshInstancingStats stats{};
+	uint32_t count = static_cast<uint32_t>(scene.meshes.size());
+	stats.totalMeshes = count;
+
+	// Every mesh's vertices in its frame at once, the biggest temporary of the load, so they come out of scratch.
+	ArenaVector<MeshFrame> frames(count, MeshFrame(), scratch);
+	std::vector<ArenaVector<Vertex>> framed(count, ArenaVector<Vertex>(scratch));
+	for (uint32_t i = 0; i < count; i++) {
+		stats.bytesBefore += getMeshBytes(scene.meshes[i]);
+		frames[i] = calculateMeshFrame(scene.meshes[i].vertices);
+		toMeshFrame(scene.meshes[i].vertices, frames[i], framed[i]);
+	}
+
+	// Each mesh's first copy, which every later copy merges into.
+	ArenaVector<uint32_t> original(count, 0, scratch);
+	ArenaVector<uint32_t> copies(count, 0, scratch);
+
+	// Sorted by hash then index rather than bucketed in a map, so a run of equal hashes is a bucket in the order its
+	// meshes came in.
+	ArenaVector<std::pair<uint64_t, uint32_t>> hashed(scratch);
+	hashed.reserve(count);
+	for (uint32_t i = 0; i < count; i++) {
+		original[i] = i;
+		if (!scene.meshes[i].vertices.empty())
+			hashed.push_back({ hashMesh(scene.meshes[i]), i });
+	}
+	std::sort(hashed.begin(), hashed.end());
+
+	for (size_t begin = 0; begin < hashed.size();) {
+		size_t end = begin + 1;
+		while (end < hashed.size() && hashed[end].first == hashed[begin].first) {
+			end++;
+		}
+
+		for (size_t entry = begin + 1; entry < end; entry++) {
+			uint32_t i = hashed[entry].second;
+			for (size_t earlier = begin; earlier < entry; earlier++) {
+				uint32_t candidate = hashed[earlier].second;
+				if (original[candidate] == candidate && isSameMesh(scene.meshes[candidate], framed[candidate], frames[candidate], scene.meshes[i], framed[i])) {
+					original[i] = candidate;
+					copies[candidate]++;
+					break;
+				}
+			}
+		}
+
+		begin = end;
+	}
+
+	ArenaVector<uint32_t> remap(count, 0, scratch);
+	std::vector<MeshData> unique;
+	unique.reserve(count);
+	for (uint32_t i = 0; i < count; i++) {
+		if (original[i] != i) {
+			stats.mergedMeshes++;
+			continue;
+		}
+
+		remap[i] = static_cast<uint32_t>(unique.size());
+		unique.push_back(std::move(scene.meshes[i]));
+
+		// Moving and turning doesn't change the UV density, only the bounds need redoing. Copied over the vertices it
+		// replaces, the same size, so there's no allocation.
+		if (copies[i] > 0) {
+			unique.back().vertices.assign(framed[i].begin(), framed[i].end());
+			unique.back().localBounds = calculateMeshBounds(unique.back().vertices);
+		}
+	}
+
+	for (auto& instance : scene.instances) {
+		uint32_t mesh = instance.mesh;
+		uint32_t first = original[mesh];
+
+		if (copies[first] > 0) {
+			XMStoreFloat4x4(&instance.meshToNode, XMMatrixMultiply(XMLoadFloat4x4(&frames[mesh].toMesh), XMLoadFloat4x4(&instance.meshToNode)));
+		}
+		instance.mesh = remap[first];
+	}
+
+	scene.meshes = std::move(unique);
+
+	stats.uniqueMeshes = static_cast<uint32_t>(scene.meshes.size());
+	for (auto& mesh : scene.meshes) {
+		stats.bytesAfter += getMeshBytes(mesh);
+	}
+	stats.ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	return stats;
+}
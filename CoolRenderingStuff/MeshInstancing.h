@@ -0,0 +1,12 @@
+#pragma once
+#include "Scene.h"
+#include "LinearArena.h"
+
+// Finds meshes that are copies of one another, moved or turned, keeps one and makes every copy an instance of it.
+// Each mesh gets a frame of its own: its centroid for the origin and axes towards two of its vertices, picked by vertex
+// order so copies written out in the same order pick the same two. Meshes are bucketed on a hash of their material,
+// indices and quantised texcoords, then compared vertex by vertex in their frames within a tolerance, so float error
+// in the frames can't split copies the way hashing positions would.
+// A merged mesh is stored in its frame, each instance's meshToNode takes it back to where its copy was.
+// The per mesh temporaries come out of scratch when there is one, it's left for the caller to reset.
+MeshInstancingStats instanceDuplicateMeshes(SceneData& scene, LinearArena* scratch = nullptr);
@@ -0,0 +1,232 @@
+#include "MipGenerator.h"
+#include "JobSystem.h"
+
+#include <xmmintrin.h>
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+// Four floats a texel whatever the source channel count, so the filter is one SSE add per tap.
+struct FloatLevel {
+	uint32_t width;
+	uint32_t height;
+	std::vector<float> texels;
+};
+
+static float srgbToLinear(float value)
+{
+	return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+}
+
+static float linearToSrgb(float value)
+{
+	return value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+}
+
+static unsigned char toUnorm8(float value)
+{
+	return static_cast<unsigned char>(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+static FloatLevel decodeTopLevel(const TextureData& texture, MipFilter filter)
+{
+	FloatLevel level;
+	level.width = static_cast<uint32_t>(texture.width);
+	level.height = static_cast<uint32_t>(texture.height);
+	level.texels.resize(static_cast<size_t>(level.width) * level.height * 4);
+
+	size_t texels = static_cast<size_t>(level.width) * level.height;
+	for (size_t i = 0; i < texels; i++) {
+		float* out = &level.texels[i * 4];
+		for (int c = 0; c < 4; c++) {
+			out[c] = c < texture.channels ? texture.pixels[i * texture.channels + c] / 255.0f : (c == 3 ? 1.0f : 0.0f);
+		}
+
+		if (filter == MipFilter::Colour) {
+			for (int c = 0; c < 3; c++) {
+				out[c] = srgbToLinear(out[c]);
+			}
+		}
+		else if (filter == MipFilter::Normal) {
+			// Left unnormalized from here on, the length of the average is what Toksvig needs.
+			for (int c = 0; c < 3; c++) {
+				out[c] = out[c] * 2.0f - 1.0f;
+			}
+		}
+	}
+
+	return level;
+}
+
+// 2x2 box, odd edges repeat their last row or column.
+static FloatLevel downsample(const FloatLevel& source)
+{
+	FloatLevel level;
+	level.width = std::max(1u, source.width / 2);
+	level.height = std::max(1u, source.height / 2);
+	level.texels.resize(static_cast<size_t>(level.width) * level.height * 4);
+
+	const __m128 quarter = _mm_set1_ps(0.25f);
+
+	for (uint32_t y = 0; y < level.height; y++) {
+		uint32_t y0 = std::min(y * 2, source.height - 1);
+		uint32_t y1 = std::min(y * 2 + 1, source.height - 1);
+		const float* row0 = &source.texels[static_cast<size_t>(y0) * source.width * 4];
+		const float* row1 = &source.texels[static_cast<size_t>(y1) * source.width * 4];
+		float* out = &level.texels[static_cast<size_t>(y) * level.width * 4];
+
+		for (uint32_t x = 0; x < level.width; x++) {
+			uint32_t x0 = std::min(x * 2, source.width - 1) * 4;
+			uint32_t x1 = std::min(x * 2 + 1, source.width - 1) * 4;
+
+			__m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(row0 + x0), _mm_loadu_ps(row0 + x1)), _mm_add_ps(_mm_loadu_ps(row1 + x0), _mm_loadu_ps(row1 + x1)));
+			_mm_storeu_ps(out + x * 4, _mm_mul_ps(sum, quarter));
+		}
+	}
+
+	return level;
+}
+
+static float alphaTestCoverage(const FloatLevel& level, int channel, float scale)
+{
+	size_t texels = static_cast<size_t>(level.width) * level.height;
+	size_t passed = 0;
+	for (size_t i = 0; i < texels; i++) {
+		if (level.texels[i * 4 + channel] * scale >= ALPHA_TEST_THRESHOLD)
+			passed++;
+	}
+	return static_cast<float>(passed) / texels;
+}
+
+// Coverage only grows with the scale, so a bisection closes in on the top level's.
+// It moves in steps of whole texels, so whichever side of the step lands nearer wins.
+static float findCoverageScale(const FloatLevel& level, int channel, float targetCoverage)
+{
+	float low = 0.0f;
+	float high = 256.0f;
+	for (int i = 0; i < 20; i++) {
+		float mid = (low + high) * 0.5f;
+		if (alphaTestCoverage(level, channel, mid) < targetCoverage)
+			low = mid;
+		else high = mid;
+	}
+
+	float lowError = targetCoverage - alphaTestCoverage(level, channel, low);
+	float highError = alphaTestCoverage(level, channel, high) - targetCoverage;
+	return lowError < highError ? low : high;
+}
+
+static std::vector<unsigned char> encodeLevel(const FloatLevel& level, int channels, const MipSettings& settings, float coverageScale)
+{
+	size_t texels = static_cast<size_t>(level.width) * level.height;
+	std::vector<unsigned char> pixels(texels * channels);
+
+	for (size_t i = 0; i < texels; i++) {
+		float value[4] = { level.texels[i * 4], level.texels[i * 4 + 1], level.texels[i * 4 + 2], level.texels[i * 4 + 3] };
+
+		if (settings.filter == MipFilter::Colour) {
+			for (int c = 0; c < 3; c++) {
+				value[c] = linearToSrgb(value[c]);
+			}
+		}
+		else if (settings.filter == MipFilter::Normal) {
+			float length = std::sqrt(value[0] * value[0] + value[1] * value[1] + value[2] * value[2]);
+			float inverse = length > 0.0f ? 1.0f / length : 0.0f;
+			if (length <= 0.0f) {
+				value[2] = 1.0f;
+				inverse = 1.0f;
+			}
+
+			for (int c = 0; c < 3; c++) {
+				value[c] = value[c] * inverse * 0.5f + 0.5f;
+			}
+
+			// Toksvig, the spread of normals under the texel shortens the average and widens the highlight.
+			length = std::min(length, 1.0f);
+			value[3] = length / (length + SPECULAR_POWER * (1.0f - length));
+		}
+
+		if (settings.coverageChannel >= 0)
+			value[settings.coverageChannel] *= coverageScale;
+
+		for (int c = 0; c < channels; c++) {
+			pixels[i * channels + c] = toUnorm8(value[c]);
+		}
+	}
+
+	return pixels;
+}
+
+std::unordered_map<std::string, MipSettings> getSceneMipSettings(const SceneData& scene)
+{
+	std::unordered_map<std::string, MipSettings> settings;
+
+	for (auto& material : scene.materials) {
+		if (material.settings.useDiffuseTexture && settings[material.diffuseTexture].filter != MipFilter::Normal)
+			settings[material.diffuseTexture].filter = MipFilter::Colour;
+
+		if (material.settings.useNormalTexture)
+			settings[material.normalTexture].filter = MipFilter::Normal;
+
+		if (material.settings.useAlphaCutoutTexture)
+			settings[material.alphaCutoutTexture].coverageChannel = material.alphaCutoutChannel == TEXTURE_CHANNEL_ALL ? 0 : static_cast<int>(material.alphaCutoutChannel);
+
+		if (material.settings.useSpecularTexture)
+			settings[material.specularTexture];
+	}
+
+	return settings;
+}
+
+void generateMips(TextureData& texture, const MipSettings& settings)
+{
+	if (settings.filter == MipFilter::Normal && texture.channels == 4) {
+		// The top level is fully glossy, whatever the source had in alpha.
+		for (size_t i = 3; i < texture.pixels.size(); i += 4) {
+			texture.pixels[i] = 255;
+		}
+	}
+
+	bool coverage = settings.coverageChannel >= 0 && settings.coverageChannel < texture.channels;
+
+	FloatLevel level = decodeTopLevel(texture, settings.filter);
+	float targetCoverage = coverage ? alphaTestCoverage(level, settings.coverageChannel, 1.0f) : 0.0f;
+
+	texture.mips.clear();
+	while (level.width > 1 || level.height > 1) {
+		// Scaled on the way out only, each level still filters the unscaled one above.
+		level = downsample(level);
+		float scale = coverage ? findCoverageScale(level, settings.coverageChannel, targetCoverage) : 1.0f;
+		texture.mips.push_back(encodeLevel(level, texture.channels, settings, scale));
+	}
+}
+
+MipGenerationStats generateSceneMips(SceneData& scene, JobSystem& jobs)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	auto settings = getSceneMipSettings(scene);
+
+	std::vector<std::pair<TextureData*, MipSettings>> work;
+	for (auto& [path, texture] : scene.textures) {
+		auto found = settings.find(path);
+		work.push_back({ &texture, found != settings.end() ? found->second : MipSettings{} });
+	}
+
+	jobs.parallelFor(static_cast<uint32_t>(work.size()), [&](uint32_t i, uint32_t) {
+		generateMips(*work[i].first, work[i].second);
+	});
+
+	MipGenerationStats stats{};
+	stats.textures = static_cast<uint32_t>(work.size());
+	for (auto& [texture, textureSettings] : work) {
+		for (auto& mip : texture->mips) {
+			stats.bytes += mip.size();
+		}
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+	stats.ms = std::chrono::duration<double, std::milli>(end - start).count();
+	return stats;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include "Scene.h"
+
+class JobSystem;
+
+enum class MipFilter {
+	// RGB is sRGB encoded and gets averaged in linear, alpha is linear.
+	Colour,
+	// Tangent space normal in RGB. Levels are renormalized and the Toksvig gloss factor goes in alpha.
+	Normal,
+	// Averaged as it is.
+	Data,
+};
+
+struct MipSettings {
+	MipFilter filter = MipFilter::Data;
+	// Channel that gets alpha tested at ALPHA_TEST_THRESHOLD, scaled per level so the fraction of texels passing stays the same.
+	int coverageChannel = -1;
+};
+
+// Same as deferredPixel.hlsl's discard and the specular power the light pass scales gloss by.
+static const float ALPHA_TEST_THRESHOLD = 0.5f;
+static const float SPECULAR_POWER = 100.0f;
+
+// What each texture holds, worked out from the material slots that refer to it. Run after cookMaterialTextures.
+std::unordered_map<std::string, MipSettings> getSceneMipSettings(const SceneData& scene);
+
+// Fills texture.mips with every level below the top one, down to 1x1. Box filtered with SSE in float.
+void generateMips(TextureData& texture, const MipSettings& settings);
+
+struct MipGenerationStats {
+	uint32_t textures;
+	uint64_t bytes;
+	double ms;
+};
+
+// A texture per job, textures are independent.
+MipGenerationStats generateSceneMips(SceneData& scene, JobSystem& jobs);
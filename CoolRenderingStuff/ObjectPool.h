@@ -0,0 +1,76 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Slots for T in chunks of CHUNK_SIZE, handed out from a free list so records of one type sit together and a destroyed
+// one's slot goes to the next create rather than back to the heap. Only a full pool allocates, a chunk at a time.
+// Objects never move. Anything not destroyed by the time the pool goes has its memory freed without its destructor.
+template<typename T, size_t CHUNK_SIZE = 32>
+class ObjectPool
+{
+public:
+	ObjectPool() = default;
+	~ObjectPool() {
+		for (Slot* chunk : chunks) {
+			delete[] chunk;
+		}
+	}
+
+	ObjectPool(const ObjectPool&) = delete;
+	ObjectPool& operator=(const ObjectPool&) = delete;
+
+	template<typename... Args>
+	T* create(Args&&... args) {
+		if (!freeList) {
+			Slot* chunk = new Slot[CHUNK_SIZE];
+			chunks.push_back(chunk);
+			for (size_t i = CHUNK_SIZE; i-- > 0;) {
+				chunk[i].next = freeList;
+				freeList = &chunk[i];
+			}
+		}
+
+		Slot* slot = freeList;
+		freeList = slot->next;
+
+		// The constructor writes over next, a throw puts the slot back on the list.
+		T* object;
+		try {
+			object = new (slot->storage) T(std::forward<Args>(args)...);
+		}
+		catch (...) {
+			slot->next = freeList;
+			freeList = slot;
+			throw;
+		}
+
+		count++;
+		return object;
+	}
+
+	void destroy(T* object) {
+		if (!object)
+			return;
+
+		object->~T();
+		Slot* slot = reinterpret_cast<Slot*>(object);
+		slot->next = freeList;
+		freeList = slot;
+		count--;
+	}
+
+	size_t getCount() const { return count; }
+	size_t getCapacity() const { return chunks.size() * CHUNK_SIZE; }
+
+private:
+	union Slot {
+		Slot* next;
+		alignas(T) unsigned char storage[sizeof(T)];
+	};
+
+	std::vector<Slot*> chunks;
+	Slot* freeList = nullptr;
+	size_t count = 0;
+};
@@ -0,0 +1,523 @@
+#include "OcclusionCuller.h"
+#include "JobSystem.h"
+
+#include <immintrin.h>
+#include <cmath>
+#include <cfloat>
+#include <chrono>
+#include <algorithm>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC emits AVX instructions for intrinsics without needing /arch:AVX2 on the whole project.
+#define AVX2_FUNCTION
+#else
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+#endif
+
+using namespace DirectX;
+
+static double elapsedMs(std::chrono::high_resolution_clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+bool OcclusionCuller::hasAVX2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+
+	__cpuid(info, 1);
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+
+	__cpuidex(info, 7, 0);
+	bool avx2 = (info[1] & (1 << 5)) != 0;
+
+	// The OS has to be saving the YMM registers too.
+	return osxsave && avx && avx2 && (_xgetbv(0) & 6) == 6;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+OcclusionCuller::OcclusionCuller(const SceneData& scene, JobSystem& jobs, uint32_t occluderTriangleBudget) : jobs(jobs), useAVX2(hasAVX2())
+{
+	struct Candidate {
+		uint32_t instance;
+		float averageArea;
+	};
+
+	// Average triangle area per mesh, in the mesh's own space.
+	std::vector<float> meshAreas(scene.meshes.size(), 0.0f);
+	for (uint32_t i = 0; i < scene.meshes.size(); i++) {
+		const MeshData& mesh = scene.meshes[i];
+		uint32_t triangleCount = static_cast<uint32_t>(mesh.indices.size() / 3);
+		if (triangleCount == 0 || scene.materials[mesh.materialId].settings.useAlphaCutoutTexture)
+			continue;
+
+		float area = 0.0f;
+		for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3) {
+			auto p0 = XMLoadFloat3(&mesh.vertices[mesh.indices[t + 0]].position);
+			auto p1 = XMLoadFloat3(&mesh.vertices[mesh.indices[t + 1]].position);
+			auto p2 = XMLoadFloat3(&mesh.vertices[mesh.indices[t + 2]].position);
+			area += 0.5f * XMVectorGetX(XMVector3Length(XMVector3Cross(XMVectorSubtract(p1, p0), XMVectorSubtract(p2, p0))));
+		}
+		meshAreas[i] = area / triangleCount;
+	}
+
+	std::vector<Candidate> candidates;
+
+	instanceBounds.resize(scene.instances.size());
+	for (uint32_t i = 0; i < scene.instances.size(); i++) {
+		const MeshInstance& instance = scene.instances[i];
+
+		instanceBounds[i].min = instance.bounds.min;
+		instanceBounds[i].max = instance.bounds.max;
+		instanceBounds[i].triangleCount = static_cast<uint32_t>(scene.meshes[instance.mesh].indices.size() / 3);
+
+		if (meshAreas[instance.mesh] <= 0.0f)
+			continue;
+
+		float scale = getMatrixScale(getInstanceWorld(scene.graph, instance));
+		candidates.push_back({ i, meshAreas[instance.mesh] * scale * scale });
+	}
+
+	// Big flat walls and floors first, detailed props are expensive and hide little.
+	std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) { return a.averageArea > b.averageArea; });
+
+	uint32_t triangles = 0;
+	for (auto& candidate : candidates) {
+		const MeshInstance& instance = scene.instances[candidate.instance];
+		const MeshData& mesh = scene.meshes[instance.mesh];
+		uint32_t count = instanceBounds[candidate.instance].triangleCount;
+		if (triangles + count > occluderTriangleBudget)
+			continue;
+
+		Occluder occluder;
+		occluder.instance = candidate.instance;
+		XMStoreFloat4x4(&occluder.world, getInstanceWorld(scene.graph, instance));
+		occluder.positions.reserve(mesh.vertices.size());
+		for (auto& vertex : mesh.vertices) {
+			occluder.positions.push_back(vertex.position);
+		}
+		occluder.indices = mesh.indices;
+
+		occluders.push_back(std::move(occluder));
+		triangles += count;
+	}
+
+	occluderTriangles.resize(occluders.size());
+
+	depth.resize(BUFFER_WIDTH * BUFFER_HEIGHT);
+	blockMaxDepth.resize(BLOCKS_X * BLOCKS_Y);
+
+	stats.occluderTriangles = triangles;
+}
+
+void OcclusionCuller::setInstanceTransform(uint32_t instance, const XMFLOAT4X4& world, const MeshBounds& bounds)
+{
+	instanceBounds[instance].min = bounds.min;
+	instanceBounds[instance].max = bounds.max;
+
+	for (auto& occluder : occluders) {
+		if (occluder.instance == instance)
+			occluder.world = world;
+	}
+}
+
+void OcclusionCuller::cull(const XMMATRIX& viewProj, std::vector<uint8_t>& visibility, LinearArena* scratch)
+{
+	auto frameStart = std::chrono::high_resolution_clock::now();
+
+	uint64_t occluderTriangleCount = stats.occluderTriangles;
+	stats = {};
+	stats.occluderTriangles = occluderTriangleCount;
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	jobs.parallelFor(static_cast<uint32_t>(occluders.size()), [&](uint32_t occluder, uint32_t) {
+		setupOccluder(occluder, viewProj, scratch);
+	});
+
+	for (auto& triangles : occluderTriangles) {
+		stats.rasterizedTriangles += triangles.size();
+	}
+
+	stats.setupMs = elapsedMs(start);
+
+	// Horizontal bands one block high, so no two jobs ever write the same pixels.
+	start = std::chrono::high_resolution_clock::now();
+
+	jobs.parallelFor(BLOCKS_Y, [&](uint32_t band, uint32_t) {
+		rasterizeBand(band);
+	});
+
+	stats.rasterMs = elapsedMs(start);
+
+	start = std::chrono::high_resolution_clock::now();
+
+	// 0 visible, 1 outside the frustum, 2 occluded.
+	ArenaVector<uint8_t> results(instanceBounds.size(), 0, scratch);
+	jobs.parallelFor(static_cast<uint32_t>(instanceBounds.size()), [&](uint32_t instance, uint32_t) {
+		bool frustumCulled = false;
+		bool visible = testInstance(instance, viewProj, frustumCulled);
+		results[instance] = visible ? 0 : (frustumCulled ? 1 : 2);
+	});
+
+	visibility.resize(instanceBounds.size());
+	for (size_t i = 0; i < instanceBounds.size(); i++) {
+		visibility[i] = results[i] == 0;
+
+		stats.meshesTested++;
+		stats.trianglesTested += instanceBounds[i].triangleCount;
+
+		if (results[i] == 1)
+			stats.frustumCulled++;
+		else if (results[i] == 2)
+			stats.occlusionCulled++;
+
+		if (results[i] != 0)
+			stats.trianglesCulled += instanceBounds[i].triangleCount;
+	}
+
+	stats.testMs = elapsedMs(start);
+	stats.totalMs = elapsedMs(frameStart);
+}
+
+void OcclusionCuller::setupOccluder(uint32_t occluderIndex, const XMMATRIX& viewProj, LinearArena* scratch)
+{
+	const Occluder& occluder = occluders[occluderIndex];
+	auto& out = occluderTriangles[occluderIndex];
+	out.clear();
+
+	auto worldViewProj = XMMatrixMultiply(XMLoadFloat4x4(&occluder.world), viewProj);
+
+	ArenaVector<XMFLOAT4> clip(occluder.positions.size(), XMFLOAT4(), scratch);
+	for (size_t i = 0; i < occluder.positions.size(); i++) {
+		XMStoreFloat4(&clip[i], XMVector4Transform(XMVectorSetW(XMLoadFloat3(&occluder.positions[i]), 1.0f), worldViewProj));
+	}
+
+	auto outcode = [](const XMFLOAT4& c) {
+		uint32_t code = 0;
+		if (c.x < -c.w) code |= 1;
+		if (c.x > c.w) code |= 2;
+		if (c.y < -c.w) code |= 4;
+		if (c.y > c.w) code |= 8;
+		if (c.z < 0.0f) code |= 16;
+		return code;
+	};
+
+	auto lerp = [](const XMFLOAT4& a, const XMFLOAT4& b, float t) {
+		XMFLOAT4 result;
+		XMStoreFloat4(&result, XMVectorLerp(XMLoadFloat4(&a), XMLoadFloat4(&b), t));
+		return result;
+	};
+
+	for (size_t t = 0; t + 2 < occluder.indices.size(); t += 3) {
+		const XMFLOAT4& c0 = clip[occluder.indices[t + 0]];
+		const XMFLOAT4& c1 = clip[occluder.indices[t + 1]];
+		const XMFLOAT4& c2 = clip[occluder.indices[t + 2]];
+
+		uint32_t o0 = outcode(c0);
+		uint32_t o1 = outcode(c1);
+		uint32_t o2 = outcode(c2);
+
+		if (o0 & o1 & o2)
+			continue;
+
+		if (((o0 | o1 | o2) & 16) == 0) {
+			emitTriangle(out, c0, c1, c2);
+			continue;
+		}
+
+		// Near plane only, everything else is handled by the bounding box clamp.
+		const XMFLOAT4* in[3] = { &c0, &c1, &c2 };
+		XMFLOAT4 poly[4];
+		size_t count = 0;
+
+		for (size_t i = 0; i < 3; i++) {
+			const XMFLOAT4& a = *in[i];
+			const XMFLOAT4& b = *in[(i + 1) % 3];
+			bool aInside = a.z >= 0.0f;
+			bool bInside = b.z >= 0.0f;
+
+			if (aInside)
+				poly[count++] = a;
+
+			if (aInside != bInside)
+				poly[count++] = lerp(a, b, a.z / (a.z - b.z));
+		}
+
+		for (size_t i = 2; i < count; i++) {
+			emitTriangle(out, poly[0], poly[i - 1], poly[i]);
+		}
+	}
+}
+
+void OcclusionCuller::emitTriangle(std::vector<OccluderTriangle>& out, const XMFLOAT4& v0, const XMFLOAT4& v1, const XMFLOAT4& v2)
+{
+	const XMFLOAT4* v[3] = { &v0, &v1, &v2 };
+	float x[3], y[3], z[3];
+
+	for (size_t i = 0; i < 3; i++) {
+		float invW = 1.0f / v[i]->w;
+		x[i] = (v[i]->x * invW * 0.5f + 0.5f) * BUFFER_WIDTH;
+		y[i] = (0.5f - v[i]->y * invW * 0.5f) * BUFFER_HEIGHT;
+		z[i] = v[i]->z * invW;
+	}
+
+	// Same winding and culling as the G-buffer pass.
+	float area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+	if (!(area > 0.0f))
+		return;
+
+	OccluderTriangle tri;
+	tri.minX = std::max(0, static_cast<int>(std::floor(std::min({ x[0], x[1], x[2] }))));
+	tri.maxX = std::min(static_cast<int>(BUFFER_WIDTH) - 1, static_cast<int>(std::ceil(std::max({ x[0], x[1], x[2] }))));
+	tri.minY = std::max(0, static_cast<int>(std::floor(std::min({ y[0], y[1], y[2] }))));
+	tri.maxY = std::min(static_cast<int>(BUFFER_HEIGHT) - 1, static_cast<int>(std::ceil(std::max({ y[0], y[1], y[2] }))));
+
+	if (tri.minX > tri.maxX || tri.minY > tri.maxY)
+		return;
+
+	for (size_t i = 0; i < 3; i++) {
+		size_t a = (i + 1) % 3;
+		size_t b = (i + 2) % 3;
+		float dx = x[b] - x[a];
+		float dy = y[b] - y[a];
+
+		tri.edgeA[i] = -dy;
+		tri.edgeB[i] = dx;
+		tri.edgeC[i] = dy * x[a] - dx * y[a];
+	}
+
+	float invArea = 1.0f / area;
+	tri.dzdx = ((z[1] - z[0]) * (y[2] - y[0]) - (z[2] - z[0]) * (y[1] - y[0])) * invArea;
+	tri.dzdy = ((z[2] - z[0]) * (x[1] - x[0]) - (z[1] - z[0]) * (x[2] - x[0])) * invArea;
+	tri.z0 = z[0] - tri.dzdx * x[0] - tri.dzdy * y[0];
+
+	out.push_back(tri);
+}
+
+void OcclusionCuller::rasterizeBand(uint32_t band)
+{
+	int minY = static_cast<int>(band * BLOCK_SIZE);
+	int maxY = minY + static_cast<int>(BLOCK_SIZE) - 1;
+
+	std::fill(depth.begin() + minY * BUFFER_WIDTH, depth.begin() + (maxY + 1) * BUFFER_WIDTH, 1.0f);
+
+	for (auto& triangles : occluderTriangles) {
+		for (auto& tri : triangles) {
+			if (tri.maxY < minY || tri.minY > maxY)
+				continue;
+
+			if (useAVX2)
+				rasterizeTriangleAVX2(tri, std::max(minY, tri.minY), std::min(maxY, tri.maxY));
+			else
+				rasterizeTriangleScalar(tri, std::max(minY, tri.minY), std::min(maxY, tri.maxY));
+		}
+	}
+
+	for (uint32_t bx = 0; bx < BLOCKS_X; bx++) {
+		float farthest = 0.0f;
+		for (int y = minY; y <= maxY; y++) {
+			const float* row = &depth[y * BUFFER_WIDTH + bx * BLOCK_SIZE];
+			for (uint32_t x = 0; x < BLOCK_SIZE; x++) {
+				farthest = std::max(farthest, row[x]);
+			}
+		}
+		blockMaxDepth[band * BLOCKS_X + bx] = farthest;
+	}
+}
+
+void OcclusionCuller::rasterizeTriangleScalar(const OccluderTriangle& tri, int minY, int maxY)
+{
+	for (int y = minY; y <= maxY; y++) {
+		float py = y + 0.5f;
+		float* row = &depth[y * BUFFER_WIDTH];
+
+		for (int x = tri.minX; x <= tri.maxX; x++) {
+			float px = x + 0.5f;
+
+			bool inside = true;
+			for (size_t i = 0; i < 3; i++) {
+				inside &= tri.edgeA[i] * px + tri.edgeB[i] * py + tri.edgeC[i] >= 0.0f;
+			}
+
+			if (!inside)
+				continue;
+
+			float z = std::min(std::max(tri.z0 + tri.dzdx * px + tri.dzdy * py, 0.0f), 1.0f);
+			row[x] = std::min(row[x], z);
+		}
+	}
+}
+
+AVX2_FUNCTION void OcclusionCuller::rasterizeTriangleAVX2(const OccluderTriangle& tri, int minY, int maxY)
+{
+	const __m256 laneOffsets = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+
+	__m256 edgeA[3], edgeB[3], edgeC[3];
+	for (size_t i = 0; i < 3; i++) {
+		edgeA[i] = _mm256_set1_ps(tri.edgeA[i]);
+		edgeB[i] = _mm256_set1_ps(tri.edgeB[i]);
+		edgeC[i] = _mm256_set1_ps(tri.edgeC[i]);
+	}
+
+	const __m256 dzdx = _mm256_set1_ps(tri.dzdx);
+	const __m256 dzdy = _mm256_set1_ps(tri.dzdy);
+	const __m256 z0 = _mm256_set1_ps(tri.z0);
+
+	// The buffer width is a multiple of 8 so aligned blocks never run off the end of a row.
+	int startX = tri.minX & ~7;
+
+	for (int y = minY; y <= maxY; y++) {
+		__m256 py = _mm256_set1_ps(y + 0.5f);
+		float* row = &depth[y * BUFFER_WIDTH];
+
+		__m256 rowEdge[3];
+		for (size_t i = 0; i < 3; i++) {
+			rowEdge[i] = _mm256_add_ps(_mm256_mul_ps(edgeB[i], py), edgeC[i]);
+		}
+		__m256 rowZ = _mm256_add_ps(_mm256_mul_ps(dzdy, py), z0);
+
+		for (int x = startX; x <= tri.maxX; x += 8) {
+			__m256 px = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(x)), laneOffsets);
+
+			__m256 e0 = _mm256_add_ps(_mm256_mul_ps(edgeA[0], px), rowEdge[0]);
+			__m256 e1 = _mm256_add_ps(_mm256_mul_ps(edgeA[1], px), rowEdge[1]);
+			__m256 e2 = _mm256_add_ps(_mm256_mul_ps(edgeA[2], px), rowEdge[2]);
+
+			__m256 inside = _mm256_and_ps(
+				_mm256_and_ps(_mm256_cmp_ps(e0, zero, _CMP_GE_OQ), _mm256_cmp_ps(e1, zero, _CMP_GE_OQ)),
+				_mm256_cmp_ps(e2, zero, _CMP_GE_OQ));
+			if (_mm256_movemask_ps(inside) == 0)
+				continue;
+
+			__m256 z = _mm256_add_ps(_mm256_mul_ps(dzdx, px), rowZ);
+			z = _mm256_min_ps(_mm256_max_ps(z, zero), one);
+
+			__m256 old = _mm256_loadu_ps(row + x);
+			__m256 closer = _mm256_min_ps(old, z);
+			_mm256_storeu_ps(row + x, _mm256_blendv_ps(old, closer, inside));
+		}
+	}
+}
+
+bool OcclusionCuller::testInstance(uint32_t instance, const XMMATRIX& viewProj, bool& frustumCulled) const
+{
+	const Bounds& bounds = instanceBounds[instance];
+	frustumCulled = false;
+
+	if (bounds.triangleCount == 0) {
+		frustumCulled = true;
+		return false;
+	}
+
+	uint32_t outsideAll = 0x1f;
+	bool crossesNear = false;
+
+	float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+	float minZ = FLT_MAX;
+
+	for (uint32_t corner = 0; corner < 8; corner++) {
+		auto p = XMVectorSet(
+			(corner & 1) ? bounds.max.x : bounds.min.x,
+			(corner & 2) ? bounds.max.y : bounds.min.y,
+			(corner & 4) ? bounds.max.z : bounds.min.z,
+			1.0f);
+
+		XMFLOAT4 c;
+		XMStoreFloat4(&c, XMVector4Transform(p, viewProj));
+
+		uint32_t code = 0;
+		if (c.x < -c.w) code |= 1;
+		if (c.x > c.w) code |= 2;
+		if (c.y < -c.w) code |= 4;
+		if (c.y > c.w) code |= 8;
+		if (c.z < 0.0f) code |= 16;
+		outsideAll &= code;
+
+		if (c.z < 0.0f) {
+			crossesNear = true;
+			continue;
+		}
+
+		float invW = 1.0f / c.w;
+		minX = std::min(minX, c.x * invW);
+		maxX = std::max(maxX, c.x * invW);
+		minY = std::min(minY, c.y * invW);
+		maxY = std::max(maxY, c.y * invW);
+		minZ = std::min(minZ, c.z * invW);
+	}
+
+	if (outsideAll) {
+		frustumCulled = true;
+		return false;
+	}
+
+	// Can't project a box that reaches behind the camera, assume the camera is inside it.
+	if (crossesNear)
+		return true;
+
+	int rectMinX = std::max(0, static_cast<int>(std::floor((minX * 0.5f + 0.5f) * BUFFER_WIDTH)));
+	int rectMaxX = std::min(static_cast<int>(BUFFER_WIDTH) - 1, static_cast<int>(std::floor((maxX * 0.5f + 0.5f) * BUFFER_WIDTH)));
+	int rectMinY = std::max(0, static_cast<int>(std::floor((0.5f - maxY * 0.5f) * BUFFER_HEIGHT)));
+	int rectMaxY = std::min(static_cast<int>(BUFFER_HEIGHT) - 1, static_cast<int>(std::floor((0.5f - minY * 0.5f) * BUFFER_HEIGHT)));
+
+	for (int by = rectMinY / BLOCK_SIZE; by <= rectMaxY / static_cast<int>(BLOCK_SIZE); by++) {
+		for (int bx = rectMinX / BLOCK_SIZE; bx <= rectMaxX / static_cast<int>(BLOCK_SIZE); bx++) {
+			// Every pixel in this block is nearer than the box.
+			if (blockMaxDepth[by * BLOCKS_X + bx] < minZ)
+				continue;
+
+			int x0 = std::max(rectMinX, bx * static_cast<int>(BLOCK_SIZE));
+			int x1 = std::min(rectMaxX, (bx + 1) * static_cast<int>(BLOCK_SIZE) - 1);
+			int y0 = std::max(rectMinY, by * static_cast<int>(BLOCK_SIZE));
+			int y1 = std::min(rectMaxY, (by + 1) * static_cast<int>(BLOCK_SIZE) - 1);
+
+			bool visible = useAVX2 ? testRectAVX2(x0, y0, x1, y1, minZ) : testRectScalar(x0, y0, x1, y1, minZ);
+			if (visible)
+				return true;
+		}
+	}
+
+	return false;
+}
+
+bool OcclusionCuller::testRectScalar(int minX, int minY, int maxX, int maxY, float minZ) const
+{
+	for (int y = minY; y <= maxY; y++) {
+		const float* row = &depth[y * BUFFER_WIDTH];
+		for (int x = minX; x <= maxX; x++) {
+			if (row[x] >= minZ)
+				return true;
+		}
+	}
+	return false;
+}
+
+AVX2_FUNCTION bool OcclusionCuller::testRectAVX2(int minX, int minY, int maxX, int maxY, float minZ) const
+{
+	// Rects never cross a block boundary, so one aligned load covers a whole row.
+	int blockX = minX & ~7;
+	__m256i lanes = _mm256_add_epi32(_mm256_set1_epi32(blockX), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+	__m256i inRange = _mm256_andnot_si256(
+		_mm256_or_si256(_mm256_cmpgt_epi32(_mm256_set1_epi32(minX), lanes), _mm256_cmpgt_epi32(lanes, _mm256_set1_epi32(maxX))),
+		_mm256_set1_epi32(-1));
+	__m256 mask = _mm256_castsi256_ps(inRange);
+	__m256 boxZ = _mm256_set1_ps(minZ);
+
+	for (int y = minY; y <= maxY; y++) {
+		__m256 occluder = _mm256_loadu_ps(&depth[y * BUFFER_WIDTH + blockX]);
+		__m256 visible = _mm256_and_ps(_mm256_cmp_ps(occluder, boxZ, _CMP_GE_OQ), mask);
+		if (_mm256_movemask_ps(visible))
+			return true;
+	}
+	return false;
+}
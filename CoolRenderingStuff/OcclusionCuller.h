@@ -0,0 +1,109 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <DirectXMath.h>
+#include "Scene.h"
+#include "LinearArena.h"
+
+class JobSystem;
+
+struct OcclusionStats {
+	double setupMs;
+	double rasterMs;
+	double testMs;
+	double totalMs;
+
+	uint64_t occluderTriangles;
+	uint64_t rasterizedTriangles;
+
+	uint64_t meshesTested;
+	uint64_t frustumCulled;
+	uint64_t occlusionCulled;
+	uint64_t trianglesTested;
+	uint64_t trianglesCulled;
+
+	float culledPercent() const { return meshesTested ? 100.0f * (frustumCulled + occlusionCulled) / meshesTested : 0.0f; }
+	float culledTrianglePercent() const { return trianglesTested ? 100.0f * trianglesCulled / trianglesTested : 0.0f; }
+};
+
+// Rasterizes a handful of big opaque meshes into a small depth buffer, then tests every instance's bounds against it.
+// Occluder depth is sampled at pixel centres like the GPU, so a mesh peeking through a sub-pixel gap can be lost.
+class OcclusionCuller
+{
+public:
+	static const uint32_t BUFFER_WIDTH = 320;
+	static const uint32_t BUFFER_HEIGHT = 192;
+	// Each 8x8 block also keeps its farthest depth so most tests never touch individual pixels.
+	static const uint32_t BLOCK_SIZE = 8;
+	static const uint32_t BLOCKS_X = BUFFER_WIDTH / BLOCK_SIZE;
+	static const uint32_t BLOCKS_Y = BUFFER_HEIGHT / BLOCK_SIZE;
+
+	// Occluders are picked by average triangle area until the budget runs out. Alpha tested materials never occlude.
+	OcclusionCuller(const SceneData& scene, JobSystem& jobs, uint32_t occluderTriangleBudget = 32768);
+
+	// For an instance whose node has moved since the culler was built.
+	void setInstanceTransform(uint32_t instance, const DirectX::XMFLOAT4X4& world, const MeshBounds& bounds);
+
+	// visibility gets one entry per scene instance, 0 for culled. Temporaries come out of scratch when there is one.
+	void cull(const DirectX::XMMATRIX& viewProj, std::vector<uint8_t>& visibility, LinearArena* scratch = nullptr);
+
+	// Falls back to scalar loops when the CPU doesn't have AVX2, or when forced off for comparison.
+	void setUseAVX2(bool use) { useAVX2 = use && hasAVX2(); }
+	bool getUseAVX2() const { return useAVX2; }
+	static bool hasAVX2();
+
+	const OcclusionStats& getStats() const { return stats; }
+	uint32_t getNumOccluders() const { return static_cast<uint32_t>(occluders.size()); }
+
+	// Depth of the last cull, row major, 1 is empty.
+	const std::vector<float>& getDepth() const { return depth; }
+
+private:
+	struct Bounds {
+		DirectX::XMFLOAT3 min;
+		DirectX::XMFLOAT3 max;
+		uint32_t triangleCount;
+	};
+
+	struct Occluder {
+		uint32_t instance;
+		DirectX::XMFLOAT4X4 world;
+		// In the mesh's own space.
+		std::vector<DirectX::XMFLOAT3> positions;
+		std::vector<uint32_t> indices;
+	};
+
+	// Edge functions and a depth plane in buffer pixel space.
+	struct OccluderTriangle {
+		float edgeA[3];
+		float edgeB[3];
+		float edgeC[3];
+		float z0, dzdx, dzdy;
+		int minX, minY, maxX, maxY;
+	};
+
+	void setupOccluder(uint32_t occluderIndex, const DirectX::XMMATRIX& viewProj, LinearArena* scratch);
+	void emitTriangle(std::vector<OccluderTriangle>& out, const DirectX::XMFLOAT4& v0, const DirectX::XMFLOAT4& v1, const DirectX::XMFLOAT4& v2);
+
+	void rasterizeBand(uint32_t band);
+	void rasterizeTriangleScalar(const OccluderTriangle& tri, int minY, int maxY);
+	void rasterizeTriangleAVX2(const OccluderTriangle& tri, int minY, int maxY);
+
+	bool testInstance(uint32_t instance, const DirectX::XMMATRIX& viewProj, bool& frustumCulled) const;
+	bool testRectScalar(int minX, int minY, int maxX, int maxY, float minZ) const;
+	bool testRectAVX2(int minX, int minY, int maxX, int maxY, float minZ) const;
+
+	JobSystem& jobs;
+	bool useAVX2;
+
+	std::vector<Bounds> instanceBounds;
+	std::vector<Occluder> occluders;
+
+	// Per occluder so setup can run in parallel, rasterization reads them all per band.
+	std::vector<std::vector<OccluderTriangle>> occluderTriangles;
+
+	std::vector<float> depth;
+	std::vector<float> blockMaxDepth;
+
+	OcclusionStats stats{};
+};
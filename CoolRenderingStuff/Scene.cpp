@@ -0,0 +1,153 @@
+#include "Scene.h"
+#include <cmath>
+#include <cstdlib>
+#include <cfloat>
+#include <DirectXColors.h>
+
+using namespace DirectX;
+
+MeshBounds calculateMeshBounds(const std::vector<Vertex>& vertices)
+{
+	auto boundsMin = XMVectorReplicate(FLT_MAX);
+	auto boundsMax = XMVectorReplicate(-FLT_MAX);
+	for (auto& vertex : vertices) {
+		auto p = XMLoadFloat3(&vertex.position);
+		boundsMin = XMVectorMin(boundsMin, p);
+		boundsMax = XMVectorMax(boundsMax, p);
+	}
+
+	MeshBounds bounds;
+	XMStoreFloat3(&bounds.min, boundsMin);
+	XMStoreFloat3(&bounds.max, boundsMax);
+	return bounds;
+}
+
+float calculateMeshUVDensity(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices)
+{
+	double uvArea = 0.0;
+	double worldArea = 0.0;
+
+	for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+		auto& a = vertices[indices[i]];
+		auto& b = vertices[indices[i + 1]];
+		auto& c = vertices[indices[i + 2]];
+
+		auto p0 = XMLoadFloat3(&a.position);
+		auto edges = XMVector3Cross(XMVectorSubtract(XMLoadFloat3(&b.position), p0), XMVectorSubtract(XMLoadFloat3(&c.position), p0));
+		worldArea += 0.5 * XMVectorGetX(XMVector3Length(edges));
+
+		float u1 = b.texcoord.x - a.texcoord.x, v1 = b.texcoord.y - a.texcoord.y;
+		float u2 = c.texcoord.x - a.texcoord.x, v2 = c.texcoord.y - a.texcoord.y;
+		uvArea += 0.5 * std::fabs(u1 * v2 - u2 * v1);
+	}
+
+	return worldArea > 0.0 ? static_cast<float>(std::sqrt(uvArea / worldArea)) : 0.0f;
+}
+
+MeshBounds transformMeshBounds(const MeshBounds& bounds, FXMMATRIX world)
+{
+	// Centre and extents, the extents going through the absolute value of the rotation.
+	auto boundsMin = XMLoadFloat3(&bounds.min);
+	auto boundsMax = XMLoadFloat3(&bounds.max);
+	auto centre = XMVector3TransformCoord(XMVectorScale(XMVectorAdd(boundsMin, boundsMax), 0.5f), world);
+	auto extents = XMVectorScale(XMVectorSubtract(boundsMax, boundsMin), 0.5f);
+
+	auto worldExtents = XMVectorAdd(XMVectorAdd(
+		XMVectorMultiply(XMVectorSplatX(extents), XMVectorAbs(world.r[0])),
+		XMVectorMultiply(XMVectorSplatY(extents), XMVectorAbs(world.r[1]))),
+		XMVectorMultiply(XMVectorSplatZ(extents), XMVectorAbs(world.r[2])));
+
+	MeshBounds out;
+	XMStoreFloat3(&out.min, XMVectorSubtract(centre, worldExtents));
+	XMStoreFloat3(&out.max, XMVectorAdd(centre, worldExtents));
+	return out;
+}
+
+float getMatrixScale(FXMMATRIX world)
+{
+	return std::cbrt(std::fabs(XMVectorGetX(XMMatrixDeterminant(world))));
+}
+
+XMMATRIX getInstanceWorld(const SceneGraph& graph, const MeshInstance& instance)
+{
+	return XMMatrixMultiply(XMLoadFloat4x4(&instance.meshToNode), XMLoadFloat4x4(&graph.getWorld(instance.node)));
+}
+
+void updateInstanceBounds(SceneData& scene, bool all)
+{
+	for (auto& instance : scene.instances) {
+		if (!all && !scene.graph.wasUpdated(instance.node))
+			continue;
+
+		auto& mesh = scene.meshes[instance.mesh];
+		auto world = getInstanceWorld(scene.graph, instance);
+		instance.bounds = transformMeshBounds(mesh.localBounds, world);
+
+		float scale = getMatrixScale(world);
+		instance.uvDensity = scale > 0.0f ? mesh.uvDensity / scale : mesh.uvDensity;
+	}
+}
+
+std::vector<Light> createSceneLights()
+{
+	std::vector<Light> lights;
+
+	XMVECTOR colors[] = {
+		Colors::Red,
+		Colors::Green,
+		Colors::Blue,
+		Colors::Cyan,
+		Colors::Magenta,
+		Colors::Yellow,
+	};
+
+	lights.push_back(Light(XMFLOAT3(0.0f, 1.0f, 0.0f), 2.0f, XMFLOAT3(1.0f, 1.0f, 1.0f), 1.0f, XMFLOAT4(0.1f, 0.1f, 0.1f, 1.0f)));
+
+	for (size_t i = 1; i < 50; i++)
+	{
+		float rand0 = (float)rand() / RAND_MAX;
+		float rand1 = (float)rand() / RAND_MAX;
+		float rand2 = (float)rand() / RAND_MAX;
+		lights.push_back(Light(
+			XMFLOAT3 { rand0 * 30.0f - 15.0f, rand2 * 10.0f, rand1 * 20.0f - 10.0f },
+			5.0f,
+			XMFLOAT3 { 1.0f, 1.0f, 1.0f },
+			1.0f,
+			XMFLOAT4 { 0.0f, 0.0f, 0.0f, 0.0f}
+		));
+		XMStoreFloat3(&lights[i].color, colors[i % 6]);
+	}
+
+	return lights;
+}
+
+void animateSceneLights(std::vector<Light>& lights, float time)
+{
+	lights[0].position.x = std::cos(time) * 2.0f;
+	lights[0].position.z = -std::sin(time) * 2.0f;
+}
+
+PerFrameUniforms calculatePerFrameUniforms(XMFLOAT3 cameraPosition, float pitch, float yaw, int width, int height)
+{
+	PerFrameUniforms uniforms{};
+
+	auto look = XMMatrixRotationRollPitchYaw(pitch, yaw, 0.0f);
+	auto trans = XMMatrixTranslation(cameraPosition.x, cameraPosition.y, cameraPosition.z);
+
+	auto camera = look * trans;
+	auto det = XMMatrixDeterminant(camera);
+	auto view = XMMatrixInverse(&det, camera);
+
+	uniforms.eyePos = cameraPosition;
+	uniforms.screenDimensions = { static_cast<float>(width), static_cast<float>(height) };
+	uniforms.viewport = { 0.0f, 0.0f, static_cast<float>(width), static_cast<float>(height) };
+	uniforms.view = view;
+
+	auto proj = XMMatrixPerspectiveFovLH(CAMERA_FOV_Y, static_cast<float>(width) / height, 0.1f, 1000.0f);
+	uniforms.viewProj = uniforms.view * proj;
+
+	auto viewProjDet = XMMatrixDeterminant(uniforms.viewProj);
+	uniforms.invViewProj = XMMatrixInverse(&viewProjDet, uniforms.viewProj);
+
+	return uniforms;
+}
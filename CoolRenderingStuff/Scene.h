@@ -0,0 +1,155 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <DirectXMath.h>
+#include "SceneGraph.h"
+
+struct Vertex {
+	DirectX::XMFLOAT3 position;
+	DirectX::XMFLOAT3 normal;
+	DirectX::XMFLOAT3 tangent;
+	DirectX::XMFLOAT3 bitangent;
+	DirectX::XMFLOAT2 texcoord;
+	// Ambient occlusion, 1 for nothing in the way. Baked by bakeAmbientOcclusion, the ambient pass reads it from the G-buffer.
+	float occlusion = 1.0f;
+};
+
+struct MaterialCbuffer {
+	// TODO WT: bit flags (though 16 byte alignment makes that redundant right now).
+	int useDiffuseTexture = false;
+	int useNormalTexture = false;
+	int useAlphaCutoutTexture = false;
+	int useSpecularTexture = false;
+};
+
+// A single channel slot reads this channel of its texture, TEXTURE_CHANNEL_ALL uses the texture as it is.
+static const uint32_t TEXTURE_CHANNEL_ALL = 4;
+
+struct Material {
+	std::string name;
+	std::string diffuseTexture;
+	std::string normalTexture;
+	std::string alphaCutoutTexture;
+	std::string specularTexture;
+	MaterialCbuffer settings;
+
+	// Changed by cookMaterialTextures when it moves the masks into channels of their own.
+	uint32_t alphaCutoutChannel = 0;
+	uint32_t specularChannel = TEXTURE_CHANNEL_ALL;
+};
+
+struct Light {
+	DirectX::XMFLOAT3 position;
+	float radius;
+
+	DirectX::XMFLOAT3 color;
+	float intensity;
+
+	// Only used as the constant ambient when there's no environment to bake, the ambient pass lights every pixel once.
+	DirectX::XMFLOAT4 ambient;
+
+	Light() {}
+	Light(DirectX::XMFLOAT3 pos, float rad, DirectX::XMFLOAT3 col, float inten, DirectX::XMFLOAT4 ambi) : position(pos), radius(rad), color(col), intensity(inten), ambient(ambi) {}
+};
+
+struct PerFrameUniforms {
+	DirectX::XMFLOAT2 screenDimensions;
+	uint32_t frameIndex;
+	float virtualFeedbackLodBias;
+	DirectX::XMFLOAT3 eyePos;
+	float pad3;
+	DirectX::XMMATRIX view;
+	DirectX::XMMATRIX viewProj;
+	DirectX::XMMATRIX invViewProj;
+	DirectX::XMFLOAT4 virtualTextureParams;
+	// The view's rectangle in target pixels, origin then size. The whole target unless the frame is split between views.
+	DirectX::XMFLOAT4 viewport;
+	// Ambient irradiance for the ambient pass, see IrradianceSH.
+	DirectX::XMFLOAT4 irradianceSH[9];
+	// Last level of the prefiltered specular cube, then the diffuse and specular ambient scales.
+	DirectX::XMFLOAT4 environmentParams;
+};
+
+// World space AABB.
+struct MeshBounds {
+	DirectX::XMFLOAT3 min;
+	DirectX::XMFLOAT3 max;
+};
+
+// CPU side copy of a mesh, in its own space. Instances place it in the scene.
+struct MeshData {
+	std::string name;
+	uint32_t materialId;
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	MeshBounds localBounds;
+	// Per unit of the mesh's own space.
+	float uvDensity;
+	// A vertex's average unoccluded direction in the mesh's space, empty until bakeAmbientOcclusion has run.
+	std::vector<DirectX::XMFLOAT3> bentNormals;
+};
+
+// A mesh placed at a scene graph node. The same mesh can have any number of instances.
+struct MeshInstance {
+	uint32_t mesh;
+	uint32_t node;
+	// From the mesh's space to its node's. Identity unless the mesh was merged with copies of itself, see MeshInstancing.h.
+	DirectX::XMFLOAT4X4 meshToNode;
+	// World space, kept up to date with the node by updateInstanceBounds. Left for that to fill in when an instance is made.
+	MeshBounds bounds = {};
+	// Per world unit, so it takes the node's scale into account.
+	float uvDensity = 0.0f;
+};
+
+struct MeshInstancingStats {
+	uint32_t totalMeshes;
+	uint32_t uniqueMeshes;
+	// Meshes that turned out to be copies of another one.
+	uint32_t mergedMeshes;
+	uint64_t bytesBefore;
+	uint64_t bytesAfter;
+	double ms;
+};
+
+// 8 bits per channel, the same data that gets uploaded to the GPU. Always RGBA8 out of the loader, cooking can drop it to R8 or RG8.
+struct TextureData {
+	int width;
+	int height;
+	std::vector<unsigned char> pixels;
+	int channels = 4;
+	// Every level below pixels, halving down to 1x1. Empty until generateMips has run.
+	std::vector<std::vector<unsigned char>> mips;
+};
+
+struct SceneData {
+	SceneGraph graph;
+	std::vector<MeshData> meshes;
+	std::vector<MeshInstance> instances;
+	MeshInstancingStats instancingStats{};
+	std::vector<Material> materials;
+	// Keyed on the same path the materials refer to.
+	std::unordered_map<std::string, TextureData> textures;
+};
+
+MeshBounds calculateMeshBounds(const std::vector<Vertex>& vertices);
+// UV units per world unit, the square root of the mesh's total UV area over its total world area. 0 for a mesh without texcoords.
+float calculateMeshUVDensity(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices);
+// The box around a box moved by world.
+MeshBounds transformMeshBounds(const MeshBounds& bounds, DirectX::FXMMATRIX world);
+// How much world scales lengths by, the cube root of its determinant. Only exact for uniform scale.
+float getMatrixScale(DirectX::FXMMATRIX world);
+// meshToNode followed by the node's world matrix.
+DirectX::XMMATRIX getInstanceWorld(const SceneGraph& graph, const MeshInstance& instance);
+// Recomputes the world bounds and UV density of the instances whose node the graph's last update moved, or of every instance.
+void updateInstanceBounds(SceneData& scene, bool all = false);
+
+// The light setup used by the application, shared so the reference renderer sees the same scene.
+std::vector<Light> createSceneLights();
+void animateSceneLights(std::vector<Light>& lights, float time);
+
+// Vertical field of view handed to XMMatrixPerspectiveFovLH.
+static const float CAMERA_FOV_Y = 45.0f;
+
+PerFrameUniforms calculatePerFrameUniforms(DirectX::XMFLOAT3 cameraPosition, float pitch, float yaw, int width, int height);
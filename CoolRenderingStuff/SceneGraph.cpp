@@ -0,0 +1,117 @@
+#include "SceneGraph.h"
+#include "JobSystem.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+
+using namespace DirectX;
+
+uint32_t SceneGraph::addNode(const std::string& name, uint32_t parent, const XMFLOAT4X4& local)
+{
+	uint32_t node = size();
+	uint32_t level = 0;
+	if (parent != NO_NODE) {
+		if (parent >= node)
+			throw std::runtime_error("Scene graph node " + name + " was added before its parent");
+		level = getLevel(parent) + 1;
+	}
+
+	// Either the deepest level so far or the start of the next one.
+	if (level == levelStarts.size()) {
+		levelStarts.push_back(node);
+		levelDirty.push_back(0);
+	}
+	else if (level + 1 != levelStarts.size()) {
+		throw std::runtime_error("Scene graph node " + name + " was added out of depth order");
+	}
+
+	parents.push_back(parent);
+	locals.push_back(local);
+	worlds.push_back(local);
+	dirty.push_back(1);
+	updated.push_back(0);
+	names.push_back(name);
+	levelDirty[level]++;
+
+	return node;
+}
+
+uint32_t SceneGraph::getLevel(uint32_t node) const
+{
+	return static_cast<uint32_t>(std::upper_bound(levelStarts.begin(), levelStarts.end(), node) - levelStarts.begin()) - 1;
+}
+
+void SceneGraph::setLocal(uint32_t node, const XMFLOAT4X4& local)
+{
+	locals[node] = local;
+	if (!dirty[node]) {
+		dirty[node] = 1;
+		levelDirty[getLevel(node)]++;
+	}
+}
+
+uint32_t SceneGraph::updateRange(uint32_t begin, uint32_t end)
+{
+	uint32_t count = 0;
+	for (uint32_t i = begin; i < end; i++) {
+		uint32_t parent = parents[i];
+		if (!dirty[i] && (parent == NO_NODE || !updated[parent]))
+			continue;
+
+		XMMATRIX world = XMLoadFloat4x4(&locals[i]);
+		if (parent != NO_NODE)
+			world = XMMatrixMultiply(world, XMLoadFloat4x4(&worlds[parent]));
+		XMStoreFloat4x4(&worlds[i], world);
+
+		dirty[i] = 0;
+		updated[i] = 1;
+		count++;
+	}
+	return count;
+}
+
+uint32_t SceneGraph::update(JobSystem* jobs)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	stats = {};
+
+	// Last update's flags, only worth clearing if it set any.
+	if (anyUpdated)
+		std::fill(updated.begin(), updated.end(), static_cast<uint8_t>(0));
+
+	uint32_t previousLevelUpdated = 0;
+	for (uint32_t level = 0; level < getLevelCount(); level++) {
+		// Nothing dirty here and no parent moved, so nothing below can have either until the next dirty level.
+		if (levelDirty[level] == 0 && previousLevelUpdated == 0) {
+			stats.levelsSkipped++;
+			continue;
+		}
+
+		uint32_t begin = getLevelStart(level);
+		uint32_t end = getLevelStart(level + 1);
+		uint32_t count = end - begin;
+
+		if (!jobs || count < UPDATE_BATCH * 2) {
+			previousLevelUpdated = updateRange(begin, end);
+		}
+		else {
+			std::atomic<uint32_t> levelUpdated{ 0 };
+			uint32_t batches = (count + UPDATE_BATCH - 1) / UPDATE_BATCH;
+			jobs->parallelFor(batches, [&](uint32_t batch, uint32_t) {
+				uint32_t first = begin + batch * UPDATE_BATCH;
+				levelUpdated += updateRange(first, std::min(end, first + UPDATE_BATCH));
+			});
+			previousLevelUpdated = levelUpdated;
+		}
+
+		levelDirty[level] = 0;
+		stats.updated += previousLevelUpdated;
+	}
+
+	anyUpdated = stats.updated > 0;
+	stats.ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	return stats.updated;
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <DirectXMath.h>
+
+class JobSystem;
+
+struct SceneGraphStats {
+	// For the last update.
+	uint32_t updated;
+	uint32_t levelsSkipped;
+	double ms;
+};
+
+// Node transforms as parallel arrays sorted by depth, so an update walks one level at a time front to back and every
+// parent's world matrix is done before its children read it. Nodes in a level never depend on each other, which is
+// what lets a level be split across jobs. setLocal marks a node dirty, update only recomputes dirty nodes and the
+// subtrees under them, and skips a level outright when nothing in it or above it changed.
+class SceneGraph
+{
+public:
+	static const uint32_t NO_NODE = ~0u;
+	// Levels smaller than two batches aren't worth handing out.
+	static const uint32_t UPDATE_BATCH = 2048;
+
+	// Nodes go in a level at a time with every parent already in, breadth first. Throws otherwise.
+	// A new node is dirty, so its world matrix is only valid after the next update.
+	uint32_t addNode(const std::string& name, uint32_t parent, const DirectX::XMFLOAT4X4& local);
+
+	void setLocal(uint32_t node, const DirectX::XMFLOAT4X4& local);
+
+	// Jobs can be null to update on the calling thread. Returns how many world matrices changed.
+	uint32_t update(JobSystem* jobs = nullptr);
+
+	// Whether the last update recomputed the node's world matrix, itself or through a parent.
+	bool wasUpdated(uint32_t node) const { return updated[node] != 0; }
+	bool isDirty(uint32_t node) const { return dirty[node] != 0; }
+
+	uint32_t size() const { return static_cast<uint32_t>(parents.size()); }
+	uint32_t getLevelCount() const { return static_cast<uint32_t>(levelStarts.size()); }
+	// Nodes of a level are [getLevelStart(level), getLevelStart(level + 1)).
+	uint32_t getLevelStart(uint32_t level) const { return level < levelStarts.size() ? levelStarts[level] : size(); }
+	uint32_t getLevel(uint32_t node) const;
+
+	uint32_t getParent(uint32_t node) const { return parents[node]; }
+	const std::string& getName(uint32_t node) const { return names[node]; }
+	const DirectX::XMFLOAT4X4& getLocal(uint32_t node) const { return locals[node]; }
+	const DirectX::XMFLOAT4X4& getWorld(uint32_t node) const { return worlds[node]; }
+	const std::vector<DirectX::XMFLOAT4X4>& getWorlds() const { return worlds; }
+
+	const SceneGraphStats& getStats() const { return stats; }
+
+private:
+	uint32_t updateRange(uint32_t begin, uint32_t end);
+
+	// Hot, touched by every update.
+	std::vector<uint32_t> parents;
+	std::vector<DirectX::XMFLOAT4X4> locals;
+	std::vector<DirectX::XMFLOAT4X4> worlds;
+	std::vector<uint8_t> dirty;
+	std::vector<uint8_t> updated;
+
+	std::vector<uint32_t> levelStarts;
+	// Nodes marked dirty per level since the last update.
+	std::vector<uint32_t> levelDirty;
+	bool anyUpdated = false;
+
+	// Cold.
+	std::vector<std::string> names;
+
+	SceneGraphStats stats{};
+};
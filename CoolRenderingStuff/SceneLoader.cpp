@@ -0,0 +1,280 @@
+#include "SceneLoader.h"
+#include "JobSystem.h"
+#include "MeshInstancing.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "vendor/stb/stb_image.h"
+
+#include <stdexcept>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <filesystem>
+#include <mutex>
+#include <deque>
+
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+#include <assimp/ProgressHandler.hpp>
+
+using namespace DirectX;
+
+class AssimpProgressHandler : public Assimp::ProgressHandler {
+	virtual bool Update(float percentage) {
+		std::cout << "\rAssimp: " << std::fixed << std::setprecision(1) << percentage * 100.0f << std::defaultfloat << "%\tloaded.";
+		return true;
+	}
+};
+
+// Only records the path, pixels come later from decodeSceneTextures so the import itself stays quick.
+static void loadTexture(aiTextureType type, aiMaterial* materialData, const std::string& baseAssetPath, SceneData& scene, std::string& outPath, bool& outEnabled) {
+	outEnabled = false;
+	outPath.clear();
+
+	aiString path;
+	if (materialData->Get(AI_MATKEY_TEXTURE(type, 0), path) == AI_SUCCESS) {
+		outPath += baseAssetPath;
+		outPath += path.C_Str();
+
+		std::cout << outPath << std::endl;
+
+		std::filesystem::path asPath(outPath);
+		auto extension = asPath.extension();
+		if (extension == ".dds") {
+			std::cout << "Cant support DDS just yet." << outPath << std::endl;
+			outPath.clear();
+			outEnabled = false;
+			return;
+		}
+
+		scene.textures[outPath];
+
+		outEnabled = true;
+	}
+}
+
+static void decodeTexture(const std::string& path, TextureData& texture) {
+	int width, height, bpp;
+	unsigned char* textureData = stbi_load(path.c_str(), &width, &height, &bpp, STBI_rgb_alpha);
+	if (!textureData) {
+		std::stringstream errorString("Failed to load texture ");
+		errorString << path << " because " << stbi_failure_reason();
+		throw std::runtime_error(errorString.str());
+	}
+
+	texture.width = width;
+	texture.height = height;
+	texture.channels = 4;
+	texture.pixels.assign(textureData, textureData + static_cast<size_t>(width) * height * 4);
+
+	stbi_image_free(textureData);
+}
+
+static void processVertices(const aiMesh* meshData, std::vector<Vertex>& vertices) {
+	for (size_t v = 0; v < meshData->mNumVertices; v++) {
+		auto pos = meshData->mVertices[v];
+		auto normal = meshData->mNormals[v];
+		auto tangent = meshData->mTangents[v];
+		auto bitangent = meshData->mBitangents[v];
+		aiVector3D uv;
+		if (meshData->mTextureCoords) {
+			uv = meshData->mTextureCoords[0][v];
+		}
+
+		vertices[v] = {
+			{ pos.x, pos.y, pos.z },
+			{ normal.x, normal.y, normal.z },
+			{ tangent.x, tangent.y, tangent.z },
+			{ bitangent.x, bitangent.y, bitangent.z },
+			{ uv.x, uv.y }
+		};
+	}
+}
+
+static void processIndices(const aiMesh* meshData, std::vector<uint32_t>& indices) {
+	for (size_t face = 0, index = 0; face < meshData->mNumFaces; face++)
+	{
+		indices[index++] = meshData->mFaces[face].mIndices[0];
+		indices[index++] = meshData->mFaces[face].mIndices[1];
+		indices[index++] = meshData->mFaces[face].mIndices[2];
+	}
+}
+
+// The scenes are modelled in centimetres, the root node scales them to metres.
+static const float IMPORT_SCALE = 0.01f;
+
+// aiMatrix4x4 is row major for column vectors and DirectXMath uses row vectors, so it goes in transposed.
+static XMFLOAT4X4 toFloat4x4(const aiMatrix4x4& m) {
+	return XMFLOAT4X4(
+		m.a1, m.b1, m.c1, m.d1,
+		m.a2, m.b2, m.c2, m.d2,
+		m.a3, m.b3, m.c3, m.d3,
+		m.a4, m.b4, m.c4, m.d4);
+}
+
+// Breadth first, so the graph gets its nodes a level at a time. Every node's use of a mesh is an instance of it,
+// a mesh no node uses gets one at the root.
+static void buildSceneGraph(const aiScene* scene, SceneData& result, LinearArena* scratch) {
+	using QueueEntry = std::pair<const aiNode*, uint32_t>;
+	std::deque<QueueEntry, ArenaAllocator<QueueEntry>> queue(scratch);
+	queue.push_back({ scene->mRootNode, SceneGraph::NO_NODE });
+
+	XMFLOAT4X4 identity;
+	XMStoreFloat4x4(&identity, XMMatrixIdentity());
+
+	ArenaVector<uint8_t> used(result.meshes.size(), 0, scratch);
+
+	while (!queue.empty()) {
+		auto [data, parent] = queue.front();
+		queue.pop_front();
+
+		XMFLOAT4X4 local = toFloat4x4(data->mTransformation);
+		if (parent == SceneGraph::NO_NODE)
+			XMStoreFloat4x4(&local, XMMatrixMultiply(XMLoadFloat4x4(&local), XMMatrixScaling(IMPORT_SCALE, IMPORT_SCALE, IMPORT_SCALE)));
+
+		uint32_t node = result.graph.addNode(data->mName.C_Str(), parent, local);
+
+		for (uint32_t i = 0; i < data->mNumMeshes; i++) {
+			result.instances.push_back({ data->mMeshes[i], node, identity });
+			used[data->mMeshes[i]] = 1;
+		}
+
+		for (uint32_t i = 0; i < data->mNumChildren; i++) {
+			queue.push_back({ data->mChildren[i], node });
+		}
+	}
+
+	for (uint32_t i = 0; i < result.meshes.size(); i++) {
+		if (!used[i])
+			result.instances.push_back({ i, 0, identity });
+	}
+
+	result.graph.update();
+}
+
+SceneData importScene(const std::string& basePath, const std::string& fileName, LinearArena* scratch)
+{
+	Assimp::Importer importer;
+
+	AssimpProgressHandler* handler = new AssimpProgressHandler();
+	importer.SetProgressHandler(handler); // Taken ownership of handler
+
+	const aiScene* scene = importer.ReadFile(basePath + fileName, aiProcess_CalcTangentSpace | aiProcess_Triangulate | aiProcess_JoinIdenticalVertices);
+	if (!scene) {
+		throw std::runtime_error(std::string("Failed to import scene: ") + importer.GetErrorString());
+	}
+
+	std::cout << "\n Loaded\n";
+
+	SceneData result;
+	result.materials.reserve(scene->mNumMaterials);
+
+	for (size_t i = 0; i < scene->mNumMaterials; i++) {
+		Material mat;
+		aiMaterial* data = scene->mMaterials[i];
+
+		aiString name;
+		if (data->Get(AI_MATKEY_NAME, name) == AI_SUCCESS) {
+			std::cout << "Loading material " << name.C_Str() << std::endl;
+			mat.name = name.C_Str();
+		}
+
+		loadTexture(aiTextureType_DIFFUSE, data, basePath, result, mat.diffuseTexture, (bool&)mat.settings.useDiffuseTexture);
+		loadTexture(aiTextureType_NORMALS, data, basePath, result, mat.normalTexture, (bool&)mat.settings.useNormalTexture);
+		loadTexture(aiTextureType_OPACITY, data, basePath, result, mat.alphaCutoutTexture, (bool&)mat.settings.useAlphaCutoutTexture);
+		loadTexture(aiTextureType_SPECULAR, data, basePath, result, mat.specularTexture, (bool&)mat.settings.useSpecularTexture);
+		if (!mat.settings.useSpecularTexture)
+			loadTexture(aiTextureType_SHININESS, data, basePath, result, mat.specularTexture, (bool&)mat.settings.useSpecularTexture);
+		if (!mat.settings.useSpecularTexture)
+			loadTexture(aiTextureType_DIFFUSE_ROUGHNESS, data, basePath, result, mat.specularTexture, (bool&)mat.settings.useSpecularTexture);
+
+		result.materials.push_back(mat);
+	}
+
+	result.meshes.reserve(scene->mNumMeshes);
+
+	for (size_t i = 0; i < scene->mNumMeshes; i++) {
+		MeshData mesh;
+		aiMesh* data = scene->mMeshes[i];
+
+		mesh.name = data->mName.C_Str();
+		mesh.materialId = data->mMaterialIndex;
+
+		mesh.vertices.resize(data->mNumVertices);
+		processVertices(data, mesh.vertices);
+
+		mesh.indices.resize(data->mNumFaces * 3u);
+		processIndices(data, mesh.indices);
+
+		mesh.localBounds = calculateMeshBounds(mesh.vertices);
+		mesh.uvDensity = calculateMeshUVDensity(mesh.vertices, mesh.indices);
+
+		result.meshes.push_back(std::move(mesh));
+	}
+
+	buildSceneGraph(scene, result, scratch);
+
+	result.instancingStats = instanceDuplicateMeshes(result, scratch);
+	updateInstanceBounds(result, true);
+
+	auto& instancing = result.instancingStats;
+	std::cout << result.graph.size() << " nodes in " << result.graph.getLevelCount() << " levels, " << result.instances.size() << " instances of "
+		<< instancing.uniqueMeshes << " unique meshes (" << instancing.mergedMeshes << " merged, "
+		<< (instancing.bytesBefore - instancing.bytesAfter) / 1024 << " KB saved)" << std::endl;
+
+	importer.FreeScene();
+
+	return result;
+}
+
+static std::vector<std::pair<const std::string*, TextureData*>> getUndecodedTextures(SceneData& scene)
+{
+	std::vector<std::pair<const std::string*, TextureData*>> textures;
+	for (auto& [path, texture] : scene.textures) {
+		if (texture.pixels.empty())
+			textures.push_back({ &path, &texture });
+	}
+	return textures;
+}
+
+void decodeSceneTextures(SceneData& scene, JobSystem& jobs, std::atomic<uint32_t>* decoded)
+{
+	// Global in stb_image, so it's set once up front rather than from every job.
+	stbi_set_flip_vertically_on_load(true);
+
+	auto textures = getUndecodedTextures(scene);
+
+	// A throw can't cross parallelFor, the first failure is kept and rethrown once every job is done.
+	std::mutex errorMutex;
+	std::string error;
+
+	jobs.parallelFor(static_cast<uint32_t>(textures.size()), [&](uint32_t i, uint32_t) {
+		try {
+			decodeTexture(*textures[i].first, *textures[i].second);
+		}
+		catch (const std::exception& e) {
+			std::lock_guard<std::mutex> lock(errorMutex);
+			if (error.empty())
+				error = e.what();
+		}
+
+		if (decoded)
+			(*decoded)++;
+	});
+
+	if (!error.empty())
+		throw std::runtime_error(error);
+}
+
+SceneData loadScene(const std::string& basePath, const std::string& fileName)
+{
+	SceneData scene = importScene(basePath, fileName);
+
+	stbi_set_flip_vertically_on_load(true);
+	for (auto& [path, texture] : getUndecodedTextures(scene)) {
+		decodeTexture(*path, *texture);
+	}
+
+	return scene;
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include <string>
+#include <atomic>
+#include "Scene.h"
+#include "LinearArena.h"
+
+class JobSystem;
+
+// Imports a model with Assimp and decodes all its textures to RGBA8. No GPU work happens here.
+SceneData loadScene(const std::string& basePath, const std::string& fileName);
+
+// The two halves of loadScene. importScene leaves every texture the materials use in scene.textures with no pixels yet,
+// decodeSceneTextures fills them in, a texture per job, counting each one off in decoded if it's given. The import's
+// temporaries come out of scratch when there is one, the caller resets it once the import is done.
+SceneData importScene(const std::string& basePath, const std::string& fileName, LinearArena* scratch = nullptr);
+void decodeSceneTextures(SceneData& scene, JobSystem& jobs, std::atomic<uint32_t>* decoded = nullptr);
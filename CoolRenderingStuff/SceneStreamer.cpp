@@ -0,0 +1,180 @@
+#include "SceneStreamer.h"
+#include "SceneLoader.h"
+#include <stdexcept>
+#include <filesystem>
+#include "LinearArena.h"
+
+// Import temporaries, mostly the instancing pass's copies of every mesh. A bigger scene spills over onto the heap.
+static const size_t SCRATCH_SIZE = 32 * 1024 * 1024;
+
+const char* getSceneStreamStageName(SceneStreamStage stage)
+{
+	switch (stage) {
+	case SceneStreamStage::Importing: return "Importing";
+	case SceneStreamStage::BakingOcclusion: return "Baking occlusion";
+	case SceneStreamStage::Decoding: return "Decoding textures";
+	case SceneStreamStage::Cooking: return "Cooking textures";
+	case SceneStreamStage::Done: return "Done";
+	case SceneStreamStage::Failed: return "Failed";
+	}
+	return "Unknown";
+}
+
+SceneStreamer::SceneStreamer(const std::string& basePath, const std::string& fileName, uint32_t numThreads) :
+	basePath(basePath),
+	fileName(fileName),
+	jobs(numThreads)
+{
+	thread = std::thread(&SceneStreamer::threadMain, this);
+}
+
+SceneStreamer::~SceneStreamer()
+{
+	quit = true;
+	thread.join();
+}
+
+AllocationCounts SceneStreamer::getStageAllocations(SceneStreamStage stage) const
+{
+	if (stage >= SceneStreamStage::Done)
+		return {};
+	return stageAllocations[static_cast<int>(stage)].get();
+}
+
+void SceneStreamer::throwIfFailed()
+{
+	if (stage == SceneStreamStage::Failed)
+		throw std::runtime_error("Scene load failed: " + error);
+}
+
+bool SceneStreamer::takeGeometry(SceneData& out)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	throwIfFailed();
+
+	if (!geometryReady)
+		return false;
+
+	out = std::move(geometry);
+	geometry = {};
+	geometryReady = false;
+	return true;
+}
+
+bool SceneStreamer::takeOcclusion(StreamedOcclusion& out)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	throwIfFailed();
+
+	if (!occlusionReady)
+		return false;
+
+	out = std::move(occlusion);
+	occlusion = {};
+	occlusionReady = false;
+	return true;
+}
+
+bool SceneStreamer::takeTextures(StreamedTextures& out)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	throwIfFailed();
+
+	if (!texturesReady)
+		return false;
+
+	out = std::move(textures);
+	textures = {};
+	texturesReady = false;
+	return true;
+}
+
+void SceneStreamer::threadMain()
+{
+	try {
+		SceneData scene;
+		size_t scratchUsed;
+		{
+			AllocationScope scope(&stageAllocations[static_cast<int>(SceneStreamStage::Importing)]);
+			LinearArena scratch(SCRATCH_SIZE);
+			scene = importScene(basePath, fileName, &scratch);
+			scratchUsed = scratch.getUsed();
+		}
+		std::string cacheStem = "assets/cache/" + std::filesystem::path(fileName).stem().string();
+
+		// Meshes and the graph go over straight away, copies since the bake still traces against them. The textures half
+		// only needs the materials.
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			geometry.graph = scene.graph;
+			geometry.meshes = scene.meshes;
+			geometry.instances = scene.instances;
+			geometry.instancingStats = scene.instancingStats;
+			geometry.materials = scene.materials;
+			importScratchUsed = scratchUsed;
+			geometryReady = true;
+		}
+
+		if (quit)
+			return;
+
+		// Read straight back from the cache unless the geometry changed, ReferenceRenderer --bake-ao writes the same file.
+		stage = SceneStreamStage::BakingOcclusion;
+		StreamedOcclusion baked;
+		{
+			AllocationScope scope(&stageAllocations[static_cast<int>(SceneStreamStage::BakingOcclusion)]);
+			baked.stats = bakeAmbientOcclusion(scene, cacheStem + ".ao", {}, jobs);
+		}
+
+		for (auto& mesh : scene.meshes) {
+			baked.vertices.push_back(std::move(mesh.vertices));
+		}
+		scene.meshes.clear();
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			occlusion = std::move(baked);
+			occlusionReady = true;
+		}
+
+		if (quit)
+			return;
+
+		textureCount = static_cast<uint32_t>(scene.textures.size());
+		stage = SceneStreamStage::Decoding;
+		{
+			AllocationScope scope(&stageAllocations[static_cast<int>(SceneStreamStage::Decoding)]);
+			decodeSceneTextures(scene, jobs, &texturesDecoded);
+		}
+
+		if (quit)
+			return;
+
+		stage = SceneStreamStage::Cooking;
+
+		AllocationScope scope(&stageAllocations[static_cast<int>(SceneStreamStage::Cooking)]);
+
+		StreamedTextures result;
+		result.cookStats = cookMaterialTextures(scene);
+		result.mipStats = generateSceneMips(scene, jobs);
+		result.pack = packTextures(scene.textures);
+		result.materials = std::move(scene.materials);
+
+		result.virtualTexturePath = cacheStem + ".vt";
+		result.virtualLayout = layoutVirtualTextures(result.pack);
+		result.virtualCookStats = cookVirtualTextures(result.pack, result.virtualLayout, result.virtualTexturePath, jobs);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			textures = std::move(result);
+			texturesReady = true;
+		}
+
+		stage = SceneStreamStage::Done;
+	}
+	catch (const std::exception& e) {
+		std::lock_guard<std::mutex> lock(mutex);
+		error = e.what();
+		stage = SceneStreamStage::Failed;
+	}
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include "Scene.h"
+#include "JobSystem.h"
+#include "TexturePacker.h"
+#include "TextureCooker.h"
+#include "MipGenerator.h"
+#include "VirtualTexture.h"
+#include "AmbientOcclusion.h"
+#include "AllocationTracer.h"
+
+enum class SceneStreamStage {
+	Importing,
+	BakingOcclusion,
+	Decoding,
+	Cooking,
+	Done,
+	Failed,
+};
+
+const char* getSceneStreamStageName(SceneStreamStage stage);
+
+// Everything the texture half of the load produces, in one go once the pack is built.
+struct StreamedTextures {
+	TexturePack pack;
+	// The scene's materials again, pointed at the cooked textures and channels.
+	std::vector<Material> materials;
+	TextureCookStats cookStats;
+	MipGenerationStats mipStats;
+	// The pack's big colour textures cut into tiles, in a file under assets/cache that's only rewritten when they change.
+	VirtualTextureLayout virtualLayout;
+	VirtualTextureCookStats virtualCookStats;
+	std::string virtualTexturePath;
+};
+
+// The vertex occlusion bake, every mesh's vertices again with it written in.
+struct StreamedOcclusion {
+	// In mesh order, the same counts as the geometry that went over before the bake.
+	std::vector<std::vector<Vertex>> vertices;
+	AmbientOcclusionStats stats;
+};
+
+// Loads a scene on a thread of its own: import, bake the vertex occlusion, then decode, cook, mip, pack and tile the textures on a JobSystem of its own.
+// Each part is picked up by the render thread between frames as soon as it's ready, nothing here touches the device.
+// The geometry goes over before the bake, so the scene draws fully open until the occlusion follows.
+class SceneStreamer
+{
+public:
+	SceneStreamer(const std::string& basePath, const std::string& fileName, uint32_t numThreads = 0);
+	// Waits for the stage in progress to finish, an import can't be stopped part way.
+	~SceneStreamer();
+
+	SceneStreamer(const SceneStreamer&) = delete;
+	SceneStreamer& operator=(const SceneStreamer&) = delete;
+
+	// Meshes and materials straight out of the import, textures not in yet. True once, rethrows a failed load.
+	bool takeGeometry(SceneData& out);
+	// Only ever after the geometry.
+	bool takeOcclusion(StreamedOcclusion& out);
+	bool takeTextures(StreamedTextures& out);
+
+	SceneStreamStage getStage() const { return stage; }
+	uint32_t getTexturesDecoded() const { return texturesDecoded; }
+	uint32_t getTextureCount() const { return textureCount; }
+	// Heap allocations made by the loader thread and its jobs during a stage, so far if it's the one in progress.
+	AllocationCounts getStageAllocations(SceneStreamStage stage) const;
+	// How much of the import's scratch it used, past its size if it had to go to the heap. Valid once takeGeometry has returned true.
+	size_t getImportScratchUsed() const { return importScratchUsed; }
+
+private:
+	void threadMain();
+	void throwIfFailed();
+
+	std::string basePath;
+	std::string fileName;
+	JobSystem jobs;
+	AllocationCounter stageAllocations[static_cast<int>(SceneStreamStage::Done)];
+
+	std::thread thread;
+	std::mutex mutex;
+	std::atomic<bool> quit{ false };
+
+	// Shared with the render thread, guarded by mutex.
+	bool geometryReady = false;
+	SceneData geometry;
+	size_t importScratchUsed = 0;
+	bool occlusionReady = false;
+	StreamedOcclusion occlusion;
+	bool texturesReady = false;
+	StreamedTextures textures;
+	std::string error;
+
+	std::atomic<SceneStreamStage> stage{ SceneStreamStage::Importing };
+	std::atomic<uint32_t> texturesDecoded{ 0 };
+	std::atomic<uint32_t> textureCount{ 0 };
+};
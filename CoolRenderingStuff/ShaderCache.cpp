@@ -0,0 +1,383 @@
+#include "ShaderCache.h"
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+#include <unordered_set>
+#include <algorithm>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+static const uint64_t FNV_OFFSET = 14695981039346656037ull;
+static const uint64_t FNV_PRIME = 1099511628211ull;
+
+// Bump when the key layout changes so old cache files stop matching.
+static const char* CACHE_VERSION = "1";
+
+static void hashBytes(uint64_t& hash, const void* data, size_t size)
+{
+	auto bytes = static_cast<const uint8_t*>(data);
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= FNV_PRIME;
+	}
+}
+
+// Length prefixed so "ab" + "c" and "a" + "bc" don't collide.
+static void hashString(uint64_t& hash, const std::string& value)
+{
+	uint64_t size = value.size();
+	hashBytes(hash, &size, sizeof(size));
+	hashBytes(hash, value.data(), value.size());
+}
+
+static bool readText(const std::string& path, std::string& out)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open())
+		return false;
+
+	std::stringstream buffer;
+	buffer << file.rdbuf();
+	out = buffer.str();
+	return true;
+}
+
+uint32_t getMaterialFeatures(const MaterialCbuffer& settings)
+{
+	uint32_t features = 0;
+	if (settings.useDiffuseTexture) features |= MATERIAL_FEATURE_DIFFUSE;
+	if (settings.useNormalTexture) features |= MATERIAL_FEATURE_NORMAL;
+	if (settings.useAlphaCutoutTexture) features |= MATERIAL_FEATURE_ALPHA_CUTOUT;
+	if (settings.useSpecularTexture) features |= MATERIAL_FEATURE_SPECULAR;
+	return features;
+}
+
+std::vector<ShaderDefine> getMaterialFeatureDefines(uint32_t features)
+{
+	auto flag = [&](MaterialFeature feature) { return std::string((features & feature) ? "1" : "0"); };
+
+	return {
+		{ "MATERIAL_PERMUTATION", "1" },
+		{ "MATERIAL_USE_DIFFUSE", flag(MATERIAL_FEATURE_DIFFUSE) },
+		{ "MATERIAL_USE_NORMAL", flag(MATERIAL_FEATURE_NORMAL) },
+		{ "MATERIAL_USE_ALPHA_CUTOUT", flag(MATERIAL_FEATURE_ALPHA_CUTOUT) },
+		{ "MATERIAL_USE_SPECULAR", flag(MATERIAL_FEATURE_SPECULAR) },
+	};
+}
+
+// Comments blanked out with spaces, newlines kept so lines stay lines. Strings are left alone so an include path
+// can't start a comment.
+static std::string stripComments(const std::string& source)
+{
+	std::string out = source;
+	for (size_t i = 0; i < out.size(); i++) {
+		if (out[i] == '"') {
+			for (i++; i < out.size() && out[i] != '"' && out[i] != '\n'; i++) {
+			}
+		}
+		else if (out.compare(i, 2, "//") == 0) {
+			for (; i < out.size() && out[i] != '\n'; i++) {
+				out[i] = ' ';
+			}
+		}
+		else if (out.compare(i, 2, "/*") == 0) {
+			size_t end = out.find("*/", i + 2);
+			end = end == std::string::npos ? out.size() : end + 2;
+			for (; i < end; i++) {
+				if (out[i] != '\n')
+					out[i] = ' ';
+			}
+			i--;
+		}
+	}
+	return out;
+}
+
+static void parseIncludes(const std::string& path, const std::string& source, std::vector<std::string>& out)
+{
+	fs::path directory = fs::path(path).parent_path();
+
+	std::istringstream lines(stripComments(source));
+	std::string line;
+	while (std::getline(lines, line)) {
+		size_t start = line.find_first_not_of(" \t");
+		if (start == std::string::npos || line.compare(start, 8, "#include") != 0)
+			continue;
+
+		size_t open = line.find('"', start + 8);
+		size_t close = open == std::string::npos ? std::string::npos : line.find('"', open + 1);
+		if (close == std::string::npos)
+			continue;
+
+		out.push_back((directory / line.substr(open + 1, close - open - 1)).lexically_normal().generic_string());
+	}
+}
+
+std::vector<std::string> scanShaderIncludes(const std::string& path)
+{
+	std::string source;
+	if (!readText(path, source))
+		return {};
+
+	std::vector<std::string> includes;
+	parseIncludes(path, source, includes);
+
+	std::vector<std::string> existing;
+	for (auto& include : includes) {
+		if (fs::exists(include))
+			existing.push_back(include);
+	}
+
+	return existing;
+}
+
+// Depth first in include order, each file once, same as the preprocessor would see them with include guards.
+// Includes that can't be read go into missing if given, creating one changes what the key would hash.
+static void walkIncludes(const std::string& path, const std::string& source, const std::function<void(const std::string&, const std::string&)>& visit,
+	std::vector<std::string>* missing = nullptr)
+{
+	std::unordered_set<std::string> visited = { fs::path(path).lexically_normal().generic_string() };
+	std::vector<std::string> pending;
+	parseIncludes(path, source, pending);
+	std::reverse(pending.begin(), pending.end());
+
+	while (!pending.empty()) {
+		std::string include = pending.back();
+		pending.pop_back();
+
+		if (!visited.insert(include).second)
+			continue;
+
+		std::string includeSource;
+		if (!readText(include, includeSource)) {
+			if (missing)
+				missing->push_back(include);
+			continue;
+		}
+
+		visit(include, includeSource);
+
+		std::vector<std::string> nested;
+		parseIncludes(include, includeSource, nested);
+		pending.insert(pending.end(), nested.rbegin(), nested.rend());
+	}
+}
+
+std::vector<std::string> collectShaderDependencies(const std::string& path)
+{
+	std::string source;
+	if (!readText(path, source))
+		return {};
+
+	std::vector<std::string> files = { fs::path(path).lexically_normal().generic_string() };
+	walkIncludes(path, source, [&](const std::string& include, const std::string&) {
+		files.push_back(include);
+	});
+
+	return files;
+}
+
+// files gets every file the hash read or tried to, the source first.
+static uint64_t hashShaderKey(const ShaderKey& key, std::vector<std::string>* files)
+{
+	uint64_t hash = FNV_OFFSET;
+	hashString(hash, CACHE_VERSION);
+	hashString(hash, key.entryPoint);
+	hashString(hash, key.target);
+
+	for (auto& define : key.defines) {
+		hashString(hash, define.name);
+		hashString(hash, define.value);
+	}
+
+	std::string source;
+	if (!readText(key.path, source)) {
+		throw std::runtime_error("Failed to read shader " + key.path);
+	}
+	hashString(hash, source);
+
+	if (files)
+		files->push_back(key.path);
+
+	walkIncludes(key.path, source, [&](const std::string& include, const std::string& includeSource) {
+		hashString(hash, include);
+		hashString(hash, includeSource);
+		if (files)
+			files->push_back(include);
+	}, files);
+
+	return hash;
+}
+
+uint64_t hashShaderKey(const ShaderKey& key)
+{
+	return hashShaderKey(key, nullptr);
+}
+
+// Length prefixed like the hash, so keys that only differ in where one string ends and the next starts stay apart.
+static std::string getKeyName(const ShaderKey& key)
+{
+	std::string name;
+	auto append = [&](const std::string& value) {
+		name += std::to_string(value.size()) + ":" + value;
+	};
+
+	append(key.path);
+	append(key.entryPoint);
+	append(key.target);
+	for (auto& define : key.defines) {
+		append(define.name);
+		append(define.value);
+	}
+	return name;
+}
+
+static ShaderCache::FileStamp stampFile(const std::string& path)
+{
+	std::error_code error;
+	ShaderCache::FileStamp stamp = { path, fs::last_write_time(path, error), 0 };
+	if (error) {
+		stamp.writeTime = fs::file_time_type::min();
+		return stamp;
+	}
+
+	stamp.size = fs::file_size(path, error);
+	return stamp;
+}
+
+static bool stampsCurrent(const std::vector<ShaderCache::FileStamp>& stamps)
+{
+	for (auto& stamp : stamps) {
+		auto now = stampFile(stamp.path);
+		if (now.writeTime != stamp.writeTime || now.size != stamp.size)
+			return false;
+	}
+	return true;
+}
+
+ShaderCache::ShaderCache(std::string directory, ShaderCompileFunction compile) : directory(std::move(directory)), compile(std::move(compile))
+{
+	std::error_code error;
+	fs::create_directories(this->directory, error);
+}
+
+std::string ShaderCache::getCachePath(uint64_t hash) const
+{
+	std::stringstream name;
+	name << std::hex << std::setw(16) << std::setfill('0') << hash << ".cso";
+	return (fs::path(directory) / name.str()).generic_string();
+}
+
+ShaderCacheStats ShaderCache::getStats() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return stats;
+}
+
+uint64_t ShaderCache::getKeyHash(const ShaderKey& key)
+{
+	std::string name = getKeyName(key);
+
+	KeyRecord record;
+	bool known = false;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		auto found = keys.find(name);
+		if (found != keys.end()) {
+			record = found->second;
+			known = true;
+		}
+	}
+
+	if (known && stampsCurrent(record.files))
+		return record.hash;
+
+	// Stamped before the read the hash comes from, so an edit that lands mid read leaves the stamp behind and the
+	// next call hashes again. The first pass is only there to find out which files to stamp.
+	std::vector<std::string> files;
+	hashShaderKey(key, &files);
+
+	for (;;) {
+		record.files.clear();
+		for (auto& file : files) {
+			record.files.push_back(stampFile(file));
+		}
+
+		std::vector<std::string> read;
+		record.hash = hashShaderKey(key, &read);
+		if (read == files)
+			break;
+
+		files = std::move(read);
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	stats.keyHashes++;
+	keys[name] = record;
+	return record.hash;
+}
+
+std::vector<char> ShaderCache::getOrCompile(const ShaderKey& key, std::string* errors)
+{
+	uint64_t hash = getKeyHash(key);
+	std::string cachePath = getCachePath(hash);
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		auto found = loaded.find(hash);
+		if (found != loaded.end()) {
+			stats.memoryHits++;
+			return found->second;
+		}
+	}
+
+	std::ifstream cached(cachePath, std::ios::binary | std::ios::ate);
+	if (cached.is_open()) {
+		std::vector<char> bytecode(static_cast<size_t>(cached.tellg()));
+		cached.seekg(0);
+		cached.read(bytecode.data(), bytecode.size());
+
+		if (cached && !bytecode.empty()) {
+			std::lock_guard<std::mutex> lock(mutex);
+			stats.diskHits++;
+			loaded[hash] = bytecode;
+			return bytecode;
+		}
+	}
+
+	std::vector<char> bytecode;
+	std::string compileErrors;
+	bool compiled = compile(key, bytecode, compileErrors) && !bytecode.empty();
+
+	if (errors)
+		*errors = compileErrors;
+
+	if (!compiled) {
+		std::lock_guard<std::mutex> lock(mutex);
+		stats.failures++;
+		return {};
+	}
+
+	// Written to a temporary first so a crash mid write can't leave a truncated entry behind.
+	// Per thread name in case two threads end up compiling the same key.
+	std::string tempPath = cachePath + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		file.write(bytecode.data(), bytecode.size());
+	}
+
+	std::error_code error;
+	fs::rename(tempPath, cachePath, error);
+	if (error)
+		fs::remove(tempPath, error);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	stats.compiles++;
+	loaded[hash] = bytecode;
+	return bytecode;
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include <mutex>
+#include <filesystem>
+#include "Scene.h"
+
+struct ShaderDefine {
+	std::string name;
+	std::string value;
+};
+
+// Everything that changes the bytecode apart from file contents.
+struct ShaderKey {
+	std::string path;
+	std::string entryPoint;
+	std::string target;
+	std::vector<ShaderDefine> defines;
+};
+
+// Bit per MaterialCbuffer flag, see getMaterialFeatures.
+enum MaterialFeature {
+	MATERIAL_FEATURE_DIFFUSE = 1 << 0,
+	MATERIAL_FEATURE_NORMAL = 1 << 1,
+	MATERIAL_FEATURE_ALPHA_CUTOUT = 1 << 2,
+	MATERIAL_FEATURE_SPECULAR = 1 << 3,
+};
+
+uint32_t getMaterialFeatures(const MaterialCbuffer& settings);
+
+// MATERIAL_PERMUTATION plus every MATERIAL_USE_* as 0 or 1, what deferredCommon.hlsli expects.
+std::vector<ShaderDefine> getMaterialFeatureDefines(uint32_t features);
+
+// Quoted #include targets of a file, resolved against its directory the same way D3D_COMPILE_STANDARD_FILE_INCLUDE does.
+// Missing files are skipped, the compiler will complain about them properly.
+std::vector<std::string> scanShaderIncludes(const std::string& path);
+
+// The file itself followed by everything it includes, directly or not, each once.
+std::vector<std::string> collectShaderDependencies(const std::string& path);
+
+// FNV-1a over the source, every include reached from it, the entry point, target and defines in order.
+// Throws if the source file itself can't be read.
+uint64_t hashShaderKey(const ShaderKey& key);
+
+struct ShaderCacheStats {
+	uint64_t memoryHits;
+	uint64_t diskHits;
+	uint64_t compiles;
+	uint64_t failures;
+	// Keys hashed from their files. Every other lookup only checked the files' times and sizes.
+	uint64_t keyHashes;
+};
+
+// Returns false and fills errors on failure. Injected so the cache works without D3D.
+using ShaderCompileFunction = std::function<bool(const ShaderKey& key, std::vector<char>& bytecode, std::string& errors)>;
+
+// Bytecode cache on disk, one <hash>.cso per key. Stale entries are never read since any change moves the hash.
+// A key's hash is kept with the write time and size of every file it read, and only hashed again once one changes.
+// Safe to use from several threads, compiles run outside the lock.
+class ShaderCache
+{
+public:
+	ShaderCache(std::string directory, ShaderCompileFunction compile);
+
+	// Empty on compile failure, errors gets the compiler output if given.
+	std::vector<char> getOrCompile(const ShaderKey& key, std::string* errors = nullptr);
+
+	ShaderCacheStats getStats() const;
+
+	std::string getCachePath(uint64_t hash) const;
+
+	// A file as it was when a key was hashed. Missing files have the minimum time, so creating one shows up too.
+	struct FileStamp {
+		std::string path;
+		std::filesystem::file_time_type writeTime;
+		uintmax_t size;
+	};
+
+private:
+	struct KeyRecord {
+		uint64_t hash;
+		std::vector<FileStamp> files;
+	};
+
+	uint64_t getKeyHash(const ShaderKey& key);
+
+	std::string directory;
+	ShaderCompileFunction compile;
+
+	mutable std::mutex mutex;
+	std::unordered_map<std::string, KeyRecord> keys;
+	std::unordered_map<uint64_t, std::vector<char>> loaded;
+	ShaderCacheStats stats{};
+};
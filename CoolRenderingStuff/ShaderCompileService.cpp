@@ -0,0 +1,224 @@
+#include "ShaderCompileService.h"
+#include <algorithm>
+
+namespace fs = std::filesystem;
+
+ShaderCompileService::ShaderCompileService(ShaderCache& cache, uint32_t numThreads, std::chrono::milliseconds pollInterval) :
+	cache(cache),
+	jobs(numThreads),
+	pollInterval(pollInterval)
+{
+	thread = std::thread(&ShaderCompileService::threadMain, this);
+}
+
+ShaderCompileService::~ShaderCompileService()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	wake.notify_all();
+
+	thread.join();
+}
+
+void ShaderCompileService::watch(const std::vector<ShaderKey>& newShaders)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	shaders = newShaders;
+	generation++;
+	compileAll = false;
+
+	// Indices in a pending batch refer to the old list.
+	batchReady = false;
+	readyBatch = {};
+}
+
+void ShaderCompileService::requestAll()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		compileAll = true;
+	}
+	wake.notify_all();
+}
+
+bool ShaderCompileService::takeBatch(ShaderCompileBatch& out)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!batchReady)
+		return false;
+
+	out = std::move(readyBatch);
+	readyBatch = {};
+	batchReady = false;
+	return true;
+}
+
+uint32_t ShaderCompileService::getNumWatched() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return static_cast<uint32_t>(shaders.size());
+}
+
+std::vector<uint32_t> ShaderCompileService::getDependents(const std::string& file) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	auto found = dependents.find(fs::path(file).lexically_normal().generic_string());
+	if (found == dependents.end())
+		return {};
+
+	return found->second;
+}
+
+void ShaderCompileService::rebuildDependencies(const std::vector<ShaderKey>& watched)
+{
+	std::unordered_map<std::string, std::vector<uint32_t>> graph;
+
+	for (uint32_t i = 0; i < watched.size(); i++) {
+		for (auto& file : collectShaderDependencies(watched[i].path)) {
+			graph[file].push_back(i);
+		}
+	}
+
+	// Files already watched keep the time the last diff saw, so an edit made since still shows up as a change. Only
+	// files new to the graph start from their current time.
+	std::unordered_map<std::string, fs::file_time_type> times;
+	for (auto& [file, shaderIndices] : graph) {
+		auto previous = writeTimes.find(file);
+		if (previous != writeTimes.end()) {
+			times[file] = previous->second;
+			continue;
+		}
+
+		std::error_code error;
+		auto time = fs::last_write_time(file, error);
+		times[file] = (!error) ? time : fs::file_time_type::min();
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	dependents = std::move(graph);
+	writeTimes = std::move(times);
+}
+
+std::vector<uint32_t> ShaderCompileService::findChangedShaders()
+{
+	std::vector<uint32_t> changed;
+
+	for (auto& [file, time] : writeTimes) {
+		std::error_code error;
+		auto current = fs::last_write_time(file, error);
+
+		// Editors often delete and recreate on save, a missing file is just skipped until it comes back.
+		if (error || current == time)
+			continue;
+
+		time = current;
+
+		auto found = dependents.find(file);
+		if (found != dependents.end())
+			changed.insert(changed.end(), found->second.begin(), found->second.end());
+	}
+
+	std::sort(changed.begin(), changed.end());
+	changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+	return changed;
+}
+
+void ShaderCompileService::threadMain()
+{
+	while (true) {
+		std::vector<ShaderKey> watched;
+		uint64_t watchGeneration;
+		bool all;
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait_for(lock, pollInterval, [&] { return quit || compileAll; });
+
+			if (quit)
+				return;
+
+			watched = shaders;
+			watchGeneration = generation;
+			all = compileAll;
+			compileAll = false;
+		}
+
+		std::vector<uint32_t> toCompile;
+
+		if (watchGeneration != watchedGeneration) {
+			// New set, whoever called watch already has these loaded, every file starts from its current time.
+			writeTimes.clear();
+			rebuildDependencies(watched);
+			watchedGeneration = watchGeneration;
+		}
+		else {
+			toCompile = findChangedShaders();
+		}
+
+		if (all) {
+			toCompile.resize(watched.size());
+			for (uint32_t i = 0; i < watched.size(); i++) {
+				toCompile[i] = i;
+			}
+		}
+
+		if (toCompile.empty())
+			continue;
+
+		busy = true;
+
+		// A changed file can add or drop includes. Diffed again after, anything edited since the first diff gets
+		// compiled now rather than taken as already seen.
+		rebuildDependencies(watched);
+
+		auto edited = findChangedShaders();
+		toCompile.insert(toCompile.end(), edited.begin(), edited.end());
+		std::sort(toCompile.begin(), toCompile.end());
+		toCompile.erase(std::unique(toCompile.begin(), toCompile.end()), toCompile.end());
+
+		auto start = std::chrono::high_resolution_clock::now();
+
+		std::vector<std::vector<char>> bytecode(toCompile.size());
+		std::vector<std::string> errors(toCompile.size());
+
+		jobs.parallelFor(static_cast<uint32_t>(toCompile.size()), [&](uint32_t i, uint32_t threadIndex) {
+			try {
+				bytecode[i] = cache.getOrCompile(watched[toCompile[i]], &errors[i]);
+			}
+			catch (const std::exception& e) {
+				errors[i] = e.what();
+			}
+		});
+
+		auto end = std::chrono::high_resolution_clock::now();
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			if (generation == watchGeneration) {
+				// Anything not taken yet gets merged, newer bytecode for the same shader wins.
+				for (size_t i = 0; i < toCompile.size(); i++) {
+					const auto& key = watched[toCompile[i]];
+
+					if (bytecode[i].empty()) {
+						readyBatch.errors.push_back(key.path + ": " + errors[i]);
+						continue;
+					}
+
+					auto existing = std::find_if(readyBatch.shaders.begin(), readyBatch.shaders.end(), [&](const CompiledShader& shader) { return shader.index == toCompile[i]; });
+					if (existing != readyBatch.shaders.end())
+						existing->bytecode = std::move(bytecode[i]);
+					else readyBatch.shaders.push_back({ toCompile[i], std::move(bytecode[i]) });
+				}
+
+				readyBatch.compileMs = std::chrono::duration<double, std::milli>(end - start).count();
+				batchReady = true;
+			}
+		}
+
+		busy = false;
+	}
+}
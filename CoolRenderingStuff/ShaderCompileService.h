@@ -0,0 +1,77 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
+#include <unordered_map>
+#include <filesystem>
+#include "ShaderCache.h"
+#include "JobSystem.h"
+
+struct CompiledShader {
+	// Index into the list passed to watch.
+	uint32_t index;
+	std::vector<char> bytecode;
+};
+
+// Everything that finished compiling since the last takeBatch. Shaders that failed keep their old bytecode.
+struct ShaderCompileBatch {
+	std::vector<CompiledShader> shaders;
+	std::vector<std::string> errors;
+	double compileMs = 0.0;
+};
+
+// Polls the watched shaders and everything they include for changes and recompiles only the shaders a changed file feeds into.
+// Compiles go through the ShaderCache on worker threads of its own, results are picked up by the render thread between frames.
+class ShaderCompileService
+{
+public:
+	ShaderCompileService(ShaderCache& cache, uint32_t numThreads = 0, std::chrono::milliseconds pollInterval = std::chrono::milliseconds(250));
+	~ShaderCompileService();
+
+	// Replaces the watched set, anything still in flight for the old set is dropped.
+	void watch(const std::vector<ShaderKey>& shaders);
+
+	// Recompile everything on the next poll, changed or not.
+	void requestAll();
+
+	// Call once per frame before any shader is bound, swapping the whole batch in at once.
+	bool takeBatch(ShaderCompileBatch& out);
+
+	bool isBusy() const { return busy; }
+	uint32_t getNumWatched() const;
+
+	// Watched shaders the file feeds into, directly or through includes.
+	std::vector<uint32_t> getDependents(const std::string& file) const;
+
+private:
+	void threadMain();
+	void rebuildDependencies(const std::vector<ShaderKey>& shaders);
+	std::vector<uint32_t> findChangedShaders();
+
+	ShaderCache& cache;
+	JobSystem jobs;
+	std::chrono::milliseconds pollInterval;
+
+	std::thread thread;
+	mutable std::mutex mutex;
+	std::condition_variable wake;
+	bool quit = false;
+
+	// Shared with the render thread, guarded by mutex.
+	std::vector<ShaderKey> shaders;
+	uint64_t generation = 0;
+	bool compileAll = false;
+	bool batchReady = false;
+	ShaderCompileBatch readyBatch;
+	std::atomic<bool> busy{ false };
+
+	// Only touched by the service thread, apart from dependents which getDependents reads under the mutex.
+	uint64_t watchedGeneration = 0;
+	std::unordered_map<std::string, std::vector<uint32_t>> dependents;
+	std::unordered_map<std::string, std::filesystem::file_time_type> writeTimes;
+};
@@ -0,0 +1,172 @@
+#include "ShadowAtlas.h"
+#include <algorithm>
+#include <stdexcept>
+
+static bool isPowerOfTwo(uint32_t value)
+{
+	return value != 0 && (value & (value - 1)) == 0;
+}
+
+ShadowAtlas::ShadowAtlas(uint32_t size, uint32_t minTileSize) : size(size), levelCount(1)
+{
+	if (!isPowerOfTwo(size) || !isPowerOfTwo(minTileSize) || minTileSize > size)
+		throw std::runtime_error("Shadow atlas and tile sizes must be powers of two, the tile no bigger than the atlas");
+
+	while ((size >> (levelCount - 1)) > minTileSize) {
+		levelCount++;
+	}
+
+	states.resize(levelCount);
+	freeBits.resize(levelCount);
+	freeCounts.resize(levelCount);
+	for (uint32_t level = 0; level < levelCount; level++) {
+		states[level].resize(size_t(1) << (2 * level));
+		freeBits[level].resize((states[level].size() + 63) / 64);
+	}
+
+	clear();
+}
+
+void ShadowAtlas::clear()
+{
+	for (uint32_t level = 0; level < levelCount; level++) {
+		std::fill(states[level].begin(), states[level].end(), NODE_NONE);
+		std::fill(freeBits[level].begin(), freeBits[level].end(), 0);
+		freeCounts[level] = 0;
+	}
+
+	states[0][0] = NODE_FREE;
+	setFree(0, 0);
+	tileCount = 0;
+	usedTexels = 0;
+}
+
+void ShadowAtlas::setFree(uint32_t level, uint32_t index)
+{
+	uint64_t bit = uint64_t(1) << (index % 64);
+	auto& word = freeBits[level][index / 64];
+	freeCounts[level] += (word & bit) == 0;
+	word |= bit;
+}
+
+void ShadowAtlas::clearFree(uint32_t level, uint32_t index)
+{
+	uint64_t bit = uint64_t(1) << (index % 64);
+	auto& word = freeBits[level][index / 64];
+	freeCounts[level] -= (word & bit) != 0;
+	word &= ~bit;
+}
+
+bool ShadowAtlas::findFree(uint32_t level, uint32_t& index) const
+{
+	if (freeCounts[level] == 0)
+		return false;
+
+	auto& bits = freeBits[level];
+	for (uint32_t word = 0; word < bits.size(); word++) {
+		if (!bits[word])
+			continue;
+
+		uint32_t bit = 0;
+		while (!(bits[word] & (uint64_t(1) << bit))) {
+			bit++;
+		}
+		index = word * 64 + bit;
+		return true;
+	}
+	return false;
+}
+
+bool ShadowAtlas::takeFree(uint32_t level, uint32_t& index)
+{
+	if (findFree(level, index)) {
+		clearFree(level, index);
+		return true;
+	}
+
+	uint32_t parent;
+	if (level == 0 || !takeFree(level - 1, parent))
+		return false;
+
+	// The first child goes to the caller, the other three stay free.
+	states[level - 1][parent] = NODE_SPLIT;
+	for (uint32_t child = 1; child < 4; child++) {
+		states[level][parent * 4 + child] = NODE_FREE;
+		setFree(level, parent * 4 + child);
+	}
+
+	index = parent * 4;
+	return true;
+}
+
+bool ShadowAtlas::allocate(uint32_t tileSize, ShadowTile& tile)
+{
+	if (!isPowerOfTwo(tileSize) || tileSize > size || tileSize < getMinTileSize())
+		throw std::runtime_error("Shadow tile size must be a power of two within the atlas' range");
+
+	uint32_t level = 0;
+	while ((size >> level) > tileSize) {
+		level++;
+	}
+
+	uint32_t index;
+	if (!takeFree(level, index))
+		return false;
+
+	states[level][index] = NODE_USED;
+
+	// Morton order interleaves the bits, x in the even ones and y in the odd.
+	uint32_t x = 0, y = 0;
+	for (uint32_t bit = level; bit-- > 0;) {
+		uint32_t quadrant = (index >> (2 * bit)) & 3;
+		x = x * 2 + (quadrant & 1);
+		y = y * 2 + (quadrant >> 1);
+	}
+
+	tile = { x * tileSize, y * tileSize, tileSize, level, index };
+	tileCount++;
+	usedTexels += uint64_t(tileSize) * tileSize;
+	return true;
+}
+
+void ShadowAtlas::free(const ShadowTile& tile)
+{
+	uint32_t level = tile.level, index = tile.index;
+	if (level >= levelCount || index >= states[level].size() || states[level][index] != NODE_USED)
+		throw std::runtime_error("Freeing a shadow tile that isn't allocated");
+
+	states[level][index] = NODE_FREE;
+	tileCount--;
+	usedTexels -= uint64_t(tile.size) * tile.size;
+
+	// Four free siblings go back to being their free parent, as far up as that goes.
+	while (level > 0) {
+		uint32_t first = index & ~3u;
+		bool siblingsFree = true;
+		for (uint32_t child = 0; child < 4; child++) {
+			siblingsFree &= states[level][first + child] == NODE_FREE;
+		}
+		if (!siblingsFree)
+			break;
+
+		for (uint32_t child = 0; child < 4; child++) {
+			states[level][first + child] = NODE_NONE;
+			clearFree(level, first + child);
+		}
+
+		level--;
+		index >>= 2;
+		states[level][index] = NODE_FREE;
+	}
+
+	setFree(level, index);
+}
+
+uint32_t ShadowAtlas::getLargestFreeTile() const
+{
+	for (uint32_t level = 0; level < levelCount; level++) {
+		if (freeCounts[level])
+			return size >> level;
+	}
+	return 0;
+}
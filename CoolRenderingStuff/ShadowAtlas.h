@@ -0,0 +1,58 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+// A square of the atlas handed out by ShadowAtlas, in texels. level and index say which quadtree node it is.
+struct ShadowTile {
+	uint32_t x = 0;
+	uint32_t y = 0;
+	uint32_t size = 0;
+	uint32_t level = 0;
+	uint32_t index = 0;
+};
+
+// Quadtree allocator for a square atlas of power of two tiles. Level 0 is the whole atlas and every level down splits
+// each node in four, so a tile is always aligned to its own size and a freed tile merges back with its siblings into
+// the parent. Nodes of a level are in Morton order, lowest first, which keeps allocations packed into one corner.
+class ShadowAtlas
+{
+public:
+	// Both powers of two, the minimum no bigger than the atlas. Throws otherwise.
+	ShadowAtlas(uint32_t size, uint32_t minTileSize);
+
+	// A power of two tile between the minimum and the atlas size. Returns false when there's no room for it.
+	bool allocate(uint32_t tileSize, ShadowTile& tile);
+	void free(const ShadowTile& tile);
+	void clear();
+
+	uint32_t getSize() const { return size; }
+	uint32_t getMinTileSize() const { return size >> (levelCount - 1); }
+	uint32_t getTileCount() const { return tileCount; }
+	uint64_t getUsedTexels() const { return usedTexels; }
+	// The biggest tile allocate would hand out right now, 0 when full.
+	uint32_t getLargestFreeTile() const;
+
+private:
+	enum NodeState : uint8_t {
+		NODE_NONE,
+		NODE_FREE,
+		NODE_SPLIT,
+		NODE_USED,
+	};
+
+	// Takes a free node of the level, splitting one further up if the level has none.
+	bool takeFree(uint32_t level, uint32_t& index);
+
+	// A bit per node, so the free lists are sized once and the lowest free node is a scan for the first set bit.
+	void setFree(uint32_t level, uint32_t index);
+	void clearFree(uint32_t level, uint32_t index);
+	bool findFree(uint32_t level, uint32_t& index) const;
+
+	uint32_t size;
+	uint32_t levelCount;
+	std::vector<std::vector<uint8_t>> states;
+	std::vector<std::vector<uint64_t>> freeBits;
+	std::vector<uint32_t> freeCounts;
+	uint32_t tileCount = 0;
+	uint64_t usedTexels = 0;
+};
@@ -0,0 +1,347 @@
+#include "ShadowCache.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+
+using namespace DirectX;
+
+static const uint32_t ALL_FACES = (1u << CUBE_FACE_COUNT) - 1;
+
+// D3D's cube faces, the same bases XMMatrixLookToLH builds and lightAccPixel.hlsl picks between.
+static const XMFLOAT3 FACE_LOOK[CUBE_FACE_COUNT] = {
+	{ 1.0f, 0.0f, 0.0f }, { -1.0f, 0.0f, 0.0f },
+	{ 0.0f, 1.0f, 0.0f }, { 0.0f, -1.0f, 0.0f },
+	{ 0.0f, 0.0f, 1.0f }, { 0.0f, 0.0f, -1.0f },
+};
+static const XMFLOAT3 FACE_UP[CUBE_FACE_COUNT] = {
+	{ 0.0f, 1.0f, 0.0f }, { 0.0f, 1.0f, 0.0f },
+	{ 0.0f, 0.0f, -1.0f }, { 0.0f, 0.0f, 1.0f },
+	{ 0.0f, 1.0f, 0.0f }, { 0.0f, 1.0f, 0.0f },
+};
+
+static uint32_t countFaces(uint32_t faces)
+{
+	uint32_t count = 0;
+	for (; faces; faces &= faces - 1) {
+		count++;
+	}
+	return count;
+}
+
+float getShadowScreenRadius(const Light& light, float rangeScale, XMFLOAT3 eye, float projScale, float height)
+{
+	float range = light.radius * rangeScale;
+	float x = light.position.x - eye.x, y = light.position.y - eye.y, z = light.position.z - eye.z;
+	float distSq = x * x + y * y + z * z;
+
+	// From inside the range it can fill the screen.
+	if (distSq <= range * range)
+		return height;
+
+	// The sphere's silhouette, tan of its half angle scaled into pixels.
+	return range / std::sqrt(distSq - range * range) * projScale * height * 0.5f;
+}
+
+XMMATRIX getShadowFaceViewProj(XMFLOAT3 origin, uint32_t face, float nearPlane, float farPlane)
+{
+	auto view = XMMatrixLookToLH(XMLoadFloat3(&origin), XMLoadFloat3(&FACE_LOOK[face]), XMLoadFloat3(&FACE_UP[face]));
+	return view * XMMatrixPerspectiveFovLH(XM_PIDIV2, 1.0f, nearPlane, farPlane);
+}
+
+bool shadowFaceTouchesBounds(XMFLOAT3 origin, float range, uint32_t face, const MeshBounds& bounds)
+{
+	float cx = (bounds.min.x + bounds.max.x) * 0.5f - origin.x, ex = (bounds.max.x - bounds.min.x) * 0.5f;
+	float cy = (bounds.min.y + bounds.max.y) * 0.5f - origin.y, ey = (bounds.max.y - bounds.min.y) * 0.5f;
+	float cz = (bounds.min.z + bounds.max.z) * 0.5f - origin.z, ez = (bounds.max.z - bounds.min.z) * 0.5f;
+
+	float dx = std::max(std::fabs(cx) - ex, 0.0f), dy = std::max(std::fabs(cy) - ey, 0.0f), dz = std::max(std::fabs(cz) - ez, 0.0f);
+	if (dx * dx + dy * dy + dz * dz > range * range)
+		return false;
+
+	// The side planes of a 90 degree frustum bisect look and each of its edge directions, all through the origin.
+	auto& l = FACE_LOOK[face];
+	auto& u = FACE_UP[face];
+	XMFLOAT3 r = { u.y * l.z - u.z * l.y, u.z * l.x - u.x * l.z, u.x * l.y - u.y * l.x };
+
+	for (uint32_t plane = 0; plane < 4; plane++) {
+		auto& side = plane < 2 ? r : u;
+		float sign = (plane & 1) ? -1.0f : 1.0f;
+		float nx = l.x + side.x * sign, ny = l.y + side.y * sign, nz = l.z + side.z * sign;
+		if (nx * cx + ny * cy + nz * cz + std::fabs(nx) * ex + std::fabs(ny) * ey + std::fabs(nz) * ez < 0.0f)
+			return false;
+	}
+	return true;
+}
+
+ShadowCache::ShadowCache(const ShadowSettings& settings) : settings(settings), atlas(settings.atlasSize, settings.minTileSize)
+{
+	if (settings.maxTileSize < settings.minTileSize || settings.maxTileSize > settings.atlasSize)
+		throw std::runtime_error("Shadow tile size range doesn't fit the atlas");
+}
+
+bool ShadowCache::allocateTiles(LightShadow& shadow, uint32_t tileSize)
+{
+	for (uint32_t face = 0; face < CUBE_FACE_COUNT; face++) {
+		if (!atlas.allocate(tileSize, shadow.tiles[face])) {
+			while (face-- > 0) {
+				atlas.free(shadow.tiles[face]);
+			}
+			return false;
+		}
+	}
+
+	shadow.tileSize = tileSize;
+	shadow.dirtyFaces = ALL_FACES;
+	shadow.complete = false;
+	return true;
+}
+
+void ShadowCache::freeTiles(LightShadow& shadow)
+{
+	if (shadow.tileSize == 0)
+		return;
+
+	for (auto& tile : shadow.tiles) {
+		atlas.free(tile);
+	}
+
+	shadow.tileSize = 0;
+	shadow.dirtyFaces = 0;
+	shadow.complete = false;
+}
+
+void ShadowCache::invalidateCasters(const MeshBounds& bounds)
+{
+	for (auto& shadow : shadows) {
+		if (shadow.tileSize == 0 || shadow.dirtyFaces == ALL_FACES)
+			continue;
+
+		for (uint32_t face = 0; face < CUBE_FACE_COUNT; face++) {
+			if (!(shadow.dirtyFaces & (1u << face)) && shadowFaceTouchesBounds(shadow.origin, shadow.range, face, bounds)) {
+				shadow.dirtyFaces |= 1u << face;
+			}
+		}
+	}
+}
+
+void ShadowCache::invalidateAll()
+{
+	for (auto& shadow : shadows) {
+		if (shadow.tileSize != 0) {
+			shadow.dirtyFaces = ALL_FACES;
+		}
+	}
+}
+
+const std::vector<ShadowFaceRender>& ShadowCache::update(const std::vector<Light>& lights, const std::vector<uint8_t>& visible, const std::vector<float>& screenRadius, LinearArena* scratch)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	uint32_t lightCount = static_cast<uint32_t>(lights.size());
+	if (visible.size() != lightCount || screenRadius.size() != lightCount)
+		throw std::runtime_error("Shadow update needs visibility and a screen radius for every light");
+
+	for (uint32_t i = lightCount; i < shadows.size(); i++) {
+		freeTiles(shadows[i]);
+	}
+	shadows.resize(lightCount);
+	renders.clear();
+
+	ShadowStats frame;
+	frame.totalFacesRendered = stats.totalFacesRendered;
+	frame.totalFacesAvoided = stats.totalFacesAvoided;
+	frame.lights = lightCount;
+
+	// Invisible lights rank below every visible one, they keep their tiles only until someone visible needs the room.
+	auto priority = [&](uint32_t light) { return visible[light] ? screenRadius[light] : -1.0f; };
+
+	ArenaVector<uint32_t> order(lightCount, 0, scratch);
+	for (uint32_t i = 0; i < lightCount; i++) {
+		order[i] = i;
+	}
+	std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+		float pa = priority(a), pb = priority(b);
+		return pa != pb ? pa > pb : a < b;
+	});
+
+	for (uint32_t i = 0; i < lightCount; i++) {
+		auto& shadow = shadows[i];
+		auto& light = lights[i];
+		float range = light.radius * settings.rangeScale;
+		if (shadow.tileSize != 0 && (light.position.x != shadow.origin.x || light.position.y != shadow.origin.y || light.position.z != shadow.origin.z || range != shadow.range)) {
+			shadow.dirtyFaces = ALL_FACES;
+		}
+	}
+
+	ArenaVector<uint32_t> desired(lightCount, 0, scratch);
+	uint64_t desiredTexels = 0;
+	for (uint32_t i = 0; i < lightCount; i++) {
+		if (!visible[i])
+			continue;
+
+		desired[i] = settings.minTileSize;
+		float texels = screenRadius[i] * settings.texelsPerPixel;
+		while (desired[i] < texels && desired[i] < settings.maxTileSize) {
+			desired[i] *= 2;
+		}
+		desiredTexels += uint64_t(desired[i]) * desired[i] * CUBE_FACE_COUNT;
+	}
+
+	// With more visible lights than fit, the biggest are capped until they do. A quarter is left for the quadtree to
+	// fragment, packing it any fuller means evicting lights every frame to make room.
+	uint64_t capacity = uint64_t(atlas.getSize()) * atlas.getSize() * 3 / 4;
+	uint32_t sizeCap = settings.maxTileSize;
+	while (desiredTexels > capacity && sizeCap > settings.minTileSize) {
+		sizeCap /= 2;
+		desiredTexels = 0;
+		for (uint32_t i = 0; i < lightCount; i++) {
+			desired[i] = std::min(desired[i], sizeCap);
+			desiredTexels += uint64_t(desired[i]) * desired[i] * CUBE_FACE_COUNT;
+		}
+	}
+
+	// Most important first, so anything evicted to make room is always less important than what takes its place. The
+	// victims come off the back of the same order.
+	size_t victim = order.size();
+	for (uint32_t light : order) {
+		if (!visible[light])
+			break;
+
+		frame.visibleLights++;
+		auto& shadow = shadows[light];
+
+		// Grows straight away but only shrinks once it's a quarter of the size, so a light near a boundary doesn't flip.
+		// Over the cap it shrinks regardless, the others need the room.
+		if (shadow.tileSize != 0 && desired[light] <= shadow.tileSize && desired[light] * 4 > shadow.tileSize && shadow.tileSize <= sizeCap)
+			continue;
+
+		if (shadow.tileSize != 0) {
+			freeTiles(shadow);
+			frame.reallocations++;
+		}
+
+		bool allocated = false;
+		for (uint32_t size = desired[light]; size >= settings.minTileSize && !allocated; size /= 2) {
+			while (!(allocated = allocateTiles(shadow, size))) {
+				while (victim > 0 && shadows[order[victim - 1]].tileSize == 0) {
+					victim--;
+				}
+				if (victim == 0 || priority(order[victim - 1]) >= priority(light))
+					break;
+
+				freeTiles(shadows[order[--victim]]);
+				frame.evictions++;
+			}
+		}
+
+		if (!allocated) {
+			frame.unallocated++;
+		}
+	}
+
+	// Visible lights without a map come first, then visible ones by size on screen grown by how long they've waited,
+	// then the rest by how long they've waited.
+	ArenaVector<uint32_t> dirty(scratch);
+	dirty.reserve(lightCount);
+	for (uint32_t i = 0; i < lightCount; i++) {
+		if (shadows[i].tileSize != 0 && shadows[i].dirtyFaces != 0) {
+			dirty.push_back(i);
+		}
+	}
+	std::sort(dirty.begin(), dirty.end(), [&](uint32_t a, uint32_t b) {
+		auto& sa = shadows[a];
+		auto& sb = shadows[b];
+		if (visible[a] != visible[b])
+			return visible[a] > visible[b];
+		if (visible[a] && sa.complete != sb.complete)
+			return sb.complete;
+
+		float wa = (visible[a] ? screenRadius[a] : 1.0f) * (1.0f + sa.waitFrames);
+		float wb = (visible[b] ? screenRadius[b] : 1.0f) * (1.0f + sb.waitFrames);
+		return wa != wb ? wa > wb : a < b;
+	});
+
+	for (uint32_t light : dirty) {
+		auto& shadow = shadows[light];
+		uint32_t faces = countFaces(shadow.dirtyFaces);
+
+		// A light always goes whole so its faces agree on where it was, the first one even over budget.
+		if (frame.facesRendered != 0 && frame.facesRendered + faces > settings.faceBudget) {
+			frame.facesDeferred += faces;
+			shadow.waitFrames++;
+			if (visible[light]) {
+				frame.maxWaitFrames = std::max(frame.maxWaitFrames, shadow.waitFrames);
+			}
+			continue;
+		}
+
+		shadow.origin = lights[light].position;
+		shadow.range = lights[light].radius * settings.rangeScale;
+		for (uint32_t face = 0; face < CUBE_FACE_COUNT; face++) {
+			if (shadow.dirtyFaces & (1u << face)) {
+				renders.push_back({ light, face, shadow.tiles[face], getShadowFaceViewProj(shadow.origin, face, settings.nearPlane, shadow.range) });
+			}
+		}
+
+		frame.facesRendered += faces;
+		shadow.dirtyFaces = 0;
+		shadow.complete = true;
+		shadow.waitFrames = 0;
+	}
+
+	for (auto& shadow : shadows) {
+		if (shadow.complete) {
+			frame.shadowedLights++;
+		}
+	}
+
+	frame.facesAvoided = frame.shadowedLights * CUBE_FACE_COUNT - frame.facesRendered;
+	frame.totalFacesRendered += frame.facesRendered;
+	frame.totalFacesAvoided += frame.facesAvoided;
+	frame.largestFreeTile = atlas.getLargestFreeTile();
+	frame.atlasUsage = static_cast<float>(static_cast<double>(atlas.getUsedTexels()) / (static_cast<double>(atlas.getSize()) * atlas.getSize()));
+	frame.updateMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	stats = frame;
+	return renders;
+}
+
+ShadowConstants ShadowCache::getConstants(uint32_t light) const
+{
+	ShadowConstants constants{};
+	if (!hasShadow(light))
+		return constants;
+
+	auto& shadow = shadows[light];
+	float scale = 1.0f / atlas.getSize();
+	for (uint32_t face = 0; face < CUBE_FACE_COUNT; face++) {
+		auto& tile = shadow.tiles[face];
+		constants.faceRects[face] = { tile.x * scale, tile.y * scale, tile.size * scale, tile.size * scale };
+	}
+
+	float nearPlane = settings.nearPlane, farPlane = shadow.range;
+	constants.origin = shadow.origin;
+	constants.enabled = 1.0f;
+	constants.depthParams = { farPlane / (farPlane - nearPlane), -nearPlane * farPlane / (farPlane - nearPlane), farPlane, 0.5f * scale };
+	return constants;
+}
+
+bool ShadowCache::hasShadow(uint32_t light) const
+{
+	return light < shadows.size() && shadows[light].complete;
+}
+
+bool ShadowCache::getTile(uint32_t light, uint32_t face, ShadowTile& tile) const
+{
+	if (light >= shadows.size() || shadows[light].tileSize == 0 || face >= CUBE_FACE_COUNT)
+		return false;
+
+	tile = shadows[light].tiles[face];
+	return true;
+}
+
+bool ShadowCache::isFaceDirty(uint32_t light, uint32_t face) const
+{
+	return light < shadows.size() && (shadows[light].dirtyFaces & (1u << face)) != 0;
+}
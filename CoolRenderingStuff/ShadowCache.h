@@ -0,0 +1,134 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <DirectXMath.h>
+#include "Cubemap.h"
+#include "Scene.h"
+#include "ShadowAtlas.h"
+#include "LinearArena.h"
+
+struct ShadowSettings {
+	uint32_t atlasSize = 4096;
+	uint32_t minTileSize = 64;
+	uint32_t maxTileSize = 512;
+	// Cube faces drawn per frame at most. A light's dirty faces go together, so one light can still take more.
+	uint32_t faceBudget = 24;
+	// Face texels per pixel of the light's range on screen, before rounding up to a power of two.
+	float texelsPerPixel = 0.5f;
+	// The map's far plane as a multiple of the light's radius. Nothing past it is shadowed.
+	float rangeScale = 1.0f;
+	float nearPlane = 0.05f;
+};
+
+// Per light constants for the shadow lookup in lightAccPixel.hlsl, register b2.
+struct ShadowConstants {
+	// Each cube face's tile in atlas uv, origin then size, in the order of getShadowFaceViewProj.
+	DirectX::XMFLOAT4 faceRects[CUBE_FACE_COUNT];
+	// Where the light was when the map was drawn, it can have moved since.
+	DirectX::XMFLOAT3 origin;
+	// 0 when the light has no map yet and goes unshadowed.
+	float enabled;
+	// Depth at view distance z is x + y / z, z is the far plane and w half a texel in atlas uv.
+	DirectX::XMFLOAT4 depthParams;
+};
+
+// A face the caller has to draw this frame: clear the tile's depth and render the casters with viewProj into it.
+struct ShadowFaceRender {
+	uint32_t light;
+	uint32_t face;
+	ShadowTile tile;
+	DirectX::XMMATRIX viewProj;
+};
+
+struct ShadowStats {
+	uint32_t lights = 0;
+	uint32_t visibleLights = 0;
+	// Lights with a complete map, possibly a stale one.
+	uint32_t shadowedLights = 0;
+	uint32_t facesRendered = 0;
+	// Dirty faces left for a later frame by the budget.
+	uint32_t facesDeferred = 0;
+	// Against drawing all six faces of every shadowed light every frame.
+	uint32_t facesAvoided = 0;
+	uint32_t reallocations = 0;
+	uint32_t evictions = 0;
+	// Visible lights that got no tiles at the smallest size.
+	uint32_t unallocated = 0;
+	// Most frames a visible light has waited with a dirty map.
+	uint32_t maxWaitFrames = 0;
+	uint32_t largestFreeTile = 0;
+	float atlasUsage = 0.0f;
+	double updateMs = 0.0;
+
+	// Since the cache was created.
+	uint64_t totalFacesRendered = 0;
+	uint64_t totalFacesAvoided = 0;
+};
+
+// Point light cube shadows kept in one atlas and only redrawn when they change. Every light gets six tiles sized by how
+// big its range is on screen, and a face stays valid until the light moves or a caster moves inside it. Dirty faces
+// queue up and a frame draws as many as its budget allows, visible lights first and then the ones that have waited
+// longest. Nothing here touches the GPU, update returns the faces to draw and getConstants what the light pass needs.
+class ShadowCache
+{
+public:
+	ShadowCache(const ShadowSettings& settings = {});
+
+	// A caster's bounds before and after it moved, or those of one that was added or removed. Every face whose frustum
+	// touches them is redrawn.
+	void invalidateCasters(const MeshBounds& bounds);
+	// Drops every map, for when all the casters change at once.
+	void invalidateAll();
+
+	// One frame: resizes tiles for lights whose size on screen changed, marks the faces of lights that moved and picks
+	// the faces to draw within the budget. visible and screenRadius have an entry per light, the radius in pixels
+	// from getShadowScreenRadius. Lights can be added or removed between frames, a change of index is a new light.
+	// The sorting temporaries come out of scratch when there is one.
+	const std::vector<ShadowFaceRender>& update(const std::vector<Light>& lights, const std::vector<uint8_t>& visible, const std::vector<float>& screenRadius, LinearArena* scratch = nullptr);
+
+	ShadowConstants getConstants(uint32_t light) const;
+	bool hasShadow(uint32_t light) const;
+	// The face's tile, false if the light has none.
+	bool getTile(uint32_t light, uint32_t face, ShadowTile& tile) const;
+	// Whether the face waits to be drawn.
+	bool isFaceDirty(uint32_t light, uint32_t face) const;
+
+	void setFaceBudget(uint32_t budget) { settings.faceBudget = budget; }
+	const ShadowSettings& getSettings() const { return settings; }
+	const ShadowAtlas& getAtlas() const { return atlas; }
+	const ShadowStats& getStats() const { return stats; }
+
+private:
+	struct LightShadow {
+		ShadowTile tiles[CUBE_FACE_COUNT];
+		// 0 without tiles.
+		uint32_t tileSize = 0;
+		// The origin and range the map was drawn with.
+		DirectX::XMFLOAT3 origin = { 0.0f, 0.0f, 0.0f };
+		float range = 0.0f;
+		// Bit per face.
+		uint32_t dirtyFaces = 0;
+		// Every face has been drawn at least once since the tiles were allocated.
+		bool complete = false;
+		uint32_t waitFrames = 0;
+	};
+
+	bool allocateTiles(LightShadow& shadow, uint32_t tileSize);
+	void freeTiles(LightShadow& shadow);
+
+	ShadowSettings settings;
+	ShadowAtlas atlas;
+	std::vector<LightShadow> shadows;
+	std::vector<ShadowFaceRender> renders;
+	ShadowStats stats;
+};
+
+// The light's range as a radius on screen in pixels, for a camera at eye whose projection scales y by projScale, i.e.
+// 1 / tan(fovY / 2), on a target height pixels high.
+float getShadowScreenRadius(const Light& light, float rangeScale, DirectX::XMFLOAT3 eye, float projScale, float height);
+
+// The face's 90 degree view projection from origin, in D3D's cube face order and orientation.
+DirectX::XMMATRIX getShadowFaceViewProj(DirectX::XMFLOAT3 origin, uint32_t face, float nearPlane, float farPlane);
+
+// Whether bounds can be in the face's frustum out to range. The four side planes and the range sphere, conservative.
+bool shadowFaceTouchesBounds(DirectX::XMFLOAT3 origin, float range, uint32_t face, const MeshBounds& bounds);
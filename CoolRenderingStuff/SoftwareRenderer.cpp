@@ -0,0 +1,842 @@
+#include "SoftwareRenderer.h"
+#include "JobSystem.h"
+#include "EnvironmentLighting.h"
+#include "LightTree.h"
+
+#include <xmmintrin.h>
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+
+using namespace DirectX;
+
+static double elapsedMs(std::chrono::high_resolution_clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+// Integer hash to [0, 1), turns each pixel's stratified light samples by a different amount.
+static float hashToUnit(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return static_cast<float>(x >> 8) * (1.0f / 16777216.0f);
+}
+
+SoftwareTexture::SoftwareTexture(const TextureData& data)
+{
+	// Samples the way the uncooked material slots do, cooked masks would need the channel selects too.
+	if (data.channels != 4)
+		throw std::runtime_error("Software renderer needs the scene's textures uncooked");
+
+	Level base;
+	base.width = static_cast<uint32_t>(data.width);
+	base.height = static_cast<uint32_t>(data.height);
+	base.pixels = data.pixels;
+	levels.push_back(std::move(base));
+
+	// Plain 2x2 box filter, close enough to what GenerateMips does.
+	while (levels.back().width > 1 || levels.back().height > 1) {
+		const Level& src = levels.back();
+
+		Level dst;
+		dst.width = std::max(1u, src.width / 2);
+		dst.height = std::max(1u, src.height / 2);
+		dst.pixels.resize(static_cast<size_t>(dst.width) * dst.height * 4);
+
+		for (uint32_t y = 0; y < dst.height; y++) {
+			uint32_t sy0 = std::min(y * 2, src.height - 1);
+			uint32_t sy1 = std::min(y * 2 + 1, src.height - 1);
+
+			for (uint32_t x = 0; x < dst.width; x++) {
+				uint32_t sx0 = std::min(x * 2, src.width - 1);
+				uint32_t sx1 = std::min(x * 2 + 1, src.width - 1);
+
+				for (uint32_t c = 0; c < 4; c++) {
+					uint32_t sum = src.pixels[(sy0 * src.width + sx0) * 4 + c]
+						+ src.pixels[(sy0 * src.width + sx1) * 4 + c]
+						+ src.pixels[(sy1 * src.width + sx0) * 4 + c]
+						+ src.pixels[(sy1 * src.width + sx1) * 4 + c];
+					dst.pixels[(y * dst.width + x) * 4 + c] = static_cast<uint8_t>((sum + 2) / 4);
+				}
+			}
+		}
+
+		levels.push_back(std::move(dst));
+	}
+}
+
+XMVECTOR SoftwareTexture::sampleLevel(const Level& level, float u, float v) const
+{
+	float x = u * level.width - 0.5f;
+	float y = v * level.height - 0.5f;
+
+	float fx = std::floor(x);
+	float fy = std::floor(y);
+	float tx = x - fx;
+	float ty = y - fy;
+
+	auto wrap = [](int coord, uint32_t size) {
+		int m = coord % static_cast<int>(size);
+		return static_cast<uint32_t>(m < 0 ? m + static_cast<int>(size) : m);
+	};
+
+	uint32_t x0 = wrap(static_cast<int>(fx), level.width);
+	uint32_t x1 = wrap(static_cast<int>(fx) + 1, level.width);
+	uint32_t y0 = wrap(static_cast<int>(fy), level.height);
+	uint32_t y1 = wrap(static_cast<int>(fy) + 1, level.height);
+
+	auto texel = [&](uint32_t tx, uint32_t ty) {
+		const uint8_t* p = &level.pixels[(static_cast<size_t>(ty) * level.width + tx) * 4];
+		return XMVectorSet(p[0], p[1], p[2], p[3]);
+	};
+
+	auto top = XMVectorLerp(texel(x0, y0), texel(x1, y0), tx);
+	auto bottom = XMVectorLerp(texel(x0, y1), texel(x1, y1), tx);
+
+	return XMVectorScale(XMVectorLerp(top, bottom, ty), 1.0f / 255.0f);
+}
+
+XMVECTOR SoftwareTexture::sample(float u, float v, float lod) const
+{
+	float maxLevel = static_cast<float>(levels.size() - 1);
+	lod = std::max(0.0f, std::min(lod, maxLevel));
+
+	uint32_t level0 = static_cast<uint32_t>(lod);
+	uint32_t level1 = std::min(level0 + 1, static_cast<uint32_t>(levels.size() - 1));
+	float t = lod - level0;
+
+	auto a = sampleLevel(levels[level0], u, v);
+	if (t <= 0.0f || level0 == level1)
+		return a;
+
+	return XMVectorLerp(a, sampleLevel(levels[level1], u, v), t);
+}
+
+SoftwareRenderer::SoftwareRenderer(const SceneData& scene, JobSystem& jobs) : scene(scene), jobs(jobs)
+{
+	// Build every texture's mip chain up front, in parallel as it's the slow bit of start up.
+	std::vector<const std::string*> names;
+	for (auto& texture : scene.textures) {
+		names.push_back(&texture.first);
+	}
+
+	ownedTextures.resize(names.size());
+	jobs.parallelFor(static_cast<uint32_t>(names.size()), [&](uint32_t i, uint32_t) {
+		ownedTextures[i] = new SoftwareTexture(scene.textures.at(*names[i]));
+	});
+
+	auto find = [&](bool enabled, const std::string& name) -> const SoftwareTexture* {
+		if (!enabled)
+			return nullptr;
+
+		for (size_t i = 0; i < names.size(); i++) {
+			if (*names[i] == name)
+				return ownedTextures[i];
+		}
+		return nullptr;
+	};
+
+	for (auto& mat : scene.materials) {
+		MaterialTextures textures;
+		textures.diffuse = find(mat.settings.useDiffuseTexture, mat.diffuseTexture);
+		textures.normal = find(mat.settings.useNormalTexture, mat.normalTexture);
+		textures.alphaCutout = find(mat.settings.useAlphaCutoutTexture, mat.alphaCutoutTexture);
+		textures.specular = find(mat.settings.useSpecularTexture, mat.specularTexture);
+		materialTextures.push_back(textures);
+	}
+
+	instanceTriangles.resize(scene.instances.size());
+	instanceBins.resize(scene.instances.size());
+	clipScratch.resize(jobs.getNumThreads());
+	threadStats.resize(jobs.getNumThreads());
+}
+
+SoftwareRenderer::~SoftwareRenderer()
+{
+	for (auto texture : ownedTextures) {
+		delete texture;
+	}
+}
+
+const std::vector<uint8_t>& SoftwareRenderer::render(const PerFrameUniforms& frame, const std::vector<Light>& lights, uint32_t width, uint32_t height, const SoftwareRenderOptions& options)
+{
+	auto frameStart = std::chrono::high_resolution_clock::now();
+
+	if (width != this->width || height != this->height) {
+		this->width = width;
+		this->height = height;
+		tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+		tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+
+		size_t pixels = static_cast<size_t>(width) * height;
+		depth.resize(pixels);
+		coverage.resize(pixels);
+		gPosition.resize(pixels);
+		gNormal.resize(pixels);
+		gAlbedo.resize(pixels);
+		gSpecular.resize(pixels);
+		image.resize(pixels * 4);
+		tileBins.resize(static_cast<size_t>(tilesX) * tilesY);
+	}
+
+	for (auto& local : threadStats) {
+		local = {};
+	}
+
+	// Transform, clip and bin, one job per instance.
+	auto start = std::chrono::high_resolution_clock::now();
+
+	std::vector<uint32_t> sceneOrder;
+	if (!options.instanceOrder) {
+		for (uint32_t i = 0; i < scene.instances.size(); i++) {
+			sceneOrder.push_back(i);
+		}
+	}
+	const std::vector<uint32_t>& order = options.instanceOrder ? *options.instanceOrder : sceneOrder;
+
+	for (auto& bins : instanceBins) {
+		bins.clear();
+	}
+
+	jobs.parallelFor(static_cast<uint32_t>(order.size()), [&](uint32_t i, uint32_t thread) {
+		uint32_t instance = order[i];
+		setupInstance(instance, thread, frame, !options.instanceVisibility || (*options.instanceVisibility)[instance]);
+	});
+
+	for (auto& bin : tileBins) {
+		bin.clear();
+	}
+
+	for (uint32_t instance : order) {
+		for (auto& entry : instanceBins[instance]) {
+			// instanceBins stores the tile in the instance field until it's merged here.
+			tileBins[entry.instance].push_back({ instance, entry.triangle });
+		}
+	}
+
+	stats = {};
+	stats.setupMs = elapsedMs(start);
+
+	// G-buffer fill
+	start = std::chrono::high_resolution_clock::now();
+
+	uint32_t numTiles = tilesX * tilesY;
+	jobs.parallelFor(numTiles, [&](uint32_t tile, uint32_t thread) {
+		rasterizeTile(tile, thread, options.depthPrepass);
+	});
+
+	stats.geometryMs = elapsedMs(start);
+
+	// Light accumulation
+	start = std::chrono::high_resolution_clock::now();
+
+	jobs.parallelFor(numTiles, [&](uint32_t tile, uint32_t thread) {
+		lightTile(tile, thread, frame, lights, options);
+	});
+
+	stats.lightingMs = elapsedMs(start);
+
+	for (auto& local : threadStats) {
+		stats.trianglesSubmitted += local.trianglesSubmitted;
+		stats.trianglesBinned += local.trianglesBinned;
+		stats.tileReferences += local.tileReferences;
+		stats.fragmentsShaded += local.fragmentsShaded;
+		stats.fragmentsDiscarded += local.fragmentsDiscarded;
+		stats.depthFragments += local.depthFragments;
+		stats.pixelsLit += local.pixelsLit;
+		stats.lightEvaluations += local.lightEvaluations;
+	}
+
+	stats.totalMs = elapsedMs(frameStart);
+
+	return image;
+}
+
+void SoftwareRenderer::setupInstance(uint32_t instanceIndex, uint32_t threadIndex, const PerFrameUniforms& frame, bool visible)
+{
+	const MeshInstance& instance = scene.instances[instanceIndex];
+	const MeshData& mesh = scene.meshes[instance.mesh];
+	auto& clip = clipScratch[threadIndex];
+	auto& local = threadStats[threadIndex];
+
+	instanceTriangles[instanceIndex].clear();
+	instanceBins[instanceIndex].clear();
+
+	if (!visible)
+		return;
+
+	// Vertices are in the mesh's own space, the attributes are interpolated in world space like the GPU's.
+	auto world = getInstanceWorld(scene.graph, instance);
+	auto worldViewProj = XMMatrixMultiply(world, frame.viewProj);
+
+	clip.resize(mesh.vertices.size());
+	for (size_t i = 0; i < mesh.vertices.size(); i++) {
+		auto position = XMVectorSetW(XMLoadFloat3(&mesh.vertices[i].position), 1.0f);
+		XMStoreFloat4(&clip[i], XMVector4Transform(position, worldViewProj));
+	}
+
+	auto outcode = [](const XMFLOAT4& c) {
+		uint32_t code = 0;
+		if (c.x < -c.w) code |= 1;
+		if (c.x > c.w) code |= 2;
+		if (c.y < -c.w) code |= 4;
+		if (c.y > c.w) code |= 8;
+		if (c.z < 0.0f) code |= 16;
+		return code;
+	};
+
+	auto makeVertex = [&](uint32_t index) {
+		const Vertex& local = mesh.vertices[index];
+
+		Vertex v = local;
+		XMStoreFloat3(&v.position, XMVector3TransformCoord(XMLoadFloat3(&local.position), world));
+		XMStoreFloat3(&v.normal, XMVector3TransformNormal(XMLoadFloat3(&local.normal), world));
+		XMStoreFloat3(&v.tangent, XMVector3TransformNormal(XMLoadFloat3(&local.tangent), world));
+		XMStoreFloat3(&v.bitangent, XMVector3TransformNormal(XMLoadFloat3(&local.bitangent), world));
+
+		ClipVertex out;
+		out.clip = clip[index];
+		float* a = out.attributes;
+		a[ATTR_POSITION + 0] = v.position.x; a[ATTR_POSITION + 1] = v.position.y; a[ATTR_POSITION + 2] = v.position.z;
+		a[ATTR_NORMAL + 0] = v.normal.x; a[ATTR_NORMAL + 1] = v.normal.y; a[ATTR_NORMAL + 2] = v.normal.z;
+		a[ATTR_TANGENT + 0] = v.tangent.x; a[ATTR_TANGENT + 1] = v.tangent.y; a[ATTR_TANGENT + 2] = v.tangent.z;
+		a[ATTR_BITANGENT + 0] = v.bitangent.x; a[ATTR_BITANGENT + 1] = v.bitangent.y; a[ATTR_BITANGENT + 2] = v.bitangent.z;
+		a[ATTR_TEXCOORD + 0] = v.texcoord.x; a[ATTR_TEXCOORD + 1] = v.texcoord.y;
+		a[ATTR_OCCLUSION] = v.occlusion;
+		return out;
+	};
+
+	auto lerpVertex = [](const ClipVertex& a, const ClipVertex& b, float t) {
+		ClipVertex out;
+		out.clip.x = a.clip.x + (b.clip.x - a.clip.x) * t;
+		out.clip.y = a.clip.y + (b.clip.y - a.clip.y) * t;
+		out.clip.z = a.clip.z + (b.clip.z - a.clip.z) * t;
+		out.clip.w = a.clip.w + (b.clip.w - a.clip.w) * t;
+		for (size_t i = 0; i < ATTR_COUNT; i++) {
+			out.attributes[i] = a.attributes[i] + (b.attributes[i] - a.attributes[i]) * t;
+		}
+		return out;
+	};
+
+	size_t numTriangles = mesh.indices.size() / 3;
+	local.trianglesSubmitted += numTriangles;
+
+	for (size_t t = 0; t < numTriangles; t++) {
+		uint32_t i0 = mesh.indices[t * 3 + 0];
+		uint32_t i1 = mesh.indices[t * 3 + 1];
+		uint32_t i2 = mesh.indices[t * 3 + 2];
+
+		uint32_t c0 = outcode(clip[i0]);
+		uint32_t c1 = outcode(clip[i1]);
+		uint32_t c2 = outcode(clip[i2]);
+
+		if (c0 & c1 & c2)
+			continue;
+
+		ClipVertex v0 = makeVertex(i0);
+		ClipVertex v1 = makeVertex(i1);
+		ClipVertex v2 = makeVertex(i2);
+
+		if (((c0 | c1 | c2) & 16) == 0) {
+			emitTriangle(instanceIndex, v0, v1, v2);
+			continue;
+		}
+
+		// Clip against the near plane (z >= 0), giving at most a quad.
+		ClipVertex in[3] = { v0, v1, v2 };
+		ClipVertex out[4];
+		size_t numOut = 0;
+
+		for (size_t i = 0; i < 3; i++) {
+			const ClipVertex& a = in[i];
+			const ClipVertex& b = in[(i + 1) % 3];
+			bool aInside = a.clip.z >= 0.0f;
+			bool bInside = b.clip.z >= 0.0f;
+
+			if (aInside)
+				out[numOut++] = a;
+
+			if (aInside != bInside)
+				out[numOut++] = lerpVertex(a, b, a.clip.z / (a.clip.z - b.clip.z));
+		}
+
+		for (size_t i = 2; i < numOut; i++) {
+			emitTriangle(instanceIndex, out[0], out[i - 1], out[i]);
+		}
+	}
+
+	local.trianglesBinned += instanceTriangles[instanceIndex].size();
+	local.tileReferences += instanceBins[instanceIndex].size();
+}
+
+void SoftwareRenderer::emitTriangle(uint32_t instanceIndex, const ClipVertex& v0, const ClipVertex& v1, const ClipVertex& v2)
+{
+	const ClipVertex* v[3] = { &v0, &v1, &v2 };
+
+	RasterTriangle tri;
+	float x[3], y[3];
+
+	for (size_t i = 0; i < 3; i++) {
+		float invW = 1.0f / v[i]->clip.w;
+		x[i] = (v[i]->clip.x * invW * 0.5f + 0.5f) * width;
+		y[i] = (0.5f - v[i]->clip.y * invW * 0.5f) * height;
+		tri.z[i] = v[i]->clip.z * invW;
+		tri.invW[i] = invW;
+	}
+
+	// Clockwise is front facing with y down, matching FrontCounterClockwise = false and CULL_BACK.
+	float area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+	if (!(area > 0.0f))
+		return;
+
+	float minX = std::min({ x[0], x[1], x[2] });
+	float maxX = std::max({ x[0], x[1], x[2] });
+	float minY = std::min({ y[0], y[1], y[2] });
+	float maxY = std::max({ y[0], y[1], y[2] });
+
+	tri.minX = std::max(0, static_cast<int>(std::floor(minX)));
+	tri.maxX = std::min(static_cast<int>(width) - 1, static_cast<int>(std::ceil(maxX)));
+	tri.minY = std::max(0, static_cast<int>(std::floor(minY)));
+	tri.maxY = std::min(static_cast<int>(height) - 1, static_cast<int>(std::ceil(maxY)));
+
+	if (tri.minX > tri.maxX || tri.minY > tri.maxY)
+		return;
+
+	tri.topLeftMask = 0;
+	for (size_t i = 0; i < 3; i++) {
+		// Edge i runs between the two vertices that aren't i.
+		size_t a = (i + 1) % 3;
+		size_t b = (i + 2) % 3;
+		float dx = x[b] - x[a];
+		float dy = y[b] - y[a];
+
+		tri.edgeA[i] = -dy;
+		tri.edgeB[i] = dx;
+		tri.edgeC[i] = dy * x[a] - dx * y[a];
+
+		if ((dy == 0.0f && dx > 0.0f) || dy < 0.0f)
+			tri.topLeftMask |= 1u << i;
+	}
+
+	tri.invArea = 1.0f / area;
+	tri.materialId = scene.meshes[scene.instances[instanceIndex].mesh].materialId;
+
+	for (size_t i = 0; i < 3; i++) {
+		std::copy(v[i]->attributes, v[i]->attributes + ATTR_COUNT, tri.attributes[i]);
+	}
+
+	uint32_t triangleIndex = static_cast<uint32_t>(instanceTriangles[instanceIndex].size());
+	instanceTriangles[instanceIndex].push_back(tri);
+
+	uint32_t tileMinX = tri.minX / TILE_SIZE;
+	uint32_t tileMaxX = tri.maxX / TILE_SIZE;
+	uint32_t tileMinY = tri.minY / TILE_SIZE;
+	uint32_t tileMaxY = tri.maxY / TILE_SIZE;
+
+	for (uint32_t ty = tileMinY; ty <= tileMaxY; ty++) {
+		for (uint32_t tx = tileMinX; tx <= tileMaxX; tx++) {
+			instanceBins[instanceIndex].push_back({ ty * tilesX + tx, triangleIndex });
+		}
+	}
+}
+
+void SoftwareRenderer::rasterizeTile(uint32_t tileIndex, uint32_t threadIndex, bool depthPrepass)
+{
+	int tileX0 = static_cast<int>((tileIndex % tilesX) * TILE_SIZE);
+	int tileY0 = static_cast<int>((tileIndex / tilesX) * TILE_SIZE);
+	int tileX1 = std::min(tileX0 + static_cast<int>(TILE_SIZE), static_cast<int>(width)) - 1;
+	int tileY1 = std::min(tileY0 + static_cast<int>(TILE_SIZE), static_cast<int>(height)) - 1;
+
+	for (int y = tileY0; y <= tileY1; y++) {
+		size_t row = static_cast<size_t>(y) * width;
+		std::fill(depth.begin() + row + tileX0, depth.begin() + row + tileX1 + 1, 1.0f);
+		std::fill(coverage.begin() + row + tileX0, coverage.begin() + row + tileX1 + 1, 0);
+	}
+
+	if (depthPrepass) {
+		rasterizeTriangles(tileIndex, threadIndex, RASTER_DEPTH);
+		rasterizeTriangles(tileIndex, threadIndex, RASTER_EQUAL);
+	}
+	else {
+		rasterizeTriangles(tileIndex, threadIndex, RASTER_LESS);
+	}
+}
+
+void SoftwareRenderer::rasterizeTriangles(uint32_t tileIndex, uint32_t threadIndex, RasterPass pass)
+{
+	auto& local = threadStats[threadIndex];
+
+	int tileX0 = static_cast<int>((tileIndex % tilesX) * TILE_SIZE);
+	int tileY0 = static_cast<int>((tileIndex / tilesX) * TILE_SIZE);
+	int tileX1 = std::min(tileX0 + static_cast<int>(TILE_SIZE), static_cast<int>(width)) - 1;
+	int tileY1 = std::min(tileY0 + static_cast<int>(TILE_SIZE), static_cast<int>(height)) - 1;
+
+	// Pixels are walked as 2x2 quads so texture lod can come from lane differences like on the GPU.
+	const __m128 laneX = _mm_setr_ps(0.5f, 1.5f, 0.5f, 1.5f);
+	const __m128 laneY = _mm_setr_ps(0.5f, 0.5f, 1.5f, 1.5f);
+	const __m128 zero = _mm_setzero_ps();
+
+	for (const TileEntry& entry : tileBins[tileIndex]) {
+		const RasterTriangle& tri = instanceTriangles[entry.instance][entry.triangle];
+
+		int minX = std::max(tri.minX, tileX0) & ~1;
+		int maxX = std::min(tri.maxX, tileX1);
+		int minY = std::max(tri.minY, tileY0) & ~1;
+		int maxY = std::min(tri.maxY, tileY1);
+
+		__m128 edgeA[3], edgeB[3], edgeC[3];
+		for (size_t i = 0; i < 3; i++) {
+			edgeA[i] = _mm_set1_ps(tri.edgeA[i]);
+			edgeB[i] = _mm_set1_ps(tri.edgeB[i]);
+			edgeC[i] = _mm_set1_ps(tri.edgeC[i]);
+		}
+
+		const __m128 invArea = _mm_set1_ps(tri.invArea);
+
+		for (int qy = minY; qy <= maxY; qy += 2) {
+			__m128 py = _mm_add_ps(_mm_set1_ps(static_cast<float>(qy)), laneY);
+
+			int rowMask = (qy + 1 <= tileY1) ? 0xf : 0x3;
+
+			for (int qx = minX; qx <= maxX; qx += 2) {
+				__m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(qx)), laneX);
+
+				__m128 e[3];
+				__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+				for (size_t i = 0; i < 3; i++) {
+					e[i] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(edgeA[i], px), _mm_mul_ps(edgeB[i], py)), edgeC[i]);
+					__m128 test = (tri.topLeftMask & (1u << i)) ? _mm_cmpge_ps(e[i], zero) : _mm_cmpgt_ps(e[i], zero);
+					inside = _mm_and_ps(inside, test);
+				}
+
+				int colMask = (qx + 1 <= tileX1) ? 0xf : 0x5;
+				int mask = _mm_movemask_ps(inside) & rowMask & colMask;
+				if (!mask)
+					continue;
+
+				// Screen space barycentrics, depth is affine in screen space.
+				__m128 l0 = _mm_mul_ps(e[0], invArea);
+				__m128 l1 = _mm_mul_ps(e[1], invArea);
+				__m128 l2 = _mm_mul_ps(e[2], invArea);
+
+				__m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(l0, _mm_set1_ps(tri.z[0])), _mm_mul_ps(l1, _mm_set1_ps(tri.z[1]))), _mm_mul_ps(l2, _mm_set1_ps(tri.z[2])));
+				z = _mm_min_ps(_mm_max_ps(z, zero), _mm_set1_ps(1.0f));
+
+				alignas(16) float laneZ[4];
+				_mm_store_ps(laneZ, z);
+
+				uint32_t pixels[4];
+				int depthMask = 0;
+				for (int lane = 0; lane < 4; lane++) {
+					if (!(mask & (1 << lane)))
+						continue;
+
+					pixels[lane] = static_cast<uint32_t>(qy + (lane >> 1)) * width + static_cast<uint32_t>(qx + (lane & 1));
+					bool passed = (pass == RASTER_EQUAL) ? laneZ[lane] == depth[pixels[lane]] : laneZ[lane] < depth[pixels[lane]];
+					if (passed)
+						depthMask |= 1 << lane;
+				}
+
+				if (!depthMask)
+					continue;
+
+				// Perspective correct weights for every lane, helper lanes included.
+				__m128 w0 = _mm_mul_ps(l0, _mm_set1_ps(tri.invW[0]));
+				__m128 w1 = _mm_mul_ps(l1, _mm_set1_ps(tri.invW[1]));
+				__m128 w2 = _mm_mul_ps(l2, _mm_set1_ps(tri.invW[2]));
+				__m128 invSum = _mm_div_ps(_mm_set1_ps(1.0f), _mm_add_ps(_mm_add_ps(w0, w1), w2));
+				w0 = _mm_mul_ps(w0, invSum);
+				w1 = _mm_mul_ps(w1, invSum);
+				w2 = _mm_mul_ps(w2, invSum);
+
+				auto interpolate = [&](size_t attribute) {
+					return _mm_add_ps(_mm_add_ps(
+						_mm_mul_ps(w0, _mm_set1_ps(tri.attributes[0][attribute])),
+						_mm_mul_ps(w1, _mm_set1_ps(tri.attributes[1][attribute]))),
+						_mm_mul_ps(w2, _mm_set1_ps(tri.attributes[2][attribute])));
+				};
+
+				alignas(16) float u[4], v[4];
+				_mm_store_ps(u, interpolate(ATTR_TEXCOORD + 0));
+				_mm_store_ps(v, interpolate(ATTR_TEXCOORD + 1));
+
+				// Coarse derivatives, the same value for the whole quad.
+				float uvDerivatives[4] = { u[1] - u[0], v[1] - v[0], u[2] - u[0], v[2] - v[0] };
+
+				alignas(16) float weights[3][4];
+				_mm_store_ps(weights[0], w0);
+				_mm_store_ps(weights[1], w1);
+				_mm_store_ps(weights[2], w2);
+
+				for (int lane = 0; lane < 4; lane++) {
+					if (!(depthMask & (1 << lane)))
+						continue;
+
+					if (pass == RASTER_DEPTH) {
+						// Opaque materials have nothing to test, same as binding no pixel shader.
+						const MaterialCbuffer& settings = scene.materials[tri.materialId].settings;
+						if (!settings.useAlphaCutoutTexture || fragmentAlpha(tri, u[lane], v[lane], uvDerivatives) >= 0.5f) {
+							depth[pixels[lane]] = laneZ[lane];
+							local.depthFragments++;
+						}
+						continue;
+					}
+
+					float laneWeights[3] = { weights[0][lane], weights[1][lane], weights[2][lane] };
+					if (shadeFragment(tri, laneWeights, uvDerivatives, pixels[lane])) {
+						depth[pixels[lane]] = laneZ[lane];
+						coverage[pixels[lane]] = 1;
+						local.fragmentsShaded++;
+					}
+					else {
+						local.fragmentsDiscarded++;
+					}
+				}
+			}
+		}
+	}
+}
+
+XMVECTOR SoftwareRenderer::sampleTexture(const SoftwareTexture* texture, float u, float v, const float uvDerivatives[4]) const
+{
+	if (!texture)
+		return XMVectorZero();
+
+	float w = static_cast<float>(texture->levels[0].width);
+	float h = static_cast<float>(texture->levels[0].height);
+	float dx = uvDerivatives[0] * uvDerivatives[0] * w * w + uvDerivatives[1] * uvDerivatives[1] * h * h;
+	float dy = uvDerivatives[2] * uvDerivatives[2] * w * w + uvDerivatives[3] * uvDerivatives[3] * h * h;
+	float lod = 0.5f * std::log2(std::max(std::max(dx, dy), 1e-12f));
+
+	return texture->sample(u, v, lod);
+}
+
+float SoftwareRenderer::fragmentAlpha(const RasterTriangle& tri, float u, float v, const float uvDerivatives[4]) const
+{
+	const MaterialCbuffer& settings = scene.materials[tri.materialId].settings;
+	const MaterialTextures& textures = materialTextures[tri.materialId];
+
+	if (settings.useAlphaCutoutTexture)
+		return XMVectorGetX(sampleTexture(textures.alphaCutout, u, v, uvDerivatives));
+
+	if (settings.useDiffuseTexture)
+		return XMVectorGetW(sampleTexture(textures.diffuse, u, v, uvDerivatives));
+
+	return 1.0f;
+}
+
+bool SoftwareRenderer::shadeFragment(const RasterTriangle& tri, const float weights[3], const float uvDerivatives[4], uint32_t pixel)
+{
+	float a[ATTR_COUNT];
+	for (size_t i = 0; i < ATTR_COUNT; i++) {
+		a[i] = weights[0] * tri.attributes[0][i] + weights[1] * tri.attributes[1][i] + weights[2] * tri.attributes[2][i];
+	}
+
+	const MaterialCbuffer& settings = scene.materials[tri.materialId].settings;
+	const MaterialTextures& textures = materialTextures[tri.materialId];
+
+	float u = a[ATTR_TEXCOORD + 0];
+	float v = a[ATTR_TEXCOORD + 1];
+
+	auto sample = [&](const SoftwareTexture* texture) {
+		return sampleTexture(texture, u, v, uvDerivatives);
+	};
+
+	// deferredPixel.hlsl
+	auto T = XMVector3Normalize(XMVectorSet(a[ATTR_TANGENT + 0], a[ATTR_TANGENT + 1], a[ATTR_TANGENT + 2], 0.0f));
+	auto B = XMVector3Normalize(XMVectorSet(a[ATTR_BITANGENT + 0], a[ATTR_BITANGENT + 1], a[ATTR_BITANGENT + 2], 0.0f));
+	auto interpolatedNormal = XMVectorSet(a[ATTR_NORMAL + 0], a[ATTR_NORMAL + 1], a[ATTR_NORMAL + 2], 0.0f);
+	auto N = XMVector3Normalize(interpolatedNormal);
+
+	XMFLOAT4 albedo = { 1.0f, 1.0f, 1.0f, 1.0f };
+	if (settings.useDiffuseTexture)
+		XMStoreFloat4(&albedo, sample(textures.diffuse));
+
+	if (settings.useAlphaCutoutTexture)
+		albedo.w = XMVectorGetX(sample(textures.alphaCutout));
+
+	if (settings.useAlphaCutoutTexture && albedo.w < 0.5f)
+		return false;
+
+	// The alpha test is done with it, deferredPixel.hlsl hands the baked occlusion to the ambient pass in its place.
+	albedo.w = a[ATTR_OCCLUSION];
+
+	XMFLOAT3 normal;
+	if (settings.useNormalTexture) {
+		auto normalT = XMVectorSubtract(XMVectorScale(sample(textures.normal), 2.0f), XMVectorReplicate(1.0f));
+
+		// mul(TBN, normalT) with T, B and N as rows.
+		auto normalW = XMVectorSet(
+			XMVectorGetX(XMVector3Dot(T, normalT)),
+			XMVectorGetX(XMVector3Dot(B, normalT)),
+			XMVectorGetX(XMVector3Dot(N, normalT)),
+			0.0f);
+		XMStoreFloat3(&normal, XMVector3Normalize(normalW));
+		normal.x = -normal.x;
+	}
+	else {
+		XMStoreFloat3(&normal, interpolatedNormal);
+	}
+
+	XMFLOAT4 specular = { 0.005f, 0.005f, 0.005f, 1.0f };
+	if (settings.useSpecularTexture) {
+		XMStoreFloat4(&specular, sample(textures.specular));
+		specular.w = 1.0f;
+	}
+
+	gPosition[pixel] = { a[ATTR_POSITION + 0], a[ATTR_POSITION + 1], a[ATTR_POSITION + 2] };
+	gNormal[pixel] = normal;
+	gAlbedo[pixel] = albedo;
+	gSpecular[pixel] = specular;
+
+	return true;
+}
+
+void SoftwareRenderer::lightTile(uint32_t tileIndex, uint32_t threadIndex, const PerFrameUniforms& frame, const std::vector<Light>& lights, const SoftwareRenderOptions& options)
+{
+	auto& local = threadStats[threadIndex];
+
+	uint32_t tileX0 = (tileIndex % tilesX) * TILE_SIZE;
+	uint32_t tileY0 = (tileIndex / tilesX) * TILE_SIZE;
+	uint32_t tileX1 = std::min(tileX0 + TILE_SIZE, width);
+	uint32_t tileY1 = std::min(tileY0 + TILE_SIZE, height);
+
+	// Light list for this tile, indices into lights.
+	std::vector<uint32_t> tileLights;
+	if (options.culling != LightCullingMode::TreeSampled)
+		tileLights.reserve(lights.size());
+
+	if (options.culling == LightCullingMode::TileSphere) {
+		auto boundsMin = XMVectorReplicate(FLT_MAX);
+		auto boundsMax = XMVectorReplicate(-FLT_MAX);
+		bool any = false;
+
+		for (uint32_t y = tileY0; y < tileY1; y++) {
+			for (uint32_t x = tileX0; x < tileX1; x++) {
+				uint32_t pixel = y * width + x;
+				if (!coverage[pixel])
+					continue;
+
+				auto p = XMLoadFloat3(&gPosition[pixel]);
+				boundsMin = XMVectorMin(boundsMin, p);
+				boundsMax = XMVectorMax(boundsMax, p);
+				any = true;
+			}
+		}
+
+		if (any) {
+			for (uint32_t i = 0; i < lights.size(); i++) {
+				auto center = XMLoadFloat3(&lights[i].position);
+				auto closest = XMVectorMin(XMVectorMax(center, boundsMin), boundsMax);
+				float distSq = XMVectorGetX(XMVector3LengthSq(XMVectorSubtract(center, closest)));
+
+				if (distSq <= lights[i].radius * lights[i].radius)
+					tileLights.push_back(i);
+			}
+		}
+	}
+	else if (options.culling == LightCullingMode::None) {
+		for (uint32_t i = 0; i < lights.size(); i++) {
+			tileLights.push_back(i);
+		}
+	}
+
+	bool sampled = options.culling == LightCullingMode::TreeSampled && options.lightTree && options.lightSamples > 0;
+
+	auto eye = XMLoadFloat3(&frame.eyePos);
+	auto one = XMVectorReplicate(1.0f);
+
+	IrradianceSH irradiance;
+	memcpy(irradiance.coefficients, frame.irradianceSH, sizeof(irradiance.coefficients));
+
+	for (uint32_t y = tileY0; y < tileY1; y++) {
+		for (uint32_t x = tileX0; x < tileX1; x++) {
+			uint32_t pixel = y * width + x;
+			uint8_t* out = &image[static_cast<size_t>(pixel) * 4];
+
+			if (!coverage[pixel]) {
+				out[0] = out[1] = out[2] = 0;
+				out[3] = 255;
+				continue;
+			}
+
+			// lightAccPixel.hlsl, with ONE/ONE blending into a UNORM target.
+			auto positionW = XMLoadFloat3(&gPosition[pixel]);
+			auto normal = XMLoadFloat3(&gNormal[pixel]);
+			auto albedo = XMLoadFloat4(&gAlbedo[pixel]);
+			auto specular = XMLoadFloat4(&gSpecular[pixel]);
+			float specularPower = gSpecular[pixel].w * 100.0f;
+
+			auto toEye = XMVector3Normalize(XMVectorSubtract(eye, positionW));
+
+			// ambientPixel.hlsl, drawn first with the same blending.
+			float occlusion = gAlbedo[pixel].w;
+			auto ambient = XMVectorScale(XMVectorMultiply(albedo, evaluateIrradianceSH(irradiance, normal)), occlusion * frame.environmentParams.y);
+			if (options.environment) {
+				float roughness = std::pow(2.0f / (specularPower + 2.0f), 0.25f);
+				auto reflected = XMVector3Reflect(XMVectorNegate(toEye), normal);
+				auto environment = options.environment->sample(reflected, roughness * frame.environmentParams.x);
+
+				float nDotV = std::min(std::max(XMVectorGetX(XMVector3Dot(normal, toEye)), 0.0f), 1.0f);
+				float specularOcclusion = std::pow(nDotV + occlusion, std::exp2(-16.0f * roughness - 1.0f)) - 1.0f + occlusion;
+				specularOcclusion = std::min(std::max(specularOcclusion, 0.0f), 1.0f);
+				ambient = XMVectorAdd(ambient, XMVectorScale(XMVectorMultiply(specular, environment), specularOcclusion * frame.environmentParams.z));
+			}
+			auto accumulated = XMVectorMin(XMVectorSaturate(ambient), one);
+
+			auto shadeLight = [&](const Light& light) {
+				auto toLight = XMVectorSubtract(XMLoadFloat3(&light.position), positionW);
+				float distSquared = XMVectorGetX(XMVector3LengthSq(toLight));
+
+				toLight = XMVector3Normalize(toLight);
+				auto halfwayDir = XMVector3Normalize(XMVectorAdd(toLight, toEye));
+
+				float spec = std::pow(std::max(XMVectorGetX(XMVector3Dot(normal, halfwayDir)), 0.0f), specularPower) / distSquared;
+				float lambert = std::min(std::max(XMVectorGetX(XMVector3Dot(normal, toLight)), 0.0f), 1.0f) / distSquared;
+
+				auto lightColor = XMVectorScale(XMLoadFloat3(&light.color), light.intensity);
+
+				auto color = XMVectorScale(XMVectorMultiply(albedo, lightColor), lambert);
+				return XMVectorAdd(color, XMVectorScale(XMVectorMultiply(specular, lightColor), spec));
+			};
+
+			for (uint32_t index : tileLights) {
+				accumulated = XMVectorMin(XMVectorAdd(accumulated, XMVectorSaturate(shadeLight(lights[index]))), one);
+			}
+
+			// The estimate of every light's sum is only clamped once, each light's share of it isn't known.
+			if (sampled) {
+				auto estimate = XMVectorZero();
+				float jitter = hashToUnit(pixel * 0x9e3779b9u ^ frame.frameIndex);
+				for (uint32_t i = 0; i < options.lightSamples; i++) {
+					float u = (i + jitter) / options.lightSamples;
+					uint32_t index;
+					float probability;
+					if (!options.lightTree->sample(positionW, normal, std::min(u, 0x1.fffffep-1f), index, probability) || !(probability > 0.0f))
+						continue;
+
+					estimate = XMVectorAdd(estimate, XMVectorScale(shadeLight(lights[index]), 1.0f / probability));
+				}
+				estimate = XMVectorScale(estimate, 1.0f / options.lightSamples);
+				accumulated = XMVectorMin(XMVectorAdd(accumulated, XMVectorSaturate(estimate)), one);
+				local.lightEvaluations += options.lightSamples;
+			}
+
+			XMFLOAT4 result;
+			XMStoreFloat4(&result, accumulated);
+			out[0] = static_cast<uint8_t>(result.x * 255.0f + 0.5f);
+			out[1] = static_cast<uint8_t>(result.y * 255.0f + 0.5f);
+			out[2] = static_cast<uint8_t>(result.z * 255.0f + 0.5f);
+			out[3] = 255;
+
+			local.pixelsLit++;
+			local.lightEvaluations += tileLights.size();
+		}
+	}
+}
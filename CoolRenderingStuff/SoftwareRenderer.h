@@ -0,0 +1,195 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <DirectXMath.h>
+#include "Scene.h"
+#include "Cubemap.h"
+
+class JobSystem;
+class LightTree;
+
+enum class LightCullingMode {
+	// Every light shades every pixel, same as the GPU light accumulation pass.
+	None,
+	// Light spheres are tested against each tile's world space bounds. Not an exact match, the shader ignores radius.
+	TileSphere,
+	// A few lights per pixel picked from SoftwareRenderOptions::lightTree and divided by the probability they were
+	// picked at. Noisy, but averages out to None's lighting before blending clamps each light on its own.
+	TreeSampled,
+};
+
+struct SoftwareRenderStats {
+	double setupMs;
+	double geometryMs;
+	double lightingMs;
+	double totalMs;
+
+	uint64_t trianglesSubmitted;
+	uint64_t trianglesBinned;
+	uint64_t tileReferences;
+	uint64_t fragmentsShaded;
+	uint64_t fragmentsDiscarded;
+	uint64_t depthFragments;
+	// Every covered pixel, so this doubles as the pixel count for overdraw.
+	uint64_t pixelsLit;
+	uint64_t lightEvaluations;
+
+	// G-buffer pixel shader invocations per covered pixel, discarded ones included.
+	double overdraw() const { return pixelsLit ? static_cast<double>(fragmentsShaded + fragmentsDiscarded) / pixelsLit : 0.0; }
+};
+
+struct SoftwareRenderOptions {
+	LightCullingMode culling = LightCullingMode::None;
+	// Instances with a 0 entry are skipped.
+	const std::vector<uint8_t>* instanceVisibility = nullptr;
+	// Submission order, scene order when null. Instances left out aren't drawn.
+	const std::vector<uint32_t>* instanceOrder = nullptr;
+	// Depth only pass first (alpha tested), then shading with an EQUAL test. Same as DepthPrepassMode::Prepass.
+	bool depthPrepass = false;
+	// The prefiltered specular cube the ambient reflects, see EnvironmentLighting. None when null, like a 0 specular scale.
+	const Cubemap* environment = nullptr;
+	// Built over the lights being rendered, required for TreeSampled.
+	const LightTree* lightTree = nullptr;
+	// Per pixel with TreeSampled, stratified and turned by a hash of the pixel and frame index.
+	uint32_t lightSamples = 4;
+};
+
+// RGBA8 mip chain built on the CPU, sampled trilinear with wrap addressing like the material sampler.
+struct SoftwareTexture {
+	struct Level {
+		uint32_t width;
+		uint32_t height;
+		std::vector<uint8_t> pixels;
+	};
+
+	std::vector<Level> levels;
+
+	SoftwareTexture(const TextureData& data);
+
+	DirectX::XMVECTOR sample(float u, float v, float lod) const;
+
+private:
+	DirectX::XMVECTOR sampleLevel(const Level& level, float u, float v) const;
+};
+
+// Tile binned CPU rasterizer implementing deferredPixel.hlsl, ambientPixel.hlsl and lightAccPixel.hlsl.
+// Meant as a golden image reference and for benchmarking light culling, not for interactive use.
+class SoftwareRenderer
+{
+public:
+	static const uint32_t TILE_SIZE = 64;
+
+	SoftwareRenderer(const SceneData& scene, JobSystem& jobs);
+	~SoftwareRenderer();
+
+	// Output is RGBA8, top row first.
+	const std::vector<uint8_t>& render(const PerFrameUniforms& frame, const std::vector<Light>& lights, uint32_t width, uint32_t height, const SoftwareRenderOptions& options = {});
+
+	const std::vector<uint8_t>& getImage() const { return image; }
+	const SoftwareRenderStats& getStats() const { return stats; }
+
+	uint32_t getWidth() const { return width; }
+	uint32_t getHeight() const { return height; }
+
+	// Raw G-buffer, exposed for debugging and for tools that want to reuse the geometry pass.
+	const std::vector<float>& getDepth() const { return depth; }
+	const std::vector<DirectX::XMFLOAT3>& getPositions() const { return gPosition; }
+	const std::vector<DirectX::XMFLOAT3>& getNormals() const { return gNormal; }
+	const std::vector<DirectX::XMFLOAT4>& getAlbedo() const { return gAlbedo; }
+	const std::vector<uint8_t>& getCoverage() const { return coverage; }
+
+private:
+	enum Attribute {
+		ATTR_POSITION = 0,
+		ATTR_NORMAL = 3,
+		ATTR_TANGENT = 6,
+		ATTR_BITANGENT = 9,
+		ATTR_TEXCOORD = 12,
+		ATTR_OCCLUSION = 14,
+		ATTR_COUNT = 15,
+	};
+
+	struct ClipVertex {
+		DirectX::XMFLOAT4 clip;
+		float attributes[ATTR_COUNT];
+	};
+
+	// Screen space triangle ready for rasterization, edge i is opposite vertex i.
+	struct RasterTriangle {
+		float edgeA[3];
+		float edgeB[3];
+		float edgeC[3];
+		uint32_t topLeftMask;
+		float invArea;
+
+		float z[3];
+		float invW[3];
+		int minX, minY, maxX, maxY;
+
+		uint32_t materialId;
+		float attributes[3][ATTR_COUNT];
+	};
+
+	struct TileEntry {
+		uint32_t instance;
+		uint32_t triangle;
+	};
+
+	enum RasterPass {
+		// Single pass, LESS depth test and shade.
+		RASTER_LESS,
+		// Prepass, LESS depth test with only the alpha test run.
+		RASTER_DEPTH,
+		// After the prepass, EQUAL depth test and shade.
+		RASTER_EQUAL,
+	};
+
+	struct MaterialTextures {
+		const SoftwareTexture* diffuse;
+		const SoftwareTexture* normal;
+		const SoftwareTexture* alphaCutout;
+		const SoftwareTexture* specular;
+	};
+
+	void setupInstance(uint32_t instanceIndex, uint32_t threadIndex, const PerFrameUniforms& frame, bool visible);
+	void emitTriangle(uint32_t instanceIndex, const ClipVertex& v0, const ClipVertex& v1, const ClipVertex& v2);
+	void rasterizeTile(uint32_t tileIndex, uint32_t threadIndex, bool depthPrepass);
+	void rasterizeTriangles(uint32_t tileIndex, uint32_t threadIndex, RasterPass pass);
+	DirectX::XMVECTOR sampleTexture(const SoftwareTexture* texture, float u, float v, const float uvDerivatives[4]) const;
+	// Alpha from the diffuse or cutout texture, the same value shadeFragment discards on.
+	float fragmentAlpha(const RasterTriangle& tri, float u, float v, const float uvDerivatives[4]) const;
+	// Returns false when the fragment is discarded by the alpha cutout.
+	bool shadeFragment(const RasterTriangle& tri, const float weights[3], const float uvDerivatives[4], uint32_t pixel);
+	void lightTile(uint32_t tileIndex, uint32_t threadIndex, const PerFrameUniforms& frame, const std::vector<Light>& lights, const SoftwareRenderOptions& options);
+
+	const SceneData& scene;
+	JobSystem& jobs;
+
+	std::vector<SoftwareTexture*> ownedTextures;
+	std::vector<MaterialTextures> materialTextures;
+
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t tilesX = 0;
+	uint32_t tilesY = 0;
+
+	// Per instance so binning stays in submission order regardless of which thread did the work.
+	std::vector<std::vector<RasterTriangle>> instanceTriangles;
+	std::vector<std::vector<TileEntry>> instanceBins;
+	std::vector<std::vector<TileEntry>> tileBins;
+
+	// Per thread scratch and counters.
+	std::vector<std::vector<DirectX::XMFLOAT4>> clipScratch;
+	std::vector<SoftwareRenderStats> threadStats;
+
+	std::vector<float> depth;
+	std::vector<uint8_t> coverage;
+	std::vector<DirectX::XMFLOAT3> gPosition;
+	std::vector<DirectX::XMFLOAT3> gNormal;
+	std::vector<DirectX::XMFLOAT4> gAlbedo;
+	std::vector<DirectX::XMFLOAT4> gSpecular;
+
+	std::vector<uint8_t> image;
+
+	SoftwareRenderStats stats{};
+};
@@ -0,0 +1,225 @@
+#include "StateCache.h"
+#include "GraphicsPipeline.h"
+#include <stdexcept>
+
+bool stateDescEqual(const StateCache::InputLayoutKey& a, const StateCache::InputLayoutKey& b)
+{
+	return a.vertexShaderHash == b.vertexShaderHash && stateDescEqual(a.elements, b.elements);
+}
+
+static bool stateDescEqual(const std::vector<char>& a, const std::vector<char>& b)
+{
+	return a == b;
+}
+
+template <typename Key, typename Object>
+Object* StateCache::Table<Key, Object>::find(uint64_t hash, const Key& key) const
+{
+	auto bucket = buckets.find(hash);
+	if (bucket == buckets.end())
+		return nullptr;
+
+	for (auto& entry : bucket->second) {
+		if (stateDescEqual(entry.key, key))
+			return entry.object;
+	}
+	return nullptr;
+}
+
+template <typename Key, typename Object>
+void StateCache::Table<Key, Object>::insert(uint64_t hash, const Key& key, Object* object)
+{
+	buckets[hash].push_back({ key, object });
+	size++;
+}
+
+StateCache::StateCache(ID3D11Device* device) : device(device)
+{
+}
+
+StateCache::~StateCache()
+{
+	// Pipelines hold shader references, so they go first.
+	for (auto& [hash, entries] : pipelines.buckets) {
+		for (auto& entry : entries) {
+			delete entry.object;
+		}
+	}
+
+	auto release = [](auto& table) {
+		for (auto& [hash, entries] : table.buckets) {
+			for (auto& entry : entries) {
+				entry.object->Release();
+			}
+		}
+	};
+
+	release(rasterizerStates);
+	release(depthStencilStates);
+	release(blendStates);
+	release(samplers);
+	release(inputLayouts);
+	release(vertexShaders);
+	release(pixelShaders);
+}
+
+void StateCache::internSemanticNames(std::vector<D3D11_INPUT_ELEMENT_DESC>& elements)
+{
+	for (auto& element : elements) {
+		element.SemanticName = semanticNames.insert(element.SemanticName).first->c_str();
+	}
+}
+
+ID3D11RasterizerState* StateCache::getRasterizerState(const D3D11_RASTERIZER_DESC& desc)
+{
+	stats.requests++;
+
+	uint64_t hash = hashStateDesc(desc);
+	if (auto found = rasterizerStates.find(hash, desc))
+		return found;
+
+	ID3D11RasterizerState* state;
+	if (FAILED(device->CreateRasterizerState(&desc, &state))) {
+		throw std::runtime_error("Failed to create rasterizer state!");
+	}
+
+	stats.created++;
+	rasterizerStates.insert(hash, desc, state);
+	return state;
+}
+
+ID3D11DepthStencilState* StateCache::getDepthStencilState(const D3D11_DEPTH_STENCIL_DESC& desc)
+{
+	stats.requests++;
+
+	uint64_t hash = hashStateDesc(desc);
+	if (auto found = depthStencilStates.find(hash, desc))
+		return found;
+
+	ID3D11DepthStencilState* state;
+	if (FAILED(device->CreateDepthStencilState(&desc, &state))) {
+		throw std::runtime_error("Failed to create depth stencil state!");
+	}
+
+	stats.created++;
+	depthStencilStates.insert(hash, desc, state);
+	return state;
+}
+
+ID3D11BlendState* StateCache::getBlendState(const D3D11_BLEND_DESC& desc)
+{
+	stats.requests++;
+
+	uint64_t hash = hashStateDesc(desc);
+	if (auto found = blendStates.find(hash, desc))
+		return found;
+
+	ID3D11BlendState* state;
+	if (FAILED(device->CreateBlendState(&desc, &state))) {
+		throw std::runtime_error("Failed to create blend state!");
+	}
+
+	stats.created++;
+	blendStates.insert(hash, desc, state);
+	return state;
+}
+
+ID3D11SamplerState* StateCache::getSamplerState(const D3D11_SAMPLER_DESC& desc)
+{
+	stats.requests++;
+
+	uint64_t hash = hashStateDesc(desc);
+	if (auto found = samplers.find(hash, desc))
+		return found;
+
+	ID3D11SamplerState* state;
+	if (FAILED(device->CreateSamplerState(&desc, &state))) {
+		throw std::runtime_error("Failed to create sampler state!");
+	}
+
+	stats.created++;
+	samplers.insert(hash, desc, state);
+	return state;
+}
+
+ID3D11InputLayout* StateCache::getInputLayout(const std::vector<D3D11_INPUT_ELEMENT_DESC>& elements, const std::vector<char>& vertexShaderCode)
+{
+	stats.requests++;
+
+	InputLayoutKey key = { elements, hashBytecode(vertexShaderCode) };
+	uint64_t hash = hashStateDesc(elements) ^ key.vertexShaderHash;
+	if (auto found = inputLayouts.find(hash, key))
+		return found;
+
+	ID3D11InputLayout* layout;
+	if (FAILED(device->CreateInputLayout(elements.data(), static_cast<UINT>(elements.size()), vertexShaderCode.data(), vertexShaderCode.size(), &layout))) {
+		throw std::runtime_error("Failed to create input layout!");
+	}
+
+	internSemanticNames(key.elements);
+
+	stats.created++;
+	inputLayouts.insert(hash, key, layout);
+	return layout;
+}
+
+ID3D11VertexShader* StateCache::getVertexShader(const std::vector<char>& code)
+{
+	stats.requests++;
+
+	uint64_t hash = hashBytecode(code);
+	auto shader = vertexShaders.find(hash, code);
+
+	if (!shader) {
+		if (FAILED(device->CreateVertexShader(code.data(), code.size(), nullptr, &shader))) {
+			throw std::runtime_error("Failed to create vertex shader!");
+		}
+
+		stats.created++;
+		vertexShaders.insert(hash, code, shader);
+	}
+
+	shader->AddRef();
+	return shader;
+}
+
+ID3D11PixelShader* StateCache::getPixelShader(const std::vector<char>& code)
+{
+	stats.requests++;
+
+	uint64_t hash = hashBytecode(code);
+	auto shader = pixelShaders.find(hash, code);
+
+	if (!shader) {
+		if (FAILED(device->CreatePixelShader(code.data(), code.size(), nullptr, &shader))) {
+			throw std::runtime_error("Failed to create pixel shader!");
+		}
+
+		stats.created++;
+		pixelShaders.insert(hash, code, shader);
+	}
+
+	shader->AddRef();
+	return shader;
+}
+
+GraphicsPipeline* StateCache::getGraphicsPipeline(const GraphicsPipelineDesc& desc)
+{
+	stats.requests++;
+
+	uint64_t hash = hashStateDesc(desc);
+	auto pipeline = pipelines.find(hash, desc);
+
+	if (!pipeline) {
+		pipeline = new GraphicsPipeline(*this, desc);
+
+		GraphicsPipelineDesc key = desc;
+		if (key.inputElementDescs.has_value())
+			internSemanticNames(key.inputElementDescs.value());
+
+		stats.created++;
+		pipelines.insert(hash, key, pipeline);
+	}
+
+	return pipeline;
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <d3d11.h>
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <string>
+#include "StateDesc.h"
+
+struct GraphicsPipeline;
+
+struct StateCacheStats {
+	uint64_t requests;
+	uint64_t created;
+};
+
+// Hands out one D3D object per distinct descriptor. State objects and pipelines belong to the cache, callers never Release them.
+class StateCache
+{
+public:
+	StateCache(ID3D11Device* device);
+	~StateCache();
+
+	StateCache(const StateCache&) = delete;
+	StateCache& operator=(const StateCache&) = delete;
+
+	ID3D11RasterizerState* getRasterizerState(const D3D11_RASTERIZER_DESC& desc);
+	ID3D11DepthStencilState* getDepthStencilState(const D3D11_DEPTH_STENCIL_DESC& desc);
+	ID3D11BlendState* getBlendState(const D3D11_BLEND_DESC& desc);
+	ID3D11SamplerState* getSamplerState(const D3D11_SAMPLER_DESC& desc);
+	// Keyed on the vertex shader too, its input signature is what the layout gets validated against.
+	ID3D11InputLayout* getInputLayout(const std::vector<D3D11_INPUT_ELEMENT_DESC>& elements, const std::vector<char>& vertexShaderCode);
+
+	// Shaders come back with a reference for the caller.
+	ID3D11VertexShader* getVertexShader(const std::vector<char>& code);
+	ID3D11PixelShader* getPixelShader(const std::vector<char>& code);
+
+	// Shared between callers with the same desc, the viewport and scissor get passed to bind.
+	GraphicsPipeline* getGraphicsPipeline(const GraphicsPipelineDesc& desc);
+
+	const StateCacheStats& getStats() const { return stats; }
+	size_t getNumSamplers() const { return samplers.size; }
+	size_t getNumPipelines() const { return pipelines.size; }
+
+private:
+	template <typename Key, typename Object>
+	struct Table {
+		struct Entry {
+			Key key;
+			Object* object;
+		};
+
+		std::unordered_map<uint64_t, std::vector<Entry>> buckets;
+		size_t size = 0;
+
+		Object* find(uint64_t hash, const Key& key) const;
+		void insert(uint64_t hash, const Key& key, Object* object);
+	};
+
+	struct InputLayoutKey {
+		std::vector<D3D11_INPUT_ELEMENT_DESC> elements;
+		uint64_t vertexShaderHash;
+	};
+
+	friend bool stateDescEqual(const InputLayoutKey& a, const InputLayoutKey& b);
+
+	// Stored keys point their SemanticName in here so they outlive whatever the caller passed in.
+	void internSemanticNames(std::vector<D3D11_INPUT_ELEMENT_DESC>& elements);
+
+	ID3D11Device* device;
+	std::unordered_set<std::string> semanticNames;
+
+	Table<D3D11_RASTERIZER_DESC, ID3D11RasterizerState> rasterizerStates;
+	Table<D3D11_DEPTH_STENCIL_DESC, ID3D11DepthStencilState> depthStencilStates;
+	Table<D3D11_BLEND_DESC, ID3D11BlendState> blendStates;
+	Table<D3D11_SAMPLER_DESC, ID3D11SamplerState> samplers;
+	Table<InputLayoutKey, ID3D11InputLayout> inputLayouts;
+	Table<std::vector<char>, ID3D11VertexShader> vertexShaders;
+	Table<std::vector<char>, ID3D11PixelShader> pixelShaders;
+	Table<GraphicsPipelineDesc, GraphicsPipeline> pipelines;
+
+	StateCacheStats stats{};
+};
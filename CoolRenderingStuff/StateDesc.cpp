@@ -0,0 +1,262 @@
+#include "StateDesc.h"
+#include <cstring>
+
+static const uint64_t FNV_OFFSET = 14695981039346656037ull;
+static const uint64_t FNV_PRIME = 1099511628211ull;
+
+template <typename T>
+static void hashValue(uint64_t& hash, const T& value)
+{
+	auto bytes = reinterpret_cast<const uint8_t*>(&value);
+	for (size_t i = 0; i < sizeof(T); i++) {
+		hash ^= bytes[i];
+		hash *= FNV_PRIME;
+	}
+}
+
+static void hashString(uint64_t& hash, const char* value)
+{
+	for (; value && *value; value++) {
+		hash ^= static_cast<uint8_t>(*value);
+		hash *= FNV_PRIME;
+	}
+	hashValue(hash, uint8_t(0));
+}
+
+static void hashStencilOp(uint64_t& hash, const D3D11_DEPTH_STENCILOP_DESC& desc)
+{
+	hashValue(hash, desc.StencilFailOp);
+	hashValue(hash, desc.StencilDepthFailOp);
+	hashValue(hash, desc.StencilPassOp);
+	hashValue(hash, desc.StencilFunc);
+}
+
+static bool stencilOpEqual(const D3D11_DEPTH_STENCILOP_DESC& a, const D3D11_DEPTH_STENCILOP_DESC& b)
+{
+	return a.StencilFailOp == b.StencilFailOp
+		&& a.StencilDepthFailOp == b.StencilDepthFailOp
+		&& a.StencilPassOp == b.StencilPassOp
+		&& a.StencilFunc == b.StencilFunc;
+}
+
+static bool renderTargetBlendEqual(const D3D11_RENDER_TARGET_BLEND_DESC& a, const D3D11_RENDER_TARGET_BLEND_DESC& b)
+{
+	return a.BlendEnable == b.BlendEnable
+		&& a.SrcBlend == b.SrcBlend
+		&& a.DestBlend == b.DestBlend
+		&& a.BlendOp == b.BlendOp
+		&& a.SrcBlendAlpha == b.SrcBlendAlpha
+		&& a.DestBlendAlpha == b.DestBlendAlpha
+		&& a.BlendOpAlpha == b.BlendOpAlpha
+		&& a.RenderTargetWriteMask == b.RenderTargetWriteMask;
+}
+
+static bool semanticEqual(const char* a, const char* b)
+{
+	if (!a || !b)
+		return a == b;
+	return strcmp(a, b) == 0;
+}
+
+// Without independent blend only the first target counts, whatever is in the rest is ignored by D3D too.
+static uint32_t countBlendTargets(const D3D11_BLEND_DESC& desc)
+{
+	return desc.IndependentBlendEnable ? 8 : 1;
+}
+
+uint64_t hashStateDesc(const D3D11_RASTERIZER_DESC& desc)
+{
+	uint64_t hash = FNV_OFFSET;
+	hashValue(hash, desc.FillMode);
+	hashValue(hash, desc.CullMode);
+	hashValue(hash, desc.FrontCounterClockwise);
+	hashValue(hash, desc.DepthBias);
+	hashValue(hash, desc.DepthBiasClamp);
+	hashValue(hash, desc.SlopeScaledDepthBias);
+	hashValue(hash, desc.DepthClipEnable);
+	hashValue(hash, desc.ScissorEnable);
+	hashValue(hash, desc.MultisampleEnable);
+	hashValue(hash, desc.AntialiasedLineEnable);
+	return hash;
+}
+
+uint64_t hashStateDesc(const D3D11_DEPTH_STENCIL_DESC& desc)
+{
+	uint64_t hash = FNV_OFFSET;
+	hashValue(hash, desc.DepthEnable);
+	hashValue(hash, desc.DepthWriteMask);
+	hashValue(hash, desc.DepthFunc);
+	hashValue(hash, desc.StencilEnable);
+	hashValue(hash, desc.StencilReadMask);
+	hashValue(hash, desc.StencilWriteMask);
+	hashStencilOp(hash, desc.FrontFace);
+	hashStencilOp(hash, desc.BackFace);
+	return hash;
+}
+
+uint64_t hashStateDesc(const D3D11_BLEND_DESC& desc)
+{
+	uint64_t hash = FNV_OFFSET;
+	hashValue(hash, desc.AlphaToCoverageEnable);
+	hashValue(hash, desc.IndependentBlendEnable);
+
+	for (uint32_t i = 0; i < countBlendTargets(desc); i++) {
+		auto& target = desc.RenderTarget[i];
+		hashValue(hash, target.BlendEnable);
+		hashValue(hash, target.SrcBlend);
+		hashValue(hash, target.DestBlend);
+		hashValue(hash, target.BlendOp);
+		hashValue(hash, target.SrcBlendAlpha);
+		hashValue(hash, target.DestBlendAlpha);
+		hashValue(hash, target.BlendOpAlpha);
+		hashValue(hash, target.RenderTargetWriteMask);
+	}
+	return hash;
+}
+
+uint64_t hashStateDesc(const D3D11_SAMPLER_DESC& desc)
+{
+	uint64_t hash = FNV_OFFSET;
+	hashValue(hash, desc.Filter);
+	hashValue(hash, desc.AddressU);
+	hashValue(hash, desc.AddressV);
+	hashValue(hash, desc.AddressW);
+	hashValue(hash, desc.MipLODBias);
+	hashValue(hash, desc.MaxAnisotropy);
+	hashValue(hash, desc.ComparisonFunc);
+	for (float value : desc.BorderColor) {
+		hashValue(hash, value);
+	}
+	hashValue(hash, desc.MinLOD);
+	hashValue(hash, desc.MaxLOD);
+	return hash;
+}
+
+uint64_t hashStateDesc(const std::vector<D3D11_INPUT_ELEMENT_DESC>& elements)
+{
+	uint64_t hash = FNV_OFFSET;
+	for (auto& element : elements) {
+		hashString(hash, element.SemanticName);
+		hashValue(hash, element.SemanticIndex);
+		hashValue(hash, element.Format);
+		hashValue(hash, element.InputSlot);
+		hashValue(hash, element.AlignedByteOffset);
+		hashValue(hash, element.InputSlotClass);
+		hashValue(hash, element.InstanceDataStepRate);
+	}
+	return hash;
+}
+
+uint64_t hashBytecode(const std::vector<char>& code)
+{
+	uint64_t hash = FNV_OFFSET;
+	for (char c : code) {
+		hash ^= static_cast<uint8_t>(c);
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+uint64_t hashStateDesc(const GraphicsPipelineDesc& desc)
+{
+	uint64_t hash = FNV_OFFSET;
+	hashValue(hash, hashBytecode(desc.vertexShaderCode));
+	hashValue(hash, hashBytecode(desc.pixelShaderCode));
+	hashValue(hash, desc.inputElementDescs.has_value());
+	if (desc.inputElementDescs.has_value())
+		hashValue(hash, hashStateDesc(desc.inputElementDescs.value()));
+	hashValue(hash, hashStateDesc(desc.rasterizer));
+	hashValue(hash, hashStateDesc(desc.depthStencil));
+	hashValue(hash, hashStateDesc(desc.blend));
+	hashValue(hash, desc.primitiveTopology);
+	return hash;
+}
+
+bool stateDescEqual(const D3D11_RASTERIZER_DESC& a, const D3D11_RASTERIZER_DESC& b)
+{
+	return a.FillMode == b.FillMode
+		&& a.CullMode == b.CullMode
+		&& a.FrontCounterClockwise == b.FrontCounterClockwise
+		&& a.DepthBias == b.DepthBias
+		&& a.DepthBiasClamp == b.DepthBiasClamp
+		&& a.SlopeScaledDepthBias == b.SlopeScaledDepthBias
+		&& a.DepthClipEnable == b.DepthClipEnable
+		&& a.ScissorEnable == b.ScissorEnable
+		&& a.MultisampleEnable == b.MultisampleEnable
+		&& a.AntialiasedLineEnable == b.AntialiasedLineEnable;
+}
+
+bool stateDescEqual(const D3D11_DEPTH_STENCIL_DESC& a, const D3D11_DEPTH_STENCIL_DESC& b)
+{
+	return a.DepthEnable == b.DepthEnable
+		&& a.DepthWriteMask == b.DepthWriteMask
+		&& a.DepthFunc == b.DepthFunc
+		&& a.StencilEnable == b.StencilEnable
+		&& a.StencilReadMask == b.StencilReadMask
+		&& a.StencilWriteMask == b.StencilWriteMask
+		&& stencilOpEqual(a.FrontFace, b.FrontFace)
+		&& stencilOpEqual(a.BackFace, b.BackFace);
+}
+
+bool stateDescEqual(const D3D11_BLEND_DESC& a, const D3D11_BLEND_DESC& b)
+{
+	if (a.AlphaToCoverageEnable != b.AlphaToCoverageEnable || a.IndependentBlendEnable != b.IndependentBlendEnable)
+		return false;
+
+	for (uint32_t i = 0; i < countBlendTargets(a); i++) {
+		if (!renderTargetBlendEqual(a.RenderTarget[i], b.RenderTarget[i]))
+			return false;
+	}
+	return true;
+}
+
+bool stateDescEqual(const D3D11_SAMPLER_DESC& a, const D3D11_SAMPLER_DESC& b)
+{
+	return a.Filter == b.Filter
+		&& a.AddressU == b.AddressU
+		&& a.AddressV == b.AddressV
+		&& a.AddressW == b.AddressW
+		&& a.MipLODBias == b.MipLODBias
+		&& a.MaxAnisotropy == b.MaxAnisotropy
+		&& a.ComparisonFunc == b.ComparisonFunc
+		&& a.BorderColor[0] == b.BorderColor[0]
+		&& a.BorderColor[1] == b.BorderColor[1]
+		&& a.BorderColor[2] == b.BorderColor[2]
+		&& a.BorderColor[3] == b.BorderColor[3]
+		&& a.MinLOD == b.MinLOD
+		&& a.MaxLOD == b.MaxLOD;
+}
+
+bool stateDescEqual(const std::vector<D3D11_INPUT_ELEMENT_DESC>& a, const std::vector<D3D11_INPUT_ELEMENT_DESC>& b)
+{
+	if (a.size() != b.size())
+		return false;
+
+	for (size_t i = 0; i < a.size(); i++) {
+		if (!semanticEqual(a[i].SemanticName, b[i].SemanticName)
+			|| a[i].SemanticIndex != b[i].SemanticIndex
+			|| a[i].Format != b[i].Format
+			|| a[i].InputSlot != b[i].InputSlot
+			|| a[i].AlignedByteOffset != b[i].AlignedByteOffset
+			|| a[i].InputSlotClass != b[i].InputSlotClass
+			|| a[i].InstanceDataStepRate != b[i].InstanceDataStepRate)
+			return false;
+	}
+	return true;
+}
+
+bool stateDescEqual(const GraphicsPipelineDesc& a, const GraphicsPipelineDesc& b)
+{
+	if (a.inputElementDescs.has_value() != b.inputElementDescs.has_value())
+		return false;
+
+	if (a.inputElementDescs.has_value() && !stateDescEqual(a.inputElementDescs.value(), b.inputElementDescs.value()))
+		return false;
+
+	return a.vertexShaderCode == b.vertexShaderCode
+		&& a.pixelShaderCode == b.pixelShaderCode
+		&& stateDescEqual(a.rasterizer, b.rasterizer)
+		&& stateDescEqual(a.depthStencil, b.depthStencil)
+		&& stateDescEqual(a.blend, b.blend)
+		&& a.primitiveTopology == b.primitiveTopology;
+}
@@ -0,0 +1,158 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <optional>
+
+#ifdef _WIN32
+#include <d3d11.h>
+#else
+#include <dxgiformat.h>
+
+// The state descs out of d3d11.h with the same names, values and layouts, so the hashing below builds and gets
+// checked without the Windows SDK. Only the enum values something here uses.
+enum D3D11_FILL_MODE { D3D11_FILL_WIREFRAME = 2, D3D11_FILL_SOLID = 3 };
+enum D3D11_CULL_MODE { D3D11_CULL_NONE = 1, D3D11_CULL_FRONT = 2, D3D11_CULL_BACK = 3 };
+enum D3D11_DEPTH_WRITE_MASK { D3D11_DEPTH_WRITE_MASK_ZERO = 0, D3D11_DEPTH_WRITE_MASK_ALL = 1 };
+enum D3D11_COMPARISON_FUNC {
+	D3D11_COMPARISON_NEVER = 1, D3D11_COMPARISON_LESS = 2, D3D11_COMPARISON_EQUAL = 3, D3D11_COMPARISON_LESS_EQUAL = 4,
+	D3D11_COMPARISON_GREATER = 5, D3D11_COMPARISON_NOT_EQUAL = 6, D3D11_COMPARISON_GREATER_EQUAL = 7, D3D11_COMPARISON_ALWAYS = 8,
+};
+enum D3D11_STENCIL_OP {
+	D3D11_STENCIL_OP_KEEP = 1, D3D11_STENCIL_OP_ZERO = 2, D3D11_STENCIL_OP_REPLACE = 3, D3D11_STENCIL_OP_INCR_SAT = 4,
+	D3D11_STENCIL_OP_DECR_SAT = 5, D3D11_STENCIL_OP_INVERT = 6, D3D11_STENCIL_OP_INCR = 7, D3D11_STENCIL_OP_DECR = 8,
+};
+enum D3D11_BLEND {
+	D3D11_BLEND_ZERO = 1, D3D11_BLEND_ONE = 2, D3D11_BLEND_SRC_COLOR = 3, D3D11_BLEND_INV_SRC_COLOR = 4,
+	D3D11_BLEND_SRC_ALPHA = 5, D3D11_BLEND_INV_SRC_ALPHA = 6, D3D11_BLEND_DEST_ALPHA = 7, D3D11_BLEND_INV_DEST_ALPHA = 8,
+	D3D11_BLEND_DEST_COLOR = 9, D3D11_BLEND_INV_DEST_COLOR = 10,
+};
+enum D3D11_BLEND_OP { D3D11_BLEND_OP_ADD = 1, D3D11_BLEND_OP_SUBTRACT = 2, D3D11_BLEND_OP_REV_SUBTRACT = 3, D3D11_BLEND_OP_MIN = 4, D3D11_BLEND_OP_MAX = 5 };
+enum D3D11_COLOR_WRITE_ENABLE {
+	D3D11_COLOR_WRITE_ENABLE_RED = 1, D3D11_COLOR_WRITE_ENABLE_GREEN = 2, D3D11_COLOR_WRITE_ENABLE_BLUE = 4,
+	D3D11_COLOR_WRITE_ENABLE_ALPHA = 8, D3D11_COLOR_WRITE_ENABLE_ALL = 15,
+};
+enum D3D11_FILTER {
+	D3D11_FILTER_MIN_MAG_MIP_POINT = 0, D3D11_FILTER_MIN_MAG_MIP_LINEAR = 0x15, D3D11_FILTER_ANISOTROPIC = 0x55,
+	D3D11_FILTER_COMPARISON_MIN_MAG_LINEAR_MIP_POINT = 0x94, D3D11_FILTER_COMPARISON_MIN_MAG_MIP_LINEAR = 0x95,
+};
+enum D3D11_TEXTURE_ADDRESS_MODE {
+	D3D11_TEXTURE_ADDRESS_WRAP = 1, D3D11_TEXTURE_ADDRESS_MIRROR = 2, D3D11_TEXTURE_ADDRESS_CLAMP = 3,
+	D3D11_TEXTURE_ADDRESS_BORDER = 4, D3D11_TEXTURE_ADDRESS_MIRROR_ONCE = 5,
+};
+enum D3D11_INPUT_CLASSIFICATION { D3D11_INPUT_PER_VERTEX_DATA = 0, D3D11_INPUT_PER_INSTANCE_DATA = 1 };
+enum D3D_PRIMITIVE_TOPOLOGY {
+	D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED = 0, D3D11_PRIMITIVE_TOPOLOGY_POINTLIST = 1, D3D11_PRIMITIVE_TOPOLOGY_LINELIST = 2,
+	D3D11_PRIMITIVE_TOPOLOGY_LINESTRIP = 3, D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST = 4, D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP = 5,
+};
+typedef D3D_PRIMITIVE_TOPOLOGY D3D11_PRIMITIVE_TOPOLOGY;
+
+#ifndef TRUE
+#define TRUE 1
+#define FALSE 0
+#endif
+#define D3D11_FLOAT32_MAX (3.402823466e+38f)
+#define D3D11_DEFAULT_STENCIL_READ_MASK (0xff)
+#define D3D11_DEFAULT_STENCIL_WRITE_MASK (0xff)
+#define D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT (8)
+
+struct D3D11_RASTERIZER_DESC {
+	D3D11_FILL_MODE FillMode;
+	D3D11_CULL_MODE CullMode;
+	int32_t FrontCounterClockwise;
+	int32_t DepthBias;
+	float DepthBiasClamp;
+	float SlopeScaledDepthBias;
+	int32_t DepthClipEnable;
+	int32_t ScissorEnable;
+	int32_t MultisampleEnable;
+	int32_t AntialiasedLineEnable;
+};
+
+struct D3D11_DEPTH_STENCILOP_DESC {
+	D3D11_STENCIL_OP StencilFailOp;
+	D3D11_STENCIL_OP StencilDepthFailOp;
+	D3D11_STENCIL_OP StencilPassOp;
+	D3D11_COMPARISON_FUNC StencilFunc;
+};
+
+struct D3D11_DEPTH_STENCIL_DESC {
+	int32_t DepthEnable;
+	D3D11_DEPTH_WRITE_MASK DepthWriteMask;
+	D3D11_COMPARISON_FUNC DepthFunc;
+	int32_t StencilEnable;
+	uint8_t StencilReadMask;
+	uint8_t StencilWriteMask;
+	D3D11_DEPTH_STENCILOP_DESC FrontFace;
+	D3D11_DEPTH_STENCILOP_DESC BackFace;
+};
+
+struct D3D11_RENDER_TARGET_BLEND_DESC {
+	int32_t BlendEnable;
+	D3D11_BLEND SrcBlend;
+	D3D11_BLEND DestBlend;
+	D3D11_BLEND_OP BlendOp;
+	D3D11_BLEND SrcBlendAlpha;
+	D3D11_BLEND DestBlendAlpha;
+	D3D11_BLEND_OP BlendOpAlpha;
+	uint8_t RenderTargetWriteMask;
+};
+
+struct D3D11_BLEND_DESC {
+	int32_t AlphaToCoverageEnable;
+	int32_t IndependentBlendEnable;
+	D3D11_RENDER_TARGET_BLEND_DESC RenderTarget[D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT];
+};
+
+struct D3D11_SAMPLER_DESC {
+	D3D11_FILTER Filter;
+	D3D11_TEXTURE_ADDRESS_MODE AddressU;
+	D3D11_TEXTURE_ADDRESS_MODE AddressV;
+	D3D11_TEXTURE_ADDRESS_MODE AddressW;
+	float MipLODBias;
+	uint32_t MaxAnisotropy;
+	D3D11_COMPARISON_FUNC ComparisonFunc;
+	float BorderColor[4];
+	float MinLOD;
+	float MaxLOD;
+};
+
+struct D3D11_INPUT_ELEMENT_DESC {
+	const char* SemanticName;
+	uint32_t SemanticIndex;
+	DXGI_FORMAT Format;
+	uint32_t InputSlot;
+	uint32_t AlignedByteOffset;
+	D3D11_INPUT_CLASSIFICATION InputSlotClass;
+	uint32_t InstanceDataStepRate;
+};
+#endif
+
+// Field by field rather than raw bytes, the depth stencil and blend descs have padding in them.
+// Only needs the descs, no device, the reference renderer checks these without D3D.
+uint64_t hashStateDesc(const D3D11_RASTERIZER_DESC& desc);
+uint64_t hashStateDesc(const D3D11_DEPTH_STENCIL_DESC& desc);
+uint64_t hashStateDesc(const D3D11_BLEND_DESC& desc);
+uint64_t hashStateDesc(const D3D11_SAMPLER_DESC& desc);
+uint64_t hashStateDesc(const std::vector<D3D11_INPUT_ELEMENT_DESC>& elements);
+uint64_t hashBytecode(const std::vector<char>& code);
+
+bool stateDescEqual(const D3D11_RASTERIZER_DESC& a, const D3D11_RASTERIZER_DESC& b);
+bool stateDescEqual(const D3D11_DEPTH_STENCIL_DESC& a, const D3D11_DEPTH_STENCIL_DESC& b);
+bool stateDescEqual(const D3D11_BLEND_DESC& a, const D3D11_BLEND_DESC& b);
+bool stateDescEqual(const D3D11_SAMPLER_DESC& a, const D3D11_SAMPLER_DESC& b);
+bool stateDescEqual(const std::vector<D3D11_INPUT_ELEMENT_DESC>& a, const std::vector<D3D11_INPUT_ELEMENT_DESC>& b);
+
+// Everything that goes into a pipeline apart from the viewport and scissor, which change on resize.
+struct GraphicsPipelineDesc {
+	std::vector<char> vertexShaderCode;
+	// Empty means a depth only pipeline.
+	std::vector<char> pixelShaderCode;
+	std::optional<std::vector<D3D11_INPUT_ELEMENT_DESC>> inputElementDescs;
+	D3D11_RASTERIZER_DESC rasterizer;
+	D3D11_DEPTH_STENCIL_DESC depthStencil;
+	D3D11_BLEND_DESC blend;
+	D3D11_PRIMITIVE_TOPOLOGY primitiveTopology;
+};
+
+uint64_t hashStateDesc(const GraphicsPipelineDesc& desc);
+bool stateDescEqual(const GraphicsPipelineDesc& a, const GraphicsPipelineDesc& b);
@@ -0,0 +1,144 @@
+#include "TextureCooker.h"
+#include <unordered_set>
+#include <cstdlib>
+
+// Compression and resizing leave a little noise between the channels of a grey map.
+static const int GREY_TOLERANCE = 2;
+
+static uint64_t textureBytes(const TextureData& texture)
+{
+	return static_cast<uint64_t>(texture.width) * texture.height * texture.channels;
+}
+
+static bool isGrey(const TextureData& texture)
+{
+	if (texture.channels != 4)
+		return false;
+
+	for (size_t i = 0; i < texture.pixels.size(); i += 4) {
+		int r = texture.pixels[i];
+		int g = texture.pixels[i + 1];
+		int b = texture.pixels[i + 2];
+		if (std::abs(r - g) > GREY_TOLERANCE || std::abs(g - b) > GREY_TOLERANCE)
+			return false;
+	}
+	return true;
+}
+
+// Red of each source goes into consecutive channels of the result, which is what the shaders read the masks from.
+static TextureData interleaveRed(const std::vector<const TextureData*>& sources)
+{
+	TextureData result;
+	result.width = sources[0]->width;
+	result.height = sources[0]->height;
+	result.channels = static_cast<int>(sources.size());
+
+	size_t texels = static_cast<size_t>(result.width) * result.height;
+	result.pixels.resize(texels * result.channels);
+
+	for (size_t i = 0; i < texels; i++) {
+		for (size_t c = 0; c < sources.size(); c++) {
+			result.pixels[i * result.channels + c] = sources[c]->pixels[i * 4];
+		}
+	}
+	return result;
+}
+
+TextureCookStats cookMaterialTextures(SceneData& scene)
+{
+	TextureCookStats stats{};
+
+	for (auto& [path, texture] : scene.textures) {
+		stats.bytesBefore += textureBytes(texture);
+	}
+
+	std::unordered_set<std::string> colourSpecular;
+
+	auto singleChannel = [&](const std::string& path) {
+		std::string key = path + "#r";
+		if (!scene.textures.count(key)) {
+			scene.textures[key] = interleaveRed({ &scene.textures.at(path) });
+			stats.singleChannelTextures++;
+		}
+		return key;
+	};
+
+	for (auto& material : scene.materials) {
+		bool hasCutout = material.settings.useAlphaCutoutTexture && scene.textures.count(material.alphaCutoutTexture);
+		bool hasSpecular = material.settings.useSpecularTexture && scene.textures.count(material.specularTexture);
+
+		MaterialCookReport report{ material.name, 0, 0 };
+
+		std::unordered_set<std::string> before;
+		if (hasCutout) before.insert(material.alphaCutoutTexture);
+		if (hasSpecular) before.insert(material.specularTexture);
+		for (auto& path : before) {
+			report.bytesBefore += textureBytes(scene.textures.at(path));
+		}
+
+		if (hasSpecular && !isGrey(scene.textures.at(material.specularTexture))) {
+			// Coloured highlights need all three channels, it keeps its texture.
+			if (colourSpecular.insert(material.specularTexture).second)
+				stats.colourSpecularTextures++;
+			hasSpecular = false;
+		}
+
+		if (hasCutout && hasSpecular) {
+			auto& specular = scene.textures.at(material.specularTexture);
+			auto& cutout = scene.textures.at(material.alphaCutoutTexture);
+
+			if (specular.width == cutout.width && specular.height == cutout.height) {
+				std::string key = material.specularTexture + "|" + material.alphaCutoutTexture + "#rg";
+				if (!scene.textures.count(key)) {
+					scene.textures[key] = interleaveRed({ &specular, &cutout });
+					stats.packedTextures++;
+				}
+
+				material.specularTexture = key;
+				material.specularChannel = 0;
+				material.alphaCutoutTexture = key;
+				material.alphaCutoutChannel = 1;
+				hasCutout = hasSpecular = false;
+			}
+		}
+
+		if (hasSpecular) {
+			material.specularTexture = singleChannel(material.specularTexture);
+			material.specularChannel = 0;
+		}
+
+		if (hasCutout) {
+			material.alphaCutoutTexture = singleChannel(material.alphaCutoutTexture);
+			material.alphaCutoutChannel = 0;
+		}
+
+		std::unordered_set<std::string> after;
+		if (material.settings.useAlphaCutoutTexture && scene.textures.count(material.alphaCutoutTexture)) after.insert(material.alphaCutoutTexture);
+		if (material.settings.useSpecularTexture && scene.textures.count(material.specularTexture)) after.insert(material.specularTexture);
+		for (auto& path : after) {
+			report.bytesAfter += textureBytes(scene.textures.at(path));
+		}
+
+		stats.materials.push_back(report);
+	}
+
+	std::unordered_set<std::string> referenced;
+	for (auto& material : scene.materials) {
+		if (material.settings.useDiffuseTexture) referenced.insert(material.diffuseTexture);
+		if (material.settings.useNormalTexture) referenced.insert(material.normalTexture);
+		if (material.settings.useAlphaCutoutTexture) referenced.insert(material.alphaCutoutTexture);
+		if (material.settings.useSpecularTexture) referenced.insert(material.specularTexture);
+	}
+
+	for (auto texture = scene.textures.begin(); texture != scene.textures.end();) {
+		if (!referenced.count(texture->first))
+			texture = scene.textures.erase(texture);
+		else ++texture;
+	}
+
+	for (auto& [path, texture] : scene.textures) {
+		stats.bytesAfter += textureBytes(texture);
+	}
+
+	return stats;
+}
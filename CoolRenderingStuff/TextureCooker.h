@@ -0,0 +1,30 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Scene.h"
+
+struct MaterialCookReport {
+	std::string material;
+	// What the material's specular and alpha cutout slots point at, before and after.
+	uint64_t bytesBefore;
+	uint64_t bytesAfter;
+};
+
+// Top mip only, the full chains shrink by the same ratio.
+struct TextureCookStats {
+	std::vector<MaterialCookReport> materials;
+	// Every texture in the scene, so masks shared between materials only count once.
+	uint64_t bytesBefore;
+	uint64_t bytesAfter;
+	uint32_t packedTextures;
+	uint32_t singleChannelTextures;
+	uint32_t colourSpecularTextures;
+
+	int64_t bytesSaved() const { return static_cast<int64_t>(bytesBefore) - static_cast<int64_t>(bytesAfter); }
+};
+
+// Moves each material's specular (or gloss) and alpha cutout masks into the red and green channels of one RG8 texture,
+// or into R8 when the material only has one of them or their sizes differ. Specular maps that aren't grey stay RGBA8.
+// Materials are pointed at the cooked textures and anything nothing refers to any more is dropped.
+TextureCookStats cookMaterialTextures(SceneData& scene);
@@ -0,0 +1,298 @@
+#include "TexturePacker.h"
+#include <map>
+#include <tuple>
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+#include <cstring>
+
+// ImGui builds its copy static too, so this one doesn't clash.
+#define STBRP_STATIC
+#define STB_RECT_PACK_IMPLEMENTATION
+#include "vendor/imgui/imstb_rectpack.h"
+
+using namespace DirectX;
+
+static const float FULL_SLICE_MAX_LOD = 16.0f;
+
+static uint32_t wrap(int32_t value, int32_t size)
+{
+	int32_t wrapped = value % size;
+	return static_cast<uint32_t>(wrapped < 0 ? wrapped + size : wrapped);
+}
+
+static uint32_t roundUp(uint32_t value, uint32_t multiple)
+{
+	return (value + multiple - 1) / multiple * multiple;
+}
+
+static uint32_t mipSize(uint32_t size, uint32_t level)
+{
+	return std::max(1u, size >> level);
+}
+
+static uint32_t getMipLevels(const TextureData& texture)
+{
+	return static_cast<uint32_t>(texture.mips.size()) + 1;
+}
+
+static const std::vector<unsigned char>& getMipLevel(const TextureData& texture, uint32_t level)
+{
+	return level == 0 ? texture.pixels : texture.mips[level - 1];
+}
+
+static std::vector<stbrp_rect> packRects(const std::unordered_map<std::string, TextureData>& textures, const std::vector<std::string>& paths, uint32_t pageSize, uint32_t gutter)
+{
+	// Packed in gutter sized units so every rect lands on a multiple of the gutter.
+	uint32_t units = pageSize / gutter;
+
+	std::vector<stbrp_node> nodes(units);
+	stbrp_context context;
+	stbrp_init_target(&context, units, units, nodes.data(), static_cast<int>(nodes.size()));
+
+	std::vector<stbrp_rect> rects(paths.size());
+	for (size_t i = 0; i < paths.size(); i++) {
+		auto& texture = textures.at(paths[i]);
+		rects[i].id = static_cast<int>(i);
+		rects[i].w = roundUp(texture.width + 2 * gutter, gutter) / gutter;
+		rects[i].h = roundUp(texture.height + 2 * gutter, gutter) / gutter;
+	}
+
+	stbrp_pack_rects(&context, rects.data(), static_cast<int>(rects.size()));
+	return rects;
+}
+
+// The border is filled with the texture wrapped around, which is exactly what a wrap sampler would read past the edge.
+// Everything is in texels of the given level, which only lines up while the gutter is at least a texel there.
+static void copyToAtlas(const TextureData& texture, uint32_t level, uint32_t rectX, uint32_t rectY, uint32_t rectWidth, uint32_t rectHeight, uint32_t gutter, uint32_t atlasSize, std::vector<unsigned char>& page)
+{
+	size_t channels = texture.channels;
+	uint32_t width = mipSize(texture.width, level);
+	uint32_t height = mipSize(texture.height, level);
+	auto& pixels = getMipLevel(texture, level);
+
+	for (uint32_t y = 0; y < rectHeight; y++) {
+		uint32_t sourceY = wrap(static_cast<int32_t>(y) - static_cast<int32_t>(gutter), height);
+
+		for (uint32_t x = 0; x < rectWidth; x++) {
+			uint32_t sourceX = wrap(static_cast<int32_t>(x) - static_cast<int32_t>(gutter), width);
+
+			const unsigned char* source = &pixels[(static_cast<size_t>(sourceY) * width + sourceX) * channels];
+			unsigned char* dest = &page[(static_cast<size_t>(rectY + y) * atlasSize + rectX + x) * channels];
+			memcpy(dest, source, channels);
+		}
+	}
+}
+
+// Page levels past the gutter bleed between neighbours anyway and maxLod keeps the sampler off them, so a plain box does.
+static std::vector<unsigned char> downsamplePage(const std::vector<unsigned char>& page, uint32_t size, uint32_t channels)
+{
+	uint32_t half = std::max(1u, size / 2);
+	std::vector<unsigned char> level(static_cast<size_t>(half) * half * channels);
+
+	for (uint32_t y = 0; y < half; y++) {
+		for (uint32_t x = 0; x < half; x++) {
+			for (uint32_t c = 0; c < channels; c++) {
+				uint32_t x1 = std::min(x * 2 + 1, size - 1);
+				uint32_t y1 = std::min(y * 2 + 1, size - 1);
+				uint32_t sum = page[(static_cast<size_t>(y * 2) * size + x * 2) * channels + c] + page[(static_cast<size_t>(y * 2) * size + x1) * channels + c]
+					+ page[(static_cast<size_t>(y1) * size + x * 2) * channels + c] + page[(static_cast<size_t>(y1) * size + x1) * channels + c];
+				level[(static_cast<size_t>(y) * half + x) * channels + c] = static_cast<unsigned char>((sum + 2) / 4);
+			}
+		}
+	}
+
+	return level;
+}
+
+TexturePack packTextures(const std::unordered_map<std::string, TextureData>& textures, const TexturePackSettings& settings)
+{
+	if (settings.gutter == 0 || (settings.gutter & (settings.gutter - 1)) != 0 || settings.atlasSize % settings.gutter != 0)
+		throw std::runtime_error("Texture pack gutter has to be a power of two that divides the atlas size");
+
+	TexturePack pack{};
+
+	// Sorted so the same scene always packs the same way.
+	std::map<std::tuple<int, int, int>, std::vector<std::string>> sizeClasses;
+	for (auto& [path, texture] : textures) {
+		sizeClasses[{ texture.channels, texture.width, texture.height }].push_back(path);
+		pack.stats.usedTexels += static_cast<uint64_t>(texture.width) * texture.height;
+	}
+
+	// Keyed on channel count, pages can only hold one format.
+	std::map<int, std::vector<std::string>> atlased;
+
+	for (auto& [size, paths] : sizeClasses) {
+		std::sort(paths.begin(), paths.end());
+
+		auto [channels, width, height] = size;
+		bool fitsAtlas = width + 2 * settings.gutter <= settings.atlasSize && height + 2 * settings.gutter <= settings.atlasSize;
+
+		if (paths.size() < settings.minArraySlices && fitsAtlas) {
+			atlased[channels].insert(atlased[channels].end(), paths.begin(), paths.end());
+			continue;
+		}
+
+		TexturePackArray array{};
+		array.width = width;
+		array.height = height;
+		array.channels = channels;
+		array.mipLevels = UINT32_MAX;
+
+		for (auto& path : paths) {
+			auto& texture = textures.at(path);
+			pack.locations[path] = { static_cast<uint32_t>(pack.arrays.size()), static_cast<uint32_t>(array.slices.size()), XMFLOAT4(1.0f, 1.0f, 0.0f, 0.0f), FULL_SLICE_MAX_LOD };
+
+			TextureLevels levels = { texture.pixels };
+			levels.insert(levels.end(), texture.mips.begin(), texture.mips.end());
+			array.slices.push_back(std::move(levels));
+			array.mipLevels = std::min(array.mipLevels, getMipLevels(texture));
+		}
+
+		pack.arrays.push_back(std::move(array));
+	}
+
+	for (auto& [channels, paths] : atlased) {
+		// Atlas pages go on the end of the array they match in size, so they don't cost a bind of their own.
+		uint32_t atlasArray = static_cast<uint32_t>(pack.arrays.size());
+		for (uint32_t i = 0; i < pack.arrays.size(); i++) {
+			auto& array = pack.arrays[i];
+			if (array.width == settings.atlasSize && array.height == settings.atlasSize && array.channels == static_cast<uint32_t>(channels))
+				atlasArray = i;
+		}
+
+		// Without an array to join, a page of its own only needs to be big enough for what's left over.
+		uint32_t pageSize = settings.atlasSize;
+		if (atlasArray == pack.arrays.size()) {
+			pageSize = settings.gutter;
+			while (pageSize < settings.atlasSize) {
+				auto rects = packRects(textures, paths, pageSize, settings.gutter);
+				if (std::all_of(rects.begin(), rects.end(), [](const stbrp_rect& rect) { return rect.was_packed != 0; }))
+					break;
+				pageSize *= 2;
+			}
+
+			pack.arrays.push_back({ pageSize, pageSize, static_cast<uint32_t>(channels), {}, 0, UINT32_MAX });
+		}
+
+		float maxLod = std::log2(static_cast<float>(settings.gutter));
+		uint32_t gutterLevels = static_cast<uint32_t>(maxLod);
+		uint32_t pageLevels = static_cast<uint32_t>(std::log2(static_cast<float>(pageSize))) + 1;
+
+		std::vector<std::string> remaining = paths;
+		while (!remaining.empty()) {
+			auto rects = packRects(textures, remaining, pageSize, settings.gutter);
+
+			auto& array = pack.arrays[atlasArray];
+			uint32_t slice = static_cast<uint32_t>(array.slices.size());
+			TextureLevels page(pageLevels);
+			for (uint32_t level = 0; level < pageLevels; level++) {
+				uint32_t size = mipSize(pageSize, level);
+				page[level].assign(static_cast<size_t>(size) * size * channels, 0);
+			}
+
+			// Levels the gutter still covers come from the textures' own mips, as far as every texture on the page has them.
+			uint32_t copiedLevels = gutterLevels + 1;
+
+			std::vector<std::string> unpacked;
+			for (auto& rect : rects) {
+				auto& path = remaining[rect.id];
+				if (!rect.was_packed) {
+					unpacked.push_back(path);
+					continue;
+				}
+
+				auto& texture = textures.at(path);
+				uint32_t x = rect.x * settings.gutter;
+				uint32_t y = rect.y * settings.gutter;
+				copiedLevels = std::min(copiedLevels, getMipLevels(texture));
+				for (uint32_t level = 0; level < std::min(gutterLevels + 1, getMipLevels(texture)); level++) {
+					copyToAtlas(texture, level, x >> level, y >> level, (rect.w * settings.gutter) >> level, (rect.h * settings.gutter) >> level, settings.gutter >> level, mipSize(pageSize, level), page[level]);
+				}
+
+				float size = static_cast<float>(pageSize);
+				XMFLOAT4 scaleOffset(texture.width / size, texture.height / size, (x + settings.gutter) / size, (y + settings.gutter) / size);
+				pack.locations[path] = { atlasArray, slice, scaleOffset, maxLod };
+				pack.stats.atlasTextures++;
+			}
+
+			if (unpacked.size() == remaining.size())
+				throw std::runtime_error("Texture doesn't fit an empty atlas page");
+
+			for (uint32_t level = copiedLevels; level < pageLevels; level++) {
+				page[level] = downsamplePage(page[level - 1], mipSize(pageSize, level - 1), channels);
+			}
+
+			array.slices.push_back(std::move(page));
+			array.mipLevels = std::min(array.mipLevels, pageLevels);
+			array.atlasSlices++;
+			pack.stats.atlasPages++;
+
+			remaining = std::move(unpacked);
+		}
+	}
+
+	pack.stats.textures = static_cast<uint32_t>(textures.size());
+	pack.stats.arrays = static_cast<uint32_t>(pack.arrays.size());
+	for (auto& array : pack.arrays) {
+		for (auto& slice : array.slices) {
+			slice.resize(array.mipLevels);
+		}
+
+		pack.stats.slices += static_cast<uint32_t>(array.slices.size());
+		pack.stats.allocatedTexels += static_cast<uint64_t>(array.width) * array.height * array.slices.size();
+	}
+
+	return pack;
+}
+
+PackedMaterial getPackedMaterial(const TexturePack& pack, const Material& material)
+{
+	PackedMaterial packed{};
+
+	const std::string* paths[MATERIAL_TEXTURE_COUNT] = { &material.diffuseTexture, &material.normalTexture, &material.alphaCutoutTexture, &material.specularTexture };
+	const int used[MATERIAL_TEXTURE_COUNT] = { material.settings.useDiffuseTexture, material.settings.useNormalTexture, material.settings.useAlphaCutoutTexture, material.settings.useSpecularTexture };
+	const uint32_t channels[MATERIAL_TEXTURE_COUNT] = { TEXTURE_CHANNEL_ALL, TEXTURE_CHANNEL_ALL, material.alphaCutoutChannel, material.specularChannel };
+
+	for (uint32_t slot = 0; slot < MATERIAL_TEXTURE_COUNT; slot++) {
+		packed.table.channels[slot] = channels[slot];
+		packed.table.virtualRegions[slot] = XMFLOAT4(1.0f, 1.0f, 0.0f, 0.0f);
+		packed.table.virtualMaxLevels[slot] = -1.0f;
+
+		auto location = used[slot] ? pack.locations.find(*paths[slot]) : pack.locations.end();
+
+		if (location == pack.locations.end()) {
+			packed.arrays[slot] = NO_TEXTURE_ARRAY;
+			packed.table.slices[slot] = 0;
+			packed.table.scaleOffsets[slot] = XMFLOAT4(1.0f, 1.0f, 0.0f, 0.0f);
+			packed.table.maxLods[slot] = 0.0f;
+			continue;
+		}
+
+		packed.arrays[slot] = location->second.array;
+		packed.table.slices[slot] = location->second.slice;
+		packed.table.scaleOffsets[slot] = location->second.scaleOffset;
+		packed.table.maxLods[slot] = location->second.maxLod;
+	}
+
+	return packed;
+}
+
+bool updateTextureArrayBinding(const PackedMaterial& material, uint32_t bound[MATERIAL_TEXTURE_COUNT])
+{
+	bool changed = false;
+	for (uint32_t slot = 0; slot < MATERIAL_TEXTURE_COUNT; slot++) {
+		if (material.arrays[slot] != NO_TEXTURE_ARRAY && material.arrays[slot] != bound[slot]) {
+			bound[slot] = material.arrays[slot];
+			changed = true;
+		}
+	}
+	return changed;
+}
+
+void resetTextureArrayBinding(uint32_t bound[MATERIAL_TEXTURE_COUNT])
+{
+	for (uint32_t slot = 0; slot < MATERIAL_TEXTURE_COUNT; slot++) {
+		bound[slot] = NO_TEXTURE_ARRAY;
+	}
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <DirectXMath.h>
+#include "Scene.h"
+
+struct TexturePackSettings {
+	// Size classes with fewer textures than this go into atlas pages instead of an array of their own.
+	uint32_t minArraySlices = 2;
+	// Atlas pages are square and become slices of the array with the same size, if there is one.
+	// Otherwise they get an array of their own, shrunk to the smallest power of two that holds them.
+	uint32_t atlasSize = 1024;
+	// Power of two. Rects start on a multiple of it and are surrounded by that many texels of wrapped border,
+	// so mips down to log2(gutter) never mix in a neighbour.
+	uint32_t gutter = 16;
+};
+
+// Top level first, then each level below it.
+using TextureLevels = std::vector<std::vector<unsigned char>>;
+
+// One Texture2DArray worth of 8 bit per channel slices, every slice holding mipLevels levels.
+struct TexturePackArray {
+	uint32_t width;
+	uint32_t height;
+	uint32_t channels;
+	std::vector<TextureLevels> slices;
+	uint32_t atlasSlices = 0;
+	uint32_t mipLevels = 1;
+};
+
+struct TextureLocation {
+	uint32_t array;
+	uint32_t slice;
+	// Applied to the wrapped texcoord, identity for a texture with a slice to itself.
+	DirectX::XMFLOAT4 scaleOffset;
+	// Highest mip the gutter keeps clean.
+	float maxLod;
+};
+
+struct TexturePackStats {
+	uint32_t textures;
+	uint32_t arrays;
+	uint32_t slices;
+	uint32_t atlasPages;
+	uint32_t atlasTextures;
+	uint64_t usedTexels;
+	uint64_t allocatedTexels;
+
+	double efficiency() const { return allocatedTexels ? 100.0 * usedTexels / allocatedTexels : 100.0; }
+};
+
+struct TexturePack {
+	std::vector<TexturePackArray> arrays;
+	// Keyed on the same path the materials refer to.
+	std::unordered_map<std::string, TextureLocation> locations;
+	TexturePackStats stats;
+};
+
+// Groups the textures by channel count and size into array slices, packing classes too small for an array into padded atlas pages.
+// Mips come from TextureData::mips, an array gets as many levels as its shortest slice has.
+TexturePack packTextures(const std::unordered_map<std::string, TextureData>& textures, const TexturePackSettings& settings = {});
+
+enum MaterialTextureSlot {
+	MATERIAL_TEXTURE_DIFFUSE,
+	MATERIAL_TEXTURE_NORMAL,
+	MATERIAL_TEXTURE_ALPHA_CUTOUT,
+	MATERIAL_TEXTURE_SPECULAR,
+	MATERIAL_TEXTURE_COUNT,
+};
+
+static const uint32_t NO_TEXTURE_ARRAY = UINT32_MAX;
+
+// Follows MaterialCbuffer in the material constant buffer, see deferredCommon.hlsli.
+struct MaterialTextureTable {
+	uint32_t slices[MATERIAL_TEXTURE_COUNT];
+	DirectX::XMFLOAT4 scaleOffsets[MATERIAL_TEXTURE_COUNT];
+	float maxLods[MATERIAL_TEXTURE_COUNT];
+	// Channel a mask slot reads, TEXTURE_CHANNEL_ALL for colour.
+	uint32_t channels[MATERIAL_TEXTURE_COUNT];
+	// Entry in the streamed textures' min lod buffer, 0 for a texture that's always fully resident.
+	uint32_t residency[MATERIAL_TEXTURE_COUNT];
+	// Where a slot is in the virtual texture, and the level its region is one page at. -1 for slots that aren't virtual (see VirtualTexture.h).
+	DirectX::XMFLOAT4 virtualRegions[MATERIAL_TEXTURE_COUNT];
+	float virtualMaxLevels[MATERIAL_TEXTURE_COUNT];
+};
+
+struct PackedMaterial {
+	// NO_TEXTURE_ARRAY for slots the material doesn't use.
+	uint32_t arrays[MATERIAL_TEXTURE_COUNT];
+	MaterialTextureTable table;
+};
+
+PackedMaterial getPackedMaterial(const TexturePack& pack, const Material& material);
+
+// Slots a material doesn't use keep whatever is bound, so only a draw that needs a different array rebinds.
+// Returns true when the arrays have to be bound again, with bound updated to what that bind sets.
+bool updateTextureArrayBinding(const PackedMaterial& material, uint32_t bound[MATERIAL_TEXTURE_COUNT]);
+void resetTextureArrayBinding(uint32_t bound[MATERIAL_TEXTURE_COUNT]);
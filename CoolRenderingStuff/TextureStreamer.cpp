@@ -0,0 +1,242 @@
+#include "TextureStreamer.h"
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+#include <queue>
+#include <tuple>
+
+using namespace DirectX;
+
+TextureStreamer::TextureStreamer(std::vector<StreamedTextureDesc> textures, std::vector<StreamedMeshDesc> meshes, const TextureStreamSettings& settings) :
+	textures(std::move(textures)),
+	meshes(std::move(meshes)),
+	settings(settings)
+{
+	// Everything starts out with only its tail resident.
+	states.resize(this->textures.size());
+	for (size_t t = 0; t < this->textures.size(); t++) {
+		auto& desc = this->textures[t];
+		states[t].residentLevel = desc.tailLevel;
+		states[t].wantedLevel = desc.tailLevel;
+		states[t].requiredMip = FLT_MAX;
+		states[t].lastUsed.assign(desc.tailLevel, 0);
+
+		for (size_t level = desc.tailLevel; level < desc.levelBytes.size(); level++) {
+			stats.tailBytes += desc.levelBytes[level];
+		}
+	}
+
+	stats.budget = settings.memoryBudget;
+}
+
+StreamedTextureDesc describeTiledTexture(uint32_t width, uint32_t height, uint32_t channels, uint32_t mipLevels)
+{
+	// Standard tile shapes for 8, 16 and 32 bits per texel.
+	uint32_t tileWidth = channels == 1 ? 256 : (channels == 2 ? 256 : 128);
+	uint32_t tileHeight = channels == 1 ? 256 : 128;
+
+	StreamedTextureDesc desc{};
+	desc.size = std::max(width, height);
+	desc.tailLevel = mipLevels;
+
+	uint64_t tailBytes = 0;
+	for (uint32_t level = 0; level < mipLevels; level++) {
+		uint32_t levelWidth = std::max(1u, width >> level);
+		uint32_t levelHeight = std::max(1u, height >> level);
+
+		if (desc.tailLevel == mipLevels && (levelWidth < tileWidth || levelHeight < tileHeight))
+			desc.tailLevel = level;
+
+		if (level < desc.tailLevel) {
+			uint64_t tiles = static_cast<uint64_t>((levelWidth + tileWidth - 1) / tileWidth) * ((levelHeight + tileHeight - 1) / tileHeight);
+			desc.levelBytes.push_back(tiles * TEXTURE_TILE_BYTES);
+		}
+		else {
+			desc.levelBytes.push_back(0);
+			tailBytes += static_cast<uint64_t>(levelWidth) * levelHeight * channels;
+		}
+	}
+
+	// The whole tail is counted on its first level.
+	if (desc.tailLevel < mipLevels)
+		desc.levelBytes[desc.tailLevel] = (tailBytes + TEXTURE_TILE_BYTES - 1) / TEXTURE_TILE_BYTES * TEXTURE_TILE_BYTES;
+
+	return desc;
+}
+
+float TextureStreamer::calculateRequiredMip(const StreamedMeshDesc& mesh, uint32_t textureSize, const TextureStreamView& view)
+{
+	float texelsPerUnit = mesh.uvDensity * textureSize;
+	if (texelsPerUnit <= 0.0f)
+		return FLT_MAX;
+
+	// Nearest point on the bounds, the part of the mesh closest to the camera needs the most detail.
+	auto eye = XMLoadFloat3(&view.eye);
+	auto closest = XMVectorMin(XMVectorMax(eye, XMLoadFloat3(&mesh.bounds.min)), XMLoadFloat3(&mesh.bounds.max));
+	float distance = std::max(XMVectorGetX(XMVector3Length(XMVectorSubtract(closest, eye))), 0.1f);
+
+	float pixelsPerUnit = view.screenHeight * 0.5f * view.projectionScale / distance;
+	return std::log2(texelsPerUnit / pixelsPerUnit);
+}
+
+const std::vector<TextureStreamChange>& TextureStreamer::update(const TextureStreamView& view, const std::vector<uint8_t>* visibility)
+{
+	frame++;
+	changes.clear();
+
+	stats.budget = settings.memoryBudget;
+	stats.loads = 0;
+	stats.evictions = 0;
+	stats.loadedBytes = 0;
+	stats.budgetLimited = 0;
+
+	for (auto& state : states) {
+		state.requiredMip = FLT_MAX;
+	}
+
+	for (uint32_t m = 0; m < meshes.size(); m++) {
+		if (visibility && !(*visibility)[m])
+			continue;
+
+		for (uint32_t texture : meshes[m].textures) {
+			float mip = calculateRequiredMip(meshes[m], textures[texture].size, view);
+			states[texture].requiredMip = std::min(states[texture].requiredMip, mip);
+		}
+	}
+
+	auto toLevel = [](float mip, uint32_t tail) {
+		return mip >= static_cast<float>(tail) ? tail : static_cast<uint32_t>(std::max(0.0f, std::floor(mip)));
+	};
+
+	for (uint32_t t = 0; t < states.size(); t++) {
+		auto& state = states[t];
+		uint32_t tail = textures[t].tailLevel;
+
+		float required = state.requiredMip + settings.mipBias;
+		state.wantedLevel = toLevel(required, tail);
+
+		for (uint32_t level = toLevel(required - settings.hysteresisMips, tail); level < tail; level++) {
+			state.lastUsed[level] = frame;
+		}
+	}
+
+	// Only after the budget has been lowered. Anything goes, wanted or not, oldest first.
+	while (stats.residentBytes > settings.memoryBudget) {
+		uint32_t candidate = findEvictionCandidate(UINT32_MAX, true);
+		if (candidate == UINT32_MAX)
+			break;
+		evict(candidate);
+	}
+
+	// Furthest behind first, then whichever needs the more detailed mip.
+	using Entry = std::tuple<uint32_t, float, uint32_t>;
+	auto compare = [](const Entry& a, const Entry& b) {
+		if (std::get<0>(a) != std::get<0>(b))
+			return std::get<0>(a) < std::get<0>(b);
+		return std::get<1>(a) > std::get<1>(b);
+	};
+	std::priority_queue<Entry, std::vector<Entry>, decltype(compare)> queue(compare);
+
+	for (uint32_t t = 0; t < states.size(); t++) {
+		if (states[t].wantedLevel < states[t].residentLevel)
+			queue.push({ states[t].residentLevel - states[t].wantedLevel, states[t].requiredMip, t });
+	}
+
+	while (!queue.empty()) {
+		uint32_t t = std::get<2>(queue.top());
+		queue.pop();
+
+		uint64_t bytes = textures[t].levelBytes[states[t].residentLevel - 1];
+		if (stats.loads > 0 && stats.loadedBytes + bytes > settings.loadBudget)
+			break;
+
+		bool fits = true;
+		while (stats.residentBytes + bytes > settings.memoryBudget) {
+			uint32_t candidate = findEvictionCandidate(t, false);
+			if (candidate == UINT32_MAX) {
+				fits = false;
+				break;
+			}
+			evict(candidate);
+		}
+
+		if (!fits) {
+			stats.budgetLimited++;
+			continue;
+		}
+
+		load(t);
+
+		if (states[t].wantedLevel < states[t].residentLevel)
+			queue.push({ states[t].residentLevel - states[t].wantedLevel, states[t].requiredMip, t });
+	}
+
+	stats.texturesShort = 0;
+	stats.mipDeficit = 0;
+	stats.maxDeficit = 0;
+	for (auto& state : states) {
+		if (state.wantedLevel >= state.residentLevel)
+			continue;
+
+		uint32_t deficit = state.residentLevel - state.wantedLevel;
+		stats.texturesShort++;
+		stats.mipDeficit += deficit;
+		stats.maxDeficit = std::max(stats.maxDeficit, deficit);
+	}
+
+	stats.peakResidentBytes = std::max(stats.peakResidentBytes, stats.residentBytes);
+
+	return changes;
+}
+
+void TextureStreamer::load(uint32_t texture)
+{
+	auto& state = states[texture];
+	uint32_t level = --state.residentLevel;
+	uint64_t bytes = textures[texture].levelBytes[level];
+
+	state.lastUsed[level] = frame;
+
+	stats.residentBytes += bytes;
+	stats.loads++;
+	stats.loadedBytes += bytes;
+	stats.totalLoads++;
+	stats.totalLoadedBytes += bytes;
+
+	changes.push_back({ texture, level, true });
+}
+
+void TextureStreamer::evict(uint32_t texture)
+{
+	auto& state = states[texture];
+	uint32_t level = state.residentLevel++;
+
+	stats.residentBytes -= textures[texture].levelBytes[level];
+	stats.evictions++;
+	stats.totalEvictions++;
+
+	changes.push_back({ texture, level, false });
+}
+
+uint32_t TextureStreamer::findEvictionCandidate(uint32_t except, bool ignoreDelay) const
+{
+	uint32_t best = UINT32_MAX;
+	uint64_t bestFrame = UINT64_MAX;
+
+	for (uint32_t t = 0; t < states.size(); t++) {
+		auto& state = states[t];
+		uint32_t top = state.residentLevel;
+		if (t == except || top >= textures[t].tailLevel)
+			continue;
+
+		if (!ignoreDelay && (state.wantedLevel <= top || frame - state.lastUsed[top] < settings.evictDelayFrames))
+			continue;
+
+		if (state.lastUsed[top] < bestFrame) {
+			best = t;
+			bestFrame = state.lastUsed[top];
+		}
+	}
+
+	return best;
+}
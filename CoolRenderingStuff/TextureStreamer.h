@@ -0,0 +1,125 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <DirectXMath.h>
+#include "Scene.h"
+
+// One texture whose upper mips come and go. Levels from tailLevel down are always resident and don't count against the budget.
+struct StreamedTextureDesc {
+	// Larger of the top level's width and height.
+	uint32_t size;
+	// Bytes each level takes once it's resident, top level first.
+	std::vector<uint64_t> levelBytes;
+	uint32_t tailLevel;
+};
+
+struct StreamedMeshDesc {
+	MeshBounds bounds;
+	// UV units per world unit, see calculateMeshUVDensity.
+	float uvDensity;
+	// Streamed textures the mesh's material samples.
+	std::vector<uint32_t> textures;
+};
+
+struct TextureStreamSettings {
+	// Streamed levels only, tails are extra.
+	uint64_t memoryBudget = 128ull * 1024 * 1024;
+	// Most bytes loaded in one update, the rest wait. One load always goes through so a level bigger than this still gets in.
+	uint64_t loadBudget = 8ull * 1024 * 1024;
+	float mipBias = 0.0f;
+	// A level counts as used until the required mip is this far past it, so a camera sat on the boundary doesn't flip it.
+	float hysteresisMips = 0.5f;
+	// Levels used more recently than this are never evicted to make room.
+	uint32_t evictDelayFrames = 60;
+};
+
+struct TextureStreamView {
+	DirectX::XMFLOAT3 eye;
+	float screenHeight;
+	// Cotangent of half the vertical field of view, the projection's y scale.
+	float projectionScale;
+};
+
+struct TextureStreamChange {
+	uint32_t texture;
+	uint32_t level;
+	bool load;
+};
+
+struct TextureStreamStats {
+	uint64_t budget;
+	uint64_t residentBytes;
+	uint64_t peakResidentBytes;
+	uint64_t tailBytes;
+
+	// This update.
+	uint32_t loads;
+	uint32_t evictions;
+	uint64_t loadedBytes;
+	// Loads that didn't fit because nothing was old enough to evict.
+	uint32_t budgetLimited;
+	// Textures with fewer levels resident than the view wants, and how many levels short they are between them.
+	uint32_t texturesShort;
+	uint32_t mipDeficit;
+	uint32_t maxDeficit;
+
+	uint64_t totalLoads;
+	uint64_t totalEvictions;
+	uint64_t totalLoadedBytes;
+
+	double budgetUsedPercent() const { return budget ? 100.0 * residentBytes / budget : 0.0; }
+};
+
+static const uint64_t TEXTURE_TILE_BYTES = 65536;
+
+// Level sizes as D3D11 tiled resources lay them out: 64KB standard tiles, with every level smaller than a tile
+// in either direction packed into a tail that's mapped as one.
+StreamedTextureDesc describeTiledTexture(uint32_t width, uint32_t height, uint32_t channels, uint32_t mipLevels);
+
+// Decides which mips of each texture are resident from how large the meshes using it are on screen.
+// Only bookkeeping, the caller applies the changes update returns, so it runs the same with or without a device.
+class TextureStreamer
+{
+public:
+	TextureStreamer(std::vector<StreamedTextureDesc> textures, std::vector<StreamedMeshDesc> meshes, const TextureStreamSettings& settings = {});
+
+	// Works out the mip each texture needs for the view, then evicts least recently used levels and loads missing ones.
+	// Changes come back in the order they have to be applied, an eviction always before the load it makes room for.
+	const std::vector<TextureStreamChange>& update(const TextureStreamView& view, const std::vector<uint8_t>* visibility = nullptr);
+
+	void setSettings(const TextureStreamSettings& newSettings) { settings = newSettings; }
+	const TextureStreamSettings& getSettings() const { return settings; }
+
+	// Most detailed level resident, everything below it is too.
+	uint32_t getResidentLevel(uint32_t texture) const { return states[texture].residentLevel; }
+	uint32_t getWantedLevel(uint32_t texture) const { return states[texture].wantedLevel; }
+	uint32_t getNumTextures() const { return static_cast<uint32_t>(textures.size()); }
+
+	const TextureStreamStats& getStats() const { return stats; }
+
+	// log2 of texels per pixel for the mesh with the texture on it, unclamped.
+	static float calculateRequiredMip(const StreamedMeshDesc& mesh, uint32_t textureSize, const TextureStreamView& view);
+
+private:
+	struct TextureState {
+		uint32_t residentLevel;
+		uint32_t wantedLevel;
+		float requiredMip;
+		// Frame each level was last used, for the LRU.
+		std::vector<uint64_t> lastUsed;
+	};
+
+	void load(uint32_t texture);
+	void evict(uint32_t texture);
+	// Oldest top level that isn't wanted and hasn't been used for evictDelayFrames, UINT32_MAX for none.
+	uint32_t findEvictionCandidate(uint32_t except, bool ignoreDelay) const;
+
+	std::vector<StreamedTextureDesc> textures;
+	std::vector<StreamedMeshDesc> meshes;
+	TextureStreamSettings settings;
+
+	std::vector<TextureState> states;
+	std::vector<TextureStreamChange> changes;
+	TextureStreamStats stats{};
+	uint64_t frame = 0;
+};
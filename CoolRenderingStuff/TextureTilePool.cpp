@@ -0,0 +1,129 @@
+#include "TextureTilePool.h"
+#include <stdexcept>
+
+static const uint64_t TILE_BYTES = 65536;
+
+TextureTilePool::TextureTilePool(ID3D11Device* device, ID3D11DeviceContext* context)
+{
+	D3D11_FEATURE_DATA_D3D11_OPTIONS1 options{};
+	if (FAILED(device->CheckFeatureSupport(D3D11_FEATURE_D3D11_OPTIONS1, &options, sizeof(options)))
+		|| options.TiledResourcesTier < D3D11_TILED_RESOURCES_TIER_2)
+		return;
+
+	if (FAILED(device->QueryInterface(IID_PPV_ARGS(&device2)))) {
+		device2 = nullptr;
+		return;
+	}
+
+	if (FAILED(context->QueryInterface(IID_PPV_ARGS(&context2)))) {
+		context2 = nullptr;
+		device2->Release();
+		device2 = nullptr;
+	}
+}
+
+TextureTilePool::~TextureTilePool()
+{
+	if (pool)
+		pool->Release();
+
+	if (context2)
+		context2->Release();
+
+	if (device2)
+		device2->Release();
+}
+
+void TextureTilePool::reserve(uint32_t tiles)
+{
+	if (tiles <= tileCount)
+		return;
+
+	if (!pool) {
+		D3D11_BUFFER_DESC desc{};
+		desc.ByteWidth = static_cast<UINT>(tiles * TILE_BYTES);
+		desc.Usage = D3D11_USAGE_DEFAULT;
+		desc.BindFlags = 0;
+		desc.CPUAccessFlags = 0;
+		desc.MiscFlags = D3D11_RESOURCE_MISC_TILE_POOL;
+		desc.StructureByteStride = 0;
+
+		if (FAILED(device2->CreateBuffer(&desc, nullptr, &pool))) {
+			throw std::runtime_error("Failed to create texture tile pool!");
+		}
+	}
+	else if (FAILED(context2->ResizeTilePool(pool, tiles * TILE_BYTES))) {
+		throw std::runtime_error("Failed to grow texture tile pool!");
+	}
+
+	for (uint32_t tile = tileCount; tile < tiles; tile++) {
+		freeTiles.push_back(tile);
+	}
+	tileCount = tiles;
+}
+
+TextureTiling TextureTilePool::getTiling(ID3D11Texture2D* texture, uint32_t mipLevels) const
+{
+	UINT totalTiles = 0;
+	D3D11_PACKED_MIP_DESC packedDesc{};
+	D3D11_TILE_SHAPE tileShape{};
+	UINT numTilings = mipLevels;
+	std::vector<D3D11_SUBRESOURCE_TILING> tilings(mipLevels);
+
+	// The first slice's levels, every other slice is laid out the same.
+	device2->GetResourceTiling(texture, &totalTiles, &packedDesc, &tileShape, &numTilings, 0, tilings.data());
+
+	TextureTiling tiling{};
+	tiling.packedLevel = packedDesc.NumPackedMips ? packedDesc.NumStandardMips : mipLevels;
+	tiling.packedTiles = packedDesc.NumTilesForPackedMips;
+
+	for (uint32_t level = 0; level < tiling.packedLevel; level++) {
+		tiling.levelTiles.push_back(tilings[level].WidthInTiles * tilings[level].HeightInTiles * tilings[level].DepthInTiles);
+	}
+
+	return tiling;
+}
+
+void TextureTilePool::map(ID3D11Resource* resource, uint32_t subresource, uint32_t count, std::vector<uint32_t>& outTiles)
+{
+	if (count > freeTiles.size()) {
+		throw std::runtime_error("Texture tile pool is out of tiles!");
+	}
+
+	outTiles.assign(freeTiles.end() - count, freeTiles.end());
+	freeTiles.resize(freeTiles.size() - count);
+
+	D3D11_TILED_RESOURCE_COORDINATE coordinate{ 0, 0, 0, subresource };
+	D3D11_TILE_REGION_SIZE region{};
+	region.NumTiles = count;
+	region.bUseBox = FALSE;
+
+	// Free tiles are scattered, one range each.
+	std::vector<UINT> rangeFlags(count, 0);
+	std::vector<UINT> rangeCounts(count, 1);
+
+	if (FAILED(context2->UpdateTileMappings(resource, 1, &coordinate, &region, pool, count, rangeFlags.data(), outTiles.data(), rangeCounts.data(), 0))) {
+		throw std::runtime_error("Failed to map texture tiles!");
+	}
+}
+
+void TextureTilePool::unmap(ID3D11Resource* resource, uint32_t subresource, std::vector<uint32_t>& tiles)
+{
+	UINT count = static_cast<UINT>(tiles.size());
+	if (count == 0)
+		return;
+
+	D3D11_TILED_RESOURCE_COORDINATE coordinate{ 0, 0, 0, subresource };
+	D3D11_TILE_REGION_SIZE region{};
+	region.NumTiles = count;
+	region.bUseBox = FALSE;
+
+	UINT rangeFlags = D3D11_TILE_RANGE_NULL;
+
+	if (FAILED(context2->UpdateTileMappings(resource, 1, &coordinate, &region, pool, 1, &rangeFlags, nullptr, &count, 0))) {
+		throw std::runtime_error("Failed to unmap texture tiles!");
+	}
+
+	freeTiles.insert(freeTiles.end(), tiles.begin(), tiles.end());
+	tiles.clear();
+}
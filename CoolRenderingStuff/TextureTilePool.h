@@ -0,0 +1,49 @@
+#pragma once
+#include <d3d11_2.h>
+#include <cstdint>
+#include <vector>
+
+// How a tiled texture's levels split into 64KB tiles, the same for every slice of an array.
+struct TextureTiling {
+	// Tiles each level above the packed tail takes.
+	std::vector<uint32_t> levelTiles;
+	// First level in the packed tail, mipLevels when there isn't one.
+	uint32_t packedLevel;
+	// Tiles the whole tail takes, per slice.
+	uint32_t packedTiles;
+};
+
+// Backing memory for tiled textures, handed out a tile at a time so a level can be mapped and unmapped on its own.
+// Needs tiled resources tier 2, where reads of unmapped tiles return zero, otherwise isSupported is false and nothing else may be called.
+class TextureTilePool
+{
+public:
+	TextureTilePool(ID3D11Device* device, ID3D11DeviceContext* context);
+	~TextureTilePool();
+
+	TextureTilePool(const TextureTilePool&) = delete;
+	TextureTilePool& operator=(const TextureTilePool&) = delete;
+
+	bool isSupported() const { return context2 != nullptr; }
+
+	// Grows the pool to hold at least this many tiles, it never shrinks.
+	void reserve(uint32_t tileCount);
+
+	TextureTiling getTiling(ID3D11Texture2D* texture, uint32_t mipLevels) const;
+
+	// Maps a whole subresource, or the whole packed tail when subresource is its first level, to tiles from the pool.
+	// outTiles gets the tiles used, unmap hands them back.
+	void map(ID3D11Resource* resource, uint32_t subresource, uint32_t tileCount, std::vector<uint32_t>& outTiles);
+	void unmap(ID3D11Resource* resource, uint32_t subresource, std::vector<uint32_t>& tiles);
+
+	uint32_t getTileCount() const { return tileCount; }
+	uint32_t getUsedTiles() const { return tileCount - static_cast<uint32_t>(freeTiles.size()); }
+
+private:
+	ID3D11Device2* device2 = nullptr;
+	ID3D11DeviceContext2* context2 = nullptr;
+
+	ID3D11Buffer* pool = nullptr;
+	uint32_t tileCount = 0;
+	std::vector<uint32_t> freeTiles;
+};
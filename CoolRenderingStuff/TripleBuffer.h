@@ -0,0 +1,52 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+// Hands the latest T from one writer thread to one reader thread without either ever waiting on the other. The writer
+// fills back() and publishes it, the reader picks up whatever was published last with acquire() and reads front()
+// until it next picks one up. Three slots means there's always one free for the writer however long the reader holds
+// its own, and anything published in between is skipped rather than queued.
+// Slots are reused rather than reset, so a T of vectors only allocates while they grow.
+template<typename T>
+class TripleBuffer
+{
+public:
+	TripleBuffer() = default;
+
+	TripleBuffer(const TripleBuffer&) = delete;
+	TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+	// Writer only.
+	T& back() { return slots[backIndex]; }
+
+	// Swaps back() for the slot in the middle, which the reader either never picked up or has finished with.
+	void publish() {
+		uint32_t previous = middle.exchange(backIndex | FRESH, std::memory_order_acq_rel);
+		backIndex = previous & INDEX_MASK;
+	}
+
+	// Reader only. True when something was published since the last call, front() stays what it was when not.
+	bool acquire() {
+		// Only the writer can change a fresh middle, and it stays fresh when it does.
+		if (!(middle.load(std::memory_order_relaxed) & FRESH))
+			return false;
+
+		uint32_t previous = middle.exchange(frontIndex, std::memory_order_acq_rel);
+		frontIndex = previous & INDEX_MASK;
+		return true;
+	}
+
+	// Reader only.
+	T& front() { return slots[frontIndex]; }
+	const T& front() const { return slots[frontIndex]; }
+
+private:
+	static const uint32_t INDEX_MASK = 3;
+	static const uint32_t FRESH = 4;
+
+	T slots[3];
+	uint32_t backIndex = 0;
+	uint32_t frontIndex = 1;
+	// The slot in neither hand, and whether the writer put it there since the reader last looked.
+	alignas(64) std::atomic<uint32_t> middle{ 2 };
+};
@@ -0,0 +1,149 @@
+#include "ViewCulling.h"
+#include <xmmintrin.h>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <stdexcept>
+
+using namespace DirectX;
+
+ViewFrustum ViewFrustum::fromViewProj(const XMMATRIX& viewProj)
+{
+	XMFLOAT4X4 m;
+	XMStoreFloat4x4(&m, viewProj);
+
+	// Row vectors, so clip space x is the dot product with the first column and so on. D3D's depth runs 0 to w.
+	auto column = [&](int j) { return XMFLOAT4(m.m[0][j], m.m[1][j], m.m[2][j], m.m[3][j]); };
+	auto add = [](XMFLOAT4 a, XMFLOAT4 b, float sign) { return XMFLOAT4(a.x + b.x * sign, a.y + b.y * sign, a.z + b.z * sign, a.w + b.w * sign); };
+
+	XMFLOAT4 x = column(0), y = column(1), z = column(2), w = column(3);
+
+	ViewFrustum frustum;
+	frustum.planes[0] = add(w, x, 1.0f);
+	frustum.planes[1] = add(w, x, -1.0f);
+	frustum.planes[2] = add(w, y, 1.0f);
+	frustum.planes[3] = add(w, y, -1.0f);
+	frustum.planes[4] = z;
+	frustum.planes[5] = add(w, z, -1.0f);
+
+	for (auto& plane : frustum.planes) {
+		float length = std::sqrt(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+		if (length > 0.0f) {
+			plane.x /= length;
+			plane.y /= length;
+			plane.z /= length;
+			plane.w /= length;
+		}
+	}
+
+	return frustum;
+}
+
+bool ViewFrustum::intersects(float centreX, float centreY, float centreZ, float extentX, float extentY, float extentZ, float radius) const
+{
+	for (auto& plane : planes) {
+		float distance = plane.x * centreX + plane.y * centreY + plane.z * centreZ + plane.w;
+		float reach = std::fabs(plane.x) * extentX + std::fabs(plane.y) * extentY + std::fabs(plane.z) * extentZ + radius;
+		if (distance + reach < 0.0f)
+			return false;
+	}
+	return true;
+}
+
+void CullBounds::resize(uint32_t count)
+{
+	this->count = count;
+
+	size_t padded = (static_cast<size_t>(count) + 3) & ~static_cast<size_t>(3);
+	for (auto component : { &centreX, &centreY, &centreZ, &extentX, &extentY, &extentZ, &radius }) {
+		component->assign(padded, 0.0f);
+	}
+}
+
+void CullBounds::setBox(uint32_t index, const MeshBounds& bounds)
+{
+	centreX[index] = (bounds.min.x + bounds.max.x) * 0.5f;
+	centreY[index] = (bounds.min.y + bounds.max.y) * 0.5f;
+	centreZ[index] = (bounds.min.z + bounds.max.z) * 0.5f;
+	extentX[index] = (bounds.max.x - bounds.min.x) * 0.5f;
+	extentY[index] = (bounds.max.y - bounds.min.y) * 0.5f;
+	extentZ[index] = (bounds.max.z - bounds.min.z) * 0.5f;
+	radius[index] = 0.0f;
+}
+
+void CullBounds::setSphere(uint32_t index, const XMFLOAT3& centre, float radius)
+{
+	centreX[index] = centre.x;
+	centreY[index] = centre.y;
+	centreZ[index] = centre.z;
+	extentX[index] = extentY[index] = extentZ[index] = 0.0f;
+	this->radius[index] = radius;
+}
+
+bool CullBounds::intersects(const ViewFrustum& frustum, uint32_t index) const
+{
+	return frustum.intersects(centreX[index], centreY[index], centreZ[index], extentX[index], extentY[index], extentZ[index], radius[index]);
+}
+
+void cullViews(const std::vector<ViewFrustum>& frustums, const CullBounds& bounds, std::vector<uint32_t>& masks)
+{
+	if (frustums.size() > MAX_VIEWS) {
+		throw std::runtime_error("Too many views to cull in one pass!");
+	}
+
+	masks.resize(bounds.count);
+
+	// Every plane splatted once up front: normal, distance and absolute normal.
+	struct SplatPlane {
+		__m128 x, y, z, w;
+		__m128 absX, absY, absZ;
+	};
+
+	// On the stack, at most 21 KB with every view, so a cull never touches the heap once masks has grown.
+	uint32_t viewCount = static_cast<uint32_t>(frustums.size());
+	SplatPlane planes[MAX_VIEWS * 6];
+	for (uint32_t v = 0; v < viewCount; v++) {
+		for (int p = 0; p < 6; p++) {
+			auto& plane = frustums[v].planes[p];
+			planes[v * 6 + p] = {
+				_mm_set1_ps(plane.x), _mm_set1_ps(plane.y), _mm_set1_ps(plane.z), _mm_set1_ps(plane.w),
+				_mm_set1_ps(std::fabs(plane.x)), _mm_set1_ps(std::fabs(plane.y)), _mm_set1_ps(std::fabs(plane.z)),
+			};
+		}
+	}
+
+	const __m128 zero = _mm_setzero_ps();
+
+	for (uint32_t first = 0; first < bounds.count; first += 4) {
+		__m128 centreX = _mm_loadu_ps(&bounds.centreX[first]);
+		__m128 centreY = _mm_loadu_ps(&bounds.centreY[first]);
+		__m128 centreZ = _mm_loadu_ps(&bounds.centreZ[first]);
+		__m128 extentX = _mm_loadu_ps(&bounds.extentX[first]);
+		__m128 extentY = _mm_loadu_ps(&bounds.extentY[first]);
+		__m128 extentZ = _mm_loadu_ps(&bounds.extentZ[first]);
+		__m128 radius = _mm_loadu_ps(&bounds.radius[first]);
+
+		uint32_t laneMasks[4] = {};
+
+		for (uint32_t v = 0; v < viewCount; v++) {
+			// How far inside its nearest plane each bound reaches, no early out so there's nothing to mispredict.
+			__m128 nearest = _mm_set1_ps(FLT_MAX);
+			for (int p = 0; p < 6; p++) {
+				auto& plane = planes[v * 6 + p];
+				__m128 distance = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(plane.x, centreX), _mm_mul_ps(plane.y, centreY)), _mm_mul_ps(plane.z, centreZ)), plane.w);
+				__m128 reach = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(plane.absX, extentX), _mm_mul_ps(plane.absY, extentY)), _mm_mul_ps(plane.absZ, extentZ)), radius);
+				nearest = _mm_min_ps(nearest, _mm_add_ps(distance, reach));
+			}
+
+			uint32_t inside = static_cast<uint32_t>(_mm_movemask_ps(_mm_cmpge_ps(nearest, zero)));
+			for (int lane = 0; lane < 4; lane++) {
+				laneMasks[lane] |= ((inside >> lane) & 1u) << v;
+			}
+		}
+
+		uint32_t lanes = std::min(4u, bounds.count - first);
+		for (uint32_t lane = 0; lane < lanes; lane++) {
+			masks[first + lane] = laneMasks[lane];
+		}
+	}
+}
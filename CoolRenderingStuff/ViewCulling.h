@@ -0,0 +1,36 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <DirectXMath.h>
+#include "Scene.h"
+
+// Each bound gets a bit per view in a uint32_t mask, so one pass covers this many views.
+static const uint32_t MAX_VIEWS = 32;
+
+// The six clip planes of a view projection, normalised and pointing inwards.
+struct ViewFrustum {
+	DirectX::XMFLOAT4 planes[6];
+
+	static ViewFrustum fromViewProj(const DirectX::XMMATRIX& viewProj);
+
+	// The scalar test, the same sums in the same order as cullViews so both agree to the bit.
+	bool intersects(float centreX, float centreY, float centreZ, float extentX, float extentY, float extentZ, float radius) const;
+};
+
+// Boxes grown by a radius, one array per component so the cull loads four bounds at a time. Instances are boxes with no
+// radius, lights are points with one. The arrays are padded to a multiple of 4 with empty bounds that never get a mask.
+struct CullBounds {
+	uint32_t count = 0;
+	std::vector<float> centreX, centreY, centreZ;
+	std::vector<float> extentX, extentY, extentZ;
+	std::vector<float> radius;
+
+	void resize(uint32_t count);
+	void setBox(uint32_t index, const MeshBounds& bounds);
+	void setSphere(uint32_t index, const DirectX::XMFLOAT3& centre, float radius);
+	bool intersects(const ViewFrustum& frustum, uint32_t index) const;
+};
+
+// Tests every bound against every view in one pass, so each bound is loaded once however many views there are.
+// masks gets one entry per bound with bit v set when it touches frustums[v]. Throws past MAX_VIEWS.
+void cullViews(const std::vector<ViewFrustum>& frustums, const CullBounds& bounds, std::vector<uint32_t>& masks);
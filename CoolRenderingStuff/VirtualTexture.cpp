@@ -0,0 +1,592 @@
+#include "VirtualTexture.h"
+#include "JobSystem.h"
+#include <stdexcept>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+
+using namespace DirectX;
+
+static const uint32_t VIRTUAL_TILE_FILE_MAGIC = 0x31585456; // "VTX1"
+static const uint32_t VIRTUAL_TILE_FILE_VERSION = 1;
+
+struct VirtualTileFileHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t tileSize;
+	uint32_t border;
+	uint32_t virtualPages;
+	uint32_t tileCount;
+	// Of the settings, the regions and every source texel, see hashVirtualTextures.
+	uint64_t hash;
+};
+
+static uint32_t log2u(uint32_t value) {
+	uint32_t log = 0;
+	while ((1u << (log + 1)) <= value) {
+		log++;
+	}
+	return log;
+}
+
+static uint32_t nextPowerOfTwo(uint32_t value) {
+	uint32_t power = 1;
+	while (power < value) {
+		power <<= 1;
+	}
+	return power;
+}
+
+// Morton index back to x and y.
+static uint32_t compactBits(uint32_t value) {
+	value &= 0x55555555;
+	value = (value | (value >> 1)) & 0x33333333;
+	value = (value | (value >> 2)) & 0x0f0f0f0f;
+	value = (value | (value >> 4)) & 0x00ff00ff;
+	value = (value | (value >> 8)) & 0x0000ffff;
+	return value;
+}
+
+uint32_t VirtualTextureSettings::getLevelCount() const
+{
+	return log2u(virtualPages) + 1;
+}
+
+VirtualTextureLayout layoutVirtualTextures(const TexturePack& pack, const VirtualTextureSettings& settings)
+{
+	if (settings.cacheTiles > 256 || settings.virtualPages > 4096) {
+		throw std::runtime_error("Virtual texture settings out of range");
+	}
+
+	VirtualTextureLayout layout;
+	layout.settings = settings;
+	layout.pagesUsed = 0;
+	layout.sliceRegions.resize(pack.arrays.size());
+
+	std::vector<VirtualTextureRegion> candidates;
+	for (uint32_t a = 0; a < pack.arrays.size(); a++) {
+		auto& array = pack.arrays[a];
+		uint32_t fullSlices = static_cast<uint32_t>(array.slices.size()) - array.atlasSlices;
+		layout.sliceRegions[a].assign(array.slices.size(), NO_VIRTUAL_TEXTURE);
+
+		if (array.channels != 4 || std::max(array.width, array.height) < settings.tileSize)
+			continue;
+
+		uint32_t pages = nextPowerOfTwo((std::max(array.width, array.height) + settings.tileSize - 1) / settings.tileSize);
+		uint32_t maxLevel = log2u(pages);
+
+		// The region needs a level of the source for every level it has pages at.
+		if (array.mipLevels <= maxLevel)
+			continue;
+
+		for (uint32_t slice = 0; slice < fullSlices; slice++) {
+			candidates.push_back({ 0, 0, pages, array.width, array.height, maxLevel, a, slice, {} });
+		}
+	}
+
+	// Biggest first keeps the Morton cursor aligned to every square it hands out.
+	std::stable_sort(candidates.begin(), candidates.end(), [](const VirtualTextureRegion& a, const VirtualTextureRegion& b) { return a.pages > b.pages; });
+
+	uint32_t capacity = settings.virtualPages * settings.virtualPages;
+	uint32_t cursor = 0;
+	float virtualTexels = static_cast<float>(settings.virtualPages * settings.tileSize);
+
+	for (auto& region : candidates) {
+		uint32_t area = region.pages * region.pages;
+		if (cursor + area > capacity)
+			continue;
+
+		region.pageX = compactBits(cursor);
+		region.pageY = compactBits(cursor >> 1);
+		region.scaleOffset = XMFLOAT4(region.width / virtualTexels, region.height / virtualTexels,
+			static_cast<float>(region.pageX) / settings.virtualPages, static_cast<float>(region.pageY) / settings.virtualPages);
+		cursor += area;
+
+		layout.sliceRegions[region.array][region.slice] = static_cast<uint32_t>(layout.regions.size());
+		layout.regions.push_back(region);
+	}
+
+	layout.pagesUsed = cursor;
+	return layout;
+}
+
+void applyVirtualTextureLayout(const VirtualTextureLayout& layout, const PackedMaterial& packed, MaterialTextureTable& table)
+{
+	for (uint32_t slot = 0; slot < MATERIAL_TEXTURE_COUNT; slot++) {
+		table.virtualRegions[slot] = XMFLOAT4(1.0f, 1.0f, 0.0f, 0.0f);
+		table.virtualMaxLevels[slot] = -1.0f;
+
+		uint32_t array = packed.arrays[slot];
+		if (array == NO_TEXTURE_ARRAY || array >= layout.sliceRegions.size() || packed.table.slices[slot] >= layout.sliceRegions[array].size())
+			continue;
+
+		uint32_t region = layout.sliceRegions[array][packed.table.slices[slot]];
+		if (region == NO_VIRTUAL_TEXTURE)
+			continue;
+
+		table.virtualRegions[slot] = layout.regions[region].scaleOffset;
+		table.virtualMaxLevels[slot] = static_cast<float>(layout.regions[region].maxLevel);
+	}
+}
+
+static void cookTile(const TexturePackArray& array, const VirtualTextureRegion& region, const VirtualTextureSettings& settings, uint32_t page, unsigned char* out)
+{
+	uint32_t level = getVirtualPageLevel(page);
+	uint32_t tileX = getVirtualPageX(page) - (region.pageX >> level);
+	uint32_t tileY = getVirtualPageY(page) - (region.pageY >> level);
+
+	auto& source = array.slices[region.slice][level];
+	int width = static_cast<int>(std::max(1u, array.width >> level));
+	int height = static_cast<int>(std::max(1u, array.height >> level));
+
+	int stride = static_cast<int>(settings.getTileStride());
+	int border = static_cast<int>(settings.border);
+
+	for (int y = 0; y < stride; y++) {
+		int sourceY = static_cast<int>(tileY * settings.tileSize) + y - border;
+		sourceY = ((sourceY % height) + height) % height;
+
+		for (int x = 0; x < stride; x++) {
+			int sourceX = static_cast<int>(tileX * settings.tileSize) + x - border;
+			sourceX = ((sourceX % width) + width) % width;
+
+			memcpy(out + (static_cast<size_t>(y) * stride + x) * 4, source.data() + (static_cast<size_t>(sourceY) * width + sourceX) * 4, 4);
+		}
+	}
+}
+
+static const VirtualTextureRegion* findRegion(const VirtualTextureLayout& layout, uint32_t page)
+{
+	uint32_t level = getVirtualPageLevel(page);
+	uint32_t x = getVirtualPageX(page) << level;
+	uint32_t y = getVirtualPageY(page) << level;
+
+	for (auto& region : layout.regions) {
+		if (level <= region.maxLevel && x >= region.pageX && x < region.pageX + region.pages && y >= region.pageY && y < region.pageY + region.pages)
+			return &region;
+	}
+	return nullptr;
+}
+
+void cookVirtualTile(const TexturePack& pack, const VirtualTextureLayout& layout, uint32_t page, unsigned char* out)
+{
+	auto region = findRegion(layout, page);
+	if (!region) {
+		throw std::runtime_error("No virtual texture at page " + std::to_string(page));
+	}
+
+	cookTile(pack.arrays[region->array], *region, layout.settings, page, out);
+}
+
+// Pages that have texels in them. A non square texture's region has a strip of pages it never uses.
+static std::vector<uint32_t> getCookedPages(const VirtualTextureLayout& layout)
+{
+	auto& settings = layout.settings;
+
+	std::vector<uint32_t> pages;
+	for (auto& region : layout.regions) {
+		for (uint32_t level = 0; level <= region.maxLevel; level++) {
+			uint32_t tilesX = (std::max(1u, region.width >> level) + settings.tileSize - 1) / settings.tileSize;
+			uint32_t tilesY = (std::max(1u, region.height >> level) + settings.tileSize - 1) / settings.tileSize;
+
+			for (uint32_t y = 0; y < tilesY; y++) {
+				for (uint32_t x = 0; x < tilesX; x++) {
+					pages.push_back(makeVirtualPage(level, (region.pageX >> level) + x, (region.pageY >> level) + y));
+				}
+			}
+		}
+	}
+
+	std::sort(pages.begin(), pages.end());
+	return pages;
+}
+
+static uint64_t hashBytes(uint64_t hash, const void* data, size_t size)
+{
+	auto bytes = static_cast<const unsigned char*>(data);
+
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		memcpy(&word, bytes + i, 8);
+		hash = (hash ^ word) * 0x100000001b3ull;
+		hash ^= hash >> 29;
+	}
+	for (; i < size; i++) {
+		hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+	}
+	return hash;
+}
+
+// Regions hash on their own jobs and are combined in order, so the result doesn't depend on the thread count.
+static uint64_t hashVirtualTextures(const TexturePack& pack, const VirtualTextureLayout& layout, JobSystem& jobs)
+{
+	auto& settings = layout.settings;
+	uint32_t settingsKey[] = { settings.tileSize, settings.border, settings.virtualPages };
+
+	std::vector<uint64_t> regionHashes(layout.regions.size());
+	jobs.parallelFor(static_cast<uint32_t>(layout.regions.size()), [&](uint32_t i, uint32_t) {
+		auto& region = layout.regions[i];
+		uint32_t regionKey[] = { region.pageX, region.pageY, region.pages, region.width, region.height, region.maxLevel };
+
+		uint64_t hash = hashBytes(0xcbf29ce484222325ull, regionKey, sizeof(regionKey));
+		for (uint32_t level = 0; level <= region.maxLevel; level++) {
+			auto& texels = pack.arrays[region.array].slices[region.slice][level];
+			hash = hashBytes(hash, texels.data(), texels.size());
+		}
+		regionHashes[i] = hash;
+	});
+
+	uint64_t hash = hashBytes(0xcbf29ce484222325ull, settingsKey, sizeof(settingsKey));
+	return hashBytes(hash, regionHashes.data(), regionHashes.size() * sizeof(uint64_t));
+}
+
+VirtualTextureCookStats cookVirtualTextures(const TexturePack& pack, const VirtualTextureLayout& layout, const std::string& path, JobSystem& jobs)
+{
+	auto start = std::chrono::steady_clock::now();
+	auto& settings = layout.settings;
+
+	std::vector<uint32_t> pages = getCookedPages(layout);
+
+	VirtualTextureCookStats stats{};
+	stats.tiles = static_cast<uint32_t>(pages.size());
+	stats.bytes = static_cast<uint64_t>(pages.size()) * settings.getTileBytes();
+
+	VirtualTileFileHeader header{};
+	header.magic = VIRTUAL_TILE_FILE_MAGIC;
+	header.version = VIRTUAL_TILE_FILE_VERSION;
+	header.tileSize = settings.tileSize;
+	header.border = settings.border;
+	header.virtualPages = settings.virtualPages;
+	header.tileCount = stats.tiles;
+	header.hash = hashVirtualTextures(pack, layout, jobs);
+
+	{
+		std::ifstream existing(path, std::ios::binary);
+		VirtualTileFileHeader existingHeader{};
+		if (existing.read(reinterpret_cast<char*>(&existingHeader), sizeof(existingHeader)) && memcmp(&existingHeader, &header, sizeof(header)) == 0) {
+			stats.upToDate = true;
+			stats.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			return stats;
+		}
+	}
+
+	auto directory = std::filesystem::path(path).parent_path();
+	if (!directory.empty())
+		std::filesystem::create_directories(directory);
+
+	// Written under another name and moved over the old file at the end, a cook that dies part way never looks up to date.
+	std::string tempPath = path + ".tmp";
+	std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+	if (!file) {
+		throw std::runtime_error("Failed to open " + tempPath + " for writing");
+	}
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(pages.data()), pages.size() * sizeof(uint32_t));
+
+	const uint32_t batchSize = 256;
+	std::vector<unsigned char> batch(static_cast<size_t>(batchSize) * settings.getTileBytes());
+
+	// The region lookup per page is a scan, so pages are matched to regions once up front.
+	std::vector<const VirtualTextureRegion*> regions(pages.size());
+	for (size_t i = 0; i < pages.size(); i++) {
+		regions[i] = findRegion(layout, pages[i]);
+	}
+
+	for (uint32_t first = 0; first < pages.size(); first += batchSize) {
+		uint32_t count = std::min(batchSize, static_cast<uint32_t>(pages.size()) - first);
+
+		jobs.parallelFor(count, [&](uint32_t i, uint32_t) {
+			auto region = regions[first + i];
+			cookTile(pack.arrays[region->array], *region, settings, pages[first + i], batch.data() + static_cast<size_t>(i) * settings.getTileBytes());
+		});
+
+		file.write(reinterpret_cast<const char*>(batch.data()), static_cast<std::streamsize>(count) * settings.getTileBytes());
+	}
+
+	file.close();
+	if (!file) {
+		throw std::runtime_error("Failed to write " + tempPath);
+	}
+
+	std::filesystem::rename(tempPath, path);
+
+	stats.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	return stats;
+}
+
+VirtualTileFile::VirtualTileFile(const std::string& path) :
+	path(path)
+{
+	std::ifstream file(path, std::ios::binary);
+
+	VirtualTileFileHeader header{};
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != VIRTUAL_TILE_FILE_MAGIC || header.version != VIRTUAL_TILE_FILE_VERSION) {
+		throw std::runtime_error("Not a virtual texture tile file: " + path);
+	}
+
+	settings.tileSize = header.tileSize;
+	settings.border = header.border;
+	settings.virtualPages = header.virtualPages;
+
+	pages.resize(header.tileCount);
+	if (!file.read(reinterpret_cast<char*>(pages.data()), pages.size() * sizeof(uint32_t))) {
+		throw std::runtime_error("Truncated virtual texture tile file: " + path);
+	}
+
+	dataOffset = sizeof(header) + pages.size() * sizeof(uint32_t);
+}
+
+uint32_t VirtualTileFile::findTile(uint32_t page) const
+{
+	auto found = std::lower_bound(pages.begin(), pages.end(), page);
+	if (found == pages.end() || *found != page)
+		return NO_TILE;
+	return static_cast<uint32_t>(found - pages.begin());
+}
+
+bool VirtualTileFile::readTile(std::ifstream& stream, uint32_t tile, unsigned char* out) const
+{
+	uint64_t bytes = settings.getTileBytes();
+
+	stream.clear();
+	stream.seekg(static_cast<std::streamoff>(dataOffset + tile * bytes));
+	return static_cast<bool>(stream.read(reinterpret_cast<char*>(out), static_cast<std::streamsize>(bytes)));
+}
+
+VirtualPageTable::VirtualPageTable(uint32_t virtualPages) :
+	virtualPages(virtualPages)
+{
+	for (uint32_t size = virtualPages; size > 0; size >>= 1) {
+		levels.emplace_back(static_cast<size_t>(size) * size, 0);
+	}
+}
+
+void VirtualPageTable::map(uint32_t page, uint32_t cacheX, uint32_t cacheY)
+{
+	uint32_t level = getVirtualPageLevel(page);
+	uint32_t entry = 0xff000000u | (level << 16) | (cacheY << 8) | cacheX;
+
+	// Everything under the tile that's showing something coarser, or nothing, shows the tile now.
+	for (uint32_t l = 0; l <= level; l++) {
+		uint32_t shift = level - l;
+		uint32_t size = 1u << shift;
+		uint32_t x0 = getVirtualPageX(page) << shift;
+		uint32_t y0 = getVirtualPageY(page) << shift;
+		uint32_t rowSize = getLevelSize(l);
+
+		bool changed = false;
+		for (uint32_t y = y0; y < y0 + size; y++) {
+			for (uint32_t x = x0; x < x0 + size; x++) {
+				uint32_t& current = levels[l][static_cast<size_t>(y) * rowSize + x];
+				if (l == level || current == 0 || getEntryLevel(current) > level) {
+					current = entry;
+					changed = true;
+					entriesWritten++;
+				}
+			}
+		}
+
+		if (changed)
+			dirty.push_back({ l, x0, y0, size });
+	}
+}
+
+void VirtualPageTable::unmap(uint32_t page)
+{
+	uint32_t level = getVirtualPageLevel(page);
+	uint32_t x = getVirtualPageX(page);
+	uint32_t y = getVirtualPageY(page);
+
+	uint32_t old = getEntry(level, x, y);
+	uint32_t parent = level + 1 < levels.size() ? getEntry(level + 1, x >> 1, y >> 1) : 0;
+
+	// The parent's entry is already the finest tile above this one, so whatever showed this tile shows that.
+	for (uint32_t l = 0; l <= level; l++) {
+		uint32_t shift = level - l;
+		uint32_t size = 1u << shift;
+		uint32_t x0 = x << shift;
+		uint32_t y0 = y << shift;
+		uint32_t rowSize = getLevelSize(l);
+
+		bool changed = false;
+		for (uint32_t ty = y0; ty < y0 + size; ty++) {
+			for (uint32_t tx = x0; tx < x0 + size; tx++) {
+				uint32_t& current = levels[l][static_cast<size_t>(ty) * rowSize + tx];
+				if (current == old) {
+					current = parent;
+					changed = true;
+					entriesWritten++;
+				}
+			}
+		}
+
+		if (changed)
+			dirty.push_back({ l, x0, y0, size });
+	}
+}
+
+std::vector<VirtualPageTable::DirtyRect> VirtualPageTable::takeDirtyRects()
+{
+	std::vector<DirtyRect> rects;
+	rects.swap(dirty);
+	return rects;
+}
+
+VirtualTileCache::VirtualTileCache(uint32_t slotCount) :
+	slots(slotCount)
+{
+	for (uint32_t slot = 0; slot < slotCount; slot++) {
+		pushFront(slot);
+	}
+}
+
+uint32_t VirtualTileCache::find(uint32_t page) const
+{
+	auto found = lookup.find(page);
+	return found != lookup.end() ? found->second : NO_SLOT;
+}
+
+void VirtualTileCache::unlink(uint32_t slot)
+{
+	auto& s = slots[slot];
+	if (s.prev != NO_SLOT)
+		slots[s.prev].next = s.next;
+	else
+		head = s.next;
+
+	if (s.next != NO_SLOT)
+		slots[s.next].prev = s.prev;
+	else
+		tail = s.prev;
+
+	s.prev = s.next = NO_SLOT;
+}
+
+void VirtualTileCache::pushFront(uint32_t slot)
+{
+	auto& s = slots[slot];
+	s.prev = NO_SLOT;
+	s.next = head;
+
+	if (head != NO_SLOT)
+		slots[head].prev = slot;
+	head = slot;
+
+	if (tail == NO_SLOT)
+		tail = slot;
+}
+
+void VirtualTileCache::touch(uint32_t slot, uint64_t frame)
+{
+	auto& s = slots[slot];
+	s.lastUsed = frame;
+
+	if (s.pinned || head == slot)
+		return;
+
+	unlink(slot);
+	pushFront(slot);
+}
+
+uint32_t VirtualTileCache::allocate(uint32_t page, uint64_t frame, uint32_t& evictedPage)
+{
+	evictedPage = VIRTUAL_FEEDBACK_NONE;
+
+	uint32_t slot = tail;
+	if (slot == NO_SLOT)
+		return NO_SLOT;
+
+	auto& s = slots[slot];
+	if (s.page != VIRTUAL_FEEDBACK_NONE) {
+		if (s.lastUsed >= frame)
+			return NO_SLOT;
+
+		evictedPage = s.page;
+		lookup.erase(s.page);
+	}
+
+	s.page = page;
+	lookup[page] = slot;
+	touch(slot, frame);
+	return slot;
+}
+
+void VirtualTileCache::pin(uint32_t slot)
+{
+	if (slots[slot].pinned)
+		return;
+
+	unlink(slot);
+	slots[slot].pinned = true;
+	pinned++;
+}
+
+VirtualFeedbackAnalyser::VirtualFeedbackAnalyser(const VirtualTextureSettings& settings) :
+	virtualPages(settings.virtualPages),
+	levelCount(settings.getLevelCount())
+{
+}
+
+const std::vector<VirtualTextureRequest>& VirtualFeedbackAnalyser::analyse(const uint32_t* feedback, size_t count, VirtualTileCache& cache, uint64_t frame)
+{
+	counts.clear();
+	missing.clear();
+	requests.clear();
+	stats = {};
+
+	for (size_t i = 0; i < count; i++) {
+		uint32_t page = feedback[i];
+		if (!(page & VIRTUAL_PAGE_VALID))
+			continue;
+
+		// Anything the shader couldn't have written is dropped rather than trusted.
+		uint32_t level = getVirtualPageLevel(page);
+		if (level >= levelCount || getVirtualPageX(page) >= (virtualPages >> level) || getVirtualPageY(page) >= (virtualPages >> level))
+			continue;
+
+		counts[page]++;
+		stats.texels++;
+	}
+
+	stats.pages = static_cast<uint32_t>(counts.size());
+
+	for (auto& [page, texels] : counts) {
+		uint32_t slot = cache.find(page);
+		if (slot != VirtualTileCache::NO_SLOT) {
+			cache.touch(slot, frame);
+			stats.resident++;
+			continue;
+		}
+
+		for (uint32_t wanted = page; ; wanted = getVirtualPageParent(wanted)) {
+			missing[wanted] += texels;
+
+			if (getVirtualPageLevel(wanted) + 1 >= levelCount)
+				break;
+
+			uint32_t parentSlot = cache.find(getVirtualPageParent(wanted));
+			if (parentSlot != VirtualTileCache::NO_SLOT) {
+				cache.touch(parentSlot, frame);
+				break;
+			}
+		}
+	}
+
+	requests.reserve(missing.size());
+	for (auto& [page, texels] : missing) {
+		requests.push_back({ page, texels });
+	}
+
+	std::sort(requests.begin(), requests.end(), [](const VirtualTextureRequest& a, const VirtualTextureRequest& b) {
+		uint32_t levelA = getVirtualPageLevel(a.page), levelB = getVirtualPageLevel(b.page);
+		if (levelA != levelB)
+			return levelA > levelB;
+		if (a.count != b.count)
+			return a.count > b.count;
+		return a.page < b.page;
+	});
+
+	return requests;
+}
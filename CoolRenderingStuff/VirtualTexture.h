@@ -0,0 +1,227 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <unordered_map>
+#include <DirectXMath.h>
+#include "TexturePacker.h"
+
+class JobSystem;
+
+struct VirtualTextureSettings {
+	// Texels of texture in a tile along a side, power of two.
+	uint32_t tileSize = 128;
+	// Texels of wrapped neighbour around each tile, so bilinear filtering at a tile's edge reads what the source has there.
+	uint32_t border = 4;
+	// Top level of the virtual address space in pages along a side, power of two. Page keys leave 12 bits for each.
+	uint32_t virtualPages = 256;
+	// Physical cache in tiles along a side, at most 256 so a page table entry holds them in a byte each.
+	uint32_t cacheTiles = 16;
+	// Most tile loads started in one update, and most waiting on the I/O threads at once.
+	uint32_t maxRequestsPerFrame = 16;
+	uint32_t maxRequestsInFlight = 64;
+	// Feedback is rendered at 1/feedbackScale of the screen in each direction.
+	uint32_t feedbackScale = 8;
+
+	uint32_t getTileStride() const { return tileSize + 2 * border; }
+	uint32_t getTileBytes() const { return getTileStride() * getTileStride() * 4; }
+	uint32_t getCacheSize() const { return cacheTiles * getTileStride(); }
+	uint32_t getLevelCount() const;
+};
+
+// A page is one tile sized square of the virtual address space at some level, level 0 being the most detailed.
+// Keys are what the feedback pass writes: x and y in 12 bits each, the level above them and the top bit set.
+static const uint32_t VIRTUAL_PAGE_VALID = 0x80000000u;
+static const uint32_t VIRTUAL_FEEDBACK_NONE = 0;
+
+inline uint32_t makeVirtualPage(uint32_t level, uint32_t x, uint32_t y) { return VIRTUAL_PAGE_VALID | (level << 24) | (y << 12) | x; }
+inline uint32_t getVirtualPageLevel(uint32_t page) { return (page >> 24) & 0x7f; }
+inline uint32_t getVirtualPageX(uint32_t page) { return page & 0xfff; }
+inline uint32_t getVirtualPageY(uint32_t page) { return (page >> 12) & 0xfff; }
+inline uint32_t getVirtualPageParent(uint32_t page) { return makeVirtualPage(getVirtualPageLevel(page) + 1, getVirtualPageX(page) >> 1, getVirtualPageY(page) >> 1); }
+
+static const uint32_t NO_VIRTUAL_TEXTURE = UINT32_MAX;
+
+// A texture's square of the virtual address space. Always a power of two pages and aligned to its size,
+// so at every level down to maxLevel it still covers whole pages.
+struct VirtualTextureRegion {
+	uint32_t pageX;
+	uint32_t pageY;
+	uint32_t pages;
+	uint32_t width;
+	uint32_t height;
+	// The level the region is one page at. Pinned in the cache so there's always something to fall back to.
+	uint32_t maxLevel;
+	// Where it came from in the pack.
+	uint32_t array;
+	uint32_t slice;
+	// Takes the wrapped texcoord to virtual uv, same layout as TextureLocation::scaleOffset.
+	DirectX::XMFLOAT4 scaleOffset;
+};
+
+struct VirtualTextureLayout {
+	VirtualTextureSettings settings;
+	std::vector<VirtualTextureRegion> regions;
+	// Per pack array, the region each slice went to. NO_VIRTUAL_TEXTURE for slices that stay in their array.
+	std::vector<std::vector<uint32_t>> sliceRegions;
+	// Top level pages handed out, of virtualPages squared.
+	uint32_t pagesUsed = 0;
+};
+
+// Every full RGBA slice at least a tile across becomes a virtual texture, biggest first in Morton order so the squares pack without gaps.
+// Masks and atlas pages stay in their arrays, as does anything that doesn't fit.
+VirtualTextureLayout layoutVirtualTextures(const TexturePack& pack, const VirtualTextureSettings& settings = {});
+
+// Sets up a material's virtual slots. The table keeps its array slots too, they're what's sampled with virtual texturing off.
+void applyVirtualTextureLayout(const VirtualTextureLayout& layout, const PackedMaterial& packed, MaterialTextureTable& table);
+
+struct VirtualTextureCookStats {
+	uint32_t tiles;
+	uint64_t bytes;
+	// Left as it was when the file already held exactly this layout of exactly these textures.
+	bool upToDate;
+	double ms;
+};
+
+// Writes every page of every region at every level down to its maxLevel to one file, tiles in page key order after a sorted directory.
+// A tile is its texels plus border wrapped from the same level of the source. Jobs cook a batch of tiles at a time.
+VirtualTextureCookStats cookVirtualTextures(const TexturePack& pack, const VirtualTextureLayout& layout, const std::string& path, JobSystem& jobs);
+
+// One tile straight from the source, what cookVirtualTextures writes for it.
+void cookVirtualTile(const TexturePack& pack, const VirtualTextureLayout& layout, uint32_t page, unsigned char* out);
+
+// Directory of a cooked file. Reading is done through a stream the caller owns, so each I/O thread can have its own.
+class VirtualTileFile
+{
+public:
+	static const uint32_t NO_TILE = UINT32_MAX;
+
+	explicit VirtualTileFile(const std::string& path);
+
+	uint32_t findTile(uint32_t page) const;
+	uint32_t getPage(uint32_t tile) const { return pages[tile]; }
+	uint32_t getTileCount() const { return static_cast<uint32_t>(pages.size()); }
+	const VirtualTextureSettings& getSettings() const { return settings; }
+	const std::string& getPath() const { return path; }
+
+	bool readTile(std::ifstream& stream, uint32_t tile, unsigned char* out) const;
+
+private:
+	std::string path;
+	VirtualTextureSettings settings;
+	std::vector<uint32_t> pages;
+	uint64_t dataOffset;
+};
+
+// CPU copy of the page table, a level per mip of the GPU texture. Each entry is the finest cached tile covering that page:
+// cache x and y in the low bytes, the level the tile is from above them, and the top byte set. 0 is nothing mapped at all.
+// Mapping and unmapping only rewrite the entries under the tile, and record that square for the upload.
+class VirtualPageTable
+{
+public:
+	struct DirtyRect {
+		uint32_t level;
+		uint32_t x;
+		uint32_t y;
+		uint32_t size;
+	};
+
+	VirtualPageTable(uint32_t virtualPages);
+
+	void map(uint32_t page, uint32_t cacheX, uint32_t cacheY);
+	void unmap(uint32_t page);
+
+	uint32_t getEntry(uint32_t level, uint32_t x, uint32_t y) const { return levels[level][static_cast<size_t>(y) * getLevelSize(level) + x]; }
+	uint32_t getLevelSize(uint32_t level) const { return std::max(1u, virtualPages >> level); }
+	uint32_t getLevelCount() const { return static_cast<uint32_t>(levels.size()); }
+	const uint32_t* getLevelData(uint32_t level) const { return levels[level].data(); }
+
+	// Squares changed since the last call, at most one per level a map or unmap touched.
+	std::vector<DirtyRect> takeDirtyRects();
+	uint64_t getEntriesWritten() const { return entriesWritten; }
+
+	static uint32_t getEntryLevel(uint32_t entry) { return (entry >> 16) & 0xff; }
+
+private:
+	uint32_t virtualPages;
+	std::vector<std::vector<uint32_t>> levels;
+	std::vector<DirtyRect> dirty;
+	uint64_t entriesWritten = 0;
+};
+
+// Which page sits in each slot of the physical cache. Slots are kept on an intrusive list most recently used first,
+// pinned ones are taken off it and never evicted.
+class VirtualTileCache
+{
+public:
+	static const uint32_t NO_SLOT = UINT32_MAX;
+
+	VirtualTileCache(uint32_t slots);
+
+	uint32_t find(uint32_t page) const;
+	void touch(uint32_t slot, uint64_t frame);
+	// The least recently used slot, unless it was used this frame: evicting that would only have it requested again.
+	// evictedPage is the page that was in it, VIRTUAL_FEEDBACK_NONE if it was empty.
+	uint32_t allocate(uint32_t page, uint64_t frame, uint32_t& evictedPage);
+	void pin(uint32_t slot);
+
+	uint32_t getPage(uint32_t slot) const { return slots[slot].page; }
+	uint32_t getSlotCount() const { return static_cast<uint32_t>(slots.size()); }
+	uint32_t getUsedSlots() const { return static_cast<uint32_t>(lookup.size()); }
+	uint32_t getPinnedSlots() const { return pinned; }
+
+private:
+	struct Slot {
+		uint32_t page = VIRTUAL_FEEDBACK_NONE;
+		uint64_t lastUsed = 0;
+		uint32_t prev = NO_SLOT;
+		uint32_t next = NO_SLOT;
+		bool pinned = false;
+	};
+
+	void unlink(uint32_t slot);
+	void pushFront(uint32_t slot);
+
+	std::vector<Slot> slots;
+	std::unordered_map<uint32_t, uint32_t> lookup;
+	uint32_t head = NO_SLOT;
+	uint32_t tail = NO_SLOT;
+	uint32_t pinned = 0;
+};
+
+struct VirtualTextureRequest {
+	uint32_t page;
+	// Feedback texels that asked for it or for a page it's the fallback of.
+	uint32_t count;
+};
+
+struct VirtualFeedbackStats {
+	uint32_t texels;
+	uint32_t pages;
+	// Of pages, how many were already cached.
+	uint32_t resident;
+};
+
+// Turns a frame's feedback into the pages worth loading. Cached pages are touched so the LRU keeps them, and a page
+// that isn't cached touches the tile drawn in its place. Its missing ancestors are wanted too, so detail always
+// arrives coarse to fine. Requests come out coarsest first, then by how much of the screen wants them.
+class VirtualFeedbackAnalyser
+{
+public:
+	VirtualFeedbackAnalyser(const VirtualTextureSettings& settings);
+
+	const std::vector<VirtualTextureRequest>& analyse(const uint32_t* feedback, size_t count, VirtualTileCache& cache, uint64_t frame);
+
+	const VirtualFeedbackStats& getStats() const { return stats; }
+
+private:
+	uint32_t virtualPages;
+	uint32_t levelCount;
+
+	std::unordered_map<uint32_t, uint32_t> counts;
+	std::unordered_map<uint32_t, uint32_t> missing;
+	std::vector<VirtualTextureRequest> requests;
+	VirtualFeedbackStats stats{};
+};
@@ -0,0 +1,213 @@
+#include "VirtualTextureStreamer.h"
+#include <algorithm>
+#include <stdexcept>
+
+VirtualTextureStreamer::VirtualTextureStreamer(const std::string& path, const VirtualTextureLayout& layout, uint32_t ioThreads) :
+	settings(layout.settings),
+	file(path),
+	pageTable(layout.settings.virtualPages),
+	cache(layout.settings.cacheTiles * layout.settings.cacheTiles),
+	analyser(layout.settings)
+{
+	auto& fileSettings = file.getSettings();
+	if (fileSettings.tileSize != settings.tileSize || fileSettings.border != settings.border || fileSettings.virtualPages != settings.virtualPages) {
+		throw std::runtime_error("Virtual texture file " + path + " was cooked with different settings");
+	}
+
+	// At least one slot has to be left over for streaming into.
+	if (layout.regions.size() >= cache.getSlotCount()) {
+		throw std::runtime_error("Virtual texture cache is too small to pin every region");
+	}
+
+	std::ifstream stream(path, std::ios::binary);
+	for (auto& region : layout.regions) {
+		Load load{};
+		load.page = makeVirtualPage(region.maxLevel, region.pageX >> region.maxLevel, region.pageY >> region.maxLevel);
+		load.tile = file.findTile(load.page);
+		load.data.resize(settings.getTileBytes());
+
+		if (load.tile == VirtualTileFile::NO_TILE || !file.readTile(stream, load.tile, load.data.data())) {
+			throw std::runtime_error("Virtual texture file " + path + " is missing a region's last page");
+		}
+
+		uint32_t evicted;
+		uint32_t slot = cache.allocate(load.page, frame, evicted);
+		cache.pin(slot);
+		pageTable.map(load.page, slot % settings.cacheTiles, slot / settings.cacheTiles);
+
+		uploadBuffers.push_back(std::move(load.data));
+		uploads.push_back({ slot, slot % settings.cacheTiles, slot / settings.cacheTiles, uploadBuffers.back().data() });
+	}
+
+	for (uint32_t i = 0; i < std::max(1u, ioThreads); i++) {
+		threads.emplace_back(&VirtualTextureStreamer::threadMain, this);
+	}
+}
+
+VirtualTextureStreamer::~VirtualTextureStreamer()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	queued.notify_all();
+
+	for (auto& thread : threads) {
+		thread.join();
+	}
+}
+
+void VirtualTextureStreamer::threadMain()
+{
+	std::ifstream stream(file.getPath(), std::ios::binary);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		queued.wait(lock, [this] { return quit || !queue.empty(); });
+		if (quit)
+			return;
+
+		Load load = std::move(queue.front());
+		queue.pop_front();
+		reading++;
+
+		lock.unlock();
+		load.data.resize(settings.getTileBytes());
+		load.succeeded = file.readTile(stream, load.tile, load.data.data());
+		lock.lock();
+
+		completed.push_back(std::move(load));
+		reading--;
+
+		if (queue.empty() && reading == 0)
+			idle.notify_all();
+	}
+}
+
+void VirtualTextureStreamer::waitForLoads()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	idle.wait(lock, [this] { return queue.empty() && reading == 0; });
+}
+
+void VirtualTextureStreamer::place(Load& load)
+{
+	inFlight.erase(load.page);
+
+	uint32_t evicted;
+	uint32_t slot = load.succeeded ? cache.allocate(load.page, frame, evicted) : VirtualTileCache::NO_SLOT;
+	if (slot == VirtualTileCache::NO_SLOT) {
+		stats.dropped++;
+		freeBuffers.push_back(std::move(load.data));
+		return;
+	}
+
+	if (evicted != VIRTUAL_FEEDBACK_NONE) {
+		pageTable.unmap(evicted);
+		stats.evictions++;
+		stats.totalEvictions++;
+	}
+
+	uint32_t cacheX = slot % settings.cacheTiles;
+	uint32_t cacheY = slot / settings.cacheTiles;
+	pageTable.map(load.page, cacheX, cacheY);
+
+	uploadBuffers.push_back(std::move(load.data));
+	uploads.push_back({ slot, cacheX, cacheY, uploadBuffers.back().data() });
+
+	stats.loadsCompleted++;
+	stats.totalLoads++;
+	stats.averageLatencyFrames += static_cast<float>(frame - load.frame);
+}
+
+const std::vector<VirtualTileUpload>& VirtualTextureStreamer::update(const uint32_t* feedback, size_t count, LinearArena* scratch)
+{
+	// The construction time uploads go out with the first update.
+	if (frame > 0) {
+		uploads.clear();
+		for (auto& buffer : uploadBuffers) {
+			freeBuffers.push_back(std::move(buffer));
+		}
+		uploadBuffers.clear();
+	}
+	frame++;
+
+	uint64_t totalLoads = stats.totalLoads;
+	uint64_t totalEvictions = stats.totalEvictions;
+	stats = {};
+	stats.totalLoads = totalLoads;
+	stats.totalEvictions = totalEvictions;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		finished.swap(completed);
+	}
+
+	if (count) {
+		auto& requests = analyser.analyse(feedback, count, cache, frame);
+		stats.feedback = analyser.getStats();
+		stats.requested = static_cast<uint32_t>(requests.size());
+
+		ArenaVector<uint32_t> wanted(scratch);
+		wanted.reserve(requests.size());
+		for (auto& request : requests) {
+			wanted.push_back(request.page);
+		}
+		std::sort(wanted.begin(), wanted.end());
+
+		std::lock_guard<std::mutex> lock(mutex);
+
+		// Queued reads nobody wants any more make room for ones they do.
+		for (auto load = queue.begin(); load != queue.end();) {
+			if (std::binary_search(wanted.begin(), wanted.end(), load->page)) {
+				load++;
+				continue;
+			}
+
+			inFlight.erase(load->page);
+			freeBuffers.push_back(std::move(load->data));
+			load = queue.erase(load);
+			stats.dropped++;
+		}
+
+		for (auto& request : requests) {
+			if (stats.loadsStarted >= settings.maxRequestsPerFrame || inFlight.size() >= settings.maxRequestsInFlight)
+				break;
+
+			if (inFlight.count(request.page))
+				continue;
+
+			uint32_t tile = file.findTile(request.page);
+			if (tile == VirtualTileFile::NO_TILE)
+				continue;
+
+			Load load{};
+			load.page = request.page;
+			load.tile = tile;
+			load.frame = frame;
+			if (!freeBuffers.empty()) {
+				load.data = std::move(freeBuffers.back());
+				freeBuffers.pop_back();
+			}
+
+			queue.push_back(std::move(load));
+			inFlight.insert(request.page);
+			stats.loadsStarted++;
+		}
+	}
+	queued.notify_all();
+
+	// Finished loads land after the feedback has touched what's on screen, so they only evict tiles it didn't.
+	for (auto& load : finished) {
+		place(load);
+	}
+	finished.clear();
+
+	if (stats.loadsCompleted)
+		stats.averageLatencyFrames /= stats.loadsCompleted;
+
+	stats.inFlight = static_cast<uint32_t>(inFlight.size());
+	stats.cachedTiles = cache.getUsedSlots();
+
+	return uploads;
+}
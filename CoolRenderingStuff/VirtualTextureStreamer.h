@@ -0,0 +1,100 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_set>
+#include "VirtualTexture.h"
+#include "LinearArena.h"
+
+// A tile for the physical cache. data stays valid until the next update.
+struct VirtualTileUpload {
+	uint32_t slot;
+	uint32_t cacheX;
+	uint32_t cacheY;
+	const unsigned char* data;
+};
+
+struct VirtualTextureStreamStats {
+	VirtualFeedbackStats feedback;
+	// Counts for the last update.
+	uint32_t requested;
+	uint32_t loadsStarted;
+	uint32_t loadsCompleted;
+	uint32_t evictions;
+	// Loads thrown away: queued ones no longer asked for, or finished ones with nowhere to go this frame.
+	uint32_t dropped;
+	// Frames from asking for a tile to it landing, averaged over the loads that completed.
+	float averageLatencyFrames;
+
+	uint32_t inFlight;
+	uint32_t cachedTiles;
+	uint64_t totalLoads;
+	uint64_t totalEvictions;
+};
+
+// Keeps the physical cache and page table fed from a cooked tile file. Reads happen on I/O threads of its own,
+// update hands back what finished since the last one and queues what the feedback asks for next.
+// Each region's one page level is read up front and pinned, so every virtual texture always has something to show.
+class VirtualTextureStreamer
+{
+public:
+	VirtualTextureStreamer(const std::string& path, const VirtualTextureLayout& layout, uint32_t ioThreads = 2);
+	~VirtualTextureStreamer();
+
+	VirtualTextureStreamer(const VirtualTextureStreamer&) = delete;
+	VirtualTextureStreamer& operator=(const VirtualTextureStreamer&) = delete;
+
+	// Feedback is a frame's worth of page keys, or nothing on frames where none came back. The page table is up to date
+	// with the returned uploads, so both go to the GPU before the next draw. Temporaries come out of scratch if given.
+	const std::vector<VirtualTileUpload>& update(const uint32_t* feedback, size_t count, LinearArena* scratch = nullptr);
+	// Blocks until nothing is queued or being read, the next update picks up the results.
+	void waitForLoads();
+
+	VirtualPageTable& getPageTable() { return pageTable; }
+	const VirtualPageTable& getPageTable() const { return pageTable; }
+	const VirtualTileCache& getCache() const { return cache; }
+	const VirtualTextureSettings& getSettings() const { return settings; }
+	const VirtualTextureStreamStats& getStats() const { return stats; }
+
+private:
+	struct Load {
+		uint32_t page;
+		uint32_t tile;
+		uint64_t frame;
+		bool succeeded;
+		std::vector<unsigned char> data;
+	};
+
+	void threadMain();
+	void place(Load& load);
+
+	VirtualTextureSettings settings;
+	VirtualTileFile file;
+	VirtualPageTable pageTable;
+	VirtualTileCache cache;
+	VirtualFeedbackAnalyser analyser;
+	uint64_t frame = 0;
+
+	// Render thread only.
+	std::unordered_set<uint32_t> inFlight;
+	std::vector<std::vector<unsigned char>> freeBuffers;
+	std::vector<std::vector<unsigned char>> uploadBuffers;
+	std::vector<VirtualTileUpload> uploads;
+	// Swapped with completed every update, so neither has to grow again.
+	std::vector<Load> finished;
+	VirtualTextureStreamStats stats{};
+
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable queued;
+	std::condition_variable idle;
+	// Shared with the I/O threads, guarded by mutex.
+	bool quit = false;
+	std::deque<Load> queue;
+	std::vector<Load> completed;
+	uint32_t reading = 0;
+};
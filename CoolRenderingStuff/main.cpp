@@ -8,9 +8,6 @@
 #define GLFW_EXPOSE_NATIVE_WIN32
 #include <GLFW/glfw3native.h>
 
-#define STB_IMAGE_IMPLEMENTATION
-#include "vendor\stb\stb_image.h"
-
 #include <stdexcept>
 #include <iostream>
 #include <sstream>
@@ -21,17 +18,43 @@
 #include <thread>
 #include <unordered_map>
 #include <filesystem>
+#include <array>
+#include <algorithm>
+#include <chrono>
+#include <atomic>
 
 #include <DirectXMath.h>
 #include <DirectXColors.h>
 #include <d3dcompiler.h>
 
 #include "GraphicsPipeline.h"
-
-#include <assimp/Importer.hpp>
-#include <assimp/scene.h>
-#include <assimp/postprocess.h>
-#include <assimp/ProgressHandler.hpp>
+#include "StateCache.h"
+#include "GBufferLayout.h"
+#include "Scene.h"
+#include "SceneLoader.h"
+#include "JobSystem.h"
+#include "OcclusionCuller.h"
+#include "DrawOrder.h"
+#include "ViewCulling.h"
+#include "EnvironmentLighting.h"
+#include "GeometryPool.h"
+#include "ConstantBufferRing.h"
+#include "ShaderCache.h"
+#include "ShaderCompileService.h"
+#include "TexturePacker.h"
+#include "TextureCooker.h"
+#include "MipGenerator.h"
+#include "SceneStreamer.h"
+#include "TextureTilePool.h"
+#include "TextureStreamer.h"
+#include "VirtualTexture.h"
+#include "VirtualTextureStreamer.h"
+#include "ShadowCache.h"
+#include "AllocationTracer.h"
+#include "LinearArena.h"
+#include "ObjectPool.h"
+#include "TripleBuffer.h"
+#include "DynamicResolution.h"
 
 #include "vendor/imgui/imgui.h"
 #include "vendor/imgui/imgui_impl_glfw.h"
@@ -43,42 +66,41 @@ using namespace DirectX;
 
 #define PI 3.1415927f
 
-class AssimpProgressHandler : public Assimp::ProgressHandler {
-	virtual bool Update(float percentage) {
-		std::cout << "\rAssimp: " << std::fixed << std::setprecision(1) << percentage * 100.0f << std::defaultfloat << "%\tloaded.";
-		return true;
-	}
-};
+// Split screen goes up to quarters.
+static const uint32_t MAX_SPLIT_VIEWS = 4;
 
-struct Vertex {
-	XMFLOAT3 position;
-	XMFLOAT3 normal;
-	XMFLOAT3 tangent;
-	XMFLOAT3 bitangent;
-	XMFLOAT2 texcoord;
-};
+// Starting size of the frame arena, it grows to fit the busiest frame it has seen.
+static const size_t FRAME_ARENA_SIZE = 1024 * 1024;
+
+// How much wider than the screen the simulation culls, as a fraction of it. The camera can turn by about that much of
+// the view between a tick and the frame that draws it before anything pops in at the edges.
+static const float CULL_GUARD_BAND = 0.15f;
 
 struct GeometryBuffer {
 	enum Buffer {
-		POSITION,
-		NORMAL,
-		ALBEDO,
-		SPECULAR,
-		MAX_BUFFER,
+		POSITION = GBUFFER_POSITION,
+		NORMAL = GBUFFER_NORMAL,
+		ALBEDO = GBUFFER_ALBEDO,
+		SPECULAR = GBUFFER_SPECULAR,
+		MAX_BUFFER = GBUFFER_TARGET_COUNT,
 	};
 
-	const DXGI_FORMAT formats[MAX_BUFFER] = {
-		DXGI_FORMAT_R16G16B16A16_FLOAT,
-		DXGI_FORMAT_R16G16B16A16_SNORM,
-		DXGI_FORMAT_R8G8B8A8_UNORM_SRGB,
-		DXGI_FORMAT_R16G16B16A16_FLOAT,
-	};
+	GBufferLayout layout = GBufferLayout::Standard;
 
-	ID3D11Texture2D* textures[MAX_BUFFER];
-	ID3D11RenderTargetView* textureViews[MAX_BUFFER];
-	ID3D11ShaderResourceView* textureResourceViews[MAX_BUFFER];
+	// Targets the layout doesn't store are left null.
+	ID3D11Texture2D* textures[MAX_BUFFER] = {};
+	ID3D11RenderTargetView* textureViews[MAX_BUFFER] = {};
+	ID3D11ShaderResourceView* textureResourceViews[MAX_BUFFER] = {};
 
 	~GeometryBuffer() {
+		release();
+	}
+
+	DXGI_FORMAT format(size_t buffer) const {
+		return getGBufferLayoutDesc(layout).targets[buffer].format;
+	}
+
+	void release() {
 		for (size_t i = 0; i < MAX_BUFFER; i++) {
 			if (textureResourceViews[i])
 				textureResourceViews[i]->Release();
@@ -88,6 +110,10 @@ struct GeometryBuffer {
 
 			if (textures[i])
 				textures[i]->Release();
+
+			textureResourceViews[i] = nullptr;
+			textureViews[i] = nullptr;
+			textures[i] = nullptr;
 		}
 	}
 
@@ -98,109 +124,245 @@ struct GeometryBuffer {
 
 struct Mesh {
 	uint32_t materialId;
+	// Where its vertices and indices are in the geometry pool.
+	GeometryAllocation geometry;
+};
 
-	size_t numVertices;
-	ID3D11Buffer* vertices;
-
-	uint32_t indexCount;
-	ID3D11Buffer* indices;
+// One camera's part of the frame. Every view is culled in the same pass and shares the draw order, then each is recorded
+// into its own batches and light list on a worker, which the immediate context plays back one view after another.
+struct RenderView {
+	PerFrameUniforms uniforms;
+	// Where the view goes on the back buffer, the scissor keeping it out from under the menu bar. The simulation's.
+	ResolutionRect outputRect;
+	ResolutionRect outputScissor;
+	// The two above at the frame's resolution scale, filled in by the render thread.
+	D3D11_VIEWPORT viewport;
+	D3D11_RECT scissor;
+
+	DrawBatches batches;
+	std::vector<uint32_t> lights;
+	// Where its instance ids start in the per instance stream.
+	uint32_t firstInstance;
 };
 
-struct MaterialCbuffer {
-	// TODO WT: bit flags (though 16 byte alignment makes that redundant right now).
-	int useDiffuseTexture = false;
-	int useNormalTexture = false;
-	int useAlphaCutoutTexture = false;
-	int useSpecularTexture = false;
+// What the render thread sends the simulation each frame, a tick picks up whichever was sent last.
+struct SimulationInput {
+	float yaw = 0.0f;
+	float pitch = 0.0f;
+	// WASD, -1 to 1 along the camera's x and z.
+	float moveX = 0.0f;
+	float moveZ = 0.0f;
+	int width = 1;
+	int height = 1;
+	float menuHeight = 0.0f;
+
+	uint32_t viewCount = 1;
+	// Meshes uploaded so far, instances of the rest aren't drawn.
+	uint32_t drawableMeshes = 0;
+	DepthPrepassMode depthPrepassMode = DepthPrepassMode::Prepass;
+	bool instancingEnabled = true;
+	bool cullLightsByRadius = false;
+	bool occlusionCullingEnabled = true;
+	bool occlusionUseAVX2 = true;
+
+	// The menu's offset for editNode, bumped editSelection whenever it picks another node so the offset starts again.
+	int editNode = 0;
+	uint32_t editSelection = 0;
+	XMFLOAT3 editNodeOffset{};
+
+	int simulationHz = 120;
 };
 
-struct Material {
-	std::string name;
-	std::string diffuseTexture;
-	std::string normalTexture;
-	std::string alphaCutoutTexture;
-	std::string specularTexture;
-	MaterialCbuffer settings;
+// One tick of the simulation, everything the render thread needs to draw it. The slots of the triple buffer it goes
+// through are reused, so once they've grown to fit a tick fills one in without allocating.
+struct FrameSnapshot {
+	uint64_t sequence = 0;
+	// glfwGetTime when the tick ran, the frame that draws it is this far behind.
+	double time = 0.0;
+	XMFLOAT3 cameraPosition{};
+
+	// Culled with the camera as the tick saw it, a guard band wider than the screen. The render thread turns the views'
+	// matrices to the latest mouse input before drawing.
+	std::vector<RenderView> views;
+	std::vector<ViewFrustum> viewFrustums;
+	// Instances then, when culled by radius, lights.
+	CullBounds viewBounds;
+	std::vector<Light> lights;
+
+	// Only copied into a slot when graphVersion has moved on since it last held them.
+	uint64_t graphVersion = 0;
+	std::vector<MeshBounds> instanceBounds;
+	std::vector<XMFLOAT4X4> instanceWorlds;
+	// Empty until the occlusion culler is built.
+	std::vector<uint8_t> instanceVisibility;
+
+	size_t opaqueInstances = 0;
+	size_t alphaTestedInstances = 0;
+	SceneGraphStats graphStats{};
+	OcclusionStats occlusionStats{};
+	double cullMs = 0.0;
+	double recordMs = 0.0;
+	double tickMs = 0.0;
+	AllocationCounts allocations{};
 };
 
-struct Texture {
-	std::string name;
+// One packed array from the TexturePacker, every material texture is a slice or an atlas rect in one of these.
+struct TextureArray {
 	ID3D11Texture2D* texture;
 	ID3D11ShaderResourceView* textureSRV;
-	ID3D11SamplerState* sampler;
-
-	Texture(ID3D11Device* device, ID3D11DeviceContext* context, std::string name,  int width, int height, int bpp, unsigned char* data): name(name) {
-		auto format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	// Slices go in in order, a streamed array only has this many filled in so far.
+	uint32_t uploadedSlices = 0;
+
+	// Only set on a tiled array. Its full slices only ever have the packed tail uploaded with them,
+	// the levels above it are mapped and filled by loadLevel as the TextureStreamer asks for them.
+	TextureTilePool* tilePool = nullptr;
+	TextureTiling tiling{};
+	uint32_t mipLevels;
+	uint32_t fullSlices;
+	// Pool tiles behind each slice's levels, the tail's are kept on its first level.
+	std::vector<std::vector<uint32_t>> mappedTiles;
+
+	// A streamed array starts out empty and gets its slices from uploadSlice, a frame's upload budget at a time.
+	TextureArray(ID3D11Device* device, const std::string& name, const TexturePackArray& data, bool streamed = false, TextureTilePool* tilePool = nullptr) :
+		tilePool(tilePool),
+		mipLevels(data.mipLevels),
+		fullSlices(static_cast<uint32_t>(data.slices.size()) - data.atlasSlices)
+	{
+		// Cooked masks come in with one or two channels.
+		auto format = data.channels == 1 ? DXGI_FORMAT_R8_UNORM : (data.channels == 2 ? DXGI_FORMAT_R8G8_UNORM : DXGI_FORMAT_R8G8B8A8_UNORM);
 
 		D3D11_TEXTURE2D_DESC desc;
-		desc.Width = width;
-		desc.Height = height;
-		desc.MipLevels = 0;
-		desc.ArraySize = 1;
+		desc.Width = data.width;
+		desc.Height = data.height;
+		desc.MipLevels = data.mipLevels;
+		desc.ArraySize = static_cast<UINT>(data.slices.size());
 		desc.Format = format;
 		desc.SampleDesc.Count = 1;
 		desc.SampleDesc.Quality = 0;
-		desc.Usage = D3D11_USAGE_DEFAULT;
-		desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_RENDER_TARGET;
+		desc.Usage = streamed || tilePool ? D3D11_USAGE_DEFAULT : D3D11_USAGE_IMMUTABLE;
+		desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
 		desc.CPUAccessFlags = 0;
-		desc.MiscFlags = D3D11_RESOURCE_MISC_GENERATE_MIPS;
+		desc.MiscFlags = tilePool ? D3D11_RESOURCE_MISC_TILED : 0;
+
+		// Every level comes mipped from the MipGenerator, nothing is left to do on the GPU.
+		std::vector<D3D11_SUBRESOURCE_DATA> initialData(static_cast<size_t>(data.mipLevels) * data.slices.size());
+		for (UINT slice = 0; slice < data.slices.size() && !streamed; slice++) {
+			for (UINT level = 0; level < data.mipLevels; level++) {
+				auto& subresource = initialData[D3D11CalcSubresource(level, slice, data.mipLevels)];
+				subresource.pSysMem = data.slices[slice][level].data();
+				subresource.SysMemPitch = getRowPitch(data, level);
+				subresource.SysMemSlicePitch = 0;
+			}
+		}
 
-		auto hr = device->CreateTexture2D(&desc, nullptr, &texture);
+		auto hr = device->CreateTexture2D(&desc, streamed || tilePool ? nullptr : initialData.data(), &texture);
 		if (FAILED(hr)) {
-			throw std::runtime_error("Failed to create texture2D!");
+			throw std::runtime_error("Failed to create texture2D array!");
 		}
 
 		texture->SetPrivateData(WKPDID_D3DDebugObjectName, name.size(), name.c_str());
 
-		context->UpdateSubresource(texture, 0, NULL, data, width * 4 * sizeof(unsigned char), 0);
-
 		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc{};
 		srvDesc.Format = format;
-		srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
-		srvDesc.Texture2D.MipLevels = -1;
-		srvDesc.Texture2D.MostDetailedMip = 0;
+		srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2DARRAY;
+		srvDesc.Texture2DArray.MipLevels = -1;
+		srvDesc.Texture2DArray.MostDetailedMip = 0;
+		srvDesc.Texture2DArray.FirstArraySlice = 0;
+		srvDesc.Texture2DArray.ArraySize = desc.ArraySize;
 
 		hr = device->CreateShaderResourceView(texture, &srvDesc, &textureSRV);
 		if (FAILED(hr)) {
-			throw std::runtime_error("Failed to create SRV to texture2D!");
+			throw std::runtime_error("Failed to create SRV to texture2D array!");
 		}
 
-		context->GenerateMips(textureSRV);
-
-		D3D11_SAMPLER_DESC samplerDesc{};
-		samplerDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
-		samplerDesc.AddressU = D3D11_TEXTURE_ADDRESS_WRAP;
-		samplerDesc.AddressV = D3D11_TEXTURE_ADDRESS_WRAP;
-		samplerDesc.AddressW = D3D11_TEXTURE_ADDRESS_WRAP;
-		samplerDesc.MipLODBias = 0.0f;
-		samplerDesc.MaxAnisotropy = 1;
-		samplerDesc.ComparisonFunc = D3D11_COMPARISON_ALWAYS;
-		samplerDesc.BorderColor[0] = 0.0f;
-		samplerDesc.BorderColor[1] = 0.0f;
-		samplerDesc.BorderColor[2] = 0.0f;
-		samplerDesc.BorderColor[3] = 0.0f;
-		samplerDesc.MinLOD = 0.0f;
-		samplerDesc.MaxLOD = D3D11_FLOAT32_MAX;
+		uploadedSlices = streamed ? 0 : desc.ArraySize;
 
-		if (FAILED(device->CreateSamplerState(&samplerDesc, &sampler))) {
-			throw std::runtime_error("Failed to create gbuffer sampler");
+		if (tilePool) {
+			tiling = tilePool->getTiling(texture, mipLevels);
+			mappedTiles.resize(static_cast<size_t>(mipLevels) * desc.ArraySize);
 		}
 	}
 
-	~Texture() {
+	~TextureArray() {
 		textureSRV->Release();
 		texture->Release();
-		sampler->Release();
+	}
+
+	// Worth tiling when there are full slices to stream and their smallest levels pack into a tail that can stay resident.
+	static bool canTile(const TexturePackArray& data) {
+		return data.atlasSlices < data.slices.size() && data.mipLevels > 1 && (std::min(data.width, data.height) >> (data.mipLevels - 1)) < 128;
+	}
+
+	bool isStreamedSlice(uint32_t slice) const {
+		return tilePool && slice < fullSlices;
+	}
+
+	UINT getFirstUploadLevel(uint32_t slice) const {
+		return isStreamedSlice(slice) ? tiling.packedLevel : 0;
+	}
+
+	// Every level of the next slice, or just the tail of a streamed one. data has to be what the array was created from.
+	void uploadSlice(ID3D11DeviceContext* context, const TexturePackArray& data) {
+		UINT slice = uploadedSlices++;
+		UINT firstLevel = getFirstUploadLevel(slice);
+
+		if (tilePool) {
+			for (UINT level = firstLevel; level < tiling.packedLevel; level++) {
+				tilePool->map(texture, D3D11CalcSubresource(level, slice, mipLevels), tiling.levelTiles[level], getMappedTiles(slice, level));
+			}
+			if (tiling.packedLevel < mipLevels) {
+				tilePool->map(texture, D3D11CalcSubresource(tiling.packedLevel, slice, mipLevels), tiling.packedTiles, getMappedTiles(slice, tiling.packedLevel));
+			}
+		}
+
+		for (UINT level = firstLevel; level < data.mipLevels; level++) {
+			context->UpdateSubresource(texture, D3D11CalcSubresource(level, slice, data.mipLevels), nullptr, data.slices[slice][level].data(), getRowPitch(data, level), 0);
+		}
+	}
+
+	// One level above the tail of a streamed slice, mapped and filled or unmapped and given back to the pool.
+	void loadLevel(ID3D11DeviceContext* context, const TexturePackArray& data, uint32_t slice, uint32_t level) {
+		UINT subresource = D3D11CalcSubresource(level, slice, mipLevels);
+		tilePool->map(texture, subresource, tiling.levelTiles[level], getMappedTiles(slice, level));
+		context->UpdateSubresource(texture, subresource, nullptr, data.slices[slice][level].data(), getRowPitch(data, level), 0);
+	}
+
+	void evictLevel(uint32_t slice, uint32_t level) {
+		tilePool->unmap(texture, D3D11CalcSubresource(level, slice, mipLevels), getMappedTiles(slice, level));
+	}
+
+	std::vector<uint32_t>& getMappedTiles(uint32_t slice, uint32_t level) {
+		return mappedTiles[D3D11CalcSubresource(level, slice, mipLevels)];
+	}
+
+	// Tiles the array has mapped once every slice is uploaded: tails for the full slices, everything for the atlas pages.
+	uint32_t getUploadedTiles() const {
+		uint32_t slices = static_cast<uint32_t>(mappedTiles.size() / mipLevels);
+
+		uint32_t levelTiles = 0;
+		for (uint32_t tiles : tiling.levelTiles) {
+			levelTiles += tiles;
+		}
+		return slices * tiling.packedTiles + (slices - fullSlices) * levelTiles;
+	}
+
+	static UINT getRowPitch(const TexturePackArray& data, UINT level) {
+		return std::max(1u, data.width >> level) * data.channels * sizeof(unsigned char);
+	}
+
+	uint64_t getUploadBytes(const TexturePackArray& data, uint32_t slice) const {
+		uint64_t bytes = 0;
+		for (uint32_t level = getFirstUploadLevel(slice); level < data.mipLevels; level++) {
+			bytes += data.slices[slice][level].size();
+		}
+		return bytes;
 	}
 };
 
-struct PerFrameUniforms {
-	XMFLOAT2 screenDimensions;
-	float pad[2];
-	XMFLOAT3 eyePos;
-	float pad3;
-	DirectX::XMMATRIX view;
-	DirectX::XMMATRIX viewProj;
+// What the material constant buffer holds, in deferredCommon.hlsli's order.
+struct MaterialConstants {
+	MaterialCbuffer settings;
+	MaterialTextureTable textures;
 };
 
 class Application {
@@ -284,6 +446,34 @@ public:
 		return buffer;
 	}
 
+	static bool compileShader(const ShaderKey& key, std::vector<char>& bytecode, std::string& errors) {
+		std::vector<D3D_SHADER_MACRO> macros;
+		for (auto& define : key.defines) {
+			macros.push_back({ define.name.c_str(), define.value.c_str() });
+		}
+		macros.push_back({ nullptr, nullptr });
+
+		ID3D10Blob* blob = nullptr;
+		ID3D10Blob* errorBlob = nullptr;
+
+		auto path = std::filesystem::path(key.path).wstring();
+		auto hr = D3DCompileFromFile(path.c_str(), macros.data(), D3D_COMPILE_STANDARD_FILE_INCLUDE, key.entryPoint.c_str(), key.target.c_str(), D3DCOMPILE_OPTIMIZATION_LEVEL3, 0, &blob, &errorBlob);
+
+		if (errorBlob) {
+			errors.assign(static_cast<char*>(errorBlob->GetBufferPointer()), errorBlob->GetBufferSize());
+			errorBlob->Release();
+		}
+
+		if (FAILED(hr))
+			return false;
+
+		auto data = static_cast<char*>(blob->GetBufferPointer());
+		bytecode.assign(data, data + blob->GetBufferSize());
+		blob->Release();
+
+		return true;
+	}
+
 public:
 protected:
 private:
@@ -294,94 +484,444 @@ private:
 	uint32_t numSwapChainBuffers;
 	IDXGISwapChain* swapChain;
 	DXGI_FORMAT swapChainFormat = DXGI_FORMAT_UNKNOWN;
+	// Flip model swap chains hand D3D11 the current buffer as buffer 0, so one view does for every frame until a resize.
+	ID3D11RenderTargetView* backBufferRTV = nullptr;
+
+	// Dynamic resolution. The G-buffer and depth stay window sized and a frame renders into the top left of them at the
+	// controller's scale, lights it into the accumulation target and stretches that over the back buffer. Off, the
+	// lights go straight to the back buffer as before.
+	bool dynamicResolutionEnabled = false;
+	DynamicResolutionController resolutionController;
+	ResolutionFrame resolutionFrame{};
+	// The whole back buffer, where the upscale draws. Latched with the views.
+	D3D11_VIEWPORT outputViewport{};
+	D3D11_RECT outputScissor{};
+	ID3D11Texture2D* lightAccumulationTexture = nullptr;
+	ID3D11RenderTargetView* lightAccumulationRTV = nullptr;
+	ID3D11ShaderResourceView* lightAccumulationSRV = nullptr;
+	GraphicsPipeline* upscaleGraphicsPipeline;
+
+	// The GPU's time from the shadows to the upscale, read back GPU_TIMER_LATENCY frames later so it never stalls.
+	// It's what the controller is fed, ImGui and Present are left out.
+	static const uint32_t GPU_TIMER_LATENCY = 4;
+	struct GpuTimer {
+		ID3D11Query* disjoint;
+		ID3D11Query* begin;
+		ID3D11Query* end;
+	};
+	GpuTimer gpuTimers[GPU_TIMER_LATENCY] = {};
+	uint64_t gpuTimersIssued = 0;
+	uint64_t gpuTimersRead = 0;
+	float gpuFrameMs = 0.0f;
+
+	// Owns every state object and pipeline below, pipelines come back shared when their descs match.
+	StateCache* stateCache;
+	PipelineBindState bindState;
+	// What each pipeline was requested with, hot reload asks for them again with the new bytecode.
+	std::unordered_map<GraphicsPipeline*, GraphicsPipelineDesc> graphicsPipelineDescs;
 
 	GraphicsPipeline *deferredGraphicsPipeline;
 	GraphicsPipeline *lightingGraphicsPipeline;
+	// The lighting pipeline with the ambient shader, drawn once under each view's lights.
+	GraphicsPipeline *ambientGraphicsPipeline;
+
+	// Depth only pipelines for the prepass, opaque meshes have no pixel shader at all.
+	GraphicsPipeline *depthPrepassGraphicsPipeline;
+	GraphicsPipeline *depthPrepassAlphaGraphicsPipeline;
+	// Swapped in over the deferred pipeline's depth state once the prepass has laid down depth.
+	ID3D11DepthStencilState* depthEqualState;
 
 	ID3D11Texture2D* depthTexture;
 	ID3D11DepthStencilView* depthStencilView;
+	ID3D11ShaderResourceView* depthResourceView;
 
-	float yaw;
-	float pitch;
-
-	XMFLOAT3 cameraPosition = { 0.0f, 1.5f, 0.0f };
+	// Moved by the cursor callback, sent to the simulation and read again just before drawing.
+	float yaw = 0.0f;
+	float pitch = 0.0f;
 
+	// Mapped with DISCARD for each view a pass draws. Kept out of the ring so it stays bound through fallback mode uploads.
 	ID3D11Buffer* perFrameUniformsBuffer;
-	PerFrameUniforms perFrameUniforms;
 
-	ID3D11Buffer* perMaterialUniformsBuffer;
+	// Split screen, view i looking i / count of a turn further round than the camera. The first view is the main one,
+	// only it is occlusion culled and drawn into the virtual texture feedback.
+	uint32_t viewCount = 1;
+	// The light shader ignores radius, so like the software renderer's tile culling it's not an exact match and is off.
+	bool cullLightsByRadius = false;
+	float mainMenuHeight = 0.0f;
+
+	// Camera, light animation, the scene graph, culling and binning run on the simulation thread at simulationHz, each
+	// tick handed over in a FrameSnapshot so a slow tick never holds up Present and a slow frame never holds up a tick.
+	// The render thread sends its input and settings back the same way. Until stopSimulation the members below up to
+	// the render thread's side are the simulation's, and the scene arrays it reads are only changed with it stopped.
+	std::thread simulationThread;
+	std::atomic<bool> simulationQuit{ false };
+	std::atomic<bool> simulationFailed{ false };
+	std::string simulationError;
+	TripleBuffer<FrameSnapshot> snapshots;
+	TripleBuffer<SimulationInput> simulationInputs;
+	int simulationHz = 120;
+
+	XMFLOAT3 cameraPosition = { 0.0f, 1.5f, 0.0f };
+	double simulationTime = 0.0;
+	uint64_t simulationTicks = 0;
+	// One mask per bound in the snapshot's viewBounds, with a bit per view.
+	std::vector<uint32_t> viewMasks;
+	// Bumped whenever an instance moves, snapshots only copy the instances when it has.
+	uint64_t graphVersion = 0;
+	int editedNode = 0;
+	uint32_t editedSelection = 0;
+	XMFLOAT3 appliedNodeOffset{};
+	// Tick temporaries, reset after each one.
+	LinearArena* simulationArena;
+	AllocationCounter simulationAllocations;
+
+	// The render thread's side. frame is the latest tick, drawn again with the camera turned when no newer one is in.
+	FrameSnapshot* frame = nullptr;
+	uint64_t snapshotsDrawn = 0;
+	uint64_t snapshotsSkipped = 0;
+	uint64_t snapshotsRepeated = 0;
+	double snapshotAgeMs = 0.0;
+	// The instances' bounds and world matrices as the shadow cache and the GPU last saw them.
+	std::vector<MeshBounds> casterBounds;
+	uint64_t uploadedGraphVersion = 0;
+	bool occlusionUseAVX2 = OcclusionCuller::hasAVX2();
+
+	// Per draw constants come out of the ring, material settings only change while textures stream in.
+	ConstantBufferRing* constantRing;
+	ImmutableConstantArray* materialConstants = nullptr;
 
 	ID3D11SamplerState* gbufferSampler;
+	ID3D11SamplerState* environmentSampler;
+	// Every material texture samples the same way, bound to all four slots once per pass.
+	ID3D11SamplerState* materialSampler;
 	GeometryBuffer geometryBuffer;
 
-	std::unordered_map<std::string, Texture*> textureCache;
+	// The placeholder array first, the streamed pack's arrays after it. The records themselves sit together in the pool.
+	ObjectPool<TextureArray, 16> textureArrayPool;
+	std::vector<TextureArray*> textureArrays;
+	std::vector<PackedMaterial> packedMaterials;
+	TexturePackStats texturePackStats{};
+	TextureCookStats textureCookStats{};
+	MipGenerationStats mipGenerationStats{};
 
+	// Arrays currently in t0-t3, a draw only rebinds when it needs a different one.
+	uint32_t boundTextureArrays[MATERIAL_TEXTURE_COUNT];
+	uint64_t textureArrayBinds = 0;
+	uint64_t materialDraws = 0;
+
+	// One per unique mesh, copies of a mesh are instances of it.
 	std::vector<Mesh> loadedMesh;
+	GeometryPool* geometryPool;
+	// This frame's draws and how many of them had to bind a different page.
+	uint64_t geometryDraws = 0;
+	uint64_t geometryBinds = 0;
 	std::vector<Material> loadedMaterials;
 
+	// One entry per instance, all there from the import on. An instance is drawn once its mesh is uploaded.
+	// Bounds, world matrices and drawable flags are the simulation's, the render thread draws the snapshot's.
+	std::vector<MeshBounds> instanceBounds;
+	std::vector<uint8_t> instanceAlphaTested;
+	std::vector<uint32_t> instanceMeshes;
+	std::vector<uint8_t> instanceDrawable;
+
+	// Every instance's node and every mesh's local bounds, so bounds and world matrices can follow the graph when a node moves.
+	SceneGraph sceneGraph;
+	std::vector<MeshInstance> sceneInstances;
+	std::vector<MeshBounds> meshLocalBounds;
+	MeshInstancingStats instancingStats{};
+	AmbientOcclusionStats occlusionStats{};
+	size_t importScratchUsed = 0;
+
+	// One world matrix per instance in a structured buffer. Each frame the visible instances' indices are written out view by
+	// view and batch by batch into a per instance stream, each draw's start instance pointing at its batch's run of them.
+	std::vector<XMFLOAT4X4> instanceWorlds;
+	ID3D11Buffer* instanceWorldBuffer = nullptr;
+	ID3D11ShaderResourceView* instanceWorldSRV = nullptr;
+	ID3D11Buffer* instanceIndexBuffer = nullptr;
+	// Off draws every instance on its own, for comparison.
+	bool instancingEnabled = true;
+
+	int editNode = 0;
+	uint32_t editSelection = 0;
+	XMFLOAT3 editNodeOffset{};
+
+	ShaderCache* shaderCache;
+	ShaderCompileService* shaderCompiler;
+
+	// What each watched shader feeds, same order as the keys handed to the compile service.
+	struct WatchedShader {
+		enum Use {
+			DeferredVertex,
+			DeferredPixel,
+			DepthPrepassAlphaPixel,
+			LightAccVertex,
+			LightAccPixel,
+			AmbientPixel,
+			DeferredPermutation,
+			VirtualFeedbackPixel,
+			UpscalePixel,
+		};
+
+		Use use;
+		uint32_t features;
+	};
+
+	std::vector<WatchedShader> watchedShaders;
+	uint32_t lastShaderBatchSize = 0;
+	double lastShaderBatchMs = 0.0;
+
+	// G-buffer pixel shader per MaterialFeature combination the scene uses. Missing ones fall back to the pipeline's shader.
+	bool shaderPermutationsEnabled = true;
+	std::unordered_map<uint32_t, ID3D11PixelShader*> deferredPixelVariants;
+	std::vector<uint32_t> materialFeatures;
+
+	DepthPrepassMode depthPrepassMode = DepthPrepassMode::Prepass;
+	// Every view's visible instances, each view's batches are filtered out of it. The simulation's.
+	DrawOrder drawOrder;
+
+	// G-buffer pass pixel shader invocations, read back whenever the GPU has them.
+	ID3D11Query* pipelineStatisticsQuery;
+	bool pipelineStatisticsPending = false;
+	uint64_t gbufferPixelShaderInvocations = 0;
+
 	Lighting* lighting;
 
+	// Animated by the simulation, the render thread lights with the snapshot's.
 	std::vector<Light> lights;
 
+	// Baked from the probe at startup, or just the first light's ambient with a black specular cube when it won't load.
+	EnvironmentLighting environment;
+	EnvironmentBakeStats environmentStats{};
+	bool environmentBaked = false;
+	ID3D11Texture2D* environmentTexture;
+	ID3D11ShaderResourceView* environmentSRV;
+	float diffuseAmbientScale = 1.0f;
+	float specularAmbientScale = 1.0f;
+
+	// Cube shadows for every light in one depth atlas, redrawn a few faces a frame as lights and casters move.
+	ShadowCache* shadowCache;
+	bool shadowsEnabled = true;
+	int shadowFaceBudget;
+	ID3D11Texture2D* shadowAtlasTexture;
+	ID3D11DepthStencilView* shadowAtlasDSV;
+	ID3D11ShaderResourceView* shadowAtlasSRV;
+	ID3D11SamplerState* shadowSampler;
+	GraphicsPipeline* shadowGraphicsPipeline;
+	GraphicsPipeline* shadowAlphaGraphicsPipeline;
+	GraphicsPipeline* shadowClearGraphicsPipeline;
+	// The faces' instance ids, separate from the views' so neither has to make room for the other.
+	ID3D11Buffer* shadowInstanceBuffer = nullptr;
+	uint32_t shadowInstanceCapacity = 0;
+	std::vector<uint8_t> lightVisible;
+	std::vector<float> lightScreenRadius;
+	std::vector<ViewFrustum> shadowFrustums;
+	std::vector<uint32_t> shadowMasks;
+	std::vector<uint8_t> shadowDrawable;
+	DrawOrder shadowOrder;
+	std::vector<DrawBatches> shadowBatches;
+	std::vector<uint32_t> shadowFirstInstances;
+	uint32_t shadowDraws = 0;
+	double shadowRecordMs = 0.0;
+
+	// The simulation's, only one thread can hand it work at a time.
+	JobSystem* jobs;
+
+	// Built once every mesh is in, a half loaded scene would cull against occluders that aren't drawn yet. Culls on the simulation.
+	OcclusionCuller* occlusionCuller = nullptr;
+	bool occlusionCullingEnabled = true;
+	std::vector<uint8_t> instanceVisibility;
+
+	// Loading happens on the streamer, the render thread uploads whatever it has handed over up to the budget each frame.
+	SceneStreamer* sceneStreamer;
+	SceneData streamedGeometry;
+	size_t streamedMeshCount = 0;
+	// Baked vertices for the meshes that were already up when the occlusion came in, rewritten in order.
+	std::vector<std::vector<Vertex>> occlusionVertices;
+	size_t nextOcclusionUpload = 0;
+	bool occlusionStreamed = false;
+	TexturePack streamedPack;
+	bool texturesStreamed = false;
+	uint32_t nextArrayUpload = 0;
+	// What each material switches to from the placeholders once every slice it reads is uploaded.
+	std::vector<PackedMaterial> streamedMaterials;
+	std::vector<uint8_t> materialStreamed;
+	bool sceneLoaded = false;
+
+	int uploadBudgetMB = 16;
+	uint64_t uploadedBytesThisFrame = 0;
+	uint64_t uploadedBytesTotal = 0;
+
+	std::chrono::steady_clock::time_point loadStart;
+	double firstFrameMs = 0.0;
+	double firstGeometryMs = 0.0;
+	double fullyLoadedMs = 0.0;
+
+	// Tiled arrays' full slices keep only their tails resident, the streamer maps the levels above as the view needs them.
+	// Without tier 2 tiled resources every array is uploaded whole as before and nothing streams.
+	TextureTilePool* tilePool;
+	TextureStreamer* textureStreamer = nullptr;
+	uint32_t tilePoolBaseTiles = 0;
+	int textureBudgetMB = 128;
+
+	// What each streamed texture is, in streamer order. Its entry in the min lod buffer is one past its index.
+	struct StreamedTextureSlot {
+		uint32_t array;
+		uint32_t slice;
+	};
+
+	std::vector<StreamedTextureSlot> streamedTextureSlots;
+
+	ID3D11Buffer* textureMinLodBuffer = nullptr;
+	ID3D11ShaderResourceView* textureMinLodSRV = nullptr;
+
+	// The pack's big colour textures streamed a tile at a time into one cache texture, driven by a low resolution feedback pass.
+	// Switched on from the menu. Their arrays stay resident either way, so switching back off is instant.
+	VirtualTextureLayout virtualLayout;
+	VirtualTextureCookStats virtualCookStats{};
+	VirtualTextureStreamer* virtualStreamer = nullptr;
+	bool virtualTexturingEnabled = false;
+	uint32_t virtualTileUploads = 0;
+
+	ID3D11Texture2D* virtualCacheTexture = nullptr;
+	ID3D11ShaderResourceView* virtualCacheSRV = nullptr;
+	ID3D11Texture2D* virtualPageTableTexture = nullptr;
+	ID3D11ShaderResourceView* virtualPageTableSRV = nullptr;
+
+	// Page keys at 1/feedbackScale of the screen. Each frame's copy is read back VIRTUAL_FEEDBACK_LATENCY frames later, so mapping it never stalls.
+	static const uint32_t VIRTUAL_FEEDBACK_LATENCY = 3;
+	GraphicsPipeline* virtualFeedbackPipeline;
+	ID3D11Texture2D* virtualFeedbackTexture = nullptr;
+	ID3D11RenderTargetView* virtualFeedbackRTV = nullptr;
+	ID3D11Texture2D* virtualFeedbackDepth = nullptr;
+	ID3D11DepthStencilView* virtualFeedbackDSV = nullptr;
+	ID3D11Texture2D* virtualFeedbackStaging[VIRTUAL_FEEDBACK_LATENCY] = {};
+	uint32_t virtualFeedbackWidth = 0;
+	uint32_t virtualFeedbackHeight = 0;
+	uint64_t virtualFeedbackCopies = 0;
+	std::vector<uint32_t> virtualFeedback;
+
+	uint32_t frameIndex = 0;
+
+	// Frame temporaries, reset after Present. Once the scene is in and the arena has grown to fit, a frame shouldn't touch the heap.
+	LinearArena* frameArena;
+	AllocationCounter frameAllocations;
+	AllocationCounts lastFrameAllocations{};
+	uint32_t allocationFreeFrames = 0;
+
 public:
 	Application() {
+		loadStart = std::chrono::steady_clock::now();
+
 		createWindow();
 		createDeviceAndSwapChain();
 		initImgui();
+
+		stateCache = new StateCache(device);
+		shaderCache = new ShaderCache("shaders/cache", compileShader);
+
 		createDeferredGraphicsPipeline();
 		createLightingGraphicsPipeline();
+		createMaterialSampler();
 		createConstantBuffers();
 		createGbuffers();
+		createLightAccumulationTarget();
+		createQueries();
 
-		loadModel();
+		jobs = new JobSystem();
+		frameArena = new LinearArena(FRAME_ARENA_SIZE);
+		simulationArena = new LinearArena(FRAME_ARENA_SIZE);
 
-		lighting = new Lighting(device);
+		createPlaceholderTextures();
+		createTextureMinLods({ 0.0f });
+		tilePool = new TextureTilePool(device, context);
+		sceneStreamer = new SceneStreamer("assets/crytekSponza_fbx/", "sponza.fbx", std::max(1u, std::thread::hardware_concurrency() / 2));
 
-		XMVECTOR colors[] = {
-			Colors::Red,
-			Colors::Green,
-			Colors::Blue,
-			Colors::Cyan,
-			Colors::Magenta,
-			Colors::Yellow,
-		};
+		shaderCompiler = new ShaderCompileService(*shaderCache, std::max(1u, std::thread::hardware_concurrency() / 2));
+		watchShaders();
+
+		lighting = new Lighting(device);
 
-		lights.push_back(Light(XMFLOAT3(0.0f, 1.0f, 0.0f), 2.0f, XMFLOAT3(1.0f, 1.0f, 1.0f), 1.0f, XMFLOAT4(0.1f, 0.1f, 0.1f, 1.0f)));
+		lights = createSceneLights();
+		createEnvironmentLighting();
+		createShadowAtlas();
 
-		for (size_t i = 1; i < 50; i++)
-		{
-			float rand0 = (float)rand() / RAND_MAX;
-			float rand1 = (float)rand() / RAND_MAX;
-			float rand2 = (float)rand() / RAND_MAX;
-			lights.push_back(Light(
-				XMFLOAT3 { rand0 * 30.0f - 15.0f, rand2 * 10.0f, rand1 * 20.0f - 10.0f },
-				5.0f,
-				XMFLOAT3 { 1.0f, 1.0f, 1.0f },
-				1.0f,
-				XMFLOAT4 { 0.0f, 0.0f, 0.0f, 0.0f}
-			));
-			XMStoreFloat3(&lights[i].color, colors[i % 6]);
-		}
+		// The first frame draws the first tick, so it's simulated here before the thread takes over.
+		sendSimulationInput();
+		simulateTick();
+		startSimulation();
 	}
 
 	~Application() {
-		for (auto texture : textureCache) {
-			delete texture.second;
+		stopSimulation();
+
+		delete sceneStreamer;
+
+		delete textureStreamer;
+
+		if (virtualStreamer) {
+			releaseVirtualFeedbackTargets();
+			virtualCacheSRV->Release();
+			virtualCacheTexture->Release();
+			virtualPageTableSRV->Release();
+			virtualPageTableTexture->Release();
+		}
+		delete virtualStreamer;
+
+		for (auto array : textureArrays) {
+			textureArrayPool.destroy(array);
 		}
+		delete tilePool;
 
-		for (auto mesh : loadedMesh) {
-			mesh.vertices->Release();
-			mesh.indices->Release();
+		textureMinLodSRV->Release();
+		textureMinLodBuffer->Release();
+
+		if (instanceWorldBuffer) {
+			instanceWorldSRV->Release();
+			instanceWorldBuffer->Release();
+			instanceIndexBuffer->Release();
 		}
+
+		delete geometryPool;
 		delete lighting;
 
-		delete lightingGraphicsPipeline;
-		delete deferredGraphicsPipeline;
+		environmentSRV->Release();
+		environmentTexture->Release();
+
+		if (shadowInstanceBuffer)
+			shadowInstanceBuffer->Release();
+		shadowAtlasSRV->Release();
+		shadowAtlasDSV->Release();
+		shadowAtlasTexture->Release();
+		delete shadowCache;
+
+		delete materialConstants;
+		delete constantRing;
+
+		delete shaderCompiler;
+		releaseMaterialPermutations();
+		delete shaderCache;
+
+		delete occlusionCuller;
+		delete jobs;
+		delete frameArena;
+		delete simulationArena;
+
+		delete stateCache;
+
+		pipelineStatisticsQuery->Release();
+		for (auto& timer : gpuTimers) {
+			timer.disjoint->Release();
+			timer.begin->Release();
+			timer.end->Release();
+		}
+
+		releaseLightAccumulationTarget();
 
 		ImGui_ImplDX11_Shutdown();
 		ImGui_ImplGlfw_Shutdown();
 		ImGui::DestroyContext();
 
+		backBufferRTV->Release();
 		swapChain->Release();
 		context->Release();
 		device->Release();
@@ -395,12 +935,23 @@ public:
 		while (!glfwWindowShouldClose(window)) {
 			glfwPollEvents();
 
-			ImGui_ImplDX11_NewFrame();
-			ImGui_ImplGlfw_NewFrame();
-			ImGui::NewFrame();
+			// Everything from here to Present, the jobs it hands out included, goes towards the frame.
+			AllocationCounts before = frameAllocations.get();
+			{
+				AllocationScope scope(&frameAllocations);
+
+				ImGui_ImplDX11_NewFrame();
+				ImGui_ImplGlfw_NewFrame();
+				ImGui::NewFrame();
+
+				updateStreaming();
+				updateFrame();
+				drawFrame();
+			}
 
-			updateFrame();
-			drawFrame();
+			frameArena->reset();
+			lastFrameAllocations = frameAllocations.get() - before;
+			allocationFreeFrames = lastFrameAllocations.allocations == 0 ? allocationFreeFrames + 1 : 0;
 		}
 	}
 protected:
@@ -516,10 +1067,46 @@ private:
 		if (FAILED(hr)) {
 			throw std::runtime_error("Failed to create depth texture RTV!");
 		}
+
+		createDepthResourceView();
+		createBackBufferTarget();
+	}
+
+	void createBackBufferTarget() {
+		ID3D11Texture2D* backBuffer;
+		if (FAILED(swapChain->GetBuffer(0, IID_PPV_ARGS(&backBuffer)))) {
+			throw std::runtime_error("Failed to get a back buffer!");
+		}
+
+		D3D11_RENDER_TARGET_VIEW_DESC rtvDesc{};
+		rtvDesc.Format = swapChainFormat;
+		rtvDesc.ViewDimension = D3D11_RTV_DIMENSION_TEXTURE2D;
+		rtvDesc.Texture2D.MipSlice = 0;
+
+		HRESULT hr = device->CreateRenderTargetView(backBuffer, &rtvDesc, &backBufferRTV);
+		backBuffer->Release();
+		if (FAILED(hr)) {
+			throw std::runtime_error("Failed to create backbuffer RTV!");
+		}
+	}
+
+	// The compact G-buffer reconstructs position from depth in the lighting pass.
+	void createDepthResourceView() {
+		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc{};
+		srvDesc.Format = DXGI_FORMAT_R24_UNORM_X8_TYPELESS;
+		srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+		srvDesc.Texture2D.MipLevels = 1;
+		srvDesc.Texture2D.MostDetailedMip = 0;
+
+		if (FAILED(device->CreateShaderResourceView(depthTexture, &srvDesc, &depthResourceView))) {
+			throw std::runtime_error("Failed to create depth texture SRV!");
+		}
 	}
 
 	void initImgui() {
 		IMGUI_CHECKVERSION();
+		// Before the context, so its allocations are counted with the rest of the frame's.
+		ImGui::SetAllocatorFunctions(tracedMalloc, tracedFree);
 		ImGui::CreateContext();
 		ImGuiIO& io = ImGui::GetIO(); (void)io;
 
@@ -529,9 +1116,31 @@ private:
 		ImGui_ImplDX11_Init(device, context);
 	}
 
+	// Goes through the cache so startup reuses bytecode whenever the sources haven't changed. The build's .cso is the fallback.
+	std::vector<char> loadShaderBytecode(const std::string& name, const char* target) {
+		std::string errors;
+		try {
+			auto bytecode = shaderCache->getOrCompile({ name + ".hlsl", "main", target, {} }, &errors);
+			if (!bytecode.empty())
+				return bytecode;
+		}
+		catch (const std::exception& e) {
+			errors = e.what();
+		}
+
+		std::cout << name << " error " << errors << std::endl;
+		return readFile(name + ".cso");
+	}
+
+	GraphicsPipeline* requestGraphicsPipeline(const GraphicsPipelineDesc& desc) {
+		auto pipeline = stateCache->getGraphicsPipeline(desc);
+		graphicsPipelineDescs.emplace(pipeline, desc);
+		return pipeline;
+	}
+
 	void createDeferredGraphicsPipeline() {
-		std::vector<char> vertexShaderCode = readFile("shaders/deferredVertex.cso");
-		std::vector<char> pixelShaderCode = readFile("shaders/deferredPixel.cso");
+		std::vector<char> vertexShaderCode = loadShaderBytecode("shaders/deferredVertex", "vs_5_0");
+		std::vector<char> pixelShaderCode = loadShaderBytecode(getGBufferLayoutDesc(geometryBuffer.layout).deferredPixelShader, "ps_5_0");
 
 		D3D11_RASTERIZER_DESC rasterizerDesc{};
 		rasterizerDesc.FillMode = D3D11_FILL_SOLID;
@@ -545,29 +1154,14 @@ private:
 		rasterizerDesc.MultisampleEnable = false; //useMultisampling;
 		rasterizerDesc.AntialiasedLineEnable = false;
 
-		int width, height;
-		glfwGetWindowSize(window, &width, &height);
-
-		D3D11_VIEWPORT viewport{};
-		viewport.TopLeftX = 0.0f;
-		viewport.TopLeftY = 0.0f;
-		viewport.Width = static_cast<float>(width);
-		viewport.Height = static_cast<float>(height);
-		viewport.MinDepth = 0.0f;
-		viewport.MaxDepth = 1.0f;
-
-		D3D11_RECT scissor{};
-		scissor.left = 0;
-		scissor.top = 0;
-		scissor.right = width;
-		scissor.bottom = height;
-
-		std::vector<D3D11_INPUT_ELEMENT_DESC> inputs(5);
+		std::vector<D3D11_INPUT_ELEMENT_DESC> inputs(6);
 		inputs[0] = { "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, offsetof(Vertex, position), D3D11_INPUT_PER_VERTEX_DATA, 0 };
 		inputs[1] = { "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, offsetof(Vertex, normal), D3D11_INPUT_PER_VERTEX_DATA, 0 };
 		inputs[2] = { "TANGENT", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, offsetof(Vertex, tangent), D3D11_INPUT_PER_VERTEX_DATA, 0 };
 		inputs[3] = { "BINORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, offsetof(Vertex, bitangent), D3D11_INPUT_PER_VERTEX_DATA, 0 };
 		inputs[4] = { "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, offsetof(Vertex, texcoord), D3D11_INPUT_PER_VERTEX_DATA, 0 };
+		inputs[5] = { "OCCLUSION", 0, DXGI_FORMAT_R32_FLOAT, 0, offsetof(Vertex, occlusion), D3D11_INPUT_PER_VERTEX_DATA, 0 };
+		inputs.push_back({ "INSTANCE", 0, DXGI_FORMAT_R32_UINT, 1, 0, D3D11_INPUT_PER_INSTANCE_DATA, 1 });
 
 		D3D11_DEPTH_STENCIL_DESC depthStencilDesc{};
 		depthStencilDesc.DepthEnable = true;
@@ -601,8 +1195,7 @@ private:
 			blendDesc.RenderTarget[i].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
 		}
 
-		deferredGraphicsPipeline = new GraphicsPipeline(
-			device,
+		deferredGraphicsPipeline = requestGraphicsPipeline({
 			vertexShaderCode,
 			pixelShaderCode,
 			std::make_optional(inputs),
@@ -610,14 +1203,91 @@ private:
 			depthStencilDesc,
 			blendDesc,
 			D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST,
-			viewport,
-			scissor
-		);
+		});
+
+		// Same vertex shader and rasterizer state so depth comes out bit identical for the EQUAL test.
+		depthPrepassGraphicsPipeline = requestGraphicsPipeline({
+			vertexShaderCode,
+			{},
+			std::make_optional(inputs),
+			rasterizerDesc,
+			depthStencilDesc,
+			blendDesc,
+			D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST,
+		});
+
+		depthPrepassAlphaGraphicsPipeline = requestGraphicsPipeline({
+			vertexShaderCode,
+			loadShaderBytecode("shaders/depthPrepassAlphaPixel", "ps_5_0"),
+			std::make_optional(inputs),
+			rasterizerDesc,
+			depthStencilDesc,
+			blendDesc,
+			D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST,
+		});
+
+		// Both sides, casters are often single sided walls seen from behind. Bound with the face's tile as the viewport.
+		D3D11_RASTERIZER_DESC shadowRasterizerDesc = rasterizerDesc;
+		shadowRasterizerDesc.CullMode = D3D11_CULL_NONE;
+		shadowRasterizerDesc.DepthBias = 100;
+		shadowRasterizerDesc.DepthBiasClamp = 0.01f;
+		shadowRasterizerDesc.SlopeScaledDepthBias = 2.0f;
+		shadowRasterizerDesc.DepthClipEnable = true;
+
+		shadowGraphicsPipeline = requestGraphicsPipeline({
+			vertexShaderCode,
+			{},
+			std::make_optional(inputs),
+			shadowRasterizerDesc,
+			depthStencilDesc,
+			blendDesc,
+			D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST,
+		});
+
+		shadowAlphaGraphicsPipeline = requestGraphicsPipeline({
+			vertexShaderCode,
+			loadShaderBytecode("shaders/depthPrepassAlphaPixel", "ps_5_0"),
+			std::make_optional(inputs),
+			shadowRasterizerDesc,
+			depthStencilDesc,
+			blendDesc,
+			D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST,
+		});
+
+		// Clearing the whole DSV would lose every cached face, so a tile is cleared by drawing the far plane over it.
+		D3D11_DEPTH_STENCIL_DESC clearDepthStencilDesc = depthStencilDesc;
+		clearDepthStencilDesc.DepthFunc = D3D11_COMPARISON_ALWAYS;
+
+		shadowClearGraphicsPipeline = requestGraphicsPipeline({
+			loadShaderBytecode("shaders/shadowClearVertex", "vs_5_0"),
+			{},
+			std::nullopt,
+			rasterizerDesc,
+			clearDepthStencilDesc,
+			blendDesc,
+			D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP,
+		});
+
+		// Renders to a depth buffer of its own at the feedback size, see drawVirtualFeedback.
+		virtualFeedbackPipeline = requestGraphicsPipeline({
+			vertexShaderCode,
+			loadShaderBytecode("shaders/virtualFeedbackPixel", "ps_5_0"),
+			std::make_optional(inputs),
+			rasterizerDesc,
+			depthStencilDesc,
+			blendDesc,
+			D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST,
+		});
+
+		depthStencilDesc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ZERO;
+		depthStencilDesc.DepthFunc = D3D11_COMPARISON_EQUAL;
+
+		depthEqualState = stateCache->getDepthStencilState(depthStencilDesc);
 	}
 
 	void createLightingGraphicsPipeline() {
-		std::vector<char> vertexShaderCode = readFile("shaders/lightAccVertex.cso");
-		std::vector<char> pixelShaderCode = readFile("shaders/lightAccPixel.cso");
+		std::vector<char> vertexShaderCode = loadShaderBytecode("shaders/lightAccVertex", "vs_5_0");
+		std::vector<char> pixelShaderCode = loadShaderBytecode(getGBufferLayoutDesc(geometryBuffer.layout).lightAccPixelShader, "ps_5_0");
 
 		D3D11_RASTERIZER_DESC rasterizerDesc{};
 		rasterizerDesc.FillMode = D3D11_FILL_SOLID;
@@ -631,23 +1301,6 @@ private:
 		rasterizerDesc.MultisampleEnable = false; //useMultisampling;
 		rasterizerDesc.AntialiasedLineEnable = false;
 
-		int width, height;
-		glfwGetWindowSize(window, &width, &height);
-
-		D3D11_VIEWPORT viewport{};
-		viewport.TopLeftX = 0.0f;
-		viewport.TopLeftY = 0.0f;
-		viewport.Width = static_cast<float>(width);
-		viewport.Height = static_cast<float>(height);
-		viewport.MinDepth = 0.0f;
-		viewport.MaxDepth = 1.0f;
-
-		D3D11_RECT scissor{};
-		scissor.left = 0;
-		scissor.top = 0;
-		scissor.right = width;
-		scissor.bottom = height;
-
 		D3D11_DEPTH_STENCIL_DESC depthStencilDesc{};
 		depthStencilDesc.DepthEnable = true;
 		depthStencilDesc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ZERO;
@@ -681,8 +1334,7 @@ private:
 		blendDesc.RenderTarget[0].BlendOpAlpha = D3D11_BLEND_OP_ADD;
 		blendDesc.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
 
-		lightingGraphicsPipeline = new GraphicsPipeline(
-			device,
+		lightingGraphicsPipeline = requestGraphicsPipeline({
 			vertexShaderCode,
 			pixelShaderCode,
 			//std::make_optional(inputs),
@@ -692,9 +1344,31 @@ private:
 			blendDesc,
 			//D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST,
 			D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP,
-			viewport,
-			scissor
-		);
+		});
+
+		ambientGraphicsPipeline = requestGraphicsPipeline({
+			vertexShaderCode,
+			loadShaderBytecode(getGBufferLayoutDesc(geometryBuffer.layout).ambientPixelShader, "ps_5_0"),
+			std::nullopt,
+			rasterizerDesc,
+			depthStencilDesc,
+			blendDesc,
+			D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP,
+		});
+
+		// Overwrites the whole back buffer, nothing to test or blend against.
+		depthStencilDesc.DepthEnable = false;
+		blendDesc.RenderTarget[0].BlendEnable = false;
+
+		upscaleGraphicsPipeline = requestGraphicsPipeline({
+			vertexShaderCode,
+			loadShaderBytecode("shaders/upscalePixel", "ps_5_0"),
+			std::nullopt,
+			rasterizerDesc,
+			depthStencilDesc,
+			blendDesc,
+			D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP,
+		});
 
 		D3D11_SAMPLER_DESC samplerDesc{};
 		samplerDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_POINT;
@@ -711,48 +1385,202 @@ private:
 		samplerDesc.MinLOD = 0.0f;
 		samplerDesc.MaxLOD = D3D11_FLOAT32_MAX;
 
-		if (FAILED(device->CreateSamplerState(&samplerDesc, &gbufferSampler))) {
-			throw std::runtime_error("Failed to create gbuffer sampler");
-		}
+		gbufferSampler = stateCache->getSamplerState(samplerDesc);
+
+		samplerDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
+		environmentSampler = stateCache->getSamplerState(samplerDesc);
 	}
 
-	void createConstantBuffers() {
-		D3D11_BUFFER_DESC desc{};
-		desc.ByteWidth = sizeof(PerFrameUniforms);
-		desc.Usage = D3D11_USAGE_DYNAMIC;
-		desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
-		desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
-		desc.MiscFlags = 0;
-		desc.StructureByteStride = 0;
+	// Baked on the jobs the first time, read back from the cache after that. The specular cube goes up as float, it's small
+	// next to the G-buffer and keeps the bake's range.
+	void createEnvironmentLighting() {
+		try {
+			environmentStats = bakeEnvironmentLighting("assets/sponzaScene/sponzaCubemap/environmentprobe_cm.dds", "assets/cache/environmentprobe_cm.env", {}, *jobs, environment);
+			environmentBaked = true;
 
-		if (FAILED(device->CreateBuffer(&desc, nullptr, &perFrameUniformsBuffer))) {
-			throw std::runtime_error("Failed to create cbuffer!");
+			double bakeMs = environmentStats.loadMs + environmentStats.projectMs + environmentStats.prefilterMs;
+			std::cout << "Environment lighting: " << (environmentStats.upToDate ? "already baked" : "baked in " + std::to_string(bakeMs) + " ms") << std::endl;
+		}
+		catch (const std::exception& e) {
+			std::cout << e.what() << ", using the first light's ambient" << std::endl;
+
+			environment.irradiance = getConstantIrradianceSH(lights[0].ambient);
+			environment.specular.allocate(1, 1);
+		}
+
+		auto& cube = environment.specular;
+
+		D3D11_TEXTURE2D_DESC desc{};
+		desc.Width = cube.size;
+		desc.Height = cube.size;
+		desc.MipLevels = cube.levelCount;
+		desc.ArraySize = CUBE_FACE_COUNT;
+		desc.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
+		desc.SampleDesc.Count = 1;
+		desc.SampleDesc.Quality = 0;
+		desc.Usage = D3D11_USAGE_IMMUTABLE;
+		desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+		desc.CPUAccessFlags = 0;
+		desc.MiscFlags = D3D11_RESOURCE_MISC_TEXTURECUBE;
+
+		// Subresources go face by face, each face's whole chain before the next.
+		std::vector<D3D11_SUBRESOURCE_DATA> initialData;
+		for (uint32_t face = 0; face < CUBE_FACE_COUNT; face++) {
+			for (uint32_t level = 0; level < cube.levelCount; level++) {
+				D3D11_SUBRESOURCE_DATA data{};
+				data.pSysMem = cube.getFace(level, face);
+				data.SysMemPitch = static_cast<UINT>(cube.getLevelSize(level) * sizeof(XMFLOAT4));
+				initialData.push_back(data);
+			}
 		}
 
-		D3D11_BUFFER_DESC matDesc{};
-		matDesc.ByteWidth = sizeof(MaterialCbuffer);
-		matDesc.Usage = D3D11_USAGE_DYNAMIC;
-		matDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
-		matDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
-		matDesc.MiscFlags = 0;
-		matDesc.StructureByteStride = 0;
+		if (FAILED(device->CreateTexture2D(&desc, initialData.data(), &environmentTexture))) {
+			throw std::runtime_error("Failed to create environment texture!");
+		}
+
+		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc{};
+		srvDesc.Format = desc.Format;
+		srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURECUBE;
+		srvDesc.TextureCube.MostDetailedMip = 0;
+		srvDesc.TextureCube.MipLevels = cube.levelCount;
 
-		if (FAILED(device->CreateBuffer(&matDesc, nullptr, &perMaterialUniformsBuffer))) {
-			throw std::runtime_error("Failed to create material settings cbuffer!");
+		if (FAILED(device->CreateShaderResourceView(environmentTexture, &srvDesc, &environmentSRV))) {
+			throw std::runtime_error("Failed to create environment SRV!");
 		}
 	}
 
-	void createGbuffers() {
-		int32_t width, height;
-		glfwGetWindowSize(window, &width, &height);
+	void createShadowAtlas() {
+		shadowCache = new ShadowCache();
+		shadowFaceBudget = static_cast<int>(shadowCache->getSettings().faceBudget);
+		uint32_t size = shadowCache->getAtlas().getSize();
 
-		for (size_t i = 0; i < GeometryBuffer::MAX_BUFFER; i++) {
-			D3D11_TEXTURE2D_DESC textureDesc{};
+		// Typeless so the same texture is a depth target while faces are drawn and a float SRV for the light pass.
+		D3D11_TEXTURE2D_DESC desc{};
+		desc.Width = size;
+		desc.Height = size;
+		desc.MipLevels = 1;
+		desc.ArraySize = 1;
+		desc.Format = DXGI_FORMAT_R32_TYPELESS;
+		desc.SampleDesc.Count = 1;
+		desc.SampleDesc.Quality = 0;
+		desc.Usage = D3D11_USAGE_DEFAULT;
+		desc.BindFlags = D3D11_BIND_DEPTH_STENCIL | D3D11_BIND_SHADER_RESOURCE;
+		desc.CPUAccessFlags = 0;
+		desc.MiscFlags = 0;
+
+		if (FAILED(device->CreateTexture2D(&desc, nullptr, &shadowAtlasTexture))) {
+			throw std::runtime_error("Failed to create shadow atlas!");
+		}
+
+		D3D11_DEPTH_STENCIL_VIEW_DESC dsvDesc{};
+		dsvDesc.Format = DXGI_FORMAT_D32_FLOAT;
+		dsvDesc.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2D;
+		dsvDesc.Texture2D.MipSlice = 0;
+
+		if (FAILED(device->CreateDepthStencilView(shadowAtlasTexture, &dsvDesc, &shadowAtlasDSV))) {
+			throw std::runtime_error("Failed to create shadow atlas DSV!");
+		}
+
+		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc{};
+		srvDesc.Format = DXGI_FORMAT_R32_FLOAT;
+		srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+		srvDesc.Texture2D.MostDetailedMip = 0;
+		srvDesc.Texture2D.MipLevels = 1;
+
+		if (FAILED(device->CreateShaderResourceView(shadowAtlasTexture, &srvDesc, &shadowAtlasSRV))) {
+			throw std::runtime_error("Failed to create shadow atlas SRV!");
+		}
+
+		// Nothing's been drawn anywhere yet, every face starts at the far plane.
+		context->ClearDepthStencilView(shadowAtlasDSV, D3D11_CLEAR_DEPTH, 1.0f, 0);
+
+		// Lit where the receiver is no further than the caster, bilinear over the four nearest texels.
+		D3D11_SAMPLER_DESC samplerDesc{};
+		samplerDesc.Filter = D3D11_FILTER_COMPARISON_MIN_MAG_LINEAR_MIP_POINT;
+		samplerDesc.AddressU = D3D11_TEXTURE_ADDRESS_CLAMP;
+		samplerDesc.AddressV = D3D11_TEXTURE_ADDRESS_CLAMP;
+		samplerDesc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
+		samplerDesc.MipLODBias = 0.0f;
+		samplerDesc.MaxAnisotropy = 1;
+		samplerDesc.ComparisonFunc = D3D11_COMPARISON_LESS_EQUAL;
+		samplerDesc.MinLOD = 0.0f;
+		samplerDesc.MaxLOD = D3D11_FLOAT32_MAX;
+
+		shadowSampler = stateCache->getSamplerState(samplerDesc);
+	}
+
+	void createMaterialSampler() {
+		D3D11_SAMPLER_DESC samplerDesc{};
+		samplerDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
+		samplerDesc.AddressU = D3D11_TEXTURE_ADDRESS_WRAP;
+		samplerDesc.AddressV = D3D11_TEXTURE_ADDRESS_WRAP;
+		samplerDesc.AddressW = D3D11_TEXTURE_ADDRESS_WRAP;
+		samplerDesc.MipLODBias = 0.0f;
+		samplerDesc.MaxAnisotropy = 1;
+		samplerDesc.ComparisonFunc = D3D11_COMPARISON_ALWAYS;
+		samplerDesc.BorderColor[0] = 0.0f;
+		samplerDesc.BorderColor[1] = 0.0f;
+		samplerDesc.BorderColor[2] = 0.0f;
+		samplerDesc.BorderColor[3] = 0.0f;
+		samplerDesc.MinLOD = 0.0f;
+		samplerDesc.MaxLOD = D3D11_FLOAT32_MAX;
+
+		materialSampler = stateCache->getSamplerState(samplerDesc);
+	}
+
+	void createConstantBuffers() {
+		D3D11_BUFFER_DESC desc{};
+		desc.ByteWidth = sizeof(PerFrameUniforms);
+		desc.Usage = D3D11_USAGE_DYNAMIC;
+		desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+		desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+		desc.MiscFlags = 0;
+		desc.StructureByteStride = 0;
+
+		if (FAILED(device->CreateBuffer(&desc, nullptr, &perFrameUniformsBuffer))) {
+			throw std::runtime_error("Failed to create cbuffer!");
+		}
+
+		constantRing = new ConstantBufferRing(device, context);
+		geometryPool = new GeometryPool(device, context);
+	}
+
+	void createQueries() {
+		D3D11_QUERY_DESC desc{};
+		desc.Query = D3D11_QUERY_PIPELINE_STATISTICS;
+		desc.MiscFlags = 0;
+
+		if (FAILED(device->CreateQuery(&desc, &pipelineStatisticsQuery))) {
+			throw std::runtime_error("Failed to create pipeline statistics query!");
+		}
+
+		for (auto& timer : gpuTimers) {
+			desc.Query = D3D11_QUERY_TIMESTAMP_DISJOINT;
+			if (FAILED(device->CreateQuery(&desc, &timer.disjoint))) {
+				throw std::runtime_error("Failed to create GPU timer disjoint query!");
+			}
+
+			desc.Query = D3D11_QUERY_TIMESTAMP;
+			if (FAILED(device->CreateQuery(&desc, &timer.begin)) || FAILED(device->CreateQuery(&desc, &timer.end))) {
+				throw std::runtime_error("Failed to create GPU timer timestamp query!");
+			}
+		}
+	}
+
+	void createGbuffers() {
+		int32_t width, height;
+		glfwGetWindowSize(window, &width, &height);
+
+		for (size_t i = 0; i < GeometryBuffer::MAX_BUFFER; i++) {
+			if (geometryBuffer.format(i) == DXGI_FORMAT_UNKNOWN)
+				continue;
+
+			D3D11_TEXTURE2D_DESC textureDesc{};
 			textureDesc.Width = width;
 			textureDesc.Height = height;
 			textureDesc.MipLevels = 1;
 			textureDesc.ArraySize = 1;
-			textureDesc.Format = geometryBuffer.formats[i];
+			textureDesc.Format = geometryBuffer.format(i);
 			textureDesc.SampleDesc.Count = 1;
 			textureDesc.SampleDesc.Quality = 0;
 
@@ -766,7 +1594,7 @@ private:
 			}
 
 			D3D11_RENDER_TARGET_VIEW_DESC rtvDesc{};
-			rtvDesc.Format = geometryBuffer.formats[i];
+			rtvDesc.Format = geometryBuffer.format(i);
 			rtvDesc.ViewDimension = D3D11_RTV_DIMENSION_TEXTURE2D;
 			rtvDesc.Texture2D.MipSlice = 0;
 
@@ -775,259 +1603,1730 @@ private:
 			}
 
 			D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc{};
-			srvDesc.Format = geometryBuffer.formats[i];
+			srvDesc.Format = geometryBuffer.format(i);
 			srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
 			srvDesc.Texture2D.MipLevels = 1;
 			srvDesc.Texture2D.MostDetailedMip = 0;
 
-			if (FAILED(device->CreateShaderResourceView(geometryBuffer.textures[i], &srvDesc, &geometryBuffer.textureResourceViews[i]))) {
-				throw std::runtime_error("Failed to create gbuffer SRV!");
+			if (FAILED(device->CreateShaderResourceView(geometryBuffer.textures[i], &srvDesc, &geometryBuffer.textureResourceViews[i]))) {
+				throw std::runtime_error("Failed to create gbuffer SRV!");
+			}
+		}
+	}
+
+	// Where the lights go with dynamic resolution on, window sized like the G-buffer and in the back buffer's format so
+	// the lights add up the same.
+	void createLightAccumulationTarget() {
+		int32_t width, height;
+		glfwGetWindowSize(window, &width, &height);
+
+		D3D11_TEXTURE2D_DESC textureDesc{};
+		textureDesc.Width = width;
+		textureDesc.Height = height;
+		textureDesc.MipLevels = 1;
+		textureDesc.ArraySize = 1;
+		textureDesc.Format = swapChainFormat;
+		textureDesc.SampleDesc.Count = 1;
+		textureDesc.SampleDesc.Quality = 0;
+		textureDesc.Usage = D3D11_USAGE_DEFAULT;
+		textureDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_RENDER_TARGET;
+
+		if (FAILED(device->CreateTexture2D(&textureDesc, nullptr, &lightAccumulationTexture))) {
+			throw std::runtime_error("Failed to create light accumulation texture!");
+		}
+
+		if (FAILED(device->CreateRenderTargetView(lightAccumulationTexture, nullptr, &lightAccumulationRTV))) {
+			throw std::runtime_error("Failed to create light accumulation RTV!");
+		}
+
+		if (FAILED(device->CreateShaderResourceView(lightAccumulationTexture, nullptr, &lightAccumulationSRV))) {
+			throw std::runtime_error("Failed to create light accumulation SRV!");
+		}
+	}
+
+	void releaseLightAccumulationTarget() {
+		lightAccumulationSRV->Release();
+		lightAccumulationRTV->Release();
+		lightAccumulationTexture->Release();
+	}
+
+	void createMaterialPermutations() {
+		releaseMaterialPermutations();
+
+		std::string path = std::string(getGBufferLayoutDesc(geometryBuffer.layout).deferredPixelShader) + ".hlsl";
+
+		for (uint32_t features : materialFeatures) {
+			if (deferredPixelVariants.count(features))
+				continue;
+
+			std::string errors;
+			auto bytecode = shaderCache->getOrCompile({ path, "main", "ps_5_0", getMaterialFeatureDefines(features) }, &errors);
+			if (bytecode.empty()) {
+				std::cout << "deferred permutation " << features << " error " << errors << std::endl;
+				continue;
+			}
+
+			deferredPixelVariants[features] = stateCache->getPixelShader(bytecode);
+		}
+	}
+
+	void releaseMaterialPermutations() {
+		for (auto& [features, shader] : deferredPixelVariants) {
+			shader->Release();
+		}
+		deferredPixelVariants.clear();
+	}
+
+	// 1x1 stand ins for every material slot until the real slices are uploaded: grey, flat, opaque and barely specular.
+	void createPlaceholderTextures() {
+		TexturePackArray placeholder{ 1, 1, 4, {}, 0, 1 };
+		placeholder.slices = {
+			{ { 200, 200, 200, 255 } },
+			{ { 128, 128, 255, 255 } },
+			{ { 255, 255, 255, 255 } },
+			{ { 1, 1, 1, 255 } },
+		};
+
+		textureArrays.push_back(textureArrayPool.create(device, "MaterialTextures_Placeholder", placeholder));
+	}
+
+	static PackedMaterial getPlaceholderMaterial() {
+		PackedMaterial packed{};
+		for (uint32_t slot = 0; slot < MATERIAL_TEXTURE_COUNT; slot++) {
+			packed.arrays[slot] = 0;
+			packed.table.slices[slot] = slot;
+			packed.table.scaleOffsets[slot] = XMFLOAT4(1.0f, 1.0f, 0.0f, 0.0f);
+			packed.table.maxLods[slot] = 0.0f;
+			packed.table.channels[slot] = slot == MATERIAL_TEXTURE_ALPHA_CUTOUT ? 0 : TEXTURE_CHANNEL_ALL;
+			packed.table.virtualRegions[slot] = XMFLOAT4(1.0f, 1.0f, 0.0f, 0.0f);
+			packed.table.virtualMaxLevels[slot] = -1.0f;
+		}
+		return packed;
+	}
+
+	double getLoadTimeMs() const {
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loadStart).count();
+	}
+
+	Mesh createMesh(const MeshData& data) {
+		Mesh mesh;
+
+		mesh.materialId = data.materialId;
+		mesh.geometry = geometryPool->upload(data.vertices, data.indices);
+
+		return mesh;
+	}
+
+	// Sized for every instance of the scene up front, the world matrices are filled in from the graph as it is now.
+	void createInstanceBuffers() {
+		uint32_t count = static_cast<uint32_t>(sceneInstances.size());
+		if (count == 0)
+			return;
+
+		instanceWorlds.resize(count);
+		for (uint32_t i = 0; i < count; i++) {
+			XMStoreFloat4x4(&instanceWorlds[i], getInstanceWorld(sceneGraph, sceneInstances[i]));
+		}
+
+		D3D11_BUFFER_DESC desc{};
+		desc.Usage = D3D11_USAGE_DEFAULT;
+		desc.ByteWidth = static_cast<UINT>(sizeof(XMFLOAT4X4) * count);
+		desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+		desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+		desc.StructureByteStride = sizeof(XMFLOAT4X4);
+
+		D3D11_SUBRESOURCE_DATA data{};
+		data.pSysMem = instanceWorlds.data();
+
+		if (FAILED(device->CreateBuffer(&desc, &data, &instanceWorldBuffer))) {
+			throw std::runtime_error("Failed to create the instance world buffer!");
+		}
+
+		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc{};
+		srvDesc.Format = DXGI_FORMAT_UNKNOWN;
+		srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+		srvDesc.Buffer.FirstElement = 0;
+		srvDesc.Buffer.NumElements = count;
+
+		if (FAILED(device->CreateShaderResourceView(instanceWorldBuffer, &srvDesc, &instanceWorldSRV))) {
+			throw std::runtime_error("Failed to create the instance world SRV!");
+		}
+
+		// Room for every instance in every view.
+		D3D11_BUFFER_DESC indexDesc{};
+		indexDesc.Usage = D3D11_USAGE_DYNAMIC;
+		indexDesc.ByteWidth = static_cast<UINT>(sizeof(uint32_t) * count * MAX_SPLIT_VIEWS);
+		indexDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+		indexDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+
+		if (FAILED(device->CreateBuffer(&indexDesc, nullptr, &instanceIndexBuffer))) {
+			throw std::runtime_error("Failed to create the instance index buffer!");
+		}
+	}
+
+	// Recomputes the world matrices of whatever moved since the last tick, then the bounds and world matrices of their instances.
+	// Simulation thread.
+	void updateSceneGraph() {
+		if (sceneInstances.empty() || sceneGraph.update(jobs) == 0)
+			return;
+
+		for (uint32_t i = 0; i < sceneInstances.size(); i++) {
+			auto& instance = sceneInstances[i];
+			if (!sceneGraph.wasUpdated(instance.node))
+				continue;
+
+			auto world = getInstanceWorld(sceneGraph, instance);
+			XMStoreFloat4x4(&instanceWorlds[i], world);
+
+			instanceBounds[i] = transformMeshBounds(meshLocalBounds[instance.mesh], world);
+			if (occlusionCuller)
+				occlusionCuller->setInstanceTransform(i, instanceWorlds[i], instanceBounds[i]);
+		}
+
+		graphVersion++;
+	}
+
+	// The menu nudges a node and everything under it, the offset is in world units along its parent's axes. Applied as
+	// the difference from what the ticks before applied, so skipped inputs don't lose any of it. Simulation thread.
+	void applyNodeEdit(const SimulationInput& input) {
+		if (sceneInstances.empty() || input.editNode < 0 || static_cast<uint32_t>(input.editNode) >= sceneGraph.size())
+			return;
+
+		if (input.editNode != editedNode || input.editSelection != editedSelection) {
+			editedNode = input.editNode;
+			editedSelection = input.editSelection;
+			appliedNodeOffset = {};
+		}
+
+		auto& offset = input.editNodeOffset;
+		if (offset.x == appliedNodeOffset.x && offset.y == appliedNodeOffset.y && offset.z == appliedNodeOffset.z)
+			return;
+
+		uint32_t parent = sceneGraph.getParent(editedNode);
+		float parentScale = parent != SceneGraph::NO_NODE ? getMatrixScale(XMLoadFloat4x4(&sceneGraph.getWorld(parent))) : 1.0f;
+		float toParent = parentScale > 0.0f ? 1.0f / parentScale : 1.0f;
+
+		auto delta = XMMatrixTranslation((offset.x - appliedNodeOffset.x) * toParent, (offset.y - appliedNodeOffset.y) * toParent, (offset.z - appliedNodeOffset.z) * toParent);
+		XMFLOAT4X4 local;
+		XMStoreFloat4x4(&local, XMMatrixMultiply(XMLoadFloat4x4(&sceneGraph.getLocal(editedNode)), delta));
+		sceneGraph.setLocal(editedNode, local);
+		appliedNodeOffset = offset;
+	}
+
+	// Uploads the world matrices whenever a tick moved something, and tells the shadow cache about the casters that moved.
+	void updateInstanceTransforms() {
+		if (!instanceWorldBuffer || frame->graphVersion == uploadedGraphVersion || frame->instanceWorlds.size() != sceneInstances.size())
+			return;
+
+		for (size_t i = 0; i < casterBounds.size(); i++) {
+			auto& bounds = frame->instanceBounds[i];
+			if (memcmp(&casterBounds[i], &bounds, sizeof(MeshBounds)) == 0)
+				continue;
+
+			// Shadows it cast where it was have to go as well as the ones it casts now.
+			shadowCache->invalidateCasters(casterBounds[i]);
+			casterBounds[i] = bounds;
+			shadowCache->invalidateCasters(casterBounds[i]);
+		}
+
+		context->UpdateSubresource(instanceWorldBuffer, 0, nullptr, frame->instanceWorlds.data(), 0, 0);
+		uploadedGraphVersion = frame->graphVersion;
+	}
+
+	void rebuildMaterialConstants() {
+		std::vector<MaterialConstants> materialSettings;
+		for (size_t i = 0; i < loadedMaterials.size(); i++) {
+			MaterialTextureTable table = packedMaterials[i].table;
+
+			// Switched off, the virtual slots go back to their arrays.
+			if (!virtualTexturingEnabled) {
+				for (uint32_t slot = 0; slot < MATERIAL_TEXTURE_COUNT; slot++) {
+					table.virtualMaxLevels[slot] = -1.0f;
+				}
+			}
+
+			materialSettings.push_back({ loadedMaterials[i].settings, table });
+		}
+
+		delete materialConstants;
+		materialConstants = new ImmutableConstantArray(device, materialSettings.data(), static_cast<uint32_t>(materialSettings.size()), sizeof(MaterialConstants), constantRing->supportsOffsets());
+	}
+
+	// Stops the simulation while the scene arrays it reads are filled in.
+	void onGeometryStreamed(SceneData&& geometry) {
+		stopSimulation();
+
+		streamedGeometry = std::move(geometry);
+		streamedMeshCount = streamedGeometry.meshes.size();
+
+		loadedMaterials = streamedGeometry.materials;
+		for (const auto& material : loadedMaterials) {
+			packedMaterials.push_back(getPlaceholderMaterial());
+			materialFeatures.push_back(getMaterialFeatures(material.settings));
+		}
+		materialStreamed.assign(loadedMaterials.size(), 0);
+		rebuildMaterialConstants();
+
+		createMaterialPermutations();
+		watchShaders();
+
+		// Copied, the occlusion culler still wants the graph and instances with the rest of the geometry.
+		sceneGraph = streamedGeometry.graph;
+		sceneInstances = streamedGeometry.instances;
+		instancingStats = streamedGeometry.instancingStats;
+		importScratchUsed = sceneStreamer->getImportScratchUsed();
+		for (auto& mesh : streamedGeometry.meshes) {
+			meshLocalBounds.push_back(mesh.localBounds);
+		}
+		for (auto& instance : sceneInstances) {
+			instanceBounds.push_back(instance.bounds);
+			instanceAlphaTested.push_back(loadedMaterials[streamedGeometry.meshes[instance.mesh].materialId].settings.useAlphaCutoutTexture != 0);
+			instanceMeshes.push_back(instance.mesh);
+		}
+		createInstanceBuffers();
+
+		casterBounds = instanceBounds;
+		graphVersion++;
+		uploadedGraphVersion = graphVersion;
+
+		startSimulation();
+
+		loadedMesh.reserve(streamedMeshCount);
+		std::cout << "Imported " << streamedMeshCount << " meshes as " << sceneInstances.size() << " instances, " << sceneGraph.size() << " nodes after " << getLoadTimeMs() << " ms" << std::endl;
+	}
+
+	// Meshes still waiting to go up take the baked vertices with them, the ones already up are written over.
+	void onOcclusionStreamed(StreamedOcclusion&& occlusion) {
+		occlusionStats = occlusion.stats;
+
+		for (size_t i = loadedMesh.size(); i < occlusion.vertices.size(); i++) {
+			streamedGeometry.meshes[i].vertices = std::move(occlusion.vertices[i]);
+		}
+		occlusion.vertices.resize(loadedMesh.size());
+		occlusionVertices = std::move(occlusion.vertices);
+		nextOcclusionUpload = 0;
+		occlusionStreamed = true;
+
+		std::cout << "Ambient occlusion " << (occlusionStats.upToDate ? "read from the cache" : "baked") << " after " << getLoadTimeMs() << " ms" << std::endl;
+	}
+
+	void onTexturesStreamed(StreamedTextures&& textures) {
+		textureCookStats = std::move(textures.cookStats);
+		mipGenerationStats = textures.mipStats;
+		texturePackStats = textures.pack.stats;
+
+		for (auto& material : textureCookStats.materials) {
+			if (material.bytesBefore != material.bytesAfter)
+				std::cout << "Cooked " << material.material << ": " << material.bytesBefore / 1024 << " KB to " << material.bytesAfter / 1024 << " KB" << std::endl;
+		}
+		std::cout << "Cooked textures: " << textureCookStats.bytesBefore / (1024 * 1024) << " MB to " << textureCookStats.bytesAfter / (1024 * 1024) << " MB, top mips only" << std::endl;
+		std::cout << "Generated mips for " << mipGenerationStats.textures << " textures in " << mipGenerationStats.ms << " ms, "
+			<< mipGenerationStats.bytes / (1024 * 1024) << " MB" << std::endl;
+		std::cout << "Packed " << texturePackStats.textures << " textures into " << texturePackStats.arrays << " arrays, "
+			<< texturePackStats.slices << " slices (" << texturePackStats.atlasPages << " atlas pages), " << texturePackStats.efficiency() << "% used" << std::endl;
+
+		virtualLayout = std::move(textures.virtualLayout);
+		virtualCookStats = textures.virtualCookStats;
+		std::cout << "Virtual textures: " << virtualLayout.regions.size() << " in " << virtualCookStats.tiles << " tiles, "
+			<< virtualCookStats.bytes / (1024 * 1024) << " MB, " << (virtualCookStats.upToDate ? "already cooked" : "cooked in " + std::to_string(virtualCookStats.ms) + " ms") << std::endl;
+
+		// Cooking moved the masks, the placeholders keep the materials' old channels until each one switches over.
+		loadedMaterials = std::move(textures.materials);
+		streamedPack = std::move(textures.pack);
+		texturesStreamed = true;
+
+		// Every full slice of a tiled array is a streamed texture with an entry in the min lod buffer, starting at its tail.
+		std::vector<float> minLods = { 0.0f };
+		std::vector<uint32_t> firstResidency(streamedPack.arrays.size(), 0);
+
+		for (uint32_t i = 0; i < streamedPack.arrays.size(); i++) {
+			auto& data = streamedPack.arrays[i];
+			bool tiled = tilePool->isSupported() && TextureArray::canTile(data);
+
+			std::string name = "MaterialTextures_" + std::to_string(data.width) + "x" + std::to_string(data.height) + "x" + std::to_string(data.channels);
+			auto array = textureArrayPool.create(device, name, data, true, tiled ? tilePool : nullptr);
+			textureArrays.push_back(array);
+
+			if (!tiled)
+				continue;
+
+			firstResidency[i] = static_cast<uint32_t>(minLods.size());
+			for (uint32_t slice = 0; slice < array->fullSlices; slice++) {
+				streamedTextureSlots.push_back({ i + 1, slice });
+				minLods.push_back(static_cast<float>(array->tiling.packedLevel));
+			}
+			tilePoolBaseTiles += array->getUploadedTiles();
+		}
+
+		if (!streamedTextureSlots.empty()) {
+			tilePool->reserve(tilePoolBaseTiles + getTextureBudgetTiles());
+			createTextureMinLods(minLods);
+		}
+
+		// Shifted past the placeholder array.
+		for (const auto& material : loadedMaterials) {
+			PackedMaterial packed = getPackedMaterial(streamedPack, material);
+			applyVirtualTextureLayout(virtualLayout, packed, packed.table);
+
+			for (uint32_t slot = 0; slot < MATERIAL_TEXTURE_COUNT; slot++) {
+				if (packed.arrays[slot] == NO_TEXTURE_ARRAY)
+					continue;
+
+				if (textureArrays[packed.arrays[slot] + 1]->isStreamedSlice(packed.table.slices[slot]))
+					packed.table.residency[slot] = firstResidency[packed.arrays[slot]] + packed.table.slices[slot];
+
+				packed.arrays[slot]++;
+			}
+			streamedMaterials.push_back(packed);
+		}
+
+		createVirtualTexturing(textures.virtualTexturePath);
+	}
+
+	uint32_t getTextureBudgetTiles() const {
+		return static_cast<uint32_t>(static_cast<uint64_t>(textureBudgetMB) * 1024 * 1024 / TEXTURE_TILE_BYTES);
+	}
+
+	// Entry 0 is for textures that are always fully resident, the rest follow streamedTextureSlots.
+	void createTextureMinLods(const std::vector<float>& minLods) {
+		if (textureMinLodSRV)
+			textureMinLodSRV->Release();
+		if (textureMinLodBuffer)
+			textureMinLodBuffer->Release();
+
+		D3D11_BUFFER_DESC desc{};
+		desc.ByteWidth = static_cast<UINT>(sizeof(float) * minLods.size());
+		desc.Usage = D3D11_USAGE_DYNAMIC;
+		desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+		desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+		desc.MiscFlags = 0;
+		desc.StructureByteStride = 0;
+
+		D3D11_SUBRESOURCE_DATA initialData{};
+		initialData.pSysMem = minLods.data();
+
+		if (FAILED(device->CreateBuffer(&desc, &initialData, &textureMinLodBuffer))) {
+			throw std::runtime_error("Failed to create texture min lod buffer!");
+		}
+
+		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc{};
+		srvDesc.Format = DXGI_FORMAT_R32_FLOAT;
+		srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+		srvDesc.Buffer.FirstElement = 0;
+		srvDesc.Buffer.NumElements = static_cast<UINT>(minLods.size());
+
+		if (FAILED(device->CreateShaderResourceView(textureMinLodBuffer, &srvDesc, &textureMinLodSRV))) {
+			throw std::runtime_error("Failed to create texture min lod SRV!");
+		}
+	}
+
+	void updateTextureMinLods() {
+		D3D11_MAPPED_SUBRESOURCE mapped{};
+		context->Map(textureMinLodBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
+
+		auto minLods = static_cast<float*>(mapped.pData);
+		minLods[0] = 0.0f;
+		for (uint32_t i = 0; i < textureStreamer->getNumTextures(); i++) {
+			minLods[i + 1] = static_cast<float>(textureStreamer->getResidentLevel(i));
+		}
+
+		context->Unmap(textureMinLodBuffer, 0);
+	}
+
+	// Level sizes straight from the arrays' tiling so the budget counts exactly what the pool hands out.
+	void createTextureStreamer() {
+		if (streamedTextureSlots.empty())
+			return;
+
+		std::vector<StreamedTextureDesc> textures;
+		for (auto& slot : streamedTextureSlots) {
+			auto array = textureArrays[slot.array];
+			auto& data = streamedPack.arrays[slot.array - 1];
+
+			StreamedTextureDesc desc{};
+			desc.size = std::max(data.width, data.height);
+			desc.tailLevel = array->tiling.packedLevel;
+			desc.levelBytes.assign(data.mipLevels, 0);
+			for (uint32_t level = 0; level < array->tiling.packedLevel; level++) {
+				desc.levelBytes[level] = array->tiling.levelTiles[level] * TEXTURE_TILE_BYTES;
+			}
+			if (desc.tailLevel < data.mipLevels)
+				desc.levelBytes[desc.tailLevel] = array->tiling.packedTiles * TEXTURE_TILE_BYTES;
+
+			textures.push_back(std::move(desc));
+		}
+
+		std::vector<StreamedMeshDesc> meshes;
+		for (size_t i = 0; i < sceneInstances.size(); i++) {
+			StreamedMeshDesc mesh{ casterBounds[i], sceneInstances[i].uvDensity, {} };
+
+			auto& table = packedMaterials[loadedMesh[instanceMeshes[i]].materialId].table;
+			for (uint32_t slot = 0; slot < MATERIAL_TEXTURE_COUNT; slot++) {
+				uint32_t residency = table.residency[slot];
+				if (residency && std::find(mesh.textures.begin(), mesh.textures.end(), residency - 1) == mesh.textures.end())
+					mesh.textures.push_back(residency - 1);
+			}
+
+			meshes.push_back(std::move(mesh));
+		}
+
+		textureStreamer = new TextureStreamer(std::move(textures), std::move(meshes), getTextureStreamSettings());
+	}
+
+	TextureStreamSettings getTextureStreamSettings() const {
+		TextureStreamSettings settings;
+		settings.memoryBudget = static_cast<uint64_t>(getTextureBudgetTiles()) * TEXTURE_TILE_BYTES;
+		settings.loadBudget = static_cast<uint64_t>(uploadBudgetMB) * 1024 * 1024;
+		return settings;
+	}
+
+	// Maps in and fills the levels the view needs and gives back the ones it doesn't, then moves the min lods to match.
+	void updateTextureStreaming(int height) {
+		auto settings = getTextureStreamSettings();
+		if (settings.memoryBudget != textureStreamer->getSettings().memoryBudget || settings.loadBudget != textureStreamer->getSettings().loadBudget) {
+			tilePool->reserve(tilePoolBaseTiles + getTextureBudgetTiles());
+			textureStreamer->setSettings(settings);
+		}
+
+		TextureStreamView view{ frame->cameraPosition, static_cast<float>(height), 1.0f / std::tan(CAMERA_FOV_Y * 0.5f) };
+		// Occlusion only covers the main view, with the screen split every instance counts.
+		bool occluded = occlusionCullingEnabled && frame->views.size() == 1 && frame->instanceVisibility.size() == sceneInstances.size();
+		auto& changes = textureStreamer->update(view, occluded ? &frame->instanceVisibility : nullptr);
+
+		for (auto& change : changes) {
+			auto& slot = streamedTextureSlots[change.texture];
+			auto array = textureArrays[slot.array];
+
+			if (change.load)
+				array->loadLevel(context, streamedPack.arrays[slot.array - 1], slot.slice, change.level);
+			else
+				array->evictLevel(slot.slice, change.level);
+		}
+
+		if (!changes.empty())
+			updateTextureMinLods();
+	}
+
+	// Cache and page table for the cooked virtual textures. A scene with none is left sampling its arrays as before.
+	void createVirtualTexturing(const std::string& path) {
+		if (virtualLayout.regions.empty())
+			return;
+
+		virtualStreamer = new VirtualTextureStreamer(path, virtualLayout);
+		auto& settings = virtualLayout.settings;
+
+		D3D11_TEXTURE2D_DESC desc{};
+		desc.Width = settings.getCacheSize();
+		desc.Height = settings.getCacheSize();
+		desc.MipLevels = 1;
+		desc.ArraySize = 1;
+		desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+		desc.SampleDesc.Count = 1;
+		desc.SampleDesc.Quality = 0;
+		desc.Usage = D3D11_USAGE_DEFAULT;
+		desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+		desc.CPUAccessFlags = 0;
+		desc.MiscFlags = 0;
+
+		if (FAILED(device->CreateTexture2D(&desc, nullptr, &virtualCacheTexture))) {
+			throw std::runtime_error("Failed to create virtual texture cache!");
+		}
+
+		if (FAILED(device->CreateShaderResourceView(virtualCacheTexture, nullptr, &virtualCacheSRV))) {
+			throw std::runtime_error("Failed to create virtual texture cache SRV!");
+		}
+
+		// A mip per page table level, the shader loads the level it wants directly.
+		desc.Width = settings.virtualPages;
+		desc.Height = settings.virtualPages;
+		desc.MipLevels = settings.getLevelCount();
+		desc.Format = DXGI_FORMAT_R8G8B8A8_UINT;
+
+		if (FAILED(device->CreateTexture2D(&desc, nullptr, &virtualPageTableTexture))) {
+			throw std::runtime_error("Failed to create virtual texture page table!");
+		}
+
+		if (FAILED(device->CreateShaderResourceView(virtualPageTableTexture, nullptr, &virtualPageTableSRV))) {
+			throw std::runtime_error("Failed to create virtual texture page table SRV!");
+		}
+
+		// Whole, once, with the pinned pages already in. After this only the squares the streamer changes go up.
+		auto& pageTable = virtualStreamer->getPageTable();
+		for (uint32_t level = 0; level < pageTable.getLevelCount(); level++) {
+			context->UpdateSubresource(virtualPageTableTexture, level, nullptr, pageTable.getLevelData(level), pageTable.getLevelSize(level) * 4, 0);
+		}
+		pageTable.takeDirtyRects();
+
+		int width, height;
+		glfwGetWindowSize(window, &width, &height);
+		createVirtualFeedbackTargets(width, height);
+	}
+
+	void createVirtualFeedbackTargets(int width, int height) {
+		virtualFeedbackWidth = std::max(1u, static_cast<uint32_t>(width) / virtualLayout.settings.feedbackScale);
+		virtualFeedbackHeight = std::max(1u, static_cast<uint32_t>(height) / virtualLayout.settings.feedbackScale);
+		virtualFeedbackCopies = 0;
+
+		D3D11_TEXTURE2D_DESC desc{};
+		desc.Width = virtualFeedbackWidth;
+		desc.Height = virtualFeedbackHeight;
+		desc.MipLevels = 1;
+		desc.ArraySize = 1;
+		desc.Format = DXGI_FORMAT_R32_UINT;
+		desc.SampleDesc.Count = 1;
+		desc.SampleDesc.Quality = 0;
+		desc.Usage = D3D11_USAGE_DEFAULT;
+		desc.BindFlags = D3D11_BIND_RENDER_TARGET;
+		desc.CPUAccessFlags = 0;
+		desc.MiscFlags = 0;
+
+		if (FAILED(device->CreateTexture2D(&desc, nullptr, &virtualFeedbackTexture))) {
+			throw std::runtime_error("Failed to create virtual texture feedback target!");
+		}
+
+		if (FAILED(device->CreateRenderTargetView(virtualFeedbackTexture, nullptr, &virtualFeedbackRTV))) {
+			throw std::runtime_error("Failed to create virtual texture feedback RTV!");
+		}
+
+		desc.Usage = D3D11_USAGE_STAGING;
+		desc.BindFlags = 0;
+		desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+
+		for (auto& staging : virtualFeedbackStaging) {
+			if (FAILED(device->CreateTexture2D(&desc, nullptr, &staging))) {
+				throw std::runtime_error("Failed to create virtual texture feedback readback!");
+			}
+		}
+
+		desc.Format = DXGI_FORMAT_D24_UNORM_S8_UINT;
+		desc.Usage = D3D11_USAGE_DEFAULT;
+		desc.BindFlags = D3D11_BIND_DEPTH_STENCIL;
+		desc.CPUAccessFlags = 0;
+
+		if (FAILED(device->CreateTexture2D(&desc, nullptr, &virtualFeedbackDepth))) {
+			throw std::runtime_error("Failed to create virtual texture feedback depth!");
+		}
+
+		if (FAILED(device->CreateDepthStencilView(virtualFeedbackDepth, nullptr, &virtualFeedbackDSV))) {
+			throw std::runtime_error("Failed to create virtual texture feedback DSV!");
+		}
+	}
+
+	void releaseVirtualFeedbackTargets() {
+		virtualFeedbackRTV->Release();
+		virtualFeedbackTexture->Release();
+		virtualFeedbackDSV->Release();
+		virtualFeedbackDepth->Release();
+
+		for (auto staging : virtualFeedbackStaging) {
+			staging->Release();
+		}
+	}
+
+	// Hands the streamer the oldest feedback copy if the GPU has finished with it, then uploads the tiles that landed
+	// and the page table squares they changed. Loads already in flight still land with virtual texturing off.
+	void updateVirtualTexturing() {
+		size_t feedbackCount = 0;
+
+		if (virtualTexturingEnabled && virtualFeedbackCopies >= VIRTUAL_FEEDBACK_LATENCY) {
+			auto staging = virtualFeedbackStaging[virtualFeedbackCopies % VIRTUAL_FEEDBACK_LATENCY];
+
+			D3D11_MAPPED_SUBRESOURCE mapped{};
+			if (context->Map(staging, 0, D3D11_MAP_READ, D3D11_MAP_FLAG_DO_NOT_WAIT, &mapped) == S_OK) {
+				virtualFeedback.resize(static_cast<size_t>(virtualFeedbackWidth) * virtualFeedbackHeight);
+				for (uint32_t y = 0; y < virtualFeedbackHeight; y++) {
+					memcpy(virtualFeedback.data() + static_cast<size_t>(y) * virtualFeedbackWidth, static_cast<const char*>(mapped.pData) + static_cast<size_t>(y) * mapped.RowPitch, virtualFeedbackWidth * sizeof(uint32_t));
+				}
+
+				context->Unmap(staging, 0);
+				feedbackCount = virtualFeedback.size();
+			}
+		}
+
+		auto& uploads = virtualStreamer->update(virtualFeedback.data(), feedbackCount, frameArena);
+		virtualTileUploads = static_cast<uint32_t>(uploads.size());
+
+		UINT stride = virtualLayout.settings.getTileStride();
+		for (auto& upload : uploads) {
+			D3D11_BOX box{ upload.cacheX * stride, upload.cacheY * stride, 0, (upload.cacheX + 1) * stride, (upload.cacheY + 1) * stride, 1 };
+			context->UpdateSubresource(virtualCacheTexture, 0, &box, upload.data, stride * 4, 0);
+		}
+
+		auto& pageTable = virtualStreamer->getPageTable();
+		for (auto& rect : pageTable.takeDirtyRects()) {
+			uint32_t size = pageTable.getLevelSize(rect.level);
+			D3D11_BOX box{ rect.x, rect.y, 0, rect.x + rect.size, rect.y + rect.size, 1 };
+			context->UpdateSubresource(virtualPageTableTexture, rect.level, &box, pageTable.getLevelData(rect.level) + static_cast<size_t>(rect.y) * size + rect.x, size * 4, 0);
+		}
+	}
+
+	// Page keys for everything on screen, in the same batches with each mesh's material bound so cutouts discard the same.
+	void drawVirtualFeedback() {
+		float clearFeedback[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		context->ClearRenderTargetView(virtualFeedbackRTV, clearFeedback);
+		context->ClearDepthStencilView(virtualFeedbackDSV, D3D11_CLEAR_DEPTH, 1.0f, 0);
+		context->OMSetRenderTargets(1, &virtualFeedbackRTV, virtualFeedbackDSV);
+
+		// Only the main view, its constants go back in when another view was drawn last.
+		auto& view = frame->views[0];
+		if (frame->views.size() > 1)
+			bindView(view);
+
+		D3D11_VIEWPORT viewport{ 0.0f, 0.0f, static_cast<float>(virtualFeedbackWidth), static_cast<float>(virtualFeedbackHeight), 0.0f, 1.0f };
+		D3D11_RECT scissor{ 0, 0, static_cast<LONG>(virtualFeedbackWidth), static_cast<LONG>(virtualFeedbackHeight) };
+		virtualFeedbackPipeline->bind(context, viewport, scissor, &bindState);
+		for (auto& batch : view.batches.batches) {
+			const auto& mesh = loadedMesh[batch.mesh];
+			bindMaterial(mesh.materialId);
+			drawBatch(batch, view.firstInstance);
+		}
+
+		context->OMSetRenderTargets(0, nullptr, nullptr);
+		context->CopyResource(virtualFeedbackStaging[virtualFeedbackCopies % VIRTUAL_FEEDBACK_LATENCY], virtualFeedbackTexture);
+		virtualFeedbackCopies++;
+	}
+
+	// Switches every material whose slices have all been uploaded over from the placeholders.
+	void updateStreamedMaterials() {
+		bool changed = false;
+
+		for (size_t i = 0; i < streamedMaterials.size(); i++) {
+			if (materialStreamed[i])
+				continue;
+
+			auto& packed = streamedMaterials[i];
+
+			bool ready = true;
+			for (uint32_t slot = 0; slot < MATERIAL_TEXTURE_COUNT; slot++) {
+				if (packed.arrays[slot] != NO_TEXTURE_ARRAY && textureArrays[packed.arrays[slot]]->uploadedSlices <= packed.table.slices[slot])
+					ready = false;
+			}
+
+			if (ready) {
+				packedMaterials[i] = packed;
+				materialStreamed[i] = 1;
+				changed = true;
+			}
+		}
+
+		if (changed)
+			rebuildMaterialConstants();
+	}
+
+	// Picks up whatever the streamer has finished and uploads up to the budget of it, meshes first.
+	// At least one upload goes through a frame, so something bigger than the whole budget still gets in.
+	void updateStreaming() {
+		uploadedBytesThisFrame = 0;
+
+		if (sceneLoaded)
+			return;
+
+		SceneData geometry;
+		if (sceneStreamer->takeGeometry(geometry))
+			onGeometryStreamed(std::move(geometry));
+
+		StreamedOcclusion occlusion;
+		if (sceneStreamer->takeOcclusion(occlusion))
+			onOcclusionStreamed(std::move(occlusion));
+
+		StreamedTextures textures;
+		if (sceneStreamer->takeTextures(textures))
+			onTexturesStreamed(std::move(textures));
+
+		uint64_t budget = static_cast<uint64_t>(uploadBudgetMB) * 1024 * 1024;
+		auto fits = [&](uint64_t bytes) { return uploadedBytesThisFrame == 0 || uploadedBytesThisFrame + bytes <= budget; };
+
+		uint32_t firstUploaded = static_cast<uint32_t>(loadedMesh.size());
+		while (loadedMesh.size() < streamedMeshCount) {
+			auto& data = streamedGeometry.meshes[loadedMesh.size()];
+			uint64_t bytes = sizeof(Vertex) * data.vertices.size() + sizeof(uint32_t) * data.indices.size();
+			if (!fits(bytes))
+				break;
+
+			loadedMesh.push_back(createMesh(data));
+			uploadedBytesThisFrame += bytes;
+		}
+
+		while (nextOcclusionUpload < occlusionVertices.size()) {
+			auto& vertices = occlusionVertices[nextOcclusionUpload];
+			uint64_t bytes = sizeof(Vertex) * vertices.size();
+			if (!fits(bytes))
+				break;
+
+			geometryPool->updateVertices(loadedMesh[nextOcclusionUpload].geometry, vertices);
+			vertices = {};
+			uploadedBytesThisFrame += bytes;
+			nextOcclusionUpload++;
+		}
+
+		// Instances that just became drawable are new casters to any shadow drawn without them.
+		if (loadedMesh.size() > firstUploaded) {
+			for (size_t i = 0; i < instanceMeshes.size(); i++) {
+				if (instanceMeshes[i] >= firstUploaded && instanceMeshes[i] < loadedMesh.size())
+					shadowCache->invalidateCasters(casterBounds[i]);
+			}
+		}
+
+		if (!occlusionCuller && streamedMeshCount > 0 && loadedMesh.size() == streamedMeshCount) {
+			// Nodes may have moved since the import. The culler and the graph are the simulation's once it starts again.
+			stopSimulation();
+			streamedGeometry.graph = sceneGraph;
+			updateInstanceBounds(streamedGeometry, true);
+
+			occlusionCuller = new OcclusionCuller(streamedGeometry, *jobs);
+			instanceVisibility.assign(sceneInstances.size(), 1);
+			startSimulation();
+
+			// Everything is on the GPU and in the culler now.
+			streamedGeometry = {};
+		}
+
+		bool slicesUploaded = false;
+		while (nextArrayUpload < streamedPack.arrays.size()) {
+			auto& data = streamedPack.arrays[nextArrayUpload];
+			auto array = textureArrays[nextArrayUpload + 1];
+
+			if (array->uploadedSlices == data.slices.size()) {
+				// Done with the CPU copy, unless the streamer loads levels from it later.
+				if (!array->tilePool)
+					data.slices = {};
+				nextArrayUpload++;
+				continue;
+			}
+
+			uint64_t bytes = array->getUploadBytes(data, array->uploadedSlices);
+			if (!fits(bytes))
+				break;
+
+			array->uploadSlice(context, data);
+			uploadedBytesThisFrame += bytes;
+			slicesUploaded = true;
+		}
+
+		if (slicesUploaded)
+			updateStreamedMaterials();
+
+		uploadedBytesTotal += uploadedBytesThisFrame;
+
+		bool occlusionUploaded = occlusionStreamed && nextOcclusionUpload == occlusionVertices.size();
+		if (occlusionCuller && occlusionUploaded && texturesStreamed && nextArrayUpload == streamedPack.arrays.size()) {
+			sceneLoaded = true;
+			fullyLoadedMs = getLoadTimeMs();
+			std::cout << "Scene fully loaded after " << fullyLoadedMs << " ms, first frame after " << firstFrameMs << " ms, "
+				<< uploadedBytesTotal / (1024 * 1024) << " MB uploaded" << std::endl;
+
+			createTextureStreamer();
+		}
+	}
+
+	void startSimulation() {
+		simulationQuit = false;
+		simulationThread = std::thread(&Application::simulationMain, this);
+	}
+
+	// Waits for the tick in progress. Until startSimulation the render thread has the simulation's members to itself.
+	void stopSimulation() {
+		if (!simulationThread.joinable())
+			return;
+
+		simulationQuit = true;
+		simulationThread.join();
+	}
+
+	// A tick every 1 / simulationHz seconds. One that runs long starts the next straight away rather than catching up.
+	void simulationMain() {
+		try {
+			auto next = std::chrono::steady_clock::now();
+			while (!simulationQuit) {
+				simulateTick();
+
+				next += std::chrono::microseconds(1000000 / std::max(1, simulationInputs.front().simulationHz));
+				auto now = std::chrono::steady_clock::now();
+				if (next < now)
+					next = now;
+				std::this_thread::sleep_until(next);
+			}
+		}
+		catch (const std::exception& e) {
+			simulationError = e.what();
+			simulationFailed = true;
+		}
+	}
+
+	// Simulation thread. Everything goes straight into the snapshot the render thread isn't holding.
+	void simulateTick() {
+		auto start = std::chrono::high_resolution_clock::now();
+
+		simulationInputs.acquire();
+		auto& input = simulationInputs.front();
+		auto& out = snapshots.back();
+
+		AllocationCounts before = simulationAllocations.get();
+		{
+			AllocationScope scope(&simulationAllocations);
+
+			double time = glfwGetTime();
+			float delta = static_cast<float>(time - simulationTime);
+			simulationTime = time;
+
+			auto look = XMMatrixRotationRollPitchYaw(input.pitch, input.yaw, 0.0f);
+
+			auto moveDir = XMVectorSet(input.moveX, 0.0f, input.moveZ, 0.0f);
+			moveDir = XMVector3Normalize(moveDir);
+			moveDir = XMVector3Transform(moveDir, look);
+
+			auto moveDelta = XMVectorScale(moveDir, delta * 2.0f);
+
+			auto newPosition = XMVectorAdd(XMLoadFloat3(&cameraPosition), moveDelta);
+			XMStoreFloat3(&cameraPosition, newPosition);
+
+			applyNodeEdit(input);
+			updateSceneGraph();
+
+			updateViews(input, out);
+
+			if (occlusionCuller) {
+				occlusionCuller->setUseAVX2(input.occlusionUseAVX2);
+				if (input.occlusionCullingEnabled)
+					occlusionCuller->cull(getCullViewProj(out.views[0].uniforms), instanceVisibility, simulationArena);
+			}
+
+			animateSceneLights(lights, static_cast<float>(time));
+
+			cullAllViews(input, out);
+			recordViews(input, out);
+
+			out.sequence = ++simulationTicks;
+			out.time = time;
+			out.cameraPosition = cameraPosition;
+			out.lights = lights;
+			if (out.graphVersion != graphVersion) {
+				out.instanceBounds = instanceBounds;
+				out.instanceWorlds = instanceWorlds;
+				out.graphVersion = graphVersion;
+			}
+			out.instanceVisibility = instanceVisibility;
+			out.opaqueInstances = drawOrder.opaqueCount;
+			out.alphaTestedInstances = drawOrder.instances.size() - drawOrder.opaqueCount;
+			out.graphStats = sceneGraph.getStats();
+			out.occlusionStats = occlusionCuller ? occlusionCuller->getStats() : OcclusionStats{};
+		}
+
+		simulationArena->reset();
+		out.allocations = simulationAllocations.get() - before;
+		out.tickMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		snapshots.publish();
+	}
+
+	// The view's frustum widened by the guard band, so it still covers the screen once the camera has turned a little.
+	static XMMATRIX getCullViewProj(const PerFrameUniforms& uniforms) {
+		float scale = 1.0f / (1.0f + CULL_GUARD_BAND);
+		return XMMatrixMultiply(uniforms.viewProj, XMMatrixScaling(scale, scale, 1.0f));
+	}
+
+	// Side by side for two views, quarters for four. The menu bar is scissored off the top row. Only what the camera
+	// decides, the render thread fills in the rest of the constants. Simulation thread.
+	void updateViews(const SimulationInput& input, FrameSnapshot& out) {
+		out.views.resize(input.viewCount);
+
+		int columns = input.viewCount > 1 ? 2 : 1;
+		int rows = input.viewCount > 2 ? 2 : 1;
+		int viewWidth = std::max(1, input.width / columns);
+		int viewHeight = std::max(1, input.height / rows);
+
+		for (uint32_t i = 0; i < input.viewCount; i++) {
+			auto& view = out.views[i];
+			int x = static_cast<int>(i) % columns * viewWidth;
+			int y = static_cast<int>(i) / columns * viewHeight;
+
+			view.uniforms = calculatePerFrameUniforms(cameraPosition, input.pitch, input.yaw + 2.0f * PI * i / input.viewCount, viewWidth, viewHeight);
+			view.outputRect = { x, y, x + viewWidth, y + viewHeight };
+			view.outputScissor = { x, std::max(y, static_cast<int>(input.menuHeight)), x + viewWidth, y + viewHeight };
+		}
+	}
+
+	// Every view's frustum against every instance's bounds, and the lights when they're culled too, in one pass.
+	// The main view's occlusion results go on top. Simulation thread.
+	void cullAllViews(const SimulationInput& input, FrameSnapshot& out) {
+		auto start = std::chrono::high_resolution_clock::now();
+
+		out.viewFrustums.resize(out.views.size());
+		for (size_t i = 0; i < out.views.size(); i++) {
+			out.viewFrustums[i] = ViewFrustum::fromViewProj(getCullViewProj(out.views[i].uniforms));
+		}
+
+		uint32_t instanceCount = static_cast<uint32_t>(instanceBounds.size());
+		uint32_t lightCount = input.cullLightsByRadius ? static_cast<uint32_t>(lights.size()) : 0;
+
+		auto& bounds = out.viewBounds;
+		bounds.resize(instanceCount + lightCount);
+		for (uint32_t i = 0; i < instanceCount; i++) {
+			bounds.setBox(i, instanceBounds[i]);
+		}
+		for (uint32_t i = 0; i < lightCount; i++) {
+			bounds.setSphere(instanceCount + i, lights[i].position, lights[i].radius);
+		}
+
+		cullViews(out.viewFrustums, bounds, viewMasks);
+
+		if (input.occlusionCullingEnabled && occlusionCuller) {
+			for (uint32_t i = 0; i < instanceCount; i++) {
+				if (!instanceVisibility[i])
+					viewMasks[i] &= ~1u;
+			}
+		}
+
+		out.cullMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	// Whatever isn't uploaded or isn't in any view is left out. Every view shares the camera's eye, so one order does for
+	// all of them, then each view's batches and lights are recorded on a worker of their own. Simulation thread.
+	void recordViews(const SimulationInput& input, FrameSnapshot& out) {
+		auto start = std::chrono::high_resolution_clock::now();
+
+		uint32_t instanceCount = static_cast<uint32_t>(instanceBounds.size());
+		instanceDrawable.resize(instanceCount);
+		for (uint32_t i = 0; i < instanceCount; i++) {
+			instanceDrawable[i] = instanceMeshes[i] < input.drawableMeshes && viewMasks[i] != 0;
+		}
+
+		buildDrawOrder(input.depthPrepassMode, instanceBounds, instanceAlphaTested, &instanceDrawable, cameraPosition, drawOrder, simulationArena);
+
+		jobs->parallelFor(static_cast<uint32_t>(out.views.size()), [&](uint32_t index, uint32_t) {
+			auto& view = out.views[index];
+			buildViewDrawBatches(drawOrder, viewMasks, index, instanceMeshes, input.instancingEnabled, view.batches, simulationArena);
+
+			view.lights.clear();
+			for (uint32_t i = 0; i < lights.size(); i++) {
+				if (!input.cullLightsByRadius || (viewMasks[instanceCount + i] & (1u << index)))
+					view.lights.push_back(i);
 			}
+		});
+
+		uint32_t first = 0;
+		for (auto& view : out.views) {
+			view.firstInstance = first;
+			first += static_cast<uint32_t>(view.batches.instances.size());
 		}
-	}
 
-	void loadModel() {
-		Assimp::Importer* importer = new Assimp::Importer();
+		out.recordMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
 
-		AssimpProgressHandler* handler = new AssimpProgressHandler();
-		importer->SetProgressHandler(handler); // Taken ownership of handler
+	// Keys are sampled here on the render thread, GLFW only answers them on the thread that polls.
+	void sendSimulationInput() {
+		auto& input = simulationInputs.back();
+		input.yaw = yaw;
+		input.pitch = pitch;
 
-		stbi_set_flip_vertically_on_load(true);
+		input.moveX = 0.0f;
+		input.moveX += glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS ? 1.0f : 0.0f;
+		input.moveX -= glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS ? 1.0f : 0.0f;
 
-		std::string basePath = "assets/crytekSponza_fbx/";
+		input.moveZ = 0.0f;
+		input.moveZ += glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS ? 1.0f : 0.0f;
+		input.moveZ -= glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS ? 1.0f : 0.0f;
 
-		const aiScene* scene = importer->ReadFile(basePath + "sponza.fbx", aiProcess_CalcTangentSpace | aiProcess_Triangulate | aiProcess_JoinIdenticalVertices);
+		glfwGetWindowSize(window, &input.width, &input.height);
+		input.menuHeight = mainMenuHeight;
 
-		std::cout << "\n Loaded\n";
+		input.viewCount = viewCount;
+		input.drawableMeshes = static_cast<uint32_t>(loadedMesh.size());
+		input.depthPrepassMode = depthPrepassMode;
+		input.instancingEnabled = instancingEnabled;
+		input.cullLightsByRadius = cullLightsByRadius;
+		input.occlusionCullingEnabled = occlusionCullingEnabled;
+		input.occlusionUseAVX2 = occlusionUseAVX2;
 
-		loadedMaterials.reserve(scene->mNumMaterials);
+		input.editNode = editNode;
+		input.editSelection = editSelection;
+		input.editNodeOffset = editNodeOffset;
 
-		for (size_t i = 0; i < scene->mNumMaterials; i++) {
-			Material mat;
-			aiMaterial* data = scene->mMaterials[i];
+		input.simulationHz = simulationHz;
 
-			std::vector<aiMaterialProperty*> properties(data->mProperties, data->mProperties + data->mNumProperties);
+		simulationInputs.publish();
+	}
 
-			aiString name;
-			if (data->Get(AI_MATKEY_NAME, name) == AI_SUCCESS) {
-				std::cout << "Loading material " << name.C_Str() << std::endl;
-				mat.name = name.C_Str();
-			}
+	// Sends the simulation this frame's input and picks up its latest tick, then everything that has to happen on the
+	// render thread before drawing it.
+	void updateFrame() {
+		if (simulationFailed)
+			throw std::runtime_error("Simulation failed: " + simulationError);
 
-			loadTexture(aiTextureType_DIFFUSE, data, basePath, mat.diffuseTexture, (bool&)mat.settings.useDiffuseTexture);
-			loadTexture(aiTextureType_NORMALS, data, basePath, mat.normalTexture, (bool&)mat.settings.useNormalTexture);
-			loadTexture(aiTextureType_OPACITY, data, basePath, mat.alphaCutoutTexture, (bool&)mat.settings.useAlphaCutoutTexture);
-			loadTexture(aiTextureType_SPECULAR, data, basePath, mat.specularTexture, (bool&)mat.settings.useSpecularTexture);
-			if (!mat.settings.useSpecularTexture)
-				loadTexture(aiTextureType_SHININESS, data, basePath, mat.specularTexture, (bool&)mat.settings.useSpecularTexture);
-			if (!mat.settings.useSpecularTexture)
-				loadTexture(aiTextureType_DIFFUSE_ROUGHNESS, data, basePath, mat.specularTexture, (bool&)mat.settings.useSpecularTexture);
+		sendSimulationInput();
 
-			loadedMaterials.push_back(mat);
+		if (snapshots.acquire()) {
+			uint64_t sequence = snapshots.front().sequence;
+			if (frame && sequence > frame->sequence + 1)
+				snapshotsSkipped += sequence - frame->sequence - 1;
+			snapshotsDrawn++;
 		}
+		else snapshotsRepeated++;
+
+		frame = &snapshots.front();
+		snapshotAgeMs = (glfwGetTime() - frame->time) * 1000.0;
 
-		loadedMesh.reserve(scene->mNumMeshes);
+		readGpuTimers();
+		latchViews();
+		updateInstanceTransforms();
 
-		for (size_t i = 0; i < scene->mNumMeshes; i++) {
-			Mesh mesh;
-			aiMesh* data = scene->mMeshes[i];
+		int width, height;
+		glfwGetWindowSize(window, &width, &height);
 
-			mesh.materialId = data->mMaterialIndex;
+		if (textureStreamer)
+			updateTextureStreaming(height);
 
-			std::vector<Vertex> vertices(data->mNumVertices);
-			processVertices(data, vertices);
+		if (virtualStreamer)
+			updateVirtualTexturing();
+	}
 
-			auto numIndices = data->mNumFaces * 3u;
-			std::vector<uint32_t> indices(numIndices);
-			processIndices(data, indices);
+	// Turns each view from where the tick left the camera to wherever the mouse has got to since, as late as the frame
+	// can, and fills in the constants the render thread owns. The tick culled with a guard band to leave room for it.
+	// The views are scaled to the frame's resolution here too, a snapshot drawn again gets the same.
+	void latchViews() {
+		int width, height;
+		glfwGetWindowSize(window, &width, &height);
+		width = std::max(1, width);
+		height = std::max(1, height);
+
+		float scale = dynamicResolutionEnabled ? resolutionController.getScale() : 1.0f;
+		resolutionFrame = getResolutionFrame(width, height, width, height, scale);
+		outputViewport = { 0.0f, 0.0f, static_cast<float>(width), static_cast<float>(height), 0.0f, 1.0f };
+		outputScissor = { 0, 0, width, height };
+
+		auto& virtualSettings = virtualLayout.settings;
+		uint32_t count = static_cast<uint32_t>(frame->views.size());
+		for (uint32_t i = 0; i < count; i++) {
+			auto& view = frame->views[i];
+
+			auto turned = calculatePerFrameUniforms(frame->cameraPosition, pitch, yaw + 2.0f * PI * i / count, view.outputRect.width(), view.outputRect.height());
+			view.uniforms.view = turned.view;
+			view.uniforms.viewProj = turned.viewProj;
+			view.uniforms.invViewProj = turned.invViewProj;
+
+			auto rect = scaleResolutionRect(view.outputRect, scale);
+			auto scissor = scaleResolutionRect(view.outputScissor, scale);
+			view.viewport = { static_cast<float>(rect.left), static_cast<float>(rect.top), static_cast<float>(rect.width()), static_cast<float>(rect.height()), 0.0f, 1.0f };
+			view.scissor = { scissor.left, scissor.top, scissor.right, scissor.bottom };
+			view.uniforms.viewport = { static_cast<float>(rect.left), static_cast<float>(rect.top), static_cast<float>(rect.width()), static_cast<float>(rect.height()) };
+			view.uniforms.screenDimensions = { static_cast<float>(width), static_cast<float>(height) };
+
+			view.uniforms.frameIndex = frameIndex;
+			view.uniforms.virtualFeedbackLodBias = -std::log2(static_cast<float>(virtualSettings.feedbackScale));
+			view.uniforms.virtualTextureParams = XMFLOAT4(static_cast<float>(virtualSettings.tileSize), static_cast<float>(virtualSettings.border),
+				static_cast<float>(virtualSettings.virtualPages), static_cast<float>(virtualSettings.getCacheSize()));
+			memcpy(view.uniforms.irradianceSH, environment.irradiance.coefficients, sizeof(view.uniforms.irradianceSH));
+			view.uniforms.environmentParams = XMFLOAT4(static_cast<float>(environment.specular.levelCount - 1), diffuseAmbientScale,
+				environmentBaked ? specularAmbientScale : 0.0f, 0.0f);
+		}
 
-			D3D11_BUFFER_DESC vDesc = {};
-			vDesc.Usage = D3D11_USAGE_DEFAULT;
-			vDesc.ByteWidth = sizeof(Vertex) * data->mNumVertices;
-			vDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-			vDesc.CPUAccessFlags = 0;
-			vDesc.MiscFlags = 0;
-			vDesc.StructureByteStride = 0;
+		frameIndex++;
+	}
 
-			D3D11_SUBRESOURCE_DATA vertData{};
-			vertData.pSysMem = vertices.data();
+	// Feeds the controller every frame the GPU has finished timing since the last call, oldest first.
+	void readGpuTimers() {
+		while (gpuTimersRead < gpuTimersIssued) {
+			auto& timer = gpuTimers[gpuTimersRead % GPU_TIMER_LATENCY];
 
-			mesh.numVertices = data->mNumVertices;
-			auto vbHR = device->CreateBuffer(&vDesc, &vertData, &mesh.vertices);
+			D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint;
+			UINT64 begin, end;
+			if (context->GetData(timer.disjoint, &disjoint, sizeof(disjoint), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK ||
+				context->GetData(timer.begin, &begin, sizeof(begin), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK ||
+				context->GetData(timer.end, &end, sizeof(end), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK)
+				break;
 
-			std::string vbufferName(data->mName.C_Str());
-			vbufferName += "_VertexBuffer";
-			mesh.vertices->SetPrivateData(WKPDID_D3DDebugObjectName, vbufferName.size(), vbufferName.c_str());
+			gpuTimersRead++;
 
-			assert(SUCCEEDED(vbHR));
+			// The GPU's clock changed part way, the timestamps don't mean anything.
+			if (disjoint.Disjoint)
+				continue;
 
-			D3D11_BUFFER_DESC iDesc = {};
-			iDesc.Usage = D3D11_USAGE_DEFAULT;
-			iDesc.ByteWidth = sizeof(unsigned int) * numIndices;
-			iDesc.BindFlags = D3D11_BIND_INDEX_BUFFER;
-			iDesc.CPUAccessFlags = 0;
-			iDesc.MiscFlags = 0;
-			iDesc.StructureByteStride = 0;
+			gpuFrameMs = static_cast<float>(static_cast<double>(end - begin) * 1000.0 / disjoint.Frequency);
+			if (dynamicResolutionEnabled)
+				resolutionController.update(gpuFrameMs);
+		}
+	}
 
-			D3D11_SUBRESOURCE_DATA indexData{};
-			indexData.pSysMem = indices.data();
+	// False when every timer is still in flight, the frame just goes untimed.
+	bool beginGpuTimer() {
+		if (gpuTimersIssued - gpuTimersRead >= GPU_TIMER_LATENCY)
+			return false;
 
-			mesh.indexCount = numIndices;
-			auto ibHF = device->CreateBuffer(&iDesc, &indexData, &mesh.indices);
+		auto& timer = gpuTimers[gpuTimersIssued % GPU_TIMER_LATENCY];
+		context->Begin(timer.disjoint);
+		context->End(timer.begin);
+		return true;
+	}
 
-			std::string ibufferName(data->mName.C_Str());
-			ibufferName += "_IndexBuffer";
-			mesh.indices->SetPrivateData(WKPDID_D3DDebugObjectName, ibufferName.size(), ibufferName.c_str());
+	void endGpuTimer() {
+		auto& timer = gpuTimers[gpuTimersIssued % GPU_TIMER_LATENCY];
+		context->End(timer.end);
+		context->End(timer.disjoint);
+		gpuTimersIssued++;
+	}
 
-			assert(SUCCEEDED(vbHR));
+	// Stretches the part of the light accumulation target the frame rendered over the whole back buffer.
+	void drawUpscale() {
+		context->OMSetRenderTargets(1, &backBufferRTV, nullptr);
 
-			mesh.materialId = data->mMaterialIndex;
+		UpscaleConstants constants;
+		memcpy(constants.uvPerPixel, resolutionFrame.uvPerPixel, sizeof(constants.uvPerPixel));
+		memcpy(constants.uvMax, resolutionFrame.uvMax, sizeof(constants.uvMax));
+		constantRing->bind(CONSTANT_STAGE_PIXEL, 1, constantRing->upload(constants));
 
-			loadedMesh.push_back(mesh);
-		}
+		upscaleGraphicsPipeline->bind(context, outputViewport, outputScissor, &bindState);
 
-		importer->FreeScene();
+		// Bilinear and clamped, the environment's sampler does.
+		context->PSSetSamplers(0, 1, &environmentSampler);
+		context->PSSetShaderResources(0, 1, &lightAccumulationSRV);
+		context->Draw(4, 0);
 
-		delete importer;
+		ID3D11ShaderResourceView* nullSRV = nullptr;
+		context->PSSetShaderResources(0, 1, &nullSRV);
 	}
 
-	void loadTexture(aiTextureType type, aiMaterial* materialData, const std::string& baseAssetPath, std::string& outPath, bool& outEnabled) {
-		outEnabled = false;
-		outPath.clear();
-		
-		aiString path;
-		if (materialData->Get(AI_MATKEY_TEXTURE(type, 0), path) == AI_SUCCESS) {
-			outPath += baseAssetPath;
-			outPath += path.C_Str();
-
-			std::cout << outPath << std::endl;
-
-			std::filesystem::path asPath(outPath);
-			auto extension = asPath.extension();
-			if (extension == ".dds") {
-				std::cout << "Cant support DDS just yet." << outPath << std::endl;
-				outPath.clear();
-				outEnabled = false;
-				return;
-			}
-			else {
-				int width, height, bpp;
-				byte* textureData = stbi_load(outPath.c_str(), &width, &height, &bpp, STBI_rgb_alpha);
-				if (!textureData) {
-					std::stringstream errorString("Failed to load texture ");
-					errorString << outPath << " because " << stbi_failure_reason();
-					throw std::runtime_error(errorString.str());
-				}
+	// The view's constants, its rectangle goes to every bind that draws into it.
+	void bindView(const RenderView& view) {
+		D3D11_MAPPED_SUBRESOURCE mapped{};
+		context->Map(perFrameUniformsBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
+		memcpy(mapped.pData, &view.uniforms, sizeof(PerFrameUniforms));
+		context->Unmap(perFrameUniformsBuffer, 0);
+	}
 
-				textureCache[outPath] = new Texture(device, context, outPath, width, height, bpp, textureData);
-				stbi_image_free(textureData);
+	// Lights are visible when their range touches any view, and as big as they are in the view that sees them largest,
+	// on the back buffer rather than at the frame's scale so the tiles don't change size with the resolution.
+	// The faces the cache picks are culled and ordered a light at a time, each face then clears its tile and draws the
+	// casters into it.
+	void drawShadows() {
+		float rangeScale = shadowCache->getSettings().rangeScale;
+		float projScale = 1.0f / std::tan(CAMERA_FOV_Y * 0.5f);
+
+		// The snapshot's, the simulation may be on to the next tick.
+		auto& lights = frame->lights;
+		auto& views = frame->views;
+
+		lightVisible.assign(lights.size(), 0);
+		lightScreenRadius.assign(lights.size(), 0.0f);
+		for (uint32_t i = 0; i < lights.size(); i++) {
+			auto& light = lights[i];
+			for (size_t v = 0; v < views.size(); v++) {
+				if (!frame->viewFrustums[v].intersects(light.position.x, light.position.y, light.position.z, 0.0f, 0.0f, 0.0f, light.radius * rangeScale))
+					continue;
+
+				lightVisible[i] = 1;
+				lightScreenRadius[i] = std::max(lightScreenRadius[i], getShadowScreenRadius(light, rangeScale, views[v].uniforms.eyePos, projScale, static_cast<float>(views[v].outputRect.height())));
 			}
-
-			outEnabled = true;
 		}
-	}
 
-	void processVertices(const aiMesh* meshData, std::vector<Vertex>& vertices) {
-		for (size_t v = 0; v < meshData->mNumVertices; v++) {
-			auto pos = meshData->mVertices[v];
-			auto normal = meshData->mNormals[v];
-			auto tangent = meshData->mTangents[v];
-			auto bitangent = meshData->mBitangents[v];
-			aiVector3D uv;
-			if (meshData->mTextureCoords) {
-				uv = meshData->mTextureCoords[0][v];
+		shadowCache->setFaceBudget(static_cast<uint32_t>(shadowFaceBudget));
+		auto& renders = shadowCache->update(lights, lightVisible, lightScreenRadius, frameArena);
+
+		auto start = std::chrono::high_resolution_clock::now();
+
+		shadowDraws = 0;
+		auto& instanceBounds = frame->instanceBounds;
+		uint32_t instanceCount = static_cast<uint32_t>(instanceBounds.size());
+
+		// Only ever grown, dropping a face's batches would free them and the next busier frame would allocate them again.
+		growDrawBatches(shadowBatches, renders.size(), instanceCount);
+		shadowFirstInstances.resize(renders.size());
+		uint32_t totalInstances = 0;
+		for (size_t begin = 0; begin < renders.size();) {
+			size_t end = begin;
+			while (end < renders.size() && renders[end].light == renders[begin].light) {
+				end++;
 			}
 
-			vertices[v] = {
-				{ pos.x / 100.0f, pos.y / 100.0f, pos.z / 100.0f },
-				{ normal.x, normal.y, normal.z },
-				{ tangent.x, tangent.y, tangent.z },
-				{ bitangent.x, bitangent.y, bitangent.z },
-				{ uv.x, uv.y }
-			};
-		}
-	}
+			shadowFrustums.resize(end - begin);
+			for (size_t face = begin; face < end; face++) {
+				shadowFrustums[face - begin] = ViewFrustum::fromViewProj(renders[face].viewProj);
+			}
 
-	void processIndices(const aiMesh* meshData, std::vector<uint32_t>& indices) {
-		for (size_t face = 0, index = 0; face < meshData->mNumFaces; face++)
-		{
-			indices[index++] = meshData->mFaces[face].mIndices[0];
-			indices[index++] = meshData->mFaces[face].mIndices[1];
-			indices[index++] = meshData->mFaces[face].mIndices[2];
+			// viewBounds starts with the instances, the lights after them are left out of the order.
+			cullViews(shadowFrustums, frame->viewBounds, shadowMasks);
+
+			shadowDrawable.resize(instanceCount);
+			for (uint32_t i = 0; i < instanceCount; i++) {
+				shadowDrawable[i] = instanceMeshes[i] < loadedMesh.size() && shadowMasks[i] != 0;
+			}
+
+			buildDrawOrder(DepthPrepassMode::FrontToBack, instanceBounds, instanceAlphaTested, &shadowDrawable, lights[renders[begin].light].position, shadowOrder, frameArena);
+
+			for (size_t face = begin; face < end; face++) {
+				buildViewDrawBatches(shadowOrder, shadowMasks, static_cast<uint32_t>(face - begin), instanceMeshes, instancingEnabled, shadowBatches[face], frameArena);
+				shadowFirstInstances[face] = totalInstances;
+				totalInstances += static_cast<uint32_t>(shadowBatches[face].instances.size());
+			}
+
+			begin = end;
 		}
-	}
 
-	void updateFrame() {
-		static double lastTime = 0.0f;
-		double thisTime = glfwGetTime();
-		float delta = static_cast<float>(thisTime - lastTime);
-		lastTime = thisTime;
+		shadowRecordMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		if (renders.empty())
+			return;
 
-		auto look = XMMatrixRotationRollPitchYaw(pitch, yaw, 0.0f);
+		if (totalInstances > shadowInstanceCapacity) {
+			if (shadowInstanceBuffer)
+				shadowInstanceBuffer->Release();
 
-		float x = 0;
-		x += glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS ? 1.0f : 0.0f;
-		x -= glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS ? 1.0f : 0.0f;
+			shadowInstanceCapacity = std::max(totalInstances, shadowInstanceCapacity * 2);
 
-		float y = 0;
-		y += glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS ? 1.0f : 0.0f;
-		y -= glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS ? 1.0f : 0.0f;
+			D3D11_BUFFER_DESC desc{};
+			desc.Usage = D3D11_USAGE_DYNAMIC;
+			desc.ByteWidth = static_cast<UINT>(sizeof(uint32_t) * shadowInstanceCapacity);
+			desc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+			desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
 
-		auto moveDir = XMVectorSet(x, 0.0f, y, 0.0f);
-		moveDir = XMVector3Normalize(moveDir);
-		moveDir = XMVector3Transform(moveDir, look);
+			if (FAILED(device->CreateBuffer(&desc, nullptr, &shadowInstanceBuffer))) {
+				throw std::runtime_error("Failed to create the shadow instance buffer!");
+			}
+		}
+
+		if (totalInstances > 0) {
+			D3D11_MAPPED_SUBRESOURCE mapped{};
+			context->Map(shadowInstanceBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
+			for (size_t face = 0; face < renders.size(); face++) {
+				auto& instances = shadowBatches[face].instances;
+				memcpy(static_cast<uint32_t*>(mapped.pData) + shadowFirstInstances[face], instances.data(), sizeof(uint32_t) * instances.size());
+			}
+			context->Unmap(shadowInstanceBuffer, 0);
 
-		auto moveDelta = XMVectorScale(moveDir, delta * 2.0f);
+			uint32_t instanceStride = sizeof(uint32_t);
+			uint32_t instanceOffset = 0;
+			context->IASetVertexBuffers(1, 1, &shadowInstanceBuffer, &instanceStride, &instanceOffset);
+		}
 
-		auto newPosition = XMVectorAdd(XMLoadFloat3(&cameraPosition), moveDelta);
-		XMStoreFloat3(&cameraPosition, newPosition);
+		// The light pass sampled the atlas last frame.
+		ID3D11ShaderResourceView* nullSRV = nullptr;
+		context->PSSetShaderResources(9, 1, &nullSRV);
+		context->OMSetRenderTargets(0, nullptr, shadowAtlasDSV);
 
-		perFrameUniforms.eyePos = cameraPosition;
+		PerFrameUniforms uniforms = views[0].uniforms;
+		for (size_t face = 0; face < renders.size(); face++) {
+			auto& render = renders[face];
+			auto& tile = render.tile;
 
-		auto trans = XMMatrixTranslation(cameraPosition.x, cameraPosition.y, cameraPosition.z);
+			uniforms.viewProj = render.viewProj;
+			uniforms.eyePos = lights[render.light].position;
 
-		auto camera = look * trans;
-		auto det = XMMatrixDeterminant(camera);
-		auto view = XMMatrixInverse(&det, camera);
+			D3D11_MAPPED_SUBRESOURCE mapped{};
+			context->Map(perFrameUniformsBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
+			memcpy(mapped.pData, &uniforms, sizeof(PerFrameUniforms));
+			context->Unmap(perFrameUniformsBuffer, 0);
 
-		int width, height;
-		glfwGetWindowSize(window, &width, &height);
-		perFrameUniforms.screenDimensions = { static_cast<float>(width), static_cast<float>(height) };
-		perFrameUniforms.view = view;
-		XMMATRIX proj;
+			D3D11_VIEWPORT viewport{ static_cast<float>(tile.x), static_cast<float>(tile.y), static_cast<float>(tile.size), static_cast<float>(tile.size), 0.0f, 1.0f };
+			D3D11_RECT scissor{ static_cast<LONG>(tile.x), static_cast<LONG>(tile.y), static_cast<LONG>(tile.x + tile.size), static_cast<LONG>(tile.y + tile.size) };
+
+			shadowClearGraphicsPipeline->bind(context, viewport, scissor, &bindState);
+			context->Draw(4, 0);
 
-		float time = static_cast<float>(glfwGetTime());
+			auto& batches = shadowBatches[face];
+			shadowGraphicsPipeline->bind(context, viewport, scissor, &bindState);
+			for (size_t i = 0; i < batches.opaqueCount; i++) {
+				drawBatch(batches.batches[i], shadowFirstInstances[face]);
+			}
+
+			shadowAlphaGraphicsPipeline->bind(context, viewport, scissor, &bindState);
+			for (size_t i = batches.opaqueCount; i < batches.batches.size(); i++) {
+				auto& batch = batches.batches[i];
+				bindMaterial(loadedMesh[batch.mesh].materialId);
+				drawBatch(batch, shadowFirstInstances[face]);
+			}
 
-		lights[0].position.x = std::cosf(time) * 2.0f;
-		lights[0].position.z = -std::sin(time) * 2.0f;
+			shadowDraws += static_cast<uint32_t>(batches.batches.size());
+		}
 
-		proj = XMMatrixPerspectiveFovLH(45.0f, static_cast<float>(width) / height, 0.1f, 1000.0f);
-		perFrameUniforms.viewProj = perFrameUniforms.view * proj;
+		uint32_t instanceStride = sizeof(uint32_t);
+		uint32_t instanceOffset = 0;
+		context->IASetVertexBuffers(1, 1, &instanceIndexBuffer, &instanceStride, &instanceOffset);
 	}
 
 	void drawFrame() {
+		applyShaderBatch();
+
+		auto& views = frame->views;
+
 		int width, height;
 		glfwGetWindowSize(window, &width, &height);
 
 		if (ImGui::BeginMainMenuBar()) {
 			ImVec2 mainMenuSize = ImGui::GetWindowSize();
 
-			deferredGraphicsPipeline->scissor.top = lightingGraphicsPipeline->scissor.top = static_cast<uint64_t>(mainMenuSize.y);
+			mainMenuHeight = mainMenuSize.y;
+
+			auto& layoutDesc = getGBufferLayoutDesc(geometryBuffer.layout);
 
 			static int currentVisualizedBuffer = -1;
 			if (ImGui::BeginMenu("Visualize Buffer")) {
-				if (ImGui::MenuItem("Position", nullptr, currentVisualizedBuffer == GeometryBuffer::Buffer::POSITION)) currentVisualizedBuffer = GeometryBuffer::Buffer::POSITION;
-				if (ImGui::MenuItem("Normals", nullptr, currentVisualizedBuffer == GeometryBuffer::Buffer::NORMAL)) currentVisualizedBuffer = GeometryBuffer::Buffer::NORMAL;
-				if (ImGui::MenuItem("Albedo", nullptr, currentVisualizedBuffer == GeometryBuffer::Buffer::ALBEDO)) currentVisualizedBuffer = GeometryBuffer::Buffer::ALBEDO;
-				if (ImGui::MenuItem("Specular", nullptr, currentVisualizedBuffer == GeometryBuffer::Buffer::SPECULAR)) currentVisualizedBuffer = GeometryBuffer::Buffer::SPECULAR;
+				for (int i = 0; i < GeometryBuffer::MAX_BUFFER; i++) {
+					if (ImGui::MenuItem(layoutDesc.targets[i].name, nullptr, currentVisualizedBuffer == i)) currentVisualizedBuffer = i;
+				}
 				if (ImGui::MenuItem("None", nullptr, currentVisualizedBuffer == -1)) currentVisualizedBuffer = -1;
 				ImGui::EndMenu();
 			}
 
-			if (ImGui::MenuItem("Recompile Shaders")) {
-				RecompileShaders();
+			if (ImGui::BeginMenu("G-Buffer")) {
+				if (ImGui::MenuItem("Standard", nullptr, geometryBuffer.layout == GBufferLayout::Standard)) setGBufferLayout(GBufferLayout::Standard);
+				if (ImGui::MenuItem("Compact", nullptr, geometryBuffer.layout == GBufferLayout::Compact)) setGBufferLayout(GBufferLayout::Compact);
+
+				ImGui::Separator();
+
+				// The targets are always window sized, the traffic goes with the frame's resolution.
+				auto targets = calculateGBufferBandwidth(geometryBuffer.layout, width, height, static_cast<uint32_t>(frame->lights.size()));
+				auto bandwidth = calculateGBufferBandwidth(geometryBuffer.layout, resolutionFrame.width, resolutionFrame.height, static_cast<uint32_t>(frame->lights.size()));
+				ImGui::Text("%llu bytes per pixel", bandwidth.bytesPerPixel);
+				ImGui::Text("Targets: %.2f MB", targets.targetMemory / (1024.0 * 1024.0));
+				ImGui::Text("Geometry pass write: %.2f MB", bandwidth.geometryPassWrite / (1024.0 * 1024.0));
+				ImGui::Text("Light pass read: %.2f MB", bandwidth.lightPassRead / (1024.0 * 1024.0));
+				ImGui::Text("Per frame: %.2f MB", bandwidth.totalPerFrame / (1024.0 * 1024.0));
+
+				if (geometryBuffer.layout == GBufferLayout::Compact) {
+					static float maxNormalError = GBufferEncoding::maxNormalRoundTripErrorDegrees(4096);
+					ImGui::Text("Max normal error: %.4f degrees", maxNormalError);
+				}
+				ImGui::EndMenu();
+			}
+
+			if (ImGui::BeginMenu("Resolution")) {
+				if (ImGui::MenuItem("Dynamic", nullptr, dynamicResolutionEnabled)) {
+					dynamicResolutionEnabled = !dynamicResolutionEnabled;
+					resolutionController.reset();
+				}
+
+				auto settings = resolutionController.getSettings();
+				bool changed = ImGui::SliderFloat("GPU budget ms", &settings.targetMs, 4.0f, 33.0f);
+				changed |= ImGui::SliderFloat("Min scale", &settings.minScale, 0.25f, 1.0f);
+				if (changed)
+					resolutionController.setSettings(settings);
+
+				ImGui::Separator();
+
+				auto& stats = resolutionController.getStats();
+				ImGui::Text("GPU frame: %.2f ms", gpuFrameMs);
+				ImGui::Text("Rendering %u x %u of %d x %d", resolutionFrame.width, resolutionFrame.height, width, height);
+				ImGui::Text("%u frames measured, %u over budget, %u changes of scale", stats.frames, stats.framesOverBudget, stats.scaleChanges);
+				ImGui::TextDisabled("Controller traces and viewport checks: ReferenceRenderer --dynamic-resolution");
+				ImGui::EndMenu();
+			}
+
+			if (ImGui::BeginMenu("Occlusion")) {
+				if (ImGui::MenuItem("Enabled", nullptr, occlusionCullingEnabled)) occlusionCullingEnabled = !occlusionCullingEnabled;
+
+				if (occlusionCuller) {
+					if (ImGui::MenuItem("AVX2", nullptr, occlusionUseAVX2, OcclusionCuller::hasAVX2())) occlusionUseAVX2 = !occlusionUseAVX2;
+
+					ImGui::Separator();
+
+					auto& stats = frame->occlusionStats;
+					ImGui::Text("%u occluders, %llu triangles", occlusionCuller->getNumOccluders(), stats.occluderTriangles);
+					if (occlusionCullingEnabled) {
+						ImGui::Text("Meshes culled: %.1f%% (%llu frustum, %llu occluded)", stats.culledPercent(), stats.frustumCulled, stats.occlusionCulled);
+						ImGui::Text("Triangles culled: %.1f%%", stats.culledTrianglePercent());
+						ImGui::Text("Setup %.3f ms, raster %.3f ms, test %.3f ms", stats.setupMs, stats.rasterMs, stats.testMs);
+					}
+				}
+				else ImGui::TextDisabled("Waiting for every mesh to load");
+				ImGui::EndMenu();
+			}
+
+			if (ImGui::BeginMenu("Depth Prepass")) {
+				for (auto mode : { DepthPrepassMode::Off, DepthPrepassMode::FrontToBack, DepthPrepassMode::Prepass }) {
+					if (ImGui::MenuItem(getDepthPrepassModeName(mode), nullptr, depthPrepassMode == mode)) depthPrepassMode = mode;
+				}
+
+				ImGui::Separator();
+
+				ImGui::Text("%zu opaque, %zu alpha tested", frame->opaqueInstances, frame->alphaTestedInstances);
+				ImGui::Text("G-buffer PS invocations: %llu", gbufferPixelShaderInvocations);
+				ImGui::Text("Per screen pixel: %.2f", static_cast<double>(gbufferPixelShaderInvocations) / (static_cast<double>(width) * height));
+				ImGui::TextDisabled("Exact overdraw per mode: ReferenceRenderer --overdraw");
+				ImGui::EndMenu();
+			}
+
+			if (ImGui::BeginMenu("Shaders")) {
+				if (ImGui::MenuItem("Permutations", nullptr, shaderPermutationsEnabled)) shaderPermutationsEnabled = !shaderPermutationsEnabled;
+				if (ImGui::MenuItem("Recompile All", nullptr, false, !shaderCompiler->isBusy())) shaderCompiler->requestAll();
+
+				ImGui::Separator();
+
+				auto stats = shaderCache->getStats();
+				ImGui::Text("%zu variants for %zu materials", deferredPixelVariants.size(), materialFeatures.size());
+				ImGui::Text("Cache: %llu compiled, %llu from disk, %llu keys hashed", stats.compiles, stats.diskHits, stats.keyHashes);
+				if (stats.failures)
+					ImGui::Text("%llu failed, see console", stats.failures);
+
+				ImGui::Text("Watching %u shaders%s", shaderCompiler->getNumWatched(), shaderCompiler->isBusy() ? ", compiling" : "");
+				if (lastShaderBatchSize)
+					ImGui::Text("Last reload: %u shaders in %.1f ms", lastShaderBatchSize, lastShaderBatchMs);
+				ImGui::EndMenu();
+			}
+
+			if (ImGui::BeginMenu("Textures")) {
+				ImGui::Text("%u textures in %u arrays, %u slices", texturePackStats.textures, texturePackStats.arrays, texturePackStats.slices);
+				ImGui::Text("%u atlas pages holding %u textures", texturePackStats.atlasPages, texturePackStats.atlasTextures);
+				ImGui::Text("Packing efficiency: %.1f%%", texturePackStats.efficiency());
+				ImGui::Text("Masks: %u packed RG, %u R, %u colour specular", textureCookStats.packedTextures, textureCookStats.singleChannelTextures, textureCookStats.colourSpecularTextures);
+				ImGui::Text("Cooking saved %.1f MB of top mips", textureCookStats.bytesSaved() / (1024.0 * 1024.0));
+				ImGui::Text("Mips: %.1f MB for %u textures in %.1f ms", mipGenerationStats.bytes / (1024.0 * 1024.0), mipGenerationStats.textures, mipGenerationStats.ms);
+				ImGui::Text("SRV binds: %llu for %llu material draws", textureArrayBinds, materialDraws);
+				ImGui::EndMenu();
+			}
+
+			if (ImGui::BeginMenu("States")) {
+				auto& stats = stateCache->getStats();
+				ImGui::Text("%zu pipelines, %zu samplers", stateCache->getNumPipelines(), stateCache->getNumSamplers());
+				ImGui::Text("%llu objects created for %llu requests", stats.created, stats.requests);
+				ImGui::Text("Binds: %llu set, %llu skipped", bindState.changes, bindState.skipped);
+				ImGui::EndMenu();
+			}
+
+			if (ImGui::BeginMenu("Constants")) {
+				auto& stats = constantRing->getFrameStats();
+				ImGui::Text("%s", constantRing->supportsOffsets() ? "Ring, NO_OVERWRITE + offsets" : "Fallback, DISCARD per upload");
+				ImGui::Text("%llu uploads, %.1f KB of %.1f KB", stats.allocations, stats.bytesAllocated / 1024.0, constantRing->getCapacity() / 1024.0);
+				ImGui::Text("%llu discards", stats.discards);
+				ImGui::Text("%u materials, uploaded as textures stream in", materialConstants ? materialConstants->size() : 0);
+				ImGui::EndMenu();
+			}
+
+			if (ImGui::BeginMenu("Loading")) {
+				ImGui::Text("%s", getSceneStreamStageName(sceneStreamer->getStage()));
+				ImGui::Text("Meshes: %zu of %zu uploaded", loadedMesh.size(), streamedMeshCount);
+				ImGui::Text("Instances: %zu", sceneInstances.size());
+				ImGui::Text("Textures: %u of %u decoded", sceneStreamer->getTexturesDecoded(), sceneStreamer->getTextureCount());
+				ImGui::Text("Texture arrays: %u of %zu uploaded", nextArrayUpload, streamedPack.arrays.size());
+
+				ImGui::Separator();
+
+				ImGui::SliderInt("Upload budget (MB)", &uploadBudgetMB, 1, 256);
+				ImGui::Text("Uploaded %.1f MB this frame, %.1f MB total", uploadedBytesThisFrame / (1024.0 * 1024.0), uploadedBytesTotal / (1024.0 * 1024.0));
+
+				ImGui::Separator();
+
+				ImGui::Text("First frame: %.0f ms", firstFrameMs);
+				if (firstGeometryMs > 0.0)
+					ImGui::Text("First geometry: %.0f ms", firstGeometryMs);
+				if (sceneLoaded)
+					ImGui::Text("Fully loaded: %.0f ms", fullyLoadedMs);
+				ImGui::EndMenu();
+			}
+
+			if (ImGui::BeginMenu("Memory")) {
+				ImGui::Text("Last frame: %llu allocations, %.1f KB", lastFrameAllocations.allocations, lastFrameAllocations.bytes / 1024.0);
+				ImGui::Text("%u frames in a row without one", allocationFreeFrames);
+				ImGui::Text("Frame arena: %.1f KB of %.1f KB, %.1f KB at most", frameArena->getUsed() / 1024.0, frameArena->getCapacity() / 1024.0, frameArena->getHighWater() / 1024.0);
+				ImGui::Text("%llu overflows onto the heap", frameArena->getOverflows());
+				ImGui::Text("Texture arrays: %zu in %zu pooled", textureArrayPool.getCount(), textureArrayPool.getCapacity());
+
+				ImGui::Separator();
+
+				for (int stage = 0; stage < static_cast<int>(SceneStreamStage::Done); stage++) {
+					auto counts = sceneStreamer->getStageAllocations(static_cast<SceneStreamStage>(stage));
+					ImGui::Text("%s: %llu allocations, %.1f MB", getSceneStreamStageName(static_cast<SceneStreamStage>(stage)), counts.allocations, counts.bytes / (1024.0 * 1024.0));
+				}
+				ImGui::Text("Import scratch: %.1f MB", importScratchUsed / (1024.0 * 1024.0));
+
+				ImGui::Text("Last tick: %llu allocations, %.1f KB", frame->allocations.allocations, frame->allocations.bytes / 1024.0);
+
+				auto total = getAllocationCounts();
+				ImGui::Text("Process: %llu allocations, %llu frees", total.allocations, total.frees);
+				ImGui::EndMenu();
+			}
+
+			if (ImGui::BeginMenu("Simulation")) {
+				ImGui::SliderInt("Ticks per second", &simulationHz, 10, 480);
+
+				ImGui::Separator();
+
+				ImGui::Text("Tick %llu: %.3f ms, cull %.3f ms, record %.3f ms", frame->sequence, frame->tickMs, frame->cullMs, frame->recordMs);
+				ImGui::Text("Drawn %.1f ms after it ran", snapshotAgeMs);
+				ImGui::Text("Ticks: %llu drawn, %llu skipped, %llu frames drew one again", snapshotsDrawn, snapshotsSkipped, snapshotsRepeated);
+				ImGui::TextDisabled("Exchange checks and latency: ReferenceRenderer --snapshots");
+				ImGui::EndMenu();
+			}
+
+			if (ImGui::BeginMenu("Streaming")) {
+				if (!tilePool->isSupported()) {
+					ImGui::TextDisabled("No tiled resources tier 2, every texture is fully resident");
+				}
+				else if (textureStreamer) {
+					auto& stats = textureStreamer->getStats();
+					ImGui::SliderInt("Budget (MB)", &textureBudgetMB, 16, 1024);
+					ImGui::Text("%u textures, %.1f MB of tails always resident", textureStreamer->getNumTextures(), stats.tailBytes / (1024.0 * 1024.0));
+					ImGui::Text("Resident: %.1f MB (%.1f%%), peak %.1f MB", stats.residentBytes / (1024.0 * 1024.0), stats.budgetUsedPercent(), stats.peakResidentBytes / (1024.0 * 1024.0));
+					ImGui::Text("Tile pool: %u of %u tiles", tilePool->getUsedTiles(), tilePool->getTileCount());
+
+					ImGui::Separator();
+
+					ImGui::Text("This frame: %u loads (%.1f MB), %u evictions", stats.loads, stats.loadedBytes / (1024.0 * 1024.0), stats.evictions);
+					ImGui::Text("Short of the view: %u textures, %u mips (%u at most)", stats.texturesShort, stats.mipDeficit, stats.maxDeficit);
+					ImGui::Text("Over budget: %u loads", stats.budgetLimited);
+					ImGui::Text("Total: %llu loads (%.1f MB), %llu evictions", stats.totalLoads, stats.totalLoadedBytes / (1024.0 * 1024.0), stats.totalEvictions);
+				}
+				else ImGui::TextDisabled("Waiting for the scene to load");
+				ImGui::EndMenu();
+			}
+
+			if (ImGui::BeginMenu("Scene Graph")) {
+				if (instanceWorldBuffer) {
+					auto& stats = frame->graphStats;
+					ImGui::Text("%u nodes in %u levels, %zu instances", sceneGraph.size(), sceneGraph.getLevelCount(), sceneInstances.size());
+					ImGui::Text("Last update: %u nodes, %u levels skipped, %.3f ms", stats.updated, stats.levelsSkipped, stats.ms);
+
+					ImGui::Separator();
+
+					// Names and levels never change after the import, so they're safe to read with the simulation running.
+					// The offset goes over with the input, see applyNodeEdit.
+					if (ImGui::SliderInt("Node", &editNode, 0, static_cast<int>(sceneGraph.size()) - 1)) {
+						editNodeOffset = {};
+						editSelection++;
+					}
+					ImGui::Text("%s, level %u", sceneGraph.getName(editNode).c_str(), sceneGraph.getLevel(editNode));
+
+					ImGui::DragFloat3("Offset", &editNodeOffset.x, 0.01f);
+				}
+				else ImGui::TextDisabled("Waiting for the scene to import");
+				ImGui::EndMenu();
+			}
+
+			if (ImGui::BeginMenu("Geometry")) {
+				auto stats = geometryPool->getStats();
+				ImGui::Text("%u pages, %u meshes", stats.pages, stats.arenas.allocations);
+				ImGui::Text("Vertices: %.1f MB used, %.1f MB free", sizeof(Vertex) * stats.arenas.usedVertices / (1024.0 * 1024.0), sizeof(Vertex) * stats.arenas.freeVertices / (1024.0 * 1024.0));
+				ImGui::Text("Indices: %.1f MB used, %.1f MB free", sizeof(uint32_t) * stats.arenas.usedIndices / (1024.0 * 1024.0), sizeof(uint32_t) * stats.arenas.freeIndices / (1024.0 * 1024.0));
+				ImGui::Text("Fragmentation: %.1f%% vertices, %.1f%% indices", 100.0f * stats.arenas.vertexFragmentation(), 100.0f * stats.arenas.indexFragmentation());
+				ImGui::Text("%u compactions, %.1f MB moved", stats.compactions, stats.movedBytes / (1024.0 * 1024.0));
+				ImGui::Text("Buffer binds: %llu for %llu draws", geometryBinds, geometryDraws);
+				ImGui::TextDisabled("Allocator churn test: ReferenceRenderer --geometry-churn");
+				ImGui::EndMenu();
+			}
+
+			if (ImGui::BeginMenu("Instancing")) {
+				ImGui::MenuItem("Enabled", nullptr, &instancingEnabled);
+
+				ImGui::Separator();
+
+				ImGui::Text("%u meshes, %u unique", instancingStats.totalMeshes, instancingStats.uniqueMeshes);
+				ImGui::Text("Vertex and index data: %llu KB, %llu KB saved", instancingStats.bytesAfter / 1024, (instancingStats.bytesBefore - instancingStats.bytesAfter) / 1024);
+				ImGui::Text("Found in %.1f ms at import", instancingStats.ms);
+				ImGui::Text("Draws: %zu for %zu instances", views[0].batches.batches.size(), views[0].batches.instances.size());
+				ImGui::EndMenu();
+			}
+
+			if (ImGui::BeginMenu("Occlusion")) {
+				if (!occlusionStreamed) {
+					ImGui::TextDisabled("Waiting for the bake");
+				}
+				else if (occlusionStats.upToDate) {
+					ImGui::Text("Read from the cache in %.1f ms", occlusionStats.totalMs);
+				}
+				else {
+					ImGui::Text("%u triangles, %u after splitting, %u nodes, depth %u", occlusionStats.triangles, occlusionStats.references, occlusionStats.nodes, occlusionStats.depth);
+					ImGui::Text("%llu vertices, %llu rays", occlusionStats.vertices, occlusionStats.rays);
+					ImGui::Text("Baked in %.1f ms, %.1f ms tracing, %.2f Mrays/s", occlusionStats.totalMs, occlusionStats.traceMs, occlusionStats.raysPerSecond() / 1e6);
+				}
+				ImGui::TextDisabled("Bake and check offline: ReferenceRenderer --bake-ao");
+				ImGui::EndMenu();
+			}
+
+			if (ImGui::BeginMenu("Views")) {
+				if (ImGui::MenuItem("Single", nullptr, viewCount == 1)) viewCount = 1;
+				if (ImGui::MenuItem("Split in two", nullptr, viewCount == 2)) viewCount = 2;
+				if (ImGui::MenuItem("Split in four", nullptr, viewCount == 4)) viewCount = 4;
+				ImGui::MenuItem("Cull lights by radius", nullptr, &cullLightsByRadius);
+
+				ImGui::Separator();
+
+				ImGui::Text("Cull: %u bounds against %zu views in %.3f ms", frame->viewBounds.count, views.size(), frame->cullMs);
+				ImGui::Text("Record: %.3f ms", frame->recordMs);
+				for (size_t i = 0; i < views.size(); i++) {
+					auto& view = views[i];
+					ImGui::Text("View %zu: %zu draws, %zu instances, %zu lights", i, view.batches.batches.size(), view.batches.instances.size(), view.lights.size());
+				}
+				ImGui::TextDisabled("Cost per view count: ReferenceRenderer --views");
+				ImGui::EndMenu();
+			}
+
+			if (ImGui::BeginMenu("Shadows")) {
+				ImGui::MenuItem("Enabled", nullptr, &shadowsEnabled);
+				ImGui::SliderInt("Faces per frame", &shadowFaceBudget, 6, 120);
+
+				ImGui::Separator();
+
+				auto& stats = shadowCache->getStats();
+				auto& atlas = shadowCache->getAtlas();
+				ImGui::Text("%u of %u lights shadowed, %u visible", stats.shadowedLights, stats.lights, stats.visibleLights);
+				ImGui::Text("Atlas: %u tiles, %.1f%% used, largest free %u", atlas.getTileCount(), 100.0f * stats.atlasUsage, stats.largestFreeTile);
+				ImGui::Text("This frame: %u faces drawn, %u deferred, %u avoided", stats.facesRendered, stats.facesDeferred, stats.facesAvoided);
+				ImGui::Text("%u resized, %u evicted, %u without room", stats.reallocations, stats.evictions, stats.unallocated);
+				ImGui::Text("Longest wait: %u frames", stats.maxWaitFrames);
+				ImGui::Text("Update %.3f ms, record %.3f ms, %u draws", stats.updateMs, shadowRecordMs, shadowDraws);
+				uint64_t naive = stats.totalFacesRendered + stats.totalFacesAvoided;
+				ImGui::Text("Total: %llu faces drawn, %.1f%% of redraws avoided", stats.totalFacesRendered, naive ? 100.0 * stats.totalFacesAvoided / naive : 0.0);
+				ImGui::TextDisabled("Allocator and scheduler checks: ReferenceRenderer --shadows");
+				ImGui::EndMenu();
+			}
+
+			if (ImGui::BeginMenu("Environment")) {
+				ImGui::SliderFloat("Diffuse ambient", &diffuseAmbientScale, 0.0f, 4.0f);
+				if (environmentBaked) {
+					ImGui::SliderFloat("Specular ambient", &specularAmbientScale, 0.0f, 4.0f);
+
+					ImGui::Separator();
+
+					auto& sh = environment.irradiance.coefficients[0];
+					ImGui::Text("Average irradiance / PI: %.3f %.3f %.3f", sh.x, sh.y, sh.z);
+					ImGui::Text("Specular cube: %u, %u levels", environment.specular.size, environment.specular.levelCount);
+					if (environmentStats.upToDate) {
+						ImGui::Text("Read from the cache in %.1f ms", environmentStats.loadMs);
+					}
+					else {
+						ImGui::Text("Load %.1f ms, SH %.2f ms, prefilter %.1f ms", environmentStats.loadMs, environmentStats.projectMs, environmentStats.prefilterMs);
+					}
+				}
+				else {
+					ImGui::TextDisabled("No environment probe, ambient is the first light's");
+				}
+				ImGui::TextDisabled("Bake cost and checks: ReferenceRenderer --bake-environment");
+				ImGui::EndMenu();
+			}
+
+			if (ImGui::BeginMenu("Virtual Texturing")) {
+				if (virtualStreamer) {
+					if (ImGui::MenuItem("Enabled", nullptr, virtualTexturingEnabled)) {
+						virtualTexturingEnabled = !virtualTexturingEnabled;
+						rebuildMaterialConstants();
+					}
+
+					ImGui::Separator();
+
+					auto& settings = virtualLayout.settings;
+					auto& cache = virtualStreamer->getCache();
+					ImGui::Text("%zu textures in %u of %u pages", virtualLayout.regions.size(), virtualLayout.pagesUsed, settings.virtualPages * settings.virtualPages);
+					ImGui::Text("Tile file: %u tiles, %.1f MB%s", virtualCookStats.tiles, virtualCookStats.bytes / (1024.0 * 1024.0), virtualCookStats.upToDate ? ", already cooked" : "");
+					ImGui::Text("Cache: %u of %u tiles, %u pinned", cache.getUsedSlots(), cache.getSlotCount(), cache.getPinnedSlots());
+
+					if (virtualTexturingEnabled) {
+						auto& stats = virtualStreamer->getStats();
+
+						ImGui::Separator();
+
+						ImGui::Text("Feedback: %ux%u, %u pages, %u cached", virtualFeedbackWidth, virtualFeedbackHeight, stats.feedback.pages, stats.feedback.resident);
+						ImGui::Text("This frame: %u wanted, %u loads started, %u landed", stats.requested, stats.loadsStarted, stats.loadsCompleted);
+						ImGui::Text("%u evictions, %u dropped, %u tiles uploaded", stats.evictions, stats.dropped, virtualTileUploads);
+						ImGui::Text("In flight: %u, latency %.1f frames", stats.inFlight, stats.averageLatencyFrames);
+						ImGui::Text("Total: %llu loads, %llu evictions", stats.totalLoads, stats.totalEvictions);
+						ImGui::Text("Page table entries written: %llu", virtualStreamer->getPageTable().getEntriesWritten());
+					}
+				}
+				else ImGui::TextDisabled(texturesStreamed ? "No texture is big enough to be virtual" : "Waiting for the textures to cook");
+				ImGui::EndMenu();
 			}
 
+			if (!sceneLoaded)
+				ImGui::TextDisabled("Loading: %s", getSceneStreamStageName(sceneStreamer->getStage()));
+
 			ImGui::EndMainMenuBar();
 
 			if (currentVisualizedBuffer >= 0) {
@@ -1036,7 +3335,9 @@ private:
 				ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, ImVec2());
 				ImGui::SetNextWindowContentSize({ (float)width, (float)height - mainMenuSize.y });
 				if (ImGui::Begin("Visualize", nullptr, ImGuiWindowFlags_NoCollapse | ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_NoMouseInputs | ImGuiWindowFlags_NoBringToFrontOnFocus)) {
-					ImGui::Image(geometryBuffer.textureResourceViews[currentVisualizedBuffer], ImGui::GetWindowSize());
+					// Only the top left of the targets was rendered to with dynamic resolution on.
+					ImVec2 rendered(static_cast<float>(resolutionFrame.width) / width, static_cast<float>(resolutionFrame.height) / height);
+					ImGui::Image(getLightingInputs()[currentVisualizedBuffer], ImGui::GetWindowSize(), ImVec2(0.0f, 0.0f), rendered);
 
 					ImGui::End();
 				}
@@ -1053,126 +3354,163 @@ private:
 		//}
 		//ImGui::End();
 
-		deferredGraphicsPipeline->bind(context);
-		//context->ClearRenderTargetView(multisampleRTV, clearColor);
-		//context->OMSetRenderTargets(1, &multisampleRTV, nullptr);
-
-		D3D11_MAPPED_SUBRESOURCE mapped{};
-		context->Map(perFrameUniformsBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
-		memcpy(mapped.pData, &perFrameUniforms, sizeof(PerFrameUniforms));
-		context->Unmap(perFrameUniformsBuffer, 0);
+		auto& lastView = views.back();
+		if (lastView.firstInstance + lastView.batches.instances.size() > 0) {
+			D3D11_MAPPED_SUBRESOURCE mappedInstances{};
+			context->Map(instanceIndexBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedInstances);
+			for (auto& view : views) {
+				memcpy(static_cast<uint32_t*>(mappedInstances.pData) + view.firstInstance, view.batches.instances.data(), sizeof(uint32_t) * view.batches.instances.size());
+			}
+			context->Unmap(instanceIndexBuffer, 0);
+		}
 
 		float clearColor[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
 		for (size_t i = 0; i < GeometryBuffer::MAX_BUFFER; i++)
 		{
-			context->ClearRenderTargetView(geometryBuffer.textureViews[i], clearColor);
+			if (geometryBuffer.textureViews[i])
+				context->ClearRenderTargetView(geometryBuffer.textureViews[i], clearColor);
 		}
 		context->ClearDepthStencilView(depthStencilView, D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL, 1.0, 0);
-		context->OMSetRenderTargets(GeometryBuffer::MAX_BUFFER, geometryBuffer.textureViews, depthStencilView);
 
-		// Deferred passes to geometry buffer
 		context->VSSetConstantBuffers(0, 1, &perFrameUniformsBuffer);
 		context->PSSetConstantBuffers(0, 1, &perFrameUniformsBuffer);
 
-		uint32_t strides = sizeof(Vertex);
-		uint32_t offsets = 0;
+		constantRing->beginFrame();
+
+		// ImGui set state behind the tracker's back last frame.
+		bindState.reset();
 
-		//context->IASetVertexBuffers(0, 1, &vertices, &strides, &offsets);
-		//context->IASetIndexBuffer(indices, DXGI_FORMAT_R32_UINT, 0);
-		//context->DrawIndexed(numIndices, 0, 0);
+		ID3D11SamplerState* materialSamplers[] = { materialSampler, materialSampler, materialSampler, materialSampler };
+		context->PSSetSamplers(0, 4, materialSamplers);
+		context->PSSetShaderResources(4, 1, &textureMinLodSRV);
 
-		ID3D11SamplerState* nullSampler = nullptr;
-		ID3D11ShaderResourceView* nullTexture = nullptr;
+		ID3D11ShaderResourceView* virtualTextureViews[] = { virtualPageTableSRV, virtualCacheSRV };
+		context->PSSetShaderResources(5, 2, virtualTextureViews);
 
-		for (const auto& mesh : loadedMesh) {
-			auto& mat = loadedMaterials[mesh.materialId];
+		uint32_t instanceStride = sizeof(uint32_t);
+		uint32_t instanceOffset = 0;
+		context->VSSetShaderResources(7, 1, &instanceWorldSRV);
+		context->IASetVertexBuffers(1, 1, &instanceIndexBuffer, &instanceStride, &instanceOffset);
 
-			ID3D11ShaderResourceView* views[] = {
-				(mat.settings.useDiffuseTexture) ? textureCache[mat.diffuseTexture]->textureSRV : nullptr,
-				(mat.settings.useNormalTexture) ? textureCache[mat.normalTexture]->textureSRV : nullptr,
-				(mat.settings.useAlphaCutoutTexture) ? textureCache[mat.alphaCutoutTexture]->textureSRV : nullptr,
-				(mat.settings.useSpecularTexture) ? textureCache[mat.specularTexture]->textureSRV : nullptr,
-			};
+		// The lighting pass put the G-buffer in t0-t3 last frame.
+		resetTextureArrayBinding(boundTextureArrays);
+		textureArrayBinds = 0;
+		materialDraws = 0;
 
-			ID3D11SamplerState* samplers[] = {
-				(mat.settings.useDiffuseTexture) ? textureCache[mat.diffuseTexture]->sampler : nullptr,
-				(mat.settings.useNormalTexture) ? textureCache[mat.normalTexture]->sampler : nullptr,
-				(mat.settings.useAlphaCutoutTexture) ? textureCache[mat.alphaCutoutTexture]->sampler : nullptr,
-				(mat.settings.useSpecularTexture) ? textureCache[mat.specularTexture]->sampler : nullptr,
-			};
+		// The lighting pass and ImGui bound their own vertex buffers last frame.
+		geometryPool->resetBinding();
+		geometryDraws = 0;
+		geometryBinds = 0;
 
-			context->PSSetShaderResources(0, 4, views);
-			context->PSSetSamplers(0, 4, samplers);
+		bool timed = beginGpuTimer();
 
-			//if (mat.settings.useDiffuseTexture) {
-			//	auto tex = textureCache[mat.diffuseTexture];
+		if (shadowsEnabled)
+			drawShadows();
 
-			//	context->PSSetSamplers(0, 1, &tex->sampler);
-			//	context->PSSetShaderResources(0, 1, &tex->textureSRV);
-			//}
+		// Depth prepass, opaque front to back with no pixel shader, then the alpha tested bucket.
+		if (depthPrepassMode == DepthPrepassMode::Prepass) {
+			context->OMSetRenderTargets(0, nullptr, depthStencilView);
 
-			//if (mat.settings.useNormalTexture) {
-			//	auto tex = textureCache[mat.normalTexture];
+			for (auto& view : views) {
+				bindView(view);
+				auto& batches = view.batches;
 
-			//	context->PSSetSamplers(1, 1, &tex->sampler);
-			//	context->PSSetShaderResources(1, 1, &tex->textureSRV);
-			//}
+				depthPrepassGraphicsPipeline->bind(context, view.viewport, view.scissor, &bindState);
+				for (size_t i = 0; i < batches.opaqueCount; i++) {
+					drawBatch(batches.batches[i], view.firstInstance);
+				}
 
-			//if (mat.settings.useAlphaCutoutTexture) {
-			//	auto tex = textureCache[mat.alphaCutoutTexture];
+				depthPrepassAlphaGraphicsPipeline->bind(context, view.viewport, view.scissor, &bindState);
+				for (size_t i = batches.opaqueCount; i < batches.batches.size(); i++) {
+					auto& batch = batches.batches[i];
+					bindMaterial(loadedMesh[batch.mesh].materialId);
+					drawBatch(batch, view.firstInstance);
+				}
+			}
+		}
 
-			//	context->PSSetSamplers(2, 1, &tex->sampler);
-			//	context->PSSetShaderResources(2, 1, &tex->textureSRV);
-			//}
+		//context->ClearRenderTargetView(multisampleRTV, clearColor);
+		//context->OMSetRenderTargets(1, &multisampleRTV, nullptr);
 
-			D3D11_MAPPED_SUBRESOURCE mappedSettings{};
-			context->Map(perMaterialUniformsBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedSettings);
-			memcpy(mappedSettings.pData, &mat.settings, sizeof(MaterialCbuffer));
-			context->Unmap(perMaterialUniformsBuffer, 0);
+		context->OMSetRenderTargets(GeometryBuffer::MAX_BUFFER, geometryBuffer.textureViews, depthStencilView);
 
-			context->PSSetConstantBuffers(1, 1, &perMaterialUniformsBuffer);
+		// Deferred passes to geometry buffer
+		bool measurePipelineStatistics = !pipelineStatisticsPending;
+		if (measurePipelineStatistics)
+			context->Begin(pipelineStatisticsQuery);
 
-			context->IASetVertexBuffers(0, 1, &mesh.vertices, &strides, &offsets);
-			context->IASetIndexBuffer(mesh.indices, DXGI_FORMAT_R32_UINT, 0);
-			context->DrawIndexed(mesh.indexCount, 0, 0);
-		}
+		for (auto& view : views) {
+			bindView(view);
+			deferredGraphicsPipeline->bind(context, view.viewport, view.scissor, &bindState);
 
-		// Light accumulation pass to the backbuffer
-		ID3D11Texture2D* backBuffer;
-		if (FAILED(swapChain->GetBuffer(0, IID_PPV_ARGS(&backBuffer)))) {
-			throw std::runtime_error("Failed to get a back buffer!");
+			if (depthPrepassMode == DepthPrepassMode::Prepass)
+				bindState.setDepthStencilState(context, depthEqualState);
+
+			for (auto& batch : view.batches.batches) {
+				const auto& mesh = loadedMesh[batch.mesh];
+
+				if (shaderPermutationsEnabled) {
+					auto variant = deferredPixelVariants.find(materialFeatures[mesh.materialId]);
+					auto shader = variant != deferredPixelVariants.end() ? variant->second : deferredGraphicsPipeline->pixelShader;
+
+					bindState.setPixelShader(context, shader);
+				}
+
+				bindMaterial(mesh.materialId);
+				drawBatch(batch, view.firstInstance);
+			}
 		}
 
-		ID3D11RenderTargetView* renderTarget;
+		if (measurePipelineStatistics) {
+			context->End(pipelineStatisticsQuery);
+			pipelineStatisticsPending = true;
+		}
 
-		D3D11_RENDER_TARGET_VIEW_DESC rtvDesc{};
-		rtvDesc.Format = swapChainFormat;
-		rtvDesc.ViewDimension = D3D11_RTV_DIMENSION_TEXTURE2D;
-		rtvDesc.Texture2D.MipSlice = 0;
+		if (virtualStreamer && virtualTexturingEnabled)
+			drawVirtualFeedback();
 
-		if (FAILED(device->CreateRenderTargetView(backBuffer, &rtvDesc, &renderTarget))) {
-			throw std::runtime_error("Failed to create backbuffer RTV!");
+		D3D11_QUERY_DATA_PIPELINE_STATISTICS pipelineStatistics;
+		if (pipelineStatisticsPending && context->GetData(pipelineStatisticsQuery, &pipelineStatistics, sizeof(pipelineStatistics), D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK) {
+			gbufferPixelShaderInvocations = pipelineStatistics.PSInvocations;
+			pipelineStatisticsPending = false;
 		}
 
-		backBuffer->Release();
+		// Light accumulation pass, to the backbuffer unless it's upscaled there after
+		auto lightTarget = dynamicResolutionEnabled ? lightAccumulationRTV : backBufferRTV;
+		context->ClearRenderTargetView(lightTarget, clearColor);
+		context->OMSetRenderTargets(1, &lightTarget, nullptr);
 
-		context->ClearRenderTargetView(renderTarget, clearColor);
-		context->OMSetRenderTargets(1, &renderTarget, nullptr);
+		context->PSSetShaderResources(0, GeometryBuffer::MAX_BUFFER, getLightingInputs().data());
 
-		lightingGraphicsPipeline->bind(context);
-		context->PSSetShaderResources(0, GeometryBuffer::MAX_BUFFER, geometryBuffer.textureResourceViews);
+		context->PSSetShaderResources(8, 1, &environmentSRV);
+		context->PSSetShaderResources(9, 1, &shadowAtlasSRV);
 
-		context->PSSetSamplers(0, 1, &gbufferSampler);
+		ID3D11SamplerState* lightingSamplers[] = { gbufferSampler, environmentSampler, shadowSampler };
+		context->PSSetSamplers(0, 3, lightingSamplers);
 
-		// Draw light mesh
-		for (size_t i = 0; i < lights.size(); i++)
-		{
-			lighting->DrawPointLight(context, lights[i]);
+		// Ambient then every light, a full screen quad each
+		for (auto& view : views) {
+			bindView(view);
+			ambientGraphicsPipeline->bind(context, view.viewport, view.scissor, &bindState);
+			context->Draw(4, 0);
+
+			lightingGraphicsPipeline->bind(context, view.viewport, view.scissor, &bindState);
+
+			for (uint32_t light : view.lights) {
+				lighting->DrawPointLight(context, *constantRing, frame->lights[light], shadowsEnabled ? shadowCache->getConstants(light) : ShadowConstants{});
+			}
 		}
 
 		ID3D11ShaderResourceView* nullSRVs[GeometryBuffer::MAX_BUFFER];
 		memset(nullSRVs, 0, sizeof(nullSRVs));
 		context->PSSetShaderResources(0, GeometryBuffer::MAX_BUFFER, nullSRVs);
+		context->PSSetShaderResources(9, 1, nullSRVs);
+
+		if (dynamicResolutionEnabled)
+			drawUpscale();
+
+		if (timed)
+			endGpuTimer();
 
 		//context->ResolveSubresource(backBuffer, 0, multisampleTexture, 0, swapChainFormat);
 
@@ -1180,83 +3518,210 @@ private:
 		ImGui_ImplDX11_RenderDrawData(ImGui::GetDrawData());
 
 		swapChain->Present(1, 0);
-		renderTarget->Release();
-	}
 
-	void RecompileShaders() {
-		// TODO WT: Clean up this memory leak heaven!
-		ID3D11VertexShader* newVertShader;
-		ID3D11PixelShader* newPixelShader;
-		ID3D10Blob* bytecode;
-		ID3D10Blob* errors;
+		if (firstFrameMs == 0.0) {
+			firstFrameMs = getLoadTimeMs();
+			std::cout << "First frame after " << firstFrameMs << " ms" << std::endl;
+		}
 
-		// Graphics
-		if (FAILED(D3DCompileFromFile(L"shaders/deferredVertex.hlsl", nullptr, D3D_COMPILE_STANDARD_FILE_INCLUDE, "main", "vs_5_0", 0, 0, &bytecode, &errors))) {
-			std::wcout << L"deferred vshader error " << (char*)errors->GetBufferPointer() << std::endl;
-			if (errors)
-				errors->Release();
-			return;
+		if (firstGeometryMs == 0.0 && frame->opaqueInstances + frame->alphaTestedInstances > 0) {
+			firstGeometryMs = getLoadTimeMs();
+			std::cout << "First geometry on screen after " << firstGeometryMs << " ms" << std::endl;
 		}
+	}
 
-		device->CreateVertexShader(bytecode->GetBufferPointer(), bytecode->GetBufferSize(), nullptr, &newVertShader);
-		if (errors)
-			errors->Release();
-		bytecode->Release();
+	void bindMaterial(uint32_t materialId) {
+		if (updateTextureArrayBinding(packedMaterials[materialId], boundTextureArrays)) {
+			ID3D11ShaderResourceView* views[MATERIAL_TEXTURE_COUNT];
+			for (uint32_t slot = 0; slot < MATERIAL_TEXTURE_COUNT; slot++) {
+				views[slot] = boundTextureArrays[slot] != NO_TEXTURE_ARRAY ? textureArrays[boundTextureArrays[slot]]->textureSRV : nullptr;
+			}
 
-		if (FAILED(D3DCompileFromFile(L"shaders/deferredPixel.hlsl", nullptr, D3D_COMPILE_STANDARD_FILE_INCLUDE, "main", "ps_5_0", 0, 0, &bytecode, &errors))) {
-			std::wcout << L"deferred pshader error" << (char*)errors->GetBufferPointer() << std::endl;
-			if (errors)
-				errors->Release();
-			return;
+			context->PSSetShaderResources(0, MATERIAL_TEXTURE_COUNT, views);
+			textureArrayBinds++;
 		}
+		materialDraws++;
+
+		constantRing->bind(CONSTANT_STAGE_PIXEL, 1, materialConstants->get(materialId));
+	}
+
+	// firstInstance is where the batch's view starts in the per instance stream.
+	void drawBatch(const DrawBatch& batch, uint32_t firstInstance) {
+		const auto& mesh = loadedMesh[batch.mesh];
+		if (geometryPool->bind(mesh.geometry.page))
+			geometryBinds++;
+		geometryDraws++;
 
-		device->CreatePixelShader(bytecode->GetBufferPointer(), bytecode->GetBufferSize(), nullptr, &newPixelShader);
-		if (errors)
-			errors->Release();
-		bytecode->Release();
+		auto& range = geometryPool->getRange(mesh.geometry);
+		context->DrawIndexedInstanced(range.indexCount, batch.count, range.startIndex, static_cast<INT>(range.baseVertex), firstInstance + batch.first);
+	}
 
-		deferredGraphicsPipeline->vertexShader->Release();
-		deferredGraphicsPipeline->pixelShader->Release();
-		deferredGraphicsPipeline->vertexShader = newVertShader;
-		deferredGraphicsPipeline->pixelShader = newPixelShader;
+	// What the lighting pass reads, slot for slot. The compact layout swaps position for depth.
+	std::array<ID3D11ShaderResourceView*, GeometryBuffer::MAX_BUFFER> getLightingInputs() {
+		std::array<ID3D11ShaderResourceView*, GeometryBuffer::MAX_BUFFER> inputs;
+		for (size_t i = 0; i < GeometryBuffer::MAX_BUFFER; i++) {
+			inputs[i] = geometryBuffer.textureResourceViews[i];
+		}
 
+		if (getGBufferLayoutDesc(geometryBuffer.layout).positionFromDepth)
+			inputs[GeometryBuffer::POSITION] = depthResourceView;
 
+		return inputs;
+	}
 
-		// Lighting
-		if (FAILED(D3DCompileFromFile(L"shaders/lightAccVertex.hlsl", nullptr, D3D_COMPILE_STANDARD_FILE_INCLUDE, "main", "vs_5_0", 0, 0, &bytecode, &errors))) {
-			std::wcout << L"lightAcc vshader error " << (char*)errors->GetBufferPointer() << std::endl;
-			if (errors)
-				errors->Release();
+	void setGBufferLayout(GBufferLayout layout) {
+		if (geometryBuffer.layout == layout)
 			return;
+
+		geometryBuffer.release();
+		geometryBuffer.layout = layout;
+		createGbuffers();
+
+		// Switching back to a layout picks its pipelines back up out of the cache.
+		createDeferredGraphicsPipeline();
+		createLightingGraphicsPipeline();
+		createMaterialPermutations();
+		watchShaders();
+	}
+
+	void watchShaders() {
+		auto& layoutDesc = getGBufferLayoutDesc(geometryBuffer.layout);
+
+		std::vector<ShaderKey> keys;
+		watchedShaders.clear();
+
+		auto add = [&](WatchedShader::Use use, const std::string& name, const char* target, uint32_t features = 0, std::vector<ShaderDefine> defines = {}) {
+			keys.push_back({ name + ".hlsl", "main", target, std::move(defines) });
+			watchedShaders.push_back({ use, features });
+		};
+
+		add(WatchedShader::DeferredVertex, "shaders/deferredVertex", "vs_5_0");
+		add(WatchedShader::DeferredPixel, layoutDesc.deferredPixelShader, "ps_5_0");
+		add(WatchedShader::DepthPrepassAlphaPixel, "shaders/depthPrepassAlphaPixel", "ps_5_0");
+		add(WatchedShader::LightAccVertex, "shaders/lightAccVertex", "vs_5_0");
+		add(WatchedShader::LightAccPixel, layoutDesc.lightAccPixelShader, "ps_5_0");
+		add(WatchedShader::AmbientPixel, layoutDesc.ambientPixelShader, "ps_5_0");
+		add(WatchedShader::VirtualFeedbackPixel, "shaders/virtualFeedbackPixel", "ps_5_0");
+		add(WatchedShader::UpscalePixel, "shaders/upscalePixel", "ps_5_0");
+
+		// Every combination the scene uses, so one that failed at load comes back once it's fixed.
+		std::vector<uint32_t> usedFeatures = materialFeatures;
+		std::sort(usedFeatures.begin(), usedFeatures.end());
+		usedFeatures.erase(std::unique(usedFeatures.begin(), usedFeatures.end()), usedFeatures.end());
+
+		for (uint32_t features : usedFeatures) {
+			add(WatchedShader::DeferredPermutation, layoutDesc.deferredPixelShader, "ps_5_0", features, getMaterialFeatureDefines(features));
 		}
 
-		device->CreateVertexShader(bytecode->GetBufferPointer(), bytecode->GetBufferSize(), nullptr, &newVertShader);
-		if (errors)
-			errors->Release();
-		bytecode->Release();
+		shaderCompiler->watch(keys);
+	}
+
+	template <typename T>
+	static void replaceShader(T*& slot, T* shader) {
+		shader->AddRef();
+		if (slot)
+			slot->Release();
+		slot = shader;
+	}
 
-		if (FAILED(D3DCompileFromFile(L"shaders/lightAccPixel.hlsl", nullptr, D3D_COMPILE_STANDARD_FILE_INCLUDE, "main", "ps_5_0", 0, 0, &bytecode, &errors))) {
-			std::wcout << L"lightAcc pshader error: " << (char*)errors->GetBufferPointer() << std::endl;
-			if (errors)
-				errors->Release();
+	// Called before anything is bound for the frame, so every pipeline in the batch switches over together. Pipelines
+	// are cached on their bytecode, so a reloaded shader means asking the cache for the pipeline again with the new code,
+	// which brings an input layout validated against the new vertex shader along with it.
+	void applyShaderBatch() {
+		ShaderCompileBatch batch;
+		if (!shaderCompiler->takeBatch(batch))
 			return;
+
+		for (auto& error : batch.errors) {
+			std::cout << error << std::endl;
+		}
+
+		// Built up over the whole batch, a pipeline with both shaders reloaded is only requested once.
+		std::vector<std::pair<GraphicsPipeline**, GraphicsPipelineDesc>> reloaded;
+		auto reload = [&](GraphicsPipeline*& pipeline) -> GraphicsPipelineDesc& {
+			for (auto& [slot, desc] : reloaded) {
+				if (slot == &pipeline)
+					return desc;
+			}
+			reloaded.push_back({ &pipeline, graphicsPipelineDescs.at(pipeline) });
+			return reloaded.back().second;
+		};
+
+		for (auto& compiled : batch.shaders) {
+			auto& watched = watchedShaders[compiled.index];
+			auto& code = compiled.bytecode;
+
+			switch (watched.use) {
+			case WatchedShader::DeferredVertex:
+				// The prepass has to keep running the exact same vertex shader or EQUAL stops matching.
+				for (auto pipeline : { &deferredGraphicsPipeline, &depthPrepassGraphicsPipeline, &depthPrepassAlphaGraphicsPipeline, &virtualFeedbackPipeline, &shadowGraphicsPipeline, &shadowAlphaGraphicsPipeline }) {
+					reload(*pipeline).vertexShaderCode = code;
+				}
+				break;
+			case WatchedShader::LightAccVertex:
+				for (auto pipeline : { &lightingGraphicsPipeline, &ambientGraphicsPipeline, &upscaleGraphicsPipeline }) {
+					reload(*pipeline).vertexShaderCode = code;
+				}
+				break;
+			case WatchedShader::DeferredPixel:
+				reload(deferredGraphicsPipeline).pixelShaderCode = code;
+				break;
+			case WatchedShader::DepthPrepassAlphaPixel:
+				reload(depthPrepassAlphaGraphicsPipeline).pixelShaderCode = code;
+				reload(shadowAlphaGraphicsPipeline).pixelShaderCode = code;
+				break;
+			case WatchedShader::LightAccPixel:
+				reload(lightingGraphicsPipeline).pixelShaderCode = code;
+				break;
+			case WatchedShader::AmbientPixel:
+				reload(ambientGraphicsPipeline).pixelShaderCode = code;
+				break;
+			case WatchedShader::VirtualFeedbackPixel:
+				reload(virtualFeedbackPipeline).pixelShaderCode = code;
+				break;
+			case WatchedShader::UpscalePixel:
+				reload(upscaleGraphicsPipeline).pixelShaderCode = code;
+				break;
+			case WatchedShader::DeferredPermutation:
+				// Bound over the deferred pipeline's pixel shader, not part of any pipeline.
+				try {
+					auto shader = stateCache->getPixelShader(code);
+					replaceShader(deferredPixelVariants[watched.features], shader);
+					shader->Release();
+				}
+				catch (const std::exception& e) {
+					std::cout << e.what() << std::endl;
+				}
+				break;
+			default:
+				break;
+			}
 		}
 
-		device->CreatePixelShader(bytecode->GetBufferPointer(), bytecode->GetBufferSize(), nullptr, &newPixelShader);
-		if (errors)
-			errors->Release();
-		bytecode->Release();
+		// A pipeline the device won't create, say a vertex shader whose inputs no longer match the layout, keeps the old one.
+		for (auto& [slot, desc] : reloaded) {
+			try {
+				*slot = requestGraphicsPipeline(desc);
+			}
+			catch (const std::exception& e) {
+				std::cout << e.what() << std::endl;
+			}
+		}
 
-		lightingGraphicsPipeline->vertexShader->Release();
-		lightingGraphicsPipeline->pixelShader->Release();
-		lightingGraphicsPipeline->vertexShader = newVertShader;
-		lightingGraphicsPipeline->pixelShader = newPixelShader;
+		lastShaderBatchSize = static_cast<uint32_t>(batch.shaders.size());
+		lastShaderBatchMs = batch.compileMs;
 
-		std::cout << "Successfully hot reloader lighting pass shaders" << std::endl;
+		if (!batch.shaders.empty())
+			std::cout << "Reloaded " << batch.shaders.size() << " shaders in " << batch.compileMs << " ms" << std::endl;
 	}
 
 	void OnWindowResized(uint32_t width, uint32_t height) {
+		// ResizeBuffers fails while anything still holds a view of the old buffers.
+		context->OMSetRenderTargets(0, nullptr, nullptr);
+		backBufferRTV->Release();
+		backBufferRTV = nullptr;
 		swapChain->ResizeBuffers(numSwapChainBuffers, width, height, swapChainFormat, 0);
+		createBackBufferTarget();
 
 		D3D11_TEXTURE2D_DESC dstDesc;
 		D3D11_DEPTH_STENCIL_VIEW_DESC dstViewDesc;
@@ -1280,14 +3745,14 @@ private:
 			throw std::runtime_error("Failed to create resized Depth Stencil View!");
 		}
 
-		deferredGraphicsPipeline->viewport.Width = static_cast<float>(width);
-		deferredGraphicsPipeline->viewport.Height = static_cast<float>(height);
-
-		deferredGraphicsPipeline->scissor.right = width;
-		deferredGraphicsPipeline->scissor.bottom = height;
+		depthResourceView->Release();
+		createDepthResourceView();
 
 		for (size_t i = 0; i < GeometryBuffer::MAX_BUFFER; i++)
 		{
+			if (!geometryBuffer.textures[i])
+				continue;
+
 			D3D11_TEXTURE2D_DESC texDesc;
 			D3D11_RENDER_TARGET_VIEW_DESC rtvDesc;
 			D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
@@ -1319,11 +3784,13 @@ private:
 
 		}
 
-		lightingGraphicsPipeline->viewport.Width = static_cast<float>(width);
-		lightingGraphicsPipeline->viewport.Height = static_cast<float>(height);
+		releaseLightAccumulationTarget();
+		createLightAccumulationTarget();
 
-		lightingGraphicsPipeline->scissor.right = width;
-		lightingGraphicsPipeline->scissor.bottom = height;
+		if (virtualStreamer) {
+			releaseVirtualFeedbackTargets();
+			createVirtualFeedbackTargets(width, height);
+		}
 	}
 };
 
@@ -0,0 +1,70 @@
+#include "common.hlsli"
+#include "lightAccCommon.hlsli"
+
+SamplerState defaultSampler : register(s0);
+SamplerState environmentSampler : register(s1);
+
+#ifdef GBUFFER_COMPACT
+texture2D depthTexture : register(t0);
+#else
+texture2D positionTexture : register(t0);
+#endif
+texture2D normalTexture : register(t1);
+texture2D albedoTexture : register(t2);
+texture2D specularTexture : register(t3);
+TextureCube specularEnvironment : register(t8);
+
+// Irradiance / PI at the normal, see IrradianceSH for the order of the terms.
+float3 EvaluateIrradianceSH(float3 n) {
+	float3 result = g_irradianceSH[0].rgb;
+	result += g_irradianceSH[1].rgb * n.y;
+	result += g_irradianceSH[2].rgb * n.z;
+	result += g_irradianceSH[3].rgb * n.x;
+	result += g_irradianceSH[4].rgb * (n.x * n.y);
+	result += g_irradianceSH[5].rgb * (n.y * n.z);
+	result += g_irradianceSH[6].rgb * (3.0 * n.z * n.z - 1.0);
+	result += g_irradianceSH[7].rgb * (n.x * n.z);
+	result += g_irradianceSH[8].rgb * (n.x * n.x - n.y * n.y);
+	return max(result, 0.0);
+}
+
+// Lagarde's approximation of how much of the specular lobe the occlusion covers, tighter lobes lose less of it.
+float SpecularOcclusion(float nDotV, float occlusion, float roughness) {
+	return saturate(pow(nDotV + occlusion, exp2(-16.0 * roughness - 1.0)) - 1.0 + occlusion);
+}
+
+// Drawn once per view before the lights, the environment's diffuse and specular for every pixel.
+// The baked occlusion in albedo's alpha darkens both, the lights are left alone.
+float4 main(VertToPixel i) : SV_TARGET
+{
+	float2 uv = i.positionH.xy / g_screenDimensions;
+
+#ifdef GBUFFER_COMPACT
+	float2 viewUv = (i.positionH.xy - g_viewport.xy) / g_viewport.zw;
+	// Loaded rather than sampled, a filtered depth or octahedral normal isn't any pixel's.
+	int3 pixel = int3(i.positionH.xy, 0);
+	float3 positionW = ReconstructPositionW(viewUv, depthTexture.Load(pixel).r);
+	float3 normal = DecodeOctahedral(normalTexture.Load(pixel).xy);
+#else
+	float3 positionW = positionTexture.Sample(defaultSampler, uv).xyz;
+	float3 normal = normalTexture.Sample(defaultSampler, uv).xyz;
+#endif
+	float4 albedo = albedoTexture.Sample(defaultSampler, uv);
+	float4 specular = specularTexture.Sample(defaultSampler, uv);
+
+	float3 toEye = normalize(g_viewPosition - positionW);
+	float3 reflected = reflect(-toEye, normal);
+
+	// Blinn-Phong power to the GGX roughness the cube's levels were filtered for.
+	float power = SpecularPower(specular);
+	float roughness = pow(2.0 / (power + 2.0), 0.25);
+	float3 environment = specularEnvironment.SampleLevel(environmentSampler, reflected, roughness * g_environmentParams.x).rgb;
+
+	float occlusion = albedo.a;
+	float specularOcclusion = SpecularOcclusion(saturate(dot(normal, toEye)), occlusion, roughness);
+
+	float3 color = albedo.rgb * EvaluateIrradianceSH(normal) * occlusion * g_environmentParams.y;
+	color += specular.rgb * environment * specularOcclusion * g_environmentParams.z;
+
+	return float4(color, 1.0);
+}
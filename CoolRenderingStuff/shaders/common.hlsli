@@ -1,10 +1,20 @@
 cbuffer PerFrameUniforms: register(b0) {
 	float2 g_screenDimensions;
-	float2 pad;
+	uint g_frameIndex;
+	float g_virtualFeedbackLodBias;
 	float3 g_viewPosition;
 	float pad2;
 	float4x4 g_view;
 	float4x4 g_viewProj;
+	float4x4 g_invViewProj;
+	// Tile size, border, virtual pages along a side and physical cache size in texels, see VirtualTextureSettings.
+	float4 g_virtualTextureParams;
+	// Origin and size in target pixels of the view being drawn, g_screenDimensions is the whole target.
+	float4 g_viewport;
+	// Ambient irradiance as L2 spherical harmonics, already divided by PI, see IrradianceSH.
+	float4 g_irradianceSH[9];
+	// Last level of the prefiltered specular cube, diffuse and specular ambient scales.
+	float4 g_environmentParams;
 };
 
 float Lambert(float3 toLight, float3 normal, float distanceSquared) {
@@ -13,4 +23,39 @@ float Lambert(float3 toLight, float3 normal, float distanceSquared) {
 	float atten = lambert / distanceSquared;
 
 	return atten;
+}
+
+// Octahedral normal encoding for the compact G-buffer, output is in [-1, 1] for an SNORM target.
+float2 OctahedralWrap(float2 v) {
+	return (1.0 - abs(v.yx)) * (v.xy >= 0.0 ? 1.0 : -1.0);
+}
+
+float2 EncodeOctahedral(float3 n) {
+	n /= (abs(n.x) + abs(n.y) + abs(n.z));
+	n.xy = n.z >= 0.0 ? n.xy : OctahedralWrap(n.xy);
+	return n.xy;
+}
+
+float3 DecodeOctahedral(float2 f) {
+	float3 n = float3(f.x, f.y, 1.0 - abs(f.x) - abs(f.y));
+	float t = saturate(-n.z);
+	n.xy += (n.xy >= 0.0 ? -t : t);
+	return normalize(n);
+}
+
+// Gloss rides in the specular target's alpha, 8 bits of it in the compact layout's RGBA8, see GBufferEncoding::packSpecularGloss.
+float4 PackSpecularGloss(float3 specular, float gloss) {
+	return float4(specular, saturate(gloss));
+}
+
+// Blinn-Phong power from the gloss packed above.
+float SpecularPower(float4 specular) {
+	return specular.a * 100.0;
+}
+
+// uv is in [0, 1] across the view with y going down, depth is the raw depth buffer value.
+float3 ReconstructPositionW(float2 uv, float depth) {
+	float4 ndc = float4(uv.x * 2.0 - 1.0, 1.0 - uv.y * 2.0, depth, 1.0);
+	float4 positionW = mul(g_invViewProj, ndc);
+	return positionW.xyz / positionW.w;
 }
\ No newline at end of file
@@ -9,6 +9,9 @@ struct VertToPixel {
 	float3 normal: NORMAL2;
 	float3 tangent: TANGENT;
 	float3 bitangent: BINORMAL;
+
+	// Baked per vertex, see AmbientOcclusion.h.
+	float occlusion: OCCLUSION;
 };
 
 cbuffer MaterialSettings: register(b1) {
@@ -16,4 +19,99 @@ cbuffer MaterialSettings: register(b1) {
 	int g_matUseNormal;
 	int g_matUseAlphaCutout;
 	int g_matUseSpecular;
-}
\ No newline at end of file
+
+	// MaterialTextureTable, indexed by slot (diffuse, normal, alpha cutout, specular).
+	uint4 g_matTextureSlice;
+	float4 g_matTextureScaleOffset[4];
+	float4 g_matTextureMaxLod;
+	uint4 g_matTextureChannel;
+	uint4 g_matTextureResidency;
+	float4 g_matVirtualRegion[4];
+	// Negative for slots that sample their array.
+	float4 g_matVirtualMaxLevel;
+}
+
+// Most detailed level resident per streamed texture, indexed by g_matTextureResidency. Entry 0 is always 0.
+Buffer<float> g_textureMinLod: register(t4);
+
+// Virtual textures, see VirtualTexture.h. Each page table entry is the cache tile x and y, the level of that tile and 255.
+Texture2D<uint4> g_virtualPageTable: register(t5);
+Texture2D g_virtualCache: register(t6);
+
+// Permutations are compiled with MATERIAL_PERMUTATION and every MATERIAL_USE_* set to 0 or 1 (see ShaderCache.h)
+// so the feature branches fold away. Without it the shader branches on the cbuffer at runtime.
+#ifdef MATERIAL_PERMUTATION
+#define USE_DIFFUSE MATERIAL_USE_DIFFUSE
+#define USE_NORMAL MATERIAL_USE_NORMAL
+#define USE_ALPHA_CUTOUT MATERIAL_USE_ALPHA_CUTOUT
+#define USE_SPECULAR MATERIAL_USE_SPECULAR
+#else
+#define USE_DIFFUSE g_matUseDiffuse
+#define USE_NORMAL g_matUseNormal
+#define USE_ALPHA_CUTOUT g_matUseAlphaCutout
+#define USE_SPECULAR g_matUseSpecular
+#endif
+
+// Where a virtual slot's texcoord lands in the virtual address space, and the level it wants there.
+// The feedback pass biases the lod by the size it renders at, so it asks for what the full size pass samples.
+float2 GetVirtualUV(uint slot, float2 texcoord, float lodBias, out uint level)
+{
+	float4 region = g_matVirtualRegion[slot];
+	float2 uv = frac(texcoord) * region.xy + region.zw;
+
+	float texels = g_virtualTextureParams.z * g_virtualTextureParams.x;
+	float2 dx = ddx(texcoord) * region.xy * texels;
+	float2 dy = ddy(texcoord) * region.xy * texels;
+	float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy))) + lodBias;
+
+	level = (uint)clamp(floor(lod), 0.0, g_matVirtualMaxLevel[slot]);
+	return uv;
+}
+
+// The page table always has something for a page, a region's last level is pinned in the cache.
+// Whatever level that turns out to be, the tile's border covers the bilinear footprint so one sample does.
+float4 SampleVirtualTexture(SamplerState texSampler, uint slot, float2 texcoord)
+{
+	uint level;
+	float2 uv = GetVirtualUV(slot, texcoord, 0.0, level);
+
+	float2 page = uv * g_virtualTextureParams.z;
+	uint4 entry = g_virtualPageTable.Load(int3((uint2)page >> level, level));
+
+	float tileSize = g_virtualTextureParams.x;
+	float border = g_virtualTextureParams.y;
+	float2 inTile = frac(page / (float)(1u << entry.b));
+	float2 cacheUV = (entry.xy * (tileSize + 2.0 * border) + border + inTile * tileSize) / g_virtualTextureParams.w;
+
+	return g_virtualCache.SampleLevel(texSampler, cacheUV, 0);
+}
+
+// Material textures are slices of arrays, some of them rects in an atlas page (see TexturePacker.h).
+// The wrap is done here and the mip picked by hand so an atlas rect never samples past what its gutter covers,
+// or a streamed texture a level that isn't mapped yet.
+float4 SampleMaterialTexture(Texture2DArray tex, SamplerState texSampler, uint slot, float2 texcoord)
+{
+	if (g_matVirtualMaxLevel[slot] >= 0.0)
+		return SampleVirtualTexture(texSampler, slot, texcoord);
+
+	float4 scaleOffset = g_matTextureScaleOffset[slot];
+	float2 uv = frac(texcoord) * scaleOffset.xy + scaleOffset.zw;
+
+	float width, height, elements;
+	tex.GetDimensions(width, height, elements);
+
+	float2 dx = ddx(texcoord) * scaleOffset.xy * float2(width, height);
+	float2 dy = ddy(texcoord) * scaleOffset.xy * float2(width, height);
+	float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy)));
+
+	lod = max(lod, g_textureMinLod[g_matTextureResidency[slot]]);
+
+	return tex.SampleLevel(texSampler, float3(uv, g_matTextureSlice[slot]), min(lod, g_matTextureMaxLod[slot]));
+}
+
+// Cooked masks share a texture a channel each (see TextureCooker.h), 4 means use the texture as it is.
+float4 SelectMaterialChannel(float4 value, uint slot)
+{
+	uint channel = g_matTextureChannel[slot];
+	return (channel < 4) ? value[channel].xxxx : value;
+}
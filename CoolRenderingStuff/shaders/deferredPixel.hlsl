@@ -2,63 +2,82 @@
 #include "deferredCommon.hlsli"
 
 SamplerState diffuseSampler: register(s0);
-texture2D diffuseTexture: register(t0);
+Texture2DArray diffuseTexture: register(t0);
 
 SamplerState normalSampler: register(s1);
-texture2D normalTexture: register(t1);
+Texture2DArray normalTexture: register(t1);
 
 SamplerState alphaCutoutSampler: register(s2);
-texture2D alphaCutoutTexture: register(t2);
+Texture2DArray alphaCutoutTexture: register(t2);
 
 SamplerState specularSampler: register(s3);
-texture2D specularTexture: register(t3);
+Texture2DArray specularTexture: register(t3);
 
+// GBUFFER_COMPACT drops the position target (rebuilt from depth) and packs the rest down, see GBufferLayout.h.
 struct GBuffers {
+#ifdef GBUFFER_COMPACT
+	float2 normal: SV_TARGET1;
+	float4 albedo: SV_TARGET2;
+	float4 specular: SV_TARGET3;
+#else
 	float4 position: SV_TARGET0;
 	float4 normal: SV_TARGET1;
 	float4 albedo: SV_TARGET2;
 	float4 specular: SV_TARGET3;
+#endif
 };
 
 GBuffers main(VertToPixel i)
 {
-	float3 T = normalize(i.tangent);
-	float3 B = normalize(i.bitangent);
-	float3 N = normalize(i.normal);
-	float3x3 TBN = float3x3(T, B, N);
-
-	float4 diffuse = diffuseTexture.Sample(diffuseSampler, i.texcoord);
-	float3 normalT = normalTexture.Sample(normalSampler, i.texcoord).xyz * 2.0 - 1.0;
-	//normalT.z = -normalT.z;
-	//normalT.y = -normalT.y;
-	//normalT.x = -normalT.x;
-
-	float3 normalW = normalize(mul(TBN, normalT));
-	normalW.x = -normalW.x;
-	
 	GBuffers o;
 
-	o.albedo = (g_matUseDiffuse || false) ? diffuse : float4(1.0f, 1.0f, 1.0f, 1.0f);
+	o.albedo = float4(1.0f, 1.0f, 1.0f, 1.0f);
+	if (USE_DIFFUSE) {
+		o.albedo = SampleMaterialTexture(diffuseTexture, diffuseSampler, 0, i.texcoord);
+	}
 
-	if (g_matUseAlphaCutout) {
-		o.albedo.a = alphaCutoutTexture.Sample(alphaCutoutSampler, i.texcoord).r;
+	// Only cutout materials alpha test, anything without a discard keeps early Z.
+	if (USE_ALPHA_CUTOUT) {
+		o.albedo.a = SelectMaterialChannel(SampleMaterialTexture(alphaCutoutTexture, alphaCutoutSampler, 2, i.texcoord), 2).r;
+
+		if (o.albedo.a < 0.5) {
+			discard;
+		}
 	}
 
-	o.position = i.positionW;
-	o.normal = (g_matUseNormal) ? float4(normalW, 1.0) : float4(i.normalW, 1.0);
-	o.specular = (g_matUseSpecular) ? float4(specularTexture.Sample(specularSampler, i.texcoord).rgb, 1.0) : float4(0.005, 0.005, 0.005, 1.0);
+	// Nothing reads the alpha past the test, so it carries the baked occlusion to the ambient pass.
+	o.albedo.a = i.occlusion;
 
-	// TODO WT: Remove this debug statement
-	//o.albedo = float4(i.texcoord, 0.0f, 1.0f);
+	float3 normalW = i.normalW;
+	float gloss = 1.0;
+	if (USE_NORMAL) {
+		float3 T = normalize(i.tangent);
+		float3 B = normalize(i.bitangent);
+		float3 N = normalize(i.normal);
+		float3x3 TBN = float3x3(T, B, N);
 
-	//o.normal = float4(o.normal.xyz * 0.5 + 0.5, 1.0);
+		float4 normalSample = SampleMaterialTexture(normalTexture, normalSampler, 1, i.texcoord);
+		float3 normalT = normalSample.xyz * 2.0 - 1.0;
 
-	if (o.albedo.a < 0.5) {
-		discard;
+		// Toksvig factor from the MipGenerator, scales the specular power down where the mip averaged away detail.
+		gloss = normalSample.a;
+
+		normalW = normalize(mul(TBN, normalT));
+		normalW.x = -normalW.x;
 	}
-	//o.normal = normalV;
-	//o.normal = float4(normalize(i.normalV), 1.0);
 
+#ifdef GBUFFER_COMPACT
+	o.normal = EncodeOctahedral(normalW);
+#else
+	o.position = i.positionW;
+	o.normal = float4(normalW, 1.0);
+#endif
+
+	float3 specular = float3(0.005, 0.005, 0.005);
+	if (USE_SPECULAR) {
+		specular = SelectMaterialChannel(SampleMaterialTexture(specularTexture, specularSampler, 3, i.texcoord), 3).rgb;
+	}
+	o.specular = PackSpecularGloss(specular, gloss);
 
 	return o;
-}
\ No newline at end of file
+}
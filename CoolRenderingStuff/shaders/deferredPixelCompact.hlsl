@@ -0,0 +1,2 @@
+#define GBUFFER_COMPACT
+#include "deferredPixel.hlsl"
\ No newline at end of file
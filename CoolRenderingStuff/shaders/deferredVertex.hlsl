@@ -7,8 +7,14 @@ struct AppData {
     float3 tangent: TANGENT;
     float3 bitangent: BINORMAL;
     float2 texcoord: TEXCOORD;
+    float occlusion: OCCLUSION;
+    // Per instance, the instance indices of the draw's batch.
+    uint instance: INSTANCE;
 };
 
+// World matrix of every instance, from the scene graph.
+StructuredBuffer<float4x4> g_instanceWorld: register(t7);
+
 VertToPixel main(AppData i)
 {
     //float2 positions[3] = {
@@ -25,18 +31,22 @@ VertToPixel main(AppData i)
 
     //float3 normal = mul(g_view, float3(0.0f, 0.0f, -1.0f));
 
-    // TODO WT: Need to be multiplied by model matrix
+    float4x4 world = g_instanceWorld[i.instance];
+
+    // Normalized again since the scene graph scales, uniformly, so the inverse transpose isn't needed.
+    float3 normal = normalize(mul((float3x3)world, i.normal));
 
     VertToPixel o;
-    o.positionW = float4(i.position, 1.0f);
+    o.positionW = mul(world, float4(i.position, 1.0f));
     o.position = mul(g_viewProj, o.positionW);
     o.color = float3(1.0f, 1.0f, 1.0f);
-    o.normalV = mul(g_view, float4(i.normal, 1.0)).xyz;
-    o.normalW = i.normal;
+    o.normalV = mul(g_view, float4(normal, 1.0)).xyz;
+    o.normalW = normal;
     o.texcoord = i.texcoord;
-    o.normal = i.normal;
-    o.tangent = i.tangent;
-    o.bitangent = i.bitangent;
+    o.normal = normal;
+    o.tangent = normalize(mul((float3x3)world, i.tangent));
+    o.bitangent = normalize(mul((float3x3)world, i.bitangent));
+    o.occlusion = i.occlusion;
 
 	return o;
 }
\ No newline at end of file
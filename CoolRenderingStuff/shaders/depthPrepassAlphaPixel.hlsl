@@ -0,0 +1,18 @@
+#include "common.hlsli"
+#include "deferredCommon.hlsli"
+
+SamplerState alphaCutoutSampler: register(s2);
+Texture2DArray alphaCutoutTexture: register(t2);
+
+// Depth only pass for the alpha cutout bucket, discards exactly what deferredPixel.hlsl does: only cutout materials
+// alpha test, and only against the cutout texture. The diffuse alpha is never a mask.
+void main(VertToPixel i)
+{
+	if (USE_ALPHA_CUTOUT) {
+		float alpha = SelectMaterialChannel(SampleMaterialTexture(alphaCutoutTexture, alphaCutoutSampler, 2, i.texcoord), 2).r;
+
+		if (alpha < 0.5) {
+			discard;
+		}
+	}
+}
@@ -11,5 +11,14 @@ cbuffer Light: register(b1) {
 	float3 g_lightColor;
 	float g_lightIntensity;
 
+	// Left for the layout of Light, ambient is the ambient pass's job now.
 	float4 g_lightAmbient;
+};
+
+// ShadowConstants, the light's cube shadow in the atlas.
+cbuffer Shadow: register(b2) {
+	float4 g_shadowFaceRects[6];
+	float3 g_shadowOrigin;
+	float g_shadowEnabled;
+	float4 g_shadowDepthParams;
 };
\ No newline at end of file
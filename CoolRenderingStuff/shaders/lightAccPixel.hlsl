@@ -3,18 +3,72 @@
 
 SamplerState defaultSampler;
 
+#ifdef GBUFFER_COMPACT
+texture2D depthTexture : register(t0);
+#else
 texture2D positionTexture : register(t0);
+#endif
 texture2D normalTexture : register(t1);
 texture2D albedoTexture : register(t2);
 texture2D specularTexture : register(t3);
+Texture2D shadowAtlas : register(t9);
+SamplerComparisonState shadowSampler : register(s2);
+
+// The face bases getShadowFaceViewProj renders with, D3D's cube order.
+static const float3 shadowFaceLook[6] = {
+	float3(1.0, 0.0, 0.0), float3(-1.0, 0.0, 0.0),
+	float3(0.0, 1.0, 0.0), float3(0.0, -1.0, 0.0),
+	float3(0.0, 0.0, 1.0), float3(0.0, 0.0, -1.0),
+};
+static const float3 shadowFaceUp[6] = {
+	float3(0.0, 1.0, 0.0), float3(0.0, 1.0, 0.0),
+	float3(0.0, 0.0, -1.0), float3(0.0, 0.0, 1.0),
+	float3(0.0, 1.0, 0.0), float3(0.0, 1.0, 0.0),
+};
+
+// 1 when lit, 0 in shadow, filtered across the 2x2 texels the comparison sampler takes.
+float ShadowFactor(float3 positionW)
+{
+	if (g_shadowEnabled == 0.0)
+		return 1.0;
+
+	float3 d = positionW - g_shadowOrigin;
+	float3 a = abs(d);
+	uint face = (a.x >= a.y && a.x >= a.z) ? (d.x > 0.0 ? 0 : 1) : (a.y >= a.z ? (d.y > 0.0 ? 2 : 3) : (d.z > 0.0 ? 4 : 5));
+
+	float3 look = shadowFaceLook[face];
+	float3 up = shadowFaceUp[face];
+	float z = dot(d, look);
+	if (z > g_shadowDepthParams.z)
+		return 1.0;
+
+	// A 90 degree projection, so x and y over z are already the face's NDC.
+	float2 ndc = float2(dot(d, cross(up, look)), dot(d, up)) / z;
+	float4 rect = g_shadowFaceRects[face];
+	float2 uv = rect.xy + (ndc * float2(0.5, -0.5) + 0.5) * rect.zw;
+
+	// Kept half a texel inside the tile so the filter doesn't reach into a neighbour's.
+	uv = clamp(uv, rect.xy + g_shadowDepthParams.w, rect.xy + rect.zw - g_shadowDepthParams.w);
+
+	float depth = g_shadowDepthParams.x + g_shadowDepthParams.y / z;
+	return shadowAtlas.SampleCmpLevelZero(shadowSampler, uv, depth);
+}
 
 float4 main(VertToPixel i) : SV_TARGET
 {
 	// World space lighting
 	float2 uv = i.positionH.xy / g_screenDimensions;
 
+#ifdef GBUFFER_COMPACT
+	float2 viewUv = (i.positionH.xy - g_viewport.xy) / g_viewport.zw;
+	// Loaded rather than sampled, a filtered depth or octahedral normal isn't any pixel's.
+	int3 pixel = int3(i.positionH.xy, 0);
+	float4 positionW = float4(ReconstructPositionW(viewUv, depthTexture.Load(pixel).r), 1.0);
+	float4 normal = float4(DecodeOctahedral(normalTexture.Load(pixel).xy), 1.0);
+#else
 	float4 positionW = positionTexture.Sample(defaultSampler, uv);
 	float4 normal = normalTexture.Sample(defaultSampler, uv);
+#endif
 	float4 albedo = albedoTexture.Sample(defaultSampler, uv);
 	float4 specular = specularTexture.Sample(defaultSampler, uv);
 
@@ -25,14 +79,13 @@ float4 main(VertToPixel i) : SV_TARGET
 	float3 toEye = normalize(g_viewPosition - positionW);
 	float3 halfwayDir = normalize(toLight + toEye);
 
-	float spec = pow(max(dot(normal, halfwayDir), 0.0), specular.a * 100.0) / distSquared;
+	float spec = pow(max(dot(normal, halfwayDir), 0.0), SpecularPower(specular)) / distSquared;
 
 	float lambert = Lambert(toLight, normal.xyz, distSquared);
 
 	float3 color = albedo.rgb * g_lightColor * lambert * g_lightIntensity;
 	color += specular.rgb * g_lightColor * spec * g_lightIntensity;
-
-	color += albedo.rgb * g_lightAmbient.rgb;
+	color *= ShadowFactor(positionW.xyz);
 
 	//float percent = dist / g_lightRadius;
 
@@ -0,0 +1,6 @@
+// A quad over the whole viewport at the far plane, for clearing one shadow tile of the atlas with depth always passing.
+float4 main(uint index: SV_VertexID) : SV_POSITION
+{
+	float2 corner = float2(index & 1, index >> 1) * 2.0 - 1.0;
+	return float4(corner, 1.0, 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,16 @@
+// UpscaleConstants, the part of the light accumulation target the frame rendered to.
+cbuffer Upscale: register(b1) {
+	float2 g_uvPerPixel;
+	float2 g_uvMax;
+};
+
+SamplerState linearSampler : register(s0);
+texture2D lightTexture : register(t0);
+
+// Stretches the frame over the back buffer, bilinear. At full scale every pixel lands on its own texel's centre and
+// comes out unchanged.
+float4 main(float4 positionH : SV_POSITION) : SV_TARGET
+{
+	float2 uv = min(positionH.xy * g_uvPerPixel, g_uvMax);
+	return float4(lightTexture.Sample(linearSampler, uv).rgb, 1.0);
+}
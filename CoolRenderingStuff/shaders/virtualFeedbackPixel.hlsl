@@ -0,0 +1,35 @@
+#include "common.hlsli"
+#include "deferredCommon.hlsli"
+
+SamplerState diffuseSampler: register(s0);
+Texture2DArray diffuseTexture: register(t0);
+
+SamplerState alphaCutoutSampler: register(s2);
+Texture2DArray alphaCutoutTexture: register(t2);
+
+// Writes the page key (see makeVirtualPage) of one of the material's virtual slots, 0 for none.
+// Neighbouring pixels and consecutive frames start on different slots, so over a few frames every slot gets asked for.
+uint main(VertToPixel i) : SV_TARGET
+{
+	if (g_matUseAlphaCutout) {
+		float alpha = SelectMaterialChannel(SampleMaterialTexture(alphaCutoutTexture, alphaCutoutSampler, 2, i.texcoord), 2).r;
+		if (alpha < 0.5) {
+			discard;
+		}
+	}
+
+	uint2 pixel = (uint2)i.position.xy;
+	uint first = g_frameIndex + pixel.x + pixel.y * 3;
+
+	for (uint n = 0; n < 4; n++) {
+		uint slot = (first + n) % 4;
+		if (g_matVirtualMaxLevel[slot] < 0.0)
+			continue;
+
+		uint level;
+		uint2 page = (uint2)(GetVirtualUV(slot, i.texcoord, g_virtualFeedbackLodBias, level) * g_virtualTextureParams.z) >> level;
+		return 0x80000000u | (level << 24) | (page.y << 12) | page.x;
+	}
+
+	return 0;
+}
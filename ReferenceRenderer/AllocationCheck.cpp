@@ -0,0 +1,469 @@
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <cstring>
+
+#include "Checks.h"
+#include "../CoolRenderingStuff/Scene.h"
+#include "../CoolRenderingStuff/JobSystem.h"
+#include "../CoolRenderingStuff/SceneGraph.h"
+#include "../CoolRenderingStuff/OcclusionCuller.h"
+#include "../CoolRenderingStuff/DrawOrder.h"
+#include "../CoolRenderingStuff/ViewCulling.h"
+#include "../CoolRenderingStuff/ShadowCache.h"
+#include "../CoolRenderingStuff/MeshInstancing.h"
+#include "../CoolRenderingStuff/AllocationTracer.h"
+#include "../CoolRenderingStuff/LinearArena.h"
+#include "../CoolRenderingStuff/ObjectPool.h"
+
+using namespace DirectX;
+
+// A box around the origin, four vertices a face so every face has its own normal and texcoords.
+static MeshData generateBoxMesh(XMFLOAT3 extent, uint32_t material) {
+	const XMFLOAT3 axes[6] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+
+	MeshData mesh;
+	mesh.materialId = material;
+	auto scale = XMLoadFloat3(&extent);
+	for (uint32_t face = 0; face < 6; face++) {
+		// Two faces on is always at right angles to this one.
+		auto normal = XMLoadFloat3(&axes[face]);
+		auto tangent = XMLoadFloat3(&axes[(face + 2) % 6]);
+		auto bitangent = XMVector3Cross(normal, tangent);
+
+		uint32_t base = static_cast<uint32_t>(mesh.vertices.size());
+		for (uint32_t corner = 0; corner < 4; corner++) {
+			float s = corner & 1 ? 1.0f : -1.0f, t = corner & 2 ? 1.0f : -1.0f;
+			auto position = XMVectorMultiply(XMVectorAdd(normal, XMVectorAdd(XMVectorScale(tangent, s), XMVectorScale(bitangent, t))), scale);
+
+			Vertex vertex;
+			XMStoreFloat3(&vertex.position, position);
+			XMStoreFloat3(&vertex.normal, normal);
+			XMStoreFloat3(&vertex.tangent, tangent);
+			XMStoreFloat3(&vertex.bitangent, bitangent);
+			vertex.texcoord = { (s + 1.0f) * 0.5f, (t + 1.0f) * 0.5f };
+			mesh.vertices.push_back(vertex);
+		}
+
+		for (uint32_t index : { 0, 1, 2, 2, 1, 3 }) {
+			mesh.indices.push_back(base + index);
+		}
+	}
+
+	mesh.localBounds = calculateMeshBounds(mesh.vertices);
+	mesh.uvDensity = calculateMeshUVDensity(mesh.vertices, mesh.indices);
+	return mesh;
+}
+
+// shapes boxes, each written out copies times already moved and turned into place the way an exporter flattens
+// instances, with a node of its own under the root. Every third shape is alpha tested.
+static SceneData generateBoxScene(uint32_t shapes, uint32_t copies, std::mt19937& random) {
+	std::uniform_real_distribution<float> x(-14.0f, 14.0f), y(0.0f, 8.0f), z(-8.0f, 8.0f), extent(0.2f, 1.0f), angle(-XM_PI, XM_PI);
+
+	SceneData scene;
+	scene.materials.resize(2);
+	scene.materials[0].name = "opaque";
+	scene.materials[1].name = "cutout";
+	scene.materials[1].settings.useAlphaCutoutTexture = true;
+
+	XMFLOAT4X4 identity;
+	XMStoreFloat4x4(&identity, XMMatrixIdentity());
+	scene.graph.addNode("root", SceneGraph::NO_NODE, identity);
+
+	for (uint32_t shape = 0; shape < shapes; shape++) {
+		MeshData box = generateBoxMesh({ extent(random), extent(random), extent(random) }, shape % 3 == 0 ? 1 : 0);
+
+		for (uint32_t copy = 0; copy < copies; copy++) {
+			auto place = XMMatrixMultiply(XMMatrixRotationRollPitchYaw(angle(random), angle(random), angle(random)), XMMatrixTranslation(x(random), y(random), z(random)));
+
+			MeshData mesh = box;
+			mesh.name = "box" + std::to_string(shape) + "_" + std::to_string(copy);
+			for (auto& vertex : mesh.vertices) {
+				XMStoreFloat3(&vertex.position, XMVector3TransformCoord(XMLoadFloat3(&vertex.position), place));
+				XMStoreFloat3(&vertex.normal, XMVector3TransformNormal(XMLoadFloat3(&vertex.normal), place));
+				XMStoreFloat3(&vertex.tangent, XMVector3TransformNormal(XMLoadFloat3(&vertex.tangent), place));
+				XMStoreFloat3(&vertex.bitangent, XMVector3TransformNormal(XMLoadFloat3(&vertex.bitangent), place));
+			}
+			mesh.localBounds = calculateMeshBounds(mesh.vertices);
+
+			uint32_t node = scene.graph.addNode(mesh.name, 0, identity);
+			scene.instances.push_back({ static_cast<uint32_t>(scene.meshes.size()), node, identity });
+			scene.meshes.push_back(std::move(mesh));
+		}
+	}
+
+	scene.graph.update();
+	return scene;
+}
+
+static bool sameInstancing(const SceneData& a, const SceneData& b) {
+	if (a.meshes.size() != b.meshes.size() || a.instances.size() != b.instances.size() || a.instancingStats.uniqueMeshes != b.instancingStats.uniqueMeshes)
+		return false;
+
+	for (size_t i = 0; i < a.meshes.size(); i++) {
+		auto& meshA = a.meshes[i];
+		auto& meshB = b.meshes[i];
+		if (meshA.indices != meshB.indices || meshA.vertices.size() != meshB.vertices.size() ||
+			memcmp(meshA.vertices.data(), meshB.vertices.data(), sizeof(Vertex) * meshA.vertices.size()) != 0)
+			return false;
+	}
+
+	for (size_t i = 0; i < a.instances.size(); i++) {
+		if (a.instances[i].mesh != b.instances[i].mesh || memcmp(&a.instances[i].meshToNode, &b.instances[i].meshToNode, sizeof(XMFLOAT4X4)) != 0)
+			return false;
+	}
+	return true;
+}
+
+// Instances a generated scene of duplicated boxes with its temporaries on the heap and in a scratch arena, then runs the
+// app's per frame CPU work over it: nodes moving, lights animating, two views culled against the bounds and the
+// occlusion buffer, one sorted order batched per view on the jobs, and the shadow cache's faces culled and batched.
+// Every frame is run with the frame arena until it has grown to fit, then again with every frame checked for heap
+// allocations, and again with no arena for what the heap path costs. Both must batch the same, frame for frame.
+int benchmarkAllocations(const Options& options, uint32_t frames) {
+	JobSystem jobs(options.threads);
+	const uint32_t SHAPES = 24;
+	const uint32_t COPIES = 16;
+	const uint32_t VIEWS = 2;
+	// One node in this many sways every frame.
+	const uint32_t MOVING_STRIDE = 16;
+	// The shadow cache hands a face's batches a different slot from one pass to the next, so a slot can still find
+	// itself short a pass or two in. Warming up stops at the first pass that didn't allocate.
+	const uint32_t MAX_WARM_PASSES = 4;
+	// Small enough that the warm up has to grow it.
+	const size_t FRAME_ARENA_SIZE = 4 * 1024;
+
+	std::mt19937 random(1234);
+	int errors = 0;
+
+	auto elapsedMs = [](std::chrono::high_resolution_clock::time_point start) {
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	};
+
+	SceneData scene = generateBoxScene(SHAPES, COPIES, random);
+	SceneData heapScene = scene;
+
+	AllocationCounter heapImport, scratchImport;
+	LinearArena importScratch(8 * 1024 * 1024);
+	{
+		AllocationScope scope(&heapImport);
+		heapScene.instancingStats = instanceDuplicateMeshes(heapScene);
+	}
+	{
+		AllocationScope scope(&scratchImport);
+		scene.instancingStats = instanceDuplicateMeshes(scene, &importScratch);
+	}
+	updateInstanceBounds(scene, true);
+
+	bool instancingMatches = sameInstancing(scene, heapScene);
+	errors += !instancingMatches + (scene.instancingStats.uniqueMeshes != SHAPES);
+
+	auto heapCounts = heapImport.get();
+	auto scratchCounts = scratchImport.get();
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << "\nScene:                " << SHAPES << " boxes, " << scene.instances.size() << " instances of " << scene.instancingStats.uniqueMeshes << " unique meshes, "
+		<< (instancingMatches ? "same" : "different") << " with and without scratch\n";
+	std::cout << "Instancing heap:      " << heapCounts.allocations << " allocations, " << heapCounts.bytes / 1024.0 << " KB\n";
+	std::cout << "Instancing scratch:   " << scratchCounts.allocations << " allocations, " << scratchCounts.bytes / 1024.0 << " KB, "
+		<< importScratch.getUsed() / 1024.0 << " KB of scratch used\n";
+
+	uint32_t instanceCount = static_cast<uint32_t>(scene.instances.size());
+	std::vector<MeshBounds> meshBounds;
+	for (auto& mesh : scene.meshes) {
+		meshBounds.push_back(mesh.localBounds);
+	}
+
+	std::vector<uint8_t> alphaTested;
+	std::vector<uint32_t> instanceMeshes;
+	for (auto& instance : scene.instances) {
+		alphaTested.push_back(scene.materials[scene.meshes[instance.mesh].materialId].settings.useAlphaCutoutTexture != 0);
+		instanceMeshes.push_back(instance.mesh);
+	}
+
+	auto lights = createSceneLights();
+	if (options.extraLights) {
+		auto extra = generateLights(options.extraLights, random);
+		lights.insert(lights.end(), extra.begin(), extra.end());
+	}
+	uint32_t lightCount = static_cast<uint32_t>(lights.size());
+
+	OcclusionCuller culler(scene, jobs);
+	ShadowSettings settings;
+	float projScale = 1.0f / std::tan(CAMERA_FOV_Y * 0.5f);
+
+	// Everything the app keeps from frame to frame. The arena and heap runs get one each, so their shadow caches go
+	// through the same frames and have to come out with the same faces.
+	struct FrameState {
+		ShadowCache shadows;
+		std::vector<Light> lights;
+		std::vector<MeshBounds> instanceBounds;
+		std::vector<ViewFrustum> frustums;
+		CullBounds cullBounds;
+		std::vector<uint32_t> masks;
+		std::vector<uint8_t> visibility;
+		std::vector<uint8_t> drawable;
+		DrawOrder order;
+		DrawBatches viewBatches[VIEWS];
+		std::vector<uint8_t> lightVisible;
+		std::vector<float> lightScreenRadius;
+		std::vector<ViewFrustum> shadowFrustums;
+		std::vector<uint32_t> shadowMasks;
+		std::vector<uint8_t> shadowDrawable;
+		DrawOrder shadowOrder;
+		std::vector<DrawBatches> shadowBatches;
+
+		FrameState(const ShadowSettings& settings) : shadows(settings) {}
+	};
+
+	auto mix = [](uint64_t hash, uint32_t value) {
+		return (hash ^ value) * 1099511628211ull;
+	};
+	auto mixBatches = [&](uint64_t hash, const DrawBatches& batches) {
+		for (auto& batch : batches.batches) {
+			hash = mix(mix(mix(hash, batch.mesh), batch.first), batch.count);
+		}
+		for (uint32_t instance : batches.instances) {
+			hash = mix(hash, instance);
+		}
+		return mix(hash, static_cast<uint32_t>(batches.opaqueCount));
+	};
+
+	// The app's updateFrame, drawShadows and drawFrame without the device. Returns a hash of every batch it built.
+	auto runFrame = [&](FrameState& state, uint32_t frame, LinearArena* scratch) {
+		for (uint32_t node = 1; node < scene.graph.size(); node += MOVING_STRIDE) {
+			XMFLOAT4X4 local;
+			XMStoreFloat4x4(&local, XMMatrixTranslation(0.0f, 0.25f * std::sin(frame * 0.1f + node), 0.0f));
+			scene.graph.setLocal(node, local);
+		}
+
+		if (scene.graph.update(&jobs)) {
+			for (uint32_t i = 0; i < instanceCount; i++) {
+				auto& instance = scene.instances[i];
+				if (!scene.graph.wasUpdated(instance.node))
+					continue;
+
+				XMFLOAT4X4 world;
+				XMStoreFloat4x4(&world, getInstanceWorld(scene.graph, instance));
+				state.shadows.invalidateCasters(state.instanceBounds[i]);
+				state.instanceBounds[i] = transformMeshBounds(meshBounds[instance.mesh], XMLoadFloat4x4(&world));
+				state.shadows.invalidateCasters(state.instanceBounds[i]);
+				culler.setInstanceTransform(i, world, state.instanceBounds[i]);
+			}
+		}
+
+		animateSceneLights(state.lights, frame / 60.0f);
+
+		// Along the nave and back like --stream, the second view looking the other way.
+		float t = static_cast<float>(frame % 600) / 300.0f;
+		bool returning = t > 1.0f;
+		XMFLOAT3 eye = { -12.0f + 24.0f * (returning ? 2.0f - t : t), options.cameraPosition.y, 0.0f };
+		PerFrameUniforms uniforms[VIEWS];
+		for (uint32_t v = 0; v < VIEWS; v++) {
+			uniforms[v] = calculatePerFrameUniforms(eye, 0.0f, (returning ? -XM_PIDIV2 : XM_PIDIV2) + v * XM_PI, options.width / VIEWS, options.height);
+			state.frustums[v] = ViewFrustum::fromViewProj(uniforms[v].viewProj);
+		}
+
+		for (uint32_t i = 0; i < instanceCount; i++) {
+			state.cullBounds.setBox(i, state.instanceBounds[i]);
+		}
+		for (uint32_t l = 0; l < lightCount; l++) {
+			state.cullBounds.setSphere(instanceCount + l, state.lights[l].position, state.lights[l].radius);
+		}
+		cullViews(state.frustums, state.cullBounds, state.masks);
+
+		// Only the first view is occlusion culled, as in the app.
+		culler.cull(uniforms[0].viewProj, state.visibility, scratch);
+		for (uint32_t i = 0; i < instanceCount; i++) {
+			if (!state.visibility[i])
+				state.masks[i] &= ~1u;
+			state.drawable[i] = state.masks[i] != 0;
+		}
+
+		buildDrawOrder(options.prepass, state.instanceBounds, alphaTested, &state.drawable, eye, state.order, scratch);
+		jobs.parallelFor(VIEWS, [&](uint32_t v, uint32_t) {
+			buildViewDrawBatches(state.order, state.masks, v, instanceMeshes, true, state.viewBatches[v], scratch);
+		});
+
+		uint64_t hash = 14695981039346656037ull;
+		for (auto& batches : state.viewBatches) {
+			hash = mixBatches(hash, batches);
+		}
+
+		for (uint32_t i = 0; i < lightCount; i++) {
+			auto& light = state.lights[i];
+			state.lightVisible[i] = 0;
+			state.lightScreenRadius[i] = 0.0f;
+			for (uint32_t v = 0; v < VIEWS; v++) {
+				if (!state.frustums[v].intersects(light.position.x, light.position.y, light.position.z, 0.0f, 0.0f, 0.0f, light.radius * settings.rangeScale))
+					continue;
+
+				state.lightVisible[i] = 1;
+				state.lightScreenRadius[i] = std::max(state.lightScreenRadius[i], getShadowScreenRadius(light, settings.rangeScale, eye, projScale, static_cast<float>(options.height)));
+			}
+		}
+
+		auto& renders = state.shadows.update(state.lights, state.lightVisible, state.lightScreenRadius, scratch);
+		growDrawBatches(state.shadowBatches, renders.size(), instanceCount);
+
+		for (size_t begin = 0; begin < renders.size();) {
+			size_t end = begin;
+			while (end < renders.size() && renders[end].light == renders[begin].light) {
+				end++;
+			}
+
+			state.shadowFrustums.resize(end - begin);
+			for (size_t face = begin; face < end; face++) {
+				state.shadowFrustums[face - begin] = ViewFrustum::fromViewProj(renders[face].viewProj);
+			}
+
+			cullViews(state.shadowFrustums, state.cullBounds, state.shadowMasks);
+			for (uint32_t i = 0; i < instanceCount; i++) {
+				state.shadowDrawable[i] = state.shadowMasks[i] != 0;
+			}
+
+			buildDrawOrder(DepthPrepassMode::FrontToBack, state.instanceBounds, alphaTested, &state.shadowDrawable, state.lights[renders[begin].light].position, state.shadowOrder, scratch);
+			for (size_t face = begin; face < end; face++) {
+				buildViewDrawBatches(state.shadowOrder, state.shadowMasks, static_cast<uint32_t>(face - begin), instanceMeshes, true, state.shadowBatches[face], scratch);
+				hash = mixBatches(mix(mix(hash, renders[face].light), renders[face].face), state.shadowBatches[face]);
+			}
+
+			begin = end;
+		}
+
+		return hash;
+	};
+
+	auto initState = [&](FrameState& state) {
+		state.lights = lights;
+		state.instanceBounds.resize(instanceCount);
+		for (uint32_t i = 0; i < instanceCount; i++) {
+			state.instanceBounds[i] = scene.instances[i].bounds;
+		}
+		state.frustums.resize(VIEWS);
+		state.cullBounds.resize(instanceCount + lightCount);
+		state.drawable.resize(instanceCount);
+		state.lightVisible.resize(lightCount);
+		state.lightScreenRadius.resize(lightCount);
+		state.shadowDrawable.resize(instanceCount);
+	};
+
+	// Runs frames 1 to frames, each in a scope of its own. frameAllocations and checksums are sized up front so
+	// recording them isn't counted.
+	AllocationCounter counter;
+	std::vector<AllocationCounts> frameAllocations(frames);
+	auto runPass = [&](FrameState& state, LinearArena* arena, std::vector<uint64_t>& checksums) {
+		auto start = std::chrono::high_resolution_clock::now();
+		for (uint32_t frame = 1; frame <= frames; frame++) {
+			auto before = counter.get();
+			{
+				AllocationScope scope(&counter);
+				checksums[frame - 1] = runFrame(state, frame, arena);
+				if (arena)
+					arena->reset();
+			}
+			frameAllocations[frame - 1] = counter.get() - before;
+		}
+		return elapsedMs(start);
+	};
+
+	auto sumAllocations = [&](uint32_t& allocatingFrames) {
+		AllocationCounts total{};
+		allocatingFrames = 0;
+		for (auto& counts : frameAllocations) {
+			total.allocations += counts.allocations;
+			total.bytes += counts.bytes;
+			allocatingFrames += counts.allocations != 0;
+		}
+		return total;
+	};
+
+	std::vector<uint64_t> warmChecksums(frames), arenaChecksums(frames), heapChecksums(frames);
+	LinearArena frameArena(FRAME_ARENA_SIZE);
+	FrameState arenaState(settings), heapState(settings);
+	initState(arenaState);
+	initState(heapState);
+
+	uint32_t warmPasses = 0, warmFrames, firstWarmFrames = 0, arenaFrames, heapFrames;
+	AllocationCounts firstWarmTotal{};
+	do {
+		runPass(arenaState, &frameArena, warmChecksums);
+		auto total = sumAllocations(warmFrames);
+		if (warmPasses++ == 0) {
+			firstWarmTotal = total;
+			firstWarmFrames = warmFrames;
+		}
+	} while (warmFrames && warmPasses < MAX_WARM_PASSES);
+	uint64_t warmOverflows = frameArena.getOverflows();
+
+	double arenaMs = runPass(arenaState, &frameArena, arenaChecksums);
+	auto arenaTotal = sumAllocations(arenaFrames);
+
+	// As many warm up passes as the arena had, so the heap's shadow cache is where the arena's was.
+	for (uint32_t pass = 0; pass < warmPasses; pass++) {
+		runPass(heapState, nullptr, warmChecksums);
+	}
+	double heapMs = runPass(heapState, nullptr, heapChecksums);
+	auto heapTotal = sumAllocations(heapFrames);
+
+	uint32_t mismatches = 0;
+	for (uint32_t i = 0; i < frames; i++) {
+		mismatches += arenaChecksums[i] != heapChecksums[i];
+	}
+	errors += arenaFrames + mismatches;
+
+	// Records churned through a pool after it has grown to the most ever alive at once.
+	const uint32_t POOL_LIVE = 256;
+	ObjectPool<Light> pool;
+	std::vector<Light*> live;
+	live.reserve(POOL_LIVE);
+	for (uint32_t i = 0; i < POOL_LIVE; i++) {
+		live.push_back(pool.create(lights[i % lightCount]));
+	}
+	for (auto light : live) {
+		pool.destroy(light);
+	}
+	live.clear();
+	size_t poolCapacity = pool.getCapacity();
+
+	AllocationCounter poolCounter;
+	uint32_t poolChurn = std::max(10000u, frames * 100);
+	uint32_t poolErrors = 0;
+	{
+		AllocationScope scope(&poolCounter);
+		for (uint32_t step = 0; step < poolChurn; step++) {
+			if (live.empty() || (live.size() < POOL_LIVE && random() % 2)) {
+				live.push_back(pool.create(lights[step % lightCount]));
+				poolErrors += memcmp(&live.back()->position, &lights[step % lightCount].position, sizeof(XMFLOAT3)) != 0;
+			}
+			else {
+				size_t slot = random() % live.size();
+				pool.destroy(live[slot]);
+				live[slot] = live.back();
+				live.pop_back();
+			}
+			poolErrors += pool.getCount() != live.size();
+		}
+	}
+	auto poolCounts = poolCounter.get();
+	poolErrors += pool.getCapacity() != poolCapacity;
+	errors += poolErrors + (poolCounts.allocations != 0);
+
+	std::cout << "Frames:               " << frames << ", " << VIEWS << " views, " << lightCount << " lights, " << (scene.graph.size() + MOVING_STRIDE - 2) / MOVING_STRIDE << " nodes moving, "
+		<< jobs.getNumThreads() << " threads\n";
+	std::cout << "Warm up:              " << warmPasses << " passes, the first " << firstWarmTotal.allocations << " allocations in " << firstWarmFrames << " frames, "
+		<< warmOverflows << " arena overflows, grew " << FRAME_ARENA_SIZE / 1024.0 << " KB to " << frameArena.getCapacity() / 1024.0 << " KB\n";
+	std::cout << "Arena frames:         " << arenaTotal.allocations << " allocations, " << arenaFrames << " frames allocated, "
+		<< frameArena.getHighWater() / 1024.0 << " KB at most, " << arenaMs / std::max(frames, 1u) << " ms a frame\n";
+	std::cout << "Heap frames:          " << static_cast<double>(heapTotal.allocations) / std::max(frames, 1u) << " allocations a frame, "
+		<< heapTotal.bytes / 1024.0 / std::max(frames, 1u) << " KB, " << heapMs / std::max(frames, 1u) << " ms a frame\n";
+	std::cout << "Batches:              " << mismatches << " frames differ between arena and heap\n";
+	std::cout << "Pool:                 " << poolChurn << " creates and destroys, " << poolCounts.allocations << " allocations, " << poolCapacity << " slots, "
+		<< poolErrors << " errors\n";
+	std::cout << "Failed checks:        " << errors << std::defaultfloat << std::endl;
+
+	return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,60 @@
+#include <vector>
+#include <string>
+#include <random>
+
+#include "Checks.h"
+
+using namespace DirectX;
+
+const std::vector<Check>& getChecks() {
+	static const std::vector<Check> checks = {
+		{ "--scene-graph", "<nodes>", "benchmark world matrix updates on a generated graph", benchmarkSceneGraph },
+		{ "--geometry-churn", "<steps>", "load and unload random meshes in a geometry arena, checking ranges and reporting fragmentation", benchmarkGeometryArena },
+		{ "--bake-environment", nullptr, "bake the environment every way, checking SH projection, prefiltering and the cache", benchmarkEnvironment },
+		{ "--light-tree", "<n>", "build, refit and sample a light tree over n generated lights, checking its probabilities", benchmarkLightTree },
+		{ "--shadows", "<frames>", "move lights and casters past a walking camera, checking the shadow atlas and its schedule", benchmarkShadows },
+		{ "--allocations", "<frames>", "run the app's frame work on generated boxes, checking that frames stop allocating once the arena fits", benchmarkAllocations },
+		{ "--snapshots", "<frames>", "hand snapshots from a simulation thread to a render thread, checking for torn reads and reporting latency", benchmarkSnapshots },
+		{ "--dynamic-resolution", "<frames>", "run the resolution controller against simulated GPU timings and check the viewport and upscale math", benchmarkDynamicResolution },
+		{ "--state-cache", nullptr, "check that every state desc field changes its hash and that padding and unused fields don't", checkStateCache },
+		{ "--gbuffer", nullptr, "check the G-buffer encodings, position reconstruction and bytes per pixel", checkGBufferEncoding },
+		{ "--shader-cache", nullptr, "check shader cache hits, misses and keys with a stub compiler in a temporary directory", checkShaderCache },
+		{ "--constant-allocator", nullptr, "check the constant ring's offsets for alignment, overlap, wrap-around and exhaustion", checkConstantAllocator },
+	};
+	return checks;
+}
+
+const Check* findCheck(const std::string& flag) {
+	for (auto& check : getChecks()) {
+		if (flag == check.flag)
+			return &check;
+	}
+	return nullptr;
+}
+
+std::vector<Light> generateLights(uint32_t count, std::mt19937& random) {
+	std::uniform_real_distribution<float> x(-15.0f, 15.0f), y(0.0f, 10.0f), z(-10.0f, 10.0f);
+	std::uniform_real_distribution<float> chance(0.0f, 1.0f), channel(0.2f, 1.0f), intensity(0.01f, 0.1f);
+	std::normal_distribution<float> spread(0.0f, 0.5f);
+
+	XMFLOAT3 clusters[16];
+	for (auto& cluster : clusters) {
+		cluster = { x(random), y(random), z(random) };
+	}
+
+	std::vector<Light> lights;
+	lights.reserve(count);
+	for (uint32_t i = 0; i < count; i++) {
+		XMFLOAT3 position;
+		if (chance(random) < 0.75f) {
+			auto& cluster = clusters[random() % 16];
+			position = { cluster.x + spread(random), cluster.y + spread(random), cluster.z + spread(random) };
+		}
+		else {
+			position = { x(random), y(random), z(random) };
+		}
+
+		lights.push_back(Light(position, 1.0f, XMFLOAT3(channel(random), channel(random), channel(random)), intensity(random), XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f)));
+	}
+	return lights;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <random>
+#include "Options.h"
+#include "../CoolRenderingStuff/Scene.h"
+
+// A headless check, run on generated data without loading a scene. Each one prints what it measured and returns
+// 0 when everything it checked passed, 1 otherwise.
+struct Check {
+	const char* flag;
+	// Shown after the flag in the usage. Null for a flag without a value, otherwise the value is a count of at least 1.
+	const char* argument;
+	const char* description;
+	int (*run)(const Options& options, uint32_t count);
+};
+
+// Every check, in the order the usage lists them.
+const std::vector<Check>& getChecks();
+// Null when the flag isn't a check's.
+const Check* findCheck(const std::string& flag);
+
+// Scattered through Sponza's volume with most of them bunched into a few dense clusters, small and dim like candles.
+std::vector<Light> generateLights(uint32_t count, std::mt19937& random);
+
+int benchmarkSceneGraph(const Options& options, uint32_t nodes);
+int benchmarkGeometryArena(const Options& options, uint32_t stepCount);
+int benchmarkEnvironment(const Options& options, uint32_t);
+int benchmarkLightTree(const Options& options, uint32_t lightCount);
+int benchmarkShadows(const Options& options, uint32_t frames);
+int benchmarkAllocations(const Options& options, uint32_t frames);
+int benchmarkSnapshots(const Options& options, uint32_t frames);
+int benchmarkDynamicResolution(const Options& options, uint32_t minimumFrames);
+int checkStateCache(const Options& options, uint32_t);
+int checkGBufferEncoding(const Options& options, uint32_t);
+int checkShaderCache(const Options& options, uint32_t);
+int checkConstantAllocator(const Options& options, uint32_t);
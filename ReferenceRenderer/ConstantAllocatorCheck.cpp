@@ -0,0 +1,120 @@
+#include <iostream>
+#include <random>
+#include <algorithm>
+#include <stdexcept>
+
+#include "Checks.h"
+#include "../CoolRenderingStuff/ConstantAllocator.h"
+
+using namespace DirectX;
+
+// The constant ring's allocator on its own, through frames of random sized uploads. Every offset has to be a multiple
+// of 16 constants inside the buffer, and everything handed out since the last discard has to sit end to end without
+// overlapping. The first allocation of a frame discards, the one that doesn't fit discards and starts over at 0, one
+// that exactly fills the buffer doesn't, and one bigger than the buffer throws.
+int checkConstantAllocator(const Options&, uint32_t) {
+	const uint32_t CAPACITY = 64 * 1024;
+	const uint32_t FRAMES = 1000;
+	// Up to an eighth of the buffer, so most frames wrap a few times.
+	const uint32_t MAX_UPLOAD = CAPACITY / 8;
+	int errors = 0;
+	auto check = [&](bool passed, const char* what) {
+		if (!passed) {
+			std::cout << "Failed:               " << what << "\n";
+			errors++;
+		}
+	};
+
+	bool tooSmallThrew = false;
+	try {
+		LinearConstantAllocator tooSmall(LinearConstantAllocator::ALIGNMENT - 1);
+	}
+	catch (const std::runtime_error&) {
+		tooSmallThrew = true;
+	}
+	check(tooSmallThrew, "a buffer smaller than one block throws");
+	check(LinearConstantAllocator(CAPACITY + 100).getCapacity() == CAPACITY, "the capacity rounds down to whole blocks");
+
+	LinearConstantAllocator allocator(CAPACITY);
+	std::mt19937 random(7);
+	std::uniform_int_distribution<uint32_t> uploadSize(0, MAX_UPLOAD);
+
+	uint64_t allocations = 0;
+	uint64_t wraps = 0;
+	uint32_t misaligned = 0;
+	uint32_t outOfRange = 0;
+	uint32_t overlapping = 0;
+	uint32_t wrongDiscards = 0;
+	uint32_t wrongStats = 0;
+
+	for (uint32_t frame = 0; frame < FRAMES; frame++) {
+		allocator.beginFrame();
+
+		uint32_t uploads = 1 + random() % 64;
+		uint64_t bytes = 0;
+		uint64_t discards = 0;
+		uint32_t expectedOffset = 0;
+
+		for (uint32_t i = 0; i < uploads; i++) {
+			uint32_t size = uploadSize(random);
+			uint32_t alignedSize = LinearConstantAllocator::alignSize(std::max(size, 1u));
+			// The previous allocation's end, or nowhere if this one has to discard.
+			bool fits = i > 0 && CAPACITY - expectedOffset >= alignedSize;
+
+			auto allocation = allocator.allocate(size);
+			allocations++;
+			bytes += allocation.size;
+			discards += allocation.discard;
+			wraps += i > 0 && allocation.discard;
+
+			misaligned += allocation.offset % LinearConstantAllocator::ALIGNMENT != 0 || allocation.size != alignedSize
+				|| LinearConstantAllocator::toConstants(allocation.offset) % 16 != 0 || LinearConstantAllocator::toConstants(allocation.size) % 16 != 0;
+			outOfRange += allocation.size < size || allocation.offset + allocation.size > CAPACITY;
+			wrongDiscards += allocation.discard == fits;
+			// Since the last discard the allocations run end to end, so starting anywhere but the last one's end overlaps it or leaves a gap.
+			overlapping += allocation.offset != (fits ? expectedOffset : 0);
+
+			expectedOffset = allocation.offset + allocation.size;
+		}
+
+		auto& stats = allocator.getFrameStats();
+		wrongStats += stats.allocations != uploads || stats.bytesAllocated != bytes || stats.discards != discards;
+	}
+
+	check(misaligned == 0, "offsets and sizes are whole 16 constant blocks");
+	check(outOfRange == 0, "allocations cover their upload and stay inside the buffer");
+	check(overlapping == 0, "allocations since the last discard don't overlap");
+	check(wrongDiscards == 0, "only the first of a frame and the ones that don't fit discard");
+	check(wrongStats == 0, "frame stats count every allocation");
+	check(wraps > 0, "some frames wrapped");
+
+	// Filling the buffer exactly doesn't wrap, the next byte does.
+	allocator.beginFrame();
+	auto first = allocator.allocate(CAPACITY - LinearConstantAllocator::ALIGNMENT);
+	auto last = allocator.allocate(LinearConstantAllocator::ALIGNMENT);
+	auto wrapped = allocator.allocate(1);
+	check(first.discard && !last.discard && last.offset + last.size == CAPACITY, "an exact fit uses the end of the buffer");
+	check(wrapped.discard && wrapped.offset == 0 && allocator.getHead() == LinearConstantAllocator::ALIGNMENT, "the allocation after the end wraps to 0");
+
+	// A whole buffer per allocation, every one of them has to discard.
+	allocator.beginFrame();
+	bool wholeBuffers = true;
+	for (uint32_t i = 0; i < 3; i++) {
+		auto whole = allocator.allocate(CAPACITY);
+		wholeBuffers = wholeBuffers && whole.discard && whole.offset == 0 && whole.size == CAPACITY;
+	}
+	check(wholeBuffers && allocator.getFrameStats().discards == 3, "whole buffer allocations discard every time");
+
+	bool tooBigThrew = false;
+	try {
+		allocator.allocate(CAPACITY + 1);
+	}
+	catch (const std::runtime_error&) {
+		tooBigThrew = true;
+	}
+	check(tooBigThrew, "an allocation bigger than the buffer throws");
+
+	std::cout << "Constant allocator:   " << allocations << " allocations over " << FRAMES << " frames, " << wraps << " wraps\n";
+	std::cout << "Failed checks:        " << errors << std::defaultfloat << std::endl;
+	return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,265 @@
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <deque>
+
+#include "Checks.h"
+#include "../CoolRenderingStuff/DynamicResolution.h"
+
+using namespace DirectX;
+
+// What a frame costs the GPU under one of benchmarkDynamicResolution's loads. fullMs is the whole frame at full
+// resolution, of which RESOLUTION_FIXED_MS costs the same at any scale. noise is the most a frame is off by, as a fraction.
+struct ResolutionTrace {
+	const char* name;
+	std::function<float(uint32_t frame)> fullMs;
+	float noise;
+};
+
+// The time and scale of every frame of one trace.
+struct ResolutionRun {
+	std::vector<float> frameMs;
+	std::vector<float> scales;
+	uint32_t scaleChanges;
+};
+
+static const float RESOLUTION_FIXED_MS = 1.5f;
+
+// Runs the controller against a trace the way the app does, every frame's time read back latency frames after it was
+// drawn and the scale it picks applying from the next frame on.
+static ResolutionRun runResolutionTrace(const ResolutionTrace& trace, uint32_t frames, uint32_t latency, const DynamicResolutionSettings& settings) {
+	DynamicResolutionController controller(settings);
+	std::mt19937 random(1234);
+
+	ResolutionRun run;
+	std::deque<float> inFlight;
+	float scale = controller.getScale();
+
+	for (uint32_t frame = 0; frame < frames; frame++) {
+		float fullMs = trace.fullMs(frame);
+		float ms = RESOLUTION_FIXED_MS + (fullMs - RESOLUTION_FIXED_MS) * scale * scale;
+		// From the generator's bits rather than a distribution, whose results the standard leaves to the library.
+		float unit = (random() >> 8) * (1.0f / 16777216.0f);
+		ms *= 1.0f + trace.noise * (unit * 2.0f - 1.0f);
+
+		run.frameMs.push_back(ms);
+		run.scales.push_back(scale);
+
+		inFlight.push_back(ms);
+		if (inFlight.size() > latency) {
+			scale = controller.update(inFlight.front());
+			inFlight.pop_front();
+		}
+	}
+
+	run.scaleChanges = controller.getStats().scaleChanges;
+	return run;
+}
+
+// The app's split screen layout, side by side for two views and quarters for four.
+static std::vector<ResolutionRect> getViewRects(int32_t width, int32_t height, uint32_t viewCount) {
+	int32_t columns = viewCount > 1 ? 2 : 1;
+	int32_t rows = viewCount > 2 ? 2 : 1;
+	int32_t viewWidth = std::max(1, width / columns);
+	int32_t viewHeight = std::max(1, height / rows);
+
+	std::vector<ResolutionRect> rects;
+	for (uint32_t i = 0; i < viewCount; i++) {
+		int32_t x = static_cast<int32_t>(i) % columns * viewWidth;
+		int32_t y = static_cast<int32_t>(i) / columns * viewHeight;
+		rects.push_back({ x, y, x + viewWidth, y + viewHeight });
+	}
+	return rects;
+}
+
+// The dynamic resolution controller against simulated GPU timings, then the viewport, scissor and upscale math it drives.
+// Every trace runs twice and has to pick the same scales both times. Each is checked for what it's there to show:
+// staying at full resolution when there's room, settling on the budget under a heavy load, dropping and recovering
+// around a spike, following a ramp, not chasing noise, and not winding up while pinned at the minimum.
+int benchmarkDynamicResolution(const Options&, uint32_t minimumFrames) {
+	const uint32_t LATENCY = 3;
+	// Frames a load is given to settle before it's held to the budget.
+	const uint32_t SETTLE = 40;
+	const uint32_t RAMP_FRAMES = 600;
+
+	DynamicResolutionSettings settings;
+	uint32_t frames = std::max(minimumFrames, SETTLE * 6);
+	float budget = settings.targetMs;
+	int errors = 0;
+
+	uint32_t spikeStart = frames / 3, spikeEnd = spikeStart + 30;
+	uint32_t floorEnd = frames / 2;
+
+	ResolutionTrace traces[] = {
+		{ "Light", [&](uint32_t) { return budget * 0.6f; }, 0.0f },
+		{ "Heavy", [&](uint32_t) { return budget * 1.8f; }, 0.0f },
+		{ "Spike", [&](uint32_t frame) { return frame >= spikeStart && frame < spikeEnd ? budget * 2.2f : budget * 0.7f; }, 0.0f },
+		// The same rate however long the run, up to a load that only fits the budget at about 0.6 scale.
+		{ "Ramp", [&](uint32_t frame) { return budget * (0.6f + 2.0f * std::min(frame, RAMP_FRAMES) / RAMP_FRAMES); }, 0.0f },
+		{ "Noisy", [&](uint32_t) { return budget * 1.5f; }, 0.1f },
+		{ "Floor", [&](uint32_t frame) { return frame < floorEnd ? budget * 6.0f : budget * 0.6f; }, 0.0f },
+	};
+
+	std::cout << "Dynamic resolution:   " << frames << " frames per trace, " << budget << " ms budget, "
+		<< RESOLUTION_FIXED_MS << " ms at any scale, times read back " << LATENCY << " frames late\n";
+	std::cout << std::fixed << std::setprecision(3);
+
+	for (auto& trace : traces) {
+		auto run = runResolutionTrace(trace, frames, LATENCY, settings);
+		auto again = runResolutionTrace(trace, frames, LATENCY, settings);
+		bool repeatable = run.scales == again.scales && run.frameMs == again.frameMs;
+
+		// Past the settling frames, apart from the spike's and the floor's own.
+		auto settled = [&](uint32_t frame) {
+			if (frame < SETTLE)
+				return false;
+			if (std::string(trace.name) == "Spike")
+				return frame < spikeStart || frame >= spikeEnd + SETTLE;
+			// Pinned at the minimum it's over budget by design, that half is checked by where it's pinned.
+			if (std::string(trace.name) == "Floor")
+				return frame >= floorEnd + SETTLE;
+			return true;
+		};
+
+		double settledMs = 0.0;
+		uint32_t settledFrames = 0, overBudget = 0;
+		float lowest = 1.0f;
+		for (uint32_t frame = 0; frame < frames; frame++) {
+			lowest = std::min(lowest, run.scales[frame]);
+			if (!settled(frame))
+				continue;
+
+			settledMs += run.frameMs[frame];
+			settledFrames++;
+			// A tenth over, on the noisy trace the noise alone is that much.
+			overBudget += run.frameMs[frame] > budget * (1.1f + trace.noise);
+		}
+		double meanMs = settledMs / std::max(1u, settledFrames);
+
+		std::string name = trace.name;
+		// Frames after the spike or the floor's load ends until it's back at full resolution.
+		uint32_t recovery = 0;
+		// Frames a tenth over budget while the spike's on, until the times from its first frames come back.
+		uint32_t spikeOver = 0;
+		bool passed = repeatable && overBudget == 0;
+		if (name == "Light")
+			passed &= lowest == 1.0f;
+		else if (name == "Heavy")
+			passed &= std::abs(meanMs - budget) < budget * 0.05;
+		else if (name == "Spike") {
+			// Over for the frames drawn before its first time comes back, and a few more coming down, then back to full.
+			uint32_t recovered = frames;
+			for (uint32_t frame = spikeStart; frame < frames; frame++) {
+				spikeOver += frame < spikeEnd && run.frameMs[frame] > budget * 1.1f;
+				if (frame >= spikeEnd && recovered == frames && run.scales[frame] == 1.0f)
+					recovered = frame;
+			}
+			recovery = recovered - spikeEnd;
+			passed &= spikeOver <= LATENCY + 4 && recovery < SETTLE;
+		}
+		else if (name == "Noisy")
+			passed &= std::abs(meanMs - budget) < budget * 0.05 && run.scaleChanges < frames / 10;
+		else if (name == "Floor") {
+			// Pinned, then back up as fast as from anywhere else, nothing wound up while it couldn't go lower.
+			uint32_t recovered = frames;
+			for (uint32_t frame = floorEnd; frame < frames && recovered == frames; frame++) {
+				if (run.scales[frame] == 1.0f)
+					recovered = frame;
+			}
+			recovery = recovered - floorEnd;
+			passed &= run.scales[floorEnd - 1] == lowest && lowest <= settings.minScale + settings.scaleStep && recovery < SETTLE;
+		}
+		errors += !passed;
+
+		std::string label = name + ":";
+		label.resize(22, ' ');
+		std::cout << label << meanMs << " ms settled, scale " << run.scales.back() << " at the end and " << lowest << " at its lowest, "
+			<< run.scaleChanges << " changes, " << overBudget << " frames over";
+		if (name == "Spike")
+			std::cout << ", " << spikeOver << " over in the spike";
+		if (recovery)
+			std::cout << ", full again " << recovery << " frames after the load went";
+		std::cout << (repeatable ? "" : ", NOT REPEATABLE") << (passed ? "" : ", FAILED") << "\n";
+	}
+
+	// Split views tile the scaled frame exactly, every pixel of it covered by one view, none outside it.
+	struct WindowSize { int32_t width, height; };
+	WindowSize windows[] = { { 1280, 720 }, { 1917, 1033 }, { 641, 361 } };
+	// The app's menu bar, the scissor keeps the top row of views out from under it.
+	const int32_t MENU_HEIGHT = 19;
+	uint32_t layoutErrors = 0, scissorErrors = 0, upscaleErrors = 0, layouts = 0;
+	std::vector<uint8_t> coverage;
+
+	for (auto window : windows) {
+		for (uint32_t viewCount : { 1u, 2u, 4u }) {
+			for (uint32_t step = 0; step <= 48; step++) {
+				float scale = step == 48 ? 0.70710677f : 1.0f - step / 64.0f;
+				auto frame = getResolutionFrame(window.width, window.height, window.width, window.height, scale);
+				auto views = getViewRects(window.width, window.height, viewCount);
+				layouts++;
+
+				// What the views cover, short of the window when it doesn't split evenly.
+				auto extent = scaleResolutionRect({ 0, 0, views.back().right, views.back().bottom }, scale);
+
+				coverage.assign(static_cast<size_t>(frame.width) * frame.height, 0);
+				for (auto& view : views) {
+					auto rect = scaleResolutionRect(view, scale);
+					auto scissor = scaleResolutionRect({ view.left, std::max(view.top, MENU_HEIGHT), view.right, view.bottom }, scale);
+					scissorErrors += scissor.top < rect.top || scissor.bottom > rect.bottom || scissor.left < rect.left || scissor.right > rect.right;
+					if (scale == 1.0f)
+						layoutErrors += memcmp(&rect, &view, sizeof(ResolutionRect)) != 0;
+
+					if (rect.left < 0 || rect.top < 0 || rect.right > static_cast<int32_t>(frame.width) || rect.bottom > static_cast<int32_t>(frame.height) || rect.width() <= 0 || rect.height() <= 0) {
+						layoutErrors++;
+						continue;
+					}
+					for (int32_t y = rect.top; y < rect.bottom; y++) {
+						for (int32_t x = rect.left; x < rect.right; x++) {
+							coverage[static_cast<size_t>(y) * frame.width + x]++;
+						}
+					}
+				}
+				for (int32_t y = 0; y < static_cast<int32_t>(frame.height); y++) {
+					for (int32_t x = 0; x < static_cast<int32_t>(frame.width); x++) {
+						uint8_t expected = x < extent.right && y < extent.bottom ? 1 : 0;
+						layoutErrors += coverage[static_cast<size_t>(y) * frame.width + x] != expected;
+					}
+				}
+
+				// The upscale's first and last pixel centres land inside what was rendered, and at full scale on texel centres.
+				for (int axis = 0; axis < 2; axis++) {
+					float outputSize = static_cast<float>(axis ? window.height : window.width);
+					float targetSize = outputSize;
+					float renderSize = static_cast<float>(axis ? frame.height : frame.width);
+					float first = 0.5f * frame.uvPerPixel[axis] * targetSize;
+					float last = (outputSize - 0.5f) * frame.uvPerPixel[axis] * targetSize;
+					upscaleErrors += first < 0.0f || last > renderSize || std::abs(frame.uvMax[axis] * targetSize - (renderSize - 0.5f)) > 1e-3f;
+					if (scale == 1.0f)
+						upscaleErrors += std::abs(first - 0.5f) > 1e-3f || std::abs(last - (outputSize - 0.5f)) > 1e-3f;
+				}
+			}
+		}
+	}
+
+	// Oversized targets, the frame still only reads what it rendered.
+	auto oversized = getResolutionFrame(1280, 720, 2048, 1024, 0.5f);
+	upscaleErrors += oversized.width != 640 || oversized.height != 360 || std::abs(oversized.uvMax[0] * 2048.0f - 639.5f) > 1e-3f
+		|| std::abs(1279.5f * oversized.uvPerPixel[0] * 2048.0f - 639.75f) > 1e-3f;
+
+	errors += layoutErrors != 0;
+	errors += scissorErrors != 0;
+	errors += upscaleErrors != 0;
+
+	std::cout << "Layouts:              " << layouts << " window, view count and scale combinations\n";
+	std::cout << "Coverage errors:      " << layoutErrors << "\n";
+	std::cout << "Scissor errors:       " << scissorErrors << "\n";
+	std::cout << "Upscale errors:       " << upscaleErrors << "\n";
+	std::cout << "Failed checks:        " << errors << std::defaultfloat << std::endl;
+
+	return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,200 @@
+#include <vector>
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <filesystem>
+#include <cstring>
+
+#include "Checks.h"
+#include "../CoolRenderingStuff/JobSystem.h"
+#include "../CoolRenderingStuff/Cubemap.h"
+#include "../CoolRenderingStuff/EnvironmentLighting.h"
+
+using namespace DirectX;
+
+// Radiance times solid angle summed over one level, over 4 PI. The same as the constant SH coefficient.
+static XMFLOAT3 getCubeMean(const Cubemap& cube, uint32_t level) {
+	uint32_t size = cube.getLevelSize(level);
+	double sum[3] = {};
+	for (uint32_t face = 0; face < CUBE_FACE_COUNT; face++) {
+		const XMFLOAT4* texels = cube.getFace(level, face);
+		for (uint32_t y = 0; y < size; y++) {
+			for (uint32_t x = 0; x < size; x++) {
+				double weight = getCubeTexelSolidAngle(x, y, size);
+				sum[0] += texels[y * size + x].x * weight;
+				sum[1] += texels[y * size + x].y * weight;
+				sum[2] += texels[y * size + x].z * weight;
+			}
+		}
+	}
+	return XMFLOAT3(static_cast<float>(sum[0] / (4.0 * XM_PI)), static_cast<float>(sum[1] / (4.0 * XM_PI)), static_cast<float>(sum[2] / (4.0 * XM_PI)));
+}
+
+// Bakes the probe every way there is and checks them against each other: the SSE projection against the double one, one
+// thread against all of them, a constant cube against its known answer, the SH against brute force irradiance and the
+// cache against a fresh bake.
+int benchmarkEnvironment(const Options& options, uint32_t) {
+	JobSystem jobs(options.threads);
+	auto elapsedMs = [](std::chrono::high_resolution_clock::time_point start) {
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	};
+
+	JobSystem single(1);
+	SpecularPrefilterSettings settings;
+	const uint32_t iterations = std::max(5u, options.frames);
+	int errors = 0;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	Cubemap source = loadCubemapDDS(options.environment);
+	double loadMs = elapsedMs(start);
+
+	// Unsigned BC6H can't decode to anything negative or not finite, if it does a mode's bits are read wrong.
+	uint64_t badTexels = 0;
+	for (auto& texel : source.texels) {
+		if (!(texel.x >= 0.0f && texel.y >= 0.0f && texel.z >= 0.0f) || !std::isfinite(texel.x + texel.y + texel.z))
+			badTexels++;
+	}
+	errors += badTexels != 0;
+
+	std::cout << "\nThreads:              " << jobs.getNumThreads() << "\n";
+	std::cout << "Source:               " << source.size << "x" << source.size << " faces, " << source.levelCount << " levels\n";
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << "Load ms:              " << loadMs << "\n";
+	std::cout << "Bad texels:           " << badTexels << "\n";
+
+	IrradianceSH reference{}, singleThreaded{}, parallel{};
+	double referenceMs = 0.0, singleMs = 0.0, parallelMs = 0.0;
+	for (uint32_t i = 0; i < iterations; i++) {
+		start = std::chrono::high_resolution_clock::now();
+		reference = projectIrradianceSHReference(source);
+		referenceMs += elapsedMs(start);
+
+		start = std::chrono::high_resolution_clock::now();
+		singleThreaded = projectIrradianceSH(source, single);
+		singleMs += elapsedMs(start);
+
+		start = std::chrono::high_resolution_clock::now();
+		parallel = projectIrradianceSH(source, jobs);
+		parallelMs += elapsedMs(start);
+	}
+	referenceMs /= iterations;
+	singleMs /= iterations;
+	parallelMs /= iterations;
+
+	float projectionError = 0.0f;
+	float largest = 0.0f;
+	for (int i = 0; i < 9; i++) {
+		auto& a = parallel.coefficients[i];
+		auto& b = reference.coefficients[i];
+		projectionError = std::max({ projectionError, std::fabs(a.x - b.x), std::fabs(a.y - b.y), std::fabs(a.z - b.z) });
+		largest = std::max({ largest, std::fabs(b.x), std::fabs(b.y), std::fabs(b.z) });
+	}
+	bool threadsMatch = memcmp(&singleThreaded, &parallel, sizeof(IrradianceSH)) == 0;
+	errors += projectionError > 1e-4f * largest;
+	errors += !threadsMatch;
+
+	std::cout << "SH projection:        " << referenceMs << " ms scalar double, " << singleMs << " ms SSE, " << parallelMs << " ms SSE on every thread ("
+		<< std::setprecision(1) << (parallelMs > 0.0 ? referenceMs / parallelMs : 0.0) << "x)\n" << std::setprecision(3);
+	std::cout << "SH error:             " << std::scientific << projectionError << std::fixed << " against the double projection, threads "
+		<< (threadsMatch ? "match" : "differ") << "\n";
+
+	// Any constant radiance is exactly its own irradiance over PI, with nothing in the higher bands.
+	Cubemap constant;
+	constant.allocate(32, 1);
+	for (auto& texel : constant.texels) {
+		texel = XMFLOAT4(0.25f, 0.5f, 1.0f, 1.0f);
+	}
+	IrradianceSH constantSH = projectIrradianceSH(constant, jobs);
+	float constantError = std::fabs(constantSH.coefficients[0].x - 0.25f) + std::fabs(constantSH.coefficients[0].y - 0.5f) + std::fabs(constantSH.coefficients[0].z - 1.0f);
+	for (int i = 1; i < 9; i++) {
+		constantError += std::fabs(constantSH.coefficients[i].x) + std::fabs(constantSH.coefficients[i].y) + std::fabs(constantSH.coefficients[i].z);
+	}
+	errors += constantError > 1e-4f;
+	std::cout << "Constant cube error:  " << std::scientific << constantError << std::fixed << "\n";
+
+	// Brute force cosine weighted irradiance over a spread of normals. L2 can't follow sharp lighting, so this is only reported.
+	const uint32_t normalCount = 32;
+	const float goldenAngle = XM_PI * (3.0f - std::sqrt(5.0f));
+	float worstIrradiance = 0.0f;
+	float meanIrradiance = 0.0f;
+	for (uint32_t n = 0; n < normalCount; n++) {
+		float z = 1.0f - 2.0f * (n + 0.5f) / normalCount;
+		float radius = std::sqrt(1.0f - z * z);
+		XMFLOAT3 normal(radius * std::cos(goldenAngle * n), radius * std::sin(goldenAngle * n), z);
+
+		double sum[3] = {};
+		for (uint32_t face = 0; face < CUBE_FACE_COUNT; face++) {
+			const XMFLOAT4* texels = source.getFace(0, face);
+			for (uint32_t y = 0; y < source.size; y++) {
+				for (uint32_t x = 0; x < source.size; x++) {
+					XMFLOAT3 d = getCubeDirection(face, (x + 0.5f) * 2.0f / source.size - 1.0f, (y + 0.5f) * 2.0f / source.size - 1.0f);
+					float cosine = (d.x * normal.x + d.y * normal.y + d.z * normal.z) / std::sqrt(d.x * d.x + d.y * d.y + d.z * d.z);
+					if (cosine <= 0.0f)
+						continue;
+
+					double weight = getCubeTexelSolidAngle(x, y, source.size) * cosine / XM_PI;
+					sum[0] += texels[y * source.size + x].x * weight;
+					sum[1] += texels[y * source.size + x].y * weight;
+					sum[2] += texels[y * source.size + x].z * weight;
+				}
+			}
+		}
+
+		XMFLOAT3 evaluated;
+		XMStoreFloat3(&evaluated, evaluateIrradianceSH(parallel, XMLoadFloat3(&normal)));
+		worstIrradiance = std::max({ worstIrradiance, std::fabs(evaluated.x - static_cast<float>(sum[0])),
+			std::fabs(evaluated.y - static_cast<float>(sum[1])), std::fabs(evaluated.z - static_cast<float>(sum[2])) });
+		meanIrradiance += static_cast<float>(sum[0] + sum[1] + sum[2]) / (3.0f * normalCount);
+	}
+	std::cout << "SH against brute:     " << std::setprecision(1) << (meanIrradiance > 0.0f ? 100.0f * worstIrradiance / meanIrradiance : 0.0f)
+		<< "% of the mean irradiance at worst, " << normalCount << " normals\n" << std::setprecision(3);
+
+	start = std::chrono::high_resolution_clock::now();
+	Cubemap singlePrefiltered = prefilterSpecular(source, settings, single);
+	double singlePrefilterMs = elapsedMs(start);
+
+	start = std::chrono::high_resolution_clock::now();
+	Cubemap prefiltered = prefilterSpecular(source, settings, jobs);
+	double prefilterMs = elapsedMs(start);
+
+	bool prefilterMatch = singlePrefiltered.texels.size() == prefiltered.texels.size() &&
+		memcmp(singlePrefiltered.texels.data(), prefiltered.texels.data(), prefiltered.texels.size() * sizeof(XMFLOAT4)) == 0;
+	errors += !prefilterMatch;
+
+	std::cout << "Prefilter:            " << settings.size << " in " << settings.levels << " levels, " << settings.sampleCount << " samples, " << singlePrefilterMs
+		<< " ms on one thread, " << prefilterMs << " ms on every thread (" << std::setprecision(1) << (prefilterMs > 0.0 ? singlePrefilterMs / prefilterMs : 0.0)
+		<< "x), threads " << (prefilterMatch ? "match" : "differ") << "\n";
+
+	// Filtering spreads the light out but shouldn't add or lose much of it.
+	XMFLOAT3 sourceMean = getCubeMean(source, 0);
+	float sourceLuminance = sourceMean.x + sourceMean.y + sourceMean.z;
+	std::cout << "Level means:          ";
+	for (uint32_t level = 0; level < prefiltered.levelCount; level++) {
+		XMFLOAT3 mean = getCubeMean(prefiltered, level);
+		std::cout << (level ? ", " : "") << (sourceLuminance > 0.0f ? 100.0f * (mean.x + mean.y + mean.z) / sourceLuminance : 0.0f) << "%";
+	}
+	std::cout << " of the source\n" << std::setprecision(3);
+
+	// A bake into an empty cache, then one that should only read it back.
+	std::string cachePath = std::filesystem::path(options.out).replace_extension(".env").string();
+	std::filesystem::remove(cachePath);
+
+	EnvironmentLighting baked, cached;
+	auto bakeStats = bakeEnvironmentLighting(options.environment, cachePath, settings, jobs, baked);
+	auto cacheStats = bakeEnvironmentLighting(options.environment, cachePath, settings, jobs, cached);
+
+	bool cacheMatches = !bakeStats.upToDate && cacheStats.upToDate &&
+		memcmp(&baked.irradiance, &parallel, sizeof(IrradianceSH)) == 0 && memcmp(&cached.irradiance, &parallel, sizeof(IrradianceSH)) == 0 &&
+		cached.specular.texels.size() == prefiltered.texels.size() &&
+		memcmp(cached.specular.texels.data(), prefiltered.texels.data(), prefiltered.texels.size() * sizeof(XMFLOAT4)) == 0;
+	errors += !cacheMatches;
+
+	std::cout << "Bake ms:              " << bakeStats.loadMs + bakeStats.projectMs + bakeStats.prefilterMs << ", " << cacheStats.loadMs << " from the cache, "
+		<< (cacheMatches ? "matches" : "differs from") << " a fresh bake\n";
+	std::cout << "Failed checks:        " << errors << std::defaultfloat << std::endl;
+
+	return errors == 0 ? 0 : 1;
+}
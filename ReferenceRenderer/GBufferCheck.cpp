@@ -0,0 +1,175 @@
+#include <vector>
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
+#include "Checks.h"
+#include "../CoolRenderingStuff/Scene.h"
+#include "../CoolRenderingStuff/GBufferLayout.h"
+
+using namespace DirectX;
+
+// The compact G-buffer's encodings against the bounds it's documented to hold, using the CPU copies of what the
+// shaders do: normals through octahedral RG16 SNORM, specular and gloss through RGBA8, and world positions through
+// the app's view projections and back from depth. Then the bytes every layout costs per pixel.
+int checkGBufferEncoding(const Options& options, uint32_t) {
+	using namespace GBufferEncoding;
+
+	const uint32_t NORMAL_SAMPLES = 1 << 20;
+	// What 16 bits on the octahedron square hold, under four thousandths of a degree at the worst place on it.
+	const float MAX_NORMAL_ERROR_DEGREES = 0.005f;
+	// Without the snorm storage only float rounding is left.
+	const float MAX_UNQUANTIZED_ERROR_DEGREES = 0.0002f;
+	int errors = 0;
+
+	std::cout << std::fixed << std::setprecision(5);
+
+	float quantized = maxNormalRoundTripErrorDegrees(NORMAL_SAMPLES);
+
+	// The poles, the axes, the octahedron's folded edges and corners, and the fibonacci sphere again without
+	// quantization. Axis aligned normals have to come back exactly, flat floors and walls are most of most scenes.
+	std::vector<XMFLOAT3> special = {
+		{ 1.0f, 0.0f, 0.0f }, { -1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, -1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 0.0f, 0.0f, -1.0f },
+		{ 1.0f, 1.0f, 0.0f }, { -1.0f, 1.0f, 0.0f }, { 1.0f, -1.0f, 0.0f }, { -1.0f, -1.0f, 0.0f },
+		{ 1.0f, 1.0f, -1.0f }, { -1.0f, -1.0f, -1.0f }, { 0.001f, 0.0f, -1.0f }, { 0.0f, -0.001f, -1.0f },
+	};
+	float specialError = 0.0f;
+	uint32_t axesExact = 0;
+	for (size_t i = 0; i < special.size(); i++) {
+		specialError = std::max(specialError, normalRoundTripErrorDegrees(special[i]));
+
+		if (i < 6) {
+			auto decoded = decodeOctahedral(unpackOctahedralSnorm16(packOctahedralSnorm16(encodeOctahedral(special[i]))));
+			axesExact += decoded.x == special[i].x && decoded.y == special[i].y && decoded.z == special[i].z;
+		}
+	}
+
+	const float goldenAngle = XM_PI * (3.0f - std::sqrt(5.0f));
+	float unquantized = 0.0f;
+	for (uint32_t i = 0; i < NORMAL_SAMPLES; i += 16) {
+		float z = 1.0f - 2.0f * (i + 0.5f) / NORMAL_SAMPLES;
+		float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+		XMFLOAT3 normal = { r * std::cos(goldenAngle * i), r * std::sin(goldenAngle * i), z };
+
+		auto decoded = decodeOctahedral(encodeOctahedral(normal));
+		unquantized = std::max(unquantized, angleBetweenDegrees(XMLoadFloat3(&normal), XMLoadFloat3(&decoded)));
+	}
+
+	bool normalsPassed = quantized <= MAX_NORMAL_ERROR_DEGREES && specialError <= MAX_NORMAL_ERROR_DEGREES
+		&& unquantized <= MAX_UNQUANTIZED_ERROR_DEGREES && axesExact == 6;
+	errors += !normalsPassed;
+	std::cout << "Normals:              " << NORMAL_SAMPLES << " on a fibonacci sphere, worst " << quantized << " degrees, special cases "
+		<< specialError << ", unquantized " << unquantized << ", " << axesExact << "/6 axes exact, bound "
+		<< MAX_NORMAL_ERROR_DEGREES << (normalsPassed ? "" : ", FAILED") << "\n";
+
+	// Every gloss and specular level through the RGBA8 target, to within half a step of 8 bits.
+	float worstSpecular = 0.0f, worstPower = 0.0f;
+	for (uint32_t i = 0; i <= 1024; i++) {
+		float value = i / 1024.0f;
+		XMFLOAT3 specular;
+		float gloss;
+		unpackSpecularGloss(packSpecularGloss({ value, 1.0f - value, value * value }, value), specular, gloss);
+
+		worstSpecular = std::max({ worstSpecular, std::abs(specular.x - value), std::abs(specular.y - (1.0f - value)), std::abs(specular.z - value * value) });
+		worstPower = std::max(worstPower, std::abs(specularPowerFromGloss(gloss) - specularPowerFromGloss(value)));
+	}
+	float powerBound = specularPowerFromGloss(0.5f / 255.0f) + 1e-4f;
+	bool glossPassed = worstSpecular <= 0.5f / 255.0f + 1e-6f && worstPower <= powerBound;
+	errors += !glossPassed;
+	std::cout << "Specular and gloss:   worst specular " << worstSpecular << ", worst power " << worstPower << " of " << specularPowerFromGloss(1.0f)
+		<< ", bound " << powerBound << (glossPassed ? "" : ", FAILED") << "\n";
+
+	// Points from near the near plane to near the far one, projected the way the rasterizer does and rebuilt the way
+	// the compact light passes do. Once with the depth as a float and once through the D24 depth buffer.
+	struct Camera {
+		XMFLOAT3 position;
+		float pitch;
+		float yaw;
+	};
+	const Camera cameras[] = {
+		{ options.cameraPosition, options.pitch, options.yaw },
+		{ { 10.0f, 4.0f, -3.0f }, 0.4f, 2.1f },
+		{ { -6.0f, 12.0f, 2.0f }, -1.2f, -0.7f },
+	};
+	const float distances[] = { 0.2f, 1.0f, 5.0f, 25.0f, 100.0f };
+	// Relative to the distance from the camera. With the app's 0.1 near plane depth is close to 1 past a few units,
+	// where a float has no more bits than D24, and by 100 units both are off by about two parts in ten thousand.
+	const float MAX_POSITION_ERROR = 5e-4f;
+
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> unit(-0.9f, 0.9f);
+	float worstFloat = 0.0f, worstD24 = 0.0f;
+	uint32_t points = 0;
+	for (auto& camera : cameras) {
+		auto frame = calculatePerFrameUniforms(camera.position, camera.pitch, camera.yaw, options.width, options.height);
+		auto eye = XMLoadFloat3(&camera.position);
+
+		for (float distance : distances) {
+			for (uint32_t i = 0; i < 64; i++) {
+				// A direction inside the frustum, from a random NDC point pushed back out through the inverse.
+				auto farPoint = XMVector3TransformCoord(XMVectorSet(unit(random), unit(random), 0.5f, 1.0f), frame.invViewProj);
+				auto point = XMVectorAdd(eye, XMVectorScale(XMVector3Normalize(XMVectorSubtract(farPoint, eye)), distance));
+
+				auto clip = XMVector4Transform(XMVectorSetW(point, 1.0f), frame.viewProj);
+				auto ndc = XMVectorScale(clip, 1.0f / XMVectorGetW(clip));
+				XMFLOAT2 uv = { XMVectorGetX(ndc) * 0.5f + 0.5f, 0.5f - XMVectorGetY(ndc) * 0.5f };
+				float depth = XMVectorGetZ(ndc);
+				float depthD24 = std::round(depth * 16777215.0f) / 16777215.0f;
+
+				auto rebuilt = reconstructPosition(uv, depth, frame.invViewProj);
+				auto rebuiltD24 = reconstructPosition(uv, depthD24, frame.invViewProj);
+				float floatError = XMVectorGetX(XMVector3Length(XMVectorSubtract(XMLoadFloat3(&rebuilt), point))) / distance;
+				float d24Error = XMVectorGetX(XMVector3Length(XMVectorSubtract(XMLoadFloat3(&rebuiltD24), point))) / distance;
+
+				worstFloat = std::max(worstFloat, floatError);
+				worstD24 = std::max(worstD24, d24Error);
+				points++;
+			}
+		}
+	}
+	bool positionsPassed = worstFloat <= MAX_POSITION_ERROR && worstD24 <= MAX_POSITION_ERROR;
+	errors += !positionsPassed;
+	std::cout << std::defaultfloat << "Positions:            " << points << " points from " << distances[0] << " to " << distances[std::size(distances) - 1]
+		<< " units, worst relative error " << worstFloat << " float depth, " << worstD24 << " D24" << (positionsPassed ? "" : ", FAILED") << "\n";
+	std::cout << std::fixed << std::setprecision(1);
+
+	// What GBufferLayout.h documents for each layout, and the bandwidth calculator's sums at the output size with a
+	// light per scene light.
+	struct LayoutExpectation {
+		GBufferLayout layout;
+		uint32_t bytesPerPixel;
+	};
+	const LayoutExpectation layouts[] = {
+		{ GBufferLayout::Standard, 28 },
+		{ GBufferLayout::Compact, 12 },
+	};
+	const uint32_t LIGHTS = 4;
+	uint64_t pixels = static_cast<uint64_t>(options.width) * options.height;
+
+	for (auto& expected : layouts) {
+		auto& desc = getGBufferLayoutDesc(expected.layout);
+		uint32_t bytes = getGBufferBytesPerPixel(expected.layout);
+		auto bandwidth = calculateGBufferBandwidth(expected.layout, options.width, options.height, LIGHTS);
+
+		uint64_t lightRead = bytes + (desc.positionFromDepth ? desc.depthBytesPerPixel : 0);
+		bool passed = bytes == expected.bytesPerPixel
+			&& desc.depthBytesPerPixel == 4
+			&& bandwidth.bytesPerPixel == bytes
+			&& bandwidth.targetMemory == pixels * bytes
+			&& bandwidth.geometryPassWrite == pixels * (bytes + desc.depthBytesPerPixel)
+			&& bandwidth.lightPassRead == pixels * lightRead * LIGHTS
+			&& bandwidth.totalPerFrame == bandwidth.geometryPassWrite + bandwidth.lightPassRead;
+		errors += !passed;
+
+		std::cout << std::left << std::setw(22) << std::string(desc.name) + " layout:" << std::right << bytes << " bytes per pixel (expected "
+			<< expected.bytesPerPixel << "), " << bandwidth.totalPerFrame / (1024.0 * 1024.0) << " MB per frame with "
+			<< LIGHTS << " lights at " << options.width << "x" << options.height << (passed ? "" : ", FAILED") << "\n";
+	}
+
+	std::cout << "Failed checks:        " << errors << std::defaultfloat << std::endl;
+	return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,170 @@
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <chrono>
+#include <algorithm>
+
+#include "Checks.h"
+#include "../CoolRenderingStuff/GeometryArena.h"
+
+using namespace DirectX;
+
+// Streams random meshes in and out of one arena, keeping it around 70% full. A shadow copy of both buffers records which
+// allocation owns every slot, so an overlap, a lost range or a compaction that drops or mangles data is caught.
+int benchmarkGeometryArena(const Options&, uint32_t stepCount) {
+	const uint32_t VERTEX_CAPACITY = 1 << 20;
+	const uint32_t INDEX_CAPACITY = 1 << 22;
+	const uint32_t NO_OWNER = ~0u;
+
+	std::mt19937 random(1234);
+	// Mostly small props with the odd big one, like a real scene.
+	std::uniform_real_distribution<float> logVertices(std::log(16.0f), std::log(65536.0f));
+	std::uniform_real_distribution<float> indicesPerVertex(1.5f, 6.0f);
+	std::uniform_real_distribution<float> chance(0.0f, 1.0f);
+
+	GeometryArena arena(VERTEX_CAPACITY, INDEX_CAPACITY);
+	std::vector<uint32_t> vertexOwner(VERTEX_CAPACITY, NO_OWNER);
+	std::vector<uint32_t> indexOwner(INDEX_CAPACITY, NO_OWNER);
+	std::vector<uint32_t> live;
+
+	int errors = 0;
+	auto fill = [&](std::vector<uint32_t>& owner, uint32_t first, uint32_t count, uint32_t expected, uint32_t value) {
+		for (uint32_t i = first; i < first + count; i++) {
+			if (owner[i] != expected)
+				errors++;
+			owner[i] = value;
+		}
+	};
+
+	uint64_t allocations = 0, frees = 0, fragmentedFailures = 0, compactions = 0, movedVertices = 0, movedIndices = 0;
+	double fragmentationSum = 0.0, worstFragmentation = 0.0;
+	double allocateMs = 0.0, freeMs = 0.0, compactMs = 0.0;
+
+	for (uint32_t step = 0; step < stepCount; step++) {
+		auto stats = arena.getStats();
+		float fullness = static_cast<float>(stats.usedVertices) / VERTEX_CAPACITY / 0.7f;
+
+		if (!live.empty() && chance(random) < fullness * 0.5f) {
+			std::uniform_int_distribution<size_t> pick(0, live.size() - 1);
+			size_t slot = pick(random);
+			uint32_t handle = live[slot];
+			auto range = arena.getRange(handle);
+
+			auto start = std::chrono::high_resolution_clock::now();
+			arena.free(handle);
+			freeMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+			fill(vertexOwner, range.baseVertex, range.vertexCount, handle, NO_OWNER);
+			fill(indexOwner, range.startIndex, range.indexCount, handle, NO_OWNER);
+			live[slot] = live.back();
+			live.pop_back();
+			frees++;
+		}
+		else {
+			uint32_t vertexCount = static_cast<uint32_t>(std::exp(logVertices(random)));
+			uint32_t indexCount = static_cast<uint32_t>(vertexCount * indicesPerVertex(random)) / 3 * 3;
+
+			auto start = std::chrono::high_resolution_clock::now();
+			uint32_t handle = arena.allocate(vertexCount, indexCount);
+			allocateMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+			if (handle == GeometryArena::NO_ALLOCATION && arena.couldFit(vertexCount, indexCount)) {
+				fragmentedFailures++;
+
+				start = std::chrono::high_resolution_clock::now();
+				auto moves = arena.compact();
+				compactMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+				compactions++;
+
+				// Copies out of the old shadow into a new one, the same as the pool copying into fresh buffers.
+				std::vector<uint32_t> newVertexOwner(VERTEX_CAPACITY, NO_OWNER);
+				std::vector<uint32_t> newIndexOwner(INDEX_CAPACITY, NO_OWNER);
+				for (auto& move : moves) {
+					fill(vertexOwner, move.from.baseVertex, move.from.vertexCount, move.handle, move.handle);
+					fill(indexOwner, move.from.startIndex, move.from.indexCount, move.handle, move.handle);
+					fill(newVertexOwner, move.to.baseVertex, move.to.vertexCount, NO_OWNER, move.handle);
+					fill(newIndexOwner, move.to.startIndex, move.to.indexCount, NO_OWNER, move.handle);
+
+					auto& now = arena.getRange(move.handle);
+					if (now.baseVertex != move.to.baseVertex || now.startIndex != move.to.startIndex)
+						errors++;
+					if (move.from.baseVertex != move.to.baseVertex)
+						movedVertices += move.from.vertexCount;
+					if (move.from.startIndex != move.to.startIndex)
+						movedIndices += move.from.indexCount;
+				}
+				if (moves.size() != live.size())
+					errors++;
+
+				vertexOwner = std::move(newVertexOwner);
+				indexOwner = std::move(newIndexOwner);
+
+				auto compacted = arena.getStats();
+				if (compacted.vertexFragmentation() != 0.0f || compacted.indexFragmentation() != 0.0f)
+					errors++;
+
+				handle = arena.allocate(vertexCount, indexCount);
+				if (handle == GeometryArena::NO_ALLOCATION)
+					errors++;
+			}
+
+			if (handle != GeometryArena::NO_ALLOCATION) {
+				auto& range = arena.getRange(handle);
+				if (range.vertexCount != vertexCount || range.indexCount != indexCount ||
+					range.baseVertex + vertexCount > VERTEX_CAPACITY || range.startIndex + indexCount > INDEX_CAPACITY) {
+					errors++;
+				}
+				else {
+					fill(vertexOwner, range.baseVertex, vertexCount, NO_OWNER, handle);
+					fill(indexOwner, range.startIndex, indexCount, NO_OWNER, handle);
+				}
+				live.push_back(handle);
+				allocations++;
+			}
+		}
+
+		stats = arena.getStats();
+		if (stats.allocations != live.size() || stats.usedVertices + stats.freeVertices != VERTEX_CAPACITY || stats.usedIndices + stats.freeIndices != INDEX_CAPACITY)
+			errors++;
+
+		double fragmentation = stats.vertexFragmentation();
+		fragmentationSum += fragmentation;
+		worstFragmentation = std::max(worstFragmentation, fragmentation);
+	}
+
+	// Every slot still has to belong to whoever the arena says it does, and the used counts have to add up.
+	uint64_t ownedVertices = 0, ownedIndices = 0;
+	for (uint32_t handle : live) {
+		auto& range = arena.getRange(handle);
+		for (uint32_t i = range.baseVertex; i < range.baseVertex + range.vertexCount; i++) {
+			if (vertexOwner[i] != handle)
+				errors++;
+		}
+		for (uint32_t i = range.startIndex; i < range.startIndex + range.indexCount; i++) {
+			if (indexOwner[i] != handle)
+				errors++;
+		}
+		ownedVertices += range.vertexCount;
+		ownedIndices += range.indexCount;
+	}
+	auto stats = arena.getStats();
+	if (ownedVertices != stats.usedVertices || ownedIndices != stats.usedIndices)
+		errors++;
+
+	double steps = stepCount;
+	std::cout << "\nSteps:                " << stepCount << " (" << allocations << " loads, " << frees << " unloads)\n";
+	std::cout << "Live meshes:          " << live.size() << ", " << std::fixed << std::setprecision(1)
+		<< 100.0 * stats.usedVertices / VERTEX_CAPACITY << "% of vertices, " << 100.0 * stats.usedIndices / INDEX_CAPACITY << "% of indices\n";
+	std::cout << "Fragmentation:        " << 100.0 * fragmentationSum / steps << "% average, " << 100.0 * worstFragmentation << "% worst\n";
+	std::cout << "Fragmented failures:  " << fragmentedFailures << ", each fixed by a compaction\n";
+	std::cout << "Compactions:          " << compactions << ", " << (compactions ? movedVertices / compactions : 0) << " vertices and "
+		<< (compactions ? movedIndices / compactions : 0) << " indices moved on average\n";
+	std::cout << std::setprecision(3);
+	std::cout << "Allocate us:          " << 1000.0 * allocateMs / std::max<uint64_t>(allocations, 1) << "\n";
+	std::cout << "Free us:              " << 1000.0 * freeMs / std::max<uint64_t>(frees, 1) << "\n";
+	std::cout << "Compact ms:           " << (compactions ? compactMs / compactions : 0.0) << std::defaultfloat << "\n";
+	std::cout << "Errors:               " << errors << std::endl;
+
+	return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,192 @@
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <cstring>
+
+#include "Checks.h"
+#include "../CoolRenderingStuff/JobSystem.h"
+#include "../CoolRenderingStuff/Scene.h"
+#include "../CoolRenderingStuff/LightTree.h"
+
+using namespace DirectX;
+
+// Diffuse only, lightAccPixel.hlsl's Lambert term for a white surface summed over the channels.
+static float getDiffuseContribution(const Light& light, FXMVECTOR position, FXMVECTOR normal) {
+	auto toLight = XMVectorSubtract(XMLoadFloat3(&light.position), position);
+	float distSquared = XMVectorGetX(XMVector3LengthSq(toLight));
+	float lambert = std::max(XMVectorGetX(XMVector3Dot(normal, XMVector3Normalize(toLight))), 0.0f) / distSquared;
+	return lambert * light.intensity * (light.color.x + light.color.y + light.color.z);
+}
+
+// Builds over generated lights, refits them as they move, then checks the probabilities at random shading points: every
+// light's adds up to one, a sample's matches the walk down to its leaf and the estimate from a few samples lands on the
+// sum over every light.
+int benchmarkLightTree(const Options& options, uint32_t lightCount) {
+	JobSystem jobs(options.threads);
+	auto elapsedMs = [](std::chrono::high_resolution_clock::time_point start) {
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	};
+
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	int errors = 0;
+
+	auto lights = generateLights(lightCount, random);
+	const uint32_t iterations = std::max(5u, options.frames);
+
+	LightTree tree;
+	double buildMs = 0.0;
+	for (uint32_t i = 0; i < iterations; i++) {
+		tree.build(lights);
+		buildMs += tree.getBuildMs();
+	}
+	buildMs /= iterations;
+
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << "\nThreads:              " << jobs.getNumThreads() << "\n";
+	std::cout << "Lights:               " << lights.size() << "\n";
+	std::cout << "Nodes:                " << tree.getNodes().size() << ", depth " << tree.getDepth() << "\n";
+	std::cout << "Build ms:             " << buildMs << ", " << std::setprecision(2) << (buildMs > 0.0 ? lights.size() / buildMs / 1000.0 : 0.0)
+		<< " Mlights/s\n" << std::setprecision(3);
+
+	// Refitting lights that haven't moved changes nothing but the order power is added in.
+	auto built = tree.getNodes();
+	tree.refit(lights);
+	bool refitMatches = true;
+	for (size_t i = 0; i < built.size(); i++) {
+		auto& a = built[i];
+		auto& b = tree.getNodes()[i];
+		refitMatches &= memcmp(&a.min, &b.min, sizeof(XMFLOAT3)) == 0 && memcmp(&a.max, &b.max, sizeof(XMFLOAT3)) == 0 && a.offset == b.offset &&
+			std::fabs(a.power - b.power) <= 1e-4f * std::max(a.power, 1.0f);
+	}
+	errors += !refitMatches;
+
+	// Every light circling where it started, a little further each frame.
+	std::vector<XMFLOAT3> origins(lights.size());
+	std::vector<float> phases(lights.size());
+	for (size_t i = 0; i < lights.size(); i++) {
+		origins[i] = lights[i].position;
+		phases[i] = unit(random) * XM_2PI;
+	}
+
+	double refitMs = 0.0;
+	for (uint32_t frame = 1; frame <= iterations; frame++) {
+		float time = frame * 0.1f;
+		for (size_t i = 0; i < lights.size(); i++) {
+			lights[i].position = { origins[i].x + 0.25f * std::cos(time + phases[i]), origins[i].y, origins[i].z + 0.25f * std::sin(time + phases[i]) };
+		}
+		tree.refit(lights);
+		refitMs += tree.getRefitMs();
+	}
+	refitMs /= iterations;
+
+	LightTree rebuilt;
+	rebuilt.build(lights);
+	double refitCost = tree.getCost(), rebuiltCost = rebuilt.getCost();
+
+	std::cout << "Refit ms:             " << refitMs << ", " << std::setprecision(2) << (refitMs > 0.0 ? lights.size() / refitMs / 1000.0 : 0.0) << " Mlights/s, "
+		<< (refitMatches ? "matches" : "differs from") << " the build in place, cost " << (rebuiltCost > 0.0 ? refitCost / rebuiltCost : 0.0)
+		<< "x a rebuild after moving\n" << std::setprecision(3);
+
+	std::uniform_real_distribution<float> x(-15.0f, 15.0f), y(0.0f, 10.0f), z(-10.0f, 10.0f), direction(-1.0f, 1.0f);
+	auto randomPoint = [&](XMVECTOR& position, XMVECTOR& normal) {
+		position = XMVectorSet(x(random), y(random), z(random), 0.0f);
+		do {
+			normal = XMVectorSet(direction(random), direction(random), direction(random), 0.0f);
+		} while (XMVectorGetX(XMVector3LengthSq(normal)) > 1.0f || XMVectorGetX(XMVector3LengthSq(normal)) < 1e-4f);
+		normal = XMVector3Normalize(normal);
+	};
+
+	// Every light's probability at a few points, and a sample's against the walk down to its leaf.
+	const uint32_t points = 16;
+	const uint32_t estimateSamples = 1024;
+	double worstSum = 0.0, treeError = 0.0, uniformError = 0.0;
+	uint32_t probabilityMismatches = 0;
+	for (uint32_t p = 0; p < points; p++) {
+		XMVECTOR position, normal;
+		randomPoint(position, normal);
+
+		double sum = 0.0, exact = 0.0;
+		for (uint32_t i = 0; i < lights.size(); i++) {
+			sum += tree.getProbability(position, normal, i);
+			exact += getDiffuseContribution(lights[i], position, normal);
+		}
+		worstSum = std::max(worstSum, std::fabs(sum - 1.0));
+
+		// The same number of samples picked by the tree and picked uniformly, to see what the tree buys.
+		double treeEstimate = 0.0, uniformEstimate = 0.0;
+		for (uint32_t i = 0; i < estimateSamples; i++) {
+			float u = std::min((i + unit(random)) / estimateSamples, 0x1.fffffep-1f);
+			uint32_t light;
+			float probability;
+			tree.sample(position, normal, u, light, probability);
+			probabilityMismatches += probability != tree.getProbability(position, normal, light);
+			treeEstimate += getDiffuseContribution(lights[light], position, normal) / probability;
+
+			uint32_t uniform = std::min(static_cast<uint32_t>(u * lights.size()), static_cast<uint32_t>(lights.size() - 1));
+			uniformEstimate += getDiffuseContribution(lights[uniform], position, normal) * lights.size();
+		}
+		treeEstimate /= estimateSamples;
+		uniformEstimate /= estimateSamples;
+
+		if (exact > 0.0) {
+			treeError += std::fabs(treeEstimate - exact) / exact;
+			uniformError += std::fabs(uniformEstimate - exact) / exact;
+		}
+	}
+
+	bool probabilitiesMatch = worstSum < 1e-3 && probabilityMismatches == 0;
+	errors += !probabilitiesMatch;
+	std::cout << "Probabilities:        sum to 1 within " << std::scientific << std::setprecision(1) << worstSum << std::fixed << std::setprecision(3) << ", "
+		<< probabilityMismatches << " samples off their leaf's\n";
+	std::cout << "Estimate error:       " << std::setprecision(2) << 100.0 * treeError / points << "% from " << estimateSamples << " tree samples, "
+		<< 100.0 * uniformError / points << "% from uniform ones\n" << std::setprecision(3);
+
+	// Throughput, a sample per shading point the way the software renderer asks for them.
+	const uint32_t batches = 256;
+	const uint32_t batchSize = 4096;
+	std::vector<XMFLOAT3> positions(batchSize), normals(batchSize);
+	for (uint32_t i = 0; i < batchSize; i++) {
+		XMVECTOR position, normal;
+		randomPoint(position, normal);
+		XMStoreFloat3(&positions[i], position);
+		XMStoreFloat3(&normals[i], normal);
+	}
+
+	std::vector<uint64_t> checksums(batches);
+	auto sampleBatch = [&](uint32_t batch, uint32_t) {
+		uint64_t checksum = 0;
+		for (uint32_t i = 0; i < batchSize; i++) {
+			uint32_t light;
+			float probability;
+			float u = ((batch * batchSize + i) * 0x9e3779b9u >> 8) * (1.0f / 16777216.0f);
+			tree.sample(XMLoadFloat3(&positions[i]), XMLoadFloat3(&normals[i]), u, light, probability);
+			checksum += light;
+		}
+		checksums[batch] = checksum;
+	};
+
+	JobSystem single(1);
+	auto start = std::chrono::high_resolution_clock::now();
+	single.parallelFor(batches, sampleBatch);
+	double singleMs = elapsedMs(start);
+	auto singleChecksums = checksums;
+
+	start = std::chrono::high_resolution_clock::now();
+	jobs.parallelFor(batches, sampleBatch);
+	double parallelMs = elapsedMs(start);
+
+	bool samplesMatch = singleChecksums == checksums;
+	errors += !samplesMatch;
+	double sampleCount = static_cast<double>(batches) * batchSize;
+	std::cout << std::setprecision(2);
+	std::cout << "Sampling:             " << sampleCount / singleMs / 1000.0 << " Msamples/s on one thread, " << sampleCount / parallelMs / 1000.0 << " on "
+		<< jobs.getNumThreads() << " (" << (parallelMs > 0.0 ? singleMs / parallelMs : 0.0) << "x), threads " << (samplesMatch ? "match" : "differ") << "\n";
+	std::cout << "Failed checks:        " << errors << std::defaultfloat << std::endl;
+
+	return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <DirectXMath.h>
+#include "../CoolRenderingStuff/SoftwareRenderer.h"
+#include "../CoolRenderingStuff/DrawOrder.h"
+
+struct Check;
+
+struct Options {
+	std::string sceneDir = "../CoolRenderingStuff/assets/crytekSponza_fbx/";
+	std::string sceneFile = "sponza.fbx";
+	uint32_t width = 1280;
+	uint32_t height = 720;
+	uint32_t threads = 0;
+	DirectX::XMFLOAT3 cameraPosition = { 0.0f, 1.5f, 0.0f };
+	float yaw = 0.0f;
+	float pitch = 0.0f;
+	float time = 0.0f;
+	uint32_t frames = 1;
+	LightCullingMode culling = LightCullingMode::None;
+	DepthPrepassMode prepass = DepthPrepassMode::Off;
+	std::string out = "reference.png";
+
+	bool occlusion = false;
+	bool avx2 = true;
+	uint32_t sweep = 0;
+
+	bool overdraw = false;
+	bool pack = false;
+
+	uint32_t streamSteps = 0;
+	uint32_t streamBudgetMB = 128;
+
+	uint32_t virtualFrames = 0;
+
+	uint32_t viewCount = 0;
+
+	std::string environment = "../CoolRenderingStuff/assets/sponzaScene/sponzaCubemap/environmentprobe_cm.dds";
+
+	// Empty for ../CoolRenderingStuff/assets/cache/<scene>.ao, the file the app reads.
+	std::string ambientOcclusion;
+	bool bakeAmbientOcclusion = false;
+	uint32_t ambientOcclusionRays = 64;
+
+	uint32_t extraLights = 0;
+	uint32_t lightSamples = 4;
+
+	// The last check flag given, run instead of loading a scene. checkCount is its value, 0 for a flag without one.
+	const Check* check = nullptr;
+	uint32_t checkCount = 0;
+};
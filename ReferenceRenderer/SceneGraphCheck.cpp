@@ -0,0 +1,133 @@
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <cstring>
+
+#include "Checks.h"
+#include "../CoolRenderingStuff/JobSystem.h"
+#include "../CoolRenderingStuff/SceneGraph.h"
+
+using namespace DirectX;
+
+// Up to 8 children a node, breadth first, each one a small turn and step from its parent like a kit built level.
+static SceneGraph generateSceneGraph(uint32_t nodes, std::mt19937& random) {
+	std::uniform_int_distribution<uint32_t> children(0, 8);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+	auto randomLocal = [&]() {
+		XMFLOAT4X4 local;
+		XMStoreFloat4x4(&local, XMMatrixMultiply(XMMatrixRotationRollPitchYaw(0.0f, unit(random) * XM_PI, 0.0f), XMMatrixTranslation(unit(random), 0.0f, unit(random))));
+		return local;
+	};
+
+	SceneGraph graph;
+	graph.addNode("root", SceneGraph::NO_NODE, randomLocal());
+
+	for (uint32_t parent = 0; graph.size() < nodes; parent++) {
+		// A childless level can't happen, the last parent of one always gets a child.
+		uint32_t count = std::max(children(random), parent + 1 == graph.size() ? 1u : 0u);
+		for (uint32_t i = 0; i < count && graph.size() < nodes; i++) {
+			graph.addNode("node" + std::to_string(graph.size()), parent, randomLocal());
+		}
+	}
+
+	return graph;
+}
+
+// Worst difference between the graph's world matrices and ones computed the slow way, a node at a time.
+static float checkSceneGraph(const SceneGraph& graph) {
+	std::vector<XMFLOAT4X4> worlds(graph.size());
+	float worst = 0.0f;
+
+	for (uint32_t i = 0; i < graph.size(); i++) {
+		XMMATRIX world = XMLoadFloat4x4(&graph.getLocal(i));
+		if (graph.getParent(i) != SceneGraph::NO_NODE)
+			world = XMMatrixMultiply(world, XMLoadFloat4x4(&worlds[graph.getParent(i)]));
+		XMStoreFloat4x4(&worlds[i], world);
+
+		for (uint32_t e = 0; e < 16; e++) {
+			worst = std::max(worst, std::fabs(worlds[i].m[e / 4][e % 4] - graph.getWorld(i).m[e / 4][e % 4]));
+		}
+	}
+
+	return worst;
+}
+
+// The same moves on one graph updated serially and a copy updated on the jobs: the whole graph, a scattered 1% of it,
+// one subtree near the bottom, and nothing at all.
+int benchmarkSceneGraph(const Options& options, uint32_t nodes) {
+	JobSystem jobs(options.threads);
+	std::mt19937 random(1234);
+
+	auto start = std::chrono::high_resolution_clock::now();
+	SceneGraph serial = generateSceneGraph(nodes, random);
+	double buildMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	serial.update();
+	SceneGraph parallel = serial;
+
+	std::cout << "\nThreads:              " << jobs.getNumThreads() << "\n";
+	std::cout << "Nodes:                " << serial.size() << " in " << serial.getLevelCount() << " levels\n";
+	std::cout << "Build ms:             " << std::fixed << std::setprecision(3) << buildMs << std::defaultfloat << "\n";
+
+	std::uniform_int_distribution<uint32_t> anyNode(0, serial.size() - 1);
+	uint32_t deepNode = serial.getLevelStart(serial.getLevelCount() > 2 ? serial.getLevelCount() - 3 : 0);
+	const uint32_t iterations = std::max(20u, options.frames);
+
+	struct Scenario {
+		const char* name;
+		std::function<void(std::vector<uint32_t>&)> pick;
+	};
+
+	Scenario scenarios[] = {
+		{ "Everything", [&](std::vector<uint32_t>& out) { out.push_back(0); } },
+		{ "Scattered 1%", [&](std::vector<uint32_t>& out) { for (uint32_t i = 0; i < serial.size() / 100; i++) out.push_back(anyNode(random)); } },
+		{ "One deep subtree", [&](std::vector<uint32_t>& out) { out.push_back(deepNode); } },
+		{ "Nothing", [&](std::vector<uint32_t>&) {} },
+	};
+
+	int errors = 0;
+	std::vector<uint32_t> moved;
+
+	for (auto& scenario : scenarios) {
+		double serialMs = 0.0;
+		double parallelMs = 0.0;
+		uint64_t updated = 0;
+
+		for (uint32_t i = 0; i < iterations; i++) {
+			moved.clear();
+			scenario.pick(moved);
+
+			for (uint32_t node : moved) {
+				XMFLOAT4X4 local;
+				XMStoreFloat4x4(&local, XMMatrixMultiply(XMLoadFloat4x4(&serial.getLocal(node)), XMMatrixRotationY(0.01f)));
+				serial.setLocal(node, local);
+				parallel.setLocal(node, local);
+			}
+
+			updated += serial.update();
+			serialMs += serial.getStats().ms;
+			parallel.update(&jobs);
+			parallelMs += parallel.getStats().ms;
+
+			if (serial.getStats().updated != parallel.getStats().updated ||
+				std::memcmp(serial.getWorlds().data(), parallel.getWorlds().data(), sizeof(XMFLOAT4X4) * serial.size()) != 0)
+				errors++;
+		}
+
+		std::cout << std::fixed << std::setprecision(3);
+		std::cout << scenario.name << ":" << std::string(21 - std::strlen(scenario.name), ' ') << updated / iterations << " nodes, "
+			<< serialMs / iterations << " ms serial, " << parallelMs / iterations << " ms parallel (" << std::setprecision(1)
+			<< (parallelMs > 0.0 ? serialMs / parallelMs : 0.0) << "x)" << std::defaultfloat << "\n";
+	}
+
+	float worst = checkSceneGraph(parallel);
+	std::cout << "Mismatched updates:   " << errors << "\n";
+	std::cout << "Max world error:      " << worst << std::endl;
+
+	return errors == 0 && worst < 1e-3f ? 0 : 1;
+}
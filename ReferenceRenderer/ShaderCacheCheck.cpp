@@ -0,0 +1,164 @@
+#include <vector>
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <filesystem>
+#include <chrono>
+#include <algorithm>
+#include <unordered_set>
+
+#include "Checks.h"
+#include "../CoolRenderingStuff/ShaderCache.h"
+
+using namespace DirectX;
+
+static void writeShaderFile(const std::filesystem::path& path, const std::string& text) {
+	std::ofstream(path, std::ios::binary | std::ios::trunc) << text;
+	// Pushed a second on each write so the edit shows up however coarse the file system's times are.
+	static auto time = std::filesystem::file_time_type::clock::now();
+	time += std::chrono::seconds(1);
+	std::filesystem::last_write_time(path, time);
+}
+
+// The shader cache on generated sources in a temporary directory, with a stub compiler that counts its calls and
+// returns the key as the bytecode. Checks that unchanged keys come from memory without hashing their files again,
+// that editing an include recompiles and touching a file without changing it doesn't, that commented out includes
+// aren't dependencies, that the entry point, target and every define split the key, and that a second cache over the
+// same directory loads everything from disk without compiling.
+int checkShaderCache(const Options&, uint32_t) {
+	namespace fs = std::filesystem;
+
+	const uint32_t LOOKUPS = 1000;
+	int errors = 0;
+	auto check = [&](bool passed, const char* what) {
+		if (!passed) {
+			std::cout << "Failed:               " << what << "\n";
+			errors++;
+		}
+	};
+
+	fs::path directory = fs::temp_directory_path() / "ReferenceRendererShaderCache";
+	fs::remove_all(directory);
+	fs::create_directories(directory / "cache");
+
+	writeShaderFile(directory / "common.hlsli", "float4 Shade() { return 1.0; }\n");
+	writeShaderFile(directory / "unused.hlsli", "float4 Unused() { return 0.0; }\n");
+	writeShaderFile(directory / "pixel.hlsl",
+		"#include \"common.hlsli\"\n"
+		"// #include \"unused.hlsli\"\n"
+		"/* an old version\n"
+		"#include \"unused.hlsli\"\n"
+		"*/\n"
+		"float4 main() : SV_TARGET { return Shade(); }\n");
+
+	uint32_t compiles = 0;
+	auto stubCompile = [&](const ShaderKey& key, std::vector<char>& bytecode, std::string&) {
+		compiles++;
+		std::string text = key.path + "|" + key.entryPoint + "|" + key.target;
+		for (auto& define : key.defines) {
+			text += "|" + define.name + "=" + define.value;
+		}
+		bytecode.assign(text.begin(), text.end());
+		return true;
+	};
+
+	std::string cacheDirectory = (directory / "cache").generic_string();
+	ShaderKey key = { (directory / "pixel.hlsl").generic_string(), "main", "ps_5_0", getMaterialFeatureDefines(MATERIAL_FEATURE_DIFFUSE) };
+
+	auto includes = scanShaderIncludes(key.path);
+	auto dependencies = collectShaderDependencies(key.path);
+	check(includes.size() == 1 && includes[0] == (directory / "common.hlsli").lexically_normal().generic_string(), "only the uncommented include is scanned");
+	check(dependencies.size() == 2, "dependencies are the source and its one include");
+
+	uint64_t firstHash = 0, editedHash = 0;
+	std::vector<char> firstBytecode;
+	double hashMs = 0.0, lookupMs = 0.0;
+	{
+		ShaderCache cache(cacheDirectory, stubCompile);
+
+		firstBytecode = cache.getOrCompile(key);
+		firstHash = hashShaderKey(key);
+		check(compiles == 1 && !firstBytecode.empty(), "the first lookup compiles");
+
+		// Unchanged, so from memory and without hashing the files again.
+		auto start = std::chrono::high_resolution_clock::now();
+		for (uint32_t i = 0; i < LOOKUPS; i++) {
+			cache.getOrCompile(key);
+		}
+		lookupMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		start = std::chrono::high_resolution_clock::now();
+		for (uint32_t i = 0; i < LOOKUPS; i++) {
+			hashShaderKey(key);
+		}
+		hashMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		auto stats = cache.getStats();
+		check(compiles == 1 && stats.memoryHits == LOOKUPS, "an unchanged key is a memory hit");
+		check(stats.keyHashes == 1, "an unchanged key isn't hashed again");
+
+		// The commented out include isn't a dependency, editing it changes nothing.
+		writeShaderFile(directory / "unused.hlsli", "float4 Unused() { return 2.0; }\n");
+		cache.getOrCompile(key);
+		check(compiles == 1 && cache.getStats().keyHashes == 1, "editing a commented out include doesn't rehash or recompile");
+
+		// Touched but the same, hashed again to find that out and still a hit.
+		writeShaderFile(directory / "common.hlsli", "float4 Shade() { return 1.0; }\n");
+		cache.getOrCompile(key);
+		check(compiles == 1 && cache.getStats().keyHashes == 2, "touching an include rehashes without recompiling");
+
+		writeShaderFile(directory / "common.hlsli", "float4 Shade() { return 0.5; }\n");
+		cache.getOrCompile(key);
+		editedHash = hashShaderKey(key);
+		check(compiles == 2 && editedHash != firstHash, "editing an include recompiles");
+
+		// Every part of the key on its own, each a hash of its own and a compile.
+		std::vector<ShaderKey> variants;
+		variants.push_back(key);
+		variants.back().entryPoint = "other";
+		variants.push_back(key);
+		variants.back().target = "ps_5_1";
+		for (uint32_t feature : { MATERIAL_FEATURE_NORMAL, MATERIAL_FEATURE_ALPHA_CUTOUT, MATERIAL_FEATURE_SPECULAR }) {
+			variants.push_back(key);
+			variants.back().defines = getMaterialFeatureDefines(MATERIAL_FEATURE_DIFFUSE | feature);
+		}
+		variants.push_back(key);
+		variants.back().defines.push_back({ "EXTRA", "1" });
+		// Same defines in another order, the preprocessor could see them differently so it's a different key.
+		variants.push_back(key);
+		std::reverse(variants.back().defines.begin(), variants.back().defines.end());
+
+		std::unordered_set<uint64_t> hashes = { editedHash };
+		for (auto& variant : variants) {
+			hashes.insert(hashShaderKey(variant));
+			cache.getOrCompile(variant);
+		}
+		check(hashes.size() == variants.size() + 1, "entry point, target and defines all change the hash");
+		check(compiles == 2 + variants.size(), "every variant compiles once");
+	}
+
+	// A new cache over the same directory, with a compiler that fails, has to find everything on disk.
+	uint32_t compilesBefore = compiles;
+	ShaderCache reloaded(cacheDirectory, [&](const ShaderKey&, std::vector<char>&, std::string& errors) {
+		compiles++;
+		errors = "not expected to compile";
+		return false;
+	});
+	auto fromDisk = reloaded.getOrCompile(key);
+	check(compiles == compilesBefore && reloaded.getStats().diskHits == 1, "a second cache loads from disk");
+	check(std::string(fromDisk.begin(), fromDisk.end()) == std::string(firstBytecode.begin(), firstBytecode.end()), "the disk copy matches what was compiled");
+
+	// Back to the first source, whose bytecode was written out before the edit.
+	writeShaderFile(directory / "common.hlsli", "float4 Shade() { return 1.0; }\n");
+	check(hashShaderKey(key) == firstHash && !reloaded.getOrCompile(key).empty() && compiles == compilesBefore, "reverting an edit finds the old entry");
+
+	std::error_code error;
+	fs::remove_all(directory, error);
+
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << "Shader cache:         " << compiles << " stub compiles, " << reloaded.getStats().diskHits << " loaded from disk\n";
+	std::cout << "Hit:                  " << lookupMs * 1000.0 / LOOKUPS << " us, hashing the files every time " << hashMs * 1000.0 / LOOKUPS << " us\n";
+	std::cout << "Failed checks:        " << errors << std::defaultfloat << std::endl;
+	return errors == 0 ? 0 : 1;
+}
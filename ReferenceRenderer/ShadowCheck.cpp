@@ -0,0 +1,244 @@
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "Checks.h"
+#include "../CoolRenderingStuff/Scene.h"
+#include "../CoolRenderingStuff/ShadowAtlas.h"
+#include "../CoolRenderingStuff/ShadowCache.h"
+#include "../CoolRenderingStuff/ViewCulling.h"
+
+using namespace DirectX;
+
+// Allocates and frees random tile sizes against a grid of who owns every minimum sized cell, then walks a camera through
+// the app's lights while boxes standing in for casters move about. Every frame checks that no two lights' tiles overlap,
+// that no face the cache calls up to date was drawn before its light or a caster in it moved, and that the budget
+// held, then reports how many redraws the cache saved over drawing every face every frame.
+int benchmarkShadows(const Options& options, uint32_t frames) {
+	const uint32_t NO_OWNER = ~0u;
+	const uint32_t CASTERS = 400;
+
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> chance(0.0f, 1.0f);
+	int errors = 0;
+
+	ShadowSettings settings;
+	uint32_t cells = settings.atlasSize / settings.minTileSize;
+	std::vector<uint32_t> owner(cells * cells, NO_OWNER);
+
+	// Marks the tile's cells as owned by value, counting any that weren't expected's or lie outside the atlas.
+	auto claim = [&](const ShadowTile& tile, uint32_t expected, uint32_t value) {
+		uint32_t wrong = 0;
+		if (tile.x % tile.size || tile.y % tile.size || tile.x + tile.size > settings.atlasSize || tile.y + tile.size > settings.atlasSize)
+			return 1u;
+
+		for (uint32_t y = tile.y / settings.minTileSize; y < (tile.y + tile.size) / settings.minTileSize; y++) {
+			for (uint32_t x = tile.x / settings.minTileSize; x < (tile.x + tile.size) / settings.minTileSize; x++) {
+				wrong += owner[y * cells + x] != expected;
+				owner[y * cells + x] = value;
+			}
+		}
+		return wrong;
+	};
+
+	// The allocator on its own, biased towards small tiles the way distant lights are.
+	ShadowAtlas atlas(settings.atlasSize, settings.minTileSize);
+	std::vector<ShadowTile> live;
+	uint32_t operations = std::max(20000u, frames * 20);
+	uint32_t allocatorErrors = 0, refusals = 0, wrongRefusals = 0;
+	uint64_t usedTexels = 0;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (uint32_t step = 0; step < operations; step++) {
+		if (live.empty() || chance(random) < 0.55f) {
+			uint32_t size = settings.minTileSize << std::min(static_cast<uint32_t>(std::max(-std::log2(chance(random) + 1e-3f), 0.0f)), 4u);
+			ShadowTile tile;
+			if (!atlas.allocate(size, tile)) {
+				// A buddy allocator only refuses when no free node is big enough.
+				refusals++;
+				wrongRefusals += atlas.getLargestFreeTile() >= size;
+				continue;
+			}
+
+			allocatorErrors += claim(tile, NO_OWNER, static_cast<uint32_t>(live.size())) != 0 || tile.size != size;
+			usedTexels += uint64_t(size) * size;
+			live.push_back(tile);
+		}
+		else {
+			size_t slot = random() % live.size();
+			auto tile = live[slot];
+			atlas.free(tile);
+			claim(tile, static_cast<uint32_t>(slot), NO_OWNER);
+			usedTexels -= uint64_t(tile.size) * tile.size;
+
+			// The last tile takes the freed slot, its cells are renamed to match.
+			if (slot != live.size() - 1) {
+				live[slot] = live.back();
+				claim(live[slot], static_cast<uint32_t>(live.size() - 1), static_cast<uint32_t>(slot));
+			}
+			live.pop_back();
+		}
+
+		allocatorErrors += atlas.getUsedTexels() != usedTexels || atlas.getTileCount() != live.size();
+	}
+	double allocatorMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	size_t peakLive = live.size();
+	for (auto& tile : live) {
+		atlas.free(tile);
+	}
+	bool merged = atlas.getLargestFreeTile() == settings.atlasSize && atlas.getUsedTexels() == 0;
+	errors += allocatorErrors + wrongRefusals + !merged;
+
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << "\nAtlas:                " << settings.atlasSize << ", tiles " << settings.minTileSize << " to " << settings.maxTileSize << "\n";
+	std::cout << "Allocator:            " << operations << " operations in " << allocatorMs << " ms, " << allocatorErrors << " overlaps, "
+		<< refusals << " refused (" << wrongRefusals << " with room), " << (merged ? "merged" : "didn't merge") << " back from " << peakLive << " tiles\n";
+
+	// The app's lights and any extra, one casting box for every few.
+	auto lights = createSceneLights();
+	if (options.extraLights) {
+		auto extra = generateLights(options.extraLights, random);
+		lights.insert(lights.end(), extra.begin(), extra.end());
+	}
+
+	std::uniform_real_distribution<float> x(-15.0f, 15.0f), y(0.0f, 10.0f), z(-10.0f, 10.0f), extent(0.1f, 1.0f), nudge(-0.5f, 0.5f);
+	std::vector<MeshBounds> casters(CASTERS);
+	for (auto& caster : casters) {
+		XMFLOAT3 centre = { x(random), y(random), z(random) };
+		float ex = extent(random), ey = extent(random), ez = extent(random);
+		caster = { { centre.x - ex, centre.y - ey, centre.z - ez }, { centre.x + ex, centre.y + ey, centre.z + ez } };
+	}
+
+	struct CasterMove {
+		uint32_t frame;
+		MeshBounds bounds;
+	};
+	std::vector<CasterMove> moves;
+
+	// What each face was last drawn with, as the renders said.
+	struct DrawnFace {
+		uint32_t frame = 0;
+		XMFLOAT3 origin;
+		float range = 0.0f;
+	};
+	std::vector<DrawnFace> drawn(lights.size() * CUBE_FACE_COUNT);
+
+	// The truth the cache is checked against: the face's own frustum clipped to its range, the box shrunk a hair so
+	// one that only grazes a plane isn't held against it.
+	auto faceTouches = [&](const DrawnFace& drawnFace, uint32_t face, const MeshBounds& bounds) {
+		auto frustum = ViewFrustum::fromViewProj(getShadowFaceViewProj(drawnFace.origin, face, settings.nearPlane, drawnFace.range));
+		float cx = (bounds.min.x + bounds.max.x) * 0.5f, cy = (bounds.min.y + bounds.max.y) * 0.5f, cz = (bounds.min.z + bounds.max.z) * 0.5f;
+		float ex = (bounds.max.x - bounds.min.x) * 0.5f - 1e-4f, ey = (bounds.max.y - bounds.min.y) * 0.5f - 1e-4f, ez = (bounds.max.z - bounds.min.z) * 0.5f - 1e-4f;
+		float dx = std::max(std::fabs(cx - drawnFace.origin.x) - ex, 0.0f), dy = std::max(std::fabs(cy - drawnFace.origin.y) - ey, 0.0f), dz = std::max(std::fabs(cz - drawnFace.origin.z) - ez, 0.0f);
+		return dx * dx + dy * dy + dz * dz < drawnFace.range * drawnFace.range && frustum.intersects(cx, cy, cz, ex, ey, ez, 0.0f);
+	};
+
+	ShadowCache cache(settings);
+	float projScale = 1.0f / std::tan(CAMERA_FOV_Y * 0.5f);
+	std::vector<uint8_t> visible(lights.size());
+	std::vector<float> screenRadius(lights.size());
+
+	uint64_t facesRendered = 0, facesAvoided = 0, facesDeferred = 0, reallocations = 0, evictions = 0, unallocated = 0;
+	uint32_t overlaps = 0, staleFaces = 0, budgetOverruns = 0, maxWait = 0, lightJumps = 0;
+	double updateMs = 0.0, worstUpdateMs = 0.0;
+
+	for (uint32_t frame = 1; frame <= frames; frame++) {
+		// Along the nave and back, like --stream.
+		float t = static_cast<float>(frame) / frames * 2.0f;
+		bool returning = t > 1.0f;
+		XMFLOAT3 eye = { -12.0f + 24.0f * (returning ? 2.0f - t : t), options.cameraPosition.y, 0.0f };
+		auto uniforms = calculatePerFrameUniforms(eye, 0.0f, returning ? -XM_PIDIV2 : XM_PIDIV2, options.width, options.height);
+		auto frustum = ViewFrustum::fromViewProj(uniforms.viewProj);
+
+		// The first light circles every frame, now and then another jumps somewhere close.
+		animateSceneLights(lights, frame / 60.0f);
+		if (frame % 30 == 0) {
+			auto& light = lights[1 + random() % (lights.size() - 1)];
+			light.position = { light.position.x + nudge(random), light.position.y, light.position.z + nudge(random) };
+			lightJumps++;
+		}
+
+		// Half the frames a box moves, its old and new place both invalidated.
+		if (chance(random) < 0.5f) {
+			auto& caster = casters[random() % CASTERS];
+			cache.invalidateCasters(caster);
+			moves.push_back({ frame, caster });
+
+			XMFLOAT3 offset = { nudge(random), nudge(random), nudge(random) };
+			caster = { { caster.min.x + offset.x, caster.min.y + offset.y, caster.min.z + offset.z }, { caster.max.x + offset.x, caster.max.y + offset.y, caster.max.z + offset.z } };
+			cache.invalidateCasters(caster);
+			moves.push_back({ frame, caster });
+		}
+
+		for (uint32_t i = 0; i < lights.size(); i++) {
+			float range = lights[i].radius * settings.rangeScale;
+			visible[i] = frustum.intersects(lights[i].position.x, lights[i].position.y, lights[i].position.z, 0.0f, 0.0f, 0.0f, range);
+			screenRadius[i] = visible[i] ? getShadowScreenRadius(lights[i], settings.rangeScale, eye, projScale, static_cast<float>(options.height)) : 0.0f;
+		}
+
+		auto& renders = cache.update(lights, visible, screenRadius);
+		auto& stats = cache.getStats();
+
+		for (auto& render : renders) {
+			drawn[render.light * CUBE_FACE_COUNT + render.face] = { frame, lights[render.light].position, lights[render.light].radius * settings.rangeScale };
+		}
+
+		// Going over is only allowed for the first light of a frame.
+		if (stats.facesRendered > settings.faceBudget && renders.front().light != renders.back().light)
+			budgetOverruns++;
+
+		std::fill(owner.begin(), owner.end(), NO_OWNER);
+		for (uint32_t i = 0; i < lights.size(); i++) {
+			for (uint32_t face = 0; face < CUBE_FACE_COUNT; face++) {
+				ShadowTile tile;
+				if (cache.getTile(i, face, tile))
+					overlaps += claim(tile, NO_OWNER, i * CUBE_FACE_COUNT + face);
+
+				if (!cache.hasShadow(i) || cache.isFaceDirty(i, face))
+					continue;
+
+				auto& drawnFace = drawn[i * CUBE_FACE_COUNT + face];
+				bool stale = drawnFace.frame == 0 || memcmp(&drawnFace.origin, &lights[i].position, sizeof(XMFLOAT3)) != 0;
+				for (size_t m = moves.size(); m-- > 0 && moves[m].frame > drawnFace.frame && !stale;) {
+					stale = faceTouches(drawnFace, face, moves[m].bounds);
+				}
+				staleFaces += stale;
+			}
+		}
+
+		facesRendered += stats.facesRendered;
+		facesAvoided += stats.facesAvoided;
+		facesDeferred += stats.facesDeferred;
+		reallocations += stats.reallocations;
+		evictions += stats.evictions;
+		unallocated += stats.unallocated;
+		maxWait = std::max(maxWait, stats.maxWaitFrames);
+		updateMs += stats.updateMs;
+		worstUpdateMs = std::max(worstUpdateMs, stats.updateMs);
+	}
+	errors += overlaps + staleFaces + budgetOverruns;
+
+	double everyFace = static_cast<double>(frames) * lights.size() * CUBE_FACE_COUNT;
+	double shadowedFaces = static_cast<double>(facesRendered + facesAvoided);
+	std::cout << "Lights:               " << lights.size() << ", " << CASTERS << " casters, " << frames << " frames, " << lightJumps << " lights jumped, "
+		<< moves.size() / 2 << " casters moved\n";
+	std::cout << "Update ms:            " << updateMs / std::max(frames, 1u) << ", worst " << worstUpdateMs << "\n";
+	std::cout << std::setprecision(2);
+	std::cout << "Faces drawn:          " << facesRendered << ", " << static_cast<double>(facesRendered) / std::max(frames, 1u) << " per frame, budget " << settings.faceBudget << "\n";
+	std::cout << "Redraws avoided:      " << (shadowedFaces > 0.0 ? 100.0 * facesAvoided / shadowedFaces : 0.0) << "% of every shadowed face every frame, "
+		<< (everyFace > 0.0 ? 100.0 * (1.0 - facesRendered / everyFace) : 0.0) << "% of every light's\n";
+	std::cout << "Deferred:             " << facesDeferred << " face frames, longest visible wait " << maxWait << " frames\n";
+	std::cout << "Tiles:                " << reallocations << " resized, " << evictions << " evicted, " << unallocated << " light frames without room, "
+		<< 100.0f * cache.getStats().atlasUsage << "% used at the end\n";
+	std::cout << "Atlas overlaps:       " << overlaps << "\n";
+	std::cout << "Stale faces:          " << staleFaces << " up to date faces drawn before their light or a caster moved\n";
+	std::cout << "Budget overruns:      " << budgetOverruns << "\n";
+	std::cout << "Failed checks:        " << errors << std::defaultfloat << std::endl;
+
+	return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,233 @@
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <atomic>
+
+#include "Checks.h"
+#include "../CoolRenderingStuff/TripleBuffer.h"
+
+using namespace DirectX;
+
+// Stands in for the app's FrameSnapshot: each view's constants, the visible instances and the lights. Everything in it is
+// stamped from its tick's sequence, so a read that caught the writer part way through a slot shows up as a mix of two.
+struct SnapshotPayload {
+	uint64_t sequence = 0;
+	std::chrono::steady_clock::time_point published;
+	std::vector<PerFrameUniforms> views;
+	std::vector<uint32_t> visible;
+	std::vector<Light> lights;
+};
+
+// The visible list's length changes from tick to tick, so slots grow and shrink the way the app's do.
+static void fillSnapshot(SnapshotPayload& snapshot, uint64_t sequence, uint32_t viewCount, uint32_t instanceCount, uint32_t lightCount) {
+	float stamp = static_cast<float>(sequence % 65536);
+
+	snapshot.views.resize(viewCount);
+	for (auto& uniforms : snapshot.views) {
+		uniforms.frameIndex = static_cast<uint32_t>(sequence);
+		uniforms.eyePos = { stamp, stamp, stamp };
+		uniforms.viewProj = XMMatrixTranslation(stamp, 0.0f, 0.0f);
+	}
+
+	snapshot.visible.resize(instanceCount - sequence % (instanceCount / 2));
+	for (size_t i = 0; i < snapshot.visible.size(); i++) {
+		snapshot.visible[i] = static_cast<uint32_t>(sequence * 2654435761u + i);
+	}
+
+	snapshot.lights.resize(lightCount);
+	for (uint32_t i = 0; i < lightCount; i++) {
+		snapshot.lights[i].position = { stamp, static_cast<float>(i), stamp };
+		snapshot.lights[i].radius = stamp;
+	}
+
+	snapshot.sequence = sequence;
+}
+
+static bool checkSnapshot(const SnapshotPayload& snapshot, uint32_t viewCount, uint32_t instanceCount, uint32_t lightCount) {
+	uint64_t sequence = snapshot.sequence;
+	float stamp = static_cast<float>(sequence % 65536);
+
+	if (snapshot.views.size() != viewCount || snapshot.visible.size() != instanceCount - sequence % (instanceCount / 2) || snapshot.lights.size() != lightCount)
+		return false;
+
+	for (auto& uniforms : snapshot.views) {
+		XMFLOAT4X4 viewProj;
+		XMStoreFloat4x4(&viewProj, uniforms.viewProj);
+		if (uniforms.frameIndex != static_cast<uint32_t>(sequence) || uniforms.eyePos.x != stamp || uniforms.eyePos.z != stamp || viewProj._41 != stamp)
+			return false;
+	}
+
+	for (size_t i = 0; i < snapshot.visible.size(); i++) {
+		if (snapshot.visible[i] != static_cast<uint32_t>(sequence * 2654435761u + i))
+			return false;
+	}
+
+	for (uint32_t i = 0; i < lightCount; i++) {
+		auto& light = snapshot.lights[i];
+		if (light.position.x != stamp || light.position.y != static_cast<float>(i) || light.position.z != stamp || light.radius != stamp)
+			return false;
+	}
+
+	return true;
+}
+
+// The app's simulation to render hand over, twice. First flat out on both threads, every snapshot picked up checked
+// for a tick torn in two and for going backwards. Then paced like the app, the simulation ticking at a fixed rate with
+// every so often a tick that runs long, and the render thread drawing at its own rate: how old a tick is when it's
+// picked up, and whether picking one up ever waited on a long tick the way a lock held over the tick would.
+// Frame times are only reported, sleeps on a loaded machine overshoot by more than a long tick.
+int benchmarkSnapshots(const Options&, uint32_t frames) {
+	const uint32_t VIEWS = 2;
+	const uint32_t INSTANCES = 4096;
+	const uint32_t LIGHTS = 64;
+	const auto TICK = std::chrono::microseconds(2000);
+	const auto FRAME = std::chrono::microseconds(4000);
+	// Every SPIKE_INTERVAL ticks one takes SPIKE longer.
+	const uint32_t SPIKE_INTERVAL = 40;
+	const auto SPIKE = std::chrono::milliseconds(25);
+
+	using Clock = std::chrono::steady_clock;
+	auto toMs = [](Clock::duration duration) { return std::chrono::duration<double, std::milli>(duration).count(); };
+
+	uint64_t errors = 0;
+
+	// Flat out.
+	TripleBuffer<SnapshotPayload> stressBuffer;
+	std::atomic<bool> stressDone{ false };
+	uint64_t stressPublished = 0;
+
+	std::thread stressWriter([&]() {
+		uint64_t sequence = 0;
+		while (!stressDone) {
+			fillSnapshot(stressBuffer.back(), ++sequence, VIEWS, INSTANCES, LIGHTS);
+			stressBuffer.publish();
+		}
+		stressPublished = sequence;
+	});
+
+	uint64_t torn = 0, backwards = 0, acquired = 0, empty = 0, lastSequence = 0;
+	auto stressStart = Clock::now();
+	while (acquired < frames) {
+		if (!stressBuffer.acquire()) {
+			// Nothing new, what's held must still be what it was. Yields so the writer gets a go on a single core.
+			empty++;
+			if (stressBuffer.front().sequence != lastSequence)
+				backwards++;
+			std::this_thread::yield();
+			continue;
+		}
+
+		auto& snapshot = stressBuffer.front();
+		torn += !checkSnapshot(snapshot, VIEWS, INSTANCES, LIGHTS);
+		backwards += snapshot.sequence <= lastSequence;
+		lastSequence = snapshot.sequence;
+		acquired++;
+	}
+	double stressMs = toMs(Clock::now() - stressStart);
+	stressDone = true;
+	stressWriter.join();
+	errors += torn + backwards;
+
+	// Paced. The first tick is in before the render thread starts, as in the app.
+	TripleBuffer<SnapshotPayload> buffer;
+	fillSnapshot(buffer.back(), 1, VIEWS, INSTANCES, LIGHTS);
+	buffer.back().published = Clock::now();
+	buffer.publish();
+
+	std::atomic<bool> done{ false };
+	uint64_t ticks = 1;
+	Clock::duration longestTick{};
+
+	std::thread simulation([&]() {
+		auto next = Clock::now();
+		uint64_t sequence = 1;
+		while (!done) {
+			auto start = Clock::now();
+			fillSnapshot(buffer.back(), ++sequence, VIEWS, INSTANCES, LIGHTS);
+			if (sequence % SPIKE_INTERVAL == 0)
+				std::this_thread::sleep_for(SPIKE);
+			buffer.back().published = Clock::now();
+			buffer.publish();
+			longestTick = std::max(longestTick, Clock::now() - start);
+
+			next += TICK;
+			auto now = Clock::now();
+			if (next < now)
+				next = now;
+			std::this_thread::sleep_until(next);
+		}
+		ticks = sequence;
+	});
+
+	uint64_t drawn = 0, repeated = 0, skipped = 0, pacedTorn = 0, pacedBackwards = 0;
+	lastSequence = 0;
+	double latencyTotal = 0.0, latencyMax = 0.0, ageTotal = 0.0, ageMax = 0.0;
+	Clock::duration longestFrame{}, longestAcquire{};
+	auto nextFrame = Clock::now();
+	auto lastFrame = nextFrame;
+	for (uint32_t frame = 0; frame < frames; frame++) {
+		auto acquireStart = Clock::now();
+		bool fresh = buffer.acquire();
+		auto acquireEnd = Clock::now();
+		longestAcquire = std::max(longestAcquire, acquireEnd - acquireStart);
+
+		auto& snapshot = buffer.front();
+		if (fresh) {
+			pacedTorn += !checkSnapshot(snapshot, VIEWS, INSTANCES, LIGHTS);
+			pacedBackwards += snapshot.sequence <= lastSequence;
+			if (lastSequence && snapshot.sequence > lastSequence + 1)
+				skipped += snapshot.sequence - lastSequence - 1;
+			lastSequence = snapshot.sequence;
+
+			double latency = toMs(acquireEnd - snapshot.published);
+			latencyTotal += latency;
+			latencyMax = std::max(latencyMax, latency);
+			drawn++;
+		}
+		else repeated++;
+
+		// Drawing it, how far behind the tick it draws is.
+		double age = toMs(acquireEnd - snapshot.published);
+		ageTotal += age;
+		ageMax = std::max(ageMax, age);
+
+		nextFrame += FRAME;
+		auto now = Clock::now();
+		if (nextFrame < now)
+			nextFrame = now;
+		std::this_thread::sleep_until(nextFrame);
+
+		auto end = Clock::now();
+		if (frame > 0)
+			longestFrame = std::max(longestFrame, end - lastFrame);
+		lastFrame = end;
+	}
+	done = true;
+	simulation.join();
+	errors += pacedTorn + pacedBackwards;
+
+	// In lockstep a frame waits out its tick, the long ones included. Decoupled, picking one up never waits at all.
+	bool heldUp = longestAcquire >= SPIKE / 2;
+	errors += heldUp;
+
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << "Snapshot:             " << VIEWS << " views, " << INSTANCES << " instances at most, " << LIGHTS << " lights\n";
+	std::cout << "Flat out:             " << acquired << " picked up of " << stressPublished << " published in " << stressMs << " ms, "
+		<< empty << " empty acquires\n";
+	std::cout << "Torn:                 " << torn + pacedTorn << "\n";
+	std::cout << "Out of order:         " << backwards + pacedBackwards << "\n";
+	std::cout << "Paced:                " << frames << " frames every " << toMs(FRAME) << " ms, " << ticks << " ticks every " << toMs(TICK) << " ms, one in "
+		<< SPIKE_INTERVAL << " " << toMs(SPIKE) << " ms longer\n";
+	std::cout << "Ticks:                " << drawn << " drawn, " << skipped << " skipped, " << repeated << " frames drew one again\n";
+	std::cout << "Publish to pick up:   " << latencyTotal / std::max<uint64_t>(drawn, 1) << " ms on average, " << latencyMax << " ms at most\n";
+	std::cout << "Age when drawn:       " << ageTotal / std::max(frames, 1u) << " ms on average, " << ageMax << " ms at most\n";
+	std::cout << "Longest tick:         " << toMs(longestTick) << " ms\n";
+	std::cout << "Longest frame:        " << toMs(longestFrame) << " ms\n";
+	std::cout << "Longest acquire:      " << std::chrono::duration<double, std::micro>(longestAcquire).count() << " us" << (heldUp ? ", waited on a tick" : "") << "\n";
+	std::cout << "Failed checks:        " << errors << std::defaultfloat << std::endl;
+
+	return errors == 0 ? 0 : 1;
+}
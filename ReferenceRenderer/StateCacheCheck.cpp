@@ -0,0 +1,225 @@
+#include <vector>
+#include <iostream>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+
+#include "Checks.h"
+#include "../CoolRenderingStuff/StateDesc.h"
+
+using namespace DirectX;
+
+// Every desc is built twice, over memory filled with different bytes, so any padding hashed or compared shows up as a
+// mismatch between copies that are the same field for field.
+template <typename Desc>
+static uint32_t checkStateDescFields(const char* name, Desc (*make)(uint8_t fill), const std::vector<std::function<void(Desc&)>>& changes) {
+	Desc zeroed = make(0x00), filled = make(0xcd);
+	uint64_t hash = hashStateDesc(zeroed);
+
+	uint32_t failed = 0;
+	if (hashStateDesc(filled) != hash || !stateDescEqual(zeroed, filled))
+		failed++;
+
+	bool padded = std::memcmp(&zeroed, &filled, sizeof(Desc)) != 0;
+
+	// Each change alone has to move the hash and break equality.
+	uint32_t missed = 0;
+	for (auto& change : changes) {
+		Desc changed = make(0x00);
+		change(changed);
+		if (hashStateDesc(changed) == hash || stateDescEqual(changed, zeroed))
+			missed++;
+	}
+	failed += missed;
+
+	std::cout << std::left << std::setw(22) << std::string(name) + ":" << std::right << changes.size() << " fields changed one at a time, "
+		<< missed << " missed, padding " << (padded ? "differs" : "none") << ", copies " << (failed == missed ? "match" : "differ") << "\n";
+	return failed;
+}
+
+static D3D11_RASTERIZER_DESC makeRasterizerDesc(uint8_t fill) {
+	D3D11_RASTERIZER_DESC desc;
+	std::memset(&desc, fill, sizeof(desc));
+	desc.FillMode = D3D11_FILL_SOLID;
+	desc.CullMode = D3D11_CULL_BACK;
+	desc.FrontCounterClockwise = FALSE;
+	desc.DepthBias = 0;
+	desc.DepthBiasClamp = 0.0f;
+	desc.SlopeScaledDepthBias = 0.0f;
+	desc.DepthClipEnable = TRUE;
+	desc.ScissorEnable = FALSE;
+	desc.MultisampleEnable = FALSE;
+	desc.AntialiasedLineEnable = FALSE;
+	return desc;
+}
+
+static D3D11_DEPTH_STENCIL_DESC makeDepthStencilDesc(uint8_t fill) {
+	D3D11_DEPTH_STENCIL_DESC desc;
+	std::memset(&desc, fill, sizeof(desc));
+	desc.DepthEnable = TRUE;
+	desc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ALL;
+	desc.DepthFunc = D3D11_COMPARISON_LESS;
+	desc.StencilEnable = FALSE;
+	desc.StencilReadMask = D3D11_DEFAULT_STENCIL_READ_MASK;
+	desc.StencilWriteMask = D3D11_DEFAULT_STENCIL_WRITE_MASK;
+	desc.FrontFace = { D3D11_STENCIL_OP_KEEP, D3D11_STENCIL_OP_KEEP, D3D11_STENCIL_OP_KEEP, D3D11_COMPARISON_ALWAYS };
+	desc.BackFace = desc.FrontFace;
+	return desc;
+}
+
+// Independent blend is on so the last target counts too.
+static D3D11_BLEND_DESC makeBlendDesc(uint8_t fill) {
+	D3D11_BLEND_DESC desc;
+	std::memset(&desc, fill, sizeof(desc));
+	desc.AlphaToCoverageEnable = FALSE;
+	desc.IndependentBlendEnable = TRUE;
+	for (auto& target : desc.RenderTarget) {
+		target.BlendEnable = FALSE;
+		target.SrcBlend = D3D11_BLEND_ONE;
+		target.DestBlend = D3D11_BLEND_ZERO;
+		target.BlendOp = D3D11_BLEND_OP_ADD;
+		target.SrcBlendAlpha = D3D11_BLEND_ONE;
+		target.DestBlendAlpha = D3D11_BLEND_ZERO;
+		target.BlendOpAlpha = D3D11_BLEND_OP_ADD;
+		target.RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
+	}
+	return desc;
+}
+
+static D3D11_SAMPLER_DESC makeSamplerDesc(uint8_t fill) {
+	D3D11_SAMPLER_DESC desc;
+	std::memset(&desc, fill, sizeof(desc));
+	desc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
+	desc.AddressU = D3D11_TEXTURE_ADDRESS_WRAP;
+	desc.AddressV = D3D11_TEXTURE_ADDRESS_WRAP;
+	desc.AddressW = D3D11_TEXTURE_ADDRESS_WRAP;
+	desc.MipLODBias = 0.0f;
+	desc.MaxAnisotropy = 1;
+	desc.ComparisonFunc = D3D11_COMPARISON_NEVER;
+	for (float& value : desc.BorderColor) {
+		value = 0.0f;
+	}
+	desc.MinLOD = 0.0f;
+	desc.MaxLOD = D3D11_FLOAT32_MAX;
+	return desc;
+}
+
+static void addBlendTargetChanges(std::vector<std::function<void(D3D11_BLEND_DESC&)>>& changes, uint32_t i) {
+	changes.push_back([=](D3D11_BLEND_DESC& d) { d.RenderTarget[i].BlendEnable = TRUE; });
+	changes.push_back([=](D3D11_BLEND_DESC& d) { d.RenderTarget[i].SrcBlend = D3D11_BLEND_SRC_ALPHA; });
+	changes.push_back([=](D3D11_BLEND_DESC& d) { d.RenderTarget[i].DestBlend = D3D11_BLEND_INV_SRC_ALPHA; });
+	changes.push_back([=](D3D11_BLEND_DESC& d) { d.RenderTarget[i].BlendOp = D3D11_BLEND_OP_SUBTRACT; });
+	changes.push_back([=](D3D11_BLEND_DESC& d) { d.RenderTarget[i].SrcBlendAlpha = D3D11_BLEND_ZERO; });
+	changes.push_back([=](D3D11_BLEND_DESC& d) { d.RenderTarget[i].DestBlendAlpha = D3D11_BLEND_ONE; });
+	changes.push_back([=](D3D11_BLEND_DESC& d) { d.RenderTarget[i].BlendOpAlpha = D3D11_BLEND_OP_MAX; });
+	changes.push_back([=](D3D11_BLEND_DESC& d) { d.RenderTarget[i].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_RED; });
+}
+
+// The state cache's hashing and equality, which decide whether two descs share one D3D object, without a device.
+// Every field of every desc has to matter on its own, and nothing that D3D ignores (padding, the blend targets past the
+// first without independent blend, where a semantic name's string lives) can.
+int checkStateCache(const Options&, uint32_t) {
+	uint32_t errors = 0;
+
+	errors += checkStateDescFields<D3D11_RASTERIZER_DESC>("Rasterizer", makeRasterizerDesc, {
+		[](D3D11_RASTERIZER_DESC& d) { d.FillMode = D3D11_FILL_WIREFRAME; },
+		[](D3D11_RASTERIZER_DESC& d) { d.CullMode = D3D11_CULL_FRONT; },
+		[](D3D11_RASTERIZER_DESC& d) { d.FrontCounterClockwise = TRUE; },
+		[](D3D11_RASTERIZER_DESC& d) { d.DepthBias = 1; },
+		[](D3D11_RASTERIZER_DESC& d) { d.DepthBiasClamp = 0.5f; },
+		[](D3D11_RASTERIZER_DESC& d) { d.SlopeScaledDepthBias = 1.0f; },
+		[](D3D11_RASTERIZER_DESC& d) { d.DepthClipEnable = FALSE; },
+		[](D3D11_RASTERIZER_DESC& d) { d.ScissorEnable = TRUE; },
+		[](D3D11_RASTERIZER_DESC& d) { d.MultisampleEnable = TRUE; },
+		[](D3D11_RASTERIZER_DESC& d) { d.AntialiasedLineEnable = TRUE; },
+	});
+
+	std::vector<std::function<void(D3D11_DEPTH_STENCIL_DESC&)>> depthChanges = {
+		[](D3D11_DEPTH_STENCIL_DESC& d) { d.DepthEnable = FALSE; },
+		[](D3D11_DEPTH_STENCIL_DESC& d) { d.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ZERO; },
+		[](D3D11_DEPTH_STENCIL_DESC& d) { d.DepthFunc = D3D11_COMPARISON_LESS_EQUAL; },
+		[](D3D11_DEPTH_STENCIL_DESC& d) { d.StencilEnable = TRUE; },
+		[](D3D11_DEPTH_STENCIL_DESC& d) { d.StencilReadMask = 0x0f; },
+		[](D3D11_DEPTH_STENCIL_DESC& d) { d.StencilWriteMask = 0x0f; },
+	};
+	for (auto face : { &D3D11_DEPTH_STENCIL_DESC::FrontFace, &D3D11_DEPTH_STENCIL_DESC::BackFace }) {
+		depthChanges.push_back([=](D3D11_DEPTH_STENCIL_DESC& d) { (d.*face).StencilFailOp = D3D11_STENCIL_OP_ZERO; });
+		depthChanges.push_back([=](D3D11_DEPTH_STENCIL_DESC& d) { (d.*face).StencilDepthFailOp = D3D11_STENCIL_OP_INCR_SAT; });
+		depthChanges.push_back([=](D3D11_DEPTH_STENCIL_DESC& d) { (d.*face).StencilPassOp = D3D11_STENCIL_OP_REPLACE; });
+		depthChanges.push_back([=](D3D11_DEPTH_STENCIL_DESC& d) { (d.*face).StencilFunc = D3D11_COMPARISON_EQUAL; });
+	}
+	errors += checkStateDescFields<D3D11_DEPTH_STENCIL_DESC>("Depth stencil", makeDepthStencilDesc, depthChanges);
+
+	std::vector<std::function<void(D3D11_BLEND_DESC&)>> blendChanges = {
+		[](D3D11_BLEND_DESC& d) { d.AlphaToCoverageEnable = TRUE; },
+		[](D3D11_BLEND_DESC& d) { d.IndependentBlendEnable = FALSE; },
+	};
+	addBlendTargetChanges(blendChanges, 0);
+	addBlendTargetChanges(blendChanges, 7);
+	errors += checkStateDescFields<D3D11_BLEND_DESC>("Blend", makeBlendDesc, blendChanges);
+
+	// Without independent blend D3D only reads the first target, so what's left in the rest can't split the cache.
+	D3D11_BLEND_DESC shared = makeBlendDesc(0x00), sharedOther = makeBlendDesc(0x00);
+	shared.IndependentBlendEnable = sharedOther.IndependentBlendEnable = FALSE;
+	for (uint32_t i = 1; i < 8; i++) {
+		sharedOther.RenderTarget[i].BlendEnable = TRUE;
+		sharedOther.RenderTarget[i].SrcBlend = D3D11_BLEND_SRC_ALPHA;
+		sharedOther.RenderTarget[i].RenderTargetWriteMask = 0;
+	}
+	bool sharedMatch = hashStateDesc(shared) == hashStateDesc(sharedOther) && stateDescEqual(shared, sharedOther);
+	errors += !sharedMatch;
+	std::cout << "Unused targets:       " << (sharedMatch ? "ignored" : "hashed") << "\n";
+
+	std::vector<std::function<void(D3D11_SAMPLER_DESC&)>> samplerChanges = {
+		[](D3D11_SAMPLER_DESC& d) { d.Filter = D3D11_FILTER_ANISOTROPIC; },
+		[](D3D11_SAMPLER_DESC& d) { d.AddressU = D3D11_TEXTURE_ADDRESS_CLAMP; },
+		[](D3D11_SAMPLER_DESC& d) { d.AddressV = D3D11_TEXTURE_ADDRESS_MIRROR; },
+		[](D3D11_SAMPLER_DESC& d) { d.AddressW = D3D11_TEXTURE_ADDRESS_BORDER; },
+		[](D3D11_SAMPLER_DESC& d) { d.MipLODBias = -0.5f; },
+		[](D3D11_SAMPLER_DESC& d) { d.MaxAnisotropy = 16; },
+		[](D3D11_SAMPLER_DESC& d) { d.ComparisonFunc = D3D11_COMPARISON_LESS_EQUAL; },
+		[](D3D11_SAMPLER_DESC& d) { d.MinLOD = 1.0f; },
+		[](D3D11_SAMPLER_DESC& d) { d.MaxLOD = 4.0f; },
+	};
+	for (uint32_t i = 0; i < 4; i++) {
+		samplerChanges.push_back([=](D3D11_SAMPLER_DESC& d) { d.BorderColor[i] = 1.0f; });
+	}
+	errors += checkStateDescFields<D3D11_SAMPLER_DESC>("Sampler", makeSamplerDesc, samplerChanges);
+
+	// Semantic names are compared as strings, a copy of the name somewhere else is the same layout.
+	char position[] = "POSITION", positionCopy[] = "POSITION", normal[] = "NORMAL";
+	std::vector<D3D11_INPUT_ELEMENT_DESC> elements = {
+		{ position, 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+	};
+	auto elementsCopy = elements;
+	elementsCopy[0].SemanticName = positionCopy;
+	bool namesMatch = hashStateDesc(elements) == hashStateDesc(elementsCopy) && stateDescEqual(elements, elementsCopy);
+
+	std::vector<std::function<void(D3D11_INPUT_ELEMENT_DESC&)>> elementChanges = {
+		[&](D3D11_INPUT_ELEMENT_DESC& e) { e.SemanticName = normal; },
+		[](D3D11_INPUT_ELEMENT_DESC& e) { e.SemanticIndex = 1; },
+		[](D3D11_INPUT_ELEMENT_DESC& e) { e.Format = DXGI_FORMAT_R32G32_FLOAT; },
+		[](D3D11_INPUT_ELEMENT_DESC& e) { e.InputSlot = 1; },
+		[](D3D11_INPUT_ELEMENT_DESC& e) { e.AlignedByteOffset = 12; },
+		[](D3D11_INPUT_ELEMENT_DESC& e) { e.InputSlotClass = D3D11_INPUT_PER_INSTANCE_DATA; },
+		[](D3D11_INPUT_ELEMENT_DESC& e) { e.InstanceDataStepRate = 1; },
+	};
+	uint32_t elementsMissed = 0;
+	for (auto& change : elementChanges) {
+		auto changed = elements;
+		change(changed[0]);
+		if (hashStateDesc(changed) == hashStateDesc(elements) || stateDescEqual(changed, elements))
+			elementsMissed++;
+	}
+	// An extra element is a different layout even with the first the same.
+	auto longer = elements;
+	longer.push_back({ normal, 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 });
+	elementsMissed += hashStateDesc(longer) == hashStateDesc(elements) || stateDescEqual(longer, elements);
+
+	errors += elementsMissed + !namesMatch;
+	std::cout << "Input layout:         " << elementChanges.size() + 1 << " changes, " << elementsMissed << " missed, copied names "
+		<< (namesMatch ? "match" : "differ") << "\n";
+
+	std::cout << "Failed checks:        " << errors << std::defaultfloat << std::endl;
+	return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,1102 @@
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#ifdef _MSC_VER
+#define STBI_MSC_SECURE_CRT
+#endif
+#include "../CoolRenderingStuff/vendor/stb/stb_image_write.h"
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <stdexcept>
+#include <cstdlib>
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <random>
+
+#include "Checks.h"
+#include "../CoolRenderingStuff/Scene.h"
+#include "../CoolRenderingStuff/SceneLoader.h"
+#include "../CoolRenderingStuff/JobSystem.h"
+#include "../CoolRenderingStuff/SoftwareRenderer.h"
+#include "../CoolRenderingStuff/OcclusionCuller.h"
+#include "../CoolRenderingStuff/DrawOrder.h"
+#include "../CoolRenderingStuff/ViewCulling.h"
+#include "../CoolRenderingStuff/TexturePacker.h"
+#include "../CoolRenderingStuff/TextureCooker.h"
+#include "../CoolRenderingStuff/MipGenerator.h"
+#include "../CoolRenderingStuff/TextureStreamer.h"
+#include "../CoolRenderingStuff/VirtualTexture.h"
+#include "../CoolRenderingStuff/VirtualTextureStreamer.h"
+#include "../CoolRenderingStuff/EnvironmentLighting.h"
+#include "../CoolRenderingStuff/AmbientOcclusion.h"
+#include "../CoolRenderingStuff/LightTree.h"
+
+using namespace DirectX;
+
+static void printUsage() {
+	std::cout <<
+		"ReferenceRenderer [options]\n"
+		"  --scene <dir> <file>        scene to load, default ../CoolRenderingStuff/assets/crytekSponza_fbx/ sponza.fbx\n"
+		"  --width <w> --height <h>    output size, default 1280x720\n"
+		"  --threads <n>               worker threads including the main thread, 0 for all cores\n"
+		"  --camera <x> <y> <z> <yaw> <pitch>\n"
+		"  --time <seconds>            time used to animate the lights\n"
+		"  --frames <n>                render n times and report the average, for benchmarking\n"
+		"  --cull <none|tile|tree>     light culling scheme, tree samples a few lights per pixel from a light tree\n"
+		"  --prepass <off|sorted|on>   draw order and depth prepass mode\n"
+		"  --out <file.png>            output image, default reference.png\n"
+		"  --occlusion                 benchmark the occlusion culler and check the culled image against the full one\n"
+		"  --no-avx2                   run the occlusion culler's scalar path\n"
+		"  --sweep <n>                 with --occlusion, turn the camera a full circle in n steps instead of one view\n"
+		"  --overdraw                  report G-buffer overdraw for every prepass mode\n"
+		"  --pack                      cook, mip and pack the material textures, report memory saved and SRV binds for the view\n"
+		"  --stream <steps>            walk the length of the scene and back in steps frames, report texture streaming residency\n"
+		"  --stream-budget <MB>        texture streaming memory budget, default 128\n"
+		"  --virtual <frames>          cook the virtual textures and stream them for synthetic feedback, checking the page table and tiles\n"
+		"  --views <n>                 cull, sort and batch the camera plus probe faces one view at a time and all at once, for 1 to n views\n"
+		"  --environment <file|none>   DDS cube the ambient is baked from, none for the first light's ambient, default the Sponza probe\n"
+		"  --ao <file|none>            baked vertex occlusion cache, none for fully open, default the app's under assets/cache\n"
+		"  --bake-ao                   bake the vertex occlusion every way, checking the BVH, packets against single rays and the cache\n"
+		"  --ao-rays <n>               rays per vertex for the occlusion bake, default 64\n"
+		"  --lights <n>                add n small lights bunched into clusters around the scene\n"
+		"  --light-samples <n>         lights sampled per pixel with --cull tree, default 4\n"
+		"Checks, no scene is loaded:\n";
+
+	for (auto& check : getChecks()) {
+		std::string flag = check.argument ? std::string(check.flag) + " " + check.argument : check.flag;
+		std::cout << "  " << std::left << std::setw(27) << flag << " " << check.description << "\n";
+	}
+}
+
+static Options parseOptions(int argc, char** argv) {
+	Options options;
+
+	auto next = [&](int& i) -> const char* {
+		if (i + 1 >= argc)
+			throw std::runtime_error(std::string("Missing value for ") + argv[i]);
+		return argv[++i];
+	};
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+
+		if (arg == "--scene") {
+			options.sceneDir = next(i);
+			options.sceneFile = next(i);
+		}
+		else if (arg == "--width") options.width = std::atoi(next(i));
+		else if (arg == "--height") options.height = std::atoi(next(i));
+		else if (arg == "--threads") options.threads = std::atoi(next(i));
+		else if (arg == "--camera") {
+			options.cameraPosition.x = static_cast<float>(std::atof(next(i)));
+			options.cameraPosition.y = static_cast<float>(std::atof(next(i)));
+			options.cameraPosition.z = static_cast<float>(std::atof(next(i)));
+			options.yaw = static_cast<float>(std::atof(next(i)));
+			options.pitch = static_cast<float>(std::atof(next(i)));
+		}
+		else if (arg == "--time") options.time = static_cast<float>(std::atof(next(i)));
+		else if (arg == "--frames") options.frames = std::max(1, std::atoi(next(i)));
+		else if (arg == "--cull") {
+			std::string mode = next(i);
+			if (mode == "none") options.culling = LightCullingMode::None;
+			else if (mode == "tile") options.culling = LightCullingMode::TileSphere;
+			else if (mode == "tree") options.culling = LightCullingMode::TreeSampled;
+			else throw std::runtime_error("Unknown culling mode " + mode);
+		}
+		else if (arg == "--prepass") {
+			std::string mode = next(i);
+			if (mode == "off") options.prepass = DepthPrepassMode::Off;
+			else if (mode == "sorted") options.prepass = DepthPrepassMode::FrontToBack;
+			else if (mode == "on") options.prepass = DepthPrepassMode::Prepass;
+			else throw std::runtime_error("Unknown prepass mode " + mode);
+		}
+		else if (arg == "--overdraw") options.overdraw = true;
+		else if (arg == "--pack") options.pack = true;
+		else if (arg == "--out") options.out = next(i);
+		else if (arg == "--occlusion") options.occlusion = true;
+		else if (arg == "--no-avx2") options.avx2 = false;
+		else if (arg == "--sweep") options.sweep = std::atoi(next(i));
+		else if (arg == "--stream") options.streamSteps = std::max(1, std::atoi(next(i)));
+		else if (arg == "--stream-budget") options.streamBudgetMB = std::max(1, std::atoi(next(i)));
+		else if (arg == "--virtual") options.virtualFrames = std::max(1, std::atoi(next(i)));
+		else if (arg == "--views") options.viewCount = std::min(static_cast<int>(MAX_VIEWS), std::max(1, std::atoi(next(i))));
+		else if (arg == "--environment") options.environment = next(i);
+		else if (arg == "--ao") options.ambientOcclusion = next(i);
+		else if (arg == "--bake-ao") options.bakeAmbientOcclusion = true;
+		else if (arg == "--ao-rays") options.ambientOcclusionRays = std::max(1, std::atoi(next(i)));
+		else if (arg == "--lights") options.extraLights = std::atoi(next(i));
+		else if (arg == "--light-samples") options.lightSamples = std::max(1, std::atoi(next(i)));
+		else if (auto check = findCheck(arg)) {
+			options.check = check;
+			options.checkCount = check->argument ? std::max(1, std::atoi(next(i))) : 0;
+		}
+		else if (arg == "--help") {
+			printUsage();
+			std::exit(0);
+		}
+		else {
+			throw std::runtime_error("Unknown argument " + arg);
+		}
+	}
+
+	if (options.width == 0 || options.height == 0)
+		throw std::runtime_error("Width and height must be non zero");
+
+	if (options.ambientOcclusion.empty())
+		options.ambientOcclusion = "../CoolRenderingStuff/assets/cache/" + std::filesystem::path(options.sceneFile).stem().string() + ".ao";
+
+	return options;
+}
+
+static void buildSceneDrawOrder(const SceneData& scene, DepthPrepassMode mode, const std::vector<uint8_t>* visibility, XMFLOAT3 eye, DrawOrder& out) {
+	std::vector<MeshBounds> bounds;
+	std::vector<uint8_t> alphaTested;
+	for (auto& instance : scene.instances) {
+		bounds.push_back(instance.bounds);
+		alphaTested.push_back(scene.materials[scene.meshes[instance.mesh].materialId].settings.useAlphaCutoutTexture != 0);
+	}
+
+	buildDrawOrder(mode, bounds, alphaTested, visibility, eye, out);
+}
+
+// Draw calls the application would make for the order, the prepass's alpha tested bucket not included.
+static size_t countDrawCalls(const SceneData& scene, const DrawOrder& order, bool instancing) {
+	std::vector<uint32_t> instanceMeshes;
+	for (auto& instance : scene.instances) {
+		instanceMeshes.push_back(instance.mesh);
+	}
+
+	DrawBatches batches;
+	buildDrawBatches(order, instanceMeshes, instancing, batches);
+	return batches.batches.size();
+}
+
+static void setLightCulling(const Options& options, const LightTree& lightTree, SoftwareRenderOptions& renderOptions) {
+	renderOptions.culling = options.culling;
+	renderOptions.lightTree = &lightTree;
+	renderOptions.lightSamples = options.lightSamples;
+}
+
+// Renders the view in every prepass mode. Images should match apart from ties in depth, overdraw shouldn't.
+static void measureOverdraw(const Options& options, const SceneData& scene, SoftwareRenderer& renderer, const std::vector<Light>& lights, const LightTree& lightTree) {
+	auto frame = calculatePerFrameUniforms(options.cameraPosition, options.pitch, options.yaw, options.width, options.height);
+
+	std::vector<uint8_t> reference;
+
+	std::cout << std::endl;
+	for (auto mode : { DepthPrepassMode::Off, DepthPrepassMode::FrontToBack, DepthPrepassMode::Prepass }) {
+		DrawOrder order;
+		buildSceneDrawOrder(scene, mode, nullptr, options.cameraPosition, order);
+
+		SoftwareRenderOptions renderOptions;
+		setLightCulling(options, lightTree, renderOptions);
+		renderOptions.instanceOrder = &order.instances;
+		renderOptions.depthPrepass = mode == DepthPrepassMode::Prepass;
+
+		auto& image = renderer.render(frame, lights, options.width, options.height, renderOptions);
+		auto& stats = renderer.getStats();
+
+		uint64_t different = 0;
+		if (reference.empty()) {
+			reference = image;
+		}
+		else {
+			for (size_t p = 0; p < image.size(); p += 4) {
+				if (image[p] != reference[p] || image[p + 1] != reference[p + 1] || image[p + 2] != reference[p + 2])
+					different++;
+			}
+		}
+
+		std::cout << std::left << std::setw(16) << getDepthPrepassModeName(mode) << std::right << std::fixed << std::setprecision(3)
+			<< "overdraw " << stats.overdraw()
+			<< ", shaded " << stats.fragmentsShaded
+			<< ", discarded " << stats.fragmentsDiscarded
+			<< ", depth only " << stats.depthFragments
+			<< ", geometry " << stats.geometryMs << " ms"
+			<< ", " << different << " pixels differ" << std::defaultfloat << std::endl;
+	}
+}
+
+// Counts the SRV binds the application's G-buffer passes make for the view, with every texture bound on its own and with the packed arrays.
+// Both only rebind when a draw needs something different, so the difference is down to the packing alone.
+static void reportTexturePacking(const Options& options, SceneData& scene, JobSystem& jobs) {
+	auto cooked = cookMaterialTextures(scene);
+
+	std::cout << "\n";
+	for (auto& material : cooked.materials) {
+		if (material.bytesBefore != material.bytesAfter)
+			std::cout << std::left << std::setw(22) << material.material << std::right << material.bytesBefore / 1024 << " KB -> " << material.bytesAfter / 1024 << " KB\n";
+	}
+	std::cout << "Masks packed RG:      " << cooked.packedTextures << "\n";
+	std::cout << "Masks R:              " << cooked.singleChannelTextures << "\n";
+	std::cout << "Colour specular:      " << cooked.colourSpecularTextures << "\n";
+	std::cout << "Texture memory:       " << cooked.bytesBefore / 1024 << " KB -> " << cooked.bytesAfter / 1024 << " KB, "
+		<< cooked.bytesSaved() / 1024 << " KB saved (top mips)\n";
+
+	auto mips = generateSceneMips(scene, jobs);
+	std::cout << "Mips:                 " << mips.bytes / 1024 << " KB for " << mips.textures << " textures in " << mips.ms << " ms\n";
+
+	TexturePack pack = packTextures(scene.textures);
+	auto& stats = pack.stats;
+
+	std::cout << "\nTextures:             " << stats.textures << "\n";
+	std::cout << "Arrays:               " << stats.arrays << "\n";
+	for (auto& array : pack.arrays) {
+		std::cout << "  " << array.width << "x" << array.height << "x" << array.channels << ": " << array.slices.size() << " slices, " << array.atlasSlices << " atlas pages\n";
+	}
+	std::cout << "Atlased textures:     " << stats.atlasTextures << "\n";
+	std::cout << "Packing efficiency:   " << std::fixed << std::setprecision(1) << stats.efficiency() << "%" << std::defaultfloat << "\n";
+
+	// Each texture as an array of its own is exactly the unpacked binding.
+	std::unordered_map<std::string, uint32_t> textureIds;
+	for (auto& [path, texture] : scene.textures) {
+		textureIds.emplace(path, static_cast<uint32_t>(textureIds.size()));
+	}
+
+	std::vector<PackedMaterial> unpacked, packed;
+	for (auto& material : scene.materials) {
+		packed.push_back(getPackedMaterial(pack, material));
+
+		PackedMaterial single = packed.back();
+		const std::string* paths[MATERIAL_TEXTURE_COUNT] = { &material.diffuseTexture, &material.normalTexture, &material.alphaCutoutTexture, &material.specularTexture };
+		for (uint32_t slot = 0; slot < MATERIAL_TEXTURE_COUNT; slot++) {
+			if (single.arrays[slot] != NO_TEXTURE_ARRAY)
+				single.arrays[slot] = textureIds.at(*paths[slot]);
+		}
+		unpacked.push_back(single);
+	}
+
+	DrawOrder order;
+	buildSceneDrawOrder(scene, options.prepass, nullptr, options.cameraPosition, order);
+
+	// The prepass binds materials for the alpha tested bucket, then the G-buffer pass for everything.
+	std::vector<uint32_t> draws;
+	if (options.prepass == DepthPrepassMode::Prepass)
+		draws.insert(draws.end(), order.instances.begin() + order.opaqueCount, order.instances.end());
+	draws.insert(draws.end(), order.instances.begin(), order.instances.end());
+
+	uint32_t unpackedBound[MATERIAL_TEXTURE_COUNT], packedBound[MATERIAL_TEXTURE_COUNT];
+	resetTextureArrayBinding(unpackedBound);
+	resetTextureArrayBinding(packedBound);
+
+	uint64_t unpackedBinds = 0, packedBinds = 0;
+	for (uint32_t instance : draws) {
+		uint32_t materialId = scene.meshes[scene.instances[instance].mesh].materialId;
+		unpackedBinds += updateTextureArrayBinding(unpacked[materialId], unpackedBound);
+		packedBinds += updateTextureArrayBinding(packed[materialId], packedBound);
+	}
+
+	std::cout << "Material draws:       " << draws.size() << " (" << getDepthPrepassModeName(options.prepass) << ")\n";
+	std::cout << "SRV binds, textures:  " << unpackedBinds << "\n";
+	std::cout << "SRV binds, packed:    " << packedBinds << std::endl;
+}
+
+// Streams the packed textures the way the app would with tiled resources, along a camera path down the scene's long axis and back.
+// Residency is pure bookkeeping so the run needs no device, the occlusion culler supplies what's visible each step.
+static void simulateTextureStreaming(const Options& options, SceneData& scene, JobSystem& jobs) {
+	cookMaterialTextures(scene);
+	generateSceneMips(scene, jobs);
+	TexturePack pack = packTextures(scene.textures);
+
+	// Every full slice of a mipped array streams, atlas pages stay resident.
+	std::vector<StreamedTextureDesc> textures;
+	std::vector<uint32_t> firstTexture(pack.arrays.size(), UINT32_MAX);
+	for (uint32_t i = 0; i < pack.arrays.size(); i++) {
+		auto& array = pack.arrays[i];
+		if (array.mipLevels <= 1)
+			continue;
+
+		firstTexture[i] = static_cast<uint32_t>(textures.size());
+		for (size_t slice = array.atlasSlices; slice < array.slices.size(); slice++) {
+			textures.push_back(describeTiledTexture(array.width, array.height, array.channels, array.mipLevels));
+		}
+	}
+
+	std::vector<StreamedMeshDesc> meshes;
+	MeshBounds sceneBounds = scene.instances.empty() ? MeshBounds{} : scene.instances[0].bounds;
+	for (auto& instance : scene.instances) {
+		StreamedMeshDesc desc{ instance.bounds, instance.uvDensity, {} };
+
+		auto packed = getPackedMaterial(pack, scene.materials[scene.meshes[instance.mesh].materialId]);
+		for (uint32_t slot = 0; slot < MATERIAL_TEXTURE_COUNT; slot++) {
+			uint32_t array = packed.arrays[slot];
+			if (array == NO_TEXTURE_ARRAY || firstTexture[array] == UINT32_MAX)
+				continue;
+
+			uint32_t fullSlices = static_cast<uint32_t>(pack.arrays[array].slices.size()) - pack.arrays[array].atlasSlices;
+			if (packed.table.slices[slot] >= fullSlices)
+				continue;
+
+			uint32_t texture = firstTexture[array] + packed.table.slices[slot];
+			if (std::find(desc.textures.begin(), desc.textures.end(), texture) == desc.textures.end())
+				desc.textures.push_back(texture);
+		}
+		meshes.push_back(std::move(desc));
+
+		XMStoreFloat3(&sceneBounds.min, XMVectorMin(XMLoadFloat3(&sceneBounds.min), XMLoadFloat3(&instance.bounds.min)));
+		XMStoreFloat3(&sceneBounds.max, XMVectorMax(XMLoadFloat3(&sceneBounds.max), XMLoadFloat3(&instance.bounds.max)));
+	}
+
+	TextureStreamSettings settings;
+	settings.memoryBudget = static_cast<uint64_t>(options.streamBudgetMB) * 1024 * 1024;
+	TextureStreamer streamer(std::move(textures), std::move(meshes), settings);
+
+	OcclusionCuller culler(scene, jobs);
+	std::vector<uint8_t> visibility;
+
+	std::cout << "\nStreamed textures:    " << streamer.getNumTextures() << ", " << streamer.getStats().tailBytes / 1024 << " KB of tails resident\n";
+	std::cout << "Budget:               " << options.streamBudgetMB << " MB\n";
+
+	// Along x or z, whichever is longer, from a tenth of the way in to a tenth from the far end and back.
+	bool alongX = sceneBounds.max.x - sceneBounds.min.x >= sceneBounds.max.z - sceneBounds.min.z;
+	float start = alongX ? sceneBounds.min.x : sceneBounds.min.z;
+	float length = (alongX ? sceneBounds.max.x : sceneBounds.max.z) - start;
+	float across = alongX ? (sceneBounds.min.z + sceneBounds.max.z) * 0.5f : (sceneBounds.min.x + sceneBounds.max.x) * 0.5f;
+
+	uint32_t steps = options.streamSteps;
+	uint32_t reportEvery = std::max(1u, steps / 10);
+	uint64_t residentSum = 0;
+	uint64_t deficitSum = 0;
+	uint32_t maxDeficit = 0;
+	uint32_t stepsShort = 0;
+	uint64_t budgetLimited = 0;
+
+	for (uint32_t step = 0; step < steps; step++) {
+		float t = static_cast<float>(step) / steps * 2.0f;
+		bool returning = t > 1.0f;
+		float along = start + length * (0.1f + 0.8f * (returning ? 2.0f - t : t));
+
+		XMFLOAT3 eye = alongX ? XMFLOAT3(along, options.cameraPosition.y, across) : XMFLOAT3(across, options.cameraPosition.y, along);
+		float yaw = (alongX ? XM_PIDIV2 : 0.0f) + (returning ? XM_PI : 0.0f);
+
+		auto frame = calculatePerFrameUniforms(eye, 0.0f, yaw, options.width, options.height);
+		culler.cull(frame.viewProj, visibility);
+
+		TextureStreamView view{ eye, static_cast<float>(options.height), 1.0f / std::tan(CAMERA_FOV_Y * 0.5f) };
+		streamer.update(view, &visibility);
+
+		auto& stats = streamer.getStats();
+		residentSum += stats.residentBytes;
+		deficitSum += stats.mipDeficit;
+		maxDeficit = std::max(maxDeficit, stats.maxDeficit);
+		stepsShort += stats.texturesShort > 0;
+		budgetLimited += stats.budgetLimited;
+
+		if (step % reportEvery == 0) {
+			std::cout << "Step " << step << " at " << std::fixed << std::setprecision(1) << along << ": "
+				<< stats.residentBytes / (1024.0 * 1024.0) << " MB (" << stats.budgetUsedPercent() << "%), "
+				<< stats.loads << " loads, " << stats.evictions << " evictions, "
+				<< stats.texturesShort << " textures " << stats.mipDeficit << " mips short" << std::defaultfloat << std::endl;
+		}
+	}
+
+	auto& stats = streamer.getStats();
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << "Average resident:     " << residentSum / (steps * 1024.0 * 1024.0) << " MB, " << 100.0 * residentSum / (static_cast<double>(steps) * settings.memoryBudget) << "% of budget\n";
+	std::cout << "Peak resident:        " << stats.peakResidentBytes / (1024.0 * 1024.0) << " MB\n";
+	std::cout << "Loads:                " << stats.totalLoads << ", " << stats.totalLoadedBytes / (1024.0 * 1024.0) << " MB\n";
+	std::cout << "Evictions:            " << stats.totalEvictions << "\n";
+	std::cout << "Over budget loads:    " << budgetLimited << "\n";
+	std::cout << "Steps short of view:  " << stepsShort << " of " << steps << "\n";
+	std::cout << "Mip deficit:          " << static_cast<double>(deficitSum) / steps << " per step, " << maxDeficit << " at most" << std::defaultfloat << std::endl;
+}
+
+// Feedback the size the renderer's would be: a band of the screen per texture, each panning across it and zooming in and out
+// through its levels. Neighbouring texels step one texel of the level they ask for, so a band wants a screen's worth of tiles.
+static void generateVirtualFeedback(const Options& options, const VirtualTextureLayout& layout, uint32_t frame, std::vector<uint32_t>& out) {
+	auto& settings = layout.settings;
+	uint32_t width = std::max(1u, options.width / settings.feedbackScale);
+	uint32_t height = std::max(1u, options.height / settings.feedbackScale);
+	const uint32_t bands = 3;
+
+	out.assign(static_cast<size_t>(width) * height, VIRTUAL_FEEDBACK_NONE);
+
+	for (uint32_t band = 0; band < bands; band++) {
+		auto& region = layout.regions[(frame / 120 + band * 7) % layout.regions.size()];
+
+		float zoom = 0.5f + 0.5f * std::sin(frame * 0.02f + band);
+		uint32_t level = std::min(region.maxLevel, static_cast<uint32_t>(zoom * (region.maxLevel + 1)));
+		uint32_t step = settings.feedbackScale << level;
+
+		uint32_t panX = frame * 3 * (band + 1) * step;
+		uint32_t panY = frame * 2 * step;
+
+		uint32_t x0 = width * band / bands;
+		uint32_t x1 = width * (band + 1) / bands;
+
+		for (uint32_t y = 0; y < height; y++) {
+			for (uint32_t x = x0; x < x1; x++) {
+				uint32_t texelX = (panX + (x - x0) * step) % region.width;
+				uint32_t texelY = (panY + y * step) % region.height;
+
+				uint32_t pageX = (region.pageX + texelX / settings.tileSize) >> level;
+				uint32_t pageY = (region.pageY + texelY / settings.tileSize) >> level;
+				out[static_cast<size_t>(y) * width + x] = makeVirtualPage(level, pageX, pageY);
+			}
+		}
+	}
+}
+
+// Every page table entry must name the finest cached tile over its page, and every cached tile must hold what the source has there.
+static uint32_t checkVirtualPageTable(const VirtualTextureStreamer& streamer) {
+	auto& pageTable = streamer.getPageTable();
+	auto& cache = streamer.getCache();
+	auto& settings = streamer.getSettings();
+
+	std::unordered_map<uint32_t, uint32_t> cached;
+	for (uint32_t slot = 0; slot < cache.getSlotCount(); slot++) {
+		if (cache.getPage(slot) != VIRTUAL_FEEDBACK_NONE)
+			cached[cache.getPage(slot)] = slot;
+	}
+
+	uint32_t errors = 0;
+	for (uint32_t level = 0; level < pageTable.getLevelCount(); level++) {
+		uint32_t size = pageTable.getLevelSize(level);
+		for (uint32_t y = 0; y < size; y++) {
+			for (uint32_t x = 0; x < size; x++) {
+				uint32_t expected = 0;
+				for (uint32_t up = level; up < pageTable.getLevelCount(); up++) {
+					auto found = cached.find(makeVirtualPage(up, x >> (up - level), y >> (up - level)));
+					if (found != cached.end()) {
+						expected = 0xff000000u | (up << 16) | ((found->second / settings.cacheTiles) << 8) | (found->second % settings.cacheTiles);
+						break;
+					}
+				}
+
+				if (pageTable.getEntry(level, x, y) != expected)
+					errors++;
+			}
+		}
+	}
+
+	return errors;
+}
+
+static int simulateVirtualTexturing(const Options& options, SceneData& scene, JobSystem& jobs) {
+	cookMaterialTextures(scene);
+	generateSceneMips(scene, jobs);
+	TexturePack pack = packTextures(scene.textures);
+
+	VirtualTextureLayout layout = layoutVirtualTextures(pack);
+	if (layout.regions.empty()) {
+		std::cout << "No texture is big enough to be virtual" << std::endl;
+		return 0;
+	}
+
+	std::string path = std::filesystem::path(options.out).replace_extension(".vt").string();
+	auto cookStats = cookVirtualTextures(pack, layout, path, jobs);
+
+	auto& settings = layout.settings;
+	std::cout << "\nVirtual textures:     " << layout.regions.size() << " in " << layout.pagesUsed << " of " << settings.virtualPages * settings.virtualPages << " pages\n";
+	std::cout << "Tile file:            " << path << ", " << cookStats.tiles << " tiles, " << cookStats.bytes / (1024 * 1024) << " MB"
+		<< (cookStats.upToDate ? ", already cooked" : ", cooked in " + std::to_string(cookStats.ms) + " ms") << "\n";
+
+	VirtualTextureStreamer streamer(path, layout);
+	std::cout << "Cache:                " << streamer.getCache().getSlotCount() << " tiles, " << streamer.getCache().getPinnedSlots() << " pinned" << std::endl;
+
+	// The GPU cache's contents as the uploads left them, checked against a tile cooked straight from the pack.
+	std::vector<std::vector<unsigned char>> physical(streamer.getCache().getSlotCount());
+	std::vector<unsigned char> expected(settings.getTileBytes());
+	uint32_t tileErrors = 0;
+	uint32_t tableErrors = 0;
+
+	auto apply = [&](const std::vector<VirtualTileUpload>& uploads) {
+		for (auto& upload : uploads) {
+			physical[upload.slot].assign(upload.data, upload.data + settings.getTileBytes());
+
+			cookVirtualTile(pack, layout, streamer.getCache().getPage(upload.slot), expected.data());
+			tileErrors += physical[upload.slot] != expected;
+		}
+		streamer.getPageTable().takeDirtyRects();
+	};
+
+	uint64_t pagesSeen = 0;
+	uint64_t pagesResident = 0;
+	uint64_t dropped = 0;
+	double latencySum = 0.0;
+	uint64_t latencyLoads = 0;
+	uint32_t reportEvery = std::max(1u, options.virtualFrames / 10);
+	std::vector<uint32_t> feedback;
+
+	for (uint32_t frame = 0; frame < options.virtualFrames; frame++) {
+		generateVirtualFeedback(options, layout, frame, feedback);
+		apply(streamer.update(feedback.data(), feedback.size()));
+		tableErrors += checkVirtualPageTable(streamer);
+
+		auto& stats = streamer.getStats();
+		pagesSeen += stats.feedback.pages;
+		pagesResident += stats.feedback.resident;
+		dropped += stats.dropped;
+		latencySum += stats.averageLatencyFrames * stats.loadsCompleted;
+		latencyLoads += stats.loadsCompleted;
+
+		if (frame % reportEvery == 0) {
+			std::cout << "Frame " << frame << ": " << stats.feedback.resident << " of " << stats.feedback.pages << " pages cached, "
+				<< stats.loadsStarted << " loads started, " << stats.loadsCompleted << " landed, " << stats.evictions << " evictions, "
+				<< stats.inFlight << " in flight" << std::endl;
+		}
+	}
+
+	// Whatever was still in flight lands, so every tile that was asked for gets checked.
+	streamer.waitForLoads();
+	apply(streamer.update(nullptr, 0));
+	tableErrors += checkVirtualPageTable(streamer);
+
+	auto& stats = streamer.getStats();
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << "Hit rate:             " << (pagesSeen ? 100.0 * pagesResident / pagesSeen : 100.0) << "% of pages asked for\n";
+	std::cout << "Loads:                " << stats.totalLoads << ", " << stats.totalLoads * settings.getTileBytes() / (1024.0 * 1024.0) << " MB\n";
+	std::cout << "Evictions:            " << stats.totalEvictions << "\n";
+	std::cout << "Dropped:              " << dropped << "\n";
+	std::cout << "Latency:              " << (latencyLoads ? latencySum / latencyLoads : 0.0) << " frames\n";
+	std::cout << "Page table writes:    " << streamer.getPageTable().getEntriesWritten() << " entries\n";
+	std::cout << "Page table errors:    " << tableErrors << "\n";
+	std::cout << "Tile errors:          " << tileErrors << std::defaultfloat << std::endl;
+
+	return tableErrors || tileErrors ? 1 : 0;
+}
+
+// The camera, then the six faces of a reflection probe at its eye, then the camera turned a little further for each view after.
+static std::vector<XMFLOAT4X4> generateViewProjs(const Options& options, uint32_t count) {
+	const XMFLOAT3 faceDirections[6] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+	const XMFLOAT3 faceUps[6] = { { 0, 1, 0 }, { 0, 1, 0 }, { 0, 0, -1 }, { 0, 0, 1 }, { 0, 1, 0 }, { 0, 1, 0 } };
+
+	std::vector<XMFLOAT4X4> viewProjs(count);
+	auto eye = XMLoadFloat3(&options.cameraPosition);
+	auto faceProj = XMMatrixPerspectiveFovLH(XM_PIDIV2, 1.0f, 0.1f, 1000.0f);
+
+	for (uint32_t i = 0; i < count; i++) {
+		if (i >= 1 && i <= 6) {
+			auto view = XMMatrixLookToLH(eye, XMLoadFloat3(&faceDirections[i - 1]), XMLoadFloat3(&faceUps[i - 1]));
+			XMStoreFloat4x4(&viewProjs[i], XMMatrixMultiply(view, faceProj));
+		}
+		else {
+			float yaw = options.yaw + (i ? 0.1f * (i - 6) : 0.0f);
+			XMStoreFloat4x4(&viewProjs[i], calculatePerFrameUniforms(options.cameraPosition, options.pitch, yaw, options.width, options.height).viewProj);
+		}
+	}
+
+	return viewProjs;
+}
+
+// What the application did with one camera, done once per view: test every instance and light against the view, sort what's
+// left and batch it. Against the batched path: every view culled in one pass over the bounds, one sort for everything any
+// view sees, then a filter and batch per view. Both run on one thread so the times are CPU cost, and both have to come out
+// with the same batches and lights for every view.
+static int benchmarkViews(const Options& options, const SceneData& scene, const std::vector<Light>& lights) {
+	std::vector<MeshBounds> bounds;
+	std::vector<uint8_t> alphaTested;
+	std::vector<uint32_t> instanceMeshes;
+	for (auto& instance : scene.instances) {
+		bounds.push_back(instance.bounds);
+		alphaTested.push_back(scene.materials[scene.meshes[instance.mesh].materialId].settings.useAlphaCutoutTexture != 0);
+		instanceMeshes.push_back(instance.mesh);
+	}
+
+	uint32_t instanceCount = static_cast<uint32_t>(bounds.size());
+	uint32_t lightCount = static_cast<uint32_t>(lights.size());
+	const uint32_t iterations = std::max(20u, options.frames);
+	auto allViewProjs = generateViewProjs(options, options.viewCount);
+
+	std::cout << "\nInstances:            " << instanceCount << "\n";
+	std::cout << "Lights:               " << lightCount << "\n";
+	std::cout << "Prepass:              " << getDepthPrepassModeName(options.prepass) << "\n";
+
+	auto elapsedMs = [](std::chrono::high_resolution_clock::time_point start) {
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	};
+
+	int errors = 0;
+	double singleMs = 0.0;
+
+	for (uint32_t count = 1; count <= options.viewCount; count++) {
+		std::vector<ViewFrustum> frustums;
+		for (uint32_t v = 0; v < count; v++) {
+			frustums.push_back(ViewFrustum::fromViewProj(XMLoadFloat4x4(&allViewProjs[v])));
+		}
+
+		std::vector<DrawBatches> naive(count);
+		std::vector<std::vector<uint32_t>> naiveLights(count);
+		std::vector<DrawBatches> batched(count);
+		std::vector<std::vector<uint32_t>> batchedLights(count);
+
+		double naiveMs = 0.0;
+		double batchedMs = 0.0;
+		size_t draws = 0;
+
+		for (uint32_t i = 0; i < iterations; i++) {
+			auto start = std::chrono::high_resolution_clock::now();
+
+			std::vector<uint8_t> visibility(instanceCount);
+			DrawOrder order;
+			for (uint32_t v = 0; v < count; v++) {
+				for (uint32_t b = 0; b < instanceCount; b++) {
+					auto& box = bounds[b];
+					visibility[b] = frustums[v].intersects((box.min.x + box.max.x) * 0.5f, (box.min.y + box.max.y) * 0.5f, (box.min.z + box.max.z) * 0.5f,
+						(box.max.x - box.min.x) * 0.5f, (box.max.y - box.min.y) * 0.5f, (box.max.z - box.min.z) * 0.5f, 0.0f);
+				}
+
+				naiveLights[v].clear();
+				for (uint32_t l = 0; l < lightCount; l++) {
+					auto& position = lights[l].position;
+					if (frustums[v].intersects(position.x, position.y, position.z, 0.0f, 0.0f, 0.0f, lights[l].radius))
+						naiveLights[v].push_back(l);
+				}
+
+				buildDrawOrder(options.prepass, bounds, alphaTested, &visibility, options.cameraPosition, order);
+				buildDrawBatches(order, instanceMeshes, true, naive[v]);
+			}
+
+			naiveMs += elapsedMs(start);
+			start = std::chrono::high_resolution_clock::now();
+
+			CullBounds cullBounds;
+			cullBounds.resize(instanceCount + lightCount);
+			for (uint32_t b = 0; b < instanceCount; b++) {
+				cullBounds.setBox(b, bounds[b]);
+			}
+			for (uint32_t l = 0; l < lightCount; l++) {
+				cullBounds.setSphere(instanceCount + l, lights[l].position, lights[l].radius);
+			}
+
+			std::vector<uint32_t> masks;
+			cullViews(frustums, cullBounds, masks);
+
+			std::vector<uint8_t> anyView(instanceCount);
+			for (uint32_t b = 0; b < instanceCount; b++) {
+				anyView[b] = masks[b] != 0;
+			}
+
+			DrawOrder shared;
+			buildDrawOrder(options.prepass, bounds, alphaTested, &anyView, options.cameraPosition, shared);
+
+			for (uint32_t v = 0; v < count; v++) {
+				buildViewDrawBatches(shared, masks, v, instanceMeshes, true, batched[v]);
+
+				batchedLights[v].clear();
+				for (uint32_t l = 0; l < lightCount; l++) {
+					if (masks[instanceCount + l] & (1u << v))
+						batchedLights[v].push_back(l);
+				}
+			}
+
+			batchedMs += elapsedMs(start);
+		}
+
+		for (uint32_t v = 0; v < count; v++) {
+			auto& a = naive[v];
+			auto& b = batched[v];
+			bool sameBatches = a.batches.size() == b.batches.size() && a.opaqueCount == b.opaqueCount && a.instances == b.instances;
+			for (size_t i = 0; sameBatches && i < a.batches.size(); i++) {
+				sameBatches = a.batches[i].mesh == b.batches[i].mesh && a.batches[i].first == b.batches[i].first && a.batches[i].count == b.batches[i].count;
+			}
+
+			if (!sameBatches || naiveLights[v] != batchedLights[v])
+				errors++;
+
+			draws += b.batches.size();
+		}
+
+		naiveMs /= iterations;
+		batchedMs /= iterations;
+		if (count == 1)
+			singleMs = batchedMs;
+
+		std::cout << std::fixed << std::setprecision(3);
+		std::string label = std::to_string(count) + (count == 1 ? " view:" : " views:");
+		std::cout << label << std::string(22 - label.size(), ' ') << naiveMs << " ms one at a time, " << batchedMs << " ms batched (" << std::setprecision(2)
+			<< (batchedMs > 0.0 ? naiveMs / batchedMs : 0.0) << "x), " << (singleMs > 0.0 ? batchedMs / singleMs : 0.0) << "x one view's cost, "
+			<< draws << " draws" << std::defaultfloat << "\n";
+	}
+
+	std::cout << "Mismatched views:     " << errors << std::endl;
+
+	return errors == 0 ? 0 : 1;
+}
+
+// The app's ambient: the probe baked into a cache next to the output, or the first light's ambient without one.
+static EnvironmentLighting loadEnvironment(const Options& options, JobSystem& jobs, const std::vector<Light>& lights) {
+	EnvironmentLighting environment;
+	if (options.environment == "none") {
+		environment.irradiance = getConstantIrradianceSH(lights[0].ambient);
+		return environment;
+	}
+
+	std::string cachePath = std::filesystem::path(options.out).replace_extension(".env").string();
+	auto stats = bakeEnvironmentLighting(options.environment, cachePath, {}, jobs, environment);
+
+	double bakeMs = stats.loadMs + stats.projectMs + stats.prefilterMs;
+	std::cout << "Environment:          " << (stats.upToDate ? "already baked" : "baked in " + std::to_string(bakeMs) + " ms") << "\n";
+	return environment;
+}
+
+static void setFrameEnvironment(PerFrameUniforms& frame, const EnvironmentLighting& environment, SoftwareRenderOptions& renderOptions) {
+	bool hasSpecular = !environment.specular.texels.empty();
+
+	memcpy(frame.irradianceSH, environment.irradiance.coefficients, sizeof(frame.irradianceSH));
+	frame.environmentParams = XMFLOAT4(hasSpecular ? static_cast<float>(environment.specular.levelCount - 1) : 0.0f, 1.0f, hasSpecular ? 1.0f : 0.0f, 0.0f);
+	renderOptions.environment = hasSpecular ? &environment.specular : nullptr;
+}
+
+// The app's vertex occlusion, read from its cache or baked into it, or left fully open without one.
+static void loadAmbientOcclusion(const Options& options, SceneData& scene, JobSystem& jobs) {
+	if (options.ambientOcclusion == "none")
+		return;
+
+	AmbientOcclusionSettings settings;
+	settings.raysPerVertex = options.ambientOcclusionRays;
+	auto stats = bakeAmbientOcclusion(scene, options.ambientOcclusion, settings, jobs);
+	std::cout << "Occlusion:            " << (stats.upToDate ? "already baked" : "baked in " + std::to_string(stats.totalMs) + " ms") << "\n";
+}
+
+struct OcclusionBake {
+	std::vector<float> occlusion;
+	std::vector<XMFLOAT3> bentNormals;
+};
+
+static OcclusionBake snapshotOcclusion(const SceneData& scene) {
+	OcclusionBake bake;
+	for (auto& mesh : scene.meshes) {
+		for (auto& vertex : mesh.vertices)
+			bake.occlusion.push_back(vertex.occlusion);
+		bake.bentNormals.insert(bake.bentNormals.end(), mesh.bentNormals.begin(), mesh.bentNormals.end());
+	}
+	return bake;
+}
+
+static bool occlusionMatches(const OcclusionBake& a, const OcclusionBake& b) {
+	return a.occlusion.size() == b.occlusion.size() && a.bentNormals.size() == b.bentNormals.size() &&
+		memcmp(a.occlusion.data(), b.occlusion.data(), a.occlusion.size() * sizeof(float)) == 0 &&
+		memcmp(a.bentNormals.data(), b.bentNormals.data(), a.bentNormals.size() * sizeof(XMFLOAT3)) == 0;
+}
+
+// Checks the tree against every triangle and the packets against single rays, then bakes with packets and without,
+// on one thread and on all of them. All three bakes trace the same rays so they have to come out the same to the bit.
+static int benchmarkAmbientOcclusion(const Options& options, SceneData& scene, JobSystem& jobs) {
+	JobSystem single(1);
+	AmbientOcclusionSettings settings;
+	settings.raysPerVertex = options.ambientOcclusionRays;
+	int errors = 0;
+
+	TriangleBVH bvh;
+	bvh.build(scene);
+
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << "Triangles:            " << bvh.getTriangleCount() << ", " << bvh.getReferenceCount() << " after splitting\n";
+	std::cout << "BVH:                  " << bvh.getNodeCount() << " nodes, depth " << bvh.getDepth() << ", built in " << bvh.getBuildMs() << " ms\n";
+
+	// Random rays out of random vertices, the way the bake shoots them. The brute force test does the same maths in a
+	// different order, so a ray grazing an edge can now and then land the other side of it.
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	const uint32_t checkPackets = 5000;
+	uint32_t packetMismatches = 0, bruteForceMismatches = 0, hits = 0;
+
+	if (!scene.instances.empty()) {
+		for (uint32_t p = 0; p < checkPackets; p++) {
+			RayPacket packet;
+			for (uint32_t lane = 0; lane < 4; lane++) {
+				auto& instance = scene.instances[random() % scene.instances.size()];
+				auto& mesh = scene.meshes[instance.mesh];
+				if (mesh.vertices.empty()) {
+					packet.activeMask &= ~(1u << lane);
+					packet.originX[lane] = packet.originY[lane] = packet.originZ[lane] = 0.0f;
+					packet.directionX[lane] = 1.0f;
+					packet.directionY[lane] = packet.directionZ[lane] = 0.0f;
+					packet.maxDistance[lane] = 0.0f;
+					continue;
+				}
+
+				auto& vertex = mesh.vertices[random() % mesh.vertices.size()];
+				auto world = getInstanceWorld(scene.graph, instance);
+				auto normal = XMVector3Normalize(XMVector3TransformNormal(XMLoadFloat3(&vertex.normal), world));
+
+				XMVECTOR direction;
+				do {
+					direction = XMVectorSet(unit(random), unit(random), unit(random), 0.0f);
+				} while (XMVectorGetX(XMVector3LengthSq(direction)) > 1.0f || XMVectorGetX(XMVector3LengthSq(direction)) < 1e-4f);
+				direction = XMVector3Normalize(direction);
+				if (XMVectorGetX(XMVector3Dot(direction, normal)) < 0.0f)
+					direction = XMVectorNegate(direction);
+
+				XMFLOAT3 origin, d;
+				XMStoreFloat3(&origin, XMVectorAdd(XMVector3TransformCoord(XMLoadFloat3(&vertex.position), world), XMVectorScale(normal, settings.bias)));
+				XMStoreFloat3(&d, direction);
+				packet.originX[lane] = origin.x; packet.originY[lane] = origin.y; packet.originZ[lane] = origin.z;
+				packet.directionX[lane] = d.x; packet.directionY[lane] = d.y; packet.directionZ[lane] = d.z;
+				packet.maxDistance[lane] = settings.maxDistance;
+			}
+
+			uint32_t mask = bvh.occluded(packet);
+			for (uint32_t lane = 0; lane < 4; lane++) {
+				if (!(packet.activeMask & (1u << lane)))
+					continue;
+
+				XMFLOAT3 origin = { packet.originX[lane], packet.originY[lane], packet.originZ[lane] };
+				XMFLOAT3 direction = { packet.directionX[lane], packet.directionY[lane], packet.directionZ[lane] };
+				bool packetHit = (mask >> lane) & 1;
+				bool rayHit = bvh.occluded(origin, direction, packet.maxDistance[lane]);
+				bool bruteForceHit = bvh.occludedBruteForce(origin, direction, packet.maxDistance[lane]);
+
+				packetMismatches += packetHit != rayHit;
+				bruteForceMismatches += rayHit != bruteForceHit;
+				hits += rayHit;
+			}
+		}
+	}
+
+	const uint32_t checkRays = checkPackets * 4;
+	bool raysMatch = packetMismatches == 0 && bruteForceMismatches <= checkRays / 10000;
+	errors += !raysMatch;
+	std::cout << "Random rays:          " << checkRays << ", " << hits << " hit, " << packetMismatches << " packet and " << bruteForceMismatches
+		<< " brute force mismatches\n";
+
+	// The bakes write into the scene, so each result is copied out before the next.
+	auto bakeWith = [&](bool packets, JobSystem& bakeJobs, OcclusionBake& out) {
+		AmbientOcclusionSettings bakeSettings = settings;
+		bakeSettings.packets = packets;
+		auto stats = bakeAmbientOcclusion(scene, "", bakeSettings, bakeJobs);
+		out = snapshotOcclusion(scene);
+		return stats;
+	};
+
+	OcclusionBake singlePacketBake, singleRayBake, parallelBake;
+	auto singlePacketStats = bakeWith(true, single, singlePacketBake);
+	auto singleRayStats = bakeWith(false, single, singleRayBake);
+	auto parallelStats = bakeWith(true, jobs, parallelBake);
+
+	bool bakesMatch = occlusionMatches(singlePacketBake, singleRayBake) && occlusionMatches(singlePacketBake, parallelBake);
+	errors += !bakesMatch;
+
+	std::cout << "Vertices:             " << parallelStats.vertices << " over every instance, " << settings.raysPerVertex << " rays each\n";
+	std::cout << std::setprecision(2);
+	std::cout << "Single rays:          " << singleRayStats.traceMs << " ms, " << singleRayStats.raysPerSecond() / 1e6 << " Mrays/s on one thread\n";
+	std::cout << "Packets:              " << singlePacketStats.traceMs << " ms, " << singlePacketStats.raysPerSecond() / 1e6 << " Mrays/s on one thread ("
+		<< (singlePacketStats.traceMs > 0.0 ? singleRayStats.traceMs / singlePacketStats.traceMs : 0.0) << "x)\n";
+	std::cout << "Packets, threaded:    " << parallelStats.traceMs << " ms, " << parallelStats.raysPerSecond() / 1e6 << " Mrays/s on " << jobs.getNumThreads() << " threads ("
+		<< (parallelStats.traceMs > 0.0 ? singlePacketStats.traceMs / parallelStats.traceMs : 0.0) << "x)\n";
+	std::cout << "Bake ms:              " << parallelStats.totalMs << ", " << parallelStats.buildMs << " of it building the BVH, bakes "
+		<< (bakesMatch ? "match" : "differ") << "\n";
+
+	// How dark it came out and how far the open direction leans off the normal, averaged over every vertex.
+	double occlusionSum = 0.0, angleSum = 0.0;
+	size_t bentIndex = 0;
+	for (auto& mesh : scene.meshes) {
+		for (auto& vertex : mesh.vertices) {
+			occlusionSum += vertex.occlusion;
+			float cosine = XMVectorGetX(XMVector3Dot(XMVector3Normalize(XMLoadFloat3(&vertex.normal)), XMLoadFloat3(&parallelBake.bentNormals[bentIndex++])));
+			angleSum += std::acos(std::min(std::max(cosine, -1.0f), 1.0f));
+		}
+	}
+	size_t vertexCount = std::max<size_t>(parallelBake.occlusion.size(), 1);
+	std::cout << "Mean occlusion:       " << occlusionSum / vertexCount << " open, bent normals " << XMConvertToDegrees(static_cast<float>(angleSum / vertexCount))
+		<< " degrees off the normal\n";
+
+	// A bake into an empty cache, then one that should only read it back.
+	std::filesystem::remove(options.ambientOcclusion);
+
+	OcclusionBake baked, cached;
+	auto bakeStats = bakeAmbientOcclusion(scene, options.ambientOcclusion, settings, jobs);
+	baked = snapshotOcclusion(scene);
+	auto cacheStats = bakeAmbientOcclusion(scene, options.ambientOcclusion, settings, jobs);
+	cached = snapshotOcclusion(scene);
+
+	bool cacheMatches = !bakeStats.upToDate && cacheStats.upToDate && occlusionMatches(baked, parallelBake) && occlusionMatches(cached, parallelBake);
+	errors += !cacheMatches;
+
+	std::cout << "Cache ms:             " << cacheStats.totalMs << " to read " << options.ambientOcclusion << ", "
+		<< (cacheMatches ? "matches" : "differs from") << " a fresh bake\n";
+	std::cout << "Failed checks:        " << errors << std::defaultfloat << std::endl;
+
+	return errors == 0 ? 0 : 1;
+}
+
+// Culls every view, then renders it with and without the culled meshes. Any pixel that differs was wrongly culled.
+static void benchmarkOcclusion(const Options& options, const SceneData& scene, JobSystem& jobs, SoftwareRenderer& renderer, const std::vector<Light>& lights, const LightTree& lightTree, const EnvironmentLighting& environment) {
+	OcclusionCuller culler(scene, jobs);
+	culler.setUseAVX2(options.avx2);
+
+	std::cout << "\nOccluders:            " << culler.getNumOccluders() << " instances, " << culler.getStats().occluderTriangles << " triangles\n";
+	std::cout << "AVX2:                 " << (culler.getUseAVX2() ? "yes" : "no") << "\n";
+
+	uint32_t views = std::max(1u, options.sweep);
+
+	OcclusionStats total{};
+	uint64_t wrongPixels = 0;
+	std::vector<uint8_t> visibility;
+
+	for (uint32_t view = 0; view < views; view++) {
+		float yaw = options.yaw + (options.sweep ? XM_2PI * view / views : 0.0f);
+		auto frame = calculatePerFrameUniforms(options.cameraPosition, options.pitch, yaw, options.width, options.height);
+
+		for (uint32_t i = 0; i < options.frames; i++) {
+			culler.cull(frame.viewProj, visibility);
+
+			auto& stats = culler.getStats();
+			total.setupMs += stats.setupMs;
+			total.rasterMs += stats.rasterMs;
+			total.testMs += stats.testMs;
+			total.totalMs += stats.totalMs;
+		}
+
+		auto& stats = culler.getStats();
+		total.rasterizedTriangles += stats.rasterizedTriangles;
+		total.meshesTested += stats.meshesTested;
+		total.frustumCulled += stats.frustumCulled;
+		total.occlusionCulled += stats.occlusionCulled;
+		total.trianglesTested += stats.trianglesTested;
+		total.trianglesCulled += stats.trianglesCulled;
+
+		SoftwareRenderOptions renderOptions;
+		setLightCulling(options, lightTree, renderOptions);
+		setFrameEnvironment(frame, environment, renderOptions);
+
+		std::vector<uint8_t> reference = renderer.render(frame, lights, options.width, options.height, renderOptions);
+
+		renderOptions.instanceVisibility = &visibility;
+		auto& culled = renderer.render(frame, lights, options.width, options.height, renderOptions);
+
+		uint64_t wrong = 0;
+		for (size_t p = 0; p < reference.size(); p += 4) {
+			if (reference[p] != culled[p] || reference[p + 1] != culled[p + 1] || reference[p + 2] != culled[p + 2])
+				wrong++;
+		}
+		wrongPixels += wrong;
+
+		std::cout << "View " << view << ": " << std::fixed << std::setprecision(1) << stats.culledPercent() << "% instances culled ("
+			<< stats.frustumCulled << " frustum, " << stats.occlusionCulled << " occluded), "
+			<< stats.culledTrianglePercent() << "% triangles, " << wrong << " wrong pixels" << std::defaultfloat << std::endl;
+	}
+
+	double runs = static_cast<double>(views) * options.frames;
+
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << "Meshes culled:        " << total.culledPercent() << "% (" << total.frustumCulled << " frustum, " << total.occlusionCulled << " occluded)\n";
+	std::cout << "Triangles culled:     " << total.culledTrianglePercent() << "%\n";
+	std::cout << "Rasterized triangles: " << total.rasterizedTriangles / views << " per view\n";
+	std::cout << "Wrong pixels:         " << wrongPixels << "\n";
+	std::cout << "Setup ms:             " << total.setupMs / runs << "\n";
+	std::cout << "Raster ms:            " << total.rasterMs / runs << "\n";
+	std::cout << "Test ms:              " << total.testMs / runs << "\n";
+	std::cout << "Total ms:             " << total.totalMs / runs << std::defaultfloat << std::endl;
+}
+
+int main(int argc, char** argv) {
+	try {
+		Options options = parseOptions(argc, argv);
+
+		if (options.check)
+			return options.check->run(options, options.checkCount);
+
+		SceneData scene = loadScene(options.sceneDir, options.sceneFile);
+
+		JobSystem jobs(options.threads);
+
+		// Cooking changes the scene's textures under the software renderer, so it goes before one exists.
+		if (options.pack) {
+			reportTexturePacking(options, scene, jobs);
+			return 0;
+		}
+
+		if (options.streamSteps) {
+			simulateTextureStreaming(options, scene, jobs);
+			return 0;
+		}
+
+		if (options.virtualFrames)
+			return simulateVirtualTexturing(options, scene, jobs);
+
+		if (options.bakeAmbientOcclusion)
+			return benchmarkAmbientOcclusion(options, scene, jobs);
+
+		auto lights = createSceneLights();
+		animateSceneLights(lights, options.time);
+		if (options.extraLights) {
+			std::mt19937 random(1234);
+			auto extra = generateLights(options.extraLights, random);
+			lights.insert(lights.end(), extra.begin(), extra.end());
+		}
+
+		LightTree lightTree;
+		if (options.culling == LightCullingMode::TreeSampled) {
+			lightTree.build(lights);
+			std::cout << "Light tree:           " << lightTree.getNodes().size() << " nodes, depth " << lightTree.getDepth() << ", built in " << lightTree.getBuildMs() << " ms\n";
+		}
+
+		if (options.viewCount)
+			return benchmarkViews(options, scene, lights);
+
+		loadAmbientOcclusion(options, scene, jobs);
+		SoftwareRenderer renderer(scene, jobs);
+		EnvironmentLighting environment = loadEnvironment(options, jobs, lights);
+
+		if (options.occlusion) {
+			benchmarkOcclusion(options, scene, jobs, renderer, lights, lightTree, environment);
+			return 0;
+		}
+
+		if (options.overdraw) {
+			measureOverdraw(options, scene, renderer, lights, lightTree);
+			return 0;
+		}
+
+		auto frame = calculatePerFrameUniforms(options.cameraPosition, options.pitch, options.yaw, options.width, options.height);
+
+		DrawOrder order;
+		buildSceneDrawOrder(scene, options.prepass, nullptr, options.cameraPosition, order);
+
+		SoftwareRenderOptions renderOptions;
+		setLightCulling(options, lightTree, renderOptions);
+		renderOptions.instanceOrder = &order.instances;
+		renderOptions.depthPrepass = options.prepass == DepthPrepassMode::Prepass;
+		setFrameEnvironment(frame, environment, renderOptions);
+
+		SoftwareRenderStats total{};
+		for (uint32_t i = 0; i < options.frames; i++) {
+			renderer.render(frame, lights, options.width, options.height, renderOptions);
+
+			auto& stats = renderer.getStats();
+			total.setupMs += stats.setupMs;
+			total.geometryMs += stats.geometryMs;
+			total.lightingMs += stats.lightingMs;
+			total.totalMs += stats.totalMs;
+		}
+
+		auto& stats = renderer.getStats();
+		double frames = static_cast<double>(options.frames);
+
+		std::cout << "\nThreads:              " << jobs.getNumThreads() << "\n";
+		std::cout << "Resolution:           " << options.width << "x" << options.height << "\n";
+		std::cout << "Lights:               " << lights.size() << "\n";
+		std::cout << "Instances:            " << scene.instances.size() << " of " << scene.meshes.size() << " unique meshes\n";
+		std::cout << "Draw calls:           " << countDrawCalls(scene, order, true) << " instanced, " << countDrawCalls(scene, order, false) << " without\n";
+		std::cout << "Triangles submitted:  " << stats.trianglesSubmitted << "\n";
+		std::cout << "Triangles binned:     " << stats.trianglesBinned << "\n";
+		std::cout << "Tile references:      " << stats.tileReferences << "\n";
+		std::cout << "Fragments shaded:     " << stats.fragmentsShaded << "\n";
+		std::cout << "Fragments discarded:  " << stats.fragmentsDiscarded << "\n";
+		std::cout << "Depth only fragments: " << stats.depthFragments << "\n";
+		std::cout << "Overdraw:             " << stats.overdraw() << "\n";
+		std::cout << "Pixels lit:           " << stats.pixelsLit << "\n";
+		std::cout << "Light evaluations:    " << stats.lightEvaluations << "\n";
+		std::cout << std::fixed << std::setprecision(3);
+		std::cout << "Setup ms:             " << total.setupMs / frames << "\n";
+		std::cout << "Geometry ms:          " << total.geometryMs / frames << "\n";
+		std::cout << "Lighting ms:          " << total.lightingMs / frames << "\n";
+		std::cout << "Total ms:             " << total.totalMs / frames << std::endl;
+
+		if (!stbi_write_png(options.out.c_str(), options.width, options.height, 4, renderer.getImage().data(), options.width * 4)) {
+			throw std::runtime_error("Failed to write " + options.out);
+		}
+
+		std::cout << "Wrote " << options.out << std::endl;
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}